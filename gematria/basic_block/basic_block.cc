@@ -22,6 +22,8 @@
 
 #include "absl/log/absl_check.h"
 #include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "gematria/basic_block/token_table.h"
 
 namespace gematria {
 
@@ -89,7 +91,7 @@ bool InstructionOperand::operator==(const InstructionOperand& other) const {
     case OperandType::kUnknown:
       return true;
     case OperandType::kRegister:
-      return register_name() == other.register_name();
+      return register_token() == other.register_token();
     case OperandType::kImmediateValue:
       return immediate_value() == other.immediate_value();
     case OperandType::kFpImmediateValue:
@@ -102,10 +104,10 @@ bool InstructionOperand::operator==(const InstructionOperand& other) const {
 }
 
 InstructionOperand InstructionOperand::Register(
-    const std::string register_name) {
+    absl::string_view register_name) {
   InstructionOperand result;
   result.type_ = OperandType::kRegister;
-  result.register_name_ = std::move(register_name);
+  result.register_token_ = TokenTable::Global().Intern(register_name);
   return result;
 }
 
@@ -129,6 +131,7 @@ InstructionOperand InstructionOperand::Address(AddressTuple address_tuple) {
   InstructionOperand result;
   result.type_ = OperandType::kAddress;
   result.address_ = std::move(address_tuple);
+  result.InternAddressRegisters();
   return result;
 }
 
@@ -144,9 +147,21 @@ InstructionOperand InstructionOperand::Address(std::string base_register,
   result.address_.displacement = displacement;
   result.address_.scaling = scaling;
   result.address_.segment_register = segment_register;
+  result.InternAddressRegisters();
   return result;
 }
 
+void InstructionOperand::InternAddressRegisters() {
+  TokenTable& token_table = TokenTable::Global();
+  const auto intern = [&token_table](const std::string& register_name) {
+    return register_name.empty() ? TokenTable::kEmptyTokenId
+                                 : token_table.Intern(register_name);
+  };
+  address_base_register_token_ = intern(address_.base_register);
+  address_index_register_token_ = intern(address_.index_register);
+  address_segment_register_token_ = intern(address_.segment_register);
+}
+
 InstructionOperand InstructionOperand::MemoryLocation(int alias_group_id) {
   InstructionOperand result;
   result.type_ = OperandType::kMemory;
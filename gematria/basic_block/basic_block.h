@@ -30,6 +30,7 @@
 
 #include "absl/log/absl_check.h"
 #include "absl/strings/string_view.h"
+#include "gematria/basic_block/token_table.h"
 
 namespace gematria {
 
@@ -127,6 +128,10 @@ std::ostream& operator<<(std::ostream& os, const AddressTuple& address_tuple);
 // Represents a single operand of an instruction. Only the getters related to
 // the represented operand type may be used; use of methods that are not valid
 // for the represented operand type will lead to undefined behavior.
+//
+// Register names are interned in the global token table, so register operands
+// do not own any strings and they can be compared and hashed by their integer
+// token ID.
 class InstructionOperand {
  public:
   // Creates an operand of type kUnknown.
@@ -140,7 +145,7 @@ class InstructionOperand {
   InstructionOperand& operator=(InstructionOperand&&) = default;
 
   // The operands must be created through one of the factory functions.
-  static InstructionOperand Register(std::string register_name);
+  static InstructionOperand Register(absl::string_view register_name);
   static InstructionOperand ImmediateValue(uint64_t immediate_value);
   static InstructionOperand FpImmediateValue(double fp_immediate_value);
   static InstructionOperand Address(AddressTuple address_tuple);
@@ -175,7 +180,14 @@ class InstructionOperand {
   // Returns the name of the register. Valid only when type() is kRegister.
   const std::string& register_name() const {
     ABSL_DCHECK_EQ(type_, OperandType::kRegister);
-    return register_name_;
+    return TokenTable::Global().Name(register_token_);
+  }
+
+  // Returns the ID of the name of the register in the global token table. Valid
+  // only when type() is kRegister.
+  TokenId register_token() const {
+    ABSL_DCHECK_EQ(type_, OperandType::kRegister);
+    return register_token_;
   }
 
   // Returns the immediate value in the operand. Valid only when type() is
@@ -199,6 +211,23 @@ class InstructionOperand {
     return address_;
   }
 
+  // Return the IDs of the names of the base, index, and segment registers of
+  // the address in the global token table, or TokenTable::kEmptyTokenId when
+  // the address does not use the register. The names are interned when the
+  // operand is created. Valid only when type() is kAddress.
+  TokenId address_base_register_token() const {
+    ABSL_DCHECK_EQ(type_, OperandType::kAddress);
+    return address_base_register_token_;
+  }
+  TokenId address_index_register_token() const {
+    ABSL_DCHECK_EQ(type_, OperandType::kAddress);
+    return address_index_register_token_;
+  }
+  TokenId address_segment_register_token() const {
+    ABSL_DCHECK_EQ(type_, OperandType::kAddress);
+    return address_segment_register_token_;
+  }
+
   // Returns the alias group ID of the memory access in the operand. Valid only
   // when type() is kMemory.
   int alias_group_id() const {
@@ -207,12 +236,18 @@ class InstructionOperand {
   }
 
  private:
+  // Interns the names of the registers of `address_` and stores their IDs.
+  void InternAddressRegisters();
+
   OperandType type_ = OperandType::kUnknown;
 
-  std::string register_name_;
+  TokenId register_token_ = TokenTable::kEmptyTokenId;
   uint64_t immediate_value_ = 0;
   double fp_immediate_value_ = 0.0;
   AddressTuple address_;
+  TokenId address_base_register_token_ = TokenTable::kEmptyTokenId;
+  TokenId address_index_register_token_ = TokenTable::kEmptyTokenId;
+  TokenId address_segment_register_token_ = TokenTable::kEmptyTokenId;
   int alias_group_id_ = 0;
 };
 
@@ -20,6 +20,7 @@
 #include <vector>
 
 #include "gematria/basic_block/basic_block.h"
+#include "gematria/basic_block/packed_basic_block.h"
 #include "gematria/proto/canonicalized_instruction.pb.h"
 #include "google/protobuf/repeated_ptr_field.h"
 
@@ -38,14 +39,19 @@ AddressTuple AddressTupleFromProto(
 CanonicalizedOperandProto::AddressTuple ProtoFromAddressTuple(
     const AddressTuple& address_tuple) {
   CanonicalizedOperandProto::AddressTuple proto;
-  proto.set_base_register(address_tuple.base_register);
-  proto.set_displacement(address_tuple.displacement);
-  proto.set_index_register(address_tuple.index_register);
-  proto.set_scaling(address_tuple.scaling);
-  proto.set_segment(address_tuple.segment_register);
+  AppendAddressTupleToProto(address_tuple, &proto);
   return proto;
 }
 
+void AppendAddressTupleToProto(const AddressTuple& address_tuple,
+                               CanonicalizedOperandProto::AddressTuple* proto) {
+  proto->set_base_register(address_tuple.base_register);
+  proto->set_displacement(address_tuple.displacement);
+  proto->set_index_register(address_tuple.index_register);
+  proto->set_scaling(address_tuple.scaling);
+  proto->set_segment(address_tuple.segment_register);
+}
+
 InstructionOperand InstructionOperandFromProto(
     const CanonicalizedOperandProto& proto) {
   switch (proto.operand_case()) {
@@ -69,26 +75,31 @@ InstructionOperand InstructionOperandFromProto(
 CanonicalizedOperandProto ProtoFromInstructionOperand(
     const InstructionOperand& operand) {
   CanonicalizedOperandProto proto;
+  AppendInstructionOperandToProto(operand, &proto);
+  return proto;
+}
+
+void AppendInstructionOperandToProto(const InstructionOperand& operand,
+                                     CanonicalizedOperandProto* proto) {
   switch (operand.type()) {
     case OperandType::kRegister:
-      proto.set_register_name(operand.register_name());
+      proto->set_register_name(operand.register_name());
       break;
     case OperandType::kImmediateValue:
-      proto.set_immediate_value(operand.immediate_value());
+      proto->set_immediate_value(operand.immediate_value());
       break;
     case OperandType::kFpImmediateValue:
-      proto.set_fp_immediate_value(operand.fp_immediate_value());
+      proto->set_fp_immediate_value(operand.fp_immediate_value());
       break;
     case OperandType::kAddress:
-      *proto.mutable_address() = ProtoFromAddressTuple(operand.address());
+      AppendAddressTupleToProto(operand.address(), proto->mutable_address());
       break;
     case OperandType::kMemory:
-      proto.mutable_memory()->set_alias_group_id(operand.alias_group_id());
+      proto->mutable_memory()->set_alias_group_id(operand.alias_group_id());
       break;
     case OperandType::kUnknown:
       break;
   }
-  return proto;
 }
 
 namespace {
@@ -107,9 +118,9 @@ void ToRepeatedPtrField(
     google::protobuf::RepeatedPtrField<CanonicalizedOperandProto>*
         repeated_field) {
   repeated_field->Reserve(operands.size());
-  std::transform(operands.begin(), operands.end(),
-                 google::protobuf::RepeatedFieldBackInserter(repeated_field),
-                 ProtoFromInstructionOperand);
+  for (const InstructionOperand& operand : operands) {
+    AppendInstructionOperandToProto(operand, repeated_field->Add());
+  }
 }
 
 }  // namespace
@@ -131,19 +142,24 @@ Instruction InstructionFromProto(const CanonicalizedInstructionProto& proto) {
 CanonicalizedInstructionProto ProtoFromInstruction(
     const Instruction& instruction) {
   CanonicalizedInstructionProto proto;
-  proto.set_mnemonic(instruction.mnemonic);
-  proto.set_llvm_mnemonic(instruction.llvm_mnemonic);
-  proto.mutable_prefixes()->Assign(instruction.prefixes.begin(),
-                                   instruction.prefixes.end());
+  AppendInstructionToProto(instruction, &proto);
+  return proto;
+}
+
+void AppendInstructionToProto(const Instruction& instruction,
+                              CanonicalizedInstructionProto* proto) {
+  proto->set_mnemonic(instruction.mnemonic);
+  proto->set_llvm_mnemonic(instruction.llvm_mnemonic);
+  proto->mutable_prefixes()->Assign(instruction.prefixes.begin(),
+                                    instruction.prefixes.end());
   ToRepeatedPtrField(instruction.input_operands,
-                     proto.mutable_input_operands());
+                     proto->mutable_input_operands());
   ToRepeatedPtrField(instruction.implicit_input_operands,
-                     proto.mutable_implicit_input_operands());
+                     proto->mutable_implicit_input_operands());
   ToRepeatedPtrField(instruction.output_operands,
-                     proto.mutable_output_operands());
+                     proto->mutable_output_operands());
   ToRepeatedPtrField(instruction.implicit_output_operands,
-                     proto.mutable_implicit_output_operands());
-  return proto;
+                     proto->mutable_implicit_output_operands());
 }
 
 namespace {
@@ -164,4 +180,68 @@ BasicBlock BasicBlockFromProto(const BasicBlockProto& proto) {
       /* instructions = */ ToVector(proto.canonicalized_instructions()));
 }
 
+namespace {
+
+void AddOperandsToPackedBasicBlock(
+    const google::protobuf::RepeatedPtrField<CanonicalizedOperandProto>&
+        protos,
+    OperandList list, PackedBasicBlock& block) {
+  for (const CanonicalizedOperandProto& proto : protos) {
+    switch (proto.operand_case()) {
+      case CanonicalizedOperandProto::OPERAND_NOT_SET:
+        block.AddUnknownOperand(list);
+        break;
+      case CanonicalizedOperandProto::kRegisterName:
+        block.AddRegisterOperand(list, proto.register_name());
+        break;
+      case CanonicalizedOperandProto::kImmediateValue:
+        block.AddImmediateValueOperand(list, proto.immediate_value());
+        break;
+      case CanonicalizedOperandProto::kFpImmediateValue:
+        block.AddFpImmediateValueOperand(list, proto.fp_immediate_value());
+        break;
+      case CanonicalizedOperandProto::kAddress: {
+        const CanonicalizedOperandProto::AddressTuple& address =
+            proto.address();
+        block.AddAddressOperand(list, address.base_register(),
+                                address.displacement(),
+                                address.index_register(), address.scaling(),
+                                address.segment());
+      } break;
+      case CanonicalizedOperandProto::kMemory:
+        block.AddMemoryOperand(list, proto.memory().alias_group_id());
+        break;
+    }
+  }
+}
+
+}  // namespace
+
+PackedBasicBlock PackedBasicBlockFromProto(const BasicBlockProto& proto) {
+  PackedBasicBlock block;
+  PackedBasicBlockFromProto(proto, block);
+  return block;
+}
+
+void PackedBasicBlockFromProto(const BasicBlockProto& proto,
+                               PackedBasicBlock& block) {
+  block.Clear();
+  for (const CanonicalizedInstructionProto& instruction :
+       proto.canonicalized_instructions()) {
+    block.BeginInstruction(instruction.mnemonic(),
+                           instruction.llvm_mnemonic());
+    for (const std::string& prefix : instruction.prefixes()) {
+      block.AddPrefix(prefix);
+    }
+    AddOperandsToPackedBasicBlock(instruction.input_operands(),
+                                  OperandList::kInput, block);
+    AddOperandsToPackedBasicBlock(instruction.implicit_input_operands(),
+                                  OperandList::kImplicitInput, block);
+    AddOperandsToPackedBasicBlock(instruction.output_operands(),
+                                  OperandList::kOutput, block);
+    AddOperandsToPackedBasicBlock(instruction.implicit_output_operands(),
+                                  OperandList::kImplicitOutput, block);
+  }
+}
+
 }  // namespace gematria
@@ -20,6 +20,7 @@
 #define GEMATRIA_BASIC_BLOCK_BASIC_BLOCK_PROTOS_H_
 
 #include "gematria/basic_block/basic_block.h"
+#include "gematria/basic_block/packed_basic_block.h"
 #include "gematria/proto/basic_block.pb.h"
 #include "gematria/proto/canonicalized_instruction.pb.h"
 
@@ -33,6 +34,13 @@ AddressTuple AddressTupleFromProto(
 CanonicalizedOperandProto::AddressTuple ProtoFromAddressTuple(
     const AddressTuple& address_tuple);
 
+// A version of ProtoFromAddressTuple() that stores the address tuple directly
+// in `proto`, e.g. in the message returned by
+// CanonicalizedOperandProto::mutable_address(). Overwrites all fields of
+// `proto`.
+void AppendAddressTupleToProto(const AddressTuple& address_tuple,
+                               CanonicalizedOperandProto::AddressTuple* proto);
+
 // Creates an instruction operand data structure from a proto.
 InstructionOperand InstructionOperandFromProto(
     const CanonicalizedOperandProto& proto);
@@ -41,6 +49,12 @@ InstructionOperand InstructionOperandFromProto(
 CanonicalizedOperandProto ProtoFromInstructionOperand(
     const InstructionOperand& operand);
 
+// A version of ProtoFromInstructionOperand() that stores the operand directly
+// in `proto`, e.g. in a new element of a repeated operand field of the parent
+// instruction proto. Expects that `proto` is empty.
+void AppendInstructionOperandToProto(const InstructionOperand& operand,
+                                     CanonicalizedOperandProto* proto);
+
 // Creates an instruction data structure from a proto.
 Instruction InstructionFromProto(const CanonicalizedInstructionProto& proto);
 
@@ -48,9 +62,29 @@ Instruction InstructionFromProto(const CanonicalizedInstructionProto& proto);
 CanonicalizedInstructionProto ProtoFromInstruction(
     const Instruction& instruction);
 
+// A version of ProtoFromInstruction() that stores the instruction directly in
+// `proto`, typically a new element of the repeated field of the parent basic
+// block proto:
+//   AppendInstructionToProto(instruction,
+//                            block.add_canonicalized_instructions());
+// Expects that `proto` is empty. All sub-messages are created in place, i.e. on
+// the arena of `proto` when it is allocated on an arena, and no intermediate
+// protos are created or copied.
+void AppendInstructionToProto(const Instruction& instruction,
+                              CanonicalizedInstructionProto* proto);
+
 // Creates a basic block data structure from a proto.
 BasicBlock BasicBlockFromProto(const BasicBlockProto& proto);
 
+// Creates a packed basic block from a proto. Does not create the intermediate
+// Instruction and InstructionOperand objects.
+PackedBasicBlock PackedBasicBlockFromProto(const BasicBlockProto& proto);
+
+// A version of PackedBasicBlockFromProto() that stores the basic block in
+// `block`. Replaces the previous contents of `block` but reuses its memory.
+void PackedBasicBlockFromProto(const BasicBlockProto& proto,
+                               PackedBasicBlock& block);
+
 }  // namespace gematria
 
 #endif  // GEMATRIA_BASIC_BLOCK_BASIC_BLOCK_PROTOS_H_
@@ -0,0 +1,119 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Microbenchmarks for the conversion of basic block protos to the C++ data
+// structures. The benchmarks report the number of basic blocks per second as
+// "items_per_second", and the number of instructions per second as
+// "instructions".
+//
+// Run with:
+//   bazel run -c opt //gematria/basic_block:basic_block_protos_benchmark
+
+#include <cstdint>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "gematria/basic_block/basic_block.h"
+#include "gematria/basic_block/basic_block_protos.h"
+#include "gematria/basic_block/packed_basic_block.h"
+#include "gematria/proto/basic_block.pb.h"
+#include "gematria/proto/throughput.pb.h"
+#include "gematria/testing/basic_blocks.h"
+
+namespace gematria {
+namespace {
+
+// The path of the benchmark binary; set by main().
+const char* argv0 = nullptr;
+
+// Returns the basic blocks from the test data. They are loaded on first use, so
+// that they are not loaded when the benchmarks are only listed.
+const std::vector<BasicBlockProto>& TestProtos() {
+  static const std::vector<BasicBlockProto>* const protos = [] {
+    const BasicBlockWithThroughputListProto test_protos =
+        LoadBasicBlocksWithThroughputFromTestData(argv0);
+    auto* protos = new std::vector<BasicBlockProto>();
+    for (const BasicBlockWithThroughputProto& proto :
+         test_protos.basic_blocks()) {
+      protos->push_back(proto.basic_block());
+    }
+    return protos;
+  }();
+  return *protos;
+}
+
+void SetCounters(benchmark::State& state, int64_t num_blocks,
+                 int64_t num_instructions) {
+  state.SetItemsProcessed(num_blocks);
+  state.counters["instructions"] =
+      benchmark::Counter(num_instructions, benchmark::Counter::kIsRate);
+}
+
+// Converts all basic blocks from the test data.
+void BM_BasicBlockFromProto_TestData(benchmark::State& state) {
+  const std::vector<BasicBlockProto>& protos = TestProtos();
+  int64_t instructions_per_iteration = 0;
+  for (const BasicBlockProto& proto : protos) {
+    instructions_per_iteration += proto.canonicalized_instructions_size();
+  }
+  for (auto _ : state) {
+    for (const BasicBlockProto& proto : protos) {
+      BasicBlock block = BasicBlockFromProto(proto);
+      benchmark::DoNotOptimize(block);
+    }
+  }
+  SetCounters(state, state.iterations() * protos.size(),
+              state.iterations() * instructions_per_iteration);
+}
+BENCHMARK(BM_BasicBlockFromProto_TestData);
+
+// Converts a synthetic basic block with `state.range(0)` instructions.
+void BM_BasicBlockFromProto_Synthetic(benchmark::State& state) {
+  const int num_instructions = state.range(0);
+  const BasicBlockProto proto = SyntheticBasicBlockProto(num_instructions);
+  for (auto _ : state) {
+    BasicBlock block = BasicBlockFromProto(proto);
+    benchmark::DoNotOptimize(block);
+  }
+  SetCounters(state, state.iterations(),
+              state.iterations() * num_instructions);
+}
+BENCHMARK(BM_BasicBlockFromProto_Synthetic)->Arg(16)->Arg(64)->Arg(256);
+
+// Converts a synthetic basic block with `state.range(0)` instructions to a
+// packed basic block, reusing the memory of the packed block.
+void BM_PackedBasicBlockFromProto_Synthetic(benchmark::State& state) {
+  const int num_instructions = state.range(0);
+  const BasicBlockProto proto = SyntheticBasicBlockProto(num_instructions);
+  PackedBasicBlock block;
+  for (auto _ : state) {
+    PackedBasicBlockFromProto(proto, block);
+    benchmark::DoNotOptimize(block);
+  }
+  SetCounters(state, state.iterations(),
+              state.iterations() * num_instructions);
+}
+BENCHMARK(BM_PackedBasicBlockFromProto_Synthetic)->Arg(16)->Arg(64)->Arg(256);
+
+}  // namespace
+}  // namespace gematria
+
+int main(int argc, char* argv[]) {
+  gematria::argv0 = argv[0];
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
@@ -15,11 +15,13 @@
 #include "gematria/basic_block/basic_block_protos.h"
 
 #include "gematria/basic_block/basic_block.h"
+#include "gematria/basic_block/packed_basic_block.h"
 #include "gematria/proto/basic_block.pb.h"
 #include "gematria/proto/canonicalized_instruction.pb.h"
 #include "gematria/testing/matchers.h"
 #include "gematria/testing/parse_proto.h"
 #include "gmock/gmock.h"
+#include "google/protobuf/arena.h"
 #include "gtest/gtest.h"
 
 namespace gematria {
@@ -198,6 +200,56 @@ TEST(ProtoFromInstructionTest, AllFields) {
               )pb"));
 }
 
+TEST(AppendInstructionToProtoTest, OnArena) {
+  google::protobuf::Arena arena;
+  BasicBlockProto* const block =
+      google::protobuf::Arena::CreateMessage<BasicBlockProto>(&arena);
+  AppendInstructionToProto(
+      Instruction(
+          /* mnemonic = */ "MOV", /* llvm_mnemonic = */ "MOV64rm",
+          /* prefixes = */ {"LOCK"},
+          /* input_operands = */
+          {InstructionOperand::MemoryLocation(1),
+           InstructionOperand::Address(/* base_register = */ "RSI",
+                                       /* displacement = */ 16,
+                                       /* index_register = */ "",
+                                       /* scaling = */ 1,
+                                       /* segment_register = */ "")},
+          /* implicit_input_operands = */ {},
+          /* output_operands = */ {InstructionOperand::Register("RAX")},
+          /* implicit_output_operands = */ {}),
+      block->add_canonicalized_instructions());
+  AppendInstructionToProto(
+      Instruction(
+          /* mnemonic = */ "NOT", /* llvm_mnemonic = */ "NOT64r",
+          /* prefixes = */ {},
+          /* input_operands = */ {InstructionOperand::Register("RAX")},
+          /* implicit_input_operands = */ {},
+          /* output_operands = */ {InstructionOperand::Register("RAX")},
+          /* implicit_output_operands = */ {}),
+      block->add_canonicalized_instructions());
+
+  EXPECT_EQ(block->canonicalized_instructions(0).GetArena(), &arena);
+  EXPECT_THAT(*block, EqualsProto(R"pb(
+                canonicalized_instructions {
+                  mnemonic: "MOV"
+                  llvm_mnemonic: "MOV64rm"
+                  prefixes: "LOCK"
+                  output_operands { register_name: "RAX" }
+                  input_operands { memory { alias_group_id: 1 } }
+                  input_operands {
+                    address { base_register: "RSI" displacement: 16 scaling: 1 }
+                  }
+                }
+                canonicalized_instructions {
+                  mnemonic: "NOT"
+                  llvm_mnemonic: "NOT64r"
+                  output_operands { register_name: "RAX" }
+                  input_operands { register_name: "RAX" }
+                }
+              )pb"));
+}
+
 TEST(BasicBlockFromProtoTest, SomeInstructions) {
   const BasicBlockProto proto = ParseTextProto(R"pb(
     canonicalized_instructions: {
@@ -234,5 +286,46 @@ TEST(BasicBlockFromProtoTest, SomeInstructions) {
                /* implicit_output_operands = */ {})}));
 }
 
+TEST(PackedBasicBlockFromProtoTest, AllOperandTypes) {
+  const BasicBlockProto proto = ParseTextProto(R"pb(
+    canonicalized_instructions: {
+      mnemonic: "ADD"
+      llvm_mnemonic: "ADD64mi32"
+      prefixes: "LOCK"
+      input_operands: { memory: { alias_group_id: 1 } }
+      input_operands: {
+        address: {
+          base_register: "RSI"
+          displacement: -16
+          index_register: "RDI"
+          scaling: 2
+          segment: "FS"
+        }
+      }
+      input_operands: { immediate_value: 123 }
+      output_operands: { memory: { alias_group_id: 1 } }
+      implicit_output_operands: { register_name: "EFLAGS" }
+    }
+    canonicalized_instructions: {
+      mnemonic: "MOV"
+      llvm_mnemonic: "MOV64ri"
+      output_operands: { register_name: "RCX" }
+      input_operands: { fp_immediate_value: 0.5 }
+      implicit_input_operands: {}
+    }
+  )pb");
+  const PackedBasicBlock block = PackedBasicBlockFromProto(proto);
+  EXPECT_EQ(block.num_instructions(), 2);
+  EXPECT_EQ(block.ToBasicBlock(), BasicBlockFromProto(proto));
+
+  // Check that the version with an output argument replaces the contents of
+  // the block.
+  PackedBasicBlock reused_block(BasicBlockFromProto(proto));
+  PackedBasicBlockFromProto(BasicBlockProto(), reused_block);
+  EXPECT_EQ(reused_block.num_instructions(), 0);
+  PackedBasicBlockFromProto(proto, reused_block);
+  EXPECT_EQ(reused_block.ToBasicBlock(), BasicBlockFromProto(proto));
+}
+
 }  // namespace
 }  // namespace gematria
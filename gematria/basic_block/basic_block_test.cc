@@ -18,6 +18,7 @@
 #include <string>
 #include <vector>
 
+#include "gematria/basic_block/token_table.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 
@@ -163,6 +164,11 @@ TEST(InstructionOperandTest, ConstructorRegister) {
   const auto operand = InstructionOperand::Register("R10");
   EXPECT_EQ(operand.type(), OperandType::kRegister);
   EXPECT_EQ(operand.register_name(), "R10");
+  EXPECT_EQ(operand.register_token(), TokenTable::Global().Find("R10"));
+  EXPECT_EQ(InstructionOperand::Register("R10").register_token(),
+            operand.register_token());
+  EXPECT_NE(InstructionOperand::Register("R11").register_token(),
+            operand.register_token());
 }
 
 TEST(InstructionOperandTest, ConstructorImmediateValue) {
@@ -183,12 +189,24 @@ TEST(InstructionOperandTest, ConstructorAddressFromTuple) {
   const auto operand = InstructionOperand::Address(address);
   EXPECT_EQ(operand.type(), OperandType::kAddress);
   EXPECT_EQ(operand.address(), address);
+  EXPECT_EQ(operand.address_base_register_token(),
+            TokenTable::Global().Find("RSI"));
+  EXPECT_EQ(operand.address_index_register_token(),
+            TokenTable::Global().Find("RDI"));
+  EXPECT_EQ(operand.address_segment_register_token(),
+            TokenTable::kEmptyTokenId);
 }
 
 TEST(InstructionOperandTest, ConstructorAddressFromArguments) {
   const auto operand = InstructionOperand::Address("RSI", -16, "RDI", 0, "");
   EXPECT_EQ(operand.type(), OperandType::kAddress);
   EXPECT_EQ(operand.address(), AddressTuple("RSI", -16, "RDI", 0, ""));
+  EXPECT_EQ(operand.address_base_register_token(),
+            TokenTable::Global().Find("RSI"));
+  EXPECT_EQ(operand.address_index_register_token(),
+            TokenTable::Global().Find("RDI"));
+  EXPECT_EQ(operand.address_segment_register_token(),
+            TokenTable::kEmptyTokenId);
 }
 
 TEST(InstructionOperandTest, ConstructorFromMemoryLocation) {
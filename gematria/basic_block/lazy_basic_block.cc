@@ -0,0 +1,101 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "gematria/basic_block/lazy_basic_block.h"
+
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "absl/log/absl_check.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "gematria/basic_block/basic_block.h"
+#include "gematria/basic_block/basic_block_protos.h"
+#include "gematria/basic_block/packed_basic_block.h"
+#include "gematria/proto/basic_block.pb.h"
+
+namespace gematria {
+
+LazyBasicBlock::LazyBasicBlock(const BasicBlockProto& proto)
+    : has_serialized_proto_(true),
+      serialized_proto_(proto.SerializeAsString()),
+      num_serialized_instructions_(proto.canonicalized_instructions_size()) {}
+
+LazyBasicBlock::LazyBasicBlock(PackedBasicBlock block)
+    : packed_block_(
+          std::make_shared<const PackedBasicBlock>(std::move(block))) {}
+
+LazyBasicBlock::LazyBasicBlock(BasicBlock block)
+    : block_(std::make_unique<BasicBlock>(std::move(block))) {}
+
+LazyBasicBlock::LazyBasicBlock(const LazyBasicBlock& other)
+    : has_serialized_proto_(other.has_serialized_proto_),
+      serialized_proto_(other.serialized_proto_),
+      num_serialized_instructions_(other.num_serialized_instructions_),
+      packed_block_(other.packed_block_) {
+  if (other.block_ != nullptr) {
+    block_ = std::make_unique<BasicBlock>(*other.block_);
+  }
+}
+
+LazyBasicBlock& LazyBasicBlock::operator=(const LazyBasicBlock& other) {
+  if (this != &other) {
+    LazyBasicBlock copy(other);
+    *this = std::move(copy);
+  }
+  return *this;
+}
+
+absl::StatusOr<LazyBasicBlock> LazyBasicBlock::FromSerializedProto(
+    std::string serialized_proto) {
+  BasicBlockProto proto;
+  if (!proto.ParseFromString(serialized_proto)) {
+    return absl::InvalidArgumentError("Could not parse the BasicBlockProto");
+  }
+  LazyBasicBlock block;
+  block.has_serialized_proto_ = true;
+  block.serialized_proto_ = std::move(serialized_proto);
+  block.num_serialized_instructions_ = proto.canonicalized_instructions_size();
+  return block;
+}
+
+const BasicBlock& LazyBasicBlock::block() const {
+  if (block_ != nullptr) return *block_;
+  if (packed_block_ != nullptr) {
+    block_ = std::make_unique<BasicBlock>(packed_block_->ToBasicBlock());
+  } else if (has_serialized_proto_) {
+    BasicBlockProto proto;
+    // The proto was either created by this class or it was checked in
+    // FromSerializedProto().
+    ABSL_CHECK(proto.ParseFromString(serialized_proto_));
+    block_ = std::make_unique<BasicBlock>(BasicBlockFromProto(proto));
+  } else {
+    block_ = std::make_unique<BasicBlock>();
+  }
+  return *block_;
+}
+
+BasicBlock& LazyBasicBlock::mutable_block() {
+  block();
+  return *block_;
+}
+
+int LazyBasicBlock::num_instructions() const {
+  if (block_ != nullptr) return static_cast<int>(block_->instructions.size());
+  if (packed_block_ != nullptr) return packed_block_->num_instructions();
+  return num_serialized_instructions_;
+}
+
+}  // namespace gematria
@@ -0,0 +1,114 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Contains a basic block handle that creates the BasicBlock data structure only
+// when it is needed.
+//
+// Datasets held in memory by the Python code typically contain many basic
+// blocks that are only passed to a graph builder or a tokenizer, and never
+// inspected otherwise. Converting all of them to BasicBlock needs many small
+// allocations per instruction. LazyBasicBlock keeps the basic block in a
+// compact form, either as a serialized BasicBlockProto or as a packed basic
+// block, and creates the BasicBlock only on the first call to block(). Clients
+// that can consume the compact form directly can use serialized_proto() and
+// packed_block() to avoid the conversion entirely.
+
+#ifndef GEMATRIA_BASIC_BLOCK_LAZY_BASIC_BLOCK_H_
+#define GEMATRIA_BASIC_BLOCK_LAZY_BASIC_BLOCK_H_
+
+#include <memory>
+#include <string>
+
+#include "absl/status/statusor.h"
+#include "gematria/basic_block/basic_block.h"
+#include "gematria/basic_block/packed_basic_block.h"
+#include "gematria/proto/basic_block.pb.h"
+
+namespace gematria {
+
+// A basic block that is materialized as BasicBlock on demand. See the
+// top-level comment for more details.
+//
+// Once the BasicBlock is materialized, it is the authoritative version of the
+// basic block: the materialized block may be modified by the client, and the
+// consumers of LazyBasicBlock must use materialized_block() when it is not
+// null, and use the compact representation only otherwise.
+//
+// The class is not thread-safe: block() and mutable_block() may materialize
+// the basic block, and they must not be called concurrently with any other
+// method. All other methods may be called concurrently.
+class LazyBasicBlock {
+ public:
+  // Creates an empty basic block.
+  LazyBasicBlock() = default;
+  // Creates a lazy basic block that keeps `proto` in the serialized form.
+  explicit LazyBasicBlock(const BasicBlockProto& proto);
+  // Creates a lazy basic block from a packed basic block.
+  explicit LazyBasicBlock(PackedBasicBlock block);
+  // Creates a lazy basic block from an existing BasicBlock. The block is
+  // considered to be materialized.
+  explicit LazyBasicBlock(BasicBlock block);
+
+  // Creates a lazy basic block from a serialized BasicBlockProto. Parses the
+  // proto once to check that it is valid and to get the number of
+  // instructions, but keeps only the serialized form. Returns an error when the
+  // proto can't be parsed.
+  static absl::StatusOr<LazyBasicBlock> FromSerializedProto(
+      std::string serialized_proto);
+
+  LazyBasicBlock(const LazyBasicBlock& other);
+  LazyBasicBlock(LazyBasicBlock&&) = default;
+
+  LazyBasicBlock& operator=(const LazyBasicBlock& other);
+  LazyBasicBlock& operator=(LazyBasicBlock&&) = default;
+
+  // Returns the basic block as BasicBlock. Materializes the basic block on the
+  // first call.
+  const BasicBlock& block() const;
+  BasicBlock& mutable_block();
+
+  // Returns the materialized basic block, or nullptr when the basic block was
+  // not materialized yet. Never materializes the basic block.
+  const BasicBlock* materialized_block() const { return block_.get(); }
+  bool is_materialized() const { return block_ != nullptr; }
+
+  // Returns the compact representations of the basic block. At most one of
+  // serialized_proto() and packed_block() is non-null, and both are null when
+  // the lazy basic block was created from a BasicBlock or when it is empty.
+  // These do not reflect changes made through mutable_block().
+  const std::string* serialized_proto() const {
+    return has_serialized_proto_ ? &serialized_proto_ : nullptr;
+  }
+  const PackedBasicBlock* packed_block() const { return packed_block_.get(); }
+
+  // Returns the number of instructions in the basic block. Never materializes
+  // the basic block.
+  int num_instructions() const;
+
+ private:
+  bool has_serialized_proto_ = false;
+  std::string serialized_proto_;
+  // The number of instructions in `serialized_proto_`.
+  int num_serialized_instructions_ = 0;
+  // The packed block is never modified, so copies of the lazy basic block can
+  // share it.
+  std::shared_ptr<const PackedBasicBlock> packed_block_;
+  // The materialized basic block. This is mutable, because it is created
+  // lazily from const methods.
+  mutable std::unique_ptr<BasicBlock> block_;
+};
+
+}  // namespace gematria
+
+#endif  // GEMATRIA_BASIC_BLOCK_LAZY_BASIC_BLOCK_H_
@@ -0,0 +1,146 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "gematria/basic_block/lazy_basic_block.h"
+
+#include <string>
+#include <utility>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "gematria/basic_block/basic_block.h"
+#include "gematria/basic_block/basic_block_protos.h"
+#include "gematria/basic_block/packed_basic_block.h"
+#include "gematria/proto/basic_block.pb.h"
+#include "gematria/testing/matchers.h"
+#include "gematria/testing/parse_proto.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace gematria {
+namespace {
+
+using ::testing::IsEmpty;
+using ::testing::IsNull;
+using ::testing::NotNull;
+
+BasicBlockProto MakeTestProto() {
+  return ParseTextProto(R"pb(
+    canonicalized_instructions: {
+      mnemonic: "ADD"
+      llvm_mnemonic: "ADD64mi32"
+      prefixes: "LOCK"
+      input_operands: { memory: { alias_group_id: 1 } }
+      input_operands: {
+        address: { base_register: "RSI" displacement: -16 scaling: 1 }
+      }
+      input_operands: { immediate_value: 123 }
+      output_operands: { memory: { alias_group_id: 1 } }
+      implicit_output_operands: { register_name: "EFLAGS" }
+    }
+    canonicalized_instructions: {
+      mnemonic: "MOV"
+      llvm_mnemonic: "MOV64rr"
+      output_operands: { register_name: "RCX" }
+      input_operands: { register_name: "RAX" }
+    }
+  )pb");
+}
+
+TEST(LazyBasicBlockTest, Empty) {
+  const LazyBasicBlock block;
+  EXPECT_FALSE(block.is_materialized());
+  EXPECT_EQ(block.num_instructions(), 0);
+  EXPECT_THAT(block.serialized_proto(), IsNull());
+  EXPECT_THAT(block.packed_block(), IsNull());
+  EXPECT_THAT(block.block().instructions, IsEmpty());
+  EXPECT_TRUE(block.is_materialized());
+}
+
+TEST(LazyBasicBlockTest, FromProto) {
+  const BasicBlockProto proto = MakeTestProto();
+  const LazyBasicBlock block(proto);
+  EXPECT_FALSE(block.is_materialized());
+  EXPECT_THAT(block.materialized_block(), IsNull());
+  EXPECT_THAT(block.packed_block(), IsNull());
+  ASSERT_THAT(block.serialized_proto(), NotNull());
+  EXPECT_EQ(*block.serialized_proto(), proto.SerializeAsString());
+  EXPECT_EQ(block.num_instructions(), 2);
+  EXPECT_FALSE(block.is_materialized());
+
+  EXPECT_EQ(block.block(), BasicBlockFromProto(proto));
+  EXPECT_TRUE(block.is_materialized());
+  EXPECT_EQ(block.materialized_block(), &block.block());
+}
+
+TEST(LazyBasicBlockTest, FromSerializedProto) {
+  const BasicBlockProto proto = MakeTestProto();
+  absl::StatusOr<LazyBasicBlock> block =
+      LazyBasicBlock::FromSerializedProto(proto.SerializeAsString());
+  ASSERT_OK(block);
+  EXPECT_FALSE(block->is_materialized());
+  EXPECT_EQ(block->num_instructions(), 2);
+  EXPECT_EQ(block->block(), BasicBlockFromProto(proto));
+}
+
+TEST(LazyBasicBlockTest, FromInvalidSerializedProto) {
+  EXPECT_THAT(LazyBasicBlock::FromSerializedProto("\xff\xff\xff"),
+              StatusIs(absl::StatusCode::kInvalidArgument));
+}
+
+TEST(LazyBasicBlockTest, FromPackedBasicBlock) {
+  const BasicBlockProto proto = MakeTestProto();
+  const LazyBasicBlock block(PackedBasicBlockFromProto(proto));
+  EXPECT_FALSE(block.is_materialized());
+  EXPECT_THAT(block.serialized_proto(), IsNull());
+  ASSERT_THAT(block.packed_block(), NotNull());
+  EXPECT_EQ(block.num_instructions(), 2);
+  EXPECT_EQ(block.block(), BasicBlockFromProto(proto));
+}
+
+TEST(LazyBasicBlockTest, FromBasicBlock) {
+  const BasicBlock basic_block = BasicBlockFromProto(MakeTestProto());
+  const LazyBasicBlock block(basic_block);
+  EXPECT_TRUE(block.is_materialized());
+  EXPECT_THAT(block.serialized_proto(), IsNull());
+  EXPECT_THAT(block.packed_block(), IsNull());
+  EXPECT_EQ(block.num_instructions(), 2);
+  EXPECT_EQ(block.block(), basic_block);
+}
+
+TEST(LazyBasicBlockTest, MutableBlock) {
+  LazyBasicBlock block(MakeTestProto());
+  block.mutable_block().instructions.pop_back();
+  EXPECT_EQ(block.num_instructions(), 1);
+  EXPECT_EQ(block.block().instructions.size(), 1);
+}
+
+TEST(LazyBasicBlockTest, Copy) {
+  const LazyBasicBlock packed_block(PackedBasicBlockFromProto(MakeTestProto()));
+  const LazyBasicBlock packed_copy = packed_block;
+  EXPECT_EQ(packed_copy.packed_block(), packed_block.packed_block());
+  EXPECT_FALSE(packed_copy.is_materialized());
+
+  LazyBasicBlock block(MakeTestProto());
+  block.mutable_block().instructions.pop_back();
+  LazyBasicBlock copy;
+  copy = block;
+  EXPECT_TRUE(copy.is_materialized());
+  EXPECT_NE(copy.materialized_block(), block.materialized_block());
+  EXPECT_EQ(copy.block(), block.block());
+  EXPECT_EQ(*copy.serialized_proto(), *block.serialized_proto());
+}
+
+}  // namespace
+}  // namespace gematria
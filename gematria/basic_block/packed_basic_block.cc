@@ -0,0 +1,237 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "gematria/basic_block/packed_basic_block.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "absl/log/absl_check.h"
+#include "absl/strings/string_view.h"
+#include "gematria/basic_block/basic_block.h"
+#include "gematria/basic_block/token_table.h"
+
+namespace gematria {
+namespace {
+
+void AddOperandsToPackedBasicBlock(
+    const std::vector<InstructionOperand>& operands, OperandList list,
+    PackedBasicBlock& block) {
+  for (const InstructionOperand& operand : operands) {
+    switch (operand.type()) {
+      case OperandType::kUnknown:
+        block.AddUnknownOperand(list);
+        break;
+      case OperandType::kRegister:
+        block.AddRegisterOperand(list, operand.register_name());
+        break;
+      case OperandType::kImmediateValue:
+        block.AddImmediateValueOperand(list, operand.immediate_value());
+        break;
+      case OperandType::kFpImmediateValue:
+        block.AddFpImmediateValueOperand(list, operand.fp_immediate_value());
+        break;
+      case OperandType::kAddress: {
+        const AddressTuple& address = operand.address();
+        block.AddAddressOperand(list, address.base_register,
+                                address.displacement, address.index_register,
+                                address.scaling, address.segment_register);
+      } break;
+      case OperandType::kMemory:
+        block.AddMemoryOperand(list, operand.alias_group_id());
+        break;
+    }
+  }
+}
+
+std::vector<InstructionOperand> OperandsFromPackedBasicBlock(
+    const PackedBasicBlock& block, const PackedInstruction& instruction,
+    OperandList list) {
+  const TokenTable& token_table = TokenTable::Global();
+  std::vector<InstructionOperand> result;
+  for (const PackedOperand& operand : block.operands(instruction, list)) {
+    switch (operand.type) {
+      case OperandType::kUnknown:
+        result.emplace_back();
+        break;
+      case OperandType::kRegister:
+        result.push_back(InstructionOperand::Register(
+            token_table.Name(operand.register_token)));
+        break;
+      case OperandType::kImmediateValue:
+        result.push_back(
+            InstructionOperand::ImmediateValue(operand.immediate_value));
+        break;
+      case OperandType::kFpImmediateValue:
+        result.push_back(
+            InstructionOperand::FpImmediateValue(operand.fp_immediate_value));
+        break;
+      case OperandType::kAddress: {
+        const PackedAddress& address = block.address(operand);
+        result.push_back(InstructionOperand::Address(
+            /* base_register = */ token_table.Name(address.base_register),
+            /* displacement = */ address.displacement,
+            /* index_register = */ token_table.Name(address.index_register),
+            /* scaling = */ address.scaling,
+            /* segment_register = */
+            token_table.Name(address.segment_register)));
+      } break;
+      case OperandType::kMemory:
+        result.push_back(
+            InstructionOperand::MemoryLocation(operand.alias_group_id));
+        break;
+    }
+  }
+  return result;
+}
+
+}  // namespace
+
+PackedBasicBlock::PackedBasicBlock(const BasicBlock& block) {
+  instructions_.reserve(block.instructions.size());
+  for (const Instruction& instruction : block.instructions) {
+    AddInstruction(instruction);
+  }
+}
+
+void PackedBasicBlock::Clear() {
+  instructions_.clear();
+  prefixes_.clear();
+  operands_.clear();
+  addresses_.clear();
+}
+
+BasicBlock PackedBasicBlock::ToBasicBlock() const {
+  const TokenTable& token_table = TokenTable::Global();
+  BasicBlock block;
+  block.instructions.reserve(instructions_.size());
+  for (const PackedInstruction& packed_instruction : instructions_) {
+    Instruction& instruction = block.instructions.emplace_back();
+    instruction.mnemonic = token_table.Name(packed_instruction.mnemonic);
+    instruction.llvm_mnemonic =
+        token_table.Name(packed_instruction.llvm_mnemonic);
+    for (const TokenId prefix : prefixes(packed_instruction)) {
+      instruction.prefixes.push_back(token_table.Name(prefix));
+    }
+    instruction.input_operands = OperandsFromPackedBasicBlock(
+        *this, packed_instruction, OperandList::kInput);
+    instruction.implicit_input_operands = OperandsFromPackedBasicBlock(
+        *this, packed_instruction, OperandList::kImplicitInput);
+    instruction.output_operands = OperandsFromPackedBasicBlock(
+        *this, packed_instruction, OperandList::kOutput);
+    instruction.implicit_output_operands = OperandsFromPackedBasicBlock(
+        *this, packed_instruction, OperandList::kImplicitOutput);
+  }
+  return block;
+}
+
+void PackedBasicBlock::AddInstruction(const Instruction& instruction) {
+  BeginInstruction(instruction.mnemonic, instruction.llvm_mnemonic);
+  for (const std::string& prefix : instruction.prefixes) {
+    AddPrefix(prefix);
+  }
+  AddOperandsToPackedBasicBlock(instruction.input_operands,
+                                OperandList::kInput, *this);
+  AddOperandsToPackedBasicBlock(instruction.implicit_input_operands,
+                                OperandList::kImplicitInput, *this);
+  AddOperandsToPackedBasicBlock(instruction.output_operands,
+                                OperandList::kOutput, *this);
+  AddOperandsToPackedBasicBlock(instruction.implicit_output_operands,
+                                OperandList::kImplicitOutput, *this);
+}
+
+void PackedBasicBlock::BeginInstruction(absl::string_view mnemonic,
+                                        absl::string_view llvm_mnemonic) {
+  TokenTable& token_table = TokenTable::Global();
+  PackedInstruction& instruction = instructions_.emplace_back();
+  instruction.mnemonic = token_table.Intern(mnemonic);
+  instruction.llvm_mnemonic = token_table.Intern(llvm_mnemonic);
+  instruction.prefixes_begin = static_cast<int32_t>(prefixes_.size());
+  instruction.prefixes_end = instruction.prefixes_begin;
+  instruction.operands_begin = static_cast<int32_t>(operands_.size());
+  instruction.operand_list_ends.fill(instruction.operands_begin);
+}
+
+void PackedBasicBlock::AddPrefix(absl::string_view prefix) {
+  ABSL_DCHECK(!instructions_.empty());
+  PackedInstruction& instruction = instructions_.back();
+  // Prefixes of the last instruction are at the end of `prefixes_`.
+  ABSL_DCHECK_EQ(instruction.prefixes_end, prefixes_.size());
+  prefixes_.push_back(TokenTable::Global().Intern(prefix));
+  ++instruction.prefixes_end;
+}
+
+PackedOperand& PackedBasicBlock::AddOperand(OperandList list,
+                                            OperandType type) {
+  ABSL_DCHECK(!instructions_.empty());
+  PackedInstruction& instruction = instructions_.back();
+  const int list_index = static_cast<int>(list);
+  // Operands can be added only to the last non-empty list or to the lists that
+  // follow it; otherwise, we'd have to move the operands of the later lists.
+  ABSL_CHECK_EQ(instruction.operand_list_ends[list_index],
+                instruction.operand_list_ends[kNumOperandLists - 1])
+      << "Operands must be added in the order of their lists";
+  for (int i = list_index; i < kNumOperandLists; ++i) {
+    ++instruction.operand_list_ends[i];
+  }
+  PackedOperand& operand = operands_.emplace_back();
+  operand.type = type;
+  return operand;
+}
+
+void PackedBasicBlock::AddRegisterOperand(OperandList list,
+                                          absl::string_view register_name) {
+  AddOperand(list, OperandType::kRegister).register_token =
+      TokenTable::Global().Intern(register_name);
+}
+
+void PackedBasicBlock::AddImmediateValueOperand(OperandList list,
+                                                uint64_t immediate_value) {
+  AddOperand(list, OperandType::kImmediateValue).immediate_value =
+      immediate_value;
+}
+
+void PackedBasicBlock::AddFpImmediateValueOperand(OperandList list,
+                                                  double fp_immediate_value) {
+  AddOperand(list, OperandType::kFpImmediateValue).fp_immediate_value =
+      fp_immediate_value;
+}
+
+void PackedBasicBlock::AddAddressOperand(OperandList list,
+                                         absl::string_view base_register,
+                                         int64_t displacement,
+                                         absl::string_view index_register,
+                                         int scaling,
+                                         absl::string_view segment_register) {
+  TokenTable& token_table = TokenTable::Global();
+  AddOperand(list, OperandType::kAddress).address_index =
+      static_cast<int32_t>(addresses_.size());
+  PackedAddress& address = addresses_.emplace_back();
+  address.base_register = token_table.Intern(base_register);
+  address.displacement = displacement;
+  address.index_register = token_table.Intern(index_register);
+  address.scaling = scaling;
+  address.segment_register = token_table.Intern(segment_register);
+}
+
+void PackedBasicBlock::AddMemoryOperand(OperandList list, int alias_group_id) {
+  AddOperand(list, OperandType::kMemory).alias_group_id = alias_group_id;
+}
+
+void PackedBasicBlock::AddUnknownOperand(OperandList list) {
+  AddOperand(list, OperandType::kUnknown);
+}
+
+}  // namespace gematria
@@ -0,0 +1,193 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Contains a compact, flat representation of basic blocks for bulk processing.
+//
+// BasicBlock stores each instruction and each operand as a separate object with
+// its own strings and vectors. This is convenient, but it needs many small
+// allocations per instruction and it has poor memory locality. PackedBasicBlock
+// stores the same data in a handful of contiguous arrays: instruction records
+// refer to ranges of a shared array of operands, operands are tagged unions,
+// and all strings are replaced by their IDs in the global token table. A packed
+// basic block can be cleared and refilled without releasing its memory, so a
+// single object can be reused for any number of basic blocks.
+
+#ifndef THIRD_PARTY_GEMATRIA_GEMATRIA_BASIC_BLOCK_PACKED_BASIC_BLOCK_H_
+#define THIRD_PARTY_GEMATRIA_GEMATRIA_BASIC_BLOCK_PACKED_BASIC_BLOCK_H_
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "absl/log/absl_check.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "gematria/basic_block/basic_block.h"
+#include "gematria/basic_block/token_table.h"
+
+namespace gematria {
+
+// The lists of operands of an instruction. The operands of each instruction
+// are stored in this order.
+enum class OperandList {
+  kInput = 0,
+  kImplicitInput = 1,
+  kOutput = 2,
+  kImplicitOutput = 3,
+};
+
+inline constexpr int kNumOperandLists = 4;
+
+// The inputs of an address computation. Registers are represented by their IDs
+// in the global token table; unused registers are TokenTable::kEmptyTokenId.
+struct PackedAddress {
+  TokenId base_register = TokenTable::kEmptyTokenId;
+  int64_t displacement = 0;
+  TokenId index_register = TokenTable::kEmptyTokenId;
+  int scaling = 0;
+  TokenId segment_register = TokenTable::kEmptyTokenId;
+};
+
+// A single operand of an instruction. This is a tagged union; only the field
+// corresponding to `type` may be used.
+struct PackedOperand {
+  PackedOperand() : immediate_value(0) {}
+
+  OperandType type = OperandType::kUnknown;
+  union {
+    // The ID of the register name in the global token table. Valid only when
+    // type is kRegister.
+    TokenId register_token;
+    // Valid only when type is kImmediateValue.
+    uint64_t immediate_value;
+    // Valid only when type is kFpImmediateValue.
+    double fp_immediate_value;
+    // The index of the address tuple in PackedBasicBlock::addresses(). Valid
+    // only when type is kAddress.
+    int32_t address_index;
+    // Valid only when type is kMemory.
+    int32_t alias_group_id;
+  };
+};
+
+// A single instruction. The prefixes and the operands are stored as ranges in
+// the arrays of the basic block that contains the instruction.
+struct PackedInstruction {
+  // The IDs of the mnemonics in the global token table.
+  TokenId mnemonic = TokenTable::kEmptyTokenId;
+  TokenId llvm_mnemonic = TokenTable::kEmptyTokenId;
+
+  // The range of prefixes of the instruction in PackedBasicBlock::prefixes().
+  int32_t prefixes_begin = 0;
+  int32_t prefixes_end = 0;
+
+  // The operands of the instruction start at `operands_begin` in
+  // PackedBasicBlock::operands(); the i-th list of operands ends at
+  // `operand_list_ends[i]` and the next list starts at the same position.
+  int32_t operands_begin = 0;
+  std::array<int32_t, kNumOperandLists> operand_list_ends = {};
+};
+
+// A basic block stored in a flat format. See the top-level comment for more
+// details.
+class PackedBasicBlock {
+ public:
+  PackedBasicBlock() = default;
+  // Creates a packed version of `block`.
+  explicit PackedBasicBlock(const BasicBlock& block);
+
+  PackedBasicBlock(const PackedBasicBlock&) = default;
+  PackedBasicBlock(PackedBasicBlock&&) = default;
+
+  PackedBasicBlock& operator=(const PackedBasicBlock&) = default;
+  PackedBasicBlock& operator=(PackedBasicBlock&&) = default;
+
+  // Removes all instructions from the basic block. Keeps the allocated memory.
+  void Clear();
+
+  // Creates a BasicBlock with the same contents as the packed basic block.
+  BasicBlock ToBasicBlock() const;
+
+  // Appends `instruction` to the end of the basic block.
+  void AddInstruction(const Instruction& instruction);
+
+  // Methods for adding instructions piece by piece. BeginInstruction() starts a
+  // new instruction at the end of the basic block, and the following calls add
+  // prefixes and operands to it. Operands must be added in the order of their
+  // lists, i.e. all input operands first and implicit output operands last.
+  void BeginInstruction(absl::string_view mnemonic,
+                        absl::string_view llvm_mnemonic);
+  void AddPrefix(absl::string_view prefix);
+  void AddRegisterOperand(OperandList list, absl::string_view register_name);
+  void AddImmediateValueOperand(OperandList list, uint64_t immediate_value);
+  void AddFpImmediateValueOperand(OperandList list, double fp_immediate_value);
+  void AddAddressOperand(OperandList list, absl::string_view base_register,
+                         int64_t displacement, absl::string_view index_register,
+                         int scaling, absl::string_view segment_register);
+  void AddMemoryOperand(OperandList list, int alias_group_id);
+  // Adds an operand with no type, corresponding to InstructionOperand().
+  void AddUnknownOperand(OperandList list);
+
+  int num_instructions() const {
+    return static_cast<int>(instructions_.size());
+  }
+  absl::Span<const PackedInstruction> instructions() const {
+    return instructions_;
+  }
+  absl::Span<const TokenId> prefixes() const { return prefixes_; }
+  absl::Span<const PackedOperand> operands() const { return operands_; }
+  absl::Span<const PackedAddress> addresses() const { return addresses_; }
+
+  // Returns the prefixes of `instruction`. `instruction` must be an element of
+  // instructions() of this basic block.
+  absl::Span<const TokenId> prefixes(
+      const PackedInstruction& instruction) const {
+    return absl::MakeConstSpan(prefixes_).subspan(
+        instruction.prefixes_begin,
+        instruction.prefixes_end - instruction.prefixes_begin);
+  }
+
+  // Returns the operands of `instruction` from the given list. `instruction`
+  // must be an element of instructions() of this basic block.
+  absl::Span<const PackedOperand> operands(const PackedInstruction& instruction,
+                                           OperandList list) const {
+    const int list_index = static_cast<int>(list);
+    const int32_t begin = list_index == 0
+                              ? instruction.operands_begin
+                              : instruction.operand_list_ends[list_index - 1];
+    return absl::MakeConstSpan(operands_).subspan(
+        begin, instruction.operand_list_ends[list_index] - begin);
+  }
+
+  // Returns the address tuple of `operand`. The operand must be of type
+  // kAddress, and it must be an element of operands() of this basic block.
+  const PackedAddress& address(const PackedOperand& operand) const {
+    ABSL_DCHECK_EQ(operand.type, OperandType::kAddress);
+    return addresses_[operand.address_index];
+  }
+
+ private:
+  // Adds a new operand to the last instruction in the basic block, and returns
+  // a reference to it.
+  PackedOperand& AddOperand(OperandList list, OperandType type);
+
+  std::vector<PackedInstruction> instructions_;
+  std::vector<TokenId> prefixes_;
+  std::vector<PackedOperand> operands_;
+  std::vector<PackedAddress> addresses_;
+};
+
+}  // namespace gematria
+
+#endif  // THIRD_PARTY_GEMATRIA_GEMATRIA_BASIC_BLOCK_PACKED_BASIC_BLOCK_H_
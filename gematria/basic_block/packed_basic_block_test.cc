@@ -0,0 +1,146 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "gematria/basic_block/packed_basic_block.h"
+
+#include <string>
+#include <vector>
+
+#include "gematria/basic_block/basic_block.h"
+#include "gematria/basic_block/token_table.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace gematria {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+
+BasicBlock MakeTestBasicBlock() {
+  return BasicBlock(
+      {Instruction(
+           /* mnemonic = */ "ADD", /* llvm_mnemonic = */ "ADD64rm",
+           /* prefixes = */ {"LOCK"},
+           /* input_operands = */
+           {InstructionOperand::Register("RAX"),
+            InstructionOperand::MemoryLocation(1),
+            InstructionOperand::Address("RSI", -16, "RDI", 2, "FS")},
+           /* implicit_input_operands = */ {},
+           /* output_operands = */ {InstructionOperand::Register("RAX")},
+           /* implicit_output_operands = */
+           {InstructionOperand::Register("EFLAGS")}),
+       Instruction(
+           /* mnemonic = */ "NOP", /* llvm_mnemonic = */ "NOOP",
+           /* prefixes = */ {},
+           /* input_operands = */ {},
+           /* implicit_input_operands = */ {},
+           /* output_operands = */ {},
+           /* implicit_output_operands = */ {}),
+       Instruction(
+           /* mnemonic = */ "MOVSD", /* llvm_mnemonic = */ "MOVSDrr",
+           /* prefixes = */ {"REP", "LOCK"},
+           /* input_operands = */
+           {InstructionOperand::ImmediateValue(123),
+            InstructionOperand::FpImmediateValue(3.14),
+            InstructionOperand()},
+           /* implicit_input_operands = */
+           {InstructionOperand::Register("RCX")},
+           /* output_operands = */ {InstructionOperand::MemoryLocation(2)},
+           /* implicit_output_operands = */ {})});
+}
+
+TEST(PackedBasicBlockTest, Empty) {
+  const PackedBasicBlock block;
+  EXPECT_EQ(block.num_instructions(), 0);
+  EXPECT_THAT(block.operands(), IsEmpty());
+  EXPECT_EQ(block.ToBasicBlock(), BasicBlock());
+}
+
+TEST(PackedBasicBlockTest, RoundTrip) {
+  const BasicBlock block = MakeTestBasicBlock();
+  const PackedBasicBlock packed_block(block);
+  EXPECT_EQ(packed_block.num_instructions(), 3);
+  EXPECT_EQ(packed_block.prefixes().size(), 3);
+  EXPECT_EQ(packed_block.operands().size(), 10);
+  EXPECT_EQ(packed_block.addresses().size(), 1);
+  EXPECT_EQ(packed_block.ToBasicBlock(), block);
+}
+
+TEST(PackedBasicBlockTest, Accessors) {
+  const PackedBasicBlock block(MakeTestBasicBlock());
+  const TokenTable& token_table = TokenTable::Global();
+
+  const PackedInstruction& add = block.instructions()[0];
+  EXPECT_EQ(token_table.Name(add.mnemonic), "ADD");
+  EXPECT_EQ(token_table.Name(add.llvm_mnemonic), "ADD64rm");
+  EXPECT_THAT(block.prefixes(add), ElementsAre(token_table.Find("LOCK")));
+
+  const auto input_operands = block.operands(add, OperandList::kInput);
+  ASSERT_EQ(input_operands.size(), 3);
+  EXPECT_EQ(input_operands[0].type, OperandType::kRegister);
+  EXPECT_EQ(input_operands[0].register_token, token_table.Find("RAX"));
+  EXPECT_EQ(input_operands[1].type, OperandType::kMemory);
+  EXPECT_EQ(input_operands[1].alias_group_id, 1);
+  ASSERT_EQ(input_operands[2].type, OperandType::kAddress);
+  const PackedAddress& address = block.address(input_operands[2]);
+  EXPECT_EQ(address.base_register, token_table.Find("RSI"));
+  EXPECT_EQ(address.displacement, -16);
+  EXPECT_EQ(address.index_register, token_table.Find("RDI"));
+  EXPECT_EQ(address.scaling, 2);
+  EXPECT_EQ(address.segment_register, token_table.Find("FS"));
+  EXPECT_THAT(block.operands(add, OperandList::kImplicitInput), IsEmpty());
+  EXPECT_EQ(block.operands(add, OperandList::kOutput).size(), 1);
+  EXPECT_EQ(block.operands(add, OperandList::kImplicitOutput).size(), 1);
+
+  const PackedInstruction& nop = block.instructions()[1];
+  EXPECT_THAT(block.prefixes(nop), IsEmpty());
+  for (const OperandList list :
+       {OperandList::kInput, OperandList::kImplicitInput, OperandList::kOutput,
+        OperandList::kImplicitOutput}) {
+    EXPECT_THAT(block.operands(nop, list), IsEmpty());
+  }
+}
+
+TEST(PackedBasicBlockTest, ClearAndReuse) {
+  PackedBasicBlock block(MakeTestBasicBlock());
+  block.Clear();
+  EXPECT_EQ(block.num_instructions(), 0);
+  EXPECT_THAT(block.prefixes(), IsEmpty());
+  EXPECT_THAT(block.operands(), IsEmpty());
+  EXPECT_THAT(block.addresses(), IsEmpty());
+
+  block.BeginInstruction("NOT", "NOT64r");
+  block.AddRegisterOperand(OperandList::kInput, "RCX");
+  block.AddRegisterOperand(OperandList::kOutput, "RCX");
+  EXPECT_EQ(block.ToBasicBlock(),
+            BasicBlock({Instruction(
+                /* mnemonic = */ "NOT", /* llvm_mnemonic = */ "NOT64r",
+                /* prefixes = */ {},
+                /* input_operands = */ {InstructionOperand::Register("RCX")},
+                /* implicit_input_operands = */ {},
+                /* output_operands = */ {InstructionOperand::Register("RCX")},
+                /* implicit_output_operands = */ {})}));
+}
+
+TEST(PackedBasicBlockDeathTest, OperandsOutOfOrder) {
+  PackedBasicBlock block;
+  block.BeginInstruction("ADD", "ADD64rr");
+  block.AddRegisterOperand(OperandList::kOutput, "RAX");
+  EXPECT_DEATH(block.AddRegisterOperand(OperandList::kInput, "RBX"),
+               "Operands must be added in the order of their lists");
+}
+
+}  // namespace
+}  // namespace gematria
@@ -21,6 +21,7 @@
 #include <utility>
 #include <vector>
 
+#include "gematria/basic_block/lazy_basic_block.h"
 #include "pybind11/cast.h"
 #include "pybind11/detail/common.h"
 #include "pybind11/pybind11.h"
@@ -234,6 +235,10 @@ PYBIND11_MODULE(basic_block, m) {
       .def(py::init<std::vector<Instruction> /* instructions */>(),
            py::arg("instructions") = std::vector<Instruction>())
       .def_readwrite("instructions", &BasicBlock::instructions)
+      .def_property_readonly("num_instructions",
+                             [](const BasicBlock& block) {
+                               return block.instructions.size();
+                             })
       .def("__repr__", &BasicBlock::ToString)
       .def("__str__", &BasicBlock::ToString)
       .def("__eq__", &BasicBlock::operator==)
@@ -243,6 +248,55 @@ PYBIND11_MODULE(basic_block, m) {
           "__deepcopy__",
           [](const BasicBlock& block, py::dict) { return BasicBlock(block); },
           py::arg("memo"));
+
+  py::class_<LazyBasicBlock> lazy_basic_block(
+      m, "LazyBasicBlock",
+      R"(A basic block that is converted to BasicBlock only when needed.
+
+The block is stored in a compact form, and it is materialized as a BasicBlock
+on the first access to `block` or `instructions`. The graph builder and the
+tokenizer consume the compact form directly, without materializing the block.
+Use `basic_block_protos.lazy_basic_block_from_proto()` to create lazy blocks
+from protos.)");
+  lazy_basic_block
+      .def(py::init<>())
+      .def(py::init<BasicBlock>(), py::arg("block"))
+      .def_property_readonly(
+          "block",
+          [](LazyBasicBlock& self) -> BasicBlock& {
+            return self.mutable_block();
+          },
+          py::return_value_policy::reference_internal)
+      .def_property(
+          "instructions",
+          [](LazyBasicBlock& self) -> std::vector<Instruction>& {
+            return self.mutable_block().instructions;
+          },
+          [](LazyBasicBlock& self, std::vector<Instruction> instructions) {
+            self.mutable_block().instructions = std::move(instructions);
+          },
+          py::return_value_policy::reference_internal)
+      .def_property_readonly("num_instructions",
+                             &LazyBasicBlock::num_instructions)
+      .def_property_readonly("is_materialized",
+                             &LazyBasicBlock::is_materialized)
+      .def("__repr__",
+           [](const LazyBasicBlock& self) { return self.block().ToString(); })
+      .def("__str__",
+           [](const LazyBasicBlock& self) { return self.block().ToString(); })
+      .def("__eq__",
+           [](const LazyBasicBlock& self, const LazyBasicBlock& other) {
+             return self.block() == other.block();
+           },
+           py::is_operator())
+      .def("__copy__",
+           [](const LazyBasicBlock& block) { return LazyBasicBlock(block); })
+      .def(
+          "__deepcopy__",
+          [](const LazyBasicBlock& block, py::dict) {
+            return LazyBasicBlock(block);
+          },
+          py::arg("memo"));
 }
 
 }  // namespace gematria
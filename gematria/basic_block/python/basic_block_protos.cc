@@ -14,10 +14,17 @@
 
 #include "gematria/basic_block/basic_block_protos.h"
 
+#include <string>
+
+#include "gematria/basic_block/lazy_basic_block.h"
+#include "gematria/proto/basic_block.pb.h"
 #include "gematria/proto/canonicalized_instruction.pb.h"
 #include "pybind11/cast.h"
 #include "pybind11/detail/common.h"
 #include "pybind11/pybind11.h"
+#include "pybind11/pytypes.h"
+#include "pybind11_abseil/import_status_module.h"
+#include "pybind11_abseil/status_casters.h"
 #include "pybind11_protobuf/native_proto_caster.h"
 
 namespace gematria {
@@ -26,6 +33,7 @@ namespace py = ::pybind11;
 
 PYBIND11_MODULE(basic_block_protos, m) {
   pybind11_protobuf::ImportNativeProtoCasters();
+  py::google::ImportStatusModule();
 
   m.doc() = "Functions for converting protos to Gematria data structures.";
 
@@ -34,6 +42,29 @@ PYBIND11_MODULE(basic_block_protos, m) {
   m.def("instruction_operand_from_proto", InstructionOperandFromProto,
         py::arg("proto"));
   m.def("address_tuple_from_proto", AddressTupleFromProto, py::arg("proto"));
+  m.def(
+      "lazy_basic_block_from_proto",
+      [](const BasicBlockProto& proto, bool packed) {
+        if (packed) return LazyBasicBlock(PackedBasicBlockFromProto(proto));
+        return LazyBasicBlock(proto);
+      },
+      py::arg("proto"), py::arg("packed") = false,
+      R"(Creates a LazyBasicBlock from a BasicBlockProto.
+
+By default, the lazy block keeps the proto in the serialized form. When `packed`
+is True, it keeps the block in the packed format that uses token IDs instead of
+strings; this is faster to add to a graph builder, but it interns all tokens of
+the block in the global token table.)");
+  m.def(
+      "lazy_basic_block_from_serialized_proto",
+      [](py::bytes serialized_proto) {
+        return LazyBasicBlock::FromSerializedProto(
+            static_cast<std::string>(serialized_proto));
+      },
+      py::arg("serialized_proto"),
+      R"(Creates a LazyBasicBlock from a serialized BasicBlockProto.
+
+Raises StatusNotOk when the proto can't be parsed.)");
 }
 
 }  // namespace gematria
@@ -19,6 +19,7 @@ from gematria.basic_block.python import basic_block
 from gematria.basic_block.python import basic_block_protos
 from gematria.proto import basic_block_pb2
 from gematria.proto import canonicalized_instruction_pb2
+from pybind11_abseil import status
 
 _CanonicalizedOperandProto = (
     canonicalized_instruction_pb2.CanonicalizedOperandProto
@@ -232,5 +233,66 @@ class BasicBlockFromProtoTest(absltest.TestCase):
     self.assertSequenceEqual(block.instructions, expected)
 
 
+class LazyBasicBlockFromProtoTest(absltest.TestCase):
+
+  def setUp(self):
+    super().setUp()
+    self.proto = basic_block_pb2.BasicBlockProto(
+        canonicalized_instructions=(
+            _CanonicalizedInstructionProto(
+                mnemonic='MOV',
+                llvm_mnemonic='MOV32rr',
+                input_operands=(
+                    _CanonicalizedOperandProto(register_name='RSI'),
+                ),
+                output_operands=(
+                    _CanonicalizedOperandProto(register_name='RCX'),
+                ),
+            ),
+            _CanonicalizedInstructionProto(
+                mnemonic='NOP', llvm_mnemonic='NOOP'
+            ),
+        )
+    )
+
+  def test_lazy_basic_block_from_proto(self):
+    for packed in (False, True):
+      with self.subTest(packed=packed):
+        block = basic_block_protos.lazy_basic_block_from_proto(
+            self.proto, packed=packed
+        )
+        self.assertIsInstance(block, basic_block.LazyBasicBlock)
+        self.assertFalse(block.is_materialized)
+        self.assertEqual(block.num_instructions, 2)
+        self.assertFalse(block.is_materialized)
+
+        self.assertEqual(
+            block.block, basic_block_protos.basic_block_from_proto(self.proto)
+        )
+        self.assertTrue(block.is_materialized)
+        self.assertEqual(block.instructions[1].mnemonic, 'NOP')
+
+  def test_modify_materialized_block(self):
+    block = basic_block_protos.lazy_basic_block_from_proto(self.proto)
+    block.instructions[0].mnemonic = 'ADD'
+    self.assertEqual(block.block.instructions[0].mnemonic, 'ADD')
+    block.instructions = basic_block.InstructionList(())
+    self.assertEqual(block.num_instructions, 0)
+
+  def test_lazy_basic_block_from_serialized_proto(self):
+    block = basic_block_protos.lazy_basic_block_from_serialized_proto(
+        self.proto.SerializeToString()
+    )
+    self.assertFalse(block.is_materialized)
+    self.assertEqual(block.num_instructions, 2)
+    self.assertEqual(
+        block.block, basic_block_protos.basic_block_from_proto(self.proto)
+    )
+
+  def test_lazy_basic_block_from_invalid_serialized_proto(self):
+    with self.assertRaises(status.StatusNotOk):
+      basic_block_protos.lazy_basic_block_from_serialized_proto(b'\xff\xff')
+
+
 if __name__ == '__main__':
   absltest.main()
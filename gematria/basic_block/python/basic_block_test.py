@@ -485,5 +485,38 @@ class BasicBlockTest(absltest.TestCase):
     self.assertEqual(block.instructions[0].mnemonic, 'ADD')
 
 
+class LazyBasicBlockTest(absltest.TestCase):
+
+  def test_from_basic_block(self):
+    block = basic_block.BasicBlock(
+        instructions=basic_block.InstructionList((
+            basic_block.Instruction(
+                mnemonic='MOV',
+                llvm_mnemonic='MOV32rr',
+                input_operands=basic_block.InstructionOperandList((
+                    basic_block.InstructionOperand.from_register('RSI'),
+                )),
+                output_operands=basic_block.InstructionOperandList((
+                    basic_block.InstructionOperand.from_register('RCX'),
+                )),
+            ),
+        ))
+    )
+    self.assertEqual(block.num_instructions, 1)
+
+    lazy_block = basic_block.LazyBasicBlock(block)
+    self.assertTrue(lazy_block.is_materialized)
+    self.assertEqual(lazy_block.num_instructions, 1)
+    self.assertEqual(lazy_block.block, block)
+    self.assertSequenceEqual(lazy_block.instructions, block.instructions)
+    self.assertEqual(lazy_block, basic_block.LazyBasicBlock(block))
+    self.assertNotEqual(lazy_block, basic_block.LazyBasicBlock())
+
+  def test_empty(self):
+    lazy_block = basic_block.LazyBasicBlock()
+    self.assertEqual(lazy_block.num_instructions, 0)
+    self.assertEqual(lazy_block.block, basic_block.BasicBlock())
+
+
 if __name__ == '__main__':
   absltest.main()
@@ -16,7 +16,7 @@
 
 from collections.abc import Sequence
 import dataclasses
-from typing import Optional
+from typing import Optional, Union
 
 from gematria.basic_block.python import basic_block
 
@@ -46,11 +46,13 @@ class BasicBlockWithThroughput:
   """Contains basic block definition along with throughput information.
 
   Attributes:
-    block: The basic block definition.
+    block: The basic block definition. This is either a BasicBlock, or a
+      LazyBasicBlock that keeps the block in a compact form and creates the
+      BasicBlock only when it is accessed from Python.
     throughputs: The inverse throughputs for the basic block. Each entry of the
       sequence corresponds to one task in the model (one microarchitecture to
       predict).
   """
 
-  block: basic_block.BasicBlock
+  block: Union[basic_block.BasicBlock, basic_block.LazyBasicBlock]
   throughputs: Sequence[Optional[BasicBlockThroughput]] = ()
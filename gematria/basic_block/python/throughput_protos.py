@@ -20,8 +20,21 @@ from gematria.proto import throughput_pb2
 
 def block_with_throughput_from_proto(
     proto: throughput_pb2.BasicBlockWithThroughputProto,
+    lazy: bool = False,
 ) -> throughput.BasicBlockWithThroughput:
-  """Converts a BasicBlockWithThroughputProto to BasicBlockWithThroughput."""
+  """Converts a BasicBlockWithThroughputProto to BasicBlockWithThroughput.
+
+  Args:
+    proto: The proto to convert.
+    lazy: When True, the basic block is stored as a LazyBasicBlock that is
+      converted to BasicBlock only when it is accessed from Python. This saves
+      memory for datasets whose blocks are only passed to a graph builder or a
+      tokenizer. When False, the basic block is converted to BasicBlock
+      immediately.
+
+  Returns:
+    The basic block with throughput.
+  """
   throughputs = []
   for throughput_proto in proto.inverse_throughputs:
     inverse_throughput_cycles = throughput_proto.inverse_throughput_cycles
@@ -39,7 +52,10 @@ def block_with_throughput_from_proto(
     else:
       throughputs.append(None)
 
+  if lazy:
+    block = basic_block_protos.lazy_basic_block_from_proto(proto.basic_block)
+  else:
+    block = basic_block_protos.basic_block_from_proto(proto.basic_block)
   return throughput.BasicBlockWithThroughput(
-      block=basic_block_protos.basic_block_from_proto(proto.basic_block),
-      throughputs=throughputs,
+      block=block, throughputs=throughputs
   )
@@ -82,6 +82,35 @@ class ConvertFromProtoTest(absltest.TestCase):
     self.assertSequenceEqual(throughputs.inverse_throughput_cycles, (1, 2, 3))
     self.assertEmpty(throughputs.prefix_inverse_throughput_cycles)
 
+  def test_lazy_block(self):
+    proto = throughput_pb2.BasicBlockWithThroughputProto(
+        basic_block=basic_block_pb2.BasicBlockProto(
+            canonicalized_instructions=(
+                canonicalized_instruction_pb2.CanonicalizedInstructionProto(
+                    mnemonic='NOP', llvm_mnemonic='NOOP'
+                ),
+            ),
+        ),
+        inverse_throughputs=(
+            throughput_pb2.ThroughputWithSourceProto(
+                inverse_throughput_cycles=(1, 2, 3)
+            ),
+        ),
+    )
+    block = throughput_protos.block_with_throughput_from_proto(proto, lazy=True)
+
+    self.assertIsInstance(block.block, basic_block.LazyBasicBlock)
+    self.assertFalse(block.block.is_materialized)
+    self.assertEqual(block.block.num_instructions, 1)
+    self.assertEqual(
+        block.block.block,
+        throughput_protos.block_with_throughput_from_proto(proto).block,
+    )
+    self.assertLen(block.throughputs, 1)
+    self.assertSequenceEqual(
+        block.throughputs[0].inverse_throughput_cycles, (1, 2, 3)
+    )
+
   def test_proto_with_prefixes(self):
     proto = throughput_pb2.BasicBlockWithThroughputProto(
         basic_block=basic_block_pb2.BasicBlockProto(
@@ -0,0 +1,43 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "gematria/basic_block/register_unit_table.h"
+
+#include <algorithm>
+
+#include "absl/log/absl_check.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "gematria/basic_block/token_table.h"
+
+namespace gematria {
+
+void RegisterUnitTable::AddRegister(absl::string_view register_name,
+                                    absl::Span<const int> units) {
+  const TokenId register_token = TokenTable::Global().Intern(register_name);
+  if (register_token >= unit_ranges_.size()) {
+    unit_ranges_.resize(register_token + 1, {0, 0});
+  }
+  ABSL_CHECK_EQ(unit_ranges_[register_token].second, 0)
+      << "The register was already added: " << register_name;
+  unit_ranges_[register_token] = {static_cast<int>(units_.size()),
+                                  static_cast<int>(units.size())};
+  for (const int unit : units) {
+    ABSL_CHECK_GE(unit, 0);
+    units_.push_back(unit);
+    num_units_ = std::max(num_units_, unit + 1);
+  }
+}
+
+}  // namespace gematria
@@ -0,0 +1,75 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Contains a table that maps registers to the register units they occupy. A
+// register unit is the smallest part of the register file that can be
+// accessed independently, e.g. on x86-64, AL and AH are separate units, and
+// both of them are part of EAX and RAX. Two registers alias if and only if
+// they share a unit. The units are small consecutive integers, so that the
+// users of the table can keep per-unit state in flat arrays.
+//
+// The table is independent of LLVM; see
+// LlvmArchitectureSupport::CreateRegisterUnitTable() for a table created from
+// the register info of an LLVM target.
+
+#ifndef THIRD_PARTY_GEMATRIA_GEMATRIA_BASIC_BLOCK_REGISTER_UNIT_TABLE_H_
+#define THIRD_PARTY_GEMATRIA_GEMATRIA_BASIC_BLOCK_REGISTER_UNIT_TABLE_H_
+
+#include <utility>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "gematria/basic_block/token_table.h"
+
+namespace gematria {
+
+// A mapping from registers, identified by their token IDs in the global token
+// table, to the register units they occupy. The table is immutable after it is
+// created, and it can be shared by multiple threads.
+class RegisterUnitTable {
+ public:
+  RegisterUnitTable() = default;
+
+  // Adds a register to the table. Interns `register_name` in the global token
+  // table. The units must be non-negative; each register can be added only
+  // once.
+  void AddRegister(absl::string_view register_name,
+                   absl::Span<const int> units);
+
+  // Returns the units of the register with the given token ID. Returns an
+  // empty span when the register is not in the table.
+  absl::Span<const int> units(TokenId register_token) const {
+    if (register_token < 0 || register_token >= unit_ranges_.size()) {
+      return {};
+    }
+    const auto [begin, size] = unit_ranges_[register_token];
+    return absl::MakeConstSpan(units_).subspan(begin, size);
+  }
+
+  // Returns the number of units. All units in the table are smaller than this
+  // value.
+  int num_units() const { return num_units_; }
+
+ private:
+  // The position and the number of the units of each register in `units_`,
+  // indexed by the token ID of the register.
+  std::vector<std::pair<int, int>> unit_ranges_;
+  std::vector<int> units_;
+  int num_units_ = 0;
+};
+
+}  // namespace gematria
+
+#endif  // THIRD_PARTY_GEMATRIA_GEMATRIA_BASIC_BLOCK_REGISTER_UNIT_TABLE_H_
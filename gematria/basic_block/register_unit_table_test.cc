@@ -0,0 +1,50 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "gematria/basic_block/register_unit_table.h"
+
+#include "gematria/basic_block/token_table.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace gematria {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+
+TEST(RegisterUnitTableTest, EmptyTable) {
+  RegisterUnitTable table;
+  EXPECT_EQ(table.num_units(), 0);
+  EXPECT_THAT(table.units(TokenTable::Global().Intern("RAX")), IsEmpty());
+  EXPECT_THAT(table.units(TokenTable::kInvalidTokenId), IsEmpty());
+}
+
+TEST(RegisterUnitTableTest, AddRegister) {
+  RegisterUnitTable table;
+  table.AddRegister("RAX", {0, 1});
+  table.AddRegister("AL", {0});
+  table.AddRegister("RBX", {4});
+  table.AddRegister("RIP", {});
+  TokenTable& token_table = TokenTable::Global();
+  EXPECT_EQ(table.num_units(), 5);
+  EXPECT_THAT(table.units(token_table.Find("RAX")), ElementsAre(0, 1));
+  EXPECT_THAT(table.units(token_table.Find("AL")), ElementsAre(0));
+  EXPECT_THAT(table.units(token_table.Find("RBX")), ElementsAre(4));
+  EXPECT_THAT(table.units(token_table.Find("RIP")), IsEmpty());
+  EXPECT_THAT(table.units(token_table.Intern("XMM0")), IsEmpty());
+}
+
+}  // namespace
+}  // namespace gematria
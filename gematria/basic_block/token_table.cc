@@ -0,0 +1,102 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "gematria/basic_block/token_table.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+
+#include "absl/log/absl_check.h"
+#include "absl/numeric/bits.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+
+namespace gematria {
+
+TokenTable::TokenTable() {
+  const TokenId empty_token_id = Intern("");
+  ABSL_CHECK_EQ(empty_token_id, kEmptyTokenId);
+}
+
+TokenTable::~TokenTable() {
+  for (std::atomic<std::string*>& chunk : chunks_) {
+    delete[] chunk.load(std::memory_order_relaxed);
+  }
+}
+
+std::pair<int, int> TokenTable::ChunkAndOffset(TokenId token_id) {
+  // Chunk `i` starts at ID (kFirstChunkSize << i) - kFirstChunkSize. Shifting
+  // the IDs by kFirstChunkSize aligns the start of each chunk with a power of
+  // two, so the index of the chunk is given by the highest bit of the ID.
+  const uint32_t shifted_id = static_cast<uint32_t>(token_id) + kFirstChunkSize;
+  const int chunk = absl::bit_width(shifted_id) - 1 - kFirstChunkSizeLog2;
+  const int offset =
+      static_cast<int>(shifted_id - (uint32_t{kFirstChunkSize} << chunk));
+  return {chunk, offset};
+}
+
+TokenTable& TokenTable::Global() {
+  static TokenTable* const global_table = new TokenTable();
+  return *global_table;
+}
+
+TokenId TokenTable::Intern(absl::string_view token) {
+  {
+    // Most calls look up tokens that are already in the table; we handle them
+    // with a shared lock.
+    absl::ReaderMutexLock lock(&mutex_);
+    const auto it = ids_.find(token);
+    if (it != ids_.end()) return it->second;
+  }
+
+  absl::MutexLock lock(&mutex_);
+  // Another thread might have added the token between the two locks.
+  const auto it = ids_.find(token);
+  if (it != ids_.end()) return it->second;
+
+  const TokenId token_id = size_.load(std::memory_order_relaxed);
+  const auto [chunk_index, offset] = ChunkAndOffset(token_id);
+  ABSL_CHECK_LT(chunk_index, kMaxNumChunks);
+  std::string* chunk = chunks_[chunk_index].load(std::memory_order_relaxed);
+  if (chunk == nullptr) {
+    chunk = new std::string[size_t{kFirstChunkSize} << chunk_index];
+    chunks_[chunk_index].store(chunk, std::memory_order_release);
+  }
+  std::string& name = chunk[offset];
+  name.assign(token.data(), token.size());
+  ids_.emplace(name, token_id);
+  size_.store(token_id + 1, std::memory_order_release);
+  return token_id;
+}
+
+TokenId TokenTable::Find(absl::string_view token) const {
+  absl::ReaderMutexLock lock(&mutex_);
+  const auto it = ids_.find(token);
+  if (it == ids_.end()) return kInvalidTokenId;
+  return it->second;
+}
+
+const std::string& TokenTable::Name(TokenId token_id) const {
+  ABSL_DCHECK_GE(token_id, 0);
+  ABSL_DCHECK_LT(token_id, size_.load(std::memory_order_acquire));
+  const auto [chunk_index, offset] = ChunkAndOffset(token_id);
+  return chunks_[chunk_index].load(std::memory_order_acquire)[offset];
+}
+
+int TokenTable::size() const { return size_.load(std::memory_order_acquire); }
+
+}  // namespace gematria
@@ -0,0 +1,106 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Contains a process-wide table of interned tokens. Interning maps each
+// distinct string to a small integer ID, so that tokens can be compared and
+// hashed as integers, and so that each distinct string is stored only once.
+//
+// The table only grows; interned strings are never removed, and references to
+// them remain valid for the lifetime of the table. It is intended for tokens
+// from a small closed set, e.g. the names of registers of the CPU.
+
+#ifndef THIRD_PARTY_GEMATRIA_GEMATRIA_BASIC_BLOCK_TOKEN_TABLE_H_
+#define THIRD_PARTY_GEMATRIA_GEMATRIA_BASIC_BLOCK_TOKEN_TABLE_H_
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <utility>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+
+namespace gematria {
+
+// The ID of an interned token. IDs are assigned consecutively starting from
+// zero, in the order in which the tokens were first interned.
+using TokenId = int32_t;
+
+// A table of interned tokens. All methods are thread-safe. Name() and size() do
+// not take any lock; Intern() and Find() take a shared lock, and Intern() takes
+// an exclusive lock to add a new token.
+class TokenTable {
+ public:
+  // The ID of the empty string. The empty string is interned in every table.
+  static constexpr TokenId kEmptyTokenId = 0;
+  // The value returned by Find() for tokens that were not interned.
+  static constexpr TokenId kInvalidTokenId = -1;
+
+  TokenTable();
+  ~TokenTable();
+
+  TokenTable(const TokenTable&) = delete;
+  TokenTable& operator=(const TokenTable&) = delete;
+
+  // Returns the global token table. The global table is never destroyed.
+  static TokenTable& Global();
+
+  // Returns the ID of `token`. Adds `token` to the table if it was not interned
+  // before.
+  TokenId Intern(absl::string_view token);
+
+  // Returns the ID of `token`, or kInvalidTokenId when `token` was not
+  // interned.
+  TokenId Find(absl::string_view token) const;
+
+  // Returns the string corresponding to `token_id`. The reference remains valid
+  // for the lifetime of the table. `token_id` must be a value returned by
+  // Intern() on this table.
+  const std::string& Name(TokenId token_id) const;
+
+  // Returns the number of interned tokens, including the empty string.
+  int size() const;
+
+ private:
+  // The interned strings are stored in chunks of growing size; chunk `i` holds
+  // kFirstChunkSize << i strings, so that kMaxNumChunks chunks can hold a
+  // string for every non-negative TokenId.
+  static constexpr int kFirstChunkSizeLog2 = 8;
+  static constexpr int kFirstChunkSize = 1 << kFirstChunkSizeLog2;
+  static constexpr int kMaxNumChunks = 24;
+
+  // Returns the index of the chunk that holds `token_id` and the index of
+  // `token_id` in the chunk.
+  static std::pair<int, int> ChunkAndOffset(TokenId token_id);
+
+  mutable absl::Mutex mutex_;
+
+  // The chunks with the interned strings; chunks are allocated when the first
+  // string is added to them. The chunks are never moved or freed before the
+  // table is destroyed, so the keys in `ids_` and references returned by Name()
+  // remain valid when new tokens are added. Each string is written only once,
+  // under `mutex_`, before its ID is published through `size_` and `ids_`;
+  // Name() can thus read the strings without taking the lock.
+  std::array<std::atomic<std::string*>, kMaxNumChunks> chunks_ = {};
+  // The number of interned strings. Updated under `mutex_`, read without it.
+  std::atomic<int> size_ = 0;
+  absl::flat_hash_map<absl::string_view, TokenId> ids_ ABSL_GUARDED_BY(mutex_);
+};
+
+}  // namespace gematria
+
+#endif  // THIRD_PARTY_GEMATRIA_GEMATRIA_BASIC_BLOCK_TOKEN_TABLE_H_
@@ -0,0 +1,105 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "gematria/basic_block/token_table.h"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace gematria {
+namespace {
+
+using ::testing::Each;
+using ::testing::Eq;
+
+TEST(TokenTableTest, EmptyString) {
+  TokenTable table;
+  EXPECT_EQ(table.size(), 1);
+  EXPECT_EQ(table.Find(""), TokenTable::kEmptyTokenId);
+  EXPECT_EQ(table.Intern(""), TokenTable::kEmptyTokenId);
+  EXPECT_EQ(table.Name(TokenTable::kEmptyTokenId), "");
+}
+
+TEST(TokenTableTest, Intern) {
+  TokenTable table;
+  const TokenId rax = table.Intern("RAX");
+  const TokenId rbx = table.Intern("RBX");
+  EXPECT_NE(rax, rbx);
+  EXPECT_NE(rax, TokenTable::kEmptyTokenId);
+  EXPECT_EQ(table.Intern("RAX"), rax);
+  EXPECT_EQ(table.Find("RBX"), rbx);
+  EXPECT_EQ(table.Find("RCX"), TokenTable::kInvalidTokenId);
+  EXPECT_EQ(table.Name(rax), "RAX");
+  EXPECT_EQ(table.Name(rbx), "RBX");
+  EXPECT_EQ(table.size(), 3);
+}
+
+TEST(TokenTableTest, ReferencesRemainValid) {
+  TokenTable table;
+  const std::string& rax = table.Name(table.Intern("RAX"));
+  for (int i = 0; i < 10000; ++i) {
+    table.Intern(std::to_string(i));
+  }
+  EXPECT_EQ(rax, "RAX");
+  EXPECT_EQ(&table.Name(table.Find("RAX")), &rax);
+}
+
+TEST(TokenTableTest, ConcurrentIntern) {
+  static constexpr int kNumThreads = 8;
+  static constexpr int kNumTokens = 1000;
+  TokenTable table;
+  std::vector<std::vector<TokenId>> ids(kNumThreads);
+  std::vector<std::thread> threads;
+  for (int thread_index = 0; thread_index < kNumThreads; ++thread_index) {
+    threads.emplace_back([&table, &ids, thread_index]() {
+      for (int i = 0; i < kNumTokens; ++i) {
+        ids[thread_index].push_back(table.Intern(std::to_string(i)));
+      }
+    });
+  }
+  for (std::thread& thread : threads) thread.join();
+
+  EXPECT_EQ(table.size(), kNumTokens + 1);
+  EXPECT_THAT(ids, Each(Eq(ids[0])));
+  for (int i = 0; i < kNumTokens; ++i) {
+    EXPECT_EQ(table.Name(ids[0][i]), std::to_string(i));
+  }
+}
+
+TEST(TokenTableTest, NameWhileInterning) {
+  static constexpr int kNumTokens = 10000;
+  TokenTable table;
+  const TokenId rax = table.Intern("RAX");
+  std::thread writer([&table]() {
+    for (int i = 0; i < kNumTokens; ++i) {
+      table.Intern(std::to_string(i));
+    }
+  });
+  // Name() does not take the lock; it must return stable references also while
+  // other threads add new chunks to the table.
+  for (int i = 0; i < kNumTokens; ++i) {
+    EXPECT_EQ(table.Name(rax), "RAX");
+    EXPECT_FALSE(table.Name(table.size() - 1).empty());
+  }
+  writer.join();
+  EXPECT_EQ(table.size(), kNumTokens + 2);
+  EXPECT_EQ(table.Name(table.Find("9999")), "9999");
+}
+
+}  // namespace
+}  // namespace gematria
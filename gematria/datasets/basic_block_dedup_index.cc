@@ -0,0 +1,103 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "gematria/datasets/basic_block_dedup_index.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+
+#include "absl/strings/str_format.h"
+#include "absl/types/span.h"
+#include "gematria/proto/throughput.pb.h"
+
+namespace gematria {
+namespace {
+
+constexpr uint64_t kFnvOffsetBasis = 0xcbf29ce484222325u;
+constexpr uint64_t kFnvPrime = 0x100000001b3u;
+
+}  // namespace
+
+std::string MachineCodeFingerprint(absl::Span<const uint8_t> machine_code) {
+  uint64_t hash = kFnvOffsetBasis;
+  for (const uint8_t byte : machine_code) {
+    hash = (hash ^ byte) * kFnvPrime;
+  }
+  return absl::StrFormat("%016x", hash);
+}
+
+void MergeInverseThroughputs(const BasicBlockWithThroughputProto& source,
+                             BasicBlockWithThroughputProto& destination) {
+  for (const ThroughputWithSourceProto& throughput :
+       source.inverse_throughputs()) {
+    ThroughputWithSourceProto* merged = nullptr;
+    for (ThroughputWithSourceProto& existing :
+         *destination.mutable_inverse_throughputs()) {
+      if (existing.source() == throughput.source()) {
+        merged = &existing;
+        break;
+      }
+    }
+    if (merged == nullptr) {
+      *destination.add_inverse_throughputs() = throughput;
+      continue;
+    }
+    merged->mutable_inverse_throughput_cycles()->MergeFrom(
+        throughput.inverse_throughput_cycles());
+    for (int i = 0; i < throughput.prefix_inverse_throughputs_size(); ++i) {
+      const auto& prefix = throughput.prefix_inverse_throughputs(i);
+      if (i < merged->prefix_inverse_throughputs_size()) {
+        merged->mutable_prefix_inverse_throughputs(i)
+            ->mutable_inverse_throughput_cycles()
+            ->MergeFrom(prefix.inverse_throughput_cycles());
+      } else {
+        *merged->add_prefix_inverse_throughputs() = prefix;
+      }
+    }
+  }
+}
+
+std::string BasicBlockDedupIndex::Key(absl::Span<const uint8_t> machine_code,
+                                      uint64_t base_address) {
+  std::string key(reinterpret_cast<const char*>(&base_address),
+                  sizeof(base_address));
+  key.append(reinterpret_cast<const char*>(machine_code.data()),
+             machine_code.size());
+  return key;
+}
+
+const BasicBlockWithThroughputProto* BasicBlockDedupIndex::Find(
+    absl::Span<const uint8_t> machine_code, uint64_t base_address) const {
+  const auto it = block_indices_.find(Key(machine_code, base_address));
+  if (it == block_indices_.end()) return nullptr;
+  return &blocks_[it->second];
+}
+
+bool BasicBlockDedupIndex::Add(absl::Span<const uint8_t> machine_code,
+                               uint64_t base_address,
+                               BasicBlockWithThroughputProto block) {
+  const auto [it, inserted] = block_indices_.try_emplace(
+      Key(machine_code, base_address), blocks_.size());
+  if (!inserted) {
+    MergeInverseThroughputs(block, blocks_[it->second]);
+    ++num_duplicates_;
+    return false;
+  }
+  blocks_.push_back(std::move(block));
+  return true;
+}
+
+}  // namespace gematria
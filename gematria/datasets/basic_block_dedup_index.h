@@ -0,0 +1,84 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Contains helpers for identifying and merging duplicate basic blocks in data
+// sets: a stable fingerprint of the machine code of a basic block, and an index
+// of unique basic blocks that merges the throughputs of their duplicates.
+
+#ifndef THIRD_PARTY_GEMATRIA_GEMATRIA_DATASETS_BASIC_BLOCK_DEDUP_INDEX_H_
+#define THIRD_PARTY_GEMATRIA_GEMATRIA_DATASETS_BASIC_BLOCK_DEDUP_INDEX_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/types/span.h"
+#include "gematria/proto/throughput.pb.h"
+
+namespace gematria {
+
+// Returns the fingerprint of the machine code of a basic block: the 64-bit
+// FNV-1a hash of the machine code bytes, formatted as 16 lowercase hex digits.
+// The fingerprint does not depend on the platform or on the process, so it can
+// be stored in BasicBlockProto.fingerprint and compared across data sets.
+std::string MachineCodeFingerprint(absl::Span<const uint8_t> machine_code);
+
+// Merges `source` into `destination`: the inverse throughputs from a source
+// that is already present in `destination` are appended to the values from
+// this source; the other sources are added as new entries.
+void MergeInverseThroughputs(const BasicBlockWithThroughputProto& source,
+                             BasicBlockWithThroughputProto& destination);
+
+// An index of unique basic blocks, keyed by their machine code and the address
+// of their first instruction. Blocks are compared by their full machine code,
+// not only by the fingerprint, so hash collisions can't merge different blocks.
+// The class is not thread-safe.
+class BasicBlockDedupIndex {
+ public:
+  // Returns the block with the given machine code and base address, or nullptr
+  // when the index does not contain such block. The pointer remains valid until
+  // the next call to Add().
+  const BasicBlockWithThroughputProto* Find(
+      absl::Span<const uint8_t> machine_code, uint64_t base_address) const;
+
+  // Adds `block` to the index. When the index already contains a block with the
+  // same machine code and base address, merges the inverse throughputs of
+  // `block` into the existing block, ignores `block.basic_block()`, and returns
+  // false. Otherwise, stores `block` as a new unique block and returns true.
+  bool Add(absl::Span<const uint8_t> machine_code, uint64_t base_address,
+           BasicBlockWithThroughputProto block);
+
+  // The unique blocks in the order in which they were first added.
+  const std::vector<BasicBlockWithThroughputProto>& blocks() const {
+    return blocks_;
+  }
+
+  // The number of calls to Add() that were merged into an existing block.
+  int64_t num_duplicates() const { return num_duplicates_; }
+
+ private:
+  static std::string Key(absl::Span<const uint8_t> machine_code,
+                         uint64_t base_address);
+
+  // Maps the keys of the blocks to their indices in `blocks_`.
+  absl::flat_hash_map<std::string, size_t> block_indices_;
+  std::vector<BasicBlockWithThroughputProto> blocks_;
+  int64_t num_duplicates_ = 0;
+};
+
+}  // namespace gematria
+
+#endif  // THIRD_PARTY_GEMATRIA_GEMATRIA_DATASETS_BASIC_BLOCK_DEDUP_INDEX_H_
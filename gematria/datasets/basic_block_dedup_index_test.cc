@@ -0,0 +1,121 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "gematria/datasets/basic_block_dedup_index.h"
+
+#include <cstdint>
+#include <vector>
+
+#include "gematria/proto/throughput.pb.h"
+#include "gematria/testing/matchers.h"
+#include "gematria/testing/parse_proto.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace gematria {
+namespace {
+
+TEST(MachineCodeFingerprintTest, KnownValues) {
+  EXPECT_EQ(MachineCodeFingerprint({}), "cbf29ce484222325");
+  EXPECT_EQ(MachineCodeFingerprint(std::vector<uint8_t>{0x90}),
+            "af644d4c8602ac8f");
+  EXPECT_EQ(MachineCodeFingerprint(std::vector<uint8_t>{0x49, 0x29, 0xd2}),
+            "40d8b319c8dbcddf");
+}
+
+TEST(MergeInverseThroughputsTest, MergeSourcesAndPrefixes) {
+  BasicBlockWithThroughputProto destination = ParseTextProto(R"pb(
+    inverse_throughputs {
+      source: "a"
+      inverse_throughput_cycles: 1
+      prefix_inverse_throughputs { inverse_throughput_cycles: 0.5 }
+    }
+  )pb");
+  const BasicBlockWithThroughputProto source = ParseTextProto(R"pb(
+    inverse_throughputs {
+      source: "b"
+      inverse_throughput_cycles: 3
+    }
+    inverse_throughputs {
+      source: "a"
+      inverse_throughput_cycles: 2
+      prefix_inverse_throughputs { inverse_throughput_cycles: 0.7 }
+      prefix_inverse_throughputs { inverse_throughput_cycles: 1.7 }
+    }
+  )pb");
+  MergeInverseThroughputs(source, destination);
+  EXPECT_THAT(destination, EqualsProto(R"pb(
+                inverse_throughputs {
+                  source: "a"
+                  inverse_throughput_cycles: 1
+                  inverse_throughput_cycles: 2
+                  prefix_inverse_throughputs {
+                    inverse_throughput_cycles: 0.5
+                    inverse_throughput_cycles: 0.7
+                  }
+                  prefix_inverse_throughputs { inverse_throughput_cycles: 1.7 }
+                }
+                inverse_throughputs {
+                  source: "b"
+                  inverse_throughput_cycles: 3
+                }
+              )pb"));
+}
+
+TEST(BasicBlockDedupIndexTest, AddAndFind) {
+  const std::vector<uint8_t> first_code = {0x90};
+  const std::vector<uint8_t> second_code = {0x90, 0x90};
+  BasicBlockDedupIndex index;
+  EXPECT_EQ(index.Find(first_code, 0), nullptr);
+
+  EXPECT_TRUE(index.Add(first_code, 0, ParseTextProto(R"pb(
+                          basic_block { fingerprint: "first" }
+                          inverse_throughputs {
+                            source: "a"
+                            inverse_throughput_cycles: 1
+                          }
+                        )pb")));
+  EXPECT_TRUE(index.Add(second_code, 0, ParseTextProto(R"pb(
+                          basic_block { fingerprint: "second" }
+                        )pb")));
+  EXPECT_TRUE(index.Add(first_code, 16, ParseTextProto(R"pb(
+                          basic_block { fingerprint: "first at 16" }
+                        )pb")));
+  EXPECT_FALSE(index.Add(first_code, 0, ParseTextProto(R"pb(
+                           basic_block { fingerprint: "ignored" }
+                           inverse_throughputs {
+                             source: "a"
+                             inverse_throughput_cycles: 2
+                           }
+                         )pb")));
+  EXPECT_EQ(index.num_duplicates(), 1);
+
+  const BasicBlockWithThroughputProto* const first = index.Find(first_code, 0);
+  ASSERT_NE(first, nullptr);
+  EXPECT_THAT(*first, EqualsProto(R"pb(
+                basic_block { fingerprint: "first" }
+                inverse_throughputs {
+                  source: "a"
+                  inverse_throughput_cycles: 1
+                  inverse_throughput_cycles: 2
+                }
+              )pb"));
+  ASSERT_EQ(index.blocks().size(), 3);
+  EXPECT_EQ(&index.blocks()[0], first);
+  EXPECT_EQ(index.blocks()[1].basic_block().fingerprint(), "second");
+  EXPECT_EQ(index.blocks()[2].basic_block().fingerprint(), "first at 16");
+}
+
+}  // namespace
+}  // namespace gematria
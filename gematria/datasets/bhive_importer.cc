@@ -14,27 +14,37 @@
 
 #include "gematria/datasets/bhive_importer.h"
 
+#include <algorithm>
+#include <cstddef>
 #include <cstdint>
 #include <memory>
+#include <string>
 #include <string_view>
 #include <utility>
 #include <vector>
 
-#include "absl/container/inlined_vector.h"
 #include "absl/log/die_if_null.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/numbers.h"
 #include "absl/strings/str_cat.h"
-#include "absl/strings/str_split.h"
 #include "absl/types/span.h"
 #include "gematria/basic_block/basic_block_protos.h"
+#include "gematria/datasets/basic_block_dedup_index.h"
 #include "gematria/llvm/canonicalizer.h"
 #include "gematria/llvm/disassembler.h"
 #include "gematria/proto/basic_block.pb.h"
 #include "gematria/proto/throughput.pb.h"
 #include "gematria/utils/string.h"
+#include "google/protobuf/arena.h"
+#include "llvm/include/llvm/MC/MCInstrDesc.h"
+#include "llvm/include/llvm/MC/MCInstrInfo.h"
 #include "llvm/include/llvm/MC/TargetRegistry.h"
+#include "llvm/include/llvm/Object/ObjectFile.h"
+#include "llvm/include/llvm/Support/Error.h"
+#include "llvm/include/llvm/Support/ErrorOr.h"
+#include "llvm/include/llvm/Support/MemoryBuffer.h"
+#include "llvm/include/llvm/Support/MemoryBufferRef.h"
 
 namespace gematria {
 namespace {
@@ -44,9 +54,47 @@ namespace {
 // each architecture, since it is guaranteed to always be there.
 constexpr int kDefaultSyntax = 0;
 
+// The columns of a line of a BHive CSV file.
+struct BHiveCsvLine {
+  std::string_view machine_code_hex;
+  double throughput_cycles = 0.0;
+};
+
+absl::StatusOr<BHiveCsvLine> SplitBHiveCsvLine(std::string_view line) {
+  // We look for the separator directly rather than using absl::StrSplit() to
+  // avoid allocating a container for the columns.
+  const size_t separator = line.find(',');
+  if (separator == std::string_view::npos ||
+      line.find(',', separator + 1) != std::string_view::npos) {
+    const int num_columns = 1 + std::count(line.begin(), line.end(), ',');
+    return absl::InvalidArgumentError(
+        absl::StrCat("Expected `line` to have 2 columns, found ", num_columns,
+                     ": '", line, "'"));
+  }
+  BHiveCsvLine csv_line;
+  csv_line.machine_code_hex = line.substr(0, separator);
+  const std::string_view throughput_str = line.substr(separator + 1);
+  if (!absl::SimpleAtod(throughput_str, &csv_line.throughput_cycles)) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Could not parse throughput value ", throughput_str));
+  }
+  return csv_line;
+}
+
+void AddInverseThroughput(std::string_view source_name,
+                          double throughput_cycles,
+                          BasicBlockWithThroughputProto& proto) {
+  ThroughputWithSourceProto& throughput = *proto.add_inverse_throughputs();
+  // Assigning to the existing string reuses its memory when the proto is
+  // reused.
+  throughput.mutable_source()->assign(source_name.data(), source_name.size());
+  throughput.add_inverse_throughput_cycles(throughput_cycles);
+}
+
 }  // namespace
 
-BHiveImporter::BHiveImporter(const Canonicalizer* canonicalizer)
+BHiveImporter::BHiveImporter(const Canonicalizer* canonicalizer,
+                             const DisassemblerOptions& disassembler_options)
     : canonicalizer_(*ABSL_DIE_IF_NULL(canonicalizer)),
       target_machine_(canonicalizer->target_machine()),
       context_(std::make_unique<llvm::MCContext>(
@@ -58,72 +106,268 @@ BHiveImporter::BHiveImporter(const Canonicalizer* canonicalizer)
       mc_inst_printer_(target_machine_.getTarget().createMCInstPrinter(
           target_machine_.getTargetTriple(), kDefaultSyntax,
           *target_machine_.getMCAsmInfo(), *target_machine_.getMCInstrInfo(),
-          *target_machine_.getMCRegisterInfo())) {}
+          *target_machine_.getMCRegisterInfo())),
+      disassembler_options_(disassembler_options) {}
 
 absl::StatusOr<BasicBlockProto> BHiveImporter::BasicBlockProtoFromMachineCode(
     absl::Span<const uint8_t> machine_code, uint64_t base_address /*= 0*/) {
   BasicBlockProto basic_block_proto;
-  absl::StatusOr<std::vector<DisassembledInstruction>> instructions_or_status =
-      DisassembleAllInstructions(*disassembler_,
-                                 *target_machine_.getMCInstrInfo(),
-                                 *target_machine_.getMCRegisterInfo(),
-                                 *target_machine_.getMCSubtargetInfo(),
-                                 *mc_inst_printer_, base_address, machine_code);
-  if (!instructions_or_status.ok()) return instructions_or_status.status();
-
-  for (DisassembledInstruction& instruction : instructions_or_status.value()) {
-    *basic_block_proto.add_machine_instructions() =
-        std::move(instruction.instruction);
-    *basic_block_proto.add_canonicalized_instructions() = ProtoFromInstruction(
+  const absl::Status status = FillBasicBlockProtoFromMachineCode(
+      machine_code, base_address, basic_block_proto);
+  if (!status.ok()) return status;
+  return basic_block_proto;
+}
+
+absl::Status BHiveImporter::FillBasicBlockProtoFromMachineCode(
+    absl::Span<const uint8_t> machine_code, uint64_t base_address,
+    BasicBlockProto& proto) {
+  const absl::Status status = DisassembleAllInstructions(
+      *disassembler_, *target_machine_.getMCInstrInfo(),
+      *target_machine_.getMCRegisterInfo(),
+      *target_machine_.getMCSubtargetInfo(), *mc_inst_printer_,
+      disassembler_options_, base_address, machine_code, instructions_buffer_);
+  if (!status.ok()) return status;
+
+  FillBasicBlockProtoFromInstructions(absl::MakeSpan(instructions_buffer_),
+                                      machine_code, proto);
+  return absl::OkStatus();
+}
+
+void BHiveImporter::FillBasicBlockProtoFromInstructions(
+    absl::Span<DisassembledInstruction> instructions,
+    absl::Span<const uint8_t> machine_code, BasicBlockProto& proto) {
+  proto.Clear();
+  proto.set_fingerprint(MachineCodeFingerprint(machine_code));
+  // Swapping is cheap only when both protos use the same arena; otherwise
+  // protobuf would make copies in both directions.
+  const bool can_swap_instructions = proto.GetArena() == nullptr;
+  canonicalized_instructions_buffer_.clear();
+  for (DisassembledInstruction& instruction : instructions) {
+    MachineInstructionProto& machine_instruction =
+        *proto.add_machine_instructions();
+    if (can_swap_instructions) {
+      machine_instruction.Swap(&instruction.instruction);
+    } else {
+      machine_instruction = instruction.instruction;
+    }
+    canonicalized_instructions_buffer_.push_back(
         canonicalizer_.InstructionFromMCInst(instruction.mc_inst));
   }
-  return basic_block_proto;
+  // The alias groups depend on all memory accesses in the block, so they can
+  // be assigned only after all instructions are canonicalized.
+  canonicalizer_.AssignMemoryAliasGroups(canonicalized_instructions_buffer_);
+  for (const Instruction& instruction : canonicalized_instructions_buffer_) {
+    AppendInstructionToProto(instruction,
+                             proto.add_canonicalized_instructions());
+  }
 }
 
 absl::StatusOr<BasicBlockProto>
 BHiveImporter::BasicBlockProtoFromMachineCodeHex(
     std::string_view machine_code_hex, uint64_t base_address /*= 0*/) {
-  const absl::StatusOr<std::vector<uint8_t>> machine_code_bytes_or_status =
-      ParseHexString(machine_code_hex);
-  if (!machine_code_bytes_or_status.ok()) {
-    return machine_code_bytes_or_status.status();
-  }
+  const absl::Status status =
+      ParseHexStringInto(machine_code_hex, machine_code_buffer_);
+  if (!status.ok()) return status;
 
-  return BasicBlockProtoFromMachineCode(machine_code_bytes_or_status.value(),
-                                        base_address);
+  return BasicBlockProtoFromMachineCode(machine_code_buffer_, base_address);
 }
 
 absl::StatusOr<BasicBlockWithThroughputProto> BHiveImporter::ParseBHiveCsvLine(
     std::string_view source_name, std::string_view line,
     double throughput_scaling /*= 1.0*/, uint64_t base_address /*= 0*/) {
-  const absl::InlinedVector<std::string_view, 2> columns =
-      absl::StrSplit(line, ',');
-  if (columns.size() != 2) {
-    return absl::InvalidArgumentError(
-        absl::StrCat("Expected `line` to have 2 columns, found ",
-                     columns.size(), ": '", line, "'"));
-  }
-  const std::string_view machine_code_hex = columns[0];
-  const std::string_view throughput_str = columns[1];
+  BasicBlockWithThroughputProto proto;
+  const absl::Status status = ParseBHiveCsvLineInto(
+      source_name, line, proto, throughput_scaling, base_address);
+  if (!status.ok()) return status;
+  return proto;
+}
+
+absl::Status BHiveImporter::ParseBHiveCsvLineInto(
+    std::string_view source_name, std::string_view line,
+    BasicBlockWithThroughputProto& proto, double throughput_scaling /*= 1.0*/,
+    uint64_t base_address /*= 0*/) {
+  const absl::StatusOr<BHiveCsvLine> csv_line = SplitBHiveCsvLine(line);
+  if (!csv_line.ok()) return csv_line.status();
+  absl::Status status =
+      ParseHexStringInto(csv_line->machine_code_hex, machine_code_buffer_);
+  if (!status.ok()) return status;
+
+  proto.Clear();
+  status = FillBasicBlockProtoFromMachineCode(
+      machine_code_buffer_, base_address, *proto.mutable_basic_block());
+  if (!status.ok()) return status;
+  AddInverseThroughput(source_name,
+                       csv_line->throughput_cycles * throughput_scaling, proto);
+  return absl::OkStatus();
+}
+
+absl::StatusOr<BasicBlockWithThroughputProto*>
+BHiveImporter::ParseBHiveCsvLineOnArena(google::protobuf::Arena& arena,
+                                        std::string_view source_name,
+                                        std::string_view line,
+                                        double throughput_scaling /*= 1.0*/,
+                                        uint64_t base_address /*= 0*/) {
+  BasicBlockWithThroughputProto* const proto =
+      google::protobuf::Arena::CreateMessage<BasicBlockWithThroughputProto>(
+          &arena);
+  const absl::Status status = ParseBHiveCsvLineInto(
+      source_name, line, *proto, throughput_scaling, base_address);
+  if (!status.ok()) return status;
+  return proto;
+}
+
+absl::StatusOr<bool> BHiveImporter::AddBHiveCsvLineToIndex(
+    BasicBlockDedupIndex& index, std::string_view source_name,
+    std::string_view line, double throughput_scaling /*= 1.0*/,
+    uint64_t base_address /*= 0*/) {
+  const absl::StatusOr<BHiveCsvLine> csv_line = SplitBHiveCsvLine(line);
+  if (!csv_line.ok()) return csv_line.status();
+  const absl::Status status =
+      ParseHexStringInto(csv_line->machine_code_hex, machine_code_buffer_);
+  if (!status.ok()) return status;
+  const absl::Span<const uint8_t> machine_code = machine_code_buffer_;
 
   BasicBlockWithThroughputProto proto;
-  absl::StatusOr<BasicBlockProto> block_proto_or_status =
-      BasicBlockProtoFromMachineCodeHex(machine_code_hex, base_address);
-  if (!block_proto_or_status.ok()) return block_proto_or_status.status();
-  *proto.mutable_basic_block() = std::move(block_proto_or_status).value();
+  if (index.Find(machine_code, base_address) == nullptr) {
+    absl::StatusOr<BasicBlockProto> block_proto_or_status =
+        BasicBlockProtoFromMachineCode(machine_code, base_address);
+    if (!block_proto_or_status.ok()) return block_proto_or_status.status();
+    *proto.mutable_basic_block() = std::move(block_proto_or_status).value();
+  }
+  AddInverseThroughput(source_name,
+                       csv_line->throughput_cycles * throughput_scaling, proto);
+  return index.Add(machine_code, base_address, std::move(proto));
+}
 
-  double throughput_cycles = 0.0;
-  if (!absl::SimpleAtod(throughput_str, &throughput_cycles)) {
+BasicBlockSplittingStats BHiveImporter::ForEachBasicBlockInMachineCode(
+    absl::Span<const uint8_t> machine_code, uint64_t base_address,
+    BasicBlockCallback callback,
+    const BasicBlockSplittingOptions& options /*= {}*/) {
+  const llvm::MCInstrInfo& instruction_info = *target_machine_.getMCInstrInfo();
+  const uint8_t* const machine_code_begin = machine_code.data();
+  BasicBlockSplittingStats stats;
+
+  // The instructions of the current basic block are the first
+  // `num_block_instructions` elements of `instructions_buffer_`; its machine
+  // code starts at `block_begin`.
+  const uint8_t* block_begin = machine_code.data();
+  size_t num_block_instructions = 0;
+  // Passes the current basic block to the callback, if it is big enough, and
+  // starts a new one. `block_end` is the end of the machine code of the block.
+  // Returns false when the iteration should stop.
+  auto finish_block = [&](const uint8_t* block_end) {
+    const size_t num_instructions = num_block_instructions;
+    num_block_instructions = 0;
+    if (num_instructions == 0 ||
+        num_instructions < static_cast<size_t>(options.min_block_size)) {
+      return true;
+    }
+    ++stats.num_blocks;
+    BasicBlockProto block;
+    FillBasicBlockProtoFromInstructions(
+        absl::MakeSpan(instructions_buffer_.data(), num_instructions),
+        absl::MakeConstSpan(block_begin, block_end), block);
+    return callback(std::move(block));
+  };
+
+  while (!machine_code.empty()) {
+    const uint8_t* const instruction_begin = machine_code.data();
+    if (num_block_instructions == instructions_buffer_.size()) {
+      instructions_buffer_.emplace_back();
+    }
+    DisassembledInstruction& instruction =
+        instructions_buffer_[num_block_instructions];
+    const absl::Status status = DisassembleOneInstruction(
+        *disassembler_, instruction_info, *target_machine_.getMCRegisterInfo(),
+        *target_machine_.getMCSubtargetInfo(), *mc_inst_printer_,
+        disassembler_options_,
+        base_address + (instruction_begin - machine_code_begin), machine_code,
+        instruction);
+    if (!status.ok()) {
+      if (!finish_block(instruction_begin)) return stats;
+      ++stats.num_invalid_bytes;
+      machine_code.remove_prefix(1);
+      block_begin = machine_code.data();
+      continue;
+    }
+    ++stats.num_instructions;
+
+    const llvm::MCInstrDesc& descriptor =
+        instruction_info.get(instruction.mc_inst.getOpcode());
+    const bool ends_block =
+        descriptor.isBranch() || descriptor.isIndirectBranch() ||
+        descriptor.isReturn() || descriptor.isTerminator() ||
+        (options.split_at_calls && descriptor.isCall());
+    if (!ends_block) {
+      ++num_block_instructions;
+      continue;
+    }
+    if (options.include_terminators) ++num_block_instructions;
+    if (!finish_block(options.include_terminators ? machine_code.data()
+                                                  : instruction_begin)) {
+      return stats;
+    }
+    block_begin = machine_code.data();
+  }
+  finish_block(machine_code.data());
+  return stats;
+}
+
+absl::StatusOr<BasicBlockSplittingStats>
+BHiveImporter::ForEachBasicBlockInObjectFile(
+    llvm::MemoryBufferRef object_file, BasicBlockCallback callback,
+    const BasicBlockSplittingOptions& options /*= {}*/) {
+  llvm::Expected<std::unique_ptr<llvm::object::ObjectFile>> object =
+      llvm::object::ObjectFile::createObjectFile(object_file);
+  if (!object) {
     return absl::InvalidArgumentError(
-        absl::StrCat("Could not parse throughput value ", throughput_str));
+        absl::StrCat("Could not parse the object file: ",
+                     llvm::toString(object.takeError())));
   }
 
-  ThroughputWithSourceProto& throughput = *proto.add_inverse_throughputs();
-  throughput.set_source(std::string(source_name));
-  throughput.add_inverse_throughput_cycles(throughput_cycles *
-                                           throughput_scaling);
+  BasicBlockSplittingStats stats;
+  bool stopped = false;
+  auto section_callback = [&](BasicBlockProto block) {
+    stopped = !callback(std::move(block));
+    return !stopped;
+  };
+  for (const llvm::object::SectionRef& section : (*object)->sections()) {
+    if (!section.isText()) continue;
+    llvm::Expected<llvm::StringRef> contents = section.getContents();
+    if (!contents) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Could not read a text section: ",
+                       llvm::toString(contents.takeError())));
+    }
+    const BasicBlockSplittingStats section_stats =
+        ForEachBasicBlockInMachineCode(
+            absl::MakeConstSpan(
+                reinterpret_cast<const uint8_t*>(contents->data()),
+                contents->size()),
+            section.getAddress(), section_callback, options);
+    stats.num_blocks += section_stats.num_blocks;
+    stats.num_instructions += section_stats.num_instructions;
+    stats.num_invalid_bytes += section_stats.num_invalid_bytes;
+    if (stopped) break;
+  }
+  return stats;
+}
 
-  return proto;
+absl::StatusOr<BasicBlockSplittingStats>
+BHiveImporter::ForEachBasicBlockInObjectFile(
+    const std::string& file_name, BasicBlockCallback callback,
+    const BasicBlockSplittingOptions& options /*= {}*/) {
+  // Without the null terminator requirement, LLVM memory-maps large files
+  // instead of reading them.
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> buffer =
+      llvm::MemoryBuffer::getFile(file_name, /*IsText=*/false,
+                                  /*RequiresNullTerminator=*/false);
+  if (!buffer) {
+    return absl::NotFoundError(absl::StrCat("Could not open ", file_name, ": ",
+                                            buffer.getError().message()));
+  }
+  return ForEachBasicBlockInObjectFile((*buffer)->getMemBufferRef(), callback,
+                                       options);
 }
 
 }  // namespace gematria
@@ -20,27 +20,65 @@
 
 #include <cstdint>
 #include <memory>
+#include <string>
 #include <string_view>
+#include <vector>
 
+#include "absl/functional/function_ref.h"
 #include "absl/status/statusor.h"
 #include "absl/types/span.h"
+#include "gematria/basic_block/basic_block.h"
+#include "gematria/datasets/basic_block_dedup_index.h"
 #include "gematria/llvm/canonicalizer.h"
+#include "gematria/llvm/disassembler.h"
 #include "gematria/proto/basic_block.pb.h"
 #include "gematria/proto/throughput.pb.h"
+#include "google/protobuf/arena.h"
 #include "llvm/include/llvm/MC/MCContext.h"
 #include "llvm/include/llvm/MC/MCDisassembler/MCDisassembler.h"
 #include "llvm/include/llvm/MC/MCInstPrinter.h"
+#include "llvm/include/llvm/Support/MemoryBufferRef.h"
 #include "llvm/include/llvm/Target/TargetMachine.h"
 
 namespace gematria {
 
+// Controls how BHiveImporter splits a sequence of machine code into basic
+// blocks.
+struct BasicBlockSplittingOptions {
+  // Include the control-flow instruction that ends a basic block as the last
+  // instruction of the block. When false, the instruction is dropped, which
+  // matches the format of the BHive data set.
+  bool include_terminators = false;
+  // End basic blocks also at call instructions.
+  bool split_at_calls = true;
+  // Basic blocks with fewer instructions are not passed to the callback.
+  int min_block_size = 1;
+};
+
+// Statistics collected while splitting machine code into basic blocks.
+struct BasicBlockSplittingStats {
+  // The number of basic blocks passed to the callback.
+  int64_t num_blocks = 0;
+  // The number of instructions that were disassembled successfully, including
+  // the terminators and instructions in blocks skipped due to their size.
+  int64_t num_instructions = 0;
+  // The number of bytes that could not be disassembled and were skipped.
+  int64_t num_invalid_bytes = 0;
+};
+
 // Parser for BHive CSV files.
 class BHiveImporter {
  public:
   // Creates a new BHive importer from a given canonicalizer. The canonicalizer
   // must be for the architecture/microarchitecture of the data set.
   // Does not take ownership of the canonicalizer.
-  explicit BHiveImporter(const Canonicalizer* canonicalizer);
+  // `disassembler_options` selects the fields of the machine instruction protos
+  // filled in by the importer; the canonicalized instructions are always
+  // included. For example, skipping the assembly code saves one call to the
+  // instruction printer per instruction.
+  explicit BHiveImporter(
+      const Canonicalizer* canonicalizer,
+      const DisassemblerOptions& disassembler_options = DisassemblerOptions());
 
   // Creates a basic block from the given block of machine code. `machine_code`
   // must contain machine code of the instructions to include in the basic
@@ -48,7 +86,8 @@ class BHiveImporter {
   // first instruction, and `machine_code.rbegin()` is the last byte of the last
   // instruction. Uses `base_address` as the address of the first instruction;
   // the addresses of following instructions are derived from `base_address` and
-  // the sizes of the instructions that preceded it.
+  // the sizes of the instructions that preceded it. The fingerprint of the
+  // basic block is set to MachineCodeFingerprint(machine_code).
   // Returns an error when parts of `machine_code` do not disassemble using the
   // provided canonicalizer.
 
@@ -72,12 +111,108 @@ class BHiveImporter {
       std::string_view source_name, std::string_view line,
       double throughput_scaling = 1.0, uint64_t base_address = 0);
 
+  // A version of ParseBHiveCsvLine() that stores the basic block in a
+  // caller-owned `proto`. The previous contents of `proto` are cleared, but
+  // protobuf keeps the memory of the cleared strings and repeated fields, so
+  // reusing the same proto for many lines avoids almost all heap allocations.
+  // `proto` may be allocated on a google::protobuf::Arena. On error, the
+  // contents of `proto` are unspecified.
+  absl::Status ParseBHiveCsvLineInto(std::string_view source_name,
+                                     std::string_view line,
+                                     BasicBlockWithThroughputProto& proto,
+                                     double throughput_scaling = 1.0,
+                                     uint64_t base_address = 0);
+
+  // A version of ParseBHiveCsvLine() that allocates the proto and all its
+  // sub-messages on `arena`. The returned proto is owned by the arena, so a
+  // whole batch of blocks parsed this way is freed in one step together with
+  // the arena. On error, the arena may still contain a partially filled proto.
+  absl::StatusOr<BasicBlockWithThroughputProto*> ParseBHiveCsvLineOnArena(
+      google::protobuf::Arena& arena, std::string_view source_name,
+      std::string_view line, double throughput_scaling = 1.0,
+      uint64_t base_address = 0);
+
+  // Parses a basic block with throughput from one BHive CSV line, in the same
+  // way as ParseBHiveCsvLine(), and adds it to `index`. When `index` already
+  // contains a block with the same machine code and base address, skips the
+  // disassembly and only merges the throughput into the existing block.
+  // Returns true when the line added a new unique block to the index, false
+  // when it was merged into an existing one, or an error when the line can't
+  // be parsed.
+  absl::StatusOr<bool> AddBHiveCsvLineToIndex(BasicBlockDedupIndex& index,
+                                              std::string_view source_name,
+                                              std::string_view line,
+                                              double throughput_scaling = 1.0,
+                                              uint64_t base_address = 0);
+
+  // Called for each basic block found by ForEachBasicBlockInMachineCode() and
+  // ForEachBasicBlockInObjectFile(). Returning false stops the iteration.
+  using BasicBlockCallback = absl::FunctionRef<bool(BasicBlockProto)>;
+
+  // Disassembles `machine_code` sequentially and splits it into basic blocks
+  // at control-flow instructions, i.e. at instructions that are marked as
+  // branches, returns, or terminators (and optionally calls) in their
+  // MCInstrDesc. Calls `callback` with each basic block, in the order in which
+  // they appear in `machine_code`; the fingerprint of each block is computed
+  // from its bytes in `machine_code`. Uses `base_address` as the address of the
+  // first byte of `machine_code`.
+  // Blocks are split only at control-flow instructions; they are not split at
+  // the targets of jumps. Bytes that can't be disassembled end the current
+  // basic block and are skipped one at a time.
+  // The machine code is not copied; `machine_code` can point to a
+  // memory-mapped file.
+  BasicBlockSplittingStats ForEachBasicBlockInMachineCode(
+      absl::Span<const uint8_t> machine_code, uint64_t base_address,
+      BasicBlockCallback callback,
+      const BasicBlockSplittingOptions& options = BasicBlockSplittingOptions());
+
+  // Splits all text sections of the object file in `object_file` into basic
+  // blocks in the same way as ForEachBasicBlockInMachineCode(). Uses the
+  // addresses of the sections from the object file as base addresses. The
+  // statistics are summed over all sections. Returns an error when
+  // `object_file` can't be parsed as an object file supported by LLVM.
+  absl::StatusOr<BasicBlockSplittingStats> ForEachBasicBlockInObjectFile(
+      llvm::MemoryBufferRef object_file, BasicBlockCallback callback,
+      const BasicBlockSplittingOptions& options = BasicBlockSplittingOptions());
+
+  // A version of ForEachBasicBlockInObjectFile() that memory-maps the object
+  // file from `file_name`.
+  absl::StatusOr<BasicBlockSplittingStats> ForEachBasicBlockInObjectFile(
+      const std::string& file_name, BasicBlockCallback callback,
+      const BasicBlockSplittingOptions& options = BasicBlockSplittingOptions());
+
  private:
+  // Fills `proto` with the basic block from already disassembled
+  // `instructions`. `machine_code` are the bytes of the instructions; they are
+  // used to compute the fingerprint of the block. Clears `proto` before adding
+  // the instructions, and swaps the machine instruction protos with the
+  // elements of `instructions`, so that the memory of both can be reused.
+  void FillBasicBlockProtoFromInstructions(
+      absl::Span<DisassembledInstruction> instructions,
+      absl::Span<const uint8_t> machine_code, BasicBlockProto& proto);
+
+  // A version of BasicBlockProtoFromMachineCode() that stores the basic block
+  // in `proto`.
+  absl::Status FillBasicBlockProtoFromMachineCode(
+      absl::Span<const uint8_t> machine_code, uint64_t base_address,
+      BasicBlockProto& proto);
+
   const Canonicalizer& canonicalizer_;
   const llvm::TargetMachine& target_machine_;
   std::unique_ptr<llvm::MCContext> context_;
   std::unique_ptr<llvm::MCDisassembler> disassembler_;
   std::unique_ptr<llvm::MCInstPrinter> mc_inst_printer_;
+  const DisassemblerOptions disassembler_options_;
+
+  // The disassembled instructions of the last basic block. Kept between calls
+  // to reuse the allocated memory.
+  std::vector<DisassembledInstruction> instructions_buffer_;
+  // The canonicalized instructions of the last basic block, before they are
+  // added to the proto. Kept between calls to reuse the allocated memory.
+  std::vector<Instruction> canonicalized_instructions_buffer_;
+  // The machine code decoded from the hex string of the last basic block. Kept
+  // between calls to reuse the allocated memory.
+  std::vector<uint8_t> machine_code_buffer_;
 };
 
 }  // namespace gematria
@@ -0,0 +1,135 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Microbenchmarks for BHiveImporter. The benchmarks report the number of basic
+// blocks per second as "items_per_second", and the number of instructions per
+// second as "instructions".
+//
+// Run with:
+//   bazel run -c opt //gematria/datasets:bhive_importer_benchmark
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "absl/log/absl_check.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "benchmark/benchmark.h"
+#include "gematria/datasets/bhive_importer.h"
+#include "gematria/llvm/canonicalizer.h"
+#include "gematria/llvm/disassembler.h"
+#include "gematria/llvm/llvm_architecture_support.h"
+#include "gematria/proto/throughput.pb.h"
+
+namespace gematria {
+namespace {
+
+constexpr absl::string_view kSourceName = "bhive: skl";
+constexpr double kScaling = 1.0 / 100.0;
+
+// The machine code of a short sequence of instructions taken from the BHive
+// data set:
+//   sub rbx, rdx
+//   mov eax, dword ptr [rsp + 108]
+//   mov edx, dword ptr [rsp + 104]
+//   sar rbx, 3
+//   sub rax, rdx
+//   cmp rbx, rax
+// The benchmarks build basic blocks by repeating it.
+constexpr absl::string_view kMachineCodeHex =
+    "4829d38b44246c8b54246848c1fb034829d04839c3";
+constexpr int kNumInstructionsInMachineCode = 6;
+
+// Returns a BHive CSV line with a basic block that contains
+// `num_instructions` instructions. `num_instructions` must be a multiple of
+// kNumInstructionsInMachineCode.
+std::string MakeBHiveCsvLine(int num_instructions) {
+  ABSL_CHECK_EQ(num_instructions % kNumInstructionsInMachineCode, 0);
+  std::string line;
+  for (int i = 0; i < num_instructions / kNumInstructionsInMachineCode; ++i) {
+    absl::StrAppend(&line, kMachineCodeHex);
+  }
+  absl::StrAppend(&line, ",207.000000");
+  return line;
+}
+
+// Parses a BHive CSV line with `state.range(0)` instructions.
+// `state.range(1)` selects the fields of the machine instruction protos filled
+// in by the importer: 0 means only the canonicalized instructions, 1 means all
+// the fields (the default of the importer).
+void BM_ParseBHiveCsvLine(benchmark::State& state) {
+  const int num_instructions = state.range(0);
+  const bool all_fields = state.range(1) != 0;
+  DisassemblerOptions disassembler_options;
+  if (!all_fields) {
+    disassembler_options.include_assembly = false;
+    disassembler_options.include_machine_code = false;
+    disassembler_options.include_address = false;
+  }
+  const std::unique_ptr<LlvmArchitectureSupport> llvm_architecture =
+      LlvmArchitectureSupport::X86_64();
+  X86Canonicalizer canonicalizer(&llvm_architecture->target_machine());
+  BHiveImporter importer(&canonicalizer, disassembler_options);
+  const std::string line = MakeBHiveCsvLine(num_instructions);
+  ABSL_CHECK_OK(
+      importer.ParseBHiveCsvLine(kSourceName, line, kScaling).status());
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        importer.ParseBHiveCsvLine(kSourceName, line, kScaling));
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.counters["instructions"] = benchmark::Counter(
+      state.iterations() * num_instructions, benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_ParseBHiveCsvLine)
+    ->ArgNames({"instructions", "all_fields"})
+    ->ArgsProduct({{6, 60, 240}, {0, 1}});
+
+// Parses a BHive CSV line with `state.range(0)` instructions into a proto that
+// is reused between the iterations. `state.range(1)` has the same meaning as in
+// BM_ParseBHiveCsvLine.
+void BM_ParseBHiveCsvLineInto(benchmark::State& state) {
+  const int num_instructions = state.range(0);
+  const bool all_fields = state.range(1) != 0;
+  DisassemblerOptions disassembler_options;
+  if (!all_fields) {
+    disassembler_options.include_assembly = false;
+    disassembler_options.include_machine_code = false;
+    disassembler_options.include_address = false;
+  }
+  const std::unique_ptr<LlvmArchitectureSupport> llvm_architecture =
+      LlvmArchitectureSupport::X86_64();
+  X86Canonicalizer canonicalizer(&llvm_architecture->target_machine());
+  BHiveImporter importer(&canonicalizer, disassembler_options);
+  const std::string line = MakeBHiveCsvLine(num_instructions);
+  BasicBlockWithThroughputProto proto;
+  ABSL_CHECK_OK(
+      importer.ParseBHiveCsvLineInto(kSourceName, line, proto, kScaling));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        importer.ParseBHiveCsvLineInto(kSourceName, line, proto, kScaling));
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.counters["instructions"] = benchmark::Counter(
+      state.iterations() * num_instructions, benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_ParseBHiveCsvLineInto)
+    ->ArgNames({"instructions", "all_fields"})
+    ->ArgsProduct({{6, 60, 240}, {0, 1}});
+
+}  // namespace
+}  // namespace gematria
+
+BENCHMARK_MAIN();
@@ -14,13 +14,24 @@
 
 #include "gematria/datasets/bhive_importer.h"
 
+#include <cstdint>
 #include <memory>
+#include <string>
+#include <utility>
+#include <vector>
 
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "gematria/datasets/basic_block_dedup_index.h"
 #include "gematria/llvm/canonicalizer.h"
 #include "gematria/llvm/llvm_architecture_support.h"
+#include "gematria/proto/basic_block.pb.h"
+#include "gematria/proto/throughput.pb.h"
 #include "gematria/testing/matchers.h"
+#include "google/protobuf/arena.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
+#include "llvm/include/llvm/Support/MemoryBufferRef.h"
 
 namespace gematria {
 namespace {
@@ -47,10 +58,29 @@ class BHiveImporterTest : public ::testing::Test {
 
 using BHiveImporterDeathTest = BHiveImporterTest;
 
+// Machine code of a loop followed by a return:
+//   0: subq %rdx, %r10
+//   3: jne 0
+//   5: addq %rbx, %rax
+//   8: retq
+constexpr uint8_t kLoopMachineCode[] = {0x49, 0x29, 0xd2, 0x75, 0xfb,
+                                        0x48, 0x01, 0xd8, 0xc3};
+
+// Returns the LLVM mnemonics of the canonicalized instructions in `block`.
+std::vector<std::string> LlvmMnemonics(const BasicBlockProto& block) {
+  std::vector<std::string> mnemonics;
+  for (const auto& instruction : block.canonicalized_instructions()) {
+    mnemonics.push_back(instruction.llvm_mnemonic());
+  }
+  return mnemonics;
+}
+
 TEST_F(BHiveImporterTest, EmptyBlock) {
   EXPECT_THAT(
       x86_bhive_importer_->ParseBHiveCsvLine(kSourceName, ",0", kScaling),
-      IsOkAndHolds(EqualsProto(R"pb(basic_block {}
+      IsOkAndHolds(EqualsProto(R"pb(basic_block {
+                                      fingerprint: "cbf29ce484222325"
+                                    }
                                     inverse_throughputs {
                                       source: "bhive: skl"
                                       inverse_throughput_cycles: 0
@@ -62,6 +92,7 @@ TEST_F(BHiveImporterTest, OneInstruction) {
                                                      "4929d2,100.000000", 0.5),
               IsOkAndHolds(EqualsProto(
                   R"pb(basic_block {
+                         fingerprint: "40d8b319c8dbcddf"
                          machine_instructions {
                            assembly: "\tsubq\t%rdx, %r10"
                            machine_code: "I)\322"
@@ -81,7 +112,8 @@ TEST_F(BHiveImporterTest, OneInstruction) {
                        })pb")));
   EXPECT_THAT(x86_bhive_importer_->BasicBlockProtoFromMachineCodeHex("4929d2"),
               IsOkAndHolds(EqualsProto(
-                  R"pb(machine_instructions {
+                  R"pb(fingerprint: "40d8b319c8dbcddf"
+                       machine_instructions {
                          assembly: "\tsubq\t%rdx, %r10"
                          machine_code: "I)\322"
                        }
@@ -98,6 +130,7 @@ TEST_F(BHiveImporterTest, OneInstruction) {
 TEST_F(BHiveImporterTest, MultipleInstructions) {
   static constexpr absl::string_view kExpectedBasicBlockProto =
       R"pb(basic_block {
+             fingerprint: "e651b4047fc7425d"
              machine_instructions {
                assembly: "\tsubq\t%rdx, %rbx"
                machine_code: "H)\323"
@@ -204,5 +237,284 @@ TEST_F(BHiveImporterTest, InvalidMachineCode) {
               StatusIs(absl::StatusCode::kInvalidArgument));
 }
 
+TEST_F(BHiveImporterTest, TooManyColumnsOnLine) {
+  EXPECT_THAT(x86_bhive_importer_->ParseBHiveCsvLine(
+                  kSourceName, "4929d2,100.000000,1", kScaling),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "Expected `line` to have 2 columns, found 3: "
+                       "'4929d2,100.000000,1'"));
+}
+
+TEST_F(BHiveImporterTest, ParseBHiveCsvLineIntoReusedProto) {
+  BasicBlockWithThroughputProto proto;
+  ASSERT_OK(x86_bhive_importer_->ParseBHiveCsvLineInto(
+      "other source", "4829d38b44246c8b54246848c1fb034829d04839c3,207.000000",
+      proto, kScaling, /*base_address=*/100));
+  ASSERT_OK(x86_bhive_importer_->ParseBHiveCsvLineInto(
+      kSourceName, "4929d2,100.000000", proto, 0.5));
+  EXPECT_THAT(proto, EqualsProto(R"pb(basic_block {
+                                        fingerprint: "40d8b319c8dbcddf"
+                                        machine_instructions {
+                                          assembly: "\tsubq\t%rdx, %r10"
+                                          machine_code: "I)\322"
+                                        }
+                                        canonicalized_instructions {
+                                          mnemonic: "SUB"
+                                          llvm_mnemonic: "SUB64rr"
+                                          output_operands {
+                                            register_name: "R10"
+                                          }
+                                          input_operands {
+                                            register_name: "R10"
+                                          }
+                                          input_operands {
+                                            register_name: "RDX"
+                                          }
+                                          implicit_output_operands {
+                                            register_name: "EFLAGS"
+                                          }
+                                        }
+                                      }
+                                      inverse_throughputs {
+                                        source: "bhive: skl"
+                                        inverse_throughput_cycles: 50
+                                      })pb"));
+}
+
+TEST_F(BHiveImporterTest, ParseBHiveCsvLineOnArena) {
+  google::protobuf::Arena arena;
+  absl::StatusOr<BasicBlockWithThroughputProto*> proto =
+      x86_bhive_importer_->ParseBHiveCsvLineOnArena(
+          arena, kSourceName, "4929d2,100.000000", kScaling);
+  ASSERT_OK(proto);
+  EXPECT_EQ((*proto)->GetArena(), &arena);
+  EXPECT_THAT(**proto, EqualsProto(R"pb(basic_block {
+                                          fingerprint: "40d8b319c8dbcddf"
+                                          machine_instructions {
+                                            assembly: "\tsubq\t%rdx, %r10"
+                                            machine_code: "I)\322"
+                                          }
+                                          canonicalized_instructions {
+                                            mnemonic: "SUB"
+                                            llvm_mnemonic: "SUB64rr"
+                                            output_operands {
+                                              register_name: "R10"
+                                            }
+                                            input_operands {
+                                              register_name: "R10"
+                                            }
+                                            input_operands {
+                                              register_name: "RDX"
+                                            }
+                                            implicit_output_operands {
+                                              register_name: "EFLAGS"
+                                            }
+                                          }
+                                        }
+                                        inverse_throughputs {
+                                          source: "bhive: skl"
+                                          inverse_throughput_cycles: 1
+                                        })pb"));
+}
+
+TEST_F(BHiveImporterTest, ParseBHiveCsvLineOnArenaError) {
+  google::protobuf::Arena arena;
+  EXPECT_THAT(x86_bhive_importer_->ParseBHiveCsvLineOnArena(
+                  arena, kSourceName, "4929d2", kScaling),
+              StatusIs(absl::StatusCode::kInvalidArgument));
+}
+
+TEST_F(BHiveImporterTest, OnlyCanonicalizedInstructions) {
+  BHiveImporter importer(x86_canonicalizer_.get(),
+                         DisassemblerOptions{/*include_assembly=*/false,
+                                             /*include_machine_code=*/false,
+                                             /*include_address=*/false});
+  // Parse two blocks with the same importer to check that reusing the
+  // instruction buffers does not leak data between blocks.
+  ASSERT_OK(importer.BasicBlockProtoFromMachineCodeHex(
+      "4829d38b44246c8b54246848c1fb034829d04839c3", /*base_address=*/100));
+  EXPECT_THAT(importer.BasicBlockProtoFromMachineCodeHex("4929d2",
+                                                         /*base_address=*/100),
+              IsOkAndHolds(EqualsProto(
+                  R"pb(fingerprint: "40d8b319c8dbcddf"
+                       machine_instructions {}
+                       canonicalized_instructions {
+                         mnemonic: "SUB"
+                         llvm_mnemonic: "SUB64rr"
+                         output_operands { register_name: "R10" }
+                         input_operands { register_name: "R10" }
+                         input_operands { register_name: "RDX" }
+                         implicit_output_operands { register_name: "EFLAGS" }
+                       })pb")));
+}
+
+TEST_F(BHiveImporterTest, AddressBasedMemoryAliasGroups) {
+  const X86Canonicalizer canonicalizer(&x86_llvm_->target_machine(),
+                                       MemoryAliasAnalysis::kAddressBased);
+  BHiveImporter importer(&canonicalizer);
+  // Machine code:
+  //   movq %rax, 8(%rsp)
+  //   movq %rbx, 16(%rsp)
+  //   movq 8(%rsp), %rcx
+  const absl::StatusOr<BasicBlockProto> block =
+      importer.BasicBlockProtoFromMachineCodeHex(
+          "488944240848895c2410488b4c2408");
+  ASSERT_OK(block);
+  ASSERT_EQ(block->canonicalized_instructions_size(), 3);
+  EXPECT_EQ(block->canonicalized_instructions(0)
+                .output_operands(0)
+                .memory()
+                .alias_group_id(),
+            1);
+  EXPECT_EQ(block->canonicalized_instructions(1)
+                .output_operands(0)
+                .memory()
+                .alias_group_id(),
+            2);
+  EXPECT_EQ(block->canonicalized_instructions(2)
+                .input_operands(0)
+                .memory()
+                .alias_group_id(),
+            1);
+}
+
+TEST_F(BHiveImporterTest, AddBHiveCsvLineToIndex) {
+  BasicBlockDedupIndex index;
+  EXPECT_THAT(x86_bhive_importer_->AddBHiveCsvLineToIndex(
+                  index, kSourceName, "4929d2,100.000000", kScaling),
+              IsOkAndHolds(true));
+  EXPECT_THAT(x86_bhive_importer_->AddBHiveCsvLineToIndex(
+                  index, kSourceName, "4829d3,200.000000", kScaling),
+              IsOkAndHolds(true));
+  EXPECT_THAT(x86_bhive_importer_->AddBHiveCsvLineToIndex(
+                  index, kSourceName, "4929D2,300.000000", kScaling),
+              IsOkAndHolds(false));
+  EXPECT_THAT(x86_bhive_importer_->AddBHiveCsvLineToIndex(
+                  index, "other source", "4929d2,400.000000", kScaling),
+              IsOkAndHolds(false));
+  // The same machine code at a different address is a different block.
+  EXPECT_THAT(x86_bhive_importer_->AddBHiveCsvLineToIndex(
+                  index, kSourceName, "4929d2,500.000000", kScaling,
+                  /*base_address=*/100),
+              IsOkAndHolds(true));
+  EXPECT_THAT(x86_bhive_importer_->AddBHiveCsvLineToIndex(
+                  index, kSourceName, "4929", kScaling),
+              StatusIs(absl::StatusCode::kInvalidArgument));
+
+  EXPECT_EQ(index.num_duplicates(), 2);
+  ASSERT_EQ(index.blocks().size(), 3);
+  EXPECT_THAT(index.blocks()[0],
+              EqualsProto(R"pb(basic_block {
+                                 fingerprint: "40d8b319c8dbcddf"
+                                 machine_instructions {
+                                   assembly: "\tsubq\t%rdx, %r10"
+                                   machine_code: "I)\322"
+                                 }
+                                 canonicalized_instructions {
+                                   mnemonic: "SUB"
+                                   llvm_mnemonic: "SUB64rr"
+                                   output_operands { register_name: "R10" }
+                                   input_operands { register_name: "R10" }
+                                   input_operands { register_name: "RDX" }
+                                   implicit_output_operands {
+                                     register_name: "EFLAGS"
+                                   }
+                                 }
+                               }
+                               inverse_throughputs {
+                                 source: "bhive: skl"
+                                 inverse_throughput_cycles: 1
+                                 inverse_throughput_cycles: 3
+                               }
+                               inverse_throughputs {
+                                 source: "other source"
+                                 inverse_throughput_cycles: 4
+                               })pb"));
+  EXPECT_EQ(index.blocks()[2].basic_block().machine_instructions(0).address(),
+            100);
+}
+
+TEST_F(BHiveImporterTest, ForEachBasicBlockInMachineCode) {
+  std::vector<BasicBlockProto> blocks;
+  const BasicBlockSplittingStats stats =
+      x86_bhive_importer_->ForEachBasicBlockInMachineCode(
+          kLoopMachineCode, 100, [&](BasicBlockProto block) {
+            blocks.push_back(std::move(block));
+            return true;
+          });
+  EXPECT_EQ(stats.num_blocks, 2);
+  EXPECT_EQ(stats.num_instructions, 4);
+  EXPECT_EQ(stats.num_invalid_bytes, 0);
+  ASSERT_EQ(blocks.size(), 2);
+
+  EXPECT_THAT(LlvmMnemonics(blocks[0]), ::testing::ElementsAre("SUB64rr"));
+  EXPECT_EQ(blocks[0].machine_instructions(0).address(), 100);
+  EXPECT_EQ(blocks[0].fingerprint(), "40d8b319c8dbcddf");
+  EXPECT_THAT(LlvmMnemonics(blocks[1]), ::testing::ElementsAre("ADD64rr"));
+  EXPECT_EQ(blocks[1].machine_instructions(0).address(), 105);
+}
+
+TEST_F(BHiveImporterTest, ForEachBasicBlockInMachineCodeWithTerminators) {
+  BasicBlockSplittingOptions options;
+  options.include_terminators = true;
+  std::vector<int> block_sizes;
+  x86_bhive_importer_->ForEachBasicBlockInMachineCode(
+      kLoopMachineCode, 0,
+      [&](BasicBlockProto block) {
+        block_sizes.push_back(block.canonicalized_instructions_size());
+        return true;
+      },
+      options);
+  EXPECT_THAT(block_sizes, ::testing::ElementsAre(2, 2));
+}
+
+TEST_F(BHiveImporterTest, ForEachBasicBlockInMachineCodeMinBlockSize) {
+  BasicBlockSplittingOptions options;
+  options.min_block_size = 2;
+  const BasicBlockSplittingStats stats =
+      x86_bhive_importer_->ForEachBasicBlockInMachineCode(
+          kLoopMachineCode, 0, [](BasicBlockProto) { return true; }, options);
+  EXPECT_EQ(stats.num_blocks, 0);
+  EXPECT_EQ(stats.num_instructions, 4);
+}
+
+TEST_F(BHiveImporterTest, ForEachBasicBlockInMachineCodeSkipsInvalidBytes) {
+  // 0x06 is not a valid instruction in 64-bit mode.
+  constexpr uint8_t kMachineCode[] = {0x49, 0x29, 0xd2, 0x06,
+                                      0x48, 0x01, 0xd8};
+  std::vector<BasicBlockProto> blocks;
+  const BasicBlockSplittingStats stats =
+      x86_bhive_importer_->ForEachBasicBlockInMachineCode(
+          kMachineCode, 0, [&](BasicBlockProto block) {
+            blocks.push_back(std::move(block));
+            return true;
+          });
+  EXPECT_EQ(stats.num_invalid_bytes, 1);
+  ASSERT_EQ(blocks.size(), 2);
+  EXPECT_THAT(LlvmMnemonics(blocks[0]), ::testing::ElementsAre("SUB64rr"));
+  EXPECT_THAT(LlvmMnemonics(blocks[1]), ::testing::ElementsAre("ADD64rr"));
+  EXPECT_EQ(blocks[1].machine_instructions(0).address(), 4);
+}
+
+TEST_F(BHiveImporterTest, ForEachBasicBlockInMachineCodeStops) {
+  int num_calls = 0;
+  const BasicBlockSplittingStats stats =
+      x86_bhive_importer_->ForEachBasicBlockInMachineCode(
+          kLoopMachineCode, 0, [&](BasicBlockProto) {
+            ++num_calls;
+            return false;
+          });
+  EXPECT_EQ(num_calls, 1);
+  EXPECT_EQ(stats.num_blocks, 1);
+}
+
+TEST_F(BHiveImporterTest, ForEachBasicBlockInObjectFileInvalidFile) {
+  constexpr char kNotAnObjectFile[] = "this is not an object file";
+  EXPECT_THAT(x86_bhive_importer_->ForEachBasicBlockInObjectFile(
+                  llvm::MemoryBufferRef(kNotAnObjectFile, "test"),
+                  [](BasicBlockProto) { return true; }),
+              StatusIs(absl::StatusCode::kInvalidArgument));
+}
+
 }  // namespace
 }  // namespace gematria
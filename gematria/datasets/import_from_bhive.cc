@@ -0,0 +1,245 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Creates a Gematria data set from a BHive data set using multiple threads.
+//
+// Reads basic blocks and throughput data from a BHive CSV file, and writes them
+// in the proto format to one or more Gematria .tfrecord files. This is a native
+// version of gematria/datasets/python/import_from_bhive.py intended for large
+// data sets.
+//
+// Usage:
+//   import_from_bhive \
+//       --gematria_input_csv=/tmp/bhive/skl.csv \
+//       --gematria_output_tfrecord=/tmp/bhive/skl.tfrecord \
+//       --gematria_throughput_source_name="bhive: skl" \
+//       --gematria_num_workers=64 \
+//       --gematria_num_output_shards=16
+//
+// When --gematria_num_output_shards is greater than one, the output is written
+// to files named {gematria_output_tfrecord}-{shard:05d}-of-{num_shards:05d}.
+//
+// When --gematria_tokens_file is used, only blocks whose instructions use only
+// the tokens from the file are written to the output. The check uses
+// BasicBlockGraphBuilder::CanAddBasicBlockFromProto() and it is much cheaper
+// than filtering the blocks later in the training pipeline.
+
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>  // NOLINT(build/c++11)
+#include <utility>
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/log/absl_log.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/strip.h"
+#include "gematria/basic_block/basic_block.h"
+#include "gematria/datasets/parallel_bhive_importer.h"
+#include "gematria/granite/graph_builder.h"
+#include "gematria/io/tfrecord.h"
+#include "gematria/llvm/canonicalizer_pool.h"
+#include "gematria/llvm/llvm_architecture_support.h"
+#include "gematria/model/oov_token_behavior.h"
+#include "gematria/proto/basic_block.pb.h"
+
+ABSL_FLAG(std::string, gematria_input_csv, "",
+          "The name of the BHive CSV file to import.");
+ABSL_FLAG(std::string, gematria_output_tfrecord, "",
+          "The name of the TFRecord file to write the data to. When the output "
+          "is sharded, this is used as the prefix of the names of the shards.");
+ABSL_FLAG(std::string, gematria_throughput_source_name, "",
+          "The name of the throughput source used for the throughput data from "
+          "the CSV file.");
+ABSL_FLAG(double, gematria_throughput_scaling, 1.0,
+          "The scaling coefficient applied to the throughput values from the "
+          "CSV file.");
+ABSL_FLAG(std::string, gematria_llvm_triple, "x86_64",
+          "The LLVM triple used for disassembling the instructions in the data "
+          "set.");
+ABSL_FLAG(bool, gematria_include_assembly, true,
+          "When true, the output protos contain the assembly code of the "
+          "machine instructions.");
+ABSL_FLAG(int, gematria_num_workers, 0,
+          "The number of worker threads. When zero, uses the number of "
+          "hardware threads.");
+ABSL_FLAG(int, gematria_num_output_shards, 1,
+          "The number of output TFRecord files.");
+ABSL_FLAG(bool, gematria_deterministic_order, true,
+          "When true, the blocks are written in the order in which they appear "
+          "in the input file and the assignment of blocks to shards is stable. "
+          "When false, the workers write the blocks as they are processed.");
+ABSL_FLAG(std::string, gematria_tokens_file, "",
+          "When not empty, the name of a text file with one token per line. "
+          "Blocks that use tokens that are not in the file are not written to "
+          "the output. Lines that start with a hash symbol (#) are ignored.");
+
+namespace gematria {
+namespace {
+
+// Reads the tokens from `file_name`. Uses the same format as the Python flag
+// --gematria_tokens_file: one token per line, leading and trailing whitespace
+// is removed, and empty lines and lines starting with '#' are ignored. The
+// special tokens used by the graph builder are always included.
+absl::StatusOr<std::vector<std::string>> ReadTokensFile(
+    const std::string& file_name) {
+  std::ifstream input(file_name);
+  if (!input.is_open()) {
+    return absl::NotFoundError(
+        absl::StrCat("Could not open the tokens file: ", file_name));
+  }
+  std::vector<std::string> tokens = {std::string(kImmediateToken),
+                                     std::string(kAddressToken),
+                                     std::string(kMemoryToken)};
+  std::string line;
+  while (std::getline(input, line)) {
+    const std::string_view token = absl::StripAsciiWhitespace(line);
+    if (token.empty() || token.front() == '#') continue;
+    tokens.emplace_back(token);
+  }
+  std::sort(tokens.begin(), tokens.end());
+  tokens.erase(std::unique(tokens.begin(), tokens.end()), tokens.end());
+  return tokens;
+}
+
+int Main() {
+  const std::string input_csv = absl::GetFlag(FLAGS_gematria_input_csv);
+  const std::string output_tfrecord =
+      absl::GetFlag(FLAGS_gematria_output_tfrecord);
+  const int num_output_shards = absl::GetFlag(FLAGS_gematria_num_output_shards);
+  if (input_csv.empty() || output_tfrecord.empty() ||
+      absl::GetFlag(FLAGS_gematria_throughput_source_name).empty()) {
+    ABSL_LOG(ERROR) << "--gematria_input_csv, --gematria_output_tfrecord, and "
+                       "--gematria_throughput_source_name are required.";
+    return 1;
+  }
+  if (num_output_shards <= 0) {
+    ABSL_LOG(ERROR) << "--gematria_num_output_shards must be positive.";
+    return 1;
+  }
+
+  const std::string llvm_triple = absl::GetFlag(FLAGS_gematria_llvm_triple);
+  absl::StatusOr<std::unique_ptr<LlvmArchitectureSupport>> llvm =
+      LlvmArchitectureSupport::FromTriple(llvm_triple, "", "");
+  if (!llvm.ok()) {
+    ABSL_LOG(ERROR) << "LLVM triple '" << llvm_triple
+                    << "' is not known or supported: " << llvm.status();
+    return 1;
+  }
+  // TODO(ondrasej): Update this so that the canonicalizer is created using the
+  // LLVM triple. For now, this is OK, because we support only x86-64 anyway.
+  const std::unique_ptr<CanonicalizerPool> canonicalizer_pool =
+      CanonicalizerPool::X86(llvm->get());
+
+  std::ifstream input(input_csv, std::ios::binary);
+  if (!input.is_open()) {
+    ABSL_LOG(ERROR) << "Could not open the input file: " << input_csv;
+    return 1;
+  }
+  const std::string input_data((std::istreambuf_iterator<char>(input)),
+                               std::istreambuf_iterator<char>());
+  const std::vector<std::string_view> lines =
+      absl::StrSplit(input_data, '\n', absl::SkipWhitespace());
+
+  std::vector<std::unique_ptr<TFRecordWriter>> writers;
+  std::vector<TFRecordWriter*> output_shards;
+  for (int shard = 0; shard < num_output_shards; ++shard) {
+    const std::string file_name =
+        num_output_shards == 1
+            ? output_tfrecord
+            : absl::StrFormat("%s-%05d-of-%05d", output_tfrecord, shard,
+                              num_output_shards);
+    absl::StatusOr<std::unique_ptr<TFRecordWriter>> writer =
+        TFRecordWriter::Open(file_name);
+    if (!writer.ok()) {
+      ABSL_LOG(ERROR) << writer.status();
+      return 1;
+    }
+    output_shards.push_back(writer->get());
+    writers.push_back(*std::move(writer));
+  }
+
+  ParallelBHiveImportOptions options;
+  options.source_name = absl::GetFlag(FLAGS_gematria_throughput_source_name);
+  options.throughput_scaling = absl::GetFlag(FLAGS_gematria_throughput_scaling);
+  options.disassembler_options.include_assembly =
+      absl::GetFlag(FLAGS_gematria_include_assembly);
+  options.num_workers = absl::GetFlag(FLAGS_gematria_num_workers);
+  if (options.num_workers <= 0) {
+    options.num_workers =
+        std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+  }
+  options.deterministic_order =
+      absl::GetFlag(FLAGS_gematria_deterministic_order);
+
+  std::unique_ptr<BasicBlockGraphBuilder> graph_builder;
+  const std::string tokens_file = absl::GetFlag(FLAGS_gematria_tokens_file);
+  if (!tokens_file.empty()) {
+    absl::StatusOr<std::vector<std::string>> tokens =
+        ReadTokensFile(tokens_file);
+    if (!tokens.ok()) {
+      ABSL_LOG(ERROR) << tokens.status();
+      return 1;
+    }
+    graph_builder = std::make_unique<BasicBlockGraphBuilder>(
+        *std::move(tokens), /*immediate_token=*/kImmediateToken,
+        /*fp_immediate_token=*/kImmediateToken,
+        /*address_token=*/kAddressToken, /*memory_token=*/kMemoryToken,
+        OutOfVocabularyTokenBehavior::ReturnError());
+    // CanAddBasicBlockFromProto() does not modify the graph builder, so it can
+    // be called from all worker threads at the same time.
+    options.block_filter = [&graph_builder](const BasicBlockProto& block) {
+      return graph_builder->CanAddBasicBlockFromProto(block);
+    };
+  }
+
+  const absl::StatusOr<BHiveImportStats> stats = ImportBHiveCsvLinesInParallel(
+      *canonicalizer_pool, lines, options, output_shards);
+  if (!stats.ok()) {
+    ABSL_LOG(ERROR) << "The import failed: " << stats.status();
+    return 1;
+  }
+  for (TFRecordWriter* writer : output_shards) {
+    const absl::Status status = writer->Flush();
+    if (!status.ok()) {
+      ABSL_LOG(ERROR) << status;
+      return 1;
+    }
+  }
+
+  std::cout << "Processed " << stats->num_input_lines << " lines, imported "
+            << stats->num_imported_blocks << " blocks, skipped "
+            << stats->num_skipped_lines << " lines, filtered out "
+            << stats->num_filtered_blocks << " blocks." << std::endl;
+  return 0;
+}
+
+}  // namespace
+}  // namespace gematria
+
+int main(int argc, char* argv[]) {
+  absl::ParseCommandLine(argc, argv);
+  return gematria::Main();
+}
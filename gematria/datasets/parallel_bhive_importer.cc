@@ -0,0 +1,226 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "gematria/datasets/parallel_bhive_importer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/log/absl_log.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/span.h"
+#include "gematria/datasets/bhive_importer.h"
+#include "gematria/io/tfrecord.h"
+#include "gematria/llvm/canonicalizer_pool.h"
+#include "gematria/llvm/disassembler.h"
+#include "gematria/proto/throughput.pb.h"
+#include "gematria/utils/thread_pool.h"
+
+namespace gematria {
+namespace {
+
+// The maximal number of work items per worker that are processed or waiting to
+// be written in the deterministic mode. Bounds the memory used for buffering
+// the output when some work items take much longer than the others.
+constexpr int64_t kMaxWorkItemsInFlightPerWorker = 4;
+
+// The results of processing a single work item.
+struct WorkItemResult {
+  std::vector<std::string> serialized_blocks;
+  int64_t num_skipped_lines = 0;
+  int64_t num_filtered_blocks = 0;
+  bool done = false;
+};
+
+// The state owned by a single worker thread.
+struct WorkerState {
+  WorkerState(CanonicalizerPool& canonicalizer_pool,
+              const DisassemblerOptions& disassembler_options)
+      : canonicalizer(canonicalizer_pool.Acquire()),
+        importer(canonicalizer.get(), disassembler_options) {}
+
+  const CanonicalizerPool::Handle canonicalizer;
+  BHiveImporter importer;
+  // Reused for all lines processed by the worker to avoid allocations.
+  BasicBlockWithThroughputProto proto;
+};
+
+absl::Status WriteBlocks(absl::Span<const std::string> serialized_blocks,
+                         TFRecordWriter& writer) {
+  for (const std::string& block : serialized_blocks) {
+    absl::Status status = writer.Write(block);
+    if (!status.ok()) return status;
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace
+
+absl::StatusOr<BHiveImportStats> ImportBHiveCsvLinesInParallel(
+    CanonicalizerPool& canonicalizer_pool,
+    absl::Span<const std::string_view> lines,
+    const ParallelBHiveImportOptions& options,
+    absl::Span<TFRecordWriter* const> output_shards) {
+  if (options.num_workers <= 0) {
+    return absl::InvalidArgumentError("num_workers must be positive");
+  }
+  if (options.num_lines_per_work_item <= 0) {
+    return absl::InvalidArgumentError(
+        "num_lines_per_work_item must be positive");
+  }
+  if (output_shards.empty()) {
+    return absl::InvalidArgumentError("At least one output shard is required");
+  }
+
+  const int64_t num_lines = static_cast<int64_t>(lines.size());
+  const int64_t num_work_items =
+      (num_lines + options.num_lines_per_work_item - 1) /
+      options.num_lines_per_work_item;
+  const int num_workers = static_cast<int>(std::max<int64_t>(
+      1, std::min<int64_t>(options.num_workers, num_work_items)));
+
+  BHiveImportStats stats;
+  stats.num_input_lines = num_lines;
+
+  ThreadPool pool(num_workers);
+  WorkerLocal<WorkerState> worker_states(pool, [&](int) {
+    return std::make_unique<WorkerState>(canonicalizer_pool,
+                                         options.disassembler_options);
+  });
+
+  absl::Mutex mutex;
+  // The first error encountered when writing the output. Guarded by `mutex`.
+  absl::Status write_status;
+  // The results of the work items, used only in the deterministic mode. Guarded
+  // by `mutex`.
+  std::vector<WorkItemResult> results(
+      options.deterministic_order ? num_work_items : 0);
+  // The number of work items whose results were stored in `results`. Guarded
+  // by `mutex`.
+  int64_t num_finished_work_items = 0;
+  // Serializes writes to the output shards in the non-deterministic mode.
+  std::vector<absl::Mutex> shard_mutexes(output_shards.size());
+
+  std::atomic<bool> cancelled = false;
+
+  const auto process_work_item = [&](int64_t work_item) {
+    WorkItemResult result;
+    if (cancelled.load(std::memory_order_relaxed)) return result;
+    WorkerState& state = worker_states.Get();
+    const int64_t begin = work_item * options.num_lines_per_work_item;
+    const int64_t end =
+        std::min(begin + options.num_lines_per_work_item, num_lines);
+    result.serialized_blocks.reserve(end - begin);
+    for (int64_t i = begin; i < end; ++i) {
+      const absl::Status status = state.importer.ParseBHiveCsvLineInto(
+          options.source_name, lines[i], state.proto,
+          options.throughput_scaling, options.base_address);
+      if (!status.ok()) {
+        ABSL_LOG(WARNING) << "Could not process line " << i << " '" << lines[i]
+                          << "': " << status;
+        ++result.num_skipped_lines;
+        continue;
+      }
+      if (options.block_filter &&
+          !options.block_filter(state.proto.basic_block())) {
+        ++result.num_filtered_blocks;
+        continue;
+      }
+      result.serialized_blocks.push_back(state.proto.SerializeAsString());
+    }
+    return result;
+  };
+
+  if (!options.deterministic_order) {
+    pool.ParallelFor(num_work_items, [&](int64_t work_item) {
+      WorkItemResult result = process_work_item(work_item);
+      const size_t shard = pool.CurrentWorkerIndex() % output_shards.size();
+      absl::Status status;
+      {
+        absl::MutexLock lock(&shard_mutexes[shard]);
+        status = WriteBlocks(result.serialized_blocks, *output_shards[shard]);
+      }
+      absl::MutexLock lock(&mutex);
+      stats.num_skipped_lines += result.num_skipped_lines;
+      stats.num_filtered_blocks += result.num_filtered_blocks;
+      if (status.ok()) {
+        stats.num_imported_blocks += result.serialized_blocks.size();
+      } else if (write_status.ok()) {
+        write_status = std::move(status);
+        cancelled = true;
+      }
+    });
+    if (!write_status.ok()) return write_status;
+    return stats;
+  }
+
+  // Write the results in the order of the work items, as they become
+  // available. The work items are scheduled ahead of the writer only up to a
+  // fixed window, so that a slow work item does not make the others buffer
+  // all of their output.
+  const int64_t max_work_items_in_flight =
+      kMaxWorkItemsInFlightPerWorker * num_workers;
+  int64_t num_scheduled_work_items = 0;
+  for (int64_t work_item = 0; work_item < num_work_items; ++work_item) {
+    const int64_t window_end =
+        std::min(num_work_items, work_item + max_work_items_in_flight);
+    for (; num_scheduled_work_items < window_end; ++num_scheduled_work_items) {
+      pool.Schedule([&, scheduled = num_scheduled_work_items]() {
+        WorkItemResult result = process_work_item(scheduled);
+        result.done = true;
+        absl::MutexLock lock(&mutex);
+        results[scheduled] = std::move(result);
+        ++num_finished_work_items;
+      });
+    }
+    WorkItemResult result;
+    {
+      absl::MutexLock lock(&mutex);
+      mutex.Await(absl::Condition(&results[work_item].done));
+      result = std::move(results[work_item]);
+    }
+    TFRecordWriter& writer = *output_shards[work_item % output_shards.size()];
+    absl::Status status = WriteBlocks(result.serialized_blocks, writer);
+    if (!status.ok()) {
+      write_status = std::move(status);
+      cancelled = true;
+      break;
+    }
+    stats.num_skipped_lines += result.num_skipped_lines;
+    stats.num_filtered_blocks += result.num_filtered_blocks;
+    stats.num_imported_blocks += result.serialized_blocks.size();
+  }
+
+  {
+    // The scheduled tasks refer to the local variables of this function.
+    absl::MutexLock lock(&mutex);
+    const auto all_finished = [&]() {
+      return num_finished_work_items == num_scheduled_work_items;
+    };
+    mutex.Await(absl::Condition(&all_finished));
+  }
+
+  if (!write_status.ok()) return write_status;
+  return stats;
+}
+
+}  // namespace gematria
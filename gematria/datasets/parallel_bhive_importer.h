@@ -0,0 +1,103 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Contains a driver that imports basic blocks from a BHive CSV file using
+// multiple worker threads, and writes them to sharded TFRecord files.
+
+#ifndef THIRD_PARTY_GEMATRIA_GEMATRIA_DATASETS_PARALLEL_BHIVE_IMPORTER_H_
+#define THIRD_PARTY_GEMATRIA_GEMATRIA_DATASETS_PARALLEL_BHIVE_IMPORTER_H_
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+
+#include "absl/status/statusor.h"
+#include "absl/types/span.h"
+#include "gematria/io/tfrecord.h"
+#include "gematria/llvm/canonicalizer_pool.h"
+#include "gematria/llvm/disassembler.h"
+#include "gematria/proto/basic_block.pb.h"
+
+namespace gematria {
+
+// Options for ImportBHiveCsvLinesInParallel().
+struct ParallelBHiveImportOptions {
+  // The name of the throughput source used for the throughputs from the CSV.
+  std::string source_name;
+  // The scaling coefficient applied to the throughput values.
+  double throughput_scaling = 1.0;
+  // The address of the first instruction of each basic block.
+  uint64_t base_address = 0;
+  // Selects the fields of the machine instruction protos filled in by the
+  // importer.
+  DisassemblerOptions disassembler_options;
+
+  // The number of worker threads used for the import.
+  int num_workers = 1;
+  // The number of consecutive lines processed by a worker as a single unit of
+  // work.
+  int num_lines_per_work_item = 1000;
+
+  // When true, the output is deterministic: the blocks are written in the order
+  // of the lines in the input, and the i-th work item is written to the shard
+  // i % output_shards.size(). Only a small multiple of `num_workers` work items
+  // is processed ahead of the one being written, which bounds the memory used
+  // for buffering the output. When false, each worker writes the blocks
+  // directly to the shard worker_index % output_shards.size() as soon as they
+  // are processed; this avoids buffering the output of workers that run ahead
+  // of the others, but the order of the blocks in the output is not stable.
+  bool deterministic_order = true;
+
+  // When set, only the blocks for which this function returns true are written
+  // to the output; the other blocks are counted in
+  // BHiveImportStats::num_filtered_blocks. The function is called concurrently
+  // from all worker threads. This is intended for cheap checks, e.g.
+  // BasicBlockGraphBuilder::CanAddBasicBlockFromProto(), that drop blocks that
+  // a model would reject anyway before they are serialized.
+  std::function<bool(const BasicBlockProto&)> block_filter;
+};
+
+// Statistics collected during the import.
+struct BHiveImportStats {
+  // The number of lines in the input.
+  int64_t num_input_lines = 0;
+  // The number of blocks successfully imported and written to the output.
+  int64_t num_imported_blocks = 0;
+  // The number of lines that could not be parsed, e.g. because of invalid
+  // machine code or an invalid throughput value.
+  int64_t num_skipped_lines = 0;
+  // The number of blocks that were parsed successfully, but that were rejected
+  // by ParallelBHiveImportOptions::block_filter.
+  int64_t num_filtered_blocks = 0;
+};
+
+// Parses `lines` from a BHive CSV file in parallel, and writes the resulting
+// BasicBlockWithThroughputProtos to `output_shards`. Each worker thread uses
+// a canonicalizer acquired from `canonicalizer_pool` and its own BHiveImporter,
+// i.e. its own MCContext, disassembler, and instruction printer.
+//
+// Lines that can't be parsed and blocks rejected by `options.block_filter` are
+// skipped and counted in the returned stats.
+// Returns an error when the options are invalid or when writing to one of the
+// output shards fails.
+absl::StatusOr<BHiveImportStats> ImportBHiveCsvLinesInParallel(
+    CanonicalizerPool& canonicalizer_pool,
+    absl::Span<const std::string_view> lines,
+    const ParallelBHiveImportOptions& options,
+    absl::Span<TFRecordWriter* const> output_shards);
+
+}  // namespace gematria
+
+#endif  // THIRD_PARTY_GEMATRIA_GEMATRIA_DATASETS_PARALLEL_BHIVE_IMPORTER_H_
@@ -0,0 +1,227 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "gematria/datasets/parallel_bhive_importer.h"
+
+#include <cstdint>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "gematria/io/tfrecord.h"
+#include "gematria/llvm/canonicalizer_pool.h"
+#include "gematria/llvm/llvm_architecture_support.h"
+#include "gematria/proto/basic_block.pb.h"
+#include "gematria/proto/throughput.pb.h"
+#include "gematria/testing/matchers.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace gematria {
+namespace {
+
+using ::testing::ElementsAreArray;
+using ::testing::SizeIs;
+
+constexpr std::string_view kSourceName = "bhive: skl";
+
+// Splits the contents of a TFRecord file into the records. Assumes that the
+// data is in the valid format.
+std::vector<std::string> ReadRecords(const std::string& data) {
+  std::vector<std::string> records;
+  size_t pos = 0;
+  while (pos < data.size()) {
+    uint64_t length = 0;
+    for (int i = 7; i >= 0; --i) {
+      length = (length << 8) | static_cast<uint8_t>(data[pos + i]);
+    }
+    pos += sizeof(uint64_t) + sizeof(uint32_t);
+    records.push_back(data.substr(pos, length));
+    pos += length + sizeof(uint32_t);
+  }
+  return records;
+}
+
+std::vector<double> ThroughputsFromRecords(
+    const std::vector<std::string>& records) {
+  std::vector<double> throughputs;
+  for (const std::string& record : records) {
+    BasicBlockWithThroughputProto proto;
+    EXPECT_TRUE(proto.ParseFromString(record));
+    throughputs.push_back(
+        proto.inverse_throughputs(0).inverse_throughput_cycles(0));
+  }
+  return throughputs;
+}
+
+class ParallelBHiveImporterTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    x86_llvm_ = LlvmArchitectureSupport::X86_64();
+    canonicalizer_pool_ = CanonicalizerPool::X86(x86_llvm_.get());
+
+    // Use a different throughput for each line, so that we can check the
+    // order of the blocks in the output.
+    for (int i = 0; i < kNumLines; ++i) {
+      // Every tenth line contains invalid machine code.
+      line_storage_.push_back(
+          (i % 10 == 9 ? "4929," : "4929d2,") + std::to_string(i));
+    }
+    lines_.assign(line_storage_.begin(), line_storage_.end());
+  }
+
+  static constexpr int kNumLines = 100;
+
+  std::unique_ptr<LlvmArchitectureSupport> x86_llvm_;
+  std::unique_ptr<CanonicalizerPool> canonicalizer_pool_;
+  std::vector<std::string> line_storage_;
+  std::vector<std::string_view> lines_;
+};
+
+TEST_F(ParallelBHiveImporterTest, DeterministicOrder) {
+  std::ostringstream shards[2];
+  TFRecordWriter writer_0(&shards[0]);
+  TFRecordWriter writer_1(&shards[1]);
+  const std::vector<TFRecordWriter*> writers = {&writer_0, &writer_1};
+
+  ParallelBHiveImportOptions options;
+  options.source_name = std::string(kSourceName);
+  options.num_workers = 4;
+  options.num_lines_per_work_item = 7;
+  options.deterministic_order = true;
+
+  const absl::StatusOr<BHiveImportStats> stats = ImportBHiveCsvLinesInParallel(
+      *canonicalizer_pool_, lines_, options, writers);
+  ASSERT_OK(stats);
+  EXPECT_EQ(stats->num_input_lines, kNumLines);
+  EXPECT_EQ(stats->num_imported_blocks, 90);
+  EXPECT_EQ(stats->num_skipped_lines, 10);
+
+  // The i-th work item is written to shard i % 2.
+  std::vector<double> expected_throughputs[2];
+  for (int i = 0; i < kNumLines; ++i) {
+    if (i % 10 == 9) continue;
+    const int work_item = i / options.num_lines_per_work_item;
+    expected_throughputs[work_item % 2].push_back(i);
+  }
+  EXPECT_THAT(ThroughputsFromRecords(ReadRecords(shards[0].str())),
+              ElementsAreArray(expected_throughputs[0]));
+  EXPECT_THAT(ThroughputsFromRecords(ReadRecords(shards[1].str())),
+              ElementsAreArray(expected_throughputs[1]));
+}
+
+TEST_F(ParallelBHiveImporterTest, DeterministicOrderWithManyWorkItems) {
+  std::ostringstream shard;
+  TFRecordWriter writer(&shard);
+  const std::vector<TFRecordWriter*> writers = {&writer};
+
+  // There are many more work items than the importer keeps in flight at the
+  // same time.
+  ParallelBHiveImportOptions options;
+  options.source_name = std::string(kSourceName);
+  options.num_workers = 2;
+  options.num_lines_per_work_item = 1;
+  options.deterministic_order = true;
+
+  const absl::StatusOr<BHiveImportStats> stats = ImportBHiveCsvLinesInParallel(
+      *canonicalizer_pool_, lines_, options, writers);
+  ASSERT_OK(stats);
+  EXPECT_EQ(stats->num_imported_blocks, 90);
+  EXPECT_EQ(stats->num_skipped_lines, 10);
+
+  std::vector<double> expected_throughputs;
+  for (int i = 0; i < kNumLines; ++i) {
+    if (i % 10 != 9) expected_throughputs.push_back(i);
+  }
+  EXPECT_THAT(ThroughputsFromRecords(ReadRecords(shard.str())),
+              ElementsAreArray(expected_throughputs));
+}
+
+TEST_F(ParallelBHiveImporterTest, NonDeterministicOrder) {
+  std::ostringstream shard;
+  TFRecordWriter writer(&shard);
+  const std::vector<TFRecordWriter*> writers = {&writer};
+
+  ParallelBHiveImportOptions options;
+  options.source_name = std::string(kSourceName);
+  options.num_workers = 4;
+  options.num_lines_per_work_item = 3;
+  options.deterministic_order = false;
+
+  const absl::StatusOr<BHiveImportStats> stats = ImportBHiveCsvLinesInParallel(
+      *canonicalizer_pool_, lines_, options, writers);
+  ASSERT_OK(stats);
+  EXPECT_EQ(stats->num_imported_blocks, 90);
+  EXPECT_EQ(stats->num_skipped_lines, 10);
+  EXPECT_THAT(ReadRecords(shard.str()), SizeIs(90));
+}
+
+TEST_F(ParallelBHiveImporterTest, BlockFilter) {
+  // Even lines contain `subq %rdx, %r10`, odd lines contain `subq %rdx, %rbx`.
+  std::vector<std::string> line_storage;
+  for (int i = 0; i < kNumLines; ++i) {
+    line_storage.push_back((i % 2 == 0 ? "4929d2," : "4829d3,") +
+                           std::to_string(i));
+  }
+  const std::vector<std::string_view> lines(line_storage.begin(),
+                                            line_storage.end());
+  std::ostringstream shard;
+  TFRecordWriter writer(&shard);
+  const std::vector<TFRecordWriter*> writers = {&writer};
+
+  ParallelBHiveImportOptions options;
+  options.source_name = std::string(kSourceName);
+  options.num_workers = 4;
+  options.num_lines_per_work_item = 7;
+  options.block_filter = [](const BasicBlockProto& block) {
+    return block.canonicalized_instructions(0)
+               .output_operands(0)
+               .register_name() != "R10";
+  };
+
+  const absl::StatusOr<BHiveImportStats> stats = ImportBHiveCsvLinesInParallel(
+      *canonicalizer_pool_, lines, options, writers);
+  ASSERT_OK(stats);
+  EXPECT_EQ(stats->num_imported_blocks, kNumLines / 2);
+  EXPECT_EQ(stats->num_filtered_blocks, kNumLines / 2);
+  EXPECT_EQ(stats->num_skipped_lines, 0);
+
+  std::vector<double> expected_throughputs;
+  for (int i = 1; i < kNumLines; i += 2) expected_throughputs.push_back(i);
+  EXPECT_THAT(ThroughputsFromRecords(ReadRecords(shard.str())),
+              ElementsAreArray(expected_throughputs));
+}
+
+TEST_F(ParallelBHiveImporterTest, InvalidOptions) {
+  std::ostringstream shard;
+  TFRecordWriter writer(&shard);
+  const std::vector<TFRecordWriter*> writers = {&writer};
+
+  ParallelBHiveImportOptions options;
+  options.num_workers = 0;
+  EXPECT_THAT(ImportBHiveCsvLinesInParallel(*canonicalizer_pool_, lines_,
+                                            options, writers),
+              StatusIs(absl::StatusCode::kInvalidArgument));
+
+  options.num_workers = 1;
+  EXPECT_THAT(
+      ImportBHiveCsvLinesInParallel(*canonicalizer_pool_, lines_, options,
+                                    /*output_shards=*/{}),
+      StatusIs(absl::StatusCode::kInvalidArgument));
+}
+
+}  // namespace
+}  // namespace gematria
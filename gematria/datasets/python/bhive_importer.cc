@@ -15,12 +15,21 @@
 #include "gematria/datasets/bhive_importer.h"
 
 #include <cstdint>
+#include <memory>
+#include <string>
 #include <string_view>
+#include <utility>
 
+#include "gematria/datasets/basic_block_dedup_index.h"
 #include "gematria/llvm/canonicalizer.h"
+#include "gematria/llvm/disassembler.h"
+#include "gematria/proto/basic_block.pb.h"
+#include "gematria/utils/python/instrumentation_bindings.h"
 #include "pybind11/cast.h"
 #include "pybind11/detail/common.h"
 #include "pybind11/pybind11.h"
+#include "pybind11/pytypes.h"
+#include "pybind11/stl.h"
 #include "pybind11_abseil/import_status_module.h"
 #include "pybind11_abseil/status_casters.h"
 #include "pybind11_protobuf/native_proto_caster.h"
@@ -29,20 +38,60 @@ namespace gematria {
 
 namespace py = ::pybind11;
 
+namespace {
+
+BasicBlockSplittingOptions MakeSplittingOptions(bool include_terminators,
+                                                bool split_at_calls,
+                                                int min_block_size) {
+  BasicBlockSplittingOptions options;
+  options.include_terminators = include_terminators;
+  options.split_at_calls = split_at_calls;
+  options.min_block_size = min_block_size;
+  return options;
+}
+
+// Wraps a Python callback for use with the basic block splitting functions.
+// The callback may return None to continue the iteration.
+auto WrapBasicBlockCallback(const py::function& callback) {
+  return [&callback](BasicBlockProto block) {
+    const py::object result = callback(std::move(block));
+    return result.is_none() || result.cast<bool>();
+  };
+}
+
+}  // namespace
+
 PYBIND11_MODULE(bhive_importer, m) {
   m.doc() = "Support code for importing data from the BHive data set format.";
 
   py::google::ImportStatusModule();
+  DefineInstrumentationSubmodule(m);
 
   py::class_<BHiveImporter>(m, "BHiveImporter")
       .def(  //
-          py::init<const Canonicalizer* /* canonicalizer */>(),
-          py::arg("canonicalizer"),
+          py::init([](const Canonicalizer* canonicalizer,
+                      bool include_assembly, bool include_machine_code,
+                      bool include_address) {
+            DisassemblerOptions options;
+            options.include_assembly = include_assembly;
+            options.include_machine_code = include_machine_code;
+            options.include_address = include_address;
+            return std::make_unique<BHiveImporter>(canonicalizer, options);
+          }),
+          py::arg("canonicalizer"), py::arg("include_assembly") = true,
+          py::arg("include_machine_code") = true,
+          py::arg("include_address") = true,
           R"(Initializes a new BHive importer for a given architecture.
 
           Args:
             canonicalizer: The canonicalizer used to disassemble instructions
-              and convert them to the Gematria proto representation.)")
+              and convert them to the Gematria proto representation.
+            include_assembly: When True, the importer fills in the assembly code
+              of the machine instructions in the output protos.
+            include_machine_code: When True, the importer fills in the machine
+              code of the machine instructions in the output protos.
+            include_address: When True, the importer fills in the addresses of
+              the machine instructions in the output protos.)")
       .def(  //
           "basic_block_proto_from_bytes",
           [](BHiveImporter& self, py::bytes machine_code,
@@ -74,6 +123,88 @@ PYBIND11_MODULE(bhive_importer, m) {
           Raises:
             StatusNotOk: When extracting instructions from the machine code
               fails.)")
+      .def(  //
+          "for_each_basic_block_in_buffer",
+          [](BHiveImporter& self, py::buffer machine_code,
+             const py::function& callback, uint64_t base_address,
+             bool include_terminators, bool split_at_calls,
+             int min_block_size) {
+            // The buffer protocol gives us direct access to the memory of
+            // `bytes`, `memoryview`, or `mmap.mmap` objects without copying.
+            const py::buffer_info buffer = machine_code.request();
+            if (buffer.ndim != 1 || buffer.strides[0] != buffer.itemsize) {
+              throw py::value_error("machine_code must be a contiguous buffer");
+            }
+            const absl::Span<const uint8_t> machine_code_bytes(
+                static_cast<const uint8_t*>(buffer.ptr),
+                buffer.size * buffer.itemsize);
+            return self.ForEachBasicBlockInMachineCode(
+                machine_code_bytes, base_address,
+                WrapBasicBlockCallback(callback),
+                MakeSplittingOptions(include_terminators, split_at_calls,
+                                     min_block_size));
+          },
+          py::arg("machine_code"), py::arg("callback"),
+          py::arg("base_address") = uint64_t{0},
+          py::arg("include_terminators") = false,
+          py::arg("split_at_calls") = true, py::arg("min_block_size") = 1,
+          R"(Splits a sequence of machine code into basic blocks.
+
+          Disassembles `machine_code` sequentially and splits it into basic
+          blocks at control-flow instructions. Calls `callback` with a
+          BasicBlockProto for each basic block. Blocks are not split at the
+          targets of jumps. Bytes that can't be disassembled end the current
+          basic block and are skipped.
+
+          Args:
+            machine_code: An object supporting the buffer protocol, e.g.
+              `bytes` or `mmap.mmap`, that contains the machine code. The
+              contents of the buffer are not copied.
+            callback: Called with each basic block. The iteration stops when it
+              returns False.
+            base_address: The address of the first byte of `machine_code`.
+            include_terminators: When True, the control-flow instruction that
+              ends a basic block is included in the block.
+            split_at_calls: When True, call instructions also end basic blocks.
+            min_block_size: Basic blocks with fewer instructions are skipped.
+
+          Returns:
+            A BasicBlockSplittingStats object with statistics of the run.)")
+      .def(  //
+          "for_each_basic_block_in_object_file",
+          [](BHiveImporter& self, const std::string& file_name,
+             const py::function& callback, bool include_terminators,
+             bool split_at_calls, int min_block_size) {
+            return self.ForEachBasicBlockInObjectFile(
+                file_name, WrapBasicBlockCallback(callback),
+                MakeSplittingOptions(include_terminators, split_at_calls,
+                                     min_block_size));
+          },
+          py::arg("file_name"), py::arg("callback"),
+          py::arg("include_terminators") = false,
+          py::arg("split_at_calls") = true, py::arg("min_block_size") = 1,
+          R"(Splits the text sections of an object file into basic blocks.
+
+          Memory-maps the object file and processes all its text sections in
+          the same way as `for_each_basic_block_in_buffer`, using the addresses
+          of the sections in the object file.
+
+          Args:
+            file_name: The name of the object file.
+            callback: Called with each basic block. The iteration stops when it
+              returns False.
+            include_terminators: When True, the control-flow instruction that
+              ends a basic block is included in the block.
+            split_at_calls: When True, call instructions also end basic blocks.
+            min_block_size: Basic blocks with fewer instructions are skipped.
+
+          Returns:
+            A BasicBlockSplittingStats object with statistics summed over all
+            text sections.
+
+          Raises:
+            StatusNotOk: When the file can't be opened or parsed as an object
+              file.)")
       .def(  //
           "basic_block_proto_from_hex",
           &BHiveImporter::BasicBlockProtoFromMachineCodeHex,
@@ -124,9 +255,65 @@ PYBIND11_MODULE(bhive_importer, m) {
             extracted from {machine_code}, and one throughput information based
             on {throughput}.
 
+          Raises:
+            StatusNotOk: When parsing the CSV line or extracting data from the
+              machine code fails.)")
+      .def(  //
+          "add_csv_line_to_index", &BHiveImporter::AddBHiveCsvLineToIndex,
+          py::arg("index"), py::arg("source_name"), py::arg("line"),
+          py::arg("throughput_scaling") = 1.0,
+          py::arg("base_address") = uint64_t{0},
+          R"(Parses a line from a BHive CSV file and adds it to `index`.
+
+          Parses the line in the same way as
+          `basic_block_with_throughput_proto_from_csv_line`. When `index`
+          already contains a block with the same machine code and base address,
+          the machine code is not disassembled again and the throughput from
+          the line is merged into the existing block.
+
+          Args:
+            index: The BasicBlockDedupIndex to add the block to.
+            source_name: The name of the throughput source used in the output
+              proto.
+            line: The line from the BHive CSV file.
+            throughput_scaling: An optional scaling applied to {throughput}.
+            base_address: The address of the first instruction of the basic
+              block.
+
+          Returns:
+            True when the line added a new block to the index; False when it
+            was merged into an existing block.
+
           Raises:
             StatusNotOk: When parsing the CSV line or extracting data from the
               machine code fails.)");
+
+  py::class_<BasicBlockSplittingStats>(
+      m, "BasicBlockSplittingStats",
+      "Statistics collected while splitting machine code into basic blocks.")
+      .def_readonly("num_blocks", &BasicBlockSplittingStats::num_blocks)
+      .def_readonly("num_instructions",
+                    &BasicBlockSplittingStats::num_instructions)
+      .def_readonly("num_invalid_bytes",
+                    &BasicBlockSplittingStats::num_invalid_bytes);
+
+  py::class_<BasicBlockDedupIndex>(
+      m, "BasicBlockDedupIndex",
+      R"(An index of unique basic blocks keyed by their machine code.
+
+      Duplicate blocks are merged into the first occurrence of the block, and
+      their throughputs are appended to the throughputs of the first
+      occurrence.)")
+      .def(py::init<>())
+      .def_property_readonly(
+          "blocks", &BasicBlockDedupIndex::blocks,
+          R"(The unique BasicBlockWithThroughputProtos, in the order of their
+          first occurrence.)")
+      .def_property_readonly("num_duplicates",
+                             &BasicBlockDedupIndex::num_duplicates)
+      .def("__len__", [](const BasicBlockDedupIndex& self) {
+        return self.blocks().size();
+      });
 }
 
 }  // namespace gematria
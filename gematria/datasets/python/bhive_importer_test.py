@@ -31,6 +31,7 @@ _CanonicalizedInstructionProto = (
 # A basic block that can be obtained by disassembling the basic block
 # "4829d38b44246c8b54246848c1fb034829d04839c3" and using base_address=600.
 _EXPECTED_BASIC_BLOCK_PROTO = basic_block_pb2.BasicBlockProto(
+    fingerprint="e651b4047fc7425d",
     machine_instructions=(
         basic_block_pb2.MachineInstructionProto(
             assembly="\tsubq\t%rdx, %rbx",
@@ -165,6 +166,7 @@ class BhiveImporterTest(absltest.TestCase):
     self.assertEqual(
         block_proto,
         basic_block_pb2.BasicBlockProto(
+            fingerprint="af644d4c8602ac8f",
             machine_instructions=(
                 basic_block_pb2.MachineInstructionProto(
                     assembly="\tnop",
@@ -181,6 +183,30 @@ class BhiveImporterTest(absltest.TestCase):
         ),
     )
 
+  def test_x86_basic_block_proto_without_optional_fields(self):
+    importer = bhive_importer.BHiveImporter(
+        self._x86_canonicalizer,
+        include_assembly=False,
+        include_machine_code=False,
+        include_address=False,
+    )
+    block_proto = importer.basic_block_proto_from_bytes(
+        b"\x90", base_address=999
+    )
+    self.assertEqual(
+        block_proto,
+        basic_block_pb2.BasicBlockProto(
+            fingerprint="af644d4c8602ac8f",
+            machine_instructions=(basic_block_pb2.MachineInstructionProto(),),
+            canonicalized_instructions=(
+                _CanonicalizedInstructionProto(
+                    mnemonic="nop",
+                    llvm_mnemonic="NOOP",
+                ),
+            ),
+        ),
+    )
+
   def test_x86_basic_block_proto_from_hex(self):
     importer = bhive_importer.BHiveImporter(self._x86_canonicalizer)
     # Basic block:
@@ -219,6 +245,70 @@ class BhiveImporterTest(absltest.TestCase):
         ),
     )
 
+  def test_x86_add_csv_line_to_index(self):
+    source_name = "test: made-up"
+    importer = bhive_importer.BHiveImporter(self._x86_canonicalizer)
+    index = bhive_importer.BasicBlockDedupIndex()
+    for line, expected_is_new in (
+        ("4829d38b44246c8b54246848c1fb034829d04839c3,10", True),
+        ("90,1", True),
+        ("4829d38b44246c8b54246848c1fb034829d04839c3,11", False),
+    ):
+      self.assertEqual(
+          importer.add_csv_line_to_index(
+              index=index,
+              source_name=source_name,
+              line=line,
+              base_address=600,
+          ),
+          expected_is_new,
+      )
+    self.assertLen(index, 2)
+    self.assertEqual(index.num_duplicates, 1)
+    self.assertEqual(
+        index.blocks[0],
+        throughput_pb2.BasicBlockWithThroughputProto(
+            basic_block=_EXPECTED_BASIC_BLOCK_PROTO,
+            inverse_throughputs=(
+                throughput_pb2.ThroughputWithSourceProto(
+                    source=source_name,
+                    inverse_throughput_cycles=[10.0, 11.0],
+                ),
+            ),
+        ),
+    )
+
+  def test_x86_for_each_basic_block_in_buffer(self):
+    importer = bhive_importer.BHiveImporter(self._x86_canonicalizer)
+    # subq %rdx, %r10; jne 0; addq %rbx, %rax; retq
+    machine_code = memoryview(b"\x49\x29\xd2\x75\xfb\x48\x01\xd8\xc3")
+    blocks = []
+    stats = importer.for_each_basic_block_in_buffer(
+        machine_code, blocks.append, base_address=100
+    )
+    self.assertEqual(stats.num_blocks, 2)
+    self.assertEqual(stats.num_instructions, 4)
+    self.assertEqual(stats.num_invalid_bytes, 0)
+    self.assertEqual(
+        [
+            [
+                instruction.llvm_mnemonic
+                for instruction in block.canonicalized_instructions
+            ]
+            for block in blocks
+        ],
+        [["SUB64rr"], ["ADD64rr"]],
+    )
+    self.assertEqual(blocks[1].machine_instructions[0].address, 105)
+
+  def test_x86_for_each_basic_block_in_buffer_stops(self):
+    importer = bhive_importer.BHiveImporter(self._x86_canonicalizer)
+    machine_code = b"\x49\x29\xd2\x75\xfb\x48\x01\xd8\xc3"
+    stats = importer.for_each_basic_block_in_buffer(
+        machine_code, lambda block: False, include_terminators=True
+    )
+    self.assertEqual(stats.num_blocks, 1)
+
 
 if __name__ == "__main__":
   absltest.main()
@@ -61,6 +61,23 @@ _THROUGHPUT_SCALING = flags.DEFINE_float(
     'The scaling coefficient applied to the throughput values from the CSV'
     ' file.',
 )
+_DEDUPLICATE_BLOCKS = flags.DEFINE_bool(
+    'gematria_deduplicate_blocks',
+    False,
+    'When true, basic blocks with the same machine code are disassembled only'
+    ' once, and the output contains each unique block once with the'
+    ' throughputs of all its copies. The unique blocks are kept in memory and'
+    ' written at the end of the import.',
+)
+_MEMORY_ALIAS_ANALYSIS = flags.DEFINE_enum(
+    'gematria_memory_alias_analysis',
+    'WHOLE_MEMORY',
+    tuple(canonicalizer.MemoryAliasAnalysis.__members__),
+    'The analysis used to assign alias groups to the memory operands. With'
+    ' ADDRESS_BASED, memory accesses that provably do not overlap are put into'
+    ' different alias groups; with WHOLE_MEMORY, all memory accesses are in the'
+    ' same alias group.',
+)
 _LLVM_TRIPLE = flags.DEFINE_string(
     'gematria_llvm_triple',
     'x86_64',
@@ -84,8 +101,18 @@ def main(argv: Sequence[str]) -> None:
   # TODO(ondrasej): Update this so that the canonicalizer is created using the
   # LLVM triple. As of 2023-05, this is OK, because we support only x86-64
   # anyway.
-  canonicalizer_obj = canonicalizer.Canonicalizer.x86_64(llvm)
+  canonicalizer_obj = canonicalizer.Canonicalizer.x86_64(
+      llvm,
+      memory_alias_analysis=canonicalizer.MemoryAliasAnalysis.__members__[
+          _MEMORY_ALIAS_ANALYSIS.value
+      ],
+  )
   importer = bhive_importer.BHiveImporter(canonicalizer_obj)
+  dedup_index = (
+      bhive_importer.BasicBlockDedupIndex()
+      if _DEDUPLICATE_BLOCKS.value
+      else None
+  )
 
   with (
       tf.io.gfile.GFile(_INPUT_CSV_FILE.value, 'r') as bhive_csv_file,
@@ -102,6 +129,14 @@ def main(argv: Sequence[str]) -> None:
         )
       num_input_blocks += 1
       try:
+        if dedup_index is not None:
+          importer.add_csv_line_to_index(
+              index=dedup_index,
+              source_name=_SOURCE_NAME.value,
+              line=line,
+              throughput_scaling=_THROUGHPUT_SCALING.value,
+          )
+          continue
         block_proto = importer.basic_block_with_throughput_proto_from_csv_line(
             source_name=_SOURCE_NAME.value,
             line=line,
@@ -114,6 +149,15 @@ def main(argv: Sequence[str]) -> None:
 
       writer.write(block_proto.SerializeToString())
 
+    if dedup_index is not None:
+      logging.info(
+          'Writing %d unique blocks, merged %d duplicates.',
+          len(dedup_index),
+          dedup_index.num_duplicates,
+      )
+      for block_proto in dedup_index.blocks:
+        writer.write(block_proto.SerializeToString())
+
 
 if __name__ == '__main__':
   app.run(main)
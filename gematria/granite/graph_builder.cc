@@ -15,6 +15,8 @@
 #include "gematria/granite/graph_builder.h"
 
 #include <algorithm>
+#include <cstdint>
+#include <memory>
 #include <ostream>
 #include <string>
 #include <utility>
@@ -25,35 +27,33 @@
 #include "absl/log/absl_log.h"
 #include "absl/log/die_if_null.h"
 #include "absl/strings/str_join.h"
+#include "absl/types/span.h"
 #include "gematria/basic_block/basic_block.h"
+#include "gematria/basic_block/basic_block_protos.h"
+#include "gematria/basic_block/lazy_basic_block.h"
+#include "gematria/basic_block/packed_basic_block.h"
+#include "gematria/basic_block/register_unit_table.h"
+#include "gematria/basic_block/token_table.h"
 #include "gematria/model/oov_token_behavior.h"
+#include "gematria/proto/basic_block.pb.h"
+#include "gematria/proto/canonicalized_instruction.pb.h"
+#include "gematria/utils/instrumentation.h"
+#include "gematria/utils/thread_pool.h"
+#include "google/protobuf/repeated_ptr_field.h"
 
 namespace gematria {
 namespace {
 
 constexpr BasicBlockGraphBuilder::NodeIndex kInvalidNode(-1);
-constexpr BasicBlockGraphBuilder::TokenIndex kInvalidTokenIndex(-1);
-
-absl::flat_hash_map<std::string, BasicBlockGraphBuilder::TokenIndex> MakeIndex(
-    std::vector<std::string> items) {
-  absl::flat_hash_map<std::string, BasicBlockGraphBuilder::TokenIndex> result;
-  for (BasicBlockGraphBuilder::TokenIndex i = 0; i < items.size(); ++i) {
-    const auto insertion_result = result.emplace(std::move(items[i]), i);
-    if (!insertion_result.second) {
-      ABSL_LOG(FATAL) << "Duplicate item: '" << insertion_result.first->first
-                      << "'";
-    }
-  }
-  return result;
-}
+constexpr BasicBlockGraphBuilder::TokenIndex kInvalidTokenIndex(
+    TokenVocabulary::kInvalidTokenIndex);
 
 BasicBlockGraphBuilder::TokenIndex FindTokenOrDie(
-    const absl::flat_hash_map<std::string, BasicBlockGraphBuilder::TokenIndex>&
-        tokens,
-    absl::string_view token) {
-  const auto it = tokens.find(token);
-  ABSL_CHECK(it != tokens.end()) << "Token was not found: '" << token << "'";
-  return it->second;
+    const TokenVocabulary& tokens, absl::string_view token) {
+  const BasicBlockGraphBuilder::TokenIndex token_index = tokens.Find(token);
+  ABSL_CHECK_NE(token_index, kInvalidTokenIndex)
+      << "Token was not found: '" << token << "'";
+  return token_index;
 }
 
 template <typename MapType, typename KeyType, typename DefaultType>
@@ -63,6 +63,58 @@ typename MapType::mapped_type& LookupOrInsert(
   return it->second;
 }
 
+// Checks that `node_index` is a valid index of a node in a batch with
+// `num_nodes` nodes. The check is done in all builds when the policy asks for
+// it, and only in debug builds otherwise.
+template <typename Policy>
+void CheckNodeIndex(BasicBlockGraphBuilder::NodeIndex node_index,
+                    int num_nodes) {
+  if constexpr (Policy::kCheckNodeIndices) {
+    ABSL_CHECK_GE(node_index, 0);
+    ABSL_CHECK_LT(node_index, num_nodes);
+  } else {
+    ABSL_DCHECK_GE(node_index, 0);
+    ABSL_DCHECK_LT(node_index, num_nodes);
+  }
+}
+
+// Makes sure that `vector` has capacity for `num_additional` more elements.
+// Unlike calling vector.reserve() directly, this preserves the amortized
+// geometric growth of the vector when called repeatedly.
+template <typename T>
+void ReserveAdditional(std::vector<T>& vector, size_t num_additional) {
+  const size_t required_capacity = vector.size() + num_additional;
+  if (required_capacity <= vector.capacity()) return;
+  vector.reserve(std::max(required_capacity, 2 * vector.capacity()));
+}
+
+// Returns an upper bound on the number of nodes and edges that the graph
+// builder creates for `instruction`. The estimate assumes that each register
+// operand creates a new node, and that each address operand uses all of its
+// registers and a displacement.
+void EstimateInstructionGraphSize(const Instruction& instruction,
+                                  int& num_nodes, int& num_edges) {
+  // The instruction node and the structural dependency edge.
+  num_nodes += 1;
+  num_edges += 1;
+  // The prefix nodes and their edges.
+  num_nodes += instruction.prefixes.size();
+  num_edges += instruction.prefixes.size();
+  for (const std::vector<InstructionOperand>* const operands :
+       {&instruction.input_operands, &instruction.implicit_input_operands,
+        &instruction.output_operands, &instruction.implicit_output_operands}) {
+    for (const InstructionOperand& operand : *operands) {
+      num_nodes += 1;
+      num_edges += 1;
+      if (operand.type() == OperandType::kAddress) {
+        // The base, index and segment registers and the displacement.
+        num_nodes += 4;
+        num_edges += 4;
+      }
+    }
+  }
+}
+
 }  // namespace
 
 #define EXEGESIS_ENUM_CASE(os, enum_value) \
@@ -100,8 +152,9 @@ std::ostream& operator<<(std::ostream& os, EdgeType edge_type) {
 
 #undef EXEGESIS_ENUM_CASE
 
-BasicBlockGraphBuilder::AddBasicBlockTransaction::AddBasicBlockTransaction(
-    BasicBlockGraphBuilder* graph_builder)
+template <typename Policy>
+BasicBlockGraphBuilderImpl<Policy>::AddBasicBlockTransaction::
+    AddBasicBlockTransaction(BasicBlockGraphBuilderImpl* graph_builder)
     : graph_builder_(*ABSL_DIE_IF_NULL(graph_builder)),
       prev_num_nodes_per_block_size_(
           graph_builder->num_nodes_per_block_.size()),
@@ -111,15 +164,39 @@ BasicBlockGraphBuilder::AddBasicBlockTransaction::AddBasicBlockTransaction(
       prev_node_features_size_(graph_builder->node_features_.size()),
       prev_edge_senders_size_(graph_builder->edge_senders_.size()),
       prev_edge_receivers_size_(graph_builder->edge_receivers_.size()),
-      prev_edge_types_size_(graph_builder->edge_receivers_.size()),
-      prev_global_features_size_(graph_builder->global_features_.size()) {}
+      prev_edge_types_size_(graph_builder->edge_types_.size()),
+      prev_edge_features_size_(graph_builder->edge_features_.size()),
+      prev_instruction_node_mask_size_(
+          graph_builder->instruction_node_mask_.size()),
+      prev_delta_block_index_size_(graph_builder->delta_block_index_.size()),
+      prev_num_global_feature_tokens_per_block_size_(
+          graph_builder->num_global_feature_tokens_per_block_.size()),
+      prev_global_feature_token_indices_size_(
+          graph_builder->global_feature_token_indices_.size()),
+      prev_global_feature_token_counts_size_(
+          graph_builder->global_feature_token_counts_.size()),
+      prev_instruction_token_indices_size_(
+          graph_builder->instruction_token_indices_.size()),
+      prev_instruction_token_offsets_size_(
+          graph_builder->instruction_token_offsets_.size()) {}
 
-BasicBlockGraphBuilder::AddBasicBlockTransaction::~AddBasicBlockTransaction() {
+template <typename Policy>
+BasicBlockGraphBuilderImpl<Policy>::AddBasicBlockTransaction::
+    ~AddBasicBlockTransaction() {
   if (!is_committed_) Rollback();
 }
 
-void BasicBlockGraphBuilder::AddBasicBlockTransaction::Commit() {
+template <typename Policy>
+void BasicBlockGraphBuilderImpl<Policy>::AddBasicBlockTransaction::Commit() {
   is_committed_ = true;
+  AddToInstrumentationCounter(
+      InstrumentationCounter::kGraphNodesAdded,
+      static_cast<int64_t>(graph_builder_.node_types_.size() -
+                           prev_node_types_size_));
+  AddToInstrumentationCounter(
+      InstrumentationCounter::kGraphEdgesAdded,
+      static_cast<int64_t>(graph_builder_.edge_types_.size() -
+                           prev_edge_types_size_));
 }
 
 #define GEMATRIA_CHECK_AND_RESIZE(vector_name)                             \
@@ -131,7 +208,8 @@ void BasicBlockGraphBuilder::AddBasicBlockTransaction::Commit() {
     graph_builder_.vector_name.resize(original_size);                      \
   } while (false)
 
-void BasicBlockGraphBuilder::AddBasicBlockTransaction::Rollback() {
+template <typename Policy>
+void BasicBlockGraphBuilderImpl<Policy>::AddBasicBlockTransaction::Rollback() {
   ABSL_CHECK(!is_committed_) << "The new basic block was already committed";
   GEMATRIA_CHECK_AND_RESIZE(num_nodes_per_block_);
   GEMATRIA_CHECK_AND_RESIZE(num_edges_per_block_);
@@ -140,60 +218,290 @@ void BasicBlockGraphBuilder::AddBasicBlockTransaction::Rollback() {
   GEMATRIA_CHECK_AND_RESIZE(edge_senders_);
   GEMATRIA_CHECK_AND_RESIZE(edge_receivers_);
   GEMATRIA_CHECK_AND_RESIZE(edge_types_);
-  GEMATRIA_CHECK_AND_RESIZE(global_features_);
+  GEMATRIA_CHECK_AND_RESIZE(edge_features_);
+  GEMATRIA_CHECK_AND_RESIZE(instruction_node_mask_);
+  GEMATRIA_CHECK_AND_RESIZE(delta_block_index_);
+  GEMATRIA_CHECK_AND_RESIZE(num_global_feature_tokens_per_block_);
+  GEMATRIA_CHECK_AND_RESIZE(global_feature_token_indices_);
+  GEMATRIA_CHECK_AND_RESIZE(global_feature_token_counts_);
+  GEMATRIA_CHECK_AND_RESIZE(instruction_token_indices_);
+  GEMATRIA_CHECK_AND_RESIZE(instruction_token_offsets_);
 }
 
 #undef GEMATRIA_CHECK_AND_RESIZE
 
-BasicBlockGraphBuilder::BasicBlockGraphBuilder(
+template <typename Policy>
+BasicBlockGraphBuilderImpl<Policy>::BasicBlockGraphBuilderImpl(
     std::vector<std::string> node_tokens, absl::string_view immediate_token,
     absl::string_view fp_immediate_token, absl::string_view address_token,
     absl::string_view memory_token,
     OutOfVocabularyTokenBehavior
         out_of_vocabulary_behavior /* = ReturnError() */
     )
-    : node_tokens_(MakeIndex(std::move(node_tokens))),
-      immediate_token_(FindTokenOrDie(node_tokens_, immediate_token)),
-      fp_immediate_token_(FindTokenOrDie(node_tokens_, fp_immediate_token)),
-      address_token_(FindTokenOrDie(node_tokens_, address_token)),
-      memory_token_(FindTokenOrDie(node_tokens_, memory_token)),
+    : BasicBlockGraphBuilderImpl(
+          std::make_shared<const TokenVocabulary>(node_tokens),
+          immediate_token, fp_immediate_token, address_token, memory_token,
+          std::move(out_of_vocabulary_behavior)) {}
+
+template <typename Policy>
+BasicBlockGraphBuilderImpl<Policy>::BasicBlockGraphBuilderImpl(
+    std::shared_ptr<const TokenVocabulary> node_tokens,
+    absl::string_view immediate_token, absl::string_view fp_immediate_token,
+    absl::string_view address_token, absl::string_view memory_token,
+    OutOfVocabularyTokenBehavior
+        out_of_vocabulary_behavior /* = ReturnError() */
+    )
+    : node_tokens_(std::move(ABSL_DIE_IF_NULL(node_tokens))),
+      immediate_token_(FindTokenOrDie(*node_tokens_, immediate_token)),
+      fp_immediate_token_(FindTokenOrDie(*node_tokens_, fp_immediate_token)),
+      address_token_(FindTokenOrDie(*node_tokens_, address_token)),
+      memory_token_(FindTokenOrDie(*node_tokens_, memory_token)),
       out_of_vocabulary_behavior_(out_of_vocabulary_behavior),
       replacement_token_(
           out_of_vocabulary_behavior.behavior_type() ==
                   OutOfVocabularyTokenBehavior::BehaviorType::kReturnError
               ? kInvalidTokenIndex
               : FindTokenOrDie(
-                    node_tokens_,
+                    *node_tokens_,
                     out_of_vocabulary_behavior.replacement_token())) {}
 
-bool BasicBlockGraphBuilder::AddBasicBlockFromInstructions(
+template <typename Policy>
+BasicBlockGraphBuilderImpl<Policy>::BasicBlockGraphBuilderImpl(
+    const BasicBlockGraphBuilderImpl& other, EmptyBatchTag)
+    : node_tokens_(other.node_tokens_),
+      immediate_token_(other.immediate_token_),
+      fp_immediate_token_(other.fp_immediate_token_),
+      address_token_(other.address_token_),
+      memory_token_(other.memory_token_),
+      out_of_vocabulary_behavior_(other.out_of_vocabulary_behavior_),
+      replacement_token_(other.replacement_token_),
+      collect_instruction_tokens_(other.collect_instruction_tokens_),
+      sequence_delimiter_token_(other.sequence_delimiter_token_),
+      sequence_immediate_token_(other.sequence_immediate_token_),
+      sequence_address_token_(other.sequence_address_token_),
+      sequence_memory_token_(other.sequence_memory_token_),
+      sequence_no_register_token_(other.sequence_no_register_token_),
+      sequence_displacement_token_(other.sequence_displacement_token_),
+      register_unit_table_(other.register_unit_table_),
+      log_out_of_vocabulary_tokens_(other.log_out_of_vocabulary_tokens_) {
+  register_unit_nodes_.resize(other.register_unit_nodes_.size(), kInvalidNode);
+}
+
+template <typename Policy>
+void BasicBlockGraphBuilderImpl<Policy>::set_collect_instruction_tokens(
+    bool collect_instruction_tokens) {
+  ABSL_CHECK_EQ(num_graphs(), 0)
+      << "Instruction token collection can be changed only when the batch is "
+         "empty";
+  collect_instruction_tokens_ = collect_instruction_tokens;
+  if (!collect_instruction_tokens) return;
+  sequence_delimiter_token_ = FindTokenOrDie(*node_tokens_, kDelimiterToken);
+  sequence_immediate_token_ = FindTokenOrDie(*node_tokens_, kImmediateToken);
+  sequence_address_token_ = FindTokenOrDie(*node_tokens_, kAddressToken);
+  sequence_memory_token_ = FindTokenOrDie(*node_tokens_, kMemoryToken);
+  sequence_no_register_token_ =
+      FindTokenOrDie(*node_tokens_, kNoRegisterToken);
+  sequence_displacement_token_ =
+      FindTokenOrDie(*node_tokens_, kDisplacementToken);
+}
+
+template <typename Policy>
+void BasicBlockGraphBuilderImpl<Policy>::set_register_unit_table(
+    std::shared_ptr<const RegisterUnitTable> register_unit_table) {
+  ABSL_CHECK_EQ(num_graphs(), 0)
+      << "The register unit table can be changed only when the batch is empty";
+  register_unit_table_ = std::move(register_unit_table);
+  used_register_units_.clear();
+  register_token_indices_.clear();
+  register_unit_nodes_.assign(
+      register_unit_table_ == nullptr ? 0 : register_unit_table_->num_units(),
+      kInvalidNode);
+}
+
+template <typename Policy>
+bool BasicBlockGraphBuilderImpl<Policy>::AddBasicBlockFromInstructions(
     const std::vector<Instruction>& instructions) {
+  ScopedInstrumentationTimer timer(InstrumentationStage::kAddBasicBlock);
   AddBasicBlockTransaction transaction(this);
 
   // Clear the maps that are maintained per basic block.
-  register_nodes_.clear();
+  ClearRegisterNodes();
   alias_group_nodes_.clear();
+  last_basic_block_is_extendable_ = false;
+  // The block that is being added is not counted in num_graphs() yet, so
+  // num_graphs() is its index in the batch.
+  current_block_index_ = num_graphs();
 
   const int prev_num_nodes = num_nodes();
   const int prev_num_edges = num_edges();
 
   NodeIndex previous_instruction_node = kInvalidNode;
   for (const Instruction& instruction : instructions) {
+    if (!AddInstruction(instruction, previous_instruction_node)) return false;
+  }
+
+  AddGlobalFeatures(prev_num_nodes);
+
+  // Record the number of nodes and edges created for this graph.
+  num_nodes_per_block_.push_back(num_nodes() - prev_num_nodes);
+  num_edges_per_block_.push_back(num_edges() - prev_num_edges);
+
+  transaction.Commit();
+  last_basic_block_is_extendable_ = true;
+  last_instruction_node_ = previous_instruction_node;
+  return true;
+}
+
+template <typename Policy>
+bool BasicBlockGraphBuilderImpl<Policy>::AppendInstructionsToLastBasicBlock(
+    const std::vector<Instruction>& instructions) {
+  ABSL_CHECK(last_basic_block_is_extendable_)
+      << "The last basic block in the batch can't be extended";
+  // The per-block state is updated in place by the new instructions; the undo
+  // log keeps the previous values of the modified entries, so that the state
+  // can be restored when one of the instructions can't be added.
+  UndoLog undo_log;
+  undo_log.num_used_register_units = used_register_units_.size();
+  undo_log_ = &undo_log;
+  const int prev_num_nodes = num_nodes();
+  const int prev_num_edges = num_edges();
+  NodeIndex previous_instruction_node = last_instruction_node_;
+  current_block_index_ = num_graphs() - 1;
+  {
+    AddBasicBlockTransaction transaction(this);
+    for (const Instruction& instruction : instructions) {
+      if (!AddInstruction(instruction, previous_instruction_node)) {
+        undo_log_ = nullptr;
+        RollBack(undo_log);
+        return false;
+      }
+    }
+    transaction.Commit();
+  }
+  undo_log_ = nullptr;
+
+  // The new nodes are appended after the nodes of the last block, so the last
+  // block still ends at the last node of the batch; only its sizes and its
+  // global features need to be updated.
+  num_nodes_per_block_.back() += num_nodes() - prev_num_nodes;
+  num_edges_per_block_.back() += num_edges() - prev_num_edges;
+  UpdateGlobalFeaturesOfLastBlock(prev_num_nodes);
+  last_instruction_node_ = previous_instruction_node;
+  return true;
+}
+
+template <typename Policy>
+void BasicBlockGraphBuilderImpl<Policy>::RollBack(const UndoLog& undo_log) {
+  // The entries are restored in the reverse order, so that an entry modified
+  // more than once gets the value from before the first modification.
+  for (auto it = undo_log.register_nodes.rbegin();
+       it != undo_log.register_nodes.rend(); ++it) {
+    if (it->second == kInvalidNode) {
+      register_nodes_.erase(it->first);
+    } else {
+      register_nodes_[it->first] = it->second;
+    }
+  }
+  for (auto it = undo_log.alias_group_nodes.rbegin();
+       it != undo_log.alias_group_nodes.rend(); ++it) {
+    if (it->second == kInvalidNode) {
+      alias_group_nodes_.erase(it->first);
+    } else {
+      alias_group_nodes_[it->first] = it->second;
+    }
+  }
+  for (auto it = undo_log.register_unit_nodes.rbegin();
+       it != undo_log.register_unit_nodes.rend(); ++it) {
+    register_unit_nodes_[it->first] = it->second;
+  }
+  used_register_units_.resize(undo_log.num_used_register_units);
+}
+
+template <typename Policy>
+bool BasicBlockGraphBuilderImpl<Policy>::AddInstruction(
+    const Instruction& instruction, NodeIndex& previous_instruction_node) {
+  // Add the instruction node.
+  const NodeIndex instruction_node =
+      AddNode(NodeType::kInstruction, instruction.mnemonic);
+  if (instruction_node == kInvalidNode) {
+    return false;
+  }
+
+  // Add nodes for prefixes of the instruction.
+  for (const std::string& prefix : instruction.prefixes) {
+    const NodeIndex prefix_node = AddNode(NodeType::kPrefix, prefix);
+    if (prefix_node == kInvalidNode) {
+      return false;
+    }
+    AddEdge(EdgeType::kInstructionPrefix, prefix_node, instruction_node);
+  }
+  StartInstructionTokens(instruction_node);
+
+  // Add a structural dependency edge from the previous instruction.
+  if (previous_instruction_node >= 0) {
+    AddEdge(EdgeType::kStructuralDependency, previous_instruction_node,
+            instruction_node);
+  }
+
+  // Add edges for input operands. And nodes too, if necessary.
+  for (const InstructionOperand& operand : instruction.input_operands) {
+    if (!AddInputOperand(instruction_node, operand)) return false;
+  }
+  for (const InstructionOperand& operand :
+       instruction.implicit_input_operands) {
+    if (!AddInputOperand(instruction_node, operand)) return false;
+  }
+
+  // Add edges and nodes for output operands.
+  for (const InstructionOperand& operand : instruction.output_operands) {
+    if (!AddOutputOperand(instruction_node, operand)) return false;
+  }
+  for (const InstructionOperand& operand :
+       instruction.implicit_output_operands) {
+    if (!AddOutputOperand(instruction_node, operand)) return false;
+  }
+  FinishInstructionTokens();
+
+  previous_instruction_node = instruction_node;
+  return true;
+}
+
+template <typename Policy>
+bool BasicBlockGraphBuilderImpl<Policy>::AddBasicBlock(
+    const PackedBasicBlock& block) {
+  ScopedInstrumentationTimer timer(InstrumentationStage::kAddBasicBlock);
+  AddBasicBlockTransaction transaction(this);
+
+  // Clear the maps that are maintained per basic block.
+  ClearRegisterNodes();
+  alias_group_nodes_.clear();
+  last_basic_block_is_extendable_ = false;
+  // The block that is being added is not counted in num_graphs() yet, so
+  // num_graphs() is its index in the batch.
+  current_block_index_ = num_graphs();
+
+  const int prev_num_nodes = num_nodes();
+  const int prev_num_edges = num_edges();
+
+  NodeIndex previous_instruction_node = kInvalidNode;
+  for (const PackedInstruction& instruction : block.instructions()) {
     // Add the instruction node.
     const NodeIndex instruction_node =
-        AddNode(NodeType::kInstruction, instruction.mnemonic);
+        AddNodeForTokenId(NodeType::kInstruction, instruction.mnemonic);
     if (instruction_node == kInvalidNode) {
       return false;
     }
 
     // Add nodes for prefixes of the instruction.
-    for (const std::string& prefix : instruction.prefixes) {
-      const NodeIndex prefix_node = AddNode(NodeType::kPrefix, prefix);
+    for (const TokenId prefix : block.prefixes(instruction)) {
+      const NodeIndex prefix_node =
+          AddNodeForTokenId(NodeType::kPrefix, prefix);
       if (prefix_node == kInvalidNode) {
         return false;
       }
       AddEdge(EdgeType::kInstructionPrefix, prefix_node, instruction_node);
     }
+    StartInstructionTokens(instruction_node);
 
     // Add a structural dependency edge from the previous instruction.
     if (previous_instruction_node >= 0) {
@@ -202,41 +510,437 @@ bool BasicBlockGraphBuilder::AddBasicBlockFromInstructions(
     }
 
     // Add edges for input operands. And nodes too, if necessary.
-    for (const InstructionOperand& operand : instruction.input_operands) {
-      if (!AddInputOperand(instruction_node, operand)) return false;
-    }
-    for (const InstructionOperand& operand :
-         instruction.implicit_input_operands) {
-      if (!AddInputOperand(instruction_node, operand)) return false;
+    for (const OperandList list :
+         {OperandList::kInput, OperandList::kImplicitInput}) {
+      for (const PackedOperand& operand : block.operands(instruction, list)) {
+        if (!AddInputOperand(instruction_node, block, operand)) return false;
+      }
     }
 
     // Add edges and nodes for output operands.
-    for (const InstructionOperand& operand : instruction.output_operands) {
-      if (!AddOutputOperand(instruction_node, operand)) return false;
-    }
-    for (const InstructionOperand& operand :
-         instruction.implicit_output_operands) {
-      if (!AddOutputOperand(instruction_node, operand)) return false;
+    for (const OperandList list :
+         {OperandList::kOutput, OperandList::kImplicitOutput}) {
+      for (const PackedOperand& operand : block.operands(instruction, list)) {
+        if (!AddOutputOperand(instruction_node, operand)) return false;
+      }
     }
+    FinishInstructionTokens();
 
     previous_instruction_node = instruction_node;
   }
 
-  global_features_.emplace_back(num_node_tokens(), 0);
-  std::vector<int>& global_features = global_features_.back();
-  for (NodeIndex i = prev_num_nodes; i < node_features_.size(); ++i) {
-    ++global_features[node_features_[i]];
-  }
+  AddGlobalFeatures(prev_num_nodes);
 
   // Record the number of nodes and edges created for this graph.
   num_nodes_per_block_.push_back(num_nodes() - prev_num_nodes);
   num_edges_per_block_.push_back(num_edges() - prev_num_edges);
 
   transaction.Commit();
+  last_basic_block_is_extendable_ = true;
+  last_instruction_node_ = previous_instruction_node;
   return true;
 }
 
-void BasicBlockGraphBuilder::Reset() {
+template <typename Policy>
+std::vector<bool> BasicBlockGraphBuilderImpl<Policy>::AddBasicBlocks(
+    absl::Span<const BasicBlock> blocks) {
+  std::vector<const BasicBlock*> block_pointers;
+  block_pointers.reserve(blocks.size());
+  for (const BasicBlock& block : blocks) block_pointers.push_back(&block);
+  return AddBasicBlocks(block_pointers);
+}
+
+template <typename Policy>
+std::vector<bool> BasicBlockGraphBuilderImpl<Policy>::AddBasicBlocks(
+    absl::Span<const BasicBlock* const> blocks) {
+  int num_instructions = 0;
+  int num_nodes = 0;
+  int num_edges = 0;
+  for (const BasicBlock* const block : blocks) {
+    ABSL_CHECK(block != nullptr);
+    num_instructions += block->instructions.size();
+    for (const Instruction& instruction : block->instructions) {
+      EstimateInstructionGraphSize(instruction, num_nodes, num_edges);
+    }
+  }
+  Reserve(blocks.size(), num_instructions, num_nodes, num_edges);
+
+  std::vector<bool> added(blocks.size(), false);
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    added[i] = AddBasicBlock(*blocks[i]);
+  }
+  return added;
+}
+
+template <typename Policy>
+std::vector<bool> BasicBlockGraphBuilderImpl<Policy>::AddBasicBlocksInParallel(
+    absl::Span<const BasicBlock* const> blocks, int num_threads) {
+  ABSL_CHECK_GT(num_threads, 0);
+  num_threads = std::min<int>(num_threads, blocks.size());
+  if (num_threads <= 1) return AddBasicBlocks(blocks);
+  ThreadPool pool(num_threads);
+  return AddBasicBlocksInParallel(blocks, pool);
+}
+
+template <typename Policy>
+std::vector<bool> BasicBlockGraphBuilderImpl<Policy>::AddBasicBlocksInParallel(
+    absl::Span<const BasicBlock* const> blocks, ThreadPool& pool) {
+  const int num_ranges = std::min<int>(pool.num_threads(), blocks.size());
+  if (num_ranges <= 1) return AddBasicBlocks(blocks);
+
+  // Split the blocks into contiguous ranges of roughly the same size. The
+  // first range is processed directly by this graph builder; the remaining
+  // ranges are processed by worker graph builders.
+  std::vector<absl::Span<const BasicBlock* const>> ranges;
+  ranges.reserve(num_ranges);
+  for (int i = 0; i < num_ranges; ++i) {
+    const size_t begin = blocks.size() * i / num_ranges;
+    const size_t end = blocks.size() * (i + 1) / num_ranges;
+    ranges.push_back(blocks.subspan(begin, end - begin));
+  }
+
+  // NOTE: The workers are created before any of the tasks start, because the
+  // constructor reads the configuration of this graph builder. The worker
+  // graph builders belong to the ranges rather than to the worker threads, so
+  // that their batches can be merged in the order of the ranges.
+  std::vector<std::unique_ptr<BasicBlockGraphBuilderImpl>> workers;
+  std::vector<std::vector<bool>> worker_results(num_ranges);
+  workers.reserve(num_ranges - 1);
+  for (int i = 1; i < num_ranges; ++i) {
+    workers.emplace_back(
+        new BasicBlockGraphBuilderImpl(*this, EmptyBatchTag()));
+  }
+
+  pool.ParallelFor(num_ranges, [&](int64_t i) {
+    BasicBlockGraphBuilderImpl& builder = i == 0 ? *this : *workers[i - 1];
+    worker_results[i] = builder.AddBasicBlocks(ranges[i]);
+  });
+
+  std::vector<bool> added = std::move(worker_results[0]);
+  added.reserve(blocks.size());
+  for (int i = 1; i < num_ranges; ++i) {
+    MergeFrom(*workers[i - 1]);
+    added.insert(added.end(), worker_results[i].begin(),
+                 worker_results[i].end());
+  }
+  return added;
+}
+
+template <typename Policy>
+void BasicBlockGraphBuilderImpl<Policy>::MergeFrom(
+    const BasicBlockGraphBuilderImpl& other) {
+  ABSL_CHECK_NE(this, &other) << "Merging a graph builder into itself";
+  // The last block of the batch now comes from `other`, whose per-block state
+  // is not copied, so it can't be extended.
+  last_basic_block_is_extendable_ = false;
+  ABSL_CHECK_EQ(num_node_tokens(), other.num_node_tokens());
+  ABSL_CHECK_EQ(immediate_token_, other.immediate_token_);
+  ABSL_CHECK_EQ(fp_immediate_token_, other.fp_immediate_token_);
+  ABSL_CHECK_EQ(address_token_, other.address_token_);
+  ABSL_CHECK_EQ(memory_token_, other.memory_token_);
+  ABSL_CHECK_EQ(replacement_token_, other.replacement_token_);
+  ABSL_CHECK_EQ(collect_instruction_tokens_, other.collect_instruction_tokens_);
+  ABSL_CHECK(node_tokens_ == other.node_tokens_ ||
+             *node_tokens_ == *other.node_tokens_)
+      << "The node token vocabularies of the graph builders are different.";
+  ABSL_CHECK(register_unit_table_ == other.register_unit_table_)
+      << "The graph builders use different register unit tables.";
+
+  const auto append = [](auto& destination, const auto& source) {
+    destination.insert(destination.end(), source.begin(), source.end());
+  };
+  // The blocks of `other` start at the original number of graphs in this graph
+  // builder.
+  const int block_offset = num_graphs();
+  delta_block_index_.reserve(delta_block_index_.size() +
+                             other.delta_block_index_.size());
+  for (const int block : other.delta_block_index_) {
+    delta_block_index_.push_back(block + block_offset);
+  }
+
+  append(num_nodes_per_block_, other.num_nodes_per_block_);
+  append(num_edges_per_block_, other.num_edges_per_block_);
+  append(node_types_, other.node_types_);
+  append(node_features_, other.node_features_);
+  append(edge_types_, other.edge_types_);
+  append(edge_features_, other.edge_features_);
+  append(instruction_node_mask_, other.instruction_node_mask_);
+  // The global features contain token indices, so they do not need to be
+  // rebased.
+  append(num_global_feature_tokens_per_block_,
+         other.num_global_feature_tokens_per_block_);
+  append(global_feature_token_indices_, other.global_feature_token_indices_);
+  append(global_feature_token_counts_, other.global_feature_token_counts_);
+
+  // The instruction token offsets of `other` start at the original number of
+  // instruction tokens in this graph builder. The first offset of `other` is
+  // always zero, and it is already present in this graph builder.
+  const int token_offset = static_cast<int>(instruction_token_indices_.size());
+  append(instruction_token_indices_, other.instruction_token_indices_);
+  instruction_token_offsets_.reserve(instruction_token_offsets_.size() +
+                                     other.instruction_token_offsets_.size() -
+                                     1);
+  for (auto it = other.instruction_token_offsets_.begin() + 1;
+       it != other.instruction_token_offsets_.end(); ++it) {
+    instruction_token_offsets_.push_back(*it + token_offset);
+  }
+
+  // Rebase the node indices in the edges: the nodes of `other` start at the
+  // original number of nodes in this graph builder.
+  const NodeIndex node_offset = num_nodes() - other.num_nodes();
+  const auto append_rebased = [node_offset](
+                                  std::vector<NodeIndex>& destination,
+                                  const std::vector<NodeIndex>& source) {
+    destination.reserve(destination.size() + source.size());
+    for (const NodeIndex node : source) {
+      destination.push_back(node + node_offset);
+    }
+  };
+  append_rebased(edge_senders_, other.edge_senders_);
+  append_rebased(edge_receivers_, other.edge_receivers_);
+
+  for (const auto& [token, count] : other.out_of_vocabulary_token_counts_) {
+    out_of_vocabulary_token_counts_[token] += count;
+  }
+}
+
+template <typename Policy>
+bool BasicBlockGraphBuilderImpl<Policy>::AddBasicBlockFromProto(
+    const BasicBlockProto& proto) {
+  PackedBasicBlockFromProto(proto, packed_block_buffer_);
+  return AddBasicBlock(packed_block_buffer_);
+}
+
+template <typename Policy>
+bool BasicBlockGraphBuilderImpl<Policy>::AddBasicBlock(
+    const LazyBasicBlock& block) {
+  if (const BasicBlock* const basic_block = block.materialized_block()) {
+    return AddBasicBlock(*basic_block);
+  }
+  if (const PackedBasicBlock* const packed_block = block.packed_block()) {
+    return AddBasicBlock(*packed_block);
+  }
+  if (const std::string* const serialized_proto = block.serialized_proto()) {
+    // LazyBasicBlock checks that the serialized proto is valid.
+    ABSL_CHECK(proto_buffer_.ParseFromString(*serialized_proto));
+    return AddBasicBlockFromProto(proto_buffer_);
+  }
+  // The lazy basic block is empty and it was never materialized.
+  return AddBasicBlock(BasicBlock());
+}
+
+template <typename Policy>
+std::vector<bool>
+BasicBlockGraphBuilderImpl<Policy>::AddBasicBlocksFromSerializedProtos(
+    absl::Span<const absl::string_view> serialized_protos) {
+  std::vector<bool> added(serialized_protos.size(), false);
+  for (size_t i = 0; i < serialized_protos.size(); ++i) {
+    const absl::string_view serialized_proto = serialized_protos[i];
+    if (!proto_buffer_.ParseFromArray(serialized_proto.data(),
+                                      serialized_proto.size())) {
+      continue;
+    }
+    added[i] = AddBasicBlockFromProto(proto_buffer_);
+  }
+  return added;
+}
+
+template <typename Policy>
+bool BasicBlockGraphBuilderImpl<Policy>::CanAddBasicBlockFromInstructions(
+    const std::vector<Instruction>& instructions) const {
+  if (out_of_vocabulary_behavior_.behavior_type() ==
+      OutOfVocabularyTokenBehavior::BehaviorType::kReplaceToken) {
+    return true;
+  }
+  for (const Instruction& instruction : instructions) {
+    if (!IsKnownNodeToken(instruction.mnemonic)) return false;
+    for (const std::string& prefix : instruction.prefixes) {
+      if (!IsKnownNodeToken(prefix)) return false;
+    }
+    for (const std::vector<InstructionOperand>* const operands :
+         {&instruction.input_operands, &instruction.implicit_input_operands,
+          &instruction.output_operands,
+          &instruction.implicit_output_operands}) {
+      for (const InstructionOperand& operand : *operands) {
+        if (!CanAddOperand(operand)) return false;
+      }
+    }
+  }
+  return true;
+}
+
+template <typename Policy>
+bool BasicBlockGraphBuilderImpl<Policy>::CanAddOperand(
+    const InstructionOperand& operand) const {
+  // Only the register operands and the registers of address computations use
+  // tokens from the basic block; the tokens of all other nodes are checked in
+  // the constructor.
+  switch (operand.type()) {
+    case OperandType::kRegister:
+      return IsKnownNodeToken(operand.register_token());
+    case OperandType::kAddress: {
+      for (const TokenId register_token :
+           {operand.address_base_register_token(),
+            operand.address_index_register_token(),
+            operand.address_segment_register_token()}) {
+        if (register_token != TokenTable::kEmptyTokenId &&
+            !IsKnownNodeToken(register_token)) {
+          return false;
+        }
+      }
+      return true;
+    }
+    case OperandType::kImmediateValue:
+    case OperandType::kFpImmediateValue:
+    case OperandType::kMemory:
+    case OperandType::kUnknown:
+      return true;
+  }
+  return true;
+}
+
+template <typename Policy>
+bool BasicBlockGraphBuilderImpl<Policy>::CanAddBasicBlock(
+    const PackedBasicBlock& block) const {
+  if (out_of_vocabulary_behavior_.behavior_type() ==
+      OutOfVocabularyTokenBehavior::BehaviorType::kReplaceToken) {
+    return true;
+  }
+  for (const PackedInstruction& instruction : block.instructions()) {
+    if (!IsKnownNodeToken(instruction.mnemonic)) return false;
+    for (const TokenId prefix : block.prefixes(instruction)) {
+      if (!IsKnownNodeToken(prefix)) return false;
+    }
+    for (const OperandList list :
+         {OperandList::kInput, OperandList::kImplicitInput,
+          OperandList::kOutput, OperandList::kImplicitOutput}) {
+      for (const PackedOperand& operand : block.operands(instruction, list)) {
+        if (operand.type == OperandType::kRegister &&
+            !IsKnownNodeToken(operand.register_token)) {
+          return false;
+        }
+        if (operand.type != OperandType::kAddress) continue;
+        const PackedAddress& address = block.address(operand);
+        for (const TokenId register_token :
+             {address.base_register, address.index_register,
+              address.segment_register}) {
+          if (register_token != TokenTable::kEmptyTokenId &&
+              !IsKnownNodeToken(register_token)) {
+            return false;
+          }
+        }
+      }
+    }
+  }
+  return true;
+}
+
+template <typename Policy>
+bool BasicBlockGraphBuilderImpl<Policy>::CanAddBasicBlockFromProto(
+    const BasicBlockProto& proto) const {
+  if (out_of_vocabulary_behavior_.behavior_type() ==
+      OutOfVocabularyTokenBehavior::BehaviorType::kReplaceToken) {
+    return true;
+  }
+  // The tokens are checked directly in the proto; this avoids interning them
+  // in the global token table and building the packed basic block.
+  using OperandProtos =
+      google::protobuf::RepeatedPtrField<CanonicalizedOperandProto>;
+  for (const CanonicalizedInstructionProto& instruction :
+       proto.canonicalized_instructions()) {
+    if (!IsKnownNodeToken(instruction.mnemonic())) return false;
+    for (const std::string& prefix : instruction.prefixes()) {
+      if (!IsKnownNodeToken(prefix)) return false;
+    }
+    for (const OperandProtos* const operands :
+         {&instruction.input_operands(),
+          &instruction.implicit_input_operands(),
+          &instruction.output_operands(),
+          &instruction.implicit_output_operands()}) {
+      for (const CanonicalizedOperandProto& operand : *operands) {
+        switch (operand.operand_case()) {
+          case CanonicalizedOperandProto::kRegisterName:
+            if (!IsKnownNodeToken(operand.register_name())) return false;
+            break;
+          case CanonicalizedOperandProto::kAddress:
+            for (const std::string* const register_name :
+                 {&operand.address().base_register(),
+                  &operand.address().index_register(),
+                  &operand.address().segment()}) {
+              if (!register_name->empty() &&
+                  !IsKnownNodeToken(*register_name)) {
+                return false;
+              }
+            }
+            break;
+          default:
+            break;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+template <typename Policy>
+std::vector<bool> BasicBlockGraphBuilderImpl<Policy>::CanAddBasicBlocks(
+    absl::Span<const BasicBlock> blocks) const {
+  std::vector<bool> can_add(blocks.size());
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    can_add[i] = CanAddBasicBlock(blocks[i]);
+  }
+  return can_add;
+}
+
+template <typename Policy>
+std::vector<bool> BasicBlockGraphBuilderImpl<Policy>::CanAddBasicBlocks(
+    absl::Span<const BasicBlock* const> blocks) const {
+  std::vector<bool> can_add(blocks.size());
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    can_add[i] = CanAddBasicBlock(*ABSL_DIE_IF_NULL(blocks[i]));
+  }
+  return can_add;
+}
+
+template <typename Policy>
+bool BasicBlockGraphBuilderImpl<Policy>::CanAddBasicBlock(
+    const LazyBasicBlock& block) const {
+  if (const BasicBlock* const basic_block = block.materialized_block()) {
+    return CanAddBasicBlock(*basic_block);
+  }
+  if (const PackedBasicBlock* const packed_block = block.packed_block()) {
+    return CanAddBasicBlock(*packed_block);
+  }
+  if (const std::string* const serialized_proto = block.serialized_proto()) {
+    BasicBlockProto proto;
+    ABSL_CHECK(proto.ParseFromString(*serialized_proto));
+    return CanAddBasicBlockFromProto(proto);
+  }
+  // An empty basic block does not contain any tokens.
+  return true;
+}
+
+template <typename Policy>
+std::vector<bool>
+BasicBlockGraphBuilderImpl<Policy>::CanAddBasicBlocksFromSerializedProtos(
+    absl::Span<const absl::string_view> serialized_protos) const {
+  std::vector<bool> can_add(serialized_protos.size(), false);
+  BasicBlockProto proto;
+  for (size_t i = 0; i < serialized_protos.size(); ++i) {
+    const absl::string_view serialized_proto = serialized_protos[i];
+    if (!proto.ParseFromArray(serialized_proto.data(),
+                              serialized_proto.size())) {
+      continue;
+    }
+    can_add[i] = CanAddBasicBlockFromProto(proto);
+  }
+  return can_add;
+}
+
+template <typename Policy>
+void BasicBlockGraphBuilderImpl<Policy>::Reset() {
+  last_basic_block_is_extendable_ = false;
+
   num_nodes_per_block_.clear();
   num_edges_per_block_.clear();
 
@@ -247,57 +951,165 @@ void BasicBlockGraphBuilder::Reset() {
   edge_receivers_.clear();
   edge_types_.clear();
 
-  global_features_.clear();
+  edge_features_.clear();
+  instruction_node_mask_.clear();
+  delta_block_index_.clear();
+
+  num_global_feature_tokens_per_block_.clear();
+  global_feature_token_indices_.clear();
+  global_feature_token_counts_.clear();
+
+  instruction_token_indices_.clear();
+  instruction_token_offsets_.assign(1, 0);
+}
+
+template <typename Policy>
+BasicBlockGraphBatch BasicBlockGraphBuilderImpl<Policy>::ReleaseBatch() {
+  BasicBlockGraphBatch batch;
+  batch.num_node_tokens = num_node_tokens();
+
+  batch.num_nodes_per_block = std::move(num_nodes_per_block_);
+  batch.num_edges_per_block = std::move(num_edges_per_block_);
+
+  batch.node_types = std::move(node_types_);
+  batch.node_features = std::move(node_features_);
+
+  batch.edge_senders = std::move(edge_senders_);
+  batch.edge_receivers = std::move(edge_receivers_);
+  batch.edge_types = std::move(edge_types_);
+  batch.edge_features = std::move(edge_features_);
+
+  batch.instruction_node_mask = std::move(instruction_node_mask_);
+  batch.delta_block_index = std::move(delta_block_index_);
+
+  batch.num_global_feature_tokens_per_block =
+      std::move(num_global_feature_tokens_per_block_);
+  batch.global_feature_token_indices = std::move(global_feature_token_indices_);
+  batch.global_feature_token_counts = std::move(global_feature_token_counts_);
+
+  batch.instruction_token_indices = std::move(instruction_token_indices_);
+  batch.instruction_token_offsets = std::move(instruction_token_offsets_);
+
+  // The moved-from vectors are in a valid but unspecified state; Reset() clears
+  // them and the rest of the per-batch state.
+  Reset();
+  return batch;
 }
 
-bool BasicBlockGraphBuilder::AddInputOperand(
+template <typename Policy>
+void BasicBlockGraphBuilderImpl<Policy>::Reserve(int num_blocks,
+                                                 int num_instructions,
+                                                 int num_nodes, int num_edges) {
+  ReserveAdditional(num_nodes_per_block_, num_blocks);
+  ReserveAdditional(num_edges_per_block_, num_blocks);
+
+  ReserveAdditional(node_types_, num_nodes);
+  ReserveAdditional(node_features_, num_nodes);
+
+  ReserveAdditional(edge_senders_, num_edges);
+  ReserveAdditional(edge_receivers_, num_edges);
+  ReserveAdditional(edge_types_, num_edges);
+
+  ReserveAdditional(edge_features_, num_edges);
+  ReserveAdditional(instruction_node_mask_, num_nodes);
+  ReserveAdditional(delta_block_index_, num_instructions);
+
+  // Each node contributes at most one entry to the sparse global features.
+  ReserveAdditional(num_global_feature_tokens_per_block_, num_blocks);
+  ReserveAdditional(global_feature_token_indices_, num_nodes);
+  ReserveAdditional(global_feature_token_counts_, num_nodes);
+
+  if (collect_instruction_tokens_) {
+    // This is only an estimate: most tokens of an instruction correspond to
+    // its nodes, and each instruction has three delimiter tokens.
+    ReserveAdditional(instruction_token_offsets_, num_instructions);
+    ReserveAdditional(instruction_token_indices_,
+                      num_nodes + 3 * num_instructions);
+  }
+}
+
+template <typename Policy>
+std::vector<std::vector<int>>
+BasicBlockGraphBuilderImpl<Policy>::GlobalFeatures() const {
+  std::vector<std::vector<int>> global_features;
+  global_features.reserve(num_graphs());
+  int token_pos = 0;
+  for (const int num_tokens_in_block : num_global_feature_tokens_per_block_) {
+    std::vector<int>& block_features =
+        global_features.emplace_back(num_node_tokens(), 0);
+    for (int i = 0; i < num_tokens_in_block; ++i, ++token_pos) {
+      block_features[global_feature_token_indices_[token_pos]] =
+          global_feature_token_counts_[token_pos];
+    }
+  }
+  return global_features;
+}
+
+template <typename Policy>
+bool BasicBlockGraphBuilderImpl<Policy>::AddInputOperand(
     NodeIndex instruction_node, const InstructionOperand& operand) {
-  ABSL_CHECK_GE(instruction_node, 0);
-  ABSL_CHECK_LT(instruction_node, num_nodes());
+  CheckNodeIndex<Policy>(instruction_node, num_nodes());
 
   switch (operand.type()) {
     case OperandType::kRegister: {
-      if (!AddDependencyOnRegister(instruction_node, operand.register_name(),
-                                   EdgeType::kInputOperands)) {
-        return false;
-      }
+      const TokenIndex register_token_index = AddDependencyOnRegister(
+          instruction_node, operand.register_token(), EdgeType::kInputOperands);
+      if (register_token_index == kInvalidTokenIndex) return false;
+      AddInputOperandToken(register_token_index);
     } break;
     case OperandType::kImmediateValue: {
       AddEdge(EdgeType::kInputOperands,
               AddNode(NodeType::kImmediate, immediate_token_),
               instruction_node);
+      AddInputOperandToken(sequence_immediate_token_);
     } break;
     case OperandType::kFpImmediateValue: {
+      constexpr bool kFuse = Policy::kFuseFpImmediateNodes;
       AddEdge(EdgeType::kInputOperands,
-              AddNode(NodeType::kFpImmediate, fp_immediate_token_),
+              kFuse ? AddNode(NodeType::kImmediate, immediate_token_)
+                    : AddNode(NodeType::kFpImmediate, fp_immediate_token_),
               instruction_node);
+      AddInputOperandToken(sequence_immediate_token_);
     } break;
     case OperandType::kAddress: {
       const NodeIndex address_node =
           AddNode(NodeType::kAddressOperand, address_token_);
+      AddInputOperandToken(sequence_address_token_);
       const AddressTuple& address_tuple = operand.address();
-      if (!address_tuple.base_register.empty()) {
-        if (!AddDependencyOnRegister(address_node, address_tuple.base_register,
-                                     EdgeType::kAddressBaseRegister)) {
-          return false;
-        }
+      if (operand.address_base_register_token() != TokenTable::kEmptyTokenId) {
+        const TokenIndex register_token_index = AddDependencyOnRegister(
+            address_node, operand.address_base_register_token(),
+            EdgeType::kAddressBaseRegister);
+        if (register_token_index == kInvalidTokenIndex) return false;
+        AddInputOperandToken(register_token_index);
+      } else {
+        AddInputOperandToken(sequence_no_register_token_);
       }
-      if (!address_tuple.index_register.empty()) {
-        if (!AddDependencyOnRegister(address_node, address_tuple.index_register,
-                                     EdgeType::kAddressIndexRegister)) {
-          return false;
-        }
+      if (operand.address_index_register_token() !=
+          TokenTable::kEmptyTokenId) {
+        const TokenIndex register_token_index = AddDependencyOnRegister(
+            address_node, operand.address_index_register_token(),
+            EdgeType::kAddressIndexRegister);
+        if (register_token_index == kInvalidTokenIndex) return false;
+        AddInputOperandToken(register_token_index);
+      } else {
+        AddInputOperandToken(sequence_no_register_token_);
       }
-      if (!address_tuple.segment_register.empty()) {
-        if (!AddDependencyOnRegister(address_node,
-                                     address_tuple.segment_register,
-                                     EdgeType::kAddressSegmentRegister)) {
-          return false;
-        }
+      if (operand.address_segment_register_token() !=
+          TokenTable::kEmptyTokenId) {
+        const TokenIndex register_token_index = AddDependencyOnRegister(
+            address_node, operand.address_segment_register_token(),
+            EdgeType::kAddressSegmentRegister);
+        if (register_token_index == kInvalidTokenIndex) return false;
+        AddInputOperandToken(register_token_index);
       }
       if (address_tuple.displacement != 0) {
-        AddEdge(EdgeType::kAddressDisplacement,
-                AddNode(NodeType::kImmediate, immediate_token_), address_node);
+        if constexpr (Policy::kAddDisplacementNodes) {
+          AddEdge(EdgeType::kAddressDisplacement,
+                  AddNode(NodeType::kImmediate, immediate_token_),
+                  address_node);
+        }
+        AddInputOperandToken(sequence_displacement_token_);
       }
       // NOTE(ondrasej): For now, we explicitly ignore the scaling.
       AddEdge(EdgeType::kInputOperands, address_node, instruction_node);
@@ -306,9 +1118,14 @@ bool BasicBlockGraphBuilder::AddInputOperand(
       NodeIndex& alias_group_node = LookupOrInsert(
           alias_group_nodes_, operand.alias_group_id(), kInvalidNode);
       if (alias_group_node == kInvalidNode) {
+        if (undo_log_ != nullptr) {
+          undo_log_->alias_group_nodes.emplace_back(operand.alias_group_id(),
+                                                    kInvalidNode);
+        }
         alias_group_node = AddNode(NodeType::kMemoryOperand, memory_token_);
       }
       AddEdge(EdgeType::kInputOperands, alias_group_node, instruction_node);
+      AddInputOperandToken(sequence_memory_token_);
     } break;
     case OperandType::kUnknown:
       // TODO(ondrasej): Return an error instead.
@@ -317,18 +1134,19 @@ bool BasicBlockGraphBuilder::AddInputOperand(
   return true;
 }
 
-bool BasicBlockGraphBuilder::AddOutputOperand(
+template <typename Policy>
+bool BasicBlockGraphBuilderImpl<Policy>::AddOutputOperand(
     NodeIndex instruction_node, const InstructionOperand& operand) {
-  ABSL_CHECK_GE(instruction_node, 0);
-  ABSL_CHECK_LT(instruction_node, num_nodes());
+  CheckNodeIndex<Policy>(instruction_node, num_nodes());
 
   switch (operand.type()) {
     case OperandType::kRegister: {
       const NodeIndex register_node =
-          AddNode(NodeType::kRegister, operand.register_name());
+          AddNodeForTokenId(NodeType::kRegister, operand.register_token());
       if (register_node == kInvalidNode) return false;
       AddEdge(EdgeType::kOutputOperands, instruction_node, register_node);
-      register_nodes_[operand.register_name()] = register_node;
+      AddOutputOperandToken(node_features_[register_node]);
+      SetRegisterNode(operand.register_token(), register_node);
     } break;
     case OperandType::kImmediateValue:
     case OperandType::kFpImmediateValue:
@@ -340,8 +1158,15 @@ bool BasicBlockGraphBuilder::AddOutputOperand(
     case OperandType::kMemory: {
       const NodeIndex alias_group_node =
           AddNode(NodeType::kMemoryOperand, memory_token_);
-      alias_group_nodes_[operand.alias_group_id()] = alias_group_node;
+      NodeIndex& alias_group_entry = LookupOrInsert(
+          alias_group_nodes_, operand.alias_group_id(), kInvalidNode);
+      if (undo_log_ != nullptr) {
+        undo_log_->alias_group_nodes.emplace_back(operand.alias_group_id(),
+                                                  alias_group_entry);
+      }
+      alias_group_entry = alias_group_node;
       AddEdge(EdgeType::kOutputOperands, instruction_node, alias_group_node);
+      AddOutputOperandToken(sequence_memory_token_);
     } break;
     case OperandType::kUnknown:
       // TODO(ondrasej): Return an error.
@@ -350,93 +1175,438 @@ bool BasicBlockGraphBuilder::AddOutputOperand(
   return true;
 }
 
-bool BasicBlockGraphBuilder::AddDependencyOnRegister(
-    NodeIndex dependent_node, absl::string_view register_name,
-    EdgeType edge_type) {
-  NodeIndex& operand_node =
-      LookupOrInsert(register_nodes_, register_name, kInvalidNode);
-  if (operand_node == kInvalidNode) {
-    // Add a node for the register if it doesn't exist. This also updates the
-    // node index in `node_by_register`.
-    operand_node = AddNode(NodeType::kRegister, register_name);
+template <typename Policy>
+bool BasicBlockGraphBuilderImpl<Policy>::AddInputOperand(
+    NodeIndex instruction_node, const PackedBasicBlock& block,
+    const PackedOperand& operand) {
+  CheckNodeIndex<Policy>(instruction_node, num_nodes());
+
+  switch (operand.type) {
+    case OperandType::kRegister: {
+      const TokenIndex register_token_index = AddDependencyOnRegister(
+          instruction_node, operand.register_token, EdgeType::kInputOperands);
+      if (register_token_index == kInvalidTokenIndex) return false;
+      AddInputOperandToken(register_token_index);
+    } break;
+    case OperandType::kImmediateValue: {
+      AddEdge(EdgeType::kInputOperands,
+              AddNode(NodeType::kImmediate, immediate_token_),
+              instruction_node);
+      AddInputOperandToken(sequence_immediate_token_);
+    } break;
+    case OperandType::kFpImmediateValue: {
+      constexpr bool kFuse = Policy::kFuseFpImmediateNodes;
+      AddEdge(EdgeType::kInputOperands,
+              kFuse ? AddNode(NodeType::kImmediate, immediate_token_)
+                    : AddNode(NodeType::kFpImmediate, fp_immediate_token_),
+              instruction_node);
+      AddInputOperandToken(sequence_immediate_token_);
+    } break;
+    case OperandType::kAddress: {
+      const NodeIndex address_node =
+          AddNode(NodeType::kAddressOperand, address_token_);
+      AddInputOperandToken(sequence_address_token_);
+      const PackedAddress& address = block.address(operand);
+      if (address.base_register != TokenTable::kEmptyTokenId) {
+        const TokenIndex register_token_index = AddDependencyOnRegister(
+            address_node, address.base_register,
+            EdgeType::kAddressBaseRegister);
+        if (register_token_index == kInvalidTokenIndex) return false;
+        AddInputOperandToken(register_token_index);
+      } else {
+        AddInputOperandToken(sequence_no_register_token_);
+      }
+      if (address.index_register != TokenTable::kEmptyTokenId) {
+        const TokenIndex register_token_index = AddDependencyOnRegister(
+            address_node, address.index_register,
+            EdgeType::kAddressIndexRegister);
+        if (register_token_index == kInvalidTokenIndex) return false;
+        AddInputOperandToken(register_token_index);
+      } else {
+        AddInputOperandToken(sequence_no_register_token_);
+      }
+      if (address.segment_register != TokenTable::kEmptyTokenId) {
+        const TokenIndex register_token_index = AddDependencyOnRegister(
+            address_node, address.segment_register,
+            EdgeType::kAddressSegmentRegister);
+        if (register_token_index == kInvalidTokenIndex) return false;
+        AddInputOperandToken(register_token_index);
+      }
+      if (address.displacement != 0) {
+        if constexpr (Policy::kAddDisplacementNodes) {
+          AddEdge(EdgeType::kAddressDisplacement,
+                  AddNode(NodeType::kImmediate, immediate_token_),
+                  address_node);
+        }
+        AddInputOperandToken(sequence_displacement_token_);
+      }
+      // NOTE(ondrasej): For now, we explicitly ignore the scaling.
+      AddEdge(EdgeType::kInputOperands, address_node, instruction_node);
+    } break;
+    case OperandType::kMemory: {
+      NodeIndex& alias_group_node = LookupOrInsert(
+          alias_group_nodes_, operand.alias_group_id, kInvalidNode);
+      if (alias_group_node == kInvalidNode) {
+        if (undo_log_ != nullptr) {
+          undo_log_->alias_group_nodes.emplace_back(operand.alias_group_id,
+                                                    kInvalidNode);
+        }
+        alias_group_node = AddNode(NodeType::kMemoryOperand, memory_token_);
+      }
+      AddEdge(EdgeType::kInputOperands, alias_group_node, instruction_node);
+      AddInputOperandToken(sequence_memory_token_);
+    } break;
+    case OperandType::kUnknown:
+      ABSL_LOG(FATAL) << "The operand is empty";
+  }
+  return true;
+}
+
+template <typename Policy>
+bool BasicBlockGraphBuilderImpl<Policy>::AddOutputOperand(
+    NodeIndex instruction_node, const PackedOperand& operand) {
+  CheckNodeIndex<Policy>(instruction_node, num_nodes());
+
+  switch (operand.type) {
+    case OperandType::kRegister: {
+      const NodeIndex register_node =
+          AddNodeForTokenId(NodeType::kRegister, operand.register_token);
+      if (register_node == kInvalidNode) return false;
+      AddEdge(EdgeType::kOutputOperands, instruction_node, register_node);
+      AddOutputOperandToken(node_features_[register_node]);
+      SetRegisterNode(operand.register_token, register_node);
+    } break;
+    case OperandType::kImmediateValue:
+    case OperandType::kFpImmediateValue:
+    case OperandType::kAddress:
+      ABSL_LOG(FATAL)
+          << "Immediate values, floating-point immediate values and "
+             "address expressions can't be output operands.";
+      break;
+    case OperandType::kMemory: {
+      const NodeIndex alias_group_node =
+          AddNode(NodeType::kMemoryOperand, memory_token_);
+      NodeIndex& alias_group_entry = LookupOrInsert(
+          alias_group_nodes_, operand.alias_group_id, kInvalidNode);
+      if (undo_log_ != nullptr) {
+        undo_log_->alias_group_nodes.emplace_back(operand.alias_group_id,
+                                                  alias_group_entry);
+      }
+      alias_group_entry = alias_group_node;
+      AddEdge(EdgeType::kOutputOperands, instruction_node, alias_group_node);
+      AddOutputOperandToken(sequence_memory_token_);
+    } break;
+    case OperandType::kUnknown:
+      ABSL_LOG(FATAL) << "The operand is empty";
   }
-  if (operand_node == kInvalidNode) return false;
-  AddEdge(edge_type, operand_node, dependent_node);
   return true;
 }
 
-BasicBlockGraphBuilder::NodeIndex BasicBlockGraphBuilder::AddNode(
+template <typename Policy>
+typename BasicBlockGraphBuilderImpl<Policy>::TokenIndex
+BasicBlockGraphBuilderImpl<Policy>::AddDependencyOnRegister(
+    NodeIndex dependent_node, TokenId register_token, EdgeType edge_type) {
+  const absl::Span<const int> units =
+      register_unit_table_ == nullptr
+          ? absl::Span<const int>()
+          : register_unit_table_->units(register_token);
+  if (units.empty()) {
+    NodeIndex& operand_node =
+        LookupOrInsert(register_nodes_, register_token, kInvalidNode);
+    if (operand_node == kInvalidNode) {
+      if (undo_log_ != nullptr) {
+        undo_log_->register_nodes.emplace_back(register_token, kInvalidNode);
+      }
+      // Add a node for the register if it doesn't exist. This also updates the
+      // node index in `node_by_register`.
+      operand_node = AddNodeForTokenId(NodeType::kRegister, register_token);
+    }
+    if (operand_node == kInvalidNode) return kInvalidTokenIndex;
+    AddEdge(edge_type, operand_node, dependent_node);
+    return node_features_[operand_node];
+  }
+
+  // The units that were not written in the block share a new node for the
+  // register; it is added before any unit is updated, so that nothing needs
+  // to be reverted when the token is not in the vocabulary.
+  NodeIndex register_node = kInvalidNode;
+  for (const int unit : units) {
+    if (register_unit_nodes_[unit] != kInvalidNode) continue;
+    if (register_node == kInvalidNode) {
+      register_node = AddNodeForTokenId(NodeType::kRegister, register_token);
+      if (register_node == kInvalidNode) return kInvalidTokenIndex;
+    }
+    if (undo_log_ != nullptr) {
+      undo_log_->register_unit_nodes.emplace_back(unit, kInvalidNode);
+    }
+    register_unit_nodes_[unit] = register_node;
+    used_register_units_.push_back(unit);
+  }
+  // Add one edge from each distinct node of the units. Registers have only a
+  // few units, so a quadratic search is faster than a set.
+  for (int i = 0; i < units.size(); ++i) {
+    const NodeIndex unit_node = register_unit_nodes_[units[i]];
+    bool is_new_node = true;
+    for (int j = 0; j < i && is_new_node; ++j) {
+      is_new_node = register_unit_nodes_[units[j]] != unit_node;
+    }
+    if (is_new_node) AddEdge(edge_type, unit_node, dependent_node);
+  }
+  // When the register was written as a part of another register, none of the
+  // nodes has the token of the register itself. The token index resolved for
+  // the register is reused for the rest of the block, so that an
+  // out-of-vocabulary register is counted once, like when its node is reused
+  // without register units.
+  if (register_node != kInvalidNode) {
+    const TokenIndex token_index = node_features_[register_node];
+    register_token_indices_.try_emplace(register_token, token_index);
+    return token_index;
+  }
+  TokenIndex& token_index = LookupOrInsert(
+      register_token_indices_, register_token, kInvalidTokenIndex);
+  if (token_index == kInvalidTokenIndex) {
+    token_index = FindNodeToken(register_token);
+  }
+  return token_index;
+}
+
+template <typename Policy>
+void BasicBlockGraphBuilderImpl<Policy>::SetRegisterNode(
+    TokenId register_token, NodeIndex register_node) {
+  const absl::Span<const int> units =
+      register_unit_table_ == nullptr
+          ? absl::Span<const int>()
+          : register_unit_table_->units(register_token);
+  if (units.empty()) {
+    NodeIndex& entry =
+        LookupOrInsert(register_nodes_, register_token, kInvalidNode);
+    if (undo_log_ != nullptr) {
+      undo_log_->register_nodes.emplace_back(register_token, entry);
+    }
+    entry = register_node;
+    return;
+  }
+  for (const int unit : units) {
+    if (register_unit_nodes_[unit] == kInvalidNode) {
+      used_register_units_.push_back(unit);
+    }
+    if (undo_log_ != nullptr) {
+      undo_log_->register_unit_nodes.emplace_back(unit,
+                                                  register_unit_nodes_[unit]);
+    }
+    register_unit_nodes_[unit] = register_node;
+  }
+}
+
+template <typename Policy>
+void BasicBlockGraphBuilderImpl<Policy>::ClearRegisterNodes() {
+  register_nodes_.clear();
+  for (const int unit : used_register_units_) {
+    register_unit_nodes_[unit] = kInvalidNode;
+  }
+  used_register_units_.clear();
+  register_token_indices_.clear();
+}
+
+template <typename Policy>
+void BasicBlockGraphBuilderImpl<Policy>::StartInstructionTokens(
+    NodeIndex instruction_node) {
+  if (!collect_instruction_tokens_) return;
+  // The order of the tokens must be kept in sync with
+  // Instruction::AddTokensToList(): the prefixes, the mnemonic, the output
+  // operands, and the input operands, separated by delimiters.
+  input_operand_tokens_.clear();
+  for (NodeIndex prefix_node = instruction_node + 1; prefix_node < num_nodes();
+       ++prefix_node) {
+    instruction_token_indices_.push_back(node_features_[prefix_node]);
+  }
+  instruction_token_indices_.push_back(node_features_[instruction_node]);
+  instruction_token_indices_.push_back(sequence_delimiter_token_);
+}
+
+template <typename Policy>
+void BasicBlockGraphBuilderImpl<Policy>::FinishInstructionTokens() {
+  if (!collect_instruction_tokens_) return;
+  instruction_token_indices_.push_back(sequence_delimiter_token_);
+  instruction_token_indices_.insert(instruction_token_indices_.end(),
+                                    input_operand_tokens_.begin(),
+                                    input_operand_tokens_.end());
+  instruction_token_indices_.push_back(sequence_delimiter_token_);
+  instruction_token_offsets_.push_back(
+      static_cast<int>(instruction_token_indices_.size()));
+}
+
+template <typename Policy>
+typename BasicBlockGraphBuilderImpl<Policy>::NodeIndex
+BasicBlockGraphBuilderImpl<Policy>::AddNode(
     NodeType node_type, TokenIndex token_index) {
   const NodeIndex new_node_index = num_nodes();
   node_types_.push_back(node_type);
   node_features_.push_back(token_index);
+  const bool is_instruction = node_type == NodeType::kInstruction;
+  instruction_node_mask_.push_back(is_instruction);
+  if (is_instruction) {
+    delta_block_index_.push_back(current_block_index_);
+  }
   return new_node_index;
 }
 
-BasicBlockGraphBuilder::NodeIndex BasicBlockGraphBuilder::AddNode(
-    NodeType node_type, absl::string_view token) {
-  const auto it = node_tokens_.find(token);
-  TokenIndex token_index = kInvalidTokenIndex;
-  if (it != node_tokens_.end()) {
-    token_index = it->second;
-  } else {
+template <typename Policy>
+typename BasicBlockGraphBuilderImpl<Policy>::TokenIndex
+BasicBlockGraphBuilderImpl<Policy>::FindNodeToken(absl::string_view token) {
+  const TokenIndex token_index = node_tokens_->Find(token);
+  if (token_index != kInvalidTokenIndex) return token_index;
+  AddToInstrumentationCounter(InstrumentationCounter::kOutOfVocabularyTokens);
+  int64_t& count =
+      out_of_vocabulary_token_counts_.try_emplace(token, 0).first->second;
+  ++count;
+  if (count == 1 && log_out_of_vocabulary_tokens_) {
     ABSL_LOG(WARNING) << "Unexpected node token: '" << token << "'";
-    switch (out_of_vocabulary_behavior_.behavior_type()) {
-      case OutOfVocabularyTokenBehavior::BehaviorType::kReturnError:
-        return kInvalidNode;
-      case OutOfVocabularyTokenBehavior::BehaviorType::kReplaceToken:
-        token_index = replacement_token_;
-    }
   }
+  switch (out_of_vocabulary_behavior_.behavior_type()) {
+    case OutOfVocabularyTokenBehavior::BehaviorType::kReturnError:
+      return kInvalidTokenIndex;
+    case OutOfVocabularyTokenBehavior::BehaviorType::kReplaceToken:
+      return replacement_token_;
+  }
+  return kInvalidTokenIndex;
+}
+
+template <typename Policy>
+typename BasicBlockGraphBuilderImpl<Policy>::TokenIndex
+BasicBlockGraphBuilderImpl<Policy>::FindNodeToken(TokenId token_id) {
+  ABSL_DCHECK_GE(token_id, 0);
+  const TokenIndex token_index = node_tokens_->Find(token_id);
+  if (token_index != kInvalidTokenIndex) return token_index;
+  // Use the string version to handle the out-of-vocabulary token.
+  return FindNodeToken(TokenTable::Global().Name(token_id));
+}
+
+template <typename Policy>
+typename BasicBlockGraphBuilderImpl<Policy>::NodeIndex
+BasicBlockGraphBuilderImpl<Policy>::AddNode(NodeType node_type,
+                                            absl::string_view token) {
+  const TokenIndex token_index = FindNodeToken(token);
+  if (token_index == kInvalidTokenIndex) return kInvalidNode;
   return AddNode(node_type, token_index);
 }
 
-void BasicBlockGraphBuilder::AddEdge(EdgeType edge_type, NodeIndex sender,
-                                     NodeIndex receiver) {
-  ABSL_CHECK_GE(sender, 0);
-  ABSL_CHECK_LT(sender, num_nodes());
-  ABSL_CHECK_GE(receiver, 0);
-  ABSL_CHECK_LT(receiver, num_nodes());
+template <typename Policy>
+typename BasicBlockGraphBuilderImpl<Policy>::NodeIndex
+BasicBlockGraphBuilderImpl<Policy>::AddNodeForTokenId(NodeType node_type,
+                                                      TokenId token_id) {
+  const TokenIndex token_index = FindNodeToken(token_id);
+  if (token_index == kInvalidTokenIndex) return kInvalidNode;
+  return AddNode(node_type, token_index);
+}
+
+template <typename Policy>
+void BasicBlockGraphBuilderImpl<Policy>::AddEdge(EdgeType edge_type,
+                                                 NodeIndex sender,
+                                                 NodeIndex receiver) {
+  CheckNodeIndex<Policy>(sender, num_nodes());
+  CheckNodeIndex<Policy>(receiver, num_nodes());
   edge_senders_.push_back(sender);
   edge_receivers_.push_back(receiver);
   edge_types_.push_back(edge_type);
+  edge_features_.push_back(static_cast<int>(edge_type));
 }
 
-std::vector<int> BasicBlockGraphBuilder::EdgeFeatures() const {
-  std::vector<int> edge_features(num_edges());
-  for (int i = 0; i < num_edges(); ++i) {
-    edge_features[i] = static_cast<int>(edge_types_[i]);
+template <typename Policy>
+void BasicBlockGraphBuilderImpl<Policy>::AddGlobalFeatures(
+    NodeIndex first_node) {
+  ABSL_CHECK_GE(first_node, 0);
+  ABSL_CHECK_LE(first_node, num_nodes());
+  // Blocks are typically small, so sorting a copy of the node features is
+  // cheaper than going through a dense histogram over the whole vocabulary.
+  std::vector<TokenIndex> block_tokens(node_features_.begin() + first_node,
+                                       node_features_.end());
+  std::sort(block_tokens.begin(), block_tokens.end());
+  const size_t prev_num_tokens = global_feature_token_indices_.size();
+  for (size_t i = 0; i < block_tokens.size();) {
+    const TokenIndex token = block_tokens[i];
+    size_t j = i + 1;
+    while (j < block_tokens.size() && block_tokens[j] == token) ++j;
+    global_feature_token_indices_.push_back(token);
+    global_feature_token_counts_.push_back(static_cast<int>(j - i));
+    i = j;
   }
-  return edge_features;
+  num_global_feature_tokens_per_block_.push_back(
+      static_cast<int>(global_feature_token_indices_.size() - prev_num_tokens));
 }
 
-std::vector<bool> BasicBlockGraphBuilder::InstructionNodeMask() const {
-  std::vector<bool> instruction_node_mask(num_nodes());
-  for (NodeIndex i = 0; i < num_nodes(); ++i) {
-    instruction_node_mask[i] = node_types_[i] == NodeType::kInstruction;
+template <typename Policy>
+void BasicBlockGraphBuilderImpl<Policy>::UpdateGlobalFeaturesOfLastBlock(
+    NodeIndex first_new_node) {
+  ABSL_CHECK(!num_global_feature_tokens_per_block_.empty());
+  ABSL_CHECK_GE(first_new_node, 0);
+  ABSL_CHECK_LE(first_new_node, num_nodes());
+  std::vector<TokenIndex> new_tokens(node_features_.begin() + first_new_node,
+                                     node_features_.end());
+  std::sort(new_tokens.begin(), new_tokens.end());
+
+  // The (token, count) entries of the last block are sorted by the token. The
+  // tokens that the block already uses only increase their counts; they are
+  // found by a binary search. The others are collected and merged into the
+  // entries below.
+  const size_t last_block_begin = global_feature_token_indices_.size() -
+                                  num_global_feature_tokens_per_block_.back();
+  std::vector<TokenIndex> added_indices;
+  std::vector<int> added_counts;
+  auto search_begin = global_feature_token_indices_.begin() + last_block_begin;
+  for (size_t i = 0; i < new_tokens.size();) {
+    const TokenIndex token = new_tokens[i];
+    size_t j = i + 1;
+    while (j < new_tokens.size() && new_tokens[j] == token) ++j;
+    const int count = static_cast<int>(j - i);
+    i = j;
+    search_begin = std::lower_bound(
+        search_begin, global_feature_token_indices_.end(), token);
+    if (search_begin != global_feature_token_indices_.end() &&
+        *search_begin == token) {
+      global_feature_token_counts_[search_begin -
+                                   global_feature_token_indices_.begin()] +=
+          count;
+    } else {
+      added_indices.push_back(token);
+      added_counts.push_back(count);
+    }
   }
-  return instruction_node_mask;
-}
+  if (added_indices.empty()) return;
 
-std::vector<int> BasicBlockGraphBuilder::DeltaBlockIndex() const {
-  const int num_instructions = static_cast<int>(std::count(
-      node_types_.begin(), node_types_.end(), NodeType::kInstruction));
-  std::vector<int> delta_block_index;
-  delta_block_index.reserve(num_instructions);
-  int block = -1;
-  int block_end = 0;
-  for (int node = 0; node < node_types_.size(); ++node) {
-    if (node_types_[node] != NodeType::kInstruction) continue;
-    while (node >= block_end && block < num_graphs()) {
-      block++;
-      block_end += num_nodes_per_block_[block];
+  // Merge the new entries into the entries of the last block in place, from
+  // the back. This is linear in the number of distinct tokens of the block,
+  // which is bounded by the size of the vocabulary.
+  size_t old_pos = global_feature_token_indices_.size();
+  size_t added_pos = added_indices.size();
+  size_t out_pos = old_pos + added_pos;
+  global_feature_token_indices_.resize(out_pos);
+  global_feature_token_counts_.resize(out_pos);
+  while (added_pos > 0) {
+    --out_pos;
+    if (old_pos > last_block_begin &&
+        global_feature_token_indices_[old_pos - 1] >
+            added_indices[added_pos - 1]) {
+      --old_pos;
+      global_feature_token_indices_[out_pos] =
+          global_feature_token_indices_[old_pos];
+      global_feature_token_counts_[out_pos] =
+          global_feature_token_counts_[old_pos];
+    } else {
+      --added_pos;
+      global_feature_token_indices_[out_pos] = added_indices[added_pos];
+      global_feature_token_counts_[out_pos] = added_counts[added_pos];
     }
-    delta_block_index.push_back(block);
   }
-  ABSL_CHECK_EQ(block, num_graphs() - 1);
-  ABSL_CHECK_EQ(block_end, num_nodes());
-  ABSL_CHECK_EQ(delta_block_index.size(), num_instructions);
-  return delta_block_index;
+  num_global_feature_tokens_per_block_.back() +=
+      static_cast<int>(added_indices.size());
+}
+
+template <typename Policy>
+std::vector<bool> BasicBlockGraphBuilderImpl<Policy>::InstructionNodeMask()
+    const {
+  return std::vector<bool>(instruction_node_mask_.begin(),
+                           instruction_node_mask_.end());
 }
 
 namespace {
@@ -447,7 +1617,8 @@ void StrAppendList(std::string* buffer, absl::string_view list_name,
 }
 }  // namespace
 
-std::string BasicBlockGraphBuilder::DebugString() const {
+template <typename Policy>
+std::string BasicBlockGraphBuilderImpl<Policy>::DebugString() const {
   std::string buffer;
   absl::StrAppend(&buffer, "num_graphs = ", num_graphs(), "\n");
   absl::StrAppend(&buffer, "num_nodes = ", num_nodes(), "\n");
@@ -464,4 +1635,8 @@ std::string BasicBlockGraphBuilder::DebugString() const {
   return buffer;
 }
 
+template class BasicBlockGraphBuilderImpl<GraniteGraphPolicy>;
+template class BasicBlockGraphBuilderImpl<UncheckedGraniteGraphPolicy>;
+template class BasicBlockGraphBuilderImpl<CompactGraniteGraphPolicy>;
+
 }  // namespace gematria
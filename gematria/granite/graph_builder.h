@@ -89,6 +89,9 @@
 #ifndef GEMATRIA_GRANITE_GRAPH_BUILDER_H_
 #define GEMATRIA_GRANITE_GRAPH_BUILDER_H_
 
+#include <cstddef>
+#include <cstdint>
+#include <memory>
 #include <ostream>
 #include <string>
 #include <utility>
@@ -96,8 +99,16 @@
 
 #include "absl/container/flat_hash_map.h"
 #include "absl/strings/string_view.h"
+#include "absl/types/span.h"
 #include "gematria/basic_block/basic_block.h"
+#include "gematria/basic_block/lazy_basic_block.h"
+#include "gematria/basic_block/packed_basic_block.h"
+#include "gematria/basic_block/register_unit_table.h"
+#include "gematria/basic_block/token_table.h"
 #include "gematria/model/oov_token_behavior.h"
+#include "gematria/model/token_vocabulary.h"
+#include "gematria/proto/basic_block.pb.h"
+#include "gematria/utils/thread_pool.h"
 
 namespace gematria {
 
@@ -136,9 +147,98 @@ enum class EdgeType {
 std::ostream& operator<<(std::ostream& os, NodeType node_type);
 std::ostream& operator<<(std::ostream& os, EdgeType edge_type);
 
+// The version of the graph format produced by BasicBlockGraphBuilder. Must be
+// incremented whenever a change in the builder changes the graph it produces
+// for a given basic block and vocabulary, so that graphs cached on disk by
+// earlier versions of the code are not reused.
+inline constexpr int kBasicBlockGraphBuilderVersion = 1;
+
+// Policies for BasicBlockGraphBuilderImpl. A policy is a struct with static
+// constexpr members that select at compile time which parts of the graph the
+// builder emits and which checks it does; the branches that depend on them are
+// removed by the compiler. Each policy must define:
+//  - kAddDisplacementNodes: when true, the displacement of an address
+//    computation is added as an immediate node connected to the address node
+//    by an EdgeType::kAddressDisplacement edge. When false, the displacement is
+//    dropped from the graph.
+//  - kFuseFpImmediateNodes: when true, floating-point immediate operands use
+//    nodes of type NodeType::kImmediate with the immediate token, i.e. the
+//    graph does not distinguish integer and floating-point immediate values.
+//  - kCheckNodeIndices: when true, the node indices of the new edges and
+//    operands are checked with ABSL_CHECK; when false, only in debug builds.
+//
+// The policy used by the Granite models; it produces the graphs described in
+// the top-level comment.
+struct GraniteGraphPolicy {
+  static constexpr bool kAddDisplacementNodes = true;
+  static constexpr bool kFuseFpImmediateNodes = false;
+  static constexpr bool kCheckNodeIndices = true;
+};
+
+// Produces the same graphs as GraniteGraphPolicy, but checks the node indices
+// only in debug builds. Intended for serving and for the input pipelines of
+// trained models, where the blocks come from a trusted importer.
+struct UncheckedGraniteGraphPolicy {
+  static constexpr bool kAddDisplacementNodes = true;
+  static constexpr bool kFuseFpImmediateNodes = false;
+  static constexpr bool kCheckNodeIndices = false;
+};
+
+// A smaller version of the Granite graph without displacement nodes and with
+// a single type of immediate nodes. Models trained on these graphs are not
+// compatible with models trained on the full graphs.
+struct CompactGraniteGraphPolicy {
+  static constexpr bool kAddDisplacementNodes = false;
+  static constexpr bool kFuseFpImmediateNodes = true;
+  static constexpr bool kCheckNodeIndices = false;
+};
+
+// The arrays of a batch of basic block graphs released from a graph builder by
+// BasicBlockGraphBuilderImpl::ReleaseBatch(). The members have the same names,
+// types and contents as the getters of the graph builder; see their comments
+// for the description of the format. The batch owns the arrays, so it can be
+// handed to a consumer (e.g. a NumPy array or a framework tensor created from
+// it without a copy) while the graph builder is reused for the next batch.
+struct BasicBlockGraphBatch {
+  // The number of node tokens of the graph builder that created the batch.
+  int num_node_tokens = 0;
+
+  std::vector<int> num_nodes_per_block;
+  std::vector<int> num_edges_per_block;
+
+  std::vector<NodeType> node_types;
+  std::vector<int> node_features;
+
+  std::vector<int> edge_senders;
+  std::vector<int> edge_receivers;
+  std::vector<EdgeType> edge_types;
+  std::vector<int> edge_features;
+
+  std::vector<uint8_t> instruction_node_mask;
+  std::vector<int> delta_block_index;
+
+  std::vector<int> num_global_feature_tokens_per_block;
+  std::vector<int> global_feature_token_indices;
+  std::vector<int> global_feature_token_counts;
+
+  std::vector<int> instruction_token_indices;
+  std::vector<int> instruction_token_offsets = {0};
+
+  // Returns the number of graphs, nodes and edges in the batch.
+  int num_graphs() const {
+    return static_cast<int>(num_nodes_per_block.size());
+  }
+  int num_nodes() const { return static_cast<int>(node_types.size()); }
+  int num_edges() const { return static_cast<int>(edge_senders.size()); }
+};
+
 // The basic block graph builder class. See the top-level comment for more
-// information on the format of the graphs produced by this file.
-class BasicBlockGraphBuilder {
+// information on the format of the graphs produced by this file. `Policy`
+// selects the variant of the graph at compile time; see GraniteGraphPolicy for
+// the requirements on the policy. The members are defined in graph_builder.cc
+// and instantiated there for the policies declared above.
+template <typename Policy>
+class BasicBlockGraphBuilderImpl {
  public:
   // The types of indices of nodes in the graph.
   using NodeIndex = int;
@@ -167,12 +267,21 @@ class BasicBlockGraphBuilder {
   //  - unknown_token_behavior: determines how the graph builder and
   // The values of immediate_token, fp_immediate_token, address_token and
   // memory_token must appear in node_tokens.
-  BasicBlockGraphBuilder(
+  BasicBlockGraphBuilderImpl(
       std::vector<std::string> node_tokens, absl::string_view immediate_token,
       absl::string_view fp_immediate_token, absl::string_view address_token,
       absl::string_view memory_token,
       OutOfVocabularyTokenBehavior out_of_vocabulary_behavior =
           OutOfVocabularyTokenBehavior::ReturnError());
+  // A version of the constructor that uses an existing vocabulary. The
+  // vocabulary is immutable, and it can be shared by multiple graph builders
+  // (and other users) without copying.
+  BasicBlockGraphBuilderImpl(
+      std::shared_ptr<const TokenVocabulary> node_tokens,
+      absl::string_view immediate_token, absl::string_view fp_immediate_token,
+      absl::string_view address_token, absl::string_view memory_token,
+      OutOfVocabularyTokenBehavior out_of_vocabulary_behavior =
+          OutOfVocabularyTokenBehavior::ReturnError());
 
   // Adds a basic block to the graph builder.
   //
@@ -187,11 +296,190 @@ class BasicBlockGraphBuilder {
   // block instead of the basic block object itself.
   bool AddBasicBlockFromInstructions(
       const std::vector<Instruction>& instructions);
+  // A version of AddBasicBlock that takes a packed basic block. Produces the
+  // same graph as AddBasicBlock(block.ToBasicBlock()), but it uses the token
+  // IDs from the packed basic block directly.
+  bool AddBasicBlock(const PackedBasicBlock& block);
+  // Adds a list of basic blocks to the graph builder, in the order in which
+  // they appear in `blocks`. Before adding the blocks, reserves space in all
+  // the arrays of the builder based on an upper bound of the number of nodes
+  // and edges of the blocks. Returns a vector that contains true at index i
+  // when the i-th block was added successfully, and false when it contained an
+  // unknown token; the blocks that were not added do not change the state of
+  // the builder.
+  std::vector<bool> AddBasicBlocks(absl::Span<const BasicBlock> blocks);
+  // A version of AddBasicBlocks that takes pointers to the basic blocks. This
+  // allows adding blocks that are not stored in a contiguous array.
+  std::vector<bool> AddBasicBlocks(absl::Span<const BasicBlock* const> blocks);
+  // A version of AddBasicBlock that takes the basic block in the proto format.
+  // Produces the same graph as AddBasicBlock(BasicBlockFromProto(proto)), but
+  // reads the canonicalized instructions directly from the proto without
+  // creating the intermediate Instruction objects.
+  bool AddBasicBlockFromProto(const BasicBlockProto& proto);
+  // A version of AddBasicBlock that takes a lazy basic block. Uses the
+  // materialized BasicBlock when there is one, and otherwise builds the graph
+  // directly from the packed basic block or the serialized proto, without
+  // materializing the block.
+  bool AddBasicBlock(const LazyBasicBlock& block);
+  // Adds basic blocks given as serialized BasicBlockProto messages to the graph
+  // builder, in the order in which they appear in `serialized_protos`. Returns
+  // a vector that contains true at index i when the i-th block was added
+  // successfully, and false when the block could not be parsed or when it
+  // contained an unknown token; the blocks that were not added do not change
+  // the state of the builder.
+  std::vector<bool> AddBasicBlocksFromSerializedProtos(
+      absl::Span<const absl::string_view> serialized_protos);
+
+  // A version of AddBasicBlocks that splits the blocks into `num_threads`
+  // contiguous ranges and builds the graphs for each range on its own thread,
+  // using a separate graph builder with the same configuration as this one.
+  // The batches of the worker graph builders are then merged into this graph
+  // builder in the order of the ranges, so that the result is the same as if
+  // the blocks were added sequentially.
+  std::vector<bool> AddBasicBlocksInParallel(
+      absl::Span<const BasicBlock* const> blocks, int num_threads);
+  // A version of AddBasicBlocksInParallel() that builds the graphs on the
+  // worker threads of `pool`, using one range per worker thread. This avoids
+  // creating new threads for each batch when the caller keeps the pool.
+  std::vector<bool> AddBasicBlocksInParallel(
+      absl::Span<const BasicBlock* const> blocks, ThreadPool& pool);
+
+  // Checks whether AddBasicBlock(block) would add the block to the batch,
+  // without modifying the batch. This only looks up the tokens of the block in
+  // the vocabulary, so it is much cheaper than building the graph, and it can
+  // be used to filter out basic blocks with unknown tokens before they are
+  // batched, e.g. in dataset importers. Always returns true when the unknown
+  // token behavior is kReplaceToken. Unlike AddBasicBlock(), it does not update
+  // the out-of-vocabulary token counts.
+  bool CanAddBasicBlock(const BasicBlock& block) const {
+    return CanAddBasicBlockFromInstructions(block.instructions);
+  }
+  // Versions of CanAddBasicBlock() for the list of instructions of a basic
+  // block, for a packed basic block, and for a basic block in the proto format.
+  bool CanAddBasicBlockFromInstructions(
+      const std::vector<Instruction>& instructions) const;
+  bool CanAddBasicBlock(const PackedBasicBlock& block) const;
+  bool CanAddBasicBlockFromProto(const BasicBlockProto& proto) const;
+  // A version of CanAddBasicBlock() for a lazy basic block. Like
+  // AddBasicBlock(const LazyBasicBlock&), it never materializes the block.
+  bool CanAddBasicBlock(const LazyBasicBlock& block) const;
+  // Batch versions of CanAddBasicBlock(). Return a vector that contains true at
+  // index i when the i-th block can be added to the batch. The version that
+  // takes serialized BasicBlockProtos returns false for protos that can't be
+  // parsed.
+  std::vector<bool> CanAddBasicBlocks(
+      absl::Span<const BasicBlock> blocks) const;
+  std::vector<bool> CanAddBasicBlocks(
+      absl::Span<const BasicBlock* const> blocks) const;
+  std::vector<bool> CanAddBasicBlocksFromSerializedProtos(
+      absl::Span<const absl::string_view> serialized_protos) const;
+
+  // Appends `instructions` to the last basic block in the batch. The result is
+  // the same as if the last block was added with `instructions` appended to
+  // its instructions, but the builder keeps the register and memory alias
+  // group state of the last block, so the cost does not depend on the number
+  // of instructions already in the block: the new instructions are added as
+  // usual, and the global features of the block are updated in place. Only a
+  // token that the block did not use before makes the update of the global
+  // features linear in the number of distinct tokens of the block, which is
+  // bounded by the size of the vocabulary. This is intended for clients that
+  // explore schedules of a basic block by appending one instruction at a time.
+  //
+  // Returns true when the instructions were added; returns false when they
+  // contain an unknown token and the unknown token behavior is not
+  // kReplaceToken. When this happens, the graph builder is left in the
+  // previous state. Must be called only when can_append_to_last_basic_block()
+  // returns true.
+  bool AppendInstructionsToLastBasicBlock(
+      const std::vector<Instruction>& instructions);
+  // Returns true when AppendInstructionsToLastBasicBlock() can be used, i.e.
+  // the last call that modified the batch successfully added a basic block or
+  // appended instructions to it. Returns false when the batch is empty, after
+  // Reset() and MergeFrom(), and after an unsuccessful call to one of the
+  // AddBasicBlock*() methods.
+  bool can_append_to_last_basic_block() const {
+    return last_basic_block_is_extendable_;
+  }
+
+  // Appends the batch from `other` to the batch in this graph builder. The node
+  // indices in the edges of `other` are rebased so that they point to the nodes
+  // appended to this graph builder. The result is the same as if the basic
+  // blocks added to `other` were added to this graph builder instead; this
+  // includes adding the out-of-vocabulary token counts of `other` to the counts
+  // of this graph builder. The node token vocabulary and the special tokens of
+  // `other` must be the same as those of this graph builder.
+  void MergeFrom(const BasicBlockGraphBuilderImpl& other);
 
   // Resets the graph builder so that it can be used to create a new graph from
-  // scratch.
+  // scratch. Does not reset the out-of-vocabulary token counts.
   void Reset();
 
+  // Moves the arrays of the current batch to a BasicBlockGraphBatch and resets
+  // the graph builder, as if Reset() was called. This avoids copying the arrays
+  // when the batch must outlive the next use of the graph builder; the
+  // capacity of the arrays is lost, so the next batch reallocates them.
+  BasicBlockGraphBatch ReleaseBatch();
+
+  // The number of occurrences of each out-of-vocabulary token encountered by
+  // the graph builder since it was created or since the last call to
+  // ResetOutOfVocabularyTokenCounts(). The counts include tokens from basic
+  // blocks that were not added to the batch because of the token.
+  const absl::flat_hash_map<std::string, int64_t>&
+  out_of_vocabulary_token_counts() const {
+    return out_of_vocabulary_token_counts_;
+  }
+  // Clears the out-of-vocabulary token counts. After this call, the graph
+  // builder logs the next occurrence of each out-of-vocabulary token again.
+  void ResetOutOfVocabularyTokenCounts() {
+    out_of_vocabulary_token_counts_.clear();
+  }
+
+  // When true, the graph builder logs a warning the first time it encounters
+  // each distinct out-of-vocabulary token; further occurrences of the token are
+  // only counted. When false, out-of-vocabulary tokens are only counted. The
+  // default is true.
+  bool log_out_of_vocabulary_tokens() const {
+    return log_out_of_vocabulary_tokens_;
+  }
+  void set_log_out_of_vocabulary_tokens(bool log_out_of_vocabulary_tokens) {
+    log_out_of_vocabulary_tokens_ = log_out_of_vocabulary_tokens;
+  }
+
+  // When true, the graph builder also collects the token sequence of each
+  // instruction in the batch, in the same traversal of the basic blocks that
+  // builds the graphs, and using the same node token vocabulary. The token
+  // sequences are the same as the ones produced by BasicBlockTokenizer (and by
+  // Instruction::AddTokensToList()), and they are available through
+  // instruction_token_indices() and instruction_token_offsets(). This allows
+  // models that use both the graph and the token sequences of the instructions
+  // to prepare their inputs without tokenizing the basic blocks twice.
+  //
+  // Enabling the token sequences requires that the structural tokens used in
+  // the sequences (kDelimiterToken, kImmediateToken, kAddressToken,
+  // kMemoryToken, kNoRegisterToken and kDisplacementToken) are in the node
+  // token vocabulary. The value can be changed only when the batch is empty.
+  // The default is false.
+  bool collect_instruction_tokens() const {
+    return collect_instruction_tokens_;
+  }
+  void set_collect_instruction_tokens(bool collect_instruction_tokens);
+
+  // The table of register units used to track the data dependencies through
+  // registers. When null, the graph builder tracks the registers by their
+  // names, i.e. a write to EAX and a later read of RAX are independent. When
+  // set, a register operand depends on the last writers of all register units
+  // of the register: a read of RAX after a write to EAX gets an edge from the
+  // node of EAX, and when only some of its units were written in the block, a
+  // new node for RAX provides the remaining ones. Registers that are not in
+  // the table are tracked by their names. The current values of the units are
+  // kept in a flat array indexed by the unit. The value can be changed only
+  // when the batch is empty. The default is null.
+  const std::shared_ptr<const RegisterUnitTable>& register_unit_table() const {
+    return register_unit_table_;
+  }
+  void set_register_unit_table(
+      std::shared_ptr<const RegisterUnitTable> register_unit_table);
+
   // Returns the number of graphs in the batch. This corresponds to the number
   // of successful calls to AddBasicBlock() since the last call to Reset().
   int num_graphs() const {
@@ -205,18 +493,21 @@ class BasicBlockGraphBuilder {
   int num_edges() const { return static_cast<int>(edge_senders_.size()); }
 
   // Returns the number of different tokens corresponding to nodes of the graph.
-  int num_node_tokens() const { return static_cast<int>(node_tokens_.size()); }
+  int num_node_tokens() const { return node_tokens_->size(); }
+  // Returns the vocabulary of node tokens used by the graph builder.
+  const std::shared_ptr<const TokenVocabulary>& node_tokens() const {
+    return node_tokens_;
+  }
 
   // The following getters provide access to the graphs in the current batch.
   // The data structures and the format of the data match the format used by the
   // graph_nets.GraphsTuple class that is fed to TensorFlow when processing the
   // batch.
 
-  // TODO(ondrasej): For simplicity, this class produces the data as lists
-  // (which get converted by pybind11 into Python lists), and the conversion to
-  // NumPy arrays required by TensorFlow must be done from Python. If this
-  // proves to be slowing down the computation, we could create optimize this by
-  // creating NumPy arrays directly from the C++ code.
+  // The Python wrapper returns copies of the vectors returned by these getters
+  // as NumPy arrays, because the vectors may be reallocated by the next call
+  // that modifies the batch. ReleaseBatch() moves the vectors to the caller
+  // without a copy.
 
   // The number of nodes for each basic block in the batch. Corresponds to
   // `GraphsTuple.n_node`.
@@ -249,22 +540,57 @@ class BasicBlockGraphBuilder {
   // i-th edge in the graph.
   const std::vector<EdgeType>& edge_types() const { return edge_types_; }
 
-  // Returns the matrix of global features of the graphs in the batch. This is a
-  // 2D matrix of shape (num_nodes(), num_node_tokens()), in the row-major
-  // format. Corresponds to `GraphsTuple.globals`.
-  const std::vector<std::vector<int>>& global_features() const {
-    return global_features_;
+  // The global features of the graphs in the batch in a sparse format. The
+  // global feature vector of each graph is the histogram of the tokens of the
+  // nodes of the graph. Instead of storing the full histogram for each graph,
+  // the graph builder stores only the tokens that appear in the graph, using
+  // a format similar to the compressed sparse row format:
+  //  - num_global_feature_tokens_per_block()[i] is the number of distinct
+  //    tokens that appear in the i-th graph of the batch,
+  //  - global_feature_token_indices() contains the indices of these tokens,
+  //    sorted in increasing order for each graph,
+  //  - global_feature_token_counts()[j] is the number of nodes in the graph
+  //    that use the token global_feature_token_indices()[j].
+  // The entries for the i-th graph start at the position equal to the sum of
+  // the first i values of num_global_feature_tokens_per_block(). Unlike the
+  // dense representation, the size of the sparse representation is bounded by
+  // the number of nodes in the batch and does not depend on the size of the
+  // vocabulary.
+  const std::vector<int>& num_global_feature_tokens_per_block() const {
+    return num_global_feature_tokens_per_block_;
+  }
+  const std::vector<TokenIndex>& global_feature_token_indices() const {
+    return global_feature_token_indices_;
+  }
+  const std::vector<int>& global_feature_token_counts() const {
+    return global_feature_token_counts_;
   }
 
-  // Returns a vector of node features. The feature of each node is the index of
-  // the edge type (i.e. the numerical constant associated with the given value
-  // of EdgeType). Corresponds to `GraphsTuple.edges`.
-  std::vector<int> EdgeFeatures() const;
-
-  // Returns a vector of boolean values of size `num_nodes()`.
-  // InstructionNodeMask()[i] is true if and only if node_types()[i] is
-  // NodeType::kInstruction. This vector is used by the models to extract nodes
-  // corresponding to instructions in the basic block.
+  // Returns the matrix of global features of the graphs in the batch. This is a
+  // 2D matrix of shape (num_graphs(), num_node_tokens()), in the row-major
+  // format. Corresponds to `GraphsTuple.globals`. The matrix is computed from
+  // the sparse representation of the global features on each call; prefer
+  // using the sparse representation when the vocabulary is large.
+  std::vector<std::vector<int>> GlobalFeatures() const;
+
+  // The features of the edges in the graph. The feature of each edge is the
+  // index of the edge type (i.e. the numerical constant associated with the
+  // given value of EdgeType). Corresponds to `GraphsTuple.edges`. The vector is
+  // maintained incrementally as basic blocks are added to the batch.
+  const std::vector<int>& edge_features() const { return edge_features_; }
+  // Returns a copy of edge_features().
+  std::vector<int> EdgeFeatures() const { return edge_features_; }
+
+  // A byte array of size `num_nodes()`. instruction_node_mask()[i] is 1 if and
+  // only if node_types()[i] is NodeType::kInstruction, and 0 otherwise. This
+  // vector is used by the models to extract nodes corresponding to
+  // instructions in the basic block. Unlike std::vector<bool>, the elements of
+  // the vector are stored one per byte, so that it can be shared with
+  // NumPy/TensorFlow as a boolean array without conversion.
+  const std::vector<uint8_t>& instruction_node_mask() const {
+    return instruction_node_mask_;
+  }
+  // Returns instruction_node_mask() as a vector of bool values.
   std::vector<bool> InstructionNodeMask() const;
 
   // Returns the delta block tensor. This is a 1D tensor of num_instructions
@@ -274,11 +600,29 @@ class BasicBlockGraphBuilder {
   // For example, when the current batch contains three basic blocks with 2, 4,
   // and 1 instruction, the return value is {0, 0, 1, 1, 1, 1, 2}.
   // The return value can be used as a value of
-  // model_base.ModelBase._delta_block_index_tensor.
-  std::vector<int> DeltaBlockIndex() const;
-
-  // TODO(ondrasej): Consider adding methods that directly create NumPy arrays
-  // from the data in this class to avoid the extra conversion.
+  // model_base.ModelBase._delta_block_index_tensor. The vector is maintained
+  // incrementally as basic blocks are added to the batch.
+  const std::vector<int>& delta_block_index() const {
+    return delta_block_index_;
+  }
+  // Returns a copy of delta_block_index().
+  std::vector<int> DeltaBlockIndex() const { return delta_block_index_; }
+
+  // The token sequences of the instructions in the batch, in a format similar
+  // to the compressed sparse row format. The tokens of the i-th instruction in
+  // the batch are instruction_token_indices()[j] for j in the range
+  // [instruction_token_offsets()[i], instruction_token_offsets()[i + 1]).
+  // The i-th instruction corresponds to the i-th instruction node in the batch
+  // (see instruction_node_mask()) and belongs to the basic block
+  // delta_block_index()[i]. instruction_token_offsets() has one more element
+  // than the number of instructions; its first element is always zero. Both
+  // vectors contain no instructions when collect_instruction_tokens() is false.
+  const std::vector<TokenIndex>& instruction_token_indices() const {
+    return instruction_token_indices_;
+  }
+  const std::vector<int>& instruction_token_offsets() const {
+    return instruction_token_offsets_;
+  }
 
   // Methods for accessing the indices of the special tokens in the graph
   // builder. When they return a non-negative value, this value is the index of
@@ -295,6 +639,16 @@ class BasicBlockGraphBuilder {
   std::string DebugString() const;
 
  private:
+  // A tag type for the constructor that copies only the configuration of a
+  // graph builder.
+  struct EmptyBatchTag {};
+
+  // Creates a graph builder that has the same node token vocabulary,
+  // special tokens and out-of-vocabulary behavior as `other`, but whose batch
+  // is empty.
+  BasicBlockGraphBuilderImpl(const BasicBlockGraphBuilderImpl& other,
+                             EmptyBatchTag);
+
   // Keeps track of the state of the basic block graph builder, and allows
   // reverting it to a state before adding a basic block to the current batch.
   // The class is intended to be used as an RAII object - it is created at the
@@ -307,7 +661,8 @@ class BasicBlockGraphBuilder {
     // Initializes the transaction object. Takes a snapshot of the sizes of the
     // vectors in the basic block graph builder at the moment the constructor is
     // called.
-    explicit AddBasicBlockTransaction(BasicBlockGraphBuilder* graph_builder);
+    explicit AddBasicBlockTransaction(
+        BasicBlockGraphBuilderImpl* graph_builder);
     // Reverts the state of the basic block graph builder when Commit() was not
     // called.
     ~AddBasicBlockTransaction();
@@ -324,7 +679,7 @@ class BasicBlockGraphBuilder {
     void Rollback();
 
     // The basic block graph builder managed by the transaction.
-    BasicBlockGraphBuilder& graph_builder_;
+    BasicBlockGraphBuilderImpl& graph_builder_;
     // True when Commit() was called; otherwise, false.
     bool is_committed_ = false;
 
@@ -337,9 +692,41 @@ class BasicBlockGraphBuilder {
     size_t prev_edge_senders_size_;
     size_t prev_edge_receivers_size_;
     size_t prev_edge_types_size_;
-    size_t prev_global_features_size_;
+    size_t prev_edge_features_size_;
+    size_t prev_instruction_node_mask_size_;
+    size_t prev_delta_block_index_size_;
+    size_t prev_num_global_feature_tokens_per_block_size_;
+    size_t prev_global_feature_token_indices_size_;
+    size_t prev_global_feature_token_counts_size_;
+    size_t prev_instruction_token_indices_size_;
+    size_t prev_instruction_token_offsets_size_;
   };
 
+  // Reserves space in the arrays of the builder for `num_blocks` more basic
+  // blocks with `num_instructions` instructions, `num_nodes` nodes and
+  // `num_edges` edges in total.
+  void Reserve(int num_blocks, int num_instructions, int num_nodes,
+               int num_edges);
+
+  // The previous values of the entries of the per-block state modified by
+  // AppendInstructionsToLastBasicBlock(), in the order of the modifications.
+  // Entries that did not exist before the call are recorded with kInvalidNode.
+  // `used_register_units_` only grows, so only its size is recorded.
+  struct UndoLog {
+    std::vector<std::pair<TokenId, NodeIndex>> register_nodes;
+    std::vector<std::pair<int, NodeIndex>> alias_group_nodes;
+    std::vector<std::pair<int, NodeIndex>> register_unit_nodes;
+    size_t num_used_register_units = 0;
+  };
+
+  // Restores the per-block state from `undo_log`.
+  void RollBack(const UndoLog& undo_log);
+
+  // Adds nodes and edges for a single instruction, and updates
+  // `previous_instruction_node` to the node of the instruction.
+  bool AddInstruction(const Instruction& instruction,
+                      NodeIndex& previous_instruction_node);
+
   // Adds nodes and edges for a single input operand of an instruction.
   bool AddInputOperand(NodeIndex instruction_node,
                        const InstructionOperand& operand);
@@ -347,11 +734,71 @@ class BasicBlockGraphBuilder {
   bool AddOutputOperand(NodeIndex instruction_node,
                         const InstructionOperand& operand);
 
+  // Versions of AddInputOperand() and AddOutputOperand() for operands of a
+  // packed basic block.
+  bool AddInputOperand(NodeIndex instruction_node,
+                       const PackedBasicBlock& block,
+                       const PackedOperand& operand);
+  bool AddOutputOperand(NodeIndex instruction_node,
+                        const PackedOperand& operand);
+
+  // Returns true when `token` is in the vocabulary of node tokens.
+  bool IsKnownNodeToken(absl::string_view token) const {
+    return node_tokens_->Find(token) != TokenVocabulary::kInvalidTokenIndex;
+  }
+  bool IsKnownNodeToken(TokenId token_id) const {
+    return node_tokens_->Find(token_id) != TokenVocabulary::kInvalidTokenIndex;
+  }
+  // Checks the tokens of a single operand for CanAddBasicBlock().
+  bool CanAddOperand(const InstructionOperand& operand) const;
+
   // Adds dependency of a node (instruction or an address computation node) on
   // a register. Adds the register node if it doesn't exist in the graph.
-  bool AddDependencyOnRegister(NodeIndex dependent_node,
-                               absl::string_view register_name,
-                               EdgeType edge_type);
+  // Returns the index of the token of the register, or kInvalidTokenIndex when
+  // the register is not in the vocabulary and the node could not be added.
+  TokenIndex AddDependencyOnRegister(NodeIndex dependent_node,
+                                     TokenId register_token,
+                                     EdgeType edge_type);
+  // Records `register_node` as the node of the current value of the register
+  // `register_token`, and of all its register units when there is a register
+  // unit table.
+  void SetRegisterNode(TokenId register_token, NodeIndex register_node);
+  // Clears the nodes of the current values of registers at the beginning of a
+  // basic block.
+  void ClearRegisterNodes();
+
+  // Methods that collect the token sequence of an instruction when
+  // collect_instruction_tokens_ is true; they do nothing otherwise. The tokens
+  // of the input operands are visited before the tokens of the output operands,
+  // but they appear after them in the sequence, so they are kept in a scratch
+  // buffer until the instruction is finished.
+  //
+  // Starts the token sequence of the instruction whose node is
+  // `instruction_node`. The nodes of the prefixes of the instruction must be
+  // the last nodes in the batch.
+  void StartInstructionTokens(NodeIndex instruction_node);
+  // Adds a token of an input operand of the current instruction.
+  void AddInputOperandToken(TokenIndex token) {
+    if (collect_instruction_tokens_) input_operand_tokens_.push_back(token);
+  }
+  // Adds a token of an output operand of the current instruction.
+  void AddOutputOperandToken(TokenIndex token) {
+    if (collect_instruction_tokens_) {
+      instruction_token_indices_.push_back(token);
+    }
+  }
+  // Adds the tokens of the input operands and finishes the token sequence of
+  // the current instruction.
+  void FinishInstructionTokens();
+
+  // Returns the index of `token` in the vocabulary of node tokens. When the
+  // token is not in the vocabulary, counts it as an out-of-vocabulary token,
+  // and returns the replacement token or kInvalidTokenIndex depending on the
+  // out-of-vocabulary behavior.
+  TokenIndex FindNodeToken(absl::string_view token);
+  // A version of FindNodeToken() where the token is given by its ID in the
+  // global token table.
+  TokenIndex FindNodeToken(TokenId token_id);
 
   // Adds a new node to the batch; the feature of the node is given directly by
   // the caller.
@@ -360,12 +807,25 @@ class BasicBlockGraphBuilder {
   // the token associated with the node. Returns kInvalidNode when the node was
   // not added.
   NodeIndex AddNode(NodeType node_type, absl::string_view token);
+  // A version of AddNode() where the token is given by its ID in the global
+  // token table. The vocabulary is looked up directly by the ID, without
+  // hashing the token.
+  NodeIndex AddNodeForTokenId(NodeType node_type, TokenId token_id);
   // Adds a new edge to the batch.
   void AddEdge(EdgeType edge_type, NodeIndex sender, NodeIndex receiver);
+  // Adds the sparse global features of the graph formed by the nodes starting
+  // at `first_node` and ending at the last node in the batch.
+  void AddGlobalFeatures(NodeIndex first_node);
+  // Adds the tokens of the nodes starting at `first_new_node` to the sparse
+  // global features of the last graph in the batch. The cost is O(k log n) for
+  // k new nodes when the tokens are already used by the graph; adding a token
+  // that the graph did not use is linear in the number n of distinct tokens of
+  // the graph.
+  void UpdateGlobalFeaturesOfLastBlock(NodeIndex first_new_node);
 
   // Mapping from string node tokens to indices of embedding vectors used in
   // the models.
-  const absl::flat_hash_map<std::string, TokenIndex> node_tokens_;
+  const std::shared_ptr<const TokenVocabulary> node_tokens_;
   // Tokens corresponding to nodes in the batch that are not associated directly
   // with a token of the assembly language.
   const TokenIndex immediate_token_;
@@ -386,12 +846,80 @@ class BasicBlockGraphBuilder {
   std::vector<NodeIndex> edge_receivers_;
   std::vector<EdgeType> edge_types_;
 
-  std::vector<std::vector<int>> global_features_;
-
-  absl::flat_hash_map<absl::string_view, NodeIndex> register_nodes_;
+  // Derived arrays that are maintained incrementally together with the arrays
+  // above, so that they do not need to be recomputed for each batch. See the
+  // comments on the corresponding accessors for their contents.
+  std::vector<int> edge_features_;
+  std::vector<uint8_t> instruction_node_mask_;
+  std::vector<int> delta_block_index_;
+
+  std::vector<int> num_global_feature_tokens_per_block_;
+  std::vector<TokenIndex> global_feature_token_indices_;
+  std::vector<int> global_feature_token_counts_;
+
+  // The token sequences of the instructions, and the indices of the structural
+  // tokens used in them. The token indices are valid only when
+  // collect_instruction_tokens_ is true.
+  bool collect_instruction_tokens_ = false;
+  TokenIndex sequence_delimiter_token_ = TokenVocabulary::kInvalidTokenIndex;
+  TokenIndex sequence_immediate_token_ = TokenVocabulary::kInvalidTokenIndex;
+  TokenIndex sequence_address_token_ = TokenVocabulary::kInvalidTokenIndex;
+  TokenIndex sequence_memory_token_ = TokenVocabulary::kInvalidTokenIndex;
+  TokenIndex sequence_no_register_token_ = TokenVocabulary::kInvalidTokenIndex;
+  TokenIndex sequence_displacement_token_ =
+      TokenVocabulary::kInvalidTokenIndex;
+  std::vector<TokenIndex> instruction_token_indices_;
+  std::vector<int> instruction_token_offsets_ = {0};
+  // The tokens of the input operands of the instruction being added.
+  std::vector<TokenIndex> input_operand_tokens_;
+
+  std::shared_ptr<const RegisterUnitTable> register_unit_table_;
+
+  // The state of the last basic block in the batch: the nodes of the current
+  // values of registers and memory alias groups, and the node of the last
+  // instruction. Used when adding instructions to the block.
+  absl::flat_hash_map<TokenId, NodeIndex> register_nodes_;
   absl::flat_hash_map<int, NodeIndex> alias_group_nodes_;
+  // Used instead of `register_nodes_` for registers in the register unit
+  // table: the node of the current value of each register unit, indexed by
+  // the unit, and the units that have a node, so that they can be cleared
+  // without touching the whole array.
+  std::vector<NodeIndex> register_unit_nodes_;
+  std::vector<int> used_register_units_;
+  // The token indices of the registers in the register unit table that were
+  // resolved in the current block. The entries do not depend on the state of
+  // the block, so they are not recorded in the undo log.
+  absl::flat_hash_map<TokenId, TokenIndex> register_token_indices_;
+  // The undo log of the running AppendInstructionsToLastBasicBlock() call, or
+  // nullptr when the changes of the per-block state are not recorded.
+  UndoLog* undo_log_ = nullptr;
+  NodeIndex last_instruction_node_ = -1;
+  // The index of the basic block to which new nodes are added.
+  int current_block_index_ = 0;
+  // True when the state above describes the last basic block in the batch.
+  bool last_basic_block_is_extendable_ = false;
+
+  absl::flat_hash_map<std::string, int64_t> out_of_vocabulary_token_counts_;
+  bool log_out_of_vocabulary_tokens_ = true;
+
+  // Scratch buffers reused across calls to AddBasicBlockFromProto() and
+  // AddBasicBlocksFromSerializedProtos(), to avoid reallocating them for each
+  // basic block.
+  PackedBasicBlock packed_block_buffer_;
+  BasicBlockProto proto_buffer_;
 };
 
+extern template class BasicBlockGraphBuilderImpl<GraniteGraphPolicy>;
+extern template class BasicBlockGraphBuilderImpl<UncheckedGraniteGraphPolicy>;
+extern template class BasicBlockGraphBuilderImpl<CompactGraniteGraphPolicy>;
+
+// The graph builder used by the Granite models and exposed to Python.
+using BasicBlockGraphBuilder = BasicBlockGraphBuilderImpl<GraniteGraphPolicy>;
+using UncheckedBasicBlockGraphBuilder =
+    BasicBlockGraphBuilderImpl<UncheckedGraniteGraphPolicy>;
+using CompactBasicBlockGraphBuilder =
+    BasicBlockGraphBuilderImpl<CompactGraniteGraphPolicy>;
+
 }  // namespace gematria
 
 #endif  // GEMATRIA_GRANITE_GRAPH_BUILDER_H_
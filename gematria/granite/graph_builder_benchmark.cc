@@ -0,0 +1,270 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Microbenchmarks for BasicBlockGraphBuilder. The benchmarks report the number
+// of basic blocks per second as "items_per_second", and the number of
+// instructions per second as "instructions".
+//
+// Run with:
+//   bazel run -c opt //gematria/granite:graph_builder_benchmark
+
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "benchmark/benchmark.h"
+#include "gematria/basic_block/basic_block.h"
+#include "gematria/basic_block/basic_block_protos.h"
+#include "gematria/granite/graph_builder.h"
+#include "gematria/model/oov_token_behavior.h"
+#include "gematria/model/token_vocabulary.h"
+#include "gematria/proto/basic_block.pb.h"
+#include "gematria/proto/throughput.pb.h"
+#include "gematria/testing/basic_blocks.h"
+
+namespace gematria {
+namespace {
+
+constexpr absl::string_view kFpImmediateToken = "_FP_IMMEDIATE_";
+constexpr absl::string_view kUnknownToken = "_UNKNOWN_";
+
+// The sizes of the synthetic basic blocks. They cover the typical size of a
+// basic block in BHive, and the long tail of large blocks.
+constexpr int kSyntheticBlockSizes[] = {16, 64, 256};
+// The number of synthetic basic blocks added to the graph builder in one
+// batch.
+constexpr int kSyntheticBatchSize = 100;
+
+// The path of the benchmark binary; set by main().
+const char* argv0 = nullptr;
+
+// The basic blocks and the vocabulary used by the benchmarks. The test data
+// are loaded on first use, so that they are not loaded when the benchmarks are
+// only listed.
+struct BenchmarkData {
+  std::vector<BasicBlock> test_blocks;
+  std::vector<BasicBlockProto> synthetic_protos;
+  std::vector<BasicBlock> synthetic_blocks;
+  std::shared_ptr<const TokenVocabulary> vocabulary;
+};
+
+const BenchmarkData& GetBenchmarkData() {
+  static const BenchmarkData* const data = [] {
+    auto* data = new BenchmarkData();
+    const BasicBlockWithThroughputListProto test_protos =
+        LoadBasicBlocksWithThroughputFromTestData(argv0);
+    for (const BasicBlockWithThroughputProto& proto :
+         test_protos.basic_blocks()) {
+      data->test_blocks.push_back(BasicBlockFromProto(proto.basic_block()));
+    }
+    for (const int num_instructions : kSyntheticBlockSizes) {
+      data->synthetic_protos.push_back(
+          SyntheticBasicBlockProto(num_instructions));
+      data->synthetic_blocks.push_back(
+          BasicBlockFromProto(data->synthetic_protos.back()));
+    }
+
+    std::set<std::string> tokens = {
+        std::string(kImmediateToken), std::string(kFpImmediateToken),
+        std::string(kAddressToken), std::string(kMemoryToken),
+        std::string(kUnknownToken)};
+    for (const auto* blocks : {&data->test_blocks, &data->synthetic_blocks}) {
+      for (const BasicBlock& block : *blocks) {
+        for (const Instruction& instruction : block.instructions) {
+          for (std::string& token : instruction.AsTokenList()) {
+            tokens.insert(std::move(token));
+          }
+        }
+      }
+    }
+    data->vocabulary = std::make_shared<const TokenVocabulary>(
+        std::vector<std::string>(tokens.begin(), tokens.end()));
+    return data;
+  }();
+  return *data;
+}
+
+template <typename Policy = GraniteGraphPolicy>
+BasicBlockGraphBuilderImpl<Policy> MakeGraphBuilder(const BenchmarkData& data) {
+  return BasicBlockGraphBuilderImpl<Policy>(
+      data.vocabulary, kImmediateToken, kFpImmediateToken, kAddressToken,
+      kMemoryToken, OutOfVocabularyTokenBehavior::ReplaceWithToken(
+                        std::string(kUnknownToken)));
+}
+
+// Returns the index of the synthetic block with `num_instructions`
+// instructions.
+int SyntheticBlockIndex(int num_instructions) {
+  for (int i = 0; i < std::size(kSyntheticBlockSizes); ++i) {
+    if (kSyntheticBlockSizes[i] == num_instructions) return i;
+  }
+  return -1;
+}
+
+void SetCounters(benchmark::State& state, int64_t num_blocks,
+                 int64_t num_instructions) {
+  state.SetItemsProcessed(num_blocks);
+  state.counters["instructions"] =
+      benchmark::Counter(num_instructions, benchmark::Counter::kIsRate);
+}
+
+// Adds a batch of `state.range(0)` basic blocks from the test data to the graph
+// builder. The blocks are reused cyclically when the batch is larger than the
+// test data.
+void BM_AddBasicBlock_TestData(benchmark::State& state) {
+  const BenchmarkData& data = GetBenchmarkData();
+  const int batch_size = state.range(0);
+  BasicBlockGraphBuilder builder = MakeGraphBuilder(data);
+  int64_t num_blocks = 0;
+  int64_t num_instructions = 0;
+  for (auto _ : state) {
+    builder.Reset();
+    for (int i = 0; i < batch_size; ++i) {
+      const BasicBlock& block = data.test_blocks[i % data.test_blocks.size()];
+      benchmark::DoNotOptimize(builder.AddBasicBlock(block));
+      num_instructions += block.instructions.size();
+    }
+    num_blocks += batch_size;
+  }
+  SetCounters(state, num_blocks, num_instructions);
+}
+BENCHMARK(BM_AddBasicBlock_TestData)->Arg(100)->Arg(1000)->Arg(10000);
+
+// Adds a batch of `state.range(0)` basic blocks from the test data to the graph
+// builder with a single call to AddBasicBlocks().
+void BM_AddBasicBlocks_TestData(benchmark::State& state) {
+  const BenchmarkData& data = GetBenchmarkData();
+  const int batch_size = state.range(0);
+  std::vector<const BasicBlock*> batch;
+  int64_t instructions_per_batch = 0;
+  for (int i = 0; i < batch_size; ++i) {
+    batch.push_back(&data.test_blocks[i % data.test_blocks.size()]);
+    instructions_per_batch += batch.back()->instructions.size();
+  }
+  BasicBlockGraphBuilder builder = MakeGraphBuilder(data);
+  for (auto _ : state) {
+    builder.Reset();
+    benchmark::DoNotOptimize(builder.AddBasicBlocks(batch));
+  }
+  SetCounters(state, state.iterations() * batch_size,
+              state.iterations() * instructions_per_batch);
+}
+BENCHMARK(BM_AddBasicBlocks_TestData)->Arg(100)->Arg(1000)->Arg(10000);
+
+// Adds a batch of synthetic basic blocks with `state.range(0)` instructions to
+// a graph builder with the given policy.
+template <typename Policy>
+void BM_AddBasicBlock_Synthetic(benchmark::State& state) {
+  const BenchmarkData& data = GetBenchmarkData();
+  const int num_instructions = state.range(0);
+  const BasicBlock& block =
+      data.synthetic_blocks[SyntheticBlockIndex(num_instructions)];
+  BasicBlockGraphBuilderImpl<Policy> builder = MakeGraphBuilder<Policy>(data);
+  for (auto _ : state) {
+    builder.Reset();
+    for (int i = 0; i < kSyntheticBatchSize; ++i) {
+      benchmark::DoNotOptimize(builder.AddBasicBlock(block));
+    }
+  }
+  SetCounters(state, state.iterations() * kSyntheticBatchSize,
+              state.iterations() * kSyntheticBatchSize * num_instructions);
+}
+BENCHMARK_TEMPLATE(BM_AddBasicBlock_Synthetic, GraniteGraphPolicy)
+    ->Arg(16)
+    ->Arg(64)
+    ->Arg(256);
+BENCHMARK_TEMPLATE(BM_AddBasicBlock_Synthetic, UncheckedGraniteGraphPolicy)
+    ->Arg(16)
+    ->Arg(64)
+    ->Arg(256);
+BENCHMARK_TEMPLATE(BM_AddBasicBlock_Synthetic, CompactGraniteGraphPolicy)
+    ->Arg(16)
+    ->Arg(64)
+    ->Arg(256);
+
+// Adds a batch of synthetic basic blocks with `state.range(0)` instructions to
+// a graph builder with the given policy directly from the proto.
+template <typename Policy>
+void BM_AddBasicBlockFromProto_Synthetic(benchmark::State& state) {
+  const BenchmarkData& data = GetBenchmarkData();
+  const int num_instructions = state.range(0);
+  const BasicBlockProto& proto =
+      data.synthetic_protos[SyntheticBlockIndex(num_instructions)];
+  BasicBlockGraphBuilderImpl<Policy> builder = MakeGraphBuilder<Policy>(data);
+  for (auto _ : state) {
+    builder.Reset();
+    for (int i = 0; i < kSyntheticBatchSize; ++i) {
+      benchmark::DoNotOptimize(builder.AddBasicBlockFromProto(proto));
+    }
+  }
+  SetCounters(state, state.iterations() * kSyntheticBatchSize,
+              state.iterations() * kSyntheticBatchSize * num_instructions);
+}
+BENCHMARK_TEMPLATE(BM_AddBasicBlockFromProto_Synthetic, GraniteGraphPolicy)
+    ->Arg(16)
+    ->Arg(64)
+    ->Arg(256);
+BENCHMARK_TEMPLATE(BM_AddBasicBlockFromProto_Synthetic,
+                   UncheckedGraniteGraphPolicy)
+    ->Arg(16)
+    ->Arg(64)
+    ->Arg(256);
+BENCHMARK_TEMPLATE(BM_AddBasicBlockFromProto_Synthetic,
+                   CompactGraniteGraphPolicy)
+    ->Arg(16)
+    ->Arg(64)
+    ->Arg(256);
+
+// Adds a batch of 10000 synthetic basic blocks with 64 instructions to the
+// graph builder using `state.range(0)` threads.
+void BM_AddBasicBlocksInParallel_Synthetic(benchmark::State& state) {
+  constexpr int kBatchSize = 10000;
+  constexpr int kNumInstructions = 64;
+  const BenchmarkData& data = GetBenchmarkData();
+  const int num_threads = state.range(0);
+  const BasicBlock* const block =
+      &data.synthetic_blocks[SyntheticBlockIndex(kNumInstructions)];
+  const std::vector<const BasicBlock*> batch(kBatchSize, block);
+  BasicBlockGraphBuilder builder = MakeGraphBuilder(data);
+  for (auto _ : state) {
+    builder.Reset();
+    benchmark::DoNotOptimize(
+        builder.AddBasicBlocksInParallel(batch, num_threads));
+  }
+  SetCounters(state, state.iterations() * kBatchSize,
+              state.iterations() * kBatchSize * kNumInstructions);
+}
+BENCHMARK(BM_AddBasicBlocksInParallel_Synthetic)
+    ->Arg(1)
+    ->Arg(2)
+    ->Arg(4)
+    ->Arg(8)
+    ->UseRealTime();
+
+}  // namespace
+}  // namespace gematria
+
+int main(int argc, char* argv[]) {
+  gematria::argv0 = argv[0];
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
@@ -15,18 +15,26 @@
 #include "gematria/granite/graph_builder.h"
 
 #include <algorithm>
+#include <cstdint>
 #include <iterator>
 #include <memory>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
 #include "gematria/basic_block/basic_block.h"
 #include "gematria/basic_block/basic_block_protos.h"
+#include "gematria/basic_block/lazy_basic_block.h"
+#include "gematria/basic_block/packed_basic_block.h"
+#include "gematria/basic_block/register_unit_table.h"
+#include "gematria/model/basic_block_tokenizer.h"
 #include "gematria/model/oov_token_behavior.h"
+#include "gematria/model/token_vocabulary.h"
 #include "gematria/proto/basic_block.pb.h"
 #include "gematria/testing/parse_proto.h"
+#include "gematria/utils/thread_pool.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 
@@ -34,7 +42,10 @@ namespace gematria {
 namespace {
 
 using ::testing::ElementsAre;
+using ::testing::ElementsAreArray;
 using ::testing::IsEmpty;
+using ::testing::Pair;
+using ::testing::UnorderedElementsAre;
 
 // Tokens used in the basic blocks in tests. For simplicity, we do not use the
 // full set of x86-64 tokens.
@@ -108,8 +119,13 @@ TEST_F(BasicBlockGraphBuilderTest, SingleInstruction) {
                           EdgeType::kInputOperands, EdgeType::kOutputOperands));
 
   EXPECT_THAT(
-      builder_->global_features(),
+      builder_->GlobalFeatures(),
       ElementsAre(ElementsAre(1, 0, 1, 0, 1, 0, 0, 0, 0, 0, 1, 0, 1, 0, 0, 0)));
+  EXPECT_THAT(builder_->num_global_feature_tokens_per_block(), ElementsAre(5));
+  EXPECT_THAT(builder_->global_feature_token_indices(),
+              ElementsAre(0, 2, 4, 10, 12));
+  EXPECT_THAT(builder_->global_feature_token_counts(),
+              ElementsAre(1, 1, 1, 1, 1));
 }
 
 TEST_F(BasicBlockGraphBuilderTest, SingleInstructionWithPrefix) {
@@ -150,7 +166,7 @@ TEST_F(BasicBlockGraphBuilderTest, SingleInstructionWithPrefix) {
                   EdgeType::kOutputOperands));
 
   EXPECT_THAT(
-      builder_->global_features(),
+      builder_->GlobalFeatures(),
       ElementsAre(ElementsAre(0, 0, 1, 2, 0, 0, 1, 0, 1, 0, 0, 0, 0, 0, 0, 1)));
 }
 
@@ -194,7 +210,7 @@ TEST_F(BasicBlockGraphBuilderTest, InvalidRegister_ReturnError) {
   EXPECT_THAT(builder_->edge_types(), IsEmpty());
   EXPECT_THAT(builder_->edge_senders(), IsEmpty());
   EXPECT_THAT(builder_->edge_receivers(), IsEmpty());
-  EXPECT_THAT(builder_->global_features(), IsEmpty());
+  EXPECT_THAT(builder_->GlobalFeatures(), IsEmpty());
 }
 
 TEST_F(BasicBlockGraphBuilderTest, InvalidAddress_ReturnError) {
@@ -217,7 +233,7 @@ TEST_F(BasicBlockGraphBuilderTest, InvalidAddress_ReturnError) {
   EXPECT_THAT(builder_->edge_types(), IsEmpty());
   EXPECT_THAT(builder_->edge_senders(), IsEmpty());
   EXPECT_THAT(builder_->edge_receivers(), IsEmpty());
-  EXPECT_THAT(builder_->global_features(), IsEmpty());
+  EXPECT_THAT(builder_->GlobalFeatures(), IsEmpty());
 }
 
 TEST_F(BasicBlockGraphBuilderTest, InvalidMnemonic_ReplaceToken) {
@@ -258,7 +274,7 @@ TEST_F(BasicBlockGraphBuilderTest, InvalidMnemonic_ReplaceToken) {
                           EdgeType::kInputOperands, EdgeType::kOutputOperands));
 
   EXPECT_THAT(
-      builder_->global_features(),
+      builder_->GlobalFeatures(),
       ElementsAre(ElementsAre(1, 0, 1, 0, 0, 0, 0, 0, 0, 0, 1, 0, 1, 1, 0, 0)));
 }
 
@@ -300,7 +316,7 @@ TEST_F(BasicBlockGraphBuilderTest, InvalidRegister_ReplaceToken) {
                           EdgeType::kInputOperands, EdgeType::kOutputOperands));
 
   EXPECT_THAT(
-      builder_->global_features(),
+      builder_->GlobalFeatures(),
       ElementsAre(ElementsAre(1, 0, 1, 0, 1, 0, 0, 0, 0, 0, 1, 0, 0, 1, 0, 0)));
 }
 
@@ -346,7 +362,7 @@ TEST_F(BasicBlockGraphBuilderTest, InvalidAddress_ReplaceToken) {
                           EdgeType::kInputOperands, EdgeType::kOutputOperands));
 
   EXPECT_THAT(
-      builder_->global_features(),
+      builder_->GlobalFeatures(),
       ElementsAre(ElementsAre(1, 0, 1, 0, 1, 0, 0, 0, 0, 0, 0, 0, 1, 1, 0, 0)));
 }
 
@@ -495,9 +511,15 @@ TEST_F(BasicBlockGraphBuilderTest, MultipleBasicBlocks) {
   EXPECT_THAT(builder_->edge_receivers(), ElementsAre(0, 2, 3, 5));
 
   EXPECT_THAT(
-      builder_->global_features(),
+      builder_->GlobalFeatures(),
       ElementsAre(ElementsAre(0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 2, 0, 0, 0, 0),
                   ElementsAre(0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 2, 0, 0, 0, 0)));
+  EXPECT_THAT(builder_->num_global_feature_tokens_per_block(),
+              ElementsAre(2, 2));
+  EXPECT_THAT(builder_->global_feature_token_indices(),
+              ElementsAre(6, 11, 6, 11));
+  EXPECT_THAT(builder_->global_feature_token_counts(),
+              ElementsAre(1, 2, 1, 2));
 
   EXPECT_THAT(builder_->DeltaBlockIndex(), ElementsAre(0, 1));
 }
@@ -510,5 +532,1168 @@ TEST_F(BasicBlockGraphBuilderTest, TwoNops) {
   )pb"))));
 }
 
+// Tests that loads are connected to the memory node of the last store in the
+// same alias group, and that stores to other alias groups do not create a
+// dependency.
+TEST_F(BasicBlockGraphBuilderTest, MemoryAliasGroups) {
+  // Returns the index of the memory node read by the last instruction of a
+  // block, and the indices of the memory nodes written by the other
+  // instructions.
+  const auto get_memory_nodes = [this](int second_store_alias_group) {
+    BasicBlockProto block_proto = ParseTextProto(R"pb(
+      canonicalized_instructions: {
+        mnemonic: "MOV"
+        llvm_mnemonic: "MOV64mr"
+        output_operands: { memory: { alias_group_id: 1 } }
+        input_operands: { address: { base_register: "R15" scaling: 1 } }
+        input_operands: { register_name: "RAX" }
+      }
+      canonicalized_instructions: {
+        mnemonic: "MOV"
+        llvm_mnemonic: "MOV64mr"
+        output_operands: { memory: { alias_group_id: 1 } }
+        input_operands: {
+          address: { base_register: "R15" displacement: 8 scaling: 1 }
+        }
+        input_operands: { register_name: "RBX" }
+      }
+      canonicalized_instructions: {
+        mnemonic: "MOV"
+        llvm_mnemonic: "MOV64rm"
+        output_operands: { register_name: "RCX" }
+        input_operands: { memory: { alias_group_id: 1 } }
+        input_operands: { address: { base_register: "R15" scaling: 1 } }
+      })pb");
+    block_proto.mutable_canonicalized_instructions(1)
+        ->mutable_output_operands(0)
+        ->mutable_memory()
+        ->set_alias_group_id(second_store_alias_group);
+    CreateBuilder(OutOfVocabularyTokenBehavior::ReturnError());
+    EXPECT_TRUE(builder_->AddBasicBlockFromProto(block_proto));
+
+    const std::vector<NodeType>& node_types = builder_->node_types();
+    std::vector<int> instruction_indices(node_types.size(), -1);
+    int num_instructions = 0;
+    for (int node = 0; node < node_types.size(); ++node) {
+      if (node_types[node] == NodeType::kInstruction) {
+        instruction_indices[node] = num_instructions++;
+      }
+    }
+    std::vector<int> written_nodes(num_instructions, -1);
+    int read_node = -1;
+    for (int edge = 0; edge < builder_->edge_types().size(); ++edge) {
+      const int sender = builder_->edge_senders()[edge];
+      const int receiver = builder_->edge_receivers()[edge];
+      const EdgeType edge_type = builder_->edge_types()[edge];
+      if (edge_type == EdgeType::kOutputOperands &&
+          node_types[receiver] == NodeType::kMemoryOperand) {
+        written_nodes[instruction_indices[sender]] = receiver;
+      }
+      if (edge_type == EdgeType::kInputOperands &&
+          node_types[sender] == NodeType::kMemoryOperand &&
+          instruction_indices[receiver] == 2) {
+        read_node = sender;
+      }
+    }
+    return std::make_pair(read_node, written_nodes);
+  };
+
+  const auto [aliased_read_node, aliased_written_nodes] = get_memory_nodes(1);
+  ASSERT_EQ(aliased_written_nodes.size(), 3);
+  EXPECT_EQ(aliased_read_node, aliased_written_nodes[1]);
+
+  const auto [read_node, written_nodes] = get_memory_nodes(2);
+  ASSERT_EQ(written_nodes.size(), 3);
+  EXPECT_EQ(read_node, written_nodes[0]);
+}
+
+// Tests that adding a packed basic block produces the same graph as adding the
+// same basic block in the BasicBlock format.
+TEST_F(BasicBlockGraphBuilderTest, PackedBasicBlock) {
+  const BasicBlockProto block_proto = ParseTextProto(R"pb(
+    canonicalized_instructions: {
+      mnemonic: "MOV"
+      llvm_mnemonic: "MOV64rm"
+      prefixes: "LOCK"
+      output_operands: { register_name: "R14" }
+      input_operands: { memory: { alias_group_id: 1 } }
+      input_operands: { address: { base_register: "R15" scaling: 1 } }
+    }
+    canonicalized_instructions: {
+      mnemonic: "LEA"
+      llvm_mnemonic: "LEA64r"
+      output_operands: { register_name: "RAX" }
+      input_operands: {
+        address: {
+          base_register: "R14"
+          index_register: "RBX"
+          displacement: 112
+          scaling: 1
+        }
+      }
+    }
+    canonicalized_instructions: {
+      mnemonic: "MOV"
+      llvm_mnemonic: "MOV64mr"
+      output_operands: { memory: { alias_group_id: 1 } }
+      input_operands: { address: { base_register: "RAX" scaling: 1 } }
+      input_operands: { register_name: "RCX" }
+      implicit_input_operands: { register_name: "RDI" }
+      implicit_output_operands: { register_name: "RCX" }
+    })pb");
+
+  CreateBuilder(OutOfVocabularyTokenBehavior::ReturnError());
+  ASSERT_TRUE(builder_->AddBasicBlock(BasicBlockFromProto(block_proto)));
+  BasicBlockGraphBuilder packed_builder(
+      std::vector<std::string>(std::begin(kTokens), std::end(kTokens)),
+      /*immediate_token =*/kImmediateToken,
+      /*fp_immediate_token =*/kFpImmediateToken,
+      /*address_token =*/kAddressToken,
+      /*memory_token =*/kMemoryToken);
+  ASSERT_TRUE(
+      packed_builder.AddBasicBlock(PackedBasicBlockFromProto(block_proto)));
+
+  EXPECT_EQ(packed_builder.num_nodes_per_block(),
+            builder_->num_nodes_per_block());
+  EXPECT_EQ(packed_builder.num_edges_per_block(),
+            builder_->num_edges_per_block());
+  EXPECT_EQ(packed_builder.node_types(), builder_->node_types());
+  EXPECT_EQ(packed_builder.node_features(), builder_->node_features());
+  EXPECT_EQ(packed_builder.edge_senders(), builder_->edge_senders());
+  EXPECT_EQ(packed_builder.edge_receivers(), builder_->edge_receivers());
+  EXPECT_EQ(packed_builder.edge_types(), builder_->edge_types());
+  EXPECT_EQ(packed_builder.global_feature_token_indices(),
+            builder_->global_feature_token_indices());
+  EXPECT_EQ(packed_builder.global_feature_token_counts(),
+            builder_->global_feature_token_counts());
+}
+
+TEST_F(BasicBlockGraphBuilderTest, PackedBasicBlockInvalidRegister) {
+  const BasicBlockProto block_proto = ParseTextProto(R"pb(
+    canonicalized_instructions: {
+      mnemonic: "LEA"
+      llvm_mnemonic: "LEA64r"
+      output_operands: { register_name: "RAX" }
+      input_operands: { address: { base_register: "RSI" scaling: 1 } }
+    })pb");
+
+  CreateBuilder(OutOfVocabularyTokenBehavior::ReturnError());
+  EXPECT_FALSE(builder_->AddBasicBlock(PackedBasicBlockFromProto(block_proto)));
+  EXPECT_EQ(builder_->num_graphs(), 0);
+  EXPECT_EQ(builder_->num_nodes(), 0);
+
+  CreateBuilder(OutOfVocabularyTokenBehavior::ReplaceWithToken(
+      std::string(kUnknownToken)));
+  ASSERT_TRUE(builder_->AddBasicBlock(PackedBasicBlockFromProto(block_proto)));
+  EXPECT_THAT(builder_->node_features(),
+              ElementsAre(TokenIndex("LEA"), TokenIndex(kAddressToken),
+                          TokenIndex(kUnknownToken), TokenIndex("RAX")));
+}
+
+// Returns a list of basic blocks for testing the batched APIs. The second
+// block contains an unknown mnemonic.
+std::vector<BasicBlock> BlocksForBatchTests() {
+  return {BasicBlockFromProto(ParseTextProto(R"pb(
+            canonicalized_instructions: {
+              mnemonic: "MOV"
+              llvm_mnemonic: "MOV64rm"
+              output_operands: { register_name: "R14" }
+              input_operands: { memory: { alias_group_id: 1 } }
+              input_operands: {
+                address: { base_register: "R15" displacement: 8 scaling: 1 }
+              }
+            })pb")),
+          BasicBlockFromProto(ParseTextProto(R"pb(
+            canonicalized_instructions: {
+              mnemonic: "ThisInstructionDoesNotExist"
+              llvm_mnemonic: "MOV64rr"
+            })pb")),
+          BasicBlockFromProto(ParseTextProto(R"pb(
+            canonicalized_instructions { mnemonic: "NOP" llvm_mnemonic: "NOOP" }
+            canonicalized_instructions {
+              mnemonic: "NOT"
+              llvm_mnemonic: "NOT64r"
+              input_operands { register_name: "RCX" }
+              output_operands { register_name: "RCX" }
+            })pb"))};
+}
+
+// Checks that the batches in `actual` and `expected` are the same.
+template <typename Policy>
+void ExpectSameBatch(const BasicBlockGraphBuilderImpl<Policy>& actual,
+                     const BasicBlockGraphBuilder& expected) {
+  EXPECT_EQ(actual.num_nodes_per_block(), expected.num_nodes_per_block());
+  EXPECT_EQ(actual.num_edges_per_block(), expected.num_edges_per_block());
+  EXPECT_EQ(actual.node_types(), expected.node_types());
+  EXPECT_EQ(actual.node_features(), expected.node_features());
+  EXPECT_EQ(actual.edge_senders(), expected.edge_senders());
+  EXPECT_EQ(actual.edge_receivers(), expected.edge_receivers());
+  EXPECT_EQ(actual.edge_types(), expected.edge_types());
+  EXPECT_EQ(actual.edge_features(), expected.edge_features());
+  EXPECT_EQ(actual.instruction_node_mask(), expected.instruction_node_mask());
+  EXPECT_EQ(actual.delta_block_index(), expected.delta_block_index());
+  EXPECT_EQ(actual.num_global_feature_tokens_per_block(),
+            expected.num_global_feature_tokens_per_block());
+  EXPECT_EQ(actual.global_feature_token_indices(),
+            expected.global_feature_token_indices());
+  EXPECT_EQ(actual.global_feature_token_counts(),
+            expected.global_feature_token_counts());
+  EXPECT_EQ(actual.instruction_token_indices(),
+            expected.instruction_token_indices());
+  EXPECT_EQ(actual.instruction_token_offsets(),
+            expected.instruction_token_offsets());
+}
+
+TEST_F(BasicBlockGraphBuilderTest, AddBasicBlocks) {
+  const std::vector<BasicBlock> blocks = BlocksForBatchTests();
+
+  CreateBuilder(OutOfVocabularyTokenBehavior::ReturnError());
+  EXPECT_THAT(builder_->AddBasicBlocks(blocks),
+              ElementsAre(true, false, true));
+  EXPECT_EQ(builder_->num_graphs(), 2);
+
+  BasicBlockGraphBuilder sequential_builder(
+      std::vector<std::string>(std::begin(kTokens), std::end(kTokens)),
+      /*immediate_token =*/kImmediateToken,
+      /*fp_immediate_token =*/kFpImmediateToken,
+      /*address_token =*/kAddressToken,
+      /*memory_token =*/kMemoryToken);
+  for (const BasicBlock& block : blocks) {
+    sequential_builder.AddBasicBlock(block);
+  }
+  ExpectSameBatch(*builder_, sequential_builder);
+}
+
+// Tests that the derived arrays are consistent with the node and edge types
+// also after a basic block that could not be added was rolled back.
+TEST_F(BasicBlockGraphBuilderTest, DerivedArraysAfterRollback) {
+  const std::vector<BasicBlock> blocks = BlocksForBatchTests();
+
+  CreateBuilder(OutOfVocabularyTokenBehavior::ReturnError());
+  EXPECT_THAT(builder_->AddBasicBlocks(blocks),
+              ElementsAre(true, false, true));
+
+  std::vector<int> expected_edge_features;
+  for (const EdgeType edge_type : builder_->edge_types()) {
+    expected_edge_features.push_back(static_cast<int>(edge_type));
+  }
+  std::vector<uint8_t> expected_instruction_node_mask;
+  for (const NodeType node_type : builder_->node_types()) {
+    expected_instruction_node_mask.push_back(node_type ==
+                                             NodeType::kInstruction);
+  }
+  EXPECT_EQ(builder_->edge_features(), expected_edge_features);
+  EXPECT_EQ(builder_->EdgeFeatures(), expected_edge_features);
+  EXPECT_EQ(builder_->instruction_node_mask(), expected_instruction_node_mask);
+  EXPECT_THAT(builder_->delta_block_index(), ElementsAre(0, 1, 1));
+  EXPECT_THAT(builder_->DeltaBlockIndex(), ElementsAre(0, 1, 1));
+
+  builder_->Reset();
+  EXPECT_THAT(builder_->edge_features(), IsEmpty());
+  EXPECT_THAT(builder_->instruction_node_mask(), IsEmpty());
+  EXPECT_THAT(builder_->delta_block_index(), IsEmpty());
+}
+
+TEST_F(BasicBlockGraphBuilderTest, OutOfVocabularyTokenCounts) {
+  const BasicBlock block = BasicBlockFromProto(ParseTextProto(R"pb(
+    canonicalized_instructions: {
+      mnemonic: "ThisInstructionDoesNotExist"
+      llvm_mnemonic: "MOV64rr"
+      output_operands: { register_name: "XMM0" }
+      input_operands: { register_name: "XMM0" }
+      input_operands: { register_name: "RAX" }
+    })pb"));
+
+  CreateBuilder(OutOfVocabularyTokenBehavior::ReturnError());
+  builder_->set_log_out_of_vocabulary_tokens(false);
+  EXPECT_FALSE(builder_->AddBasicBlock(block));
+  EXPECT_FALSE(builder_->AddBasicBlock(block));
+  // The graph builder stops at the first unknown token.
+  EXPECT_THAT(builder_->out_of_vocabulary_token_counts(),
+              UnorderedElementsAre(Pair("ThisInstructionDoesNotExist", 2)));
+
+  CreateBuilder(OutOfVocabularyTokenBehavior::ReplaceWithToken(
+      std::string(kUnknownToken)));
+  EXPECT_TRUE(builder_->log_out_of_vocabulary_tokens());
+  EXPECT_TRUE(builder_->AddBasicBlock(block));
+  EXPECT_TRUE(builder_->AddBasicBlock(block));
+  // The counts are not affected by Reset().
+  builder_->Reset();
+  EXPECT_TRUE(builder_->AddBasicBlock(block));
+  EXPECT_THAT(builder_->out_of_vocabulary_token_counts(),
+              UnorderedElementsAre(Pair("ThisInstructionDoesNotExist", 3),
+                                   Pair("XMM0", 6)));
+
+  builder_->ResetOutOfVocabularyTokenCounts();
+  EXPECT_THAT(builder_->out_of_vocabulary_token_counts(), IsEmpty());
+}
+
+TEST_F(BasicBlockGraphBuilderTest, SharedVocabulary) {
+  const auto vocabulary = std::make_shared<const TokenVocabulary>(
+      std::vector<std::string>(std::begin(kTokens), std::end(kTokens)));
+  BasicBlockGraphBuilder builder(vocabulary,
+                                 /*immediate_token =*/kImmediateToken,
+                                 /*fp_immediate_token =*/kFpImmediateToken,
+                                 /*address_token =*/kAddressToken,
+                                 /*memory_token =*/kMemoryToken);
+  EXPECT_EQ(builder.node_tokens(), vocabulary);
+  EXPECT_EQ(builder.num_node_tokens(), std::size(kTokens));
+
+  const std::vector<BasicBlock> blocks = BlocksForBatchTests();
+  CreateBuilder(OutOfVocabularyTokenBehavior::ReturnError());
+  EXPECT_EQ(builder.AddBasicBlocks(blocks), builder_->AddBasicBlocks(blocks));
+  ExpectSameBatch(builder, *builder_);
+}
+
+TEST_F(BasicBlockGraphBuilderTest, MergeFrom) {
+  const std::vector<BasicBlock> blocks = BlocksForBatchTests();
+
+  CreateBuilder(OutOfVocabularyTokenBehavior::ReturnError());
+  ASSERT_TRUE(builder_->AddBasicBlock(blocks[0]));
+  BasicBlockGraphBuilder other_builder(
+      std::vector<std::string>(std::begin(kTokens), std::end(kTokens)),
+      /*immediate_token =*/kImmediateToken,
+      /*fp_immediate_token =*/kFpImmediateToken,
+      /*address_token =*/kAddressToken,
+      /*memory_token =*/kMemoryToken);
+  ASSERT_TRUE(other_builder.AddBasicBlock(blocks[2]));
+  ASSERT_TRUE(other_builder.AddBasicBlock(blocks[0]));
+  builder_->MergeFrom(other_builder);
+
+  BasicBlockGraphBuilder sequential_builder(
+      std::vector<std::string>(std::begin(kTokens), std::end(kTokens)),
+      /*immediate_token =*/kImmediateToken,
+      /*fp_immediate_token =*/kFpImmediateToken,
+      /*address_token =*/kAddressToken,
+      /*memory_token =*/kMemoryToken);
+  ASSERT_TRUE(sequential_builder.AddBasicBlock(blocks[0]));
+  ASSERT_TRUE(sequential_builder.AddBasicBlock(blocks[2]));
+  ASSERT_TRUE(sequential_builder.AddBasicBlock(blocks[0]));
+
+  EXPECT_EQ(builder_->num_graphs(), 3);
+  ExpectSameBatch(*builder_, sequential_builder);
+}
+
+TEST_F(BasicBlockGraphBuilderTest, AddBasicBlocksInParallel) {
+  const std::vector<BasicBlock> blocks = BlocksForBatchTests();
+  std::vector<const BasicBlock*> block_pointers;
+  std::vector<bool> expected_added;
+  for (int i = 0; i < 100; ++i) {
+    block_pointers.push_back(&blocks[i % blocks.size()]);
+    expected_added.push_back(i % blocks.size() != 1);
+  }
+
+  BasicBlockGraphBuilder sequential_builder(
+      std::vector<std::string>(std::begin(kTokens), std::end(kTokens)),
+      /*immediate_token =*/kImmediateToken,
+      /*fp_immediate_token =*/kFpImmediateToken,
+      /*address_token =*/kAddressToken,
+      /*memory_token =*/kMemoryToken);
+  EXPECT_EQ(sequential_builder.AddBasicBlocks(block_pointers), expected_added);
+
+  for (const int num_threads : {1, 3, 8}) {
+    SCOPED_TRACE(num_threads);
+    CreateBuilder(OutOfVocabularyTokenBehavior::ReturnError());
+    EXPECT_EQ(builder_->AddBasicBlocksInParallel(block_pointers, num_threads),
+              expected_added);
+    ExpectSameBatch(*builder_, sequential_builder);
+    EXPECT_EQ(builder_->out_of_vocabulary_token_counts(),
+              sequential_builder.out_of_vocabulary_token_counts());
+  }
+
+  // The same pool can be used for multiple batches.
+  ThreadPool pool(4);
+  for (int batch = 0; batch < 2; ++batch) {
+    SCOPED_TRACE(batch);
+    CreateBuilder(OutOfVocabularyTokenBehavior::ReturnError());
+    EXPECT_EQ(builder_->AddBasicBlocksInParallel(block_pointers, pool),
+              expected_added);
+    ExpectSameBatch(*builder_, sequential_builder);
+  }
+}
+
+// Tests that adding a basic block directly from the proto produces the same
+// graph as adding the same basic block in the BasicBlock format.
+TEST_F(BasicBlockGraphBuilderTest, AddBasicBlockFromProto) {
+  const BasicBlockProto block_proto = ParseTextProto(R"pb(
+    canonicalized_instructions: {
+      mnemonic: "MOV"
+      llvm_mnemonic: "MOV64rm"
+      output_operands: { register_name: "R14" }
+      input_operands: { memory: { alias_group_id: 1 } }
+      input_operands: { address: { base_register: "R15" scaling: 1 } }
+    }
+    canonicalized_instructions: {
+      mnemonic: "MOV"
+      llvm_mnemonic: "MOV64mr"
+      output_operands: { memory: { alias_group_id: 1 } }
+      input_operands: { address: { base_register: "RAX" scaling: 1 } }
+      input_operands: { register_name: "R14" }
+    })pb");
+
+  CreateBuilder(OutOfVocabularyTokenBehavior::ReturnError());
+  ASSERT_TRUE(builder_->AddBasicBlock(BasicBlockFromProto(block_proto)));
+  BasicBlockGraphBuilder proto_builder(
+      std::vector<std::string>(std::begin(kTokens), std::end(kTokens)),
+      /*immediate_token =*/kImmediateToken,
+      /*fp_immediate_token =*/kFpImmediateToken,
+      /*address_token =*/kAddressToken,
+      /*memory_token =*/kMemoryToken);
+  ASSERT_TRUE(proto_builder.AddBasicBlockFromProto(block_proto));
+
+  EXPECT_EQ(proto_builder.num_nodes_per_block(),
+            builder_->num_nodes_per_block());
+  EXPECT_EQ(proto_builder.num_edges_per_block(),
+            builder_->num_edges_per_block());
+  EXPECT_EQ(proto_builder.node_types(), builder_->node_types());
+  EXPECT_EQ(proto_builder.node_features(), builder_->node_features());
+  EXPECT_EQ(proto_builder.edge_senders(), builder_->edge_senders());
+  EXPECT_EQ(proto_builder.edge_receivers(), builder_->edge_receivers());
+  EXPECT_EQ(proto_builder.edge_types(), builder_->edge_types());
+}
+
+TEST_F(BasicBlockGraphBuilderTest, AddBasicBlocksFromSerializedProtos) {
+  const BasicBlockProto valid_proto = ParseTextProto(R"pb(
+    canonicalized_instructions: {
+      mnemonic: "MOV"
+      llvm_mnemonic: "MOV64rr"
+      output_operands: { register_name: "RAX" }
+      input_operands: { register_name: "RBX" }
+    })pb");
+  const BasicBlockProto invalid_token_proto = ParseTextProto(R"pb(
+    canonicalized_instructions: {
+      mnemonic: "ThisInstructionDoesNotExist"
+      llvm_mnemonic: "MOV64rr"
+    })pb");
+  const std::string valid = valid_proto.SerializeAsString();
+  const std::string invalid_token = invalid_token_proto.SerializeAsString();
+  const std::string not_a_proto = "\xff\xff\xff";
+  const std::vector<absl::string_view> serialized_protos = {
+      valid, invalid_token, not_a_proto, valid};
+
+  CreateBuilder(OutOfVocabularyTokenBehavior::ReturnError());
+  EXPECT_THAT(builder_->AddBasicBlocksFromSerializedProtos(serialized_protos),
+              ElementsAre(true, false, false, true));
+  EXPECT_EQ(builder_->num_graphs(), 2);
+  EXPECT_THAT(builder_->num_nodes_per_block(), ElementsAre(3, 3));
+  EXPECT_THAT(builder_->node_features(),
+              ElementsAre(TokenIndex("MOV"), TokenIndex("RBX"),
+                          TokenIndex("RAX"), TokenIndex("MOV"),
+                          TokenIndex("RBX"), TokenIndex("RAX")));
+}
+
+TEST_F(BasicBlockGraphBuilderTest, LazyBasicBlock) {
+  const BasicBlockProto block_proto = ParseTextProto(R"pb(
+    canonicalized_instructions: {
+      mnemonic: "MOV"
+      llvm_mnemonic: "MOV64rm"
+      output_operands: { register_name: "R14" }
+      input_operands: { memory: { alias_group_id: 1 } }
+      input_operands: { address: { base_register: "R15" scaling: 1 } }
+    }
+    canonicalized_instructions: {
+      mnemonic: "NOT"
+      llvm_mnemonic: "NOT64r"
+      output_operands: { register_name: "R14" }
+      input_operands: { register_name: "R14" }
+    })pb");
+  const BasicBlockProto invalid_token_proto = ParseTextProto(R"pb(
+    canonicalized_instructions: {
+      mnemonic: "ThisInstructionDoesNotExist"
+      llvm_mnemonic: "MOV64rr"
+    })pb");
+  const BasicBlock block = BasicBlockFromProto(block_proto);
+
+  CreateBuilder(OutOfVocabularyTokenBehavior::ReturnError());
+  ASSERT_TRUE(builder_->AddBasicBlock(block));
+  ASSERT_TRUE(builder_->AddBasicBlock(block));
+  ASSERT_TRUE(builder_->AddBasicBlock(block));
+  ASSERT_TRUE(builder_->AddBasicBlock(BasicBlock()));
+
+  const LazyBasicBlock lazy_blocks[] = {
+      LazyBasicBlock(block_proto),
+      LazyBasicBlock(PackedBasicBlockFromProto(block_proto)),
+      LazyBasicBlock(block), LazyBasicBlock()};
+  BasicBlockGraphBuilder lazy_builder(
+      std::vector<std::string>(std::begin(kTokens), std::end(kTokens)),
+      /*immediate_token =*/kImmediateToken,
+      /*fp_immediate_token =*/kFpImmediateToken,
+      /*address_token =*/kAddressToken,
+      /*memory_token =*/kMemoryToken);
+  for (const LazyBasicBlock& lazy_block : lazy_blocks) {
+    EXPECT_TRUE(lazy_builder.CanAddBasicBlock(lazy_block));
+    ASSERT_TRUE(lazy_builder.AddBasicBlock(lazy_block));
+  }
+  // Only the block that was created from a BasicBlock is materialized.
+  EXPECT_FALSE(lazy_blocks[0].is_materialized());
+  EXPECT_FALSE(lazy_blocks[1].is_materialized());
+  EXPECT_FALSE(lazy_blocks[3].is_materialized());
+
+  EXPECT_EQ(lazy_builder.num_nodes_per_block(),
+            builder_->num_nodes_per_block());
+  EXPECT_EQ(lazy_builder.num_edges_per_block(),
+            builder_->num_edges_per_block());
+  EXPECT_EQ(lazy_builder.node_types(), builder_->node_types());
+  EXPECT_EQ(lazy_builder.node_features(), builder_->node_features());
+  EXPECT_EQ(lazy_builder.edge_senders(), builder_->edge_senders());
+  EXPECT_EQ(lazy_builder.edge_receivers(), builder_->edge_receivers());
+  EXPECT_EQ(lazy_builder.edge_types(), builder_->edge_types());
+
+  const LazyBasicBlock invalid_blocks[] = {
+      LazyBasicBlock(invalid_token_proto),
+      LazyBasicBlock(PackedBasicBlockFromProto(invalid_token_proto)),
+      LazyBasicBlock(BasicBlockFromProto(invalid_token_proto))};
+  for (const LazyBasicBlock& invalid_block : invalid_blocks) {
+    EXPECT_FALSE(lazy_builder.CanAddBasicBlock(invalid_block));
+    EXPECT_FALSE(lazy_builder.AddBasicBlock(invalid_block));
+  }
+  EXPECT_EQ(lazy_builder.num_graphs(), 4);
+}
+
+TEST_F(BasicBlockGraphBuilderTest, CanAddBasicBlock) {
+  const BasicBlockProto block_protos[] = {
+      // A block with only known tokens.
+      ParseTextProto(R"pb(
+        canonicalized_instructions: {
+          prefixes: "LOCK"
+          mnemonic: "MOV"
+          llvm_mnemonic: "MOV64rm"
+          output_operands: { register_name: "R14" }
+          input_operands: { memory: { alias_group_id: 1 } }
+          input_operands: {
+            address: {
+              base_register: "R15"
+              index_register: "RAX"
+              displacement: 8
+              scaling: 1
+            }
+          }
+          input_operands: { immediate_value: 1 }
+        })pb"),
+      // Unknown mnemonic.
+      ParseTextProto(R"pb(
+        canonicalized_instructions: { mnemonic: "ThisInstructionDoesNotExist" }
+      )pb"),
+      // Unknown prefix.
+      ParseTextProto(R"pb(
+        canonicalized_instructions: { prefixes: "REP" mnemonic: "NOP" }
+      )pb"),
+      // Unknown output register.
+      ParseTextProto(R"pb(
+        canonicalized_instructions: {
+          mnemonic: "MOV"
+          output_operands: { register_name: "RUI" }
+          input_operands: { register_name: "RAX" }
+        })pb"),
+      // Unknown implicit input register.
+      ParseTextProto(R"pb(
+        canonicalized_instructions: {
+          mnemonic: "NOT"
+          output_operands: { register_name: "RAX" }
+          implicit_input_operands: { register_name: "EFLAGS" }
+        })pb"),
+      // Unknown index register.
+      ParseTextProto(R"pb(
+        canonicalized_instructions: {
+          mnemonic: "LEA"
+          output_operands: { register_name: "RAX" }
+          input_operands: {
+            address: { base_register: "RBX" index_register: "RUX" scaling: 1 }
+          }
+        })pb"),
+      // Unknown segment register.
+      ParseTextProto(R"pb(
+        canonicalized_instructions: {
+          mnemonic: "LEA"
+          output_operands: { register_name: "RAX" }
+          input_operands: {
+            address: { base_register: "RBX" segment: "FS" scaling: 1 }
+          }
+        })pb")};
+  const bool expected_can_add[] = {true,  false, false, false,
+                                   false, false, false};
+  static_assert(std::size(block_protos) == std::size(expected_can_add));
+
+  CreateBuilder(OutOfVocabularyTokenBehavior::ReturnError());
+  for (int i = 0; i < std::size(block_protos); ++i) {
+    SCOPED_TRACE(absl::StrCat("i = ", i));
+    const BasicBlockProto& block_proto = block_protos[i];
+    const BasicBlock block = BasicBlockFromProto(block_proto);
+    EXPECT_EQ(builder_->CanAddBasicBlock(block), expected_can_add[i]);
+    EXPECT_EQ(
+        builder_->CanAddBasicBlock(PackedBasicBlockFromProto(block_proto)),
+        expected_can_add[i]);
+    EXPECT_EQ(builder_->CanAddBasicBlockFromProto(block_proto),
+              expected_can_add[i]);
+    // The checks do not modify the batch.
+    EXPECT_EQ(builder_->num_graphs(), 0);
+    EXPECT_THAT(builder_->out_of_vocabulary_token_counts(), IsEmpty());
+
+    // The result is the same as the result of adding the block.
+    EXPECT_EQ(builder_->AddBasicBlock(block), expected_can_add[i]);
+    builder_->Reset();
+    builder_->ResetOutOfVocabularyTokenCounts();
+  }
+
+  CreateBuilder(OutOfVocabularyTokenBehavior::ReplaceWithToken(
+      std::string(kUnknownToken)));
+  for (const BasicBlockProto& block_proto : block_protos) {
+    EXPECT_TRUE(builder_->CanAddBasicBlock(BasicBlockFromProto(block_proto)));
+    EXPECT_TRUE(
+        builder_->CanAddBasicBlock(PackedBasicBlockFromProto(block_proto)));
+    EXPECT_TRUE(builder_->CanAddBasicBlockFromProto(block_proto));
+  }
+}
+
+TEST_F(BasicBlockGraphBuilderTest, CanAddBasicBlocks) {
+  const std::vector<BasicBlock> blocks = BlocksForBatchTests();
+  CreateBuilder(OutOfVocabularyTokenBehavior::ReturnError());
+  EXPECT_THAT(builder_->CanAddBasicBlocks(blocks),
+              ElementsAre(true, false, true));
+  EXPECT_EQ(builder_->num_graphs(), 0);
+  EXPECT_THAT(builder_->CanAddBasicBlocks(blocks),
+              ElementsAreArray(builder_->AddBasicBlocks(blocks)));
+}
+
+TEST_F(BasicBlockGraphBuilderTest, CanAddBasicBlocksFromSerializedProtos) {
+  const BasicBlockProto valid_proto = ParseTextProto(R"pb(
+    canonicalized_instructions: {
+      mnemonic: "MOV"
+      output_operands: { register_name: "RAX" }
+      input_operands: { register_name: "RBX" }
+    })pb");
+  const BasicBlockProto invalid_token_proto = ParseTextProto(R"pb(
+    canonicalized_instructions: { mnemonic: "ThisInstructionDoesNotExist" }
+  )pb");
+  const std::string valid = valid_proto.SerializeAsString();
+  const std::string invalid_token = invalid_token_proto.SerializeAsString();
+  const std::string not_a_proto = "\xff\xff\xff";
+  const std::vector<absl::string_view> serialized_protos = {
+      valid, invalid_token, not_a_proto, valid};
+
+  CreateBuilder(OutOfVocabularyTokenBehavior::ReturnError());
+  EXPECT_THAT(
+      builder_->CanAddBasicBlocksFromSerializedProtos(serialized_protos),
+      ElementsAre(true, false, false, true));
+  EXPECT_EQ(builder_->num_graphs(), 0);
+}
+
+// Returns a basic block whose instructions depend on each other through
+// registers and memory, for testing AppendInstructionsToLastBasicBlock().
+BasicBlock BlockForAppendTests() {
+  return BasicBlockFromProto(ParseTextProto(R"pb(
+    canonicalized_instructions: {
+      mnemonic: "MOV"
+      llvm_mnemonic: "MOV64rm"
+      output_operands: { register_name: "R14" }
+      input_operands: { memory: { alias_group_id: 1 } }
+      input_operands: {
+        address: { base_register: "R15" displacement: 8 scaling: 1 }
+      }
+    }
+    canonicalized_instructions: {
+      mnemonic: "NOT"
+      llvm_mnemonic: "NOT64r"
+      input_operands: { register_name: "R14" }
+      output_operands: { register_name: "R14" }
+    }
+    canonicalized_instructions: {
+      mnemonic: "MOV"
+      llvm_mnemonic: "MOV64mr"
+      output_operands: { memory: { alias_group_id: 1 } }
+      input_operands: { register_name: "R14" }
+      input_operands: { address: { base_register: "R15" scaling: 1 } }
+    }
+    canonicalized_instructions: {
+      mnemonic: "MOV"
+      llvm_mnemonic: "MOV64rm"
+      output_operands: { register_name: "RAX" }
+      input_operands: { memory: { alias_group_id: 1 } }
+      input_operands: { address: { base_register: "R15" scaling: 1 } }
+    })pb"));
+}
+
+TEST_F(BasicBlockGraphBuilderTest, AppendInstructionsToLastBasicBlock) {
+  const std::vector<BasicBlock> blocks = BlocksForBatchTests();
+  const BasicBlock block = BlockForAppendTests();
+
+  // Build the block one instruction at a time, and compare the result with
+  // the block added at once after each step.
+  CreateBuilder(OutOfVocabularyTokenBehavior::ReturnError());
+  ASSERT_TRUE(builder_->AddBasicBlock(blocks[2]));
+  ASSERT_TRUE(builder_->AddBasicBlockFromInstructions({}));
+  for (int num_instructions = 1; num_instructions <= block.instructions.size();
+       ++num_instructions) {
+    ASSERT_TRUE(builder_->can_append_to_last_basic_block());
+    ASSERT_TRUE(builder_->AppendInstructionsToLastBasicBlock(
+        {block.instructions[num_instructions - 1]}));
+
+    BasicBlockGraphBuilder expected_builder(
+        std::vector<std::string>(std::begin(kTokens), std::end(kTokens)),
+        /*immediate_token =*/kImmediateToken,
+        /*fp_immediate_token =*/kFpImmediateToken,
+        /*address_token =*/kAddressToken,
+        /*memory_token =*/kMemoryToken);
+    ASSERT_TRUE(expected_builder.AddBasicBlock(blocks[2]));
+    ASSERT_TRUE(expected_builder.AddBasicBlockFromInstructions(
+        std::vector<Instruction>(
+            block.instructions.begin(),
+            block.instructions.begin() + num_instructions)));
+    EXPECT_EQ(builder_->num_graphs(), 2);
+    ExpectSameBatch(*builder_, expected_builder);
+  }
+}
+
+TEST_F(BasicBlockGraphBuilderTest, AppendInstructionsWithUnknownToken) {
+  const std::vector<BasicBlock> blocks = BlocksForBatchTests();
+  const BasicBlock block = BlockForAppendTests();
+
+  CreateBuilder(OutOfVocabularyTokenBehavior::ReturnError());
+  ASSERT_TRUE(builder_->AddBasicBlockFromInstructions(
+      {block.instructions[0], block.instructions[1]}));
+  // The unknown mnemonic is in the second instruction, after the first one has
+  // already modified the register state of the block.
+  EXPECT_FALSE(builder_->AppendInstructionsToLastBasicBlock(
+      {block.instructions[2], blocks[1].instructions[0]}));
+  EXPECT_TRUE(builder_->can_append_to_last_basic_block());
+  ASSERT_TRUE(builder_->AppendInstructionsToLastBasicBlock(
+      {block.instructions[2], block.instructions[3]}));
+
+  BasicBlockGraphBuilder expected_builder(
+      std::vector<std::string>(std::begin(kTokens), std::end(kTokens)),
+      /*immediate_token =*/kImmediateToken,
+      /*fp_immediate_token =*/kFpImmediateToken,
+      /*address_token =*/kAddressToken,
+      /*memory_token =*/kMemoryToken);
+  ASSERT_TRUE(expected_builder.AddBasicBlock(block));
+  ExpectSameBatch(*builder_, expected_builder);
+}
+
+TEST_F(BasicBlockGraphBuilderTest, CanAppendToLastBasicBlock) {
+  const std::vector<BasicBlock> blocks = BlocksForBatchTests();
+
+  CreateBuilder(OutOfVocabularyTokenBehavior::ReturnError());
+  EXPECT_FALSE(builder_->can_append_to_last_basic_block());
+  ASSERT_TRUE(builder_->AddBasicBlock(blocks[0]));
+  EXPECT_TRUE(builder_->can_append_to_last_basic_block());
+  ASSERT_FALSE(builder_->AddBasicBlock(blocks[1]));
+  EXPECT_FALSE(builder_->can_append_to_last_basic_block());
+  ASSERT_TRUE(builder_->AddBasicBlock(PackedBasicBlock(blocks[2])));
+  EXPECT_TRUE(builder_->can_append_to_last_basic_block());
+  builder_->Reset();
+  EXPECT_FALSE(builder_->can_append_to_last_basic_block());
+
+  ASSERT_TRUE(builder_->AddBasicBlock(blocks[0]));
+  BasicBlockGraphBuilder other_builder(
+      std::vector<std::string>(std::begin(kTokens), std::end(kTokens)),
+      /*immediate_token =*/kImmediateToken,
+      /*fp_immediate_token =*/kFpImmediateToken,
+      /*address_token =*/kAddressToken,
+      /*memory_token =*/kMemoryToken);
+  ASSERT_TRUE(other_builder.AddBasicBlock(blocks[2]));
+  builder_->MergeFrom(other_builder);
+  EXPECT_FALSE(builder_->can_append_to_last_basic_block());
+}
+
+// Returns a graph builder whose vocabulary contains also the structural tokens
+// used in the instruction token sequences, with the instruction token sequences
+// enabled.
+template <typename Policy = GraniteGraphPolicy>
+std::unique_ptr<BasicBlockGraphBuilderImpl<Policy>>
+CreateBuilderWithInstructionTokens(
+    OutOfVocabularyTokenBehavior out_of_vocabulary_behavior =
+        OutOfVocabularyTokenBehavior::ReturnError()) {
+  std::vector<std::string> tokens(std::begin(kTokens), std::end(kTokens));
+  tokens.emplace_back(kDelimiterToken);
+  tokens.emplace_back(kNoRegisterToken);
+  tokens.emplace_back(kDisplacementToken);
+  auto builder = std::make_unique<BasicBlockGraphBuilderImpl<Policy>>(
+      std::move(tokens),
+      /*immediate_token =*/kImmediateToken,
+      /*fp_immediate_token =*/kFpImmediateToken,
+      /*address_token =*/kAddressToken,
+      /*memory_token =*/kMemoryToken, out_of_vocabulary_behavior);
+  builder->set_collect_instruction_tokens(true);
+  return builder;
+}
+
+TEST_F(BasicBlockGraphBuilderTest, NoInstructionTokensByDefault) {
+  const std::vector<BasicBlock> blocks = BlocksForBatchTests();
+
+  CreateBuilder(OutOfVocabularyTokenBehavior::ReturnError());
+  EXPECT_FALSE(builder_->collect_instruction_tokens());
+  ASSERT_TRUE(builder_->AddBasicBlock(blocks[0]));
+  EXPECT_THAT(builder_->instruction_token_indices(), IsEmpty());
+  EXPECT_THAT(builder_->instruction_token_offsets(), ElementsAre(0));
+}
+
+TEST_F(BasicBlockGraphBuilderTest, InstructionTokens) {
+  const BasicBlock block = BlockForAppendTests();
+  std::unique_ptr<BasicBlockGraphBuilder> builder =
+      CreateBuilderWithInstructionTokens();
+  ASSERT_TRUE(builder->AddBasicBlock(block));
+
+  const auto token = [&builder](absl::string_view token) {
+    return builder->node_tokens()->Find(token);
+  };
+  EXPECT_THAT(
+      builder->instruction_token_indices(),
+      ElementsAre(
+          // MOV R14, [R15 + 8] (memory 1).
+          token("MOV"), token(kDelimiterToken), token("R14"),
+          token(kDelimiterToken), token(kMemoryToken), token(kAddressToken),
+          token("R15"), token(kNoRegisterToken), token(kDisplacementToken),
+          token(kDelimiterToken),
+          // NOT R14.
+          token("NOT"), token(kDelimiterToken), token("R14"),
+          token(kDelimiterToken), token("R14"), token(kDelimiterToken),
+          // MOV [R15] (memory 1), R14.
+          token("MOV"), token(kDelimiterToken), token(kMemoryToken),
+          token(kDelimiterToken), token("R14"), token(kAddressToken),
+          token("R15"), token(kNoRegisterToken), token(kDelimiterToken),
+          // MOV RAX, [R15] (memory 1).
+          token("MOV"), token(kDelimiterToken), token("RAX"),
+          token(kDelimiterToken), token(kMemoryToken), token(kAddressToken),
+          token("R15"), token(kNoRegisterToken), token(kDelimiterToken)));
+  EXPECT_THAT(builder->instruction_token_offsets(),
+              ElementsAre(0, 10, 16, 25, 34));
+}
+
+// Checks that the instruction token sequences are the same as the ones
+// produced by BasicBlockTokenizer, for all ways of adding basic blocks to the
+// graph builder.
+TEST_F(BasicBlockGraphBuilderTest, InstructionTokensMatchTokenizer) {
+  std::vector<BasicBlock> blocks = BlocksForBatchTests();
+  blocks.push_back(BlockForAppendTests());
+  blocks.push_back(BasicBlockFromProto(ParseTextProto(R"pb(
+    canonicalized_instructions: {
+      mnemonic: "MOV"
+      llvm_mnemonic: "MOV64rm"
+      prefixes: "LOCK"
+      output_operands: { register_name: "R14" }
+      input_operands: { memory: { alias_group_id: 1 } }
+      input_operands: {
+        address: { base_register: "R15" index_register: "RBX" scaling: 1 }
+      }
+    }
+    canonicalized_instructions: {
+      mnemonic: "MOV"
+      llvm_mnemonic: "MOV64ri"
+      output_operands: { register_name: "RAX" }
+      input_operands: { immediate_value: 1 }
+      implicit_input_operands: { register_name: "RDI" }
+    })pb")));
+
+  std::unique_ptr<BasicBlockGraphBuilder> builder =
+      CreateBuilderWithInstructionTokens();
+  BasicBlockTokenizer tokenizer(builder->node_tokens(),
+                                OutOfVocabularyTokenBehavior::ReturnError());
+  const std::vector<bool> added = builder->AddBasicBlocks(blocks);
+  EXPECT_EQ(added, tokenizer.AddBasicBlocks(blocks));
+  EXPECT_THAT(added, ElementsAre(true, false, true, true, true));
+  EXPECT_EQ(builder->instruction_token_indices(), tokenizer.token_indices());
+  EXPECT_EQ(builder->instruction_token_offsets(),
+            tokenizer.instruction_token_offsets());
+  EXPECT_EQ(builder->instruction_token_offsets().size(),
+            builder->delta_block_index().size() + 1);
+
+  std::unique_ptr<BasicBlockGraphBuilder> packed_builder =
+      CreateBuilderWithInstructionTokens();
+  for (const BasicBlock& block : blocks) {
+    packed_builder->AddBasicBlock(PackedBasicBlock(block));
+  }
+  ExpectSameBatch(*packed_builder, *builder);
+
+  std::vector<const BasicBlock*> block_pointers;
+  for (int i = 0; i < 20; ++i) block_pointers.push_back(&blocks[i % 5]);
+  std::unique_ptr<BasicBlockGraphBuilder> sequential_builder =
+      CreateBuilderWithInstructionTokens();
+  sequential_builder->AddBasicBlocks(block_pointers);
+  std::unique_ptr<BasicBlockGraphBuilder> parallel_builder =
+      CreateBuilderWithInstructionTokens();
+  parallel_builder->AddBasicBlocksInParallel(block_pointers, 3);
+  ExpectSameBatch(*parallel_builder, *sequential_builder);
+
+  builder->Reset();
+  EXPECT_THAT(builder->instruction_token_indices(), IsEmpty());
+  EXPECT_THAT(builder->instruction_token_offsets(), ElementsAre(0));
+}
+
+TEST_F(BasicBlockGraphBuilderTest, AppendInstructionsWithInstructionTokens) {
+  const BasicBlock block = BlockForAppendTests();
+
+  std::unique_ptr<BasicBlockGraphBuilder> builder =
+      CreateBuilderWithInstructionTokens();
+  ASSERT_TRUE(builder->AddBasicBlockFromInstructions(
+      {block.instructions[0], block.instructions[1]}));
+  EXPECT_FALSE(builder->AppendInstructionsToLastBasicBlock(
+      {block.instructions[2], BlocksForBatchTests()[1].instructions[0]}));
+  ASSERT_TRUE(builder->AppendInstructionsToLastBasicBlock(
+      {block.instructions[2], block.instructions[3]}));
+
+  std::unique_ptr<BasicBlockGraphBuilder> expected_builder =
+      CreateBuilderWithInstructionTokens();
+  ASSERT_TRUE(expected_builder->AddBasicBlock(block));
+  ExpectSameBatch(*builder, *expected_builder);
+}
+
+TEST_F(BasicBlockGraphBuilderTest, ReleaseBatch) {
+  const std::vector<BasicBlock> blocks = BlocksForBatchTests();
+  std::unique_ptr<BasicBlockGraphBuilder> builder =
+      CreateBuilderWithInstructionTokens();
+  ASSERT_TRUE(builder->AddBasicBlock(blocks[0]));
+  ASSERT_TRUE(builder->AddBasicBlock(blocks[2]));
+
+  BasicBlockGraphBuilder expected = *builder;
+  const BasicBlockGraphBatch batch = builder->ReleaseBatch();
+  EXPECT_EQ(batch.num_node_tokens, expected.num_node_tokens());
+  EXPECT_EQ(batch.num_graphs(), 2);
+  EXPECT_EQ(batch.num_nodes(), expected.num_nodes());
+  EXPECT_EQ(batch.num_edges(), expected.num_edges());
+  EXPECT_EQ(batch.num_nodes_per_block, expected.num_nodes_per_block());
+  EXPECT_EQ(batch.num_edges_per_block, expected.num_edges_per_block());
+  EXPECT_EQ(batch.node_types, expected.node_types());
+  EXPECT_EQ(batch.node_features, expected.node_features());
+  EXPECT_EQ(batch.edge_senders, expected.edge_senders());
+  EXPECT_EQ(batch.edge_receivers, expected.edge_receivers());
+  EXPECT_EQ(batch.edge_types, expected.edge_types());
+  EXPECT_EQ(batch.edge_features, expected.edge_features());
+  EXPECT_EQ(batch.instruction_node_mask, expected.instruction_node_mask());
+  EXPECT_EQ(batch.delta_block_index, expected.delta_block_index());
+  EXPECT_EQ(batch.num_global_feature_tokens_per_block,
+            expected.num_global_feature_tokens_per_block());
+  EXPECT_EQ(batch.global_feature_token_indices,
+            expected.global_feature_token_indices());
+  EXPECT_EQ(batch.global_feature_token_counts,
+            expected.global_feature_token_counts());
+  EXPECT_EQ(batch.instruction_token_indices,
+            expected.instruction_token_indices());
+  EXPECT_EQ(batch.instruction_token_offsets,
+            expected.instruction_token_offsets());
+
+  // The builder is empty after the release, and it can be used for the next
+  // batch.
+  EXPECT_EQ(builder->num_graphs(), 0);
+  EXPECT_EQ(builder->num_nodes(), 0);
+  EXPECT_EQ(builder->num_edges(), 0);
+  EXPECT_THAT(builder->instruction_token_offsets(), ElementsAre(0));
+  EXPECT_FALSE(builder->can_append_to_last_basic_block());
+  ASSERT_TRUE(builder->AddBasicBlock(blocks[0]));
+  EXPECT_EQ(builder->num_graphs(), 1);
+  EXPECT_EQ(builder->num_nodes(), expected.num_nodes_per_block()[0]);
+}
+
+TEST_F(BasicBlockGraphBuilderTest, UncheckedPolicy) {
+  const BasicBlock block = BlockForAppendTests();
+  const std::vector<BasicBlock> blocks = BlocksForBatchTests();
+
+  std::unique_ptr<UncheckedBasicBlockGraphBuilder> builder =
+      CreateBuilderWithInstructionTokens<UncheckedGraniteGraphPolicy>();
+  ASSERT_TRUE(builder->AddBasicBlock(block));
+  EXPECT_THAT(builder->AddBasicBlocks(blocks), ElementsAre(true, false, true));
+  ASSERT_TRUE(builder->AddBasicBlock(PackedBasicBlock(block)));
+
+  std::unique_ptr<BasicBlockGraphBuilder> expected_builder =
+      CreateBuilderWithInstructionTokens();
+  ASSERT_TRUE(expected_builder->AddBasicBlock(block));
+  EXPECT_THAT(expected_builder->AddBasicBlocks(blocks),
+              ElementsAre(true, false, true));
+  ASSERT_TRUE(expected_builder->AddBasicBlock(PackedBasicBlock(block)));
+  ExpectSameBatch(*builder, *expected_builder);
+}
+
+TEST_F(BasicBlockGraphBuilderTest, CompactPolicy) {
+  const BasicBlockProto block_proto = ParseTextProto(R"pb(
+    canonicalized_instructions: {
+      mnemonic: "LEA"
+      llvm_mnemonic: "LEA64r"
+      output_operands: { register_name: "RDI" }
+      input_operands: {
+        address: { base_register: "RBX" displacement: 8 scaling: 1 }
+      }
+    }
+    canonicalized_instructions: {
+      mnemonic: "MOV"
+      llvm_mnemonic: "MOV64ri"
+      output_operands: { register_name: "RAX" }
+      input_operands: { fp_immediate_value: 1.5 }
+    })pb");
+  std::unique_ptr<CompactBasicBlockGraphBuilder> builder =
+      CreateBuilderWithInstructionTokens<CompactGraniteGraphPolicy>();
+  ASSERT_TRUE(builder->AddBasicBlockFromProto(block_proto));
+
+  // The displacement has no node, and the floating-point immediate value uses
+  // an immediate value node.
+  EXPECT_THAT(builder->node_types(),
+              ElementsAre(NodeType::kInstruction, NodeType::kAddressOperand,
+                          NodeType::kRegister, NodeType::kRegister,
+                          NodeType::kInstruction, NodeType::kImmediate,
+                          NodeType::kRegister));
+  EXPECT_THAT(builder->node_features(),
+              ElementsAre(TokenIndex("LEA"), TokenIndex(kAddressToken),
+                          TokenIndex("RBX"), TokenIndex("RDI"),
+                          TokenIndex("MOV"), TokenIndex(kImmediateToken),
+                          TokenIndex("RAX")));
+  EXPECT_THAT(builder->edge_types(),
+              ElementsAre(EdgeType::kAddressBaseRegister,
+                          EdgeType::kInputOperands, EdgeType::kOutputOperands,
+                          EdgeType::kStructuralDependency,
+                          EdgeType::kInputOperands, EdgeType::kOutputOperands));
+
+  // The policy does not change the instruction token sequences.
+  std::unique_ptr<BasicBlockGraphBuilder> full_builder =
+      CreateBuilderWithInstructionTokens();
+  ASSERT_TRUE(full_builder->AddBasicBlockFromProto(block_proto));
+  EXPECT_EQ(builder->instruction_token_indices(),
+            full_builder->instruction_token_indices());
+  EXPECT_EQ(builder->instruction_token_offsets(),
+            full_builder->instruction_token_offsets());
+}
+
+// Returns a graph builder whose vocabulary contains also EAX and the structural
+// tokens used in the instruction token sequences, with the instruction token
+// sequences enabled, and with the given register unit table.
+std::unique_ptr<BasicBlockGraphBuilder> CreateBuilderWithRegisterUnits(
+    std::shared_ptr<const RegisterUnitTable> register_unit_table) {
+  std::vector<std::string> tokens(std::begin(kTokens), std::end(kTokens));
+  tokens.emplace_back("EAX");
+  tokens.emplace_back(kDelimiterToken);
+  tokens.emplace_back(kNoRegisterToken);
+  tokens.emplace_back(kDisplacementToken);
+  auto builder = std::make_unique<BasicBlockGraphBuilder>(
+      std::move(tokens),
+      /*immediate_token =*/kImmediateToken,
+      /*fp_immediate_token =*/kFpImmediateToken,
+      /*address_token =*/kAddressToken,
+      /*memory_token =*/kMemoryToken);
+  builder->set_collect_instruction_tokens(true);
+  builder->set_register_unit_table(std::move(register_unit_table));
+  return builder;
+}
+
+TEST_F(BasicBlockGraphBuilderTest, RegisterUnits) {
+  // EAX covers only one of the two units of RAX, so that a read of RAX after a
+  // write to EAX depends both on the node of EAX and on a new node for the
+  // part of RAX that was not written.
+  auto register_unit_table = std::make_shared<RegisterUnitTable>();
+  register_unit_table->AddRegister("RAX", {0, 1});
+  register_unit_table->AddRegister("EAX", {0});
+  register_unit_table->AddRegister("RBX", {2});
+  register_unit_table->AddRegister("RCX", {3});
+  const BasicBlock block = BasicBlockFromProto(ParseTextProto(R"pb(
+    canonicalized_instructions: {
+      mnemonic: "MOV"
+      llvm_mnemonic: "MOV32rr"
+      output_operands: { register_name: "EAX" }
+      input_operands: { register_name: "RBX" }
+    }
+    canonicalized_instructions: {
+      mnemonic: "NOT"
+      llvm_mnemonic: "NOT64r"
+      output_operands: { register_name: "RAX" }
+      input_operands: { register_name: "RAX" }
+    }
+    canonicalized_instructions: {
+      mnemonic: "MOV"
+      llvm_mnemonic: "MOV32rr"
+      output_operands: { register_name: "RCX" }
+      input_operands: { register_name: "EAX" }
+    })pb"));
+  const int eax_token = std::size(kTokens);
+
+  std::unique_ptr<BasicBlockGraphBuilder> builder =
+      CreateBuilderWithRegisterUnits(register_unit_table);
+  ASSERT_TRUE(builder->AddBasicBlock(block));
+  EXPECT_THAT(builder->node_features(),
+              ElementsAre(TokenIndex("MOV"), TokenIndex("RBX"), eax_token,
+                          TokenIndex("NOT"), TokenIndex("RAX"),
+                          TokenIndex("RAX"), TokenIndex("MOV"),
+                          TokenIndex("RCX")));
+  EXPECT_THAT(builder->edge_senders(), ElementsAre(1, 0, 0, 2, 4, 3, 3, 5, 6));
+  EXPECT_THAT(builder->edge_receivers(),
+              ElementsAre(0, 2, 3, 3, 3, 5, 6, 6, 7));
+
+  // The register unit table changes only the graph, not the token sequences.
+  std::unique_ptr<BasicBlockGraphBuilder> builder_without_units =
+      CreateBuilderWithRegisterUnits(nullptr);
+  ASSERT_TRUE(builder_without_units->AddBasicBlock(block));
+  EXPECT_EQ(builder_without_units->num_nodes(), 8);
+  EXPECT_THAT(builder_without_units->edge_senders(),
+              ElementsAre(1, 0, 0, 4, 3, 3, 2, 6));
+  EXPECT_EQ(builder->instruction_token_indices(),
+            builder_without_units->instruction_token_indices());
+
+  // The packed block and the appended instructions produce the same graph.
+  std::unique_ptr<BasicBlockGraphBuilder> packed_builder =
+      CreateBuilderWithRegisterUnits(register_unit_table);
+  ASSERT_TRUE(packed_builder->AddBasicBlock(PackedBasicBlock(block)));
+  ExpectSameBatch(*packed_builder, *builder);
+
+  std::unique_ptr<BasicBlockGraphBuilder> appending_builder =
+      CreateBuilderWithRegisterUnits(register_unit_table);
+  ASSERT_TRUE(appending_builder->AddBasicBlockFromInstructions(
+      {block.instructions[0]}));
+  // The failed call writes to the units of RAX before it reaches the unknown
+  // mnemonic; the units must be restored.
+  EXPECT_FALSE(appending_builder->AppendInstructionsToLastBasicBlock(
+      {block.instructions[1], BlocksForBatchTests()[1].instructions[0]}));
+  ASSERT_TRUE(appending_builder->AppendInstructionsToLastBasicBlock(
+      {block.instructions[1], block.instructions[2]}));
+  ExpectSameBatch(*appending_builder, *builder);
+
+  // The state of the registers is cleared between basic blocks.
+  ASSERT_TRUE(builder->AddBasicBlock(block));
+  ASSERT_TRUE(packed_builder->AddBasicBlock(PackedBasicBlock(block)));
+  EXPECT_THAT(builder->num_edges_per_block(), ElementsAre(9, 9));
+  ExpectSameBatch(*packed_builder, *builder);
+}
+
+TEST_F(BasicBlockGraphBuilderTest, RegisterUnitsOutOfVocabularyCounts) {
+  auto register_unit_table = std::make_shared<RegisterUnitTable>();
+  register_unit_table->AddRegister("RAX", {0, 1});
+  register_unit_table->AddRegister("EAX", {0});
+  // EAX is not in the vocabulary, and it is read twice after a write to RAX.
+  const BasicBlock block = BasicBlockFromProto(ParseTextProto(R"pb(
+    canonicalized_instructions: {
+      mnemonic: "MOV"
+      llvm_mnemonic: "MOV64rr"
+      output_operands: { register_name: "RAX" }
+      input_operands: { register_name: "RBX" }
+    }
+    canonicalized_instructions: {
+      mnemonic: "MOV"
+      llvm_mnemonic: "MOV32rr"
+      output_operands: { register_name: "RCX" }
+      input_operands: { register_name: "EAX" }
+    }
+    canonicalized_instructions: {
+      mnemonic: "MOV"
+      llvm_mnemonic: "MOV32rr"
+      output_operands: { register_name: "RDI" }
+      input_operands: { register_name: "EAX" }
+    })pb"));
+
+  // Without register units, the node of EAX is created once and reused.
+  CreateBuilder(OutOfVocabularyTokenBehavior::ReplaceWithToken(
+      std::string(kUnknownToken)));
+  builder_->set_log_out_of_vocabulary_tokens(false);
+  ASSERT_TRUE(builder_->AddBasicBlock(block));
+  EXPECT_THAT(builder_->out_of_vocabulary_token_counts(),
+              UnorderedElementsAre(Pair("EAX", 1)));
+
+  // With register units, both reads use the node of RAX, and the token of EAX
+  // is resolved only once per block.
+  CreateBuilder(OutOfVocabularyTokenBehavior::ReplaceWithToken(
+      std::string(kUnknownToken)));
+  builder_->set_log_out_of_vocabulary_tokens(false);
+  builder_->set_register_unit_table(register_unit_table);
+  ASSERT_TRUE(builder_->AddBasicBlock(block));
+  EXPECT_THAT(builder_->out_of_vocabulary_token_counts(),
+              UnorderedElementsAre(Pair("EAX", 1)));
+  ASSERT_TRUE(builder_->AddBasicBlock(block));
+  EXPECT_THAT(builder_->out_of_vocabulary_token_counts(),
+              UnorderedElementsAre(Pair("EAX", 2)));
+}
+
 }  // namespace
 }  // namespace gematria
@@ -0,0 +1,132 @@
+# Copyright 2023 Google Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#    http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+r"""Builds the graphs of basic blocks in a data set and stores them on disk.
+
+Reads basic blocks from Gematria .tfrecord files, transforms them to graphs with
+BasicBlockGraphBuilder, and stores the graphs in a memory-mappable graph data
+set file (see gematria/io/python/graph_dataset.py). The graphs are tied to the
+token vocabulary and to the version of the graph builder; training code can
+reuse them only with the same vocabulary and out-of-vocabulary token behavior.
+
+Blocks that can't be added to the graph builder, e.g. because they contain
+out-of-vocabulary tokens and no replacement token is used, are skipped. The
+index of each stored graph in the input data is preserved in the data set.
+
+Usage:
+  compile_graph_dataset \
+      --gematria_input_file=/tmp/bhive/skl.tfrecord \
+      --gematria_tokens_file=/tmp/bhive/tokens.txt \
+      --gematria_output_graph_dataset=/tmp/bhive/skl.graphs
+"""
+
+from collections.abc import Sequence
+
+from absl import app
+from absl import flags
+from absl import logging
+from gematria.basic_block.python import tokens
+from gematria.granite.python import graph_builder
+from gematria.io.python import graph_dataset
+from gematria.io.python import tfrecord
+from gematria.model.python import token_model_flags
+from gematria.proto import throughput_pb2
+
+_INPUT_FILES = flags.DEFINE_multi_string(
+    'gematria_input_file',
+    None,
+    'The name of a .tfrecord file with BasicBlockWithThroughputProtos. Can be'
+    ' used multiple times; the blocks are processed in the order of the files.',
+    required=True,
+)
+_OUTPUT_GRAPH_DATASET = flags.DEFINE_string(
+    'gematria_output_graph_dataset',
+    None,
+    'The name of the graph data set file to write.',
+    required=True,
+)
+_GRAPH_BATCH_SIZE = flags.DEFINE_integer(
+    'gematria_graph_batch_size',
+    1000,
+    'The number of basic blocks added to the graph builder before its graphs'
+    ' are written to the output.',
+    lower_bound=1,
+)
+
+
+def main(argv: Sequence[str]) -> None:
+  if len(argv) > 1:
+    raise app.UsageError('Too many command-line arguments.')
+
+  node_tokens = token_model_flags.get_tokens_from_command_line_flags(
+      model_tokens=tokens.STRUCTURAL_TOKENS
+  )
+  oov_behavior = (
+      token_model_flags.get_oov_token_behavior_from_command_line_flags()
+  )
+  builder = graph_builder.BasicBlockGraphBuilder(
+      node_tokens=node_tokens,
+      immediate_token=tokens.IMMEDIATE,
+      fp_immediate_token=tokens.IMMEDIATE,
+      address_token=tokens.ADDRESS,
+      memory_token=tokens.MEMORY,
+      out_of_vocabulary_behavior=oov_behavior,
+  )
+  key = graph_dataset.GraphDatasetKey.for_vocabulary(
+      graph_builder_version=graph_builder.GRAPH_BUILDER_VERSION,
+      node_tokens=node_tokens,
+      immediate_token=tokens.IMMEDIATE,
+      fp_immediate_token=tokens.IMMEDIATE,
+      address_token=tokens.ADDRESS,
+      memory_token=tokens.MEMORY,
+      replacement_token=oov_behavior.replacement_token,
+  )
+
+  num_skipped_blocks = 0
+  with graph_dataset.GraphDatasetWriter(
+      _OUTPUT_GRAPH_DATASET.value,
+      key,
+      num_node_tokens=builder.num_node_tokens,
+      metadata={'input_files': list(_INPUT_FILES.value)},
+  ) as writer:
+    batch_block_indices = []
+    protos = tfrecord.read_protos(
+        _INPUT_FILES.value, throughput_pb2.BasicBlockWithThroughputProto
+    )
+    for block_index, proto in enumerate(protos):
+      if not builder.add_basic_block_from_proto(proto.basic_block):
+        num_skipped_blocks += 1
+        continue
+      batch_block_indices.append(block_index)
+      if len(batch_block_indices) >= _GRAPH_BATCH_SIZE.value:
+        writer.add_batch(builder, batch_block_indices)
+        builder.reset()
+        batch_block_indices = []
+    if batch_block_indices:
+      writer.add_batch(builder, batch_block_indices)
+    num_blocks = writer.num_blocks
+
+  logging.info(
+      'Wrote %d graphs to %s, skipped %d blocks.',
+      num_blocks,
+      _OUTPUT_GRAPH_DATASET.value,
+      num_skipped_blocks,
+  )
+  for token, count in sorted(builder.out_of_vocabulary_token_counts.items()):
+    logging.info('Out-of-vocabulary token %s: %d occurrences.', token, count)
+
+
+if __name__ == '__main__':
+  token_model_flags.mark_token_flags_as_required()
+  app.run(main)
@@ -292,11 +292,7 @@ class GnnModelBase(model_base.ModelBase):
             shape=_add_batch_dimension(self._graph_edge_feature_spec.shape),
             name=GnnModelBase.EDGES_TENSOR_NAME,
         ),
-        globals=tf.placeholder(
-            dtype=self._graph_global_feature_spec.dtype,
-            shape=_add_batch_dimension(self._graph_global_feature_spec.shape),
-            name=GnnModelBase.GLOBALS_TENSOR_NAME,
-        ),
+        globals=self._create_graph_globals_input(),
         receivers=tf.placeholder(
             dtype=self._graph_index_dtype,
             shape=(None,),
@@ -319,6 +315,25 @@ class GnnModelBase(model_base.ModelBase):
         ),
     )
 
+  def _create_graph_globals_input(self) -> tf.Tensor:
+    """Creates the input tensor for the global features of the graphs.
+
+    By default, this is a placeholder that receives the global features of the
+    graphs in the batch directly. Child classes may override this method to
+    compute the global features in the TensorFlow graph from a different input
+    representation. The returned tensor must be named
+    GnnModelBase.GLOBALS_TENSOR_NAME.
+
+    Returns:
+      A tensor of shape (None, *self._graph_global_feature_spec.shape) that
+      contains the global features of the graphs in the batch.
+    """
+    return tf.placeholder(
+        dtype=self._graph_global_feature_spec.dtype,
+        shape=_add_batch_dimension(self._graph_global_feature_spec.shape),
+        name=GnnModelBase.GLOBALS_TENSOR_NAME,
+    )
+
   def _create_graph_network(self) -> graph_nets.graphs.GraphsTuple:
     """Creates TensorFlow ops for the graph network.
 
@@ -436,9 +451,12 @@ class GnnModelBase(model_base.ModelBase):
   # @Override
   def _make_batch_feed_dict(self) -> model_base.FeedDict:
     graphs_tuple = self._make_batch_graphs_tuple()
-    return graph_nets.utils_tf.get_feed_dict(
-        self._graphs_tuple_placeholders, graphs_tuple
-    )
+    placeholders = self._graphs_tuple_placeholders
+    if graphs_tuple.globals is None:
+      # The global features are not fed directly; the child class is
+      # responsible for feeding the inputs they are computed from.
+      placeholders = placeholders.replace(globals=None)
+    return graph_nets.utils_tf.get_feed_dict(placeholders, graphs_tuple)
 
   @abc.abstractmethod
   def _make_batch_graphs_tuple(self) -> graph_nets.graphs.GraphsTuple:
@@ -447,6 +465,9 @@ class GnnModelBase(model_base.ModelBase):
     This method is called by self._make_batch_feed_dict() as a part of the
     creation of the feed_dict for the current batch. Child classes must override
     it to provide the model-specific graph representation of the basic blocks.
+    The globals of the returned GraphsTuple may be None when the child class
+    overrides self._create_graph_globals_input() and feeds the global features
+    through other tensors.
     """
     raise NotImplementedError(
         'GnnModelBase._make_batch_graphs_tuple is abstract'
@@ -87,6 +87,17 @@ USE_SENT_EDGES = flags.DEFINE_bool(
     ),
 )
 
+USE_SPARSE_GLOBAL_FEATURES = flags.DEFINE_bool(
+    'gematria_use_sparse_global_features',
+    False,
+    (
+        'When True, the global features of the basic block graphs are fed to'
+        ' the model in a sparse format and the dense global feature vectors'
+        ' are computed in the TensorFlow graph. This reduces the size of the'
+        ' batch data when the token vocabulary is large.'
+    ),
+)
+
 GRAPH_MODULE_RESIDUAL_CONNECTIONS = flags.DEFINE_bool(
     'gematria_graph_module_residual_connections',
     False,
@@ -14,16 +14,29 @@
 
 #include "gematria/granite/graph_builder.h"
 
+#include <algorithm>
+#include <cstdint>
+#include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
+#include "absl/status/statusor.h"
 #include "absl/strings/string_view.h"
+#include "gematria/basic_block/basic_block.h"
+#include "gematria/basic_block/lazy_basic_block.h"
 #include "gematria/model/oov_token_behavior.h"
+#include "gematria/model/token_vocabulary.h"
+#include "gematria/proto/basic_block.pb.h"
 #include "gematria/proto/canonicalized_instruction.pb.h"
+#include "gematria/utils/python/instrumentation_bindings.h"
 #include "pybind11/cast.h"
 #include "pybind11/detail/common.h"
+#include "pybind11/numpy.h"
 #include "pybind11/pybind11.h"
 #include "pybind11/stl.h"
+#include "pybind11_abseil/import_status_module.h"
+#include "pybind11_abseil/status_casters.h"
 #include "pybind11_protobuf/native_proto_caster.h"
 
 namespace gematria {
@@ -35,12 +48,187 @@ constexpr const char* const kModuleDocstring =
     R"(Conversion of basic blocks to a graph representation.
 
 See the comments in the C++ version of the class for more details on the graph
-representation and the conversion process.)";
+representation and the conversion process.
+
+The array properties of BasicBlockGraphBuilder return NumPy arrays with a copy
+of the data of the graph builder; they remain valid when the graph builder is
+modified. graphs_tuple_arrays() returns copies of all arrays needed to create a
+graph_nets.graphs.GraphsTuple in a single call.
+
+release_batch() moves the arrays of the current batch to a GraphBatch object
+without copying them and resets the graph builder. The array properties of
+GraphBatch are writable NumPy arrays that share memory with the batch and keep
+it alive; they remain valid after the graph builder is modified, and they can be
+passed to other frameworks without a copy through the DLPack protocol, e.g. with
+numpy.from_dlpack(), torch.from_dlpack() or jax.dlpack.from_dlpack().)";
+
+constexpr const char* const kGraphsTupleArraysDocstring =
+    R"(Returns the data of the current batch as a dict of NumPy arrays.
+
+The keys of the dict are the names of the fields of
+graph_nets.graphs.GraphsTuple and the values are the corresponding arrays, so
+that the result can be used directly as:
+
+  graph_nets.graphs.GraphsTuple(**builder.graphs_tuple_arrays())
+
+The arrays are copies of the data in the graph builder, and they remain valid
+after the graph builder is modified.
+
+Args:
+  include_global_features: When False, the value of 'globals' is None. This is
+    useful when the model consumes the sparse global features and computing the
+    dense global feature matrix would be wasteful.
+  index_dtype: The dtype of the arrays that contain node indices and counts,
+    i.e. 'senders', 'receivers', 'n_node', and 'n_edge'. Must be numpy.int32 or
+    numpy.int64. The arrays are created directly with this dtype, so that they
+    can be fed to the model without another conversion.)";
+
+// Returns views of the data of `bytes`. The views are valid as long as the
+// bytes objects exist.
+std::vector<absl::string_view> BytesViews(const std::vector<py::bytes>& bytes) {
+  std::vector<absl::string_view> views;
+  views.reserve(bytes.size());
+  for (const py::bytes& item : bytes) {
+    char* data = nullptr;
+    Py_ssize_t size = 0;
+    if (PyBytes_AsStringAndSize(item.ptr(), &data, &size) != 0) {
+      throw py::error_already_set();
+    }
+    views.emplace_back(data, size);
+  }
+  return views;
+}
+
+// Returns a writable NumPy array that shares memory with `data`. `owner` is
+// used as the base object of the array, i.e. it is kept alive as long as the
+// array exists. Used for the arrays of a released batch, which are not modified
+// by the C++ code; unlike read-only arrays, writable arrays can be exported
+// through the DLPack protocol.
+template <typename T>
+py::array_t<T> AsWritableNumpyView(std::vector<T>& data, py::handle owner) {
+  return py::array_t<T>(data.size(), data.data(), owner);
+}
+
+// Returns a function that can be used as a getter of a read-only Python
+// property of GraphBatch that returns a NumPy view of `member`.
+template <typename T>
+auto BatchArrayGetter(std::vector<T> BasicBlockGraphBatch::*member) {
+  return [member](py::object self) {
+    auto& batch = self.cast<BasicBlockGraphBatch&>();
+    return AsWritableNumpyView(batch.*member, self);
+  };
+}
+
+// Returns a NumPy array that contains a copy of `data`.
+template <typename T>
+py::array_t<T> CopyToNumpyArray(const std::vector<T>& data) {
+  return py::array_t<T>(data.size(), data.data());
+}
+
+// Returns a function that can be used as a getter of a read-only Python
+// property that returns a copy of the vector returned by `getter` as a NumPy
+// array. The graph builder may reallocate its vectors whenever it is modified,
+// so the properties can't share memory with it; zero-copy access is provided
+// only by release_batch(), which transfers the ownership of the data.
+template <typename T>
+auto NumpyCopyGetter(
+    const std::vector<T>& (BasicBlockGraphBuilder::*getter)() const) {
+  return [getter](const BasicBlockGraphBuilder& builder) {
+    return CopyToNumpyArray((builder.*getter)());
+  };
+}
+
+// Returns a NumPy array of type `T` that contains a copy of `data`, converting
+// the elements to `T` in the process.
+template <typename T, typename U>
+py::array_t<T> CopyToNumpyArrayAs(const std::vector<U>& data) {
+  py::array_t<T> array(data.size());
+  std::copy(data.begin(), data.end(), array.mutable_data());
+  return array;
+}
+
+// Returns a boolean NumPy array with a copy of the instruction node mask. The
+// mask is stored as one byte per node, which matches the memory layout of
+// NumPy boolean arrays.
+py::array InstructionNodeMaskArray(const BasicBlockGraphBuilder& builder) {
+  const std::vector<uint8_t>& mask = builder.instruction_node_mask();
+  return py::array(py::dtype::of<bool>(),
+                   {static_cast<py::ssize_t>(mask.size())}, mask.data());
+}
+
+// A version of InstructionNodeMaskArray() for a released batch.
+py::array BatchInstructionNodeMaskArray(py::object self) {
+  auto& batch = self.cast<BasicBlockGraphBatch&>();
+  std::vector<uint8_t>& mask = batch.instruction_node_mask;
+  return py::array(py::dtype::of<bool>(),
+                   {static_cast<py::ssize_t>(mask.size())}, mask.data(), self);
+}
+
+// Creates the dense global feature matrix directly from the sparse global
+// features to avoid creating the intermediate nested vectors.
+py::array_t<int> GlobalFeaturesArray(const BasicBlockGraphBuilder& builder) {
+  const int num_node_tokens = builder.num_node_tokens();
+  py::array_t<int> array({builder.num_graphs(), num_node_tokens});
+  int* const data = array.mutable_data();
+  std::fill_n(data, array.size(), 0);
+  const std::vector<int>& token_indices =
+      builder.global_feature_token_indices();
+  const std::vector<int>& token_counts = builder.global_feature_token_counts();
+  int block = 0;
+  int token_pos = 0;
+  for (const int num_tokens_in_block :
+       builder.num_global_feature_tokens_per_block()) {
+    int* const block_data = data + block * num_node_tokens;
+    for (int i = 0; i < num_tokens_in_block; ++i, ++token_pos) {
+      block_data[token_indices[token_pos]] = token_counts[token_pos];
+    }
+    ++block;
+  }
+  return array;
+}
+
+// Adds the arrays that contain node indices or counts to `arrays`, converted
+// to `IndexType`.
+template <typename IndexType>
+void AddIndexArrays(const BasicBlockGraphBuilder& builder, py::dict& arrays) {
+  arrays["receivers"] =
+      CopyToNumpyArrayAs<IndexType>(builder.edge_receivers());
+  arrays["senders"] = CopyToNumpyArrayAs<IndexType>(builder.edge_senders());
+  arrays["n_node"] =
+      CopyToNumpyArrayAs<IndexType>(builder.num_nodes_per_block());
+  arrays["n_edge"] =
+      CopyToNumpyArrayAs<IndexType>(builder.num_edges_per_block());
+}
+
+py::dict GraphsTupleArrays(const BasicBlockGraphBuilder& builder,
+                           bool include_global_features,
+                           py::object index_dtype) {
+  py::dict arrays;
+  arrays["nodes"] = CopyToNumpyArray(builder.node_features());
+  arrays["edges"] = CopyToNumpyArray(builder.edge_features());
+  arrays["globals"] = include_global_features
+                          ? py::object(GlobalFeaturesArray(builder))
+                          : py::object(py::none());
+  const py::dtype dtype = py::dtype::from_args(index_dtype);
+  if (dtype.kind() != 'i' ||
+      (dtype.itemsize() != sizeof(int32_t) &&
+       dtype.itemsize() != sizeof(int64_t))) {
+    throw py::value_error("index_dtype must be numpy.int32 or numpy.int64");
+  }
+  if (dtype.itemsize() == sizeof(int64_t)) {
+    AddIndexArrays<int64_t>(builder, arrays);
+  } else {
+    AddIndexArrays<int32_t>(builder, arrays);
+  }
+  return arrays;
+}
 
 PYBIND11_MODULE(graph_builder, m) {
   m.doc() = kModuleDocstring;
 
   pybind11_protobuf::ImportNativeProtoCasters();
+  py::google::ImportStatusModule();
+  DefineInstrumentationSubmodule(m);
 
   py::enum_<NodeType>(m, "NodeType")
       .value("INSTRUCTION", NodeType::kInstruction)
@@ -63,6 +251,95 @@ PYBIND11_MODULE(graph_builder, m) {
       .value("ADDRESS_DISPLACEMENT", EdgeType::kAddressDisplacement)
       .export_values();
 
+  m.attr("GRAPH_BUILDER_VERSION") = kBasicBlockGraphBuilderVersion;
+
+  py::class_<TokenVocabulary, std::shared_ptr<TokenVocabulary>>(
+      m, "TokenVocabulary",
+      R"(An immutable vocabulary of node tokens.
+
+A single vocabulary can be shared by multiple BasicBlockGraphBuilder objects, so
+that the tokens need to be indexed only once.)")
+      .def(py::init<std::vector<std::string>>(), py::arg("tokens"))
+      .def("__len__", &TokenVocabulary::size)
+      .def(
+          "find",
+          [](const TokenVocabulary& self, absl::string_view token) {
+            return self.Find(token);
+          },
+          py::arg("token"),
+          R"(Returns the index of `token`, or -1 when it is unknown.)")
+      .def("token", &TokenVocabulary::token, py::arg("index"))
+      .def_static(
+          "read_snapshot",
+          [](const std::string& file_name)
+              -> absl::StatusOr<std::shared_ptr<TokenVocabulary>> {
+            absl::StatusOr<std::shared_ptr<const TokenVocabulary>> vocabulary =
+                TokenVocabulary::ReadSnapshot(file_name);
+            if (!vocabulary.ok()) return vocabulary.status();
+            // The Python object does not provide any methods that modify the
+            // vocabulary.
+            return std::const_pointer_cast<TokenVocabulary>(
+                *std::move(vocabulary));
+          },
+          py::arg("file_name"),
+          R"(Loads a vocabulary from a snapshot file.
+
+The snapshot is read in one step, without creating a Python list of tokens.
+Raises StatusNotOk when the file can't be read or is not a valid snapshot.)")
+      .def("write_snapshot", &TokenVocabulary::WriteSnapshot,
+           py::arg("file_name"),
+           R"(Writes the vocabulary to a snapshot file.)");
+
+  py::class_<BasicBlockGraphBatch>(m, "GraphBatch",
+                                   R"(A batch released from a graph builder.
+
+The array properties have the same names and contents as the array properties
+of BasicBlockGraphBuilder, but they are writable NumPy arrays that share memory
+with the batch, and they remain valid as long as they exist. The batch can be
+added to a graph data set with GraphDatasetWriter.add_batch().)")
+      .def_readonly("num_node_tokens", &BasicBlockGraphBatch::num_node_tokens)
+      .def_property_readonly("num_graphs", &BasicBlockGraphBatch::num_graphs)
+      .def_property_readonly("num_nodes", &BasicBlockGraphBatch::num_nodes)
+      .def_property_readonly("num_edges", &BasicBlockGraphBatch::num_edges)
+      .def_property_readonly(
+          "num_nodes_per_block",
+          BatchArrayGetter(&BasicBlockGraphBatch::num_nodes_per_block))
+      .def_property_readonly(
+          "num_edges_per_block",
+          BatchArrayGetter(&BasicBlockGraphBatch::num_edges_per_block))
+      .def_property_readonly(
+          "node_features",
+          BatchArrayGetter(&BasicBlockGraphBatch::node_features))
+      .def_property_readonly("instruction_node_mask",
+                             &BatchInstructionNodeMaskArray)
+      .def_property_readonly(
+          "edge_senders", BatchArrayGetter(&BasicBlockGraphBatch::edge_senders))
+      .def_property_readonly(
+          "edge_receivers",
+          BatchArrayGetter(&BasicBlockGraphBatch::edge_receivers))
+      .def_property_readonly(
+          "edge_features",
+          BatchArrayGetter(&BasicBlockGraphBatch::edge_features))
+      .def_property_readonly(
+          "delta_block_index",
+          BatchArrayGetter(&BasicBlockGraphBatch::delta_block_index))
+      .def_property_readonly(
+          "num_global_feature_tokens_per_block",
+          BatchArrayGetter(
+              &BasicBlockGraphBatch::num_global_feature_tokens_per_block))
+      .def_property_readonly(
+          "global_feature_token_indices",
+          BatchArrayGetter(&BasicBlockGraphBatch::global_feature_token_indices))
+      .def_property_readonly(
+          "global_feature_token_counts",
+          BatchArrayGetter(&BasicBlockGraphBatch::global_feature_token_counts))
+      .def_property_readonly(
+          "instruction_token_indices",
+          BatchArrayGetter(&BasicBlockGraphBatch::instruction_token_indices))
+      .def_property_readonly(
+          "instruction_token_offsets",
+          BatchArrayGetter(&BasicBlockGraphBatch::instruction_token_offsets));
+
   py::class_<BasicBlockGraphBuilder>(m, "BasicBlockGraphBuilder")
       .def(
           py::init<std::vector<std::string> /* node_tokens */,
@@ -75,33 +352,267 @@ PYBIND11_MODULE(graph_builder, m) {
           py::arg("node_tokens"), py::arg("immediate_token"),
           py::arg("fp_immediate_token"), py::arg("address_token"),
           py::arg("memory_token"), py::arg("out_of_vocabulary_behavior"))
-      .def("add_basic_block", &BasicBlockGraphBuilder::AddBasicBlock,
+      .def(py::init([](std::shared_ptr<TokenVocabulary> node_tokens,
+                       absl::string_view immediate_token,
+                       absl::string_view fp_immediate_token,
+                       absl::string_view address_token,
+                       absl::string_view memory_token,
+                       OutOfVocabularyTokenBehavior
+                           out_of_vocabulary_behavior) {
+             return std::make_unique<BasicBlockGraphBuilder>(
+                 std::shared_ptr<const TokenVocabulary>(std::move(node_tokens)),
+                 immediate_token, fp_immediate_token, address_token,
+                 memory_token, out_of_vocabulary_behavior);
+           }),
+           py::arg("node_tokens"), py::arg("immediate_token"),
+           py::arg("fp_immediate_token"), py::arg("address_token"),
+           py::arg("memory_token"), py::arg("out_of_vocabulary_behavior"))
+      .def("add_basic_block",
+           py::overload_cast<const BasicBlock&>(
+               &BasicBlockGraphBuilder::AddBasicBlock),
            py::arg("block"))
+      .def("add_basic_block",
+           py::overload_cast<const LazyBasicBlock&>(
+               &BasicBlockGraphBuilder::AddBasicBlock),
+           py::arg("block"),
+           R"(A version of add_basic_block() for a LazyBasicBlock.
+
+Builds the graph from the compact form of the block when the block was not
+materialized, without creating the BasicBlock object.)")
       .def("add_basic_block_from_instructions",
            &BasicBlockGraphBuilder::AddBasicBlockFromInstructions,
            py::arg("instructions"))
+      .def(
+          "add_basic_blocks",
+          [](BasicBlockGraphBuilder& self,
+             const std::vector<const BasicBlock*>& blocks) {
+            return self.AddBasicBlocks(blocks);
+          },
+          py::arg("blocks"),
+          R"(Adds a list of basic blocks to the graph builder.
+
+Reserves space for all the blocks up front, and adds them in a single call.
+Returns a list of bools, one per input block, that is True when the block was
+added to the graph builder and False when it contains an out-of-vocabulary
+token and the builder is set up to return an error.)")
+      .def(
+          "add_basic_blocks",
+          [](BasicBlockGraphBuilder& self,
+             const std::vector<const LazyBasicBlock*>& blocks) {
+            std::vector<bool> added(blocks.size());
+            for (size_t i = 0; i < blocks.size(); ++i) {
+              added[i] = self.AddBasicBlock(*blocks[i]);
+            }
+            return added;
+          },
+          py::arg("blocks"))
+      .def(
+          "add_basic_blocks_in_parallel",
+          [](BasicBlockGraphBuilder& self,
+             const std::vector<const BasicBlock*>& blocks, int num_threads) {
+            return self.AddBasicBlocksInParallel(blocks, num_threads);
+          },
+          py::arg("blocks"), py::arg("num_threads"),
+          py::call_guard<py::gil_scoped_release>(),
+          R"(Adds a list of basic blocks using multiple threads.
+
+Produces the same batch as add_basic_blocks(), but the graphs are built on
+`num_threads` threads in separate graph builders that are merged at the end.
+The GIL is released while the graphs are built.)")
+      .def("append_instructions_to_last_basic_block",
+           &BasicBlockGraphBuilder::AppendInstructionsToLastBasicBlock,
+           py::arg("instructions"),
+           R"(Appends instructions to the last basic block in the batch.
+
+Produces the same graph as adding the last block with the new instructions
+appended to it, but the cost depends only on the number of new instructions.
+Returns False and leaves the builder unchanged when the instructions contain an
+out-of-vocabulary token and the builder is set up to return an error. May be
+called only when can_append_to_last_basic_block is True.)")
+      .def_property_readonly(
+          "can_append_to_last_basic_block",
+          &BasicBlockGraphBuilder::can_append_to_last_basic_block)
+      .def("merge_from", &BasicBlockGraphBuilder::MergeFrom, py::arg("other"),
+           R"(Appends the batch from another graph builder to this one.
+
+The other graph builder must use the same node token vocabulary and the same
+special tokens.)")
+      .def("add_basic_block_from_proto",
+           &BasicBlockGraphBuilder::AddBasicBlockFromProto, py::arg("proto"),
+           R"(Adds a basic block from a BasicBlockProto.
+
+Produces the same graph as add_basic_block(), but reads the instructions
+directly from the proto without creating the BasicBlock object first.)")
+      .def(
+          "add_basic_blocks_from_serialized_protos",
+          [](BasicBlockGraphBuilder& self,
+             const std::vector<py::bytes>& serialized_protos) {
+            return self.AddBasicBlocksFromSerializedProtos(
+                BytesViews(serialized_protos));
+          },
+          py::arg("serialized_protos"),
+          R"(Adds basic blocks from a list of serialized BasicBlockProtos.
+
+Returns a list of bools, one per input block, that is True when the block was
+added to the graph builder and False when it could not be parsed or when it
+contains an out-of-vocabulary token and the builder is set up to return an
+error.)")
+      .def("can_add_basic_block",
+           py::overload_cast<const BasicBlock&>(
+               &BasicBlockGraphBuilder::CanAddBasicBlock, py::const_),
+           py::arg("block"),
+           R"(Checks whether add_basic_block() would add the block to the batch.
+
+Only looks up the tokens of the block in the vocabulary, and does not modify the
+batch. This is much cheaper than adding the block, and it can be used to filter
+out blocks that would be rejected. Always returns True when out-of-vocabulary
+tokens are replaced.)")
+      .def("can_add_basic_block",
+           py::overload_cast<const LazyBasicBlock&>(
+               &BasicBlockGraphBuilder::CanAddBasicBlock, py::const_),
+           py::arg("block"))
+      .def("can_add_basic_block_from_proto",
+           &BasicBlockGraphBuilder::CanAddBasicBlockFromProto,
+           py::arg("proto"),
+           R"(A version of can_add_basic_block() for a BasicBlockProto.)")
+      .def(
+          "can_add_basic_blocks",
+          [](const BasicBlockGraphBuilder& self,
+             const std::vector<const BasicBlock*>& blocks) {
+            return self.CanAddBasicBlocks(blocks);
+          },
+          py::arg("blocks"),
+          R"(Checks a list of basic blocks with can_add_basic_block().
+
+Returns a list of bools, one per input block, that is True when the block can be
+added to the graph builder.)")
+      .def(
+          "can_add_basic_blocks",
+          [](const BasicBlockGraphBuilder& self,
+             const std::vector<const LazyBasicBlock*>& blocks) {
+            std::vector<bool> can_add(blocks.size());
+            for (size_t i = 0; i < blocks.size(); ++i) {
+              can_add[i] = self.CanAddBasicBlock(*blocks[i]);
+            }
+            return can_add;
+          },
+          py::arg("blocks"))
+      .def(
+          "can_add_basic_blocks_from_serialized_protos",
+          [](const BasicBlockGraphBuilder& self,
+             const std::vector<py::bytes>& serialized_protos) {
+            return self.CanAddBasicBlocksFromSerializedProtos(
+                BytesViews(serialized_protos));
+          },
+          py::arg("serialized_protos"),
+          R"(Checks a list of serialized BasicBlockProtos.
+
+Returns a list of bools, one per input block, that is True when the block can be
+added to the graph builder, and False when it could not be parsed or when it
+would be rejected because of an out-of-vocabulary token.)")
       .def("reset", &BasicBlockGraphBuilder::Reset)
+      .def("release_batch", &BasicBlockGraphBuilder::ReleaseBatch,
+           R"(Moves the current batch to a GraphBatch and resets the builder.
+
+The arrays are moved without a copy. Like reset(), this does not reset the
+out-of-vocabulary token counts.)")
+      .def_property_readonly(
+          "out_of_vocabulary_token_counts",
+          [](const BasicBlockGraphBuilder& self) {
+            py::dict counts;
+            for (const auto& [token, count] :
+                 self.out_of_vocabulary_token_counts()) {
+              counts[py::str(token)] = count;
+            }
+            return counts;
+          },
+          R"(The numbers of occurrences of out-of-vocabulary tokens.
+
+A dict from out-of-vocabulary tokens to their number of occurrences. The counts
+are accumulated across batches, and they are not affected by reset(); use
+reset_out_of_vocabulary_token_counts() to clear them.)")
+      .def("reset_out_of_vocabulary_token_counts",
+           &BasicBlockGraphBuilder::ResetOutOfVocabularyTokenCounts)
+      .def_property(
+          "log_out_of_vocabulary_tokens",
+          &BasicBlockGraphBuilder::log_out_of_vocabulary_tokens,
+          &BasicBlockGraphBuilder::set_log_out_of_vocabulary_tokens,
+          R"(When True, the first occurrence of each OOV token is logged.)")
+      .def_property(
+          "collect_instruction_tokens",
+          &BasicBlockGraphBuilder::collect_instruction_tokens,
+          &BasicBlockGraphBuilder::set_collect_instruction_tokens,
+          R"(When True, the builder also collects instruction token sequences.
+
+The token sequences are the same as those of BasicBlockTokenizer, and they are
+collected in the same pass over the basic blocks that builds the graphs. They
+are available through instruction_token_indices and instruction_token_offsets.
+Can be changed only when the batch is empty.)")
       .def_property_readonly("num_node_tokens",
                              &BasicBlockGraphBuilder::num_node_tokens)
       .def_property_readonly("num_graphs", &BasicBlockGraphBuilder::num_graphs)
       .def_property_readonly("num_nodes", &BasicBlockGraphBuilder::num_nodes)
       .def_property_readonly("num_edges", &BasicBlockGraphBuilder::num_edges)
-      .def_property_readonly("num_nodes_per_block",
-                             &BasicBlockGraphBuilder::num_nodes_per_block)
-      .def_property_readonly("num_edges_per_block",
-                             &BasicBlockGraphBuilder::num_edges_per_block)
-      .def_property_readonly("node_features",
-                             &BasicBlockGraphBuilder::node_features)
-      .def_property_readonly("instruction_node_mask",
-                             &BasicBlockGraphBuilder::InstructionNodeMask)
-      .def_property_readonly("edge_senders",
-                             &BasicBlockGraphBuilder::edge_senders)
-      .def_property_readonly("edge_receivers",
-                             &BasicBlockGraphBuilder::edge_receivers)
-      .def_property_readonly("edge_features",
-                             &BasicBlockGraphBuilder::EdgeFeatures)
-      .def_property_readonly("global_features",
-                             &BasicBlockGraphBuilder::global_features)
+      .def_property_readonly(
+          "num_nodes_per_block",
+          NumpyCopyGetter(&BasicBlockGraphBuilder::num_nodes_per_block),
+          "The number of nodes in each graph of the batch.")
+      .def_property_readonly(
+          "num_edges_per_block",
+          NumpyCopyGetter(&BasicBlockGraphBuilder::num_edges_per_block),
+          "The number of edges in each graph of the batch.")
+      .def_property_readonly(
+          "node_features",
+          NumpyCopyGetter(&BasicBlockGraphBuilder::node_features),
+          "The token index of each node in the batch.")
+      .def_property_readonly(
+          "instruction_node_mask", &InstructionNodeMaskArray,
+          "True for the instruction nodes in the batch.")
+      .def_property_readonly(
+          "edge_senders",
+          NumpyCopyGetter(&BasicBlockGraphBuilder::edge_senders),
+          "The index of the source node of each edge.")
+      .def_property_readonly(
+          "edge_receivers",
+          NumpyCopyGetter(&BasicBlockGraphBuilder::edge_receivers),
+          "The index of the destination node of each edge.")
+      .def_property_readonly(
+          "edge_features",
+          NumpyCopyGetter(&BasicBlockGraphBuilder::edge_features),
+          "The edge type of each edge in the batch.")
+      .def_property_readonly(
+          "delta_block_index",
+          NumpyCopyGetter(&BasicBlockGraphBuilder::delta_block_index),
+          "The index of the graph of each instruction node.")
+      .def_property_readonly("global_features", &GlobalFeaturesArray)
+      .def_property_readonly(
+          "num_global_feature_tokens_per_block",
+          NumpyCopyGetter(
+              &BasicBlockGraphBuilder::num_global_feature_tokens_per_block),
+          "The number of distinct node tokens in each graph of the batch.")
+      .def_property_readonly(
+          "global_feature_token_indices",
+          NumpyCopyGetter(
+              &BasicBlockGraphBuilder::global_feature_token_indices),
+          "The distinct node tokens of each graph in the batch.")
+      .def_property_readonly(
+          "global_feature_token_counts",
+          NumpyCopyGetter(
+              &BasicBlockGraphBuilder::global_feature_token_counts),
+          "The number of nodes with each global feature token.")
+      .def_property_readonly(
+          "instruction_token_indices",
+          NumpyCopyGetter(&BasicBlockGraphBuilder::instruction_token_indices),
+          "The tokens of the instructions in the batch.")
+      .def_property_readonly(
+          "instruction_token_offsets",
+          NumpyCopyGetter(&BasicBlockGraphBuilder::instruction_token_offsets),
+          R"(Offsets of the first token of each instruction.
+
+The tokens of the i-th instruction node in the batch are
+instruction_token_indices[instruction_token_offsets[i]:
+instruction_token_offsets[i + 1]]. Contains one more element than the number of
+instructions; the last one is the number of tokens.)")
       .def_property_readonly("immediate_token",
                              &BasicBlockGraphBuilder::immediate_token)
       .def_property_readonly("fp_immediate_token",
@@ -111,7 +622,11 @@ PYBIND11_MODULE(graph_builder, m) {
       .def_property_readonly("memory_token",
                              &BasicBlockGraphBuilder::memory_token)
       .def_property_readonly("replacement_token",
-                             &BasicBlockGraphBuilder::replacement_token);
+                             &BasicBlockGraphBuilder::replacement_token)
+      .def("graphs_tuple_arrays", &GraphsTupleArrays,
+           py::arg("include_global_features") = true,
+           py::arg("index_dtype") = py::dtype::of<int32_t>(),
+           kGraphsTupleArraysDocstring);
 }
 
 }  // namespace
@@ -58,6 +58,18 @@ class GraphBuilderModelBase(
       'GraphBuilderModelBase.instruction_node_mask'
   )
 
+  # The names of the input tensors that receive the global features of the
+  # graphs in the sparse format, when the model uses sparse global features.
+  GLOBAL_FEATURE_TOKEN_INDICES_TENSOR_NAME = (
+      'GraphBuilderModelBase.global_feature_token_indices'
+  )
+  GLOBAL_FEATURE_TOKEN_COUNTS_TENSOR_NAME = (
+      'GraphBuilderModelBase.global_feature_token_counts'
+  )
+  NUM_GLOBAL_FEATURE_TOKENS_TENSOR_NAME = (
+      'GraphBuilderModelBase.num_global_feature_tokens_per_block'
+  )
+
   # A Boolean tensor placeholder that receives a mask for instruction nodes. The
   # mask has shape (None,), and it must have the same length as
   # self._graphs_tuple_placeholders.nodes along the first dimension. It contains
@@ -76,6 +88,20 @@ class GraphBuilderModelBase(
   # the TensorFlow computation.
   _batch_graph_builder: graph_builder.BasicBlockGraphBuilder
 
+  # When True, the global features of the graphs are fed to the model in the
+  # sparse format produced by the graph builder, and the dense global feature
+  # matrix is computed in the TensorFlow graph. This reduces the size of the
+  # data fed to the model from (num_blocks, num_tokens) to O(num_nodes).
+  _use_sparse_global_features: bool
+
+  # Placeholders that receive the sparse global features of the graphs in the
+  # batch. See BasicBlockGraphBuilder.global_feature_token_indices and the
+  # related properties for the format of the data. These are None when the
+  # model uses dense global features.
+  _global_feature_token_indices: tf.Tensor
+  _global_feature_token_counts: tf.Tensor
+  _num_global_feature_tokens_per_block: tf.Tensor
+
   # A 1D int tensor that contains indices of special tokens used by the graph
   # builder. See the docstring of self.special_tokens_tensor for more details on
   # the format of the data.
@@ -89,6 +115,7 @@ class GraphBuilderModelBase(
       fp_immediate_token: str,
       address_token: str,
       memory_token: str,
+      use_sparse_global_features: bool = False,
       **kwargs: Any,
   ) -> None:
     """Initializes the model with the given feature factory.
@@ -108,6 +135,10 @@ class GraphBuilderModelBase(
         in the basic block graph.
       memory_token: The token that is associated with memory value nodes in the
         basic block graph.
+      use_sparse_global_features: When True, the global features are fed to
+        the model in a sparse format, and the dense global feature vectors are
+        computed in the TensorFlow graph. Otherwise, the dense global feature
+        vectors are fed to the model directly.
       **kwargs: Additional keyword arguments are passed to the constructor of
         the base class.
     """
@@ -129,6 +160,10 @@ class GraphBuilderModelBase(
     )
     self._instruction_node_mask = None
     self._instruction_features = None
+    self._use_sparse_global_features = use_sparse_global_features
+    self._global_feature_token_indices = None
+    self._global_feature_token_counts = None
+    self._num_global_feature_tokens_per_block = None
     self._batch_graph_builder = graph_builder.BasicBlockGraphBuilder(
         node_tokens=self._token_list,
         immediate_token=immediate_token,
@@ -184,6 +219,41 @@ class GraphBuilderModelBase(
         name=GraphBuilderModelBase.SPECIAL_TOKENS_TENSOR_NAME,
     )
 
+  # @Override
+  def _create_graph_globals_input(self) -> tf.Tensor:
+    if not self._use_sparse_global_features:
+      return super()._create_graph_globals_input()
+    self._global_feature_token_indices = tf.placeholder(
+        dtype=tf.dtypes.int32,
+        shape=(None,),
+        name=GraphBuilderModelBase.GLOBAL_FEATURE_TOKEN_INDICES_TENSOR_NAME,
+    )
+    self._global_feature_token_counts = tf.placeholder(
+        dtype=self._graph_global_feature_spec.dtype,
+        shape=(None,),
+        name=GraphBuilderModelBase.GLOBAL_FEATURE_TOKEN_COUNTS_TENSOR_NAME,
+    )
+    self._num_global_feature_tokens_per_block = tf.placeholder(
+        dtype=self._graph_index_dtype,
+        shape=(None,),
+        name=GraphBuilderModelBase.NUM_GLOBAL_FEATURE_TOKENS_TENSOR_NAME,
+    )
+    num_graphs = tf.size(
+        self._num_global_feature_tokens_per_block, out_type=tf.dtypes.int32
+    )
+    block_indices = tf.repeat(
+        tf.range(num_graphs, dtype=tf.dtypes.int32),
+        tf.cast(self._num_global_feature_tokens_per_block, tf.dtypes.int32),
+    )
+    return tf.scatter_nd(
+        indices=tf.stack(
+            (block_indices, self._global_feature_token_indices), axis=1
+        ),
+        updates=self._global_feature_token_counts,
+        shape=tf.stack((num_graphs, len(self._token_list))),
+        name=gnn_model_base.GnnModelBase.GLOBALS_TENSOR_NAME,
+    )
+
   # @Override
   def _create_readout_network_resources(self) -> None:
     super()._create_readout_network_resources()
@@ -196,6 +266,27 @@ class GraphBuilderModelBase(
         self._graphs_tuple_outputs.nodes, self._instruction_node_mask
     )
 
+  # @Override
+  def validate_basic_block(self, block: basic_block.BasicBlock) -> bool:
+    """See base class."""
+    # The check in the graph builder is much faster than the token list check
+    # in the base class; the latter is used only to log the unknown token.
+    if self._batch_graph_builder.can_add_basic_block(block):
+      return True
+    return self.validate_basic_blockTokens(block)
+
+  # @Override
+  def validate_basic_blocks(
+      self, blocks: Sequence[basic_block.BasicBlock]
+  ) -> list[bool]:
+    """See base class."""
+    valid = self._batch_graph_builder.can_add_basic_blocks(blocks)
+    for block, is_valid in zip(blocks, valid):
+      if not is_valid:
+        # Logs the unknown token.
+        self.validate_basic_blockTokens(block)
+    return valid
+
   # @Override
   def _start_batch(self) -> None:
     super()._start_batch()
@@ -204,16 +295,44 @@ class GraphBuilderModelBase(
   # @Override
   def _make_batch_feed_dict(self) -> model_base.FeedDict:
     feed_dict = super()._make_batch_feed_dict()
-    feed_dict[self._instruction_node_mask] = np.array(
-        self._batch_graph_builder.instruction_node_mask, dtype=bool
+    # The properties of the graph builder return copies of the data, so the
+    # arrays are converted only when they do not have the right dtype.
+    feed_dict[self._instruction_node_mask] = (
+        self._batch_graph_builder.instruction_node_mask
     )
+    if self._use_sparse_global_features:
+      feed_dict[self._global_feature_token_indices] = np.asarray(
+          self._batch_graph_builder.global_feature_token_indices,
+          dtype=np.int32,
+      )
+      feed_dict[self._global_feature_token_counts] = np.asarray(
+          self._batch_graph_builder.global_feature_token_counts,
+          dtype=self._graph_global_feature_spec.dtype.as_numpy_dtype,
+      )
+      feed_dict[self._num_global_feature_tokens_per_block] = np.asarray(
+          self._batch_graph_builder.num_global_feature_tokens_per_block,
+          dtype=self._graph_index_dtype.as_numpy_dtype,
+      )
     return feed_dict
 
   # @Override
   def _make_batch_graphs_tuple(self):
-    node_features = np.array(
-        self._batch_graph_builder.node_features,
-        dtype=self._graph_node_feature_spec.dtype.as_numpy_dtype,
+    # NOTE(ondrasej): The graph globals are not normalized by the number of
+    # nodes in the graph. We could do it here, but we can also do it by
+    # introducing a LayerNorm layer in the first graph network module.
+    index_dtype = self._graph_index_dtype.as_numpy_dtype
+    arrays = self._batch_graph_builder.graphs_tuple_arrays(
+        include_global_features=not self._use_sparse_global_features,
+        # The graph builder can produce only int32 and int64 indices directly.
+        index_dtype=(
+            index_dtype if index_dtype in (np.int32, np.int64) else np.int32
+        ),
+    )
+    # The arrays returned by the graph builder already use the dtypes of the
+    # model in the default configuration; the conversions below are no-ops
+    # unless the model uses different dtypes.
+    node_features = arrays['nodes'].astype(
+        self._graph_node_feature_spec.dtype.as_numpy_dtype, copy=False
     )
     if self._oov_injection_probability > 0:
       # Each token is replaced with the probability
@@ -226,35 +345,21 @@ class GraphBuilderModelBase(
           < self._oov_injection_probability
       )
       node_features[injection_mask] = self._oov_token
+    global_features = arrays['globals']
+    if global_features is not None:
+      global_features = global_features.astype(
+          self._graph_global_feature_spec.dtype.as_numpy_dtype, copy=False
+      )
     return graph_nets.graphs.GraphsTuple(
         nodes=node_features,
-        edges=np.array(
-            self._batch_graph_builder.edge_features,
-            dtype=self._graph_edge_feature_spec.dtype.as_numpy_dtype,
-        ),
-        # NOTE(ondrasej): The graph globals are not normalized by the number of
-        # nodes in the graph. We could do it here, but we can also do it by
-        # introducing a LayerNorm layer in the first graph network module.
-        globals=np.array(
-            self._batch_graph_builder.global_features,
-            dtype=self._graph_global_feature_spec.dtype.as_numpy_dtype,
-        ),
-        receivers=np.array(
-            self._batch_graph_builder.edge_receivers,
-            dtype=self._graph_index_dtype.as_numpy_dtype,
-        ),
-        senders=np.array(
-            self._batch_graph_builder.edge_senders,
-            dtype=self._graph_index_dtype.as_numpy_dtype,
-        ),
-        n_node=np.array(
-            self._batch_graph_builder.num_nodes_per_block,
-            dtype=self._graph_index_dtype.as_numpy_dtype,
-        ),
-        n_edge=np.array(
-            self._batch_graph_builder.num_edges_per_block,
-            dtype=self._graph_index_dtype.as_numpy_dtype,
+        edges=arrays['edges'].astype(
+            self._graph_edge_feature_spec.dtype.as_numpy_dtype, copy=False
         ),
+        globals=global_features,
+        receivers=arrays['receivers'].astype(index_dtype, copy=False),
+        senders=arrays['senders'].astype(index_dtype, copy=False),
+        n_node=arrays['n_node'].astype(index_dtype, copy=False),
+        n_edge=arrays['n_edge'].astype(index_dtype, copy=False),
     )
 
   # @Override
@@ -149,6 +149,47 @@ class GraphBuilderModelBaseTest(parameterized.TestCase, model_test.TestCase):
         schedule[model._graphs_tuple_placeholders.edges].shape, (30,)
     )
 
+  def test_schedule_batch_with_sparse_global_features(self):
+    model = TestGraphBuilderModel(
+        tokens=self.tokens,
+        num_message_passing_iterations=1,
+        use_sparse_global_features=True,
+    )
+    model.initialize()
+    schedule = model.schedule_batch(self.blocks_with_throughput)
+    self.assertNotIn(model._graphs_tuple_placeholders.globals, schedule)
+    num_tokens_per_block = schedule[model._num_global_feature_tokens_per_block]
+    self.assertEqual(num_tokens_per_block.shape, (3,))
+    num_tokens = sum(num_tokens_per_block)
+    self.assertEqual(
+        schedule[model._global_feature_token_indices].shape, (num_tokens,)
+    )
+    self.assertEqual(
+        schedule[model._global_feature_token_counts].shape, (num_tokens,)
+    )
+
+    # Check that the dense global features computed in the TensorFlow graph
+    # are the same as the dense global features from the graph builder.
+    with self.session() as sess:
+      global_features = sess.run(
+          model._graphs_tuple_placeholders.globals, feed_dict=schedule
+      )
+    self.assertAllEqual(
+        global_features, model._batch_graph_builder.global_features
+    )
+
+  def test_train_seq2num_model_with_sparse_global_features(self):
+    model = TestGraphBuilderModel(
+        tokens=self.tokens,
+        use_deltas=False,
+        num_message_passing_iterations=1,
+        use_sparse_global_features=True,
+    )
+    model.initialize()
+    self.check_training_model(
+        model, self.blocks_with_throughput[0:1], num_epochs=50
+    )
+
   def test_node_token_names(self):
     model = TestGraphBuilderModel(
         tokens=self.tokens, num_message_passing_iterations=1
@@ -234,6 +275,12 @@ class GraphBuilderModelBaseTest(parameterized.TestCase, model_test.TestCase):
     self.assertFalse(model.validate_basic_block_with_throughput(invalid_block))
     self.assertFalse(model.validate_basic_block(invalid_block.block))
 
+    blocks = [block.block for block in self.blocks_with_throughput]
+    self.assertEqual(
+        model.validate_basic_blocks(blocks + [invalid_block.block]),
+        [True] * len(blocks) + [False],
+    )
+
   def test_inject_out_of_vocabulary_tokens_invalid(self):
     with self.assertRaises(ValueError):
       _ = TestGraphBuilderModel(
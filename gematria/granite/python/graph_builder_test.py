@@ -15,10 +15,14 @@
 import itertools
 
 from absl.testing import absltest
+from gematria.basic_block.python import basic_block_protos
 from gematria.basic_block.python import tokens
 from gematria.granite.python import graph_builder
 from gematria.model.python import oov_token_behavior
 from gematria.testing.python import basic_blocks_with_throughput
+from gematria.utils.python import instrumentation
+import numpy as np
+from pybind11_abseil import status
 
 # A list of tokens that contains all the "helper" tokens used by the graph
 # builder but no tokens for the actual assembly code. Transforming a non-empty
@@ -72,6 +76,21 @@ class BasicBlockGraphBuilderTest(
     for global_feature in global_features:
       self.assertLen(global_feature, builder.num_node_tokens)
 
+    num_global_feature_tokens_per_block = (
+        builder.num_global_feature_tokens_per_block
+    )
+    global_feature_token_indices = builder.global_feature_token_indices
+    global_feature_token_counts = builder.global_feature_token_counts
+    self.assertLen(num_global_feature_tokens_per_block, num_blocks)
+    num_global_feature_tokens = sum(num_global_feature_tokens_per_block)
+    self.assertLen(global_feature_token_indices, num_global_feature_tokens)
+    self.assertLen(global_feature_token_counts, num_global_feature_tokens)
+    self.assertEqual(builder.num_nodes, sum(global_feature_token_counts))
+    self.assertEqual(
+        sum(sum(global_feature) for global_feature in global_features),
+        sum(global_feature_token_counts),
+    )
+
     if builder.num_edges:
       self.assertLess(max(edge_senders), builder.num_edges)
       self.assertLess(max(edge_receivers), builder.num_nodes)
@@ -137,6 +156,580 @@ class BasicBlockGraphBuilderTest(
 
     self.assertBuilderIsSelfConsistent(builder, num_blocks)
 
+  def test_add_basic_blocks(self):
+    builder = graph_builder.BasicBlockGraphBuilder(
+        node_tokens=self.tokens,
+        immediate_token=tokens.IMMEDIATE,
+        fp_immediate_token=tokens.IMMEDIATE,
+        address_token=tokens.ADDRESS,
+        memory_token=tokens.MEMORY,
+        out_of_vocabulary_behavior=_OutOfVocabularyTokenBehavior.return_error(),
+    )
+
+    added = builder.add_basic_blocks(self.blocks)
+
+    self.assertEqual(added, [True] * len(self.blocks))
+    self.assertBuilderIsSelfConsistent(builder, len(self.blocks))
+
+  def test_add_basic_blocks_out_of_vocabulary_tokens(self):
+    builder = graph_builder.BasicBlockGraphBuilder(
+        node_tokens=_STRUCTURAL_TOKENS,
+        immediate_token=tokens.IMMEDIATE,
+        fp_immediate_token=tokens.IMMEDIATE,
+        address_token=tokens.ADDRESS,
+        memory_token=tokens.MEMORY,
+        out_of_vocabulary_behavior=_OutOfVocabularyTokenBehavior.return_error(),
+    )
+
+    added = builder.add_basic_blocks(self.blocks)
+
+    self.assertEqual(added, [False] * len(self.blocks))
+    self.assertEqual(builder.num_graphs, 0)
+    self.assertEqual(builder.num_nodes, 0)
+
+  def test_add_basic_blocks_in_parallel(self):
+    builder_args = dict(
+        node_tokens=self.tokens,
+        immediate_token=tokens.IMMEDIATE,
+        fp_immediate_token=tokens.IMMEDIATE,
+        address_token=tokens.ADDRESS,
+        memory_token=tokens.MEMORY,
+        out_of_vocabulary_behavior=_OutOfVocabularyTokenBehavior.return_error(),
+    )
+    sequential_builder = graph_builder.BasicBlockGraphBuilder(**builder_args)
+    parallel_builder = graph_builder.BasicBlockGraphBuilder(**builder_args)
+
+    sequential_builder.add_basic_blocks(self.blocks)
+    added = parallel_builder.add_basic_blocks_in_parallel(
+        self.blocks, num_threads=4
+    )
+
+    self.assertEqual(added, [True] * len(self.blocks))
+    self.assertBuilderIsSelfConsistent(parallel_builder, len(self.blocks))
+    np.testing.assert_array_equal(
+        parallel_builder.node_features, sequential_builder.node_features
+    )
+    np.testing.assert_array_equal(
+        parallel_builder.edge_senders, sequential_builder.edge_senders
+    )
+    np.testing.assert_array_equal(
+        parallel_builder.edge_receivers, sequential_builder.edge_receivers
+    )
+
+  def test_instruction_tokens(self):
+    builder = graph_builder.BasicBlockGraphBuilder(
+        node_tokens=self.tokens,
+        immediate_token=tokens.IMMEDIATE,
+        fp_immediate_token=tokens.IMMEDIATE,
+        address_token=tokens.ADDRESS,
+        memory_token=tokens.MEMORY,
+        out_of_vocabulary_behavior=_OutOfVocabularyTokenBehavior.return_error(),
+    )
+    self.assertFalse(builder.collect_instruction_tokens)
+    builder.collect_instruction_tokens = True
+    self.assertTrue(builder.collect_instruction_tokens)
+
+    self.assertEqual(
+        builder.add_basic_blocks(self.blocks), [True] * len(self.blocks)
+    )
+    self.assertBuilderIsSelfConsistent(builder, len(self.blocks))
+
+    token_index = {token: i for i, token in enumerate(self.tokens)}
+    expected_tokens = []
+    expected_offsets = [0]
+    for block in self.blocks:
+      for instruction in block.instructions:
+        expected_tokens.extend(
+            token_index[token] for token in instruction.as_token_list()
+        )
+        expected_offsets.append(len(expected_tokens))
+    np.testing.assert_array_equal(
+        builder.instruction_token_indices, expected_tokens
+    )
+    np.testing.assert_array_equal(
+        builder.instruction_token_offsets, expected_offsets
+    )
+    self.assertLen(
+        builder.instruction_token_offsets,
+        np.count_nonzero(builder.instruction_node_mask) + 1,
+    )
+
+  def test_merge_from(self):
+    builder_args = dict(
+        node_tokens=self.tokens,
+        immediate_token=tokens.IMMEDIATE,
+        fp_immediate_token=tokens.IMMEDIATE,
+        address_token=tokens.ADDRESS,
+        memory_token=tokens.MEMORY,
+        out_of_vocabulary_behavior=_OutOfVocabularyTokenBehavior.return_error(),
+    )
+    builder = graph_builder.BasicBlockGraphBuilder(**builder_args)
+    other_builder = graph_builder.BasicBlockGraphBuilder(**builder_args)
+
+    self.assertTrue(builder.add_basic_block(self.blocks[0]))
+    self.assertTrue(other_builder.add_basic_block(self.blocks[1]))
+    builder.merge_from(other_builder)
+
+    self.assertBuilderIsSelfConsistent(builder, 2)
+
+  def test_append_instructions_to_last_basic_block(self):
+    builder_args = dict(
+        node_tokens=self.tokens,
+        immediate_token=tokens.IMMEDIATE,
+        fp_immediate_token=tokens.IMMEDIATE,
+        address_token=tokens.ADDRESS,
+        memory_token=tokens.MEMORY,
+        out_of_vocabulary_behavior=_OutOfVocabularyTokenBehavior.return_error(),
+    )
+    block = max(self.blocks, key=lambda block: len(block.instructions))
+    self.assertGreater(len(block.instructions), 1)
+    incremental_builder = graph_builder.BasicBlockGraphBuilder(**builder_args)
+    full_builder = graph_builder.BasicBlockGraphBuilder(**builder_args)
+
+    self.assertFalse(incremental_builder.can_append_to_last_basic_block)
+    self.assertTrue(
+        incremental_builder.add_basic_block_from_instructions(
+            block.instructions[:1]
+        )
+    )
+    self.assertTrue(incremental_builder.can_append_to_last_basic_block)
+    self.assertTrue(
+        incremental_builder.append_instructions_to_last_basic_block(
+            block.instructions[1:]
+        )
+    )
+    self.assertTrue(full_builder.add_basic_block(block))
+
+    self.assertBuilderIsSelfConsistent(incremental_builder, 1)
+    np.testing.assert_array_equal(
+        incremental_builder.node_features, full_builder.node_features
+    )
+    np.testing.assert_array_equal(
+        incremental_builder.edge_senders, full_builder.edge_senders
+    )
+    np.testing.assert_array_equal(
+        incremental_builder.edge_receivers, full_builder.edge_receivers
+    )
+    np.testing.assert_array_equal(
+        incremental_builder.global_features, full_builder.global_features
+    )
+
+  def test_instrumentation(self):
+    module_instrumentation = graph_builder.instrumentation
+    if not module_instrumentation.ENABLED:
+      self.skipTest('Instrumentation is disabled in this build.')
+    module_instrumentation.reset()
+    module_instrumentation.clear_trace()
+    module_instrumentation.set_tracing_enabled(True)
+    self.addCleanup(module_instrumentation.set_tracing_enabled, False)
+
+    builder = graph_builder.BasicBlockGraphBuilder(
+        node_tokens=self.tokens,
+        immediate_token=tokens.IMMEDIATE,
+        fp_immediate_token=tokens.IMMEDIATE,
+        address_token=tokens.ADDRESS,
+        memory_token=tokens.MEMORY,
+        out_of_vocabulary_behavior=_OutOfVocabularyTokenBehavior.return_error(),
+    )
+    builder.add_basic_blocks(self.blocks)
+
+    snapshot = instrumentation.snapshot((module_instrumentation,))
+    self.assertEqual(snapshot.counters['graph_nodes_added'], builder.num_nodes)
+    self.assertEqual(snapshot.counters['graph_edges_added'], builder.num_edges)
+    self.assertEqual(snapshot.counters['out_of_vocabulary_tokens'], 0)
+    self.assertEqual(
+        snapshot.stages['BasicBlockGraphBuilder::AddBasicBlock'].num_calls,
+        len(self.blocks),
+    )
+    trace = instrumentation.chrome_trace((module_instrumentation,))
+    self.assertLen(
+        [event for event in trace['traceEvents'] if event['ph'] == 'X'],
+        len(self.blocks),
+    )
+
+  def test_add_basic_block_from_proto(self):
+    builder_args = dict(
+        node_tokens=self.tokens,
+        immediate_token=tokens.IMMEDIATE,
+        fp_immediate_token=tokens.IMMEDIATE,
+        address_token=tokens.ADDRESS,
+        memory_token=tokens.MEMORY,
+        out_of_vocabulary_behavior=_OutOfVocabularyTokenBehavior.return_error(),
+    )
+    block_builder = graph_builder.BasicBlockGraphBuilder(**builder_args)
+    proto_builder = graph_builder.BasicBlockGraphBuilder(**builder_args)
+
+    for block, proto in zip(self.blocks, self.block_protos):
+      self.assertTrue(block_builder.add_basic_block(block))
+      self.assertTrue(
+          proto_builder.add_basic_block_from_proto(proto.basic_block)
+      )
+
+    self.assertBuilderIsSelfConsistent(proto_builder, len(self.blocks))
+    np.testing.assert_array_equal(
+        proto_builder.node_features, block_builder.node_features
+    )
+    np.testing.assert_array_equal(
+        proto_builder.edge_senders, block_builder.edge_senders
+    )
+    np.testing.assert_array_equal(
+        proto_builder.edge_receivers, block_builder.edge_receivers
+    )
+
+  def test_add_lazy_basic_blocks(self):
+    builder_args = dict(
+        node_tokens=self.tokens,
+        immediate_token=tokens.IMMEDIATE,
+        fp_immediate_token=tokens.IMMEDIATE,
+        address_token=tokens.ADDRESS,
+        memory_token=tokens.MEMORY,
+        out_of_vocabulary_behavior=_OutOfVocabularyTokenBehavior.return_error(),
+    )
+    block_builder = graph_builder.BasicBlockGraphBuilder(**builder_args)
+    self.assertEqual(
+        block_builder.add_basic_blocks(self.blocks), [True] * len(self.blocks)
+    )
+
+    for packed in (False, True):
+      with self.subTest(packed=packed):
+        lazy_blocks = [
+            basic_block_protos.lazy_basic_block_from_proto(
+                proto.basic_block, packed=packed
+            )
+            for proto in self.block_protos
+        ]
+        lazy_builder = graph_builder.BasicBlockGraphBuilder(**builder_args)
+        self.assertEqual(
+            lazy_builder.can_add_basic_blocks(lazy_blocks),
+            [True] * len(lazy_blocks),
+        )
+        self.assertTrue(lazy_builder.add_basic_block(lazy_blocks[0]))
+        self.assertEqual(
+            lazy_builder.add_basic_blocks(lazy_blocks[1:]),
+            [True] * (len(lazy_blocks) - 1),
+        )
+        for lazy_block in lazy_blocks:
+          self.assertFalse(lazy_block.is_materialized)
+
+        self.assertBuilderIsSelfConsistent(lazy_builder, len(lazy_blocks))
+        np.testing.assert_array_equal(
+            lazy_builder.node_features, block_builder.node_features
+        )
+        np.testing.assert_array_equal(
+            lazy_builder.edge_senders, block_builder.edge_senders
+        )
+        np.testing.assert_array_equal(
+            lazy_builder.edge_receivers, block_builder.edge_receivers
+        )
+
+  def test_add_basic_blocks_from_serialized_protos(self):
+    builder = graph_builder.BasicBlockGraphBuilder(
+        node_tokens=self.tokens,
+        immediate_token=tokens.IMMEDIATE,
+        fp_immediate_token=tokens.IMMEDIATE,
+        address_token=tokens.ADDRESS,
+        memory_token=tokens.MEMORY,
+        out_of_vocabulary_behavior=_OutOfVocabularyTokenBehavior.return_error(),
+    )
+
+    serialized_protos = [
+        proto.basic_block.SerializeToString() for proto in self.block_protos
+    ]
+    serialized_protos.append(b'\xff\xff\xff')
+    added = builder.add_basic_blocks_from_serialized_protos(serialized_protos)
+
+    self.assertEqual(added, [True] * len(self.block_protos) + [False])
+    self.assertBuilderIsSelfConsistent(builder, len(self.block_protos))
+
+  def test_can_add_basic_blocks(self):
+    builder_args = dict(
+        immediate_token=tokens.IMMEDIATE,
+        fp_immediate_token=tokens.IMMEDIATE,
+        address_token=tokens.ADDRESS,
+        memory_token=tokens.MEMORY,
+        out_of_vocabulary_behavior=_OutOfVocabularyTokenBehavior.return_error(),
+    )
+    builder = graph_builder.BasicBlockGraphBuilder(
+        node_tokens=self.tokens, **builder_args
+    )
+    structural_builder = graph_builder.BasicBlockGraphBuilder(
+        node_tokens=_STRUCTURAL_TOKENS, **builder_args
+    )
+    serialized_protos = [
+        proto.basic_block.SerializeToString() for proto in self.block_protos
+    ]
+    serialized_protos.append(b'\xff\xff\xff')
+
+    self.assertEqual(
+        builder.can_add_basic_blocks(self.blocks), [True] * len(self.blocks)
+    )
+    self.assertTrue(builder.can_add_basic_block(self.blocks[0]))
+    self.assertTrue(
+        builder.can_add_basic_block_from_proto(self.block_protos[0].basic_block)
+    )
+    self.assertEqual(
+        builder.can_add_basic_blocks_from_serialized_protos(serialized_protos),
+        [True] * len(self.block_protos) + [False],
+    )
+    self.assertEqual(builder.num_graphs, 0)
+
+    self.assertEqual(
+        structural_builder.can_add_basic_blocks(self.blocks),
+        [False] * len(self.blocks),
+    )
+    self.assertEqual(
+        structural_builder.can_add_basic_blocks_from_serialized_protos(
+            serialized_protos
+        ),
+        [False] * len(serialized_protos),
+    )
+
+  def test_shared_vocabulary(self):
+    vocabulary = graph_builder.TokenVocabulary(self.tokens)
+    self.assertLen(vocabulary, len(self.tokens))
+    self.assertEqual(vocabulary.find(self.tokens[1]), 1)
+    self.assertEqual(vocabulary.token(1), self.tokens[1])
+    self.assertEqual(vocabulary.find('ThisTokenDoesNotExist'), -1)
+
+    oov_behavior = _OutOfVocabularyTokenBehavior.return_error()
+    builders = [
+        graph_builder.BasicBlockGraphBuilder(
+            node_tokens=vocabulary,
+            immediate_token=tokens.IMMEDIATE,
+            fp_immediate_token=tokens.IMMEDIATE,
+            address_token=tokens.ADDRESS,
+            memory_token=tokens.MEMORY,
+            out_of_vocabulary_behavior=oov_behavior,
+        )
+        for _ in range(2)
+    ]
+    for builder in builders:
+      self.assertEqual(
+          builder.add_basic_blocks(self.blocks), [True] * len(self.blocks)
+      )
+      self.assertBuilderIsSelfConsistent(builder, len(self.blocks))
+    np.testing.assert_array_equal(
+        builders[0].node_features, builders[1].node_features
+    )
+
+  def test_vocabulary_snapshot(self):
+    vocabulary = graph_builder.TokenVocabulary(self.tokens)
+    file_name = self.create_tempfile().full_path
+    vocabulary.write_snapshot(file_name)
+
+    snapshot = graph_builder.TokenVocabulary.read_snapshot(file_name)
+    self.assertLen(snapshot, len(self.tokens))
+    for i, token in enumerate(self.tokens):
+      self.assertEqual(snapshot.token(i), token)
+
+    builder = graph_builder.BasicBlockGraphBuilder(
+        node_tokens=snapshot,
+        immediate_token=tokens.IMMEDIATE,
+        fp_immediate_token=tokens.IMMEDIATE,
+        address_token=tokens.ADDRESS,
+        memory_token=tokens.MEMORY,
+        out_of_vocabulary_behavior=_OutOfVocabularyTokenBehavior.return_error(),
+    )
+    self.assertEqual(
+        builder.add_basic_blocks(self.blocks), [True] * len(self.blocks)
+    )
+
+    with self.assertRaises(status.StatusNotOk):
+      graph_builder.TokenVocabulary.read_snapshot(
+          self.create_tempfile(content='not a snapshot').full_path
+      )
+
+  def test_array_properties_are_copies(self):
+    builder = graph_builder.BasicBlockGraphBuilder(
+        node_tokens=self.tokens,
+        immediate_token=tokens.IMMEDIATE,
+        fp_immediate_token=tokens.IMMEDIATE,
+        address_token=tokens.ADDRESS,
+        memory_token=tokens.MEMORY,
+        out_of_vocabulary_behavior=_OutOfVocabularyTokenBehavior.return_error(),
+    )
+    self.assertTrue(builder.add_basic_block(self.blocks[0]))
+
+    node_features = builder.node_features
+    self.assertIsInstance(node_features, np.ndarray)
+    self.assertEqual(node_features.dtype, np.int32)
+    self.assertFalse(np.shares_memory(node_features, builder.node_features))
+    expected_node_features = node_features.copy()
+
+    # The arrays are not affected by later modifications of the builder.
+    for block in self.blocks:
+      self.assertTrue(builder.add_basic_block(block))
+    builder.reset()
+    np.testing.assert_array_equal(node_features, expected_node_features)
+
+  def test_release_batch(self):
+    builder = graph_builder.BasicBlockGraphBuilder(
+        node_tokens=self.tokens,
+        immediate_token=tokens.IMMEDIATE,
+        fp_immediate_token=tokens.IMMEDIATE,
+        address_token=tokens.ADDRESS,
+        memory_token=tokens.MEMORY,
+        out_of_vocabulary_behavior=_OutOfVocabularyTokenBehavior.return_error(),
+    )
+    for block in self.blocks[:3]:
+      self.assertTrue(builder.add_basic_block(block))
+    array_names = (
+        'num_nodes_per_block',
+        'num_edges_per_block',
+        'node_features',
+        'instruction_node_mask',
+        'edge_senders',
+        'edge_receivers',
+        'edge_features',
+        'delta_block_index',
+        'num_global_feature_tokens_per_block',
+        'global_feature_token_indices',
+        'global_feature_token_counts',
+        'instruction_token_indices',
+        'instruction_token_offsets',
+    )
+    expected_arrays = {
+        name: np.copy(getattr(builder, name)) for name in array_names
+    }
+    num_nodes = builder.num_nodes
+    num_edges = builder.num_edges
+
+    batch = builder.release_batch()
+    self.assertIsInstance(batch, graph_builder.GraphBatch)
+    self.assertEqual(batch.num_node_tokens, builder.num_node_tokens)
+    self.assertEqual(batch.num_graphs, 3)
+    self.assertEqual(batch.num_nodes, num_nodes)
+    self.assertEqual(batch.num_edges, num_edges)
+    for name, expected_array in expected_arrays.items():
+      array = getattr(batch, name)
+      self.assertEqual(array.dtype, expected_array.dtype, msg=name)
+      np.testing.assert_array_equal(array, expected_array, err_msg=name)
+
+    # The builder is empty, and adding blocks to it does not change the batch.
+    self.assertEqual(builder.num_graphs, 0)
+    self.assertEqual(builder.num_nodes, 0)
+    self.assertTrue(builder.add_basic_block(self.blocks[5]))
+    np.testing.assert_array_equal(
+        batch.node_features, expected_arrays['node_features']
+    )
+
+  def test_release_batch_arrays(self):
+    builder = graph_builder.BasicBlockGraphBuilder(
+        node_tokens=self.tokens,
+        immediate_token=tokens.IMMEDIATE,
+        fp_immediate_token=tokens.IMMEDIATE,
+        address_token=tokens.ADDRESS,
+        memory_token=tokens.MEMORY,
+        out_of_vocabulary_behavior=_OutOfVocabularyTokenBehavior.return_error(),
+    )
+    self.assertTrue(builder.add_basic_block(self.blocks[0]))
+    batch = builder.release_batch()
+
+    node_features = batch.node_features
+    self.assertTrue(node_features.flags.writeable)
+    # The arrays share memory with the batch.
+    self.assertTrue(np.shares_memory(node_features, batch.node_features))
+    # The arrays can be exported through DLPack without a copy.
+    exported = np.from_dlpack(node_features)
+    self.assertTrue(np.shares_memory(exported, node_features))
+    self.assertEqual(batch.instruction_node_mask.dtype, np.bool_)
+
+    # The view keeps the batch alive.
+    expected_node_features = np.copy(node_features)
+    del batch
+    del builder
+    np.testing.assert_array_equal(node_features, expected_node_features)
+
+  def test_graphs_tuple_arrays(self):
+    builder = graph_builder.BasicBlockGraphBuilder(
+        node_tokens=self.tokens,
+        immediate_token=tokens.IMMEDIATE,
+        fp_immediate_token=tokens.IMMEDIATE,
+        address_token=tokens.ADDRESS,
+        memory_token=tokens.MEMORY,
+        out_of_vocabulary_behavior=_OutOfVocabularyTokenBehavior.return_error(),
+    )
+    for block in self.blocks:
+      self.assertTrue(builder.add_basic_block(block))
+
+    arrays = builder.graphs_tuple_arrays()
+    self.assertCountEqual(
+        arrays.keys(),
+        (
+            'nodes',
+            'edges',
+            'globals',
+            'receivers',
+            'senders',
+            'n_node',
+            'n_edge',
+        ),
+    )
+    np.testing.assert_array_equal(arrays['nodes'], builder.node_features)
+    np.testing.assert_array_equal(arrays['edges'], builder.edge_features)
+    np.testing.assert_array_equal(arrays['globals'], builder.global_features)
+    np.testing.assert_array_equal(arrays['receivers'], builder.edge_receivers)
+    np.testing.assert_array_equal(arrays['senders'], builder.edge_senders)
+    np.testing.assert_array_equal(arrays['n_node'], builder.num_nodes_per_block)
+    np.testing.assert_array_equal(arrays['n_edge'], builder.num_edges_per_block)
+
+    # The arrays are copies, and they remain valid after the builder is reset.
+    nodes = arrays['nodes'].copy()
+    builder.reset()
+    self.assertTrue(builder.add_basic_block(self.blocks[1]))
+    np.testing.assert_array_equal(arrays['nodes'], nodes)
+
+    arrays = builder.graphs_tuple_arrays(include_global_features=False)
+    self.assertIsNone(arrays['globals'])
+
+  def test_graphs_tuple_arrays_index_dtype(self):
+    builder = graph_builder.BasicBlockGraphBuilder(
+        node_tokens=self.tokens,
+        immediate_token=tokens.IMMEDIATE,
+        fp_immediate_token=tokens.IMMEDIATE,
+        address_token=tokens.ADDRESS,
+        memory_token=tokens.MEMORY,
+        out_of_vocabulary_behavior=_OutOfVocabularyTokenBehavior.return_error(),
+    )
+    for block in self.blocks:
+      self.assertTrue(builder.add_basic_block(block))
+
+    for index_dtype in (np.int32, np.int64):
+      arrays = builder.graphs_tuple_arrays(index_dtype=index_dtype)
+      for key in ('receivers', 'senders', 'n_node', 'n_edge'):
+        self.assertEqual(arrays[key].dtype, index_dtype)
+      np.testing.assert_array_equal(arrays['senders'], builder.edge_senders)
+      np.testing.assert_array_equal(
+          arrays['n_node'], builder.num_nodes_per_block
+      )
+
+    with self.assertRaises(ValueError):
+      builder.graphs_tuple_arrays(index_dtype=np.float32)
+
+  def test_instruction_node_mask_and_delta_block_index(self):
+    builder = graph_builder.BasicBlockGraphBuilder(
+        node_tokens=self.tokens,
+        immediate_token=tokens.IMMEDIATE,
+        fp_immediate_token=tokens.IMMEDIATE,
+        address_token=tokens.ADDRESS,
+        memory_token=tokens.MEMORY,
+        out_of_vocabulary_behavior=_OutOfVocabularyTokenBehavior.return_error(),
+    )
+    for block in self.blocks:
+      self.assertTrue(builder.add_basic_block(block))
+
+    instruction_node_mask = builder.instruction_node_mask
+    self.assertEqual(instruction_node_mask.dtype, np.bool_)
+    num_instructions = sum(len(block.instructions) for block in self.blocks)
+    self.assertEqual(np.count_nonzero(instruction_node_mask), num_instructions)
+
+    expected_delta_block_index = []
+    for i, block in enumerate(self.blocks):
+      expected_delta_block_index.extend([i] * len(block.instructions))
+    np.testing.assert_array_equal(
+        builder.delta_block_index, expected_delta_block_index
+    )
+
   def test_out_of_vocabulary_tokens_return_error(self):
     builder = graph_builder.BasicBlockGraphBuilder(
         node_tokens=_STRUCTURAL_TOKENS,
@@ -172,6 +765,37 @@ class BasicBlockGraphBuilderTest(
 
     self.assertLen(self.blocks, builder.num_graphs)
 
+  def test_out_of_vocabulary_token_counts(self):
+    builder = graph_builder.BasicBlockGraphBuilder(
+        node_tokens=_STRUCTURAL_TOKENS,
+        immediate_token=tokens.IMMEDIATE,
+        fp_immediate_token=tokens.IMMEDIATE,
+        address_token=tokens.ADDRESS,
+        memory_token=tokens.MEMORY,
+        out_of_vocabulary_behavior=(
+            _OutOfVocabularyTokenBehavior.replace_with_token(tokens.UNKNOWN)
+        ),
+    )
+    self.assertTrue(builder.log_out_of_vocabulary_tokens)
+    builder.log_out_of_vocabulary_tokens = False
+    self.assertFalse(builder.log_out_of_vocabulary_tokens)
+
+    self.assertEqual(builder.out_of_vocabulary_token_counts, {})
+    self.assertTrue(builder.add_basic_block(self.blocks[0]))
+    counts = builder.out_of_vocabulary_token_counts
+    self.assertIn(self.blocks[0].instructions[0].mnemonic, counts)
+    # Each occurrence of an out-of-vocabulary token creates a node that uses the
+    # replacement token.
+    self.assertEqual(
+        sum(counts.values()),
+        np.count_nonzero(builder.node_features == builder.replacement_token),
+    )
+
+    builder.reset()
+    self.assertEqual(builder.out_of_vocabulary_token_counts, counts)
+    builder.reset_out_of_vocabulary_token_counts()
+    self.assertEqual(builder.out_of_vocabulary_token_counts, {})
+
 
 if __name__ == '__main__':
   absltest.main()
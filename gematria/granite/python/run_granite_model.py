@@ -90,6 +90,9 @@ def main(argv):
           granite_flags.TASK_READOUT_RESIDUAL_CONNECTIONS.value
       ),
       use_sent_edges=granite_flags.USE_SENT_EDGES.value,
+      use_sparse_global_features=(
+          granite_flags.USE_SPARSE_GLOBAL_FEATURES.value
+      ),
       out_of_vocabulary_behavior=out_of_vocabulary_behavior,
       out_of_vocabulary_injection_probability=(
           token_model_flags.OUT_OF_VOCABULARY_INJECTION_PROBABILITY.value
@@ -0,0 +1,214 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmarks for the start-up cost of a process that predicts the throughput of
+// a single basic block: creating the LLVM objects, the canonicalizer and the
+// importer, the vocabulary, and the graph builder, and adding one block to the
+// graph. Each phase is measured both with the objects created from scratch and
+// with the cached alternatives, i.e. LlvmArchitectureSupport::GetShared() and a
+// vocabulary snapshot file.
+//
+// Run with:
+//   bazel run -c opt //gematria/granite:startup_benchmark
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/log/absl_check.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "benchmark/benchmark.h"
+#include "gematria/basic_block/basic_block.h"
+#include "gematria/basic_block/basic_block_protos.h"
+#include "gematria/datasets/bhive_importer.h"
+#include "gematria/granite/graph_builder.h"
+#include "gematria/llvm/canonicalizer.h"
+#include "gematria/llvm/disassembler.h"
+#include "gematria/llvm/llvm_architecture_support.h"
+#include "gematria/model/oov_token_behavior.h"
+#include "gematria/model/token_vocabulary.h"
+#include "gematria/proto/basic_block.pb.h"
+#include "llvm/include/llvm/MC/MCInstrInfo.h"
+#include "llvm/include/llvm/MC/MCRegisterInfo.h"
+
+namespace gematria {
+namespace {
+
+constexpr absl::string_view kFpImmediateToken = "_FP_IMMEDIATE_";
+constexpr absl::string_view kUnknownToken = "_UNKNOWN_";
+
+// The machine code of a short basic block from the BHive data set; see
+// gematria/datasets/bhive_importer_benchmark.cc for the instructions.
+constexpr absl::string_view kMachineCodeHex =
+    "4829d38b44246c8b54246848c1fb034829d04839c3";
+
+// Returns the name of the vocabulary snapshot file used by the benchmarks.
+std::string SnapshotFileName() {
+  const char* const temp_dir = getenv("TEST_TMPDIR");
+  return absl::StrCat(temp_dir != nullptr ? temp_dir : "/tmp",
+                      "/gematria_startup_benchmark_vocabulary_", getpid());
+}
+
+// The vocabulary used by the benchmarks and the snapshot file that contains
+// it. The vocabulary contains the names of all x86-64 opcodes and registers,
+// the special tokens, and the tokens of the benchmark block, so that its size
+// is comparable to the vocabulary of a trained model.
+struct BenchmarkData {
+  std::vector<std::string> tokens;
+  std::string snapshot_file_name;
+};
+
+const BenchmarkData& GetBenchmarkData() {
+  static const BenchmarkData* const data = [] {
+    auto* data = new BenchmarkData();
+    const std::unique_ptr<LlvmArchitectureSupport> llvm_architecture =
+        LlvmArchitectureSupport::X86_64();
+    std::set<std::string> tokens = {
+        std::string(kImmediateToken), std::string(kFpImmediateToken),
+        std::string(kAddressToken), std::string(kMemoryToken),
+        std::string(kUnknownToken)};
+    const llvm::MCInstrInfo& instr_info = llvm_architecture->mc_instr_info();
+    for (unsigned opcode = 0; opcode < instr_info.getNumOpcodes(); ++opcode) {
+      tokens.insert(std::string(instr_info.getName(opcode)));
+    }
+    const llvm::MCRegisterInfo& register_info =
+        llvm_architecture->mc_register_info();
+    for (unsigned reg = 1; reg < register_info.getNumRegs(); ++reg) {
+      tokens.insert(register_info.getName(reg));
+    }
+
+    X86Canonicalizer canonicalizer(&llvm_architecture->target_machine());
+    BHiveImporter importer(&canonicalizer);
+    absl::StatusOr<BasicBlockProto> proto =
+        importer.BasicBlockProtoFromMachineCodeHex(kMachineCodeHex);
+    ABSL_CHECK_OK(proto);
+    for (const Instruction& instruction :
+         BasicBlockFromProto(*proto).instructions) {
+      for (std::string& token : instruction.AsTokenList()) {
+        tokens.insert(std::move(token));
+      }
+    }
+    data->tokens.assign(tokens.begin(), tokens.end());
+
+    data->snapshot_file_name = SnapshotFileName();
+    ABSL_CHECK_OK(
+        TokenVocabulary(data->tokens).WriteSnapshot(data->snapshot_file_name));
+    return data;
+  }();
+  return *data;
+}
+
+// Returns the architecture support for x86-64. When `shared` is true, returns
+// the process-wide instance; otherwise, creates a new one and stores it in
+// `owned`.
+const LlvmArchitectureSupport& GetArchitecture(
+    bool shared, std::unique_ptr<LlvmArchitectureSupport>& owned) {
+  if (shared) {
+    absl::StatusOr<const LlvmArchitectureSupport*> architecture =
+        LlvmArchitectureSupport::GetShared("x86_64", "", "");
+    ABSL_CHECK_OK(architecture);
+    return **architecture;
+  }
+  absl::StatusOr<std::unique_ptr<LlvmArchitectureSupport>> architecture =
+      LlvmArchitectureSupport::FromTriple("x86_64", "", "");
+  ABSL_CHECK_OK(architecture);
+  owned = *std::move(architecture);
+  return *owned;
+}
+
+// Returns the benchmark vocabulary, either loaded from the snapshot file or
+// created from the list of tokens.
+std::shared_ptr<const TokenVocabulary> GetVocabulary(const BenchmarkData& data,
+                                                     bool from_snapshot) {
+  if (from_snapshot) {
+    absl::StatusOr<std::shared_ptr<const TokenVocabulary>> vocabulary =
+        TokenVocabulary::ReadSnapshot(data.snapshot_file_name);
+    ABSL_CHECK_OK(vocabulary);
+    return *std::move(vocabulary);
+  }
+  return std::make_shared<const TokenVocabulary>(data.tokens);
+}
+
+// Creates the LLVM objects for x86-64. `state.range(0)` selects between
+// creating new objects (0) and using the process-wide instance (1).
+void BM_CreateArchitecture(benchmark::State& state) {
+  const bool shared = state.range(0) != 0;
+  for (auto _ : state) {
+    std::unique_ptr<LlvmArchitectureSupport> owned;
+    benchmark::DoNotOptimize(&GetArchitecture(shared, owned));
+  }
+}
+BENCHMARK(BM_CreateArchitecture)->ArgName("shared")->Arg(0)->Arg(1);
+
+// Creates the vocabulary. `state.range(0)` selects between creating it from a
+// list of tokens (0) and loading it from the snapshot file (1).
+void BM_CreateVocabulary(benchmark::State& state) {
+  const BenchmarkData& data = GetBenchmarkData();
+  const bool from_snapshot = state.range(0) != 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(GetVocabulary(data, from_snapshot));
+  }
+  state.counters["tokens"] = data.tokens.size();
+}
+BENCHMARK(BM_CreateVocabulary)->ArgName("snapshot")->Arg(0)->Arg(1);
+
+// Runs all the steps needed to add a single basic block to a new graph builder,
+// starting from its machine code. `state.range(0)` selects between creating
+// all objects from scratch (0) and using the shared architecture support and
+// the vocabulary snapshot (1).
+void BM_OneBlockQuery(benchmark::State& state) {
+  const BenchmarkData& data = GetBenchmarkData();
+  const bool cached = state.range(0) != 0;
+  DisassemblerOptions disassembler_options;
+  disassembler_options.include_assembly = false;
+  for (auto _ : state) {
+    std::unique_ptr<LlvmArchitectureSupport> owned;
+    const LlvmArchitectureSupport& llvm_architecture =
+        GetArchitecture(cached, owned);
+    X86Canonicalizer canonicalizer(&llvm_architecture.target_machine());
+    BHiveImporter importer(&canonicalizer, disassembler_options);
+    BasicBlockGraphBuilder builder(
+        GetVocabulary(data, cached), kImmediateToken, kFpImmediateToken,
+        kAddressToken, kMemoryToken,
+        OutOfVocabularyTokenBehavior::ReplaceWithToken(
+            std::string(kUnknownToken)));
+    absl::StatusOr<BasicBlockProto> proto =
+        importer.BasicBlockProtoFromMachineCodeHex(kMachineCodeHex);
+    ABSL_CHECK_OK(proto);
+    benchmark::DoNotOptimize(builder.AddBasicBlockFromProto(*proto));
+  }
+}
+BENCHMARK(BM_OneBlockQuery)->ArgName("cached")->Arg(0)->Arg(1);
+
+}  // namespace
+}  // namespace gematria
+
+int main(int argc, char* argv[]) {
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  // The snapshot file exists only when one of the benchmarks used it; removing
+  // a file that does not exist is harmless.
+  std::remove(gematria::SnapshotFileName().c_str());
+  return 0;
+}
@@ -0,0 +1,302 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "gematria/io/block_store.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <ios>
+#include <limits>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "absl/log/absl_check.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "gematria/utils/little_endian.h"
+#include "gematria/utils/mapped_file.h"
+
+namespace gematria {
+namespace {
+
+constexpr std::string_view kMagic("GMBLKSTR", 8);
+constexpr uint32_t kFormatVersion = 1;
+
+// The number of uint64 fields in each entry of the chunk table.
+constexpr int kChunkTableFields = 3;
+constexpr size_t kChunkTableEntrySize = kChunkTableFields * sizeof(uint64_t);
+constexpr size_t kFooterSize =
+    4 * sizeof(uint64_t) + 2 * sizeof(uint32_t) + kMagic.size();
+
+bool IsValidCompression(BlockStoreCompression compression) {
+  switch (compression) {
+    case BlockStoreCompression::kNone:
+    case BlockStoreCompression::kZlib:
+      return true;
+  }
+  return false;
+}
+
+}  // namespace
+
+absl::StatusOr<std::unique_ptr<BlockStoreWriter>> BlockStoreWriter::Open(
+    const std::string& file_name, const BlockStoreWriterOptions& options) {
+  if (options.records_per_chunk <= 0) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("records_per_chunk must be positive, got ",
+                     options.records_per_chunk));
+  }
+  if (!IsValidCompression(options.compression)) {
+    return absl::InvalidArgumentError("Unknown compression");
+  }
+  std::ofstream output(file_name,
+                       std::ios::binary | std::ios::out | std::ios::trunc);
+  if (!output.is_open()) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Could not open file for writing: ", file_name));
+  }
+  output.write(kMagic.data(), kMagic.size());
+  if (!output) return absl::InternalError("Writing the header failed");
+  return std::unique_ptr<BlockStoreWriter>(
+      new BlockStoreWriter(std::move(output), options));
+}
+
+BlockStoreWriter::BlockStoreWriter(std::ofstream output,
+                                   const BlockStoreWriterOptions& options)
+    : output_(std::move(output)),
+      options_(options),
+      file_offset_(kMagic.size()) {}
+
+absl::Status BlockStoreWriter::Write(std::string_view record) {
+  if (closed_) return absl::FailedPreconditionError("The writer is closed");
+  chunk_data_.append(record);
+  record_offsets_.push_back(record_offsets_.back() + record.size());
+  ++num_records_in_chunk_;
+  if (num_records_in_chunk_ == options_.records_per_chunk) {
+    return FlushChunk();
+  }
+  return absl::OkStatus();
+}
+
+absl::Status BlockStoreWriter::FlushChunk() {
+  if (num_records_in_chunk_ == 0) return absl::OkStatus();
+  std::string_view stored_data = chunk_data_;
+  std::string compressed_data;
+  if (options_.compression == BlockStoreCompression::kZlib) {
+    uLongf compressed_size = compressBound(chunk_data_.size());
+    compressed_data.resize(compressed_size);
+    const int result = compress2(
+        reinterpret_cast<Bytef*>(compressed_data.data()), &compressed_size,
+        reinterpret_cast<const Bytef*>(chunk_data_.data()), chunk_data_.size(),
+        Z_DEFAULT_COMPRESSION);
+    if (result != Z_OK) {
+      return absl::InternalError(
+          absl::StrCat("Compressing a chunk failed with zlib error ", result));
+    }
+    compressed_data.resize(compressed_size);
+    stored_data = compressed_data;
+  }
+  output_.write(stored_data.data(), stored_data.size());
+  if (!output_) return absl::InternalError("Writing a chunk failed");
+
+  chunk_table_.push_back(file_offset_);
+  chunk_table_.push_back(stored_data.size());
+  chunk_table_.push_back(chunk_data_.size());
+  file_offset_ += stored_data.size();
+  chunk_data_.clear();
+  num_records_in_chunk_ = 0;
+  return absl::OkStatus();
+}
+
+absl::Status BlockStoreWriter::Close() {
+  if (closed_) return absl::FailedPreconditionError("The writer is closed");
+  closed_ = true;
+  if (absl::Status status = FlushChunk(); !status.ok()) return status;
+
+  std::string index;
+  index.reserve((chunk_table_.size() + record_offsets_.size()) *
+                    sizeof(uint64_t) +
+                kFooterSize);
+  for (const uint64_t value : chunk_table_) {
+    AppendLittleEndian(value, index);
+  }
+  for (const uint64_t offset : record_offsets_) {
+    AppendLittleEndian(offset, index);
+  }
+  AppendLittleEndian<uint64_t>(num_records(), index);
+  AppendLittleEndian<uint64_t>(chunk_table_.size() / kChunkTableFields, index);
+  AppendLittleEndian<uint64_t>(options_.records_per_chunk, index);
+  AppendLittleEndian<uint64_t>(file_offset_, index);
+  AppendLittleEndian(static_cast<uint32_t>(options_.compression), index);
+  AppendLittleEndian(kFormatVersion, index);
+  index.append(kMagic);
+
+  output_.write(index.data(), index.size());
+  output_.close();
+  if (!output_) return absl::InternalError("Writing the index failed");
+  return absl::OkStatus();
+}
+
+absl::StatusOr<std::unique_ptr<BlockStoreReader>> BlockStoreReader::Open(
+    const std::string& file_name) {
+  absl::StatusOr<std::unique_ptr<MappedFile>> file =
+      MappedFile::Open(file_name);
+  if (!file.ok()) return file.status();
+  if ((*file)->size() < kMagic.size() + kFooterSize) {
+    return absl::InvalidArgumentError(
+        absl::StrCat(file_name, " is not an indexed block store"));
+  }
+
+  std::unique_ptr<BlockStoreReader> reader(
+      new BlockStoreReader(*std::move(file)));
+  if (absl::Status status = reader->Init(); !status.ok()) {
+    return absl::InvalidArgumentError(
+        absl::StrCat(file_name, ": ", status.message()));
+  }
+  return reader;
+}
+
+BlockStoreReader::BlockStoreReader(std::unique_ptr<MappedFile> file)
+    : file_(std::move(file)), data_(file_->data()), size_(file_->size()) {}
+
+BlockStoreReader::~BlockStoreReader() = default;
+
+absl::Status BlockStoreReader::Init() {
+  const char* const footer = data_ + size_ - kFooterSize;
+  if (std::string_view(data_, kMagic.size()) != kMagic ||
+      std::string_view(footer + kFooterSize - kMagic.size(), kMagic.size()) !=
+          kMagic) {
+    return absl::InvalidArgumentError("Not an indexed block store");
+  }
+  const uint64_t num_records = DecodeLittleEndian<uint64_t>(footer);
+  const uint64_t num_chunks = DecodeLittleEndian<uint64_t>(footer + 8);
+  const uint64_t records_per_chunk = DecodeLittleEndian<uint64_t>(footer + 16);
+  const uint64_t index_offset = DecodeLittleEndian<uint64_t>(footer + 24);
+  const auto compression = static_cast<BlockStoreCompression>(
+      DecodeLittleEndian<uint32_t>(footer + 32));
+  const uint32_t format_version = DecodeLittleEndian<uint32_t>(footer + 36);
+
+  if (format_version != kFormatVersion) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Unsupported format version ", format_version));
+  }
+  if (!IsValidCompression(compression)) {
+    return absl::InvalidArgumentError("Unknown compression");
+  }
+  // The sizes are bounded by the size of the file, which also guarantees that
+  // the computations below do not overflow.
+  if (num_records >= size_ || records_per_chunk == 0 ||
+      records_per_chunk > std::numeric_limits<int64_t>::max() ||
+      num_chunks !=
+          (num_records == 0 ? 0 : (num_records - 1) / records_per_chunk + 1)) {
+    return absl::InvalidArgumentError("Invalid record or chunk counts");
+  }
+  const uint64_t index_size = num_chunks * kChunkTableEntrySize +
+                              (num_records + 1) * sizeof(uint64_t);
+  if (index_offset < kMagic.size() ||
+      index_offset + index_size + kFooterSize != size_) {
+    return absl::InvalidArgumentError("Invalid index offset");
+  }
+
+  num_records_ = num_records;
+  num_chunks_ = num_chunks;
+  records_per_chunk_ = records_per_chunk;
+  compression_ = compression;
+  index_offset_ = index_offset;
+  chunk_table_ = data_ + index_offset;
+  record_offsets_ = chunk_table_ + num_chunks * kChunkTableEntrySize;
+  return absl::OkStatus();
+}
+
+uint64_t BlockStoreReader::RecordOffset(int64_t index) const {
+  return DecodeLittleEndian<uint64_t>(record_offsets_ +
+                                      index * sizeof(uint64_t));
+}
+
+uint64_t BlockStoreReader::ChunkField(int64_t chunk, int field) const {
+  return DecodeLittleEndian<uint64_t>(chunk_table_ +
+                                      chunk * kChunkTableEntrySize +
+                                      field * sizeof(uint64_t));
+}
+
+absl::StatusOr<std::string_view> BlockStoreReader::Get(int64_t index) {
+  if (index < 0 || index >= num_records_) {
+    return absl::OutOfRangeError(
+        absl::StrCat("Record index ", index, " is out of range [0, ",
+                     num_records_, ")"));
+  }
+  const int64_t chunk = index / records_per_chunk_;
+  const uint64_t chunk_begin = RecordOffset(chunk * records_per_chunk_);
+  const uint64_t record_begin = RecordOffset(index);
+  const uint64_t record_end = RecordOffset(index + 1);
+  const uint64_t chunk_offset = ChunkField(chunk, 0);
+  const uint64_t stored_size = ChunkField(chunk, 1);
+  const uint64_t uncompressed_size = ChunkField(chunk, 2);
+  if (record_begin < chunk_begin || record_end < record_begin ||
+      record_end - chunk_begin > uncompressed_size ||
+      chunk_offset < kMagic.size() || chunk_offset > index_offset_ ||
+      stored_size > index_offset_ - chunk_offset) {
+    return absl::DataLossError(
+        absl::StrCat("The index of chunk ", chunk, " is corrupted"));
+  }
+  const uint64_t offset_in_chunk = record_begin - chunk_begin;
+  const uint64_t record_size = record_end - record_begin;
+
+  switch (compression_) {
+    case BlockStoreCompression::kNone:
+      if (stored_size != uncompressed_size) {
+        return absl::DataLossError(
+            absl::StrCat("The index of chunk ", chunk, " is corrupted"));
+      }
+      return std::string_view(data_ + chunk_offset + offset_in_chunk,
+                              record_size);
+    case BlockStoreCompression::kZlib:
+      if (buffered_chunk_ != chunk) {
+        buffered_chunk_ = -1;
+        chunk_buffer_.resize(uncompressed_size);
+        uLongf decompressed_size = uncompressed_size;
+        const int result = uncompress(
+            reinterpret_cast<Bytef*>(chunk_buffer_.data()), &decompressed_size,
+            reinterpret_cast<const Bytef*>(data_ + chunk_offset), stored_size);
+        if (result != Z_OK || decompressed_size != uncompressed_size) {
+          return absl::DataLossError(
+              absl::StrCat("Could not decompress chunk ", chunk));
+        }
+        buffered_chunk_ = chunk;
+      }
+      return std::string_view(chunk_buffer_.data() + offset_in_chunk,
+                              record_size);
+  }
+  return absl::InternalError("Unknown compression");
+}
+
+std::pair<int64_t, int64_t> BlockStoreReader::ShardRange(
+    int64_t shard_index, int64_t num_shards) const {
+  ABSL_CHECK_GT(num_shards, 0);
+  ABSL_CHECK_GE(shard_index, 0);
+  ABSL_CHECK_LT(shard_index, num_shards);
+  const int64_t begin_chunk = num_chunks_ * shard_index / num_shards;
+  const int64_t end_chunk = num_chunks_ * (shard_index + 1) / num_shards;
+  return {std::min(begin_chunk * records_per_chunk_, num_records_),
+          std::min(end_chunk * records_per_chunk_, num_records_)};
+}
+
+}  // namespace gematria
@@ -0,0 +1,196 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Contains a reader and a writer for the indexed block store, a file format for
+// large collections of serialized protos, typically
+// BasicBlockWithThroughputProto, that supports constant-time random access to
+// the records by their index.
+//
+// The records are grouped into chunks of a fixed number of consecutive records;
+// each chunk is stored either as is or compressed with zlib. The file has the
+// following layout:
+//   char   magic[8]
+//   byte   chunk_data[num_chunks][]
+//   struct {
+//     uint64 offset             // The offset of the chunk data in the file.
+//     uint64 stored_size        // The size of the chunk data in the file.
+//     uint64 uncompressed_size  // The total size of the records in the chunk.
+//   } chunks[num_chunks]
+//   uint64 record_offsets[num_records + 1]
+//   uint64 num_records
+//   uint64 num_chunks
+//   uint64 records_per_chunk
+//   uint64 index_offset         // The offset of chunks[0] in the file.
+//   uint32 compression          // A value of BlockStoreCompression.
+//   uint32 format_version
+//   char   magic[8]
+// where all integers are in the little-endian byte order, and
+// record_offsets[i] is the offset of record `i` in the concatenation of all
+// records in the file. Record `i` is stored in chunk i / records_per_chunk at
+// the offset record_offsets[i] - record_offsets[first record in the chunk] from
+// the beginning of the uncompressed chunk data.
+//
+// The index is stored at the end of the file, so that the writer does not need
+// to know the number of records in advance. The reader maps the file to memory,
+// and opening a file does not depend on the number of records in it.
+
+#ifndef THIRD_PARTY_GEMATRIA_GEMATRIA_IO_BLOCK_STORE_H_
+#define THIRD_PARTY_GEMATRIA_GEMATRIA_IO_BLOCK_STORE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "gematria/utils/mapped_file.h"
+
+namespace gematria {
+
+// The compression used for the chunks of an indexed block store.
+enum class BlockStoreCompression : uint32_t {
+  kNone = 0,
+  kZlib = 1,
+};
+
+struct BlockStoreWriterOptions {
+  // The compression used for the chunks of the file.
+  BlockStoreCompression compression = BlockStoreCompression::kNone;
+  // The number of records in each chunk. Larger chunks compress better, but
+  // reading a single record from a compressed file decompresses the whole
+  // chunk.
+  int64_t records_per_chunk = 1024;
+};
+
+// Writes records to an indexed block store file. The file is complete only
+// after a successful call to Close(). The writer keeps the record offset table
+// in memory, i.e. it uses 8 bytes of memory per record. The class is not
+// thread-safe.
+class BlockStoreWriter {
+ public:
+  // Creates the file `file_name` and opens it for writing. Returns an error
+  // when the file can't be created or when `options` are not valid.
+  static absl::StatusOr<std::unique_ptr<BlockStoreWriter>> Open(
+      const std::string& file_name, const BlockStoreWriterOptions& options);
+
+  // Appends a single record to the file.
+  absl::Status Write(std::string_view record);
+
+  // Writes the last chunk and the index, and closes the file. The writer can't
+  // be used after calling this method.
+  absl::Status Close();
+
+  // Returns the number of records written by this writer.
+  int64_t num_records() const {
+    return static_cast<int64_t>(record_offsets_.size()) - 1;
+  }
+
+ private:
+  BlockStoreWriter(std::ofstream output,
+                   const BlockStoreWriterOptions& options);
+
+  // Writes the records in `chunk_data_` as a new chunk.
+  absl::Status FlushChunk();
+
+  std::ofstream output_;
+  const BlockStoreWriterOptions options_;
+  bool closed_ = false;
+
+  // The offset of the end of the file written so far.
+  uint64_t file_offset_ = 0;
+  // The records of the current chunk.
+  std::string chunk_data_;
+  int64_t num_records_in_chunk_ = 0;
+  // The offset, the stored size, and the uncompressed size of each chunk, as
+  // stored in the index.
+  std::vector<uint64_t> chunk_table_;
+  std::vector<uint64_t> record_offsets_ = {0};
+};
+
+// Reads records from an indexed block store file. The file is mapped to memory,
+// and the records are read lazily when they are accessed.
+//
+// For uncompressed files, the reader is immutable and it can be used from
+// multiple threads concurrently. For compressed files, Get() decompresses the
+// chunk with the record into an internal buffer, and concurrent calls to Get()
+// must be synchronized externally.
+class BlockStoreReader {
+ public:
+  // Opens the file `file_name`. Returns an error when the file can't be opened
+  // or when it is not a valid indexed block store.
+  static absl::StatusOr<std::unique_ptr<BlockStoreReader>> Open(
+      const std::string& file_name);
+
+  ~BlockStoreReader();
+
+  BlockStoreReader(const BlockStoreReader&) = delete;
+  BlockStoreReader& operator=(const BlockStoreReader&) = delete;
+
+  // Returns the serialized record at `index`. For uncompressed files, the
+  // returned view points directly to the memory-mapped file, and it remains
+  // valid for the lifetime of the reader. For compressed files, the view points
+  // to the internal buffer, and it remains valid only until the next call to
+  // Get() that reads a record from a different chunk.
+  absl::StatusOr<std::string_view> Get(int64_t index);
+
+  // Returns the range of record indices [begin, end) assigned to shard
+  // `shard_index` out of `num_shards`. The shards are contiguous, they do not
+  // overlap, and together they cover all records in the file. Shard boundaries
+  // are aligned to chunks so that each chunk is read by a single shard.
+  std::pair<int64_t, int64_t> ShardRange(int64_t shard_index,
+                                         int64_t num_shards) const;
+
+  int64_t num_records() const { return num_records_; }
+  int64_t num_chunks() const { return num_chunks_; }
+  int64_t records_per_chunk() const { return records_per_chunk_; }
+  BlockStoreCompression compression() const { return compression_; }
+
+ private:
+  explicit BlockStoreReader(std::unique_ptr<MappedFile> file);
+
+  // Parses and validates the footer and the index of the file.
+  absl::Status Init();
+
+  // Returns the offset of record `index` from record_offsets.
+  uint64_t RecordOffset(int64_t index) const;
+  // Returns the field `field` of the chunk table entry of `chunk`.
+  uint64_t ChunkField(int64_t chunk, int field) const;
+
+  // The memory-mapped file and its contents.
+  const std::unique_ptr<MappedFile> file_;
+  const char* const data_;
+  const size_t size_;
+
+  int64_t num_records_ = 0;
+  int64_t num_chunks_ = 0;
+  int64_t records_per_chunk_ = 0;
+  BlockStoreCompression compression_ = BlockStoreCompression::kNone;
+  uint64_t index_offset_ = 0;
+  const char* chunk_table_ = nullptr;
+  const char* record_offsets_ = nullptr;
+
+  // The decompressed data of chunk `buffered_chunk_`, or -1 when no chunk was
+  // decompressed yet.
+  int64_t buffered_chunk_ = -1;
+  std::string chunk_buffer_;
+};
+
+}  // namespace gematria
+
+#endif  // THIRD_PARTY_GEMATRIA_GEMATRIA_IO_BLOCK_STORE_H_
@@ -0,0 +1,218 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "gematria/io/block_store.h"
+
+#include <cstdint>
+#include <fstream>
+#include <ios>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "gematria/testing/matchers.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace gematria {
+namespace {
+
+using ::testing::Pair;
+
+std::string TempFileName(const std::string& name) {
+  return absl::StrCat(::testing::TempDir(), "/", name);
+}
+
+std::vector<std::string> MakeRecords(int num_records) {
+  std::vector<std::string> records;
+  records.reserve(num_records);
+  for (int i = 0; i < num_records; ++i) {
+    // Use records of different lengths, including an empty one.
+    records.push_back(std::string(i % 7, static_cast<char>('a' + i % 26)));
+  }
+  return records;
+}
+
+BlockStoreWriterOptions MakeOptions(BlockStoreCompression compression,
+                                    int64_t records_per_chunk) {
+  BlockStoreWriterOptions options;
+  options.compression = compression;
+  options.records_per_chunk = records_per_chunk;
+  return options;
+}
+
+void WriteRecords(const std::string& file_name,
+                  const BlockStoreWriterOptions& options,
+                  const std::vector<std::string>& records) {
+  auto writer = BlockStoreWriter::Open(file_name, options);
+  ASSERT_OK(writer);
+  for (const std::string& record : records) {
+    ASSERT_OK((*writer)->Write(record));
+  }
+  EXPECT_EQ((*writer)->num_records(), records.size());
+  ASSERT_OK((*writer)->Close());
+}
+
+class BlockStoreTest
+    : public ::testing::TestWithParam<BlockStoreCompression> {};
+
+TEST_P(BlockStoreTest, ReadSequentially) {
+  const std::string file_name = TempFileName("read_sequentially");
+  const std::vector<std::string> records = MakeRecords(100);
+  const BlockStoreWriterOptions options = MakeOptions(GetParam(), 8);
+  ASSERT_NO_FATAL_FAILURE(WriteRecords(file_name, options, records));
+
+  auto reader = BlockStoreReader::Open(file_name);
+  ASSERT_OK(reader);
+  EXPECT_EQ((*reader)->num_records(), records.size());
+  EXPECT_EQ((*reader)->num_chunks(), 13);
+  EXPECT_EQ((*reader)->records_per_chunk(), 8);
+  EXPECT_EQ((*reader)->compression(), GetParam());
+  for (int i = 0; i < records.size(); ++i) {
+    EXPECT_THAT((*reader)->Get(i), IsOkAndHolds(records[i])) << i;
+  }
+}
+
+TEST_P(BlockStoreTest, ReadInRandomOrder) {
+  const std::string file_name = TempFileName("read_in_random_order");
+  const std::vector<std::string> records = MakeRecords(50);
+  const BlockStoreWriterOptions options = MakeOptions(GetParam(), 4);
+  ASSERT_NO_FATAL_FAILURE(WriteRecords(file_name, options, records));
+
+  auto reader = BlockStoreReader::Open(file_name);
+  ASSERT_OK(reader);
+  for (const int index : {49, 0, 17, 18, 3, 48, 17, 25}) {
+    EXPECT_THAT((*reader)->Get(index), IsOkAndHolds(records[index])) << index;
+  }
+}
+
+TEST_P(BlockStoreTest, EmptyStore) {
+  const std::string file_name = TempFileName("empty_store");
+  ASSERT_NO_FATAL_FAILURE(
+      WriteRecords(file_name, MakeOptions(GetParam(), 4), {}));
+
+  auto reader = BlockStoreReader::Open(file_name);
+  ASSERT_OK(reader);
+  EXPECT_EQ((*reader)->num_records(), 0);
+  EXPECT_EQ((*reader)->num_chunks(), 0);
+  EXPECT_THAT((*reader)->ShardRange(0, 2), Pair(0, 0));
+  EXPECT_THAT((*reader)->Get(0), StatusIs(absl::StatusCode::kOutOfRange));
+}
+
+INSTANTIATE_TEST_SUITE_P(BlockStoreTests, BlockStoreTest,
+                         ::testing::Values(BlockStoreCompression::kNone,
+                                           BlockStoreCompression::kZlib));
+
+TEST(BlockStoreReaderTest, UncompressedRecordsAreNotCopied) {
+  const std::string file_name = TempFileName("uncompressed_not_copied");
+  ASSERT_NO_FATAL_FAILURE(WriteRecords(file_name, {}, MakeRecords(10)));
+
+  auto reader = BlockStoreReader::Open(file_name);
+  ASSERT_OK(reader);
+  auto first = (*reader)->Get(1);
+  auto second = (*reader)->Get(2);
+  ASSERT_OK(first);
+  ASSERT_OK(second);
+  // The records are adjacent in the memory-mapped file.
+  EXPECT_EQ(first->data() + first->size(), second->data());
+}
+
+TEST(BlockStoreReaderTest, IndexOutOfRange) {
+  const std::string file_name = TempFileName("index_out_of_range");
+  ASSERT_NO_FATAL_FAILURE(WriteRecords(file_name, {}, MakeRecords(10)));
+
+  auto reader = BlockStoreReader::Open(file_name);
+  ASSERT_OK(reader);
+  EXPECT_THAT((*reader)->Get(-1), StatusIs(absl::StatusCode::kOutOfRange));
+  EXPECT_THAT((*reader)->Get(10), StatusIs(absl::StatusCode::kOutOfRange));
+}
+
+TEST(BlockStoreReaderTest, ShardRange) {
+  const std::string file_name = TempFileName("shard_range");
+  ASSERT_NO_FATAL_FAILURE(WriteRecords(
+      file_name, MakeOptions(BlockStoreCompression::kNone, 10),
+      MakeRecords(55)));
+
+  auto reader = BlockStoreReader::Open(file_name);
+  ASSERT_OK(reader);
+  ASSERT_EQ((*reader)->num_chunks(), 6);
+  EXPECT_THAT((*reader)->ShardRange(0, 1), Pair(0, 55));
+  EXPECT_THAT((*reader)->ShardRange(0, 4), Pair(0, 10));
+  EXPECT_THAT((*reader)->ShardRange(1, 4), Pair(10, 30));
+  EXPECT_THAT((*reader)->ShardRange(2, 4), Pair(30, 40));
+  EXPECT_THAT((*reader)->ShardRange(3, 4), Pair(40, 55));
+  // With more shards than chunks, some of the shards are empty.
+  EXPECT_THAT((*reader)->ShardRange(0, 8), Pair(0, 0));
+  EXPECT_THAT((*reader)->ShardRange(7, 8), Pair(50, 55));
+}
+
+TEST(BlockStoreReaderTest, OpenMissingFile) {
+  EXPECT_THAT(BlockStoreReader::Open("/this/file/does/not/exist"),
+              StatusIs(absl::StatusCode::kNotFound));
+}
+
+TEST(BlockStoreReaderTest, OpenInvalidFile) {
+  const std::string file_name = TempFileName("invalid_file");
+  {
+    std::ofstream output(file_name, std::ios::binary | std::ios::trunc);
+    output << std::string(100, 'x');
+  }
+  EXPECT_THAT(BlockStoreReader::Open(file_name),
+              StatusIs(absl::StatusCode::kInvalidArgument));
+}
+
+TEST(BlockStoreReaderTest, OpenTruncatedFile) {
+  const std::string file_name = TempFileName("truncated_file");
+  ASSERT_NO_FATAL_FAILURE(WriteRecords(file_name, {}, MakeRecords(10)));
+  std::string contents;
+  {
+    std::ifstream input(file_name, std::ios::binary);
+    contents.assign(std::istreambuf_iterator<char>(input), {});
+  }
+  {
+    // Remove a record from the data; the footer is still valid, but the index
+    // no longer matches the size of the file.
+    std::ofstream output(file_name, std::ios::binary | std::ios::trunc);
+    output << contents.substr(0, 10) << contents.substr(11);
+  }
+  EXPECT_THAT(BlockStoreReader::Open(file_name),
+              StatusIs(absl::StatusCode::kInvalidArgument));
+}
+
+TEST(BlockStoreWriterTest, InvalidOptions) {
+  EXPECT_THAT(BlockStoreWriter::Open(
+                  TempFileName("invalid_options"),
+                  MakeOptions(BlockStoreCompression::kNone, 0)),
+              StatusIs(absl::StatusCode::kInvalidArgument));
+}
+
+TEST(BlockStoreWriterTest, OpenInvalidFile) {
+  EXPECT_THAT(BlockStoreWriter::Open("/this/directory/does/not/exist", {}),
+              StatusIs(absl::StatusCode::kInvalidArgument));
+}
+
+TEST(BlockStoreWriterTest, WriteAfterClose) {
+  auto writer = BlockStoreWriter::Open(TempFileName("write_after_close"), {});
+  ASSERT_OK(writer);
+  ASSERT_OK((*writer)->Close());
+  EXPECT_THAT((*writer)->Write("foo"),
+              StatusIs(absl::StatusCode::kFailedPrecondition));
+  EXPECT_THAT((*writer)->Close(),
+              StatusIs(absl::StatusCode::kFailedPrecondition));
+}
+
+}  // namespace
+}  // namespace gematria
@@ -0,0 +1,151 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "gematria/io/block_store.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "absl/status/statusor.h"
+#include "pybind11/detail/common.h"
+#include "pybind11/pybind11.h"
+#include "pybind11/stl.h"
+#include "pybind11_abseil/import_status_module.h"
+#include "pybind11_abseil/status_casters.h"
+
+namespace gematria {
+
+namespace py = ::pybind11;
+
+PYBIND11_MODULE(block_store, m) {
+  m.doc() = R"(Reads and writes indexed block store files.
+
+An indexed block store contains serialized protos, typically
+BasicBlockWithThroughputProto, and supports constant-time access to the protos
+by their index. See gematria/io/block_store.h for the description of the
+format.
+
+Typical use:
+  reader = block_store.BlockStoreReader.open(filename)
+  begin, end = reader.shard_range(worker_index, num_workers)
+  for index in random.sample(range(begin, end), end - begin):
+    proto = throughput_pb2.BasicBlockWithThroughputProto.FromString(
+        reader.get(index))
+)";
+
+  py::google::ImportStatusModule();
+
+  py::enum_<BlockStoreCompression>(m, "Compression")
+      .value("NONE", BlockStoreCompression::kNone)
+      .value("ZLIB", BlockStoreCompression::kZlib)
+      .export_values();
+
+  py::class_<BlockStoreWriter>(m, "BlockStoreWriter")
+      .def_static(
+          "open",
+          [](const std::string& file_name, BlockStoreCompression compression,
+             int64_t records_per_chunk) {
+            BlockStoreWriterOptions options;
+            options.compression = compression;
+            options.records_per_chunk = records_per_chunk;
+            return BlockStoreWriter::Open(file_name, options);
+          },
+          py::arg("file_name"),
+          py::arg("compression") = BlockStoreCompression::kNone,
+          py::arg("records_per_chunk") =
+              BlockStoreWriterOptions().records_per_chunk,
+          R"(Creates a new indexed block store file.
+
+          Args:
+            file_name: The name of the file to create.
+            compression: The compression used for the chunks of the file.
+            records_per_chunk: The number of records in each chunk.
+
+          Returns:
+            A writer for the file. The file is complete only after close() is
+            called.
+
+          Raises:
+            StatusNotOk: When the file can't be created or when the options are
+              not valid.)")
+      .def(
+          "write",
+          [](BlockStoreWriter& self, py::bytes record) {
+            return self.Write(std::string_view(record));
+          },
+          py::arg("record"), R"(Appends a serialized record to the file.)")
+      .def("close", &BlockStoreWriter::Close,
+           R"(Writes the index and closes the file.)")
+      .def_property_readonly("num_records", &BlockStoreWriter::num_records);
+
+  py::class_<BlockStoreReader>(m, "BlockStoreReader")
+      .def_static("open", &BlockStoreReader::Open, py::arg("file_name"),
+                  R"(Opens an indexed block store file.
+
+          The file is mapped to memory; opening a file takes the same time
+          regardless of the number of records in it.
+
+          Raises:
+            StatusNotOk: When the file can't be opened or it is not a valid
+              indexed block store.)")
+      .def(
+          "get",
+          [](BlockStoreReader& self,
+             int64_t index) -> absl::StatusOr<py::bytes> {
+            absl::StatusOr<std::string_view> record = self.Get(index);
+            if (!record.ok()) return std::move(record).status();
+            return py::bytes(record->data(), record->size());
+          },
+          py::arg("index"),
+          R"(Returns the serialized record at `index` as a bytes object.
+
+          Raises:
+            StatusNotOk: When `index` is out of range or when the record can't
+              be read.)")
+      .def(
+          "shard_range",
+          [](const BlockStoreReader& self, int64_t shard_index,
+             int64_t num_shards) {
+            if (num_shards <= 0 || shard_index < 0 ||
+                shard_index >= num_shards) {
+              throw py::value_error(
+                  "shard_index must be in the range [0, num_shards)");
+            }
+            return self.ShardRange(shard_index, num_shards);
+          },
+          py::arg("shard_index"), py::arg("num_shards"),
+          R"(Returns the range of record indices of a shard.
+
+          The shards are contiguous, aligned to chunks, and together they cover
+          all records in the file.
+
+          Args:
+            shard_index: The index of the shard, in the range [0, num_shards).
+            num_shards: The total number of shards.
+
+          Returns:
+            A tuple (begin, end) such that the shard contains the records with
+            indices in range(begin, end).)")
+      .def("__len__", &BlockStoreReader::num_records)
+      .def_property_readonly("num_records", &BlockStoreReader::num_records)
+      .def_property_readonly("num_chunks", &BlockStoreReader::num_chunks)
+      .def_property_readonly("records_per_chunk",
+                             &BlockStoreReader::records_per_chunk)
+      .def_property_readonly("compression", &BlockStoreReader::compression);
+}
+
+}  // namespace gematria
@@ -0,0 +1,100 @@
+# Copyright 2023 Google Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#    http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+import os
+
+from absl.testing import absltest
+from absl.testing import parameterized
+from gematria.io.python import block_store
+from gematria.proto import basic_block_pb2
+from gematria.proto import throughput_pb2
+from pybind11_abseil import status
+
+
+def _make_protos(num_protos):
+  return [
+      throughput_pb2.BasicBlockWithThroughputProto(
+          basic_block=basic_block_pb2.BasicBlockProto(
+              machine_instructions=(
+                  basic_block_pb2.MachineInstructionProto(
+                      address=i, machine_code=bytes(i % 5)
+                  ),
+              )
+          )
+      )
+      for i in range(num_protos)
+  ]
+
+
+class BlockStoreTest(parameterized.TestCase):
+
+  def _write_protos(self, protos, compression, records_per_chunk):
+    filename = os.path.join(self.create_tempdir().full_path, 'blocks.store')
+    writer = block_store.BlockStoreWriter.open(
+        filename,
+        compression=compression,
+        records_per_chunk=records_per_chunk,
+    )
+    for proto in protos:
+      writer.write(proto.SerializeToString())
+    self.assertEqual(writer.num_records, len(protos))
+    writer.close()
+    return filename
+
+  @parameterized.named_parameters(
+      ('none', block_store.Compression.NONE),
+      ('zlib', block_store.Compression.ZLIB),
+  )
+  def test_read_protos(self, compression):
+    protos = _make_protos(25)
+    filename = self._write_protos(protos, compression, records_per_chunk=4)
+
+    reader = block_store.BlockStoreReader.open(filename)
+    self.assertLen(reader, len(protos))
+    self.assertEqual(reader.num_records, len(protos))
+    self.assertEqual(reader.num_chunks, 7)
+    self.assertEqual(reader.records_per_chunk, 4)
+    self.assertEqual(reader.compression, compression)
+    for index in (24, 0, 13, 12, 7):
+      proto = throughput_pb2.BasicBlockWithThroughputProto.FromString(
+          reader.get(index)
+      )
+      self.assertEqual(proto, protos[index])
+
+  def test_shard_range(self):
+    filename = self._write_protos(
+        _make_protos(10), block_store.Compression.NONE, records_per_chunk=3
+    )
+    reader = block_store.BlockStoreReader.open(filename)
+    self.assertEqual(reader.shard_range(0, 2), (0, 6))
+    self.assertEqual(reader.shard_range(1, 2), (6, 10))
+    with self.assertRaises(ValueError):
+      reader.shard_range(2, 2)
+
+  def test_index_out_of_range(self):
+    filename = self._write_protos(
+        _make_protos(3), block_store.Compression.NONE, records_per_chunk=2
+    )
+    reader = block_store.BlockStoreReader.open(filename)
+    with self.assertRaises(status.StatusNotOk):
+      reader.get(3)
+
+  def test_open_invalid_file(self):
+    filename = self.create_tempfile(content='not a block store').full_path
+    with self.assertRaises(status.StatusNotOk):
+      block_store.BlockStoreReader.open(filename)
+
+
+if __name__ == '__main__':
+  absltest.main()
@@ -0,0 +1,535 @@
+# Copyright 2023 Google Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#    http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Reads and writes data sets of pre-built basic block graphs.
+
+Building the graphs with BasicBlockGraphBuilder is a significant part of the
+cost of a training step of the graph-based models, and the graph of a basic
+block depends only on the block itself, on the token vocabulary, and on the
+version of the graph builder. The graphs can thus be built once, stored on disk,
+and then reused by all experiments that use the same vocabulary.
+
+The graphs are stored in a single uncompressed file with the following layout:
+  - an 8-byte magic string,
+  - the length of the header in bytes, as a little-endian uint64,
+  - the header, a JSON object with the metadata of the data set and the
+    locations of the columns,
+  - the columns, each of them a flat little-endian array that contains the
+    concatenated data of all graphs in the data set. Each column is aligned to
+    64 bytes from the start of the file.
+The reader maps the file to memory and assembles batches of graphs by slicing
+the columns. Only the pages that contain the requested graphs are read from
+disk.
+
+Typical use:
+  key = graph_dataset.GraphDatasetKey.for_vocabulary(...)
+  dataset = graph_dataset.GraphDataset(filename, expected_key=key)
+  arrays = dataset.graphs_tuple_arrays(block_indices)
+  graphs = graph_nets.graphs.GraphsTuple(**arrays)
+"""
+
+from collections.abc import Mapping, Sequence
+import dataclasses
+import hashlib
+import json
+import shutil
+import struct
+import tempfile
+from typing import Any, BinaryIO, Optional
+
+import numpy as np
+
+# The magic string at the beginning of each graph data set file.
+MAGIC = b'GMGRAPH\x00'
+
+# The version of the file format. Must be incremented whenever the layout of the
+# file or the meaning of the columns changes.
+FORMAT_VERSION = 1
+
+# The alignment of the columns in the file, in bytes.
+_COLUMN_ALIGNMENT = 64
+
+_HEADER_LENGTH_FORMAT = '<Q'
+_HEADER_START = len(MAGIC) + struct.calcsize(_HEADER_LENGTH_FORMAT)
+
+# The names and the dtypes of the columns stored in the file:
+#   - node_offsets, edge_offsets, global_feature_offsets: for each block, the
+#     index of its first node, edge, and global feature token in the
+#     corresponding columns. Contain one extra element at the end, so that the
+#     data of block `i` is at [offsets[i], offsets[i + 1]).
+#   - num_instructions_per_block: the number of instruction nodes of each block.
+#   - source_block_indices: for each block, its index in the input data of the
+#     writer, typically the index of the block in the source .tfrecord files.
+#   - node_features, instruction_node_mask: the features of the nodes and the
+#     instruction node mask, as in BasicBlockGraphBuilder.
+#   - edge_features: the features of the edges, as in BasicBlockGraphBuilder.
+#   - edge_senders, edge_receivers: the end points of the edges. Unlike in
+#     BasicBlockGraphBuilder, the node indices are relative to the first node of
+#     the block, so that they do not depend on the position of the block in the
+#     data set or in a batch.
+#   - global_feature_token_indices, global_feature_token_counts: the sparse
+#     global features, as in BasicBlockGraphBuilder.
+_COLUMN_DTYPES = {
+    'node_offsets': np.dtype('<i8'),
+    'edge_offsets': np.dtype('<i8'),
+    'global_feature_offsets': np.dtype('<i8'),
+    'num_instructions_per_block': np.dtype('<i4'),
+    'source_block_indices': np.dtype('<i8'),
+    'node_features': np.dtype('<i4'),
+    'instruction_node_mask': np.dtype('u1'),
+    'edge_features': np.dtype('<i4'),
+    'edge_senders': np.dtype('<i4'),
+    'edge_receivers': np.dtype('<i4'),
+    'global_feature_token_indices': np.dtype('<i4'),
+    'global_feature_token_counts': np.dtype('<i4'),
+}
+
+
+@dataclasses.dataclass(frozen=True)
+class GraphDatasetKey:
+  """Identifies the graph builder configuration used to create a data set.
+
+  Graphs can be reused only by a model that uses the same vocabulary, the same
+  special tokens, and the same version of the graph builder as the code that
+  created them.
+
+  Attributes:
+    graph_builder_version: The version of the graph builder, typically
+      graph_builder.GRAPH_BUILDER_VERSION.
+    vocabulary_hash: A hash of the vocabulary and the special tokens used by the
+      graph builder.
+  """
+
+  graph_builder_version: int
+  vocabulary_hash: str
+
+  @classmethod
+  def for_vocabulary(
+      cls,
+      graph_builder_version: int,
+      node_tokens: Sequence[str],
+      immediate_token: str,
+      fp_immediate_token: str,
+      address_token: str,
+      memory_token: str,
+      replacement_token: Optional[str],
+  ) -> 'GraphDatasetKey':
+    """Creates a key for a given graph builder configuration.
+
+    Args:
+      graph_builder_version: The version of the graph builder.
+      node_tokens: The list of node tokens, in the order used by the graph
+        builder.
+      immediate_token: The token used for immediate value nodes.
+      fp_immediate_token: The token used for floating-point immediate nodes.
+      address_token: The token used for address computation nodes.
+      memory_token: The token used for memory operand nodes.
+      replacement_token: The token used to replace out-of-vocabulary tokens, or
+        None or an empty string when the graph builder rejects blocks with such
+        tokens.
+
+    Returns:
+      The key of the configuration.
+    """
+    vocabulary = json.dumps((
+        list(node_tokens),
+        immediate_token,
+        fp_immediate_token,
+        address_token,
+        memory_token,
+        replacement_token or None,
+    ))
+    return cls(
+        graph_builder_version=graph_builder_version,
+        vocabulary_hash=hashlib.sha256(vocabulary.encode('utf-8')).hexdigest(),
+    )
+
+
+def _aligned(offset: int) -> int:
+  """Rounds `offset` up to the nearest multiple of the column alignment."""
+  return -(-offset // _COLUMN_ALIGNMENT) * _COLUMN_ALIGNMENT
+
+
+def _range_indices(starts: np.ndarray, lengths: np.ndarray) -> np.ndarray:
+  """Returns the concatenation of ranges [starts[i], starts[i] + lengths[i])."""
+  total_length = int(lengths.sum())
+  if total_length == 0:
+    return np.zeros(0, dtype=np.int64)
+  output_starts = np.cumsum(lengths) - lengths
+  return np.repeat(starts - output_starts, lengths) + np.arange(total_length)
+
+
+class _ColumnWriter:
+  """Accumulates the data of a single column in a temporary file."""
+
+  def __init__(self, dtype: np.dtype):
+    self.dtype = dtype
+    self.size = 0
+    self.file = tempfile.TemporaryFile()
+
+  def append(self, data: Any) -> None:
+    array = np.ascontiguousarray(data, dtype=self.dtype)
+    self.file.write(array.tobytes())
+    self.size += array.size
+
+
+class GraphDatasetWriter:
+  """Writes graphs from BasicBlockGraphBuilder to a graph data set file.
+
+  The column data is accumulated in temporary files, and the output file is
+  created by close(). The writer can be used as a context manager, in which case
+  close() is called when leaving the context without an exception.
+  """
+
+  def __init__(
+      self,
+      filename: str,
+      key: GraphDatasetKey,
+      num_node_tokens: int,
+      metadata: Optional[Mapping[str, Any]] = None,
+  ):
+    """Initializes the writer.
+
+    Args:
+      filename: The name of the output file.
+      key: The key of the graph builder configuration used to build the graphs.
+      num_node_tokens: The number of node tokens in the vocabulary. This is the
+        size of the dense global feature vectors.
+      metadata: Additional JSON-serializable information stored in the header
+        of the file, e.g. the names of the source files.
+    """
+    self._filename = filename
+    self._key = key
+    self._num_node_tokens = num_node_tokens
+    self._metadata = dict(metadata or {})
+    self._columns = {
+        name: _ColumnWriter(dtype) for name, dtype in _COLUMN_DTYPES.items()
+    }
+    self._num_blocks = 0
+    self._num_nodes = 0
+    self._num_edges = 0
+    self._num_global_feature_tokens = 0
+    for offsets in (
+        'node_offsets',
+        'edge_offsets',
+        'global_feature_offsets',
+    ):
+      self._columns[offsets].append((0,))
+
+  @property
+  def num_blocks(self) -> int:
+    """The number of blocks added to the writer so far."""
+    return self._num_blocks
+
+  def add_batch(self, builder: Any, source_block_indices: Sequence[int]):
+    """Adds all graphs from the current batch of a graph builder.
+
+    Args:
+      builder: A BasicBlockGraphBuilder, a GraphBatch released from it by
+        release_batch(), or any object that provides the same array properties.
+      source_block_indices: The indices of the blocks in the current batch of
+        `builder` in the input data. Must contain one index per graph in the
+        batch.
+
+    Raises:
+      ValueError: When `source_block_indices` does not match the batch or when
+        the builder uses a different vocabulary size.
+    """
+    num_nodes_per_block = np.asarray(builder.num_nodes_per_block, np.int64)
+    num_edges_per_block = np.asarray(builder.num_edges_per_block, np.int64)
+    num_blocks = num_nodes_per_block.size
+    if len(source_block_indices) != num_blocks:
+      raise ValueError(
+          f'Expected {num_blocks} source block indices, got'
+          f' {len(source_block_indices)}'
+      )
+    if builder.num_node_tokens != self._num_node_tokens:
+      raise ValueError(
+          f'Expected {self._num_node_tokens} node tokens, the graph builder'
+          f' has {builder.num_node_tokens}'
+      )
+    if num_blocks == 0:
+      return
+    num_global_feature_tokens_per_block = np.asarray(
+        builder.num_global_feature_tokens_per_block, np.int64
+    )
+
+    # Make the node indices relative to the first node of each block.
+    first_node_in_block = np.cumsum(num_nodes_per_block) - num_nodes_per_block
+    edge_node_offsets = np.repeat(first_node_in_block, num_edges_per_block)
+
+    columns = self._columns
+    columns['node_offsets'].append(
+        self._num_nodes + np.cumsum(num_nodes_per_block)
+    )
+    columns['edge_offsets'].append(
+        self._num_edges + np.cumsum(num_edges_per_block)
+    )
+    columns['global_feature_offsets'].append(
+        self._num_global_feature_tokens
+        + np.cumsum(num_global_feature_tokens_per_block)
+    )
+    columns['num_instructions_per_block'].append(
+        np.bincount(builder.delta_block_index, minlength=num_blocks)
+    )
+    columns['source_block_indices'].append(source_block_indices)
+    columns['node_features'].append(builder.node_features)
+    columns['instruction_node_mask'].append(builder.instruction_node_mask)
+    columns['edge_features'].append(builder.edge_features)
+    columns['edge_senders'].append(builder.edge_senders - edge_node_offsets)
+    columns['edge_receivers'].append(builder.edge_receivers - edge_node_offsets)
+    columns['global_feature_token_indices'].append(
+        builder.global_feature_token_indices
+    )
+    columns['global_feature_token_counts'].append(
+        builder.global_feature_token_counts
+    )
+
+    self._num_blocks += num_blocks
+    self._num_nodes += int(num_nodes_per_block.sum())
+    self._num_edges += int(num_edges_per_block.sum())
+    self._num_global_feature_tokens += int(
+        num_global_feature_tokens_per_block.sum()
+    )
+
+  def close(self) -> None:
+    """Writes the output file and releases the temporary files."""
+    # The column offsets in the header are relative to the end of the header,
+    # so that the length of the header does not depend on them.
+    column_headers = {}
+    data_size = 0
+    for name, column in self._columns.items():
+      column_headers[name] = {
+          'dtype': column.dtype.str,
+          'offset': data_size,
+          'size': column.size,
+      }
+      data_size = _aligned(data_size + column.size * column.dtype.itemsize)
+    header = json.dumps({
+        'format_version': FORMAT_VERSION,
+        'graph_builder_version': self._key.graph_builder_version,
+        'vocabulary_hash': self._key.vocabulary_hash,
+        'num_blocks': self._num_blocks,
+        'num_node_tokens': self._num_node_tokens,
+        'metadata': self._metadata,
+        'columns': column_headers,
+    }).encode('utf-8')
+
+    with open(self._filename, 'wb') as f:
+      f.write(MAGIC)
+      f.write(struct.pack(_HEADER_LENGTH_FORMAT, len(header)))
+      f.write(header)
+      data_start = _aligned(f.tell())
+      for name, column in self._columns.items():
+        _write_padding(f, data_start + column_headers[name]['offset'])
+        column.file.seek(0)
+        shutil.copyfileobj(column.file, f)
+        column.file.close()
+      # Pad the file so that empty columns at the end are still in bounds.
+      _write_padding(f, data_start + data_size)
+
+  def __enter__(self) -> 'GraphDatasetWriter':
+    return self
+
+  def __exit__(self, exc_type, exc_value, traceback) -> None:
+    if exc_type is None:
+      self.close()
+    else:
+      for column in self._columns.values():
+        column.file.close()
+
+
+def _write_padding(f: BinaryIO, position: int) -> None:
+  """Pads `f` with zero bytes up to `position`."""
+  f.write(b'\x00' * (position - f.tell()))
+
+
+class GraphDataset:
+  """A read-only, memory-mapped data set of pre-built basic block graphs."""
+
+  def __init__(
+      self, filename: str, expected_key: Optional[GraphDatasetKey] = None
+  ):
+    """Opens a graph data set file.
+
+    Args:
+      filename: The name of the file. The file must be on a file system that
+        supports memory mapping.
+      expected_key: When not None, the key that the data set must have.
+
+    Raises:
+      ValueError: When the file is not a valid graph data set, when it uses an
+        unsupported version of the format, or when its key is different from
+        `expected_key`.
+    """
+    with open(filename, 'rb') as f:
+      prefix = f.read(_HEADER_START)
+      if len(prefix) != _HEADER_START or not prefix.startswith(MAGIC):
+        raise ValueError(f'{filename} is not a graph data set file')
+      (header_length,) = struct.unpack_from(
+          _HEADER_LENGTH_FORMAT, prefix, len(MAGIC)
+      )
+      header = json.loads(f.read(header_length).decode('utf-8'))
+    if header['format_version'] != FORMAT_VERSION:
+      raise ValueError(
+          f'Unsupported graph data set format version in {filename}:'
+          f' {header["format_version"]}'
+      )
+    self._key = GraphDatasetKey(
+        graph_builder_version=header['graph_builder_version'],
+        vocabulary_hash=header['vocabulary_hash'],
+    )
+    if expected_key is not None and self._key != expected_key:
+      raise ValueError(
+          f'The graph data set in {filename} was created with {self._key},'
+          f' expected {expected_key}'
+      )
+    self._num_blocks = header['num_blocks']
+    self._num_node_tokens = header['num_node_tokens']
+    self._metadata = header['metadata']
+
+    self._data = np.memmap(filename, dtype=np.uint8, mode='r')
+    data_start = _aligned(_HEADER_START + header_length)
+    self._columns = {}
+    for name, column in header['columns'].items():
+      dtype = np.dtype(column['dtype'])
+      begin = data_start + column['offset']
+      end = begin + column['size'] * dtype.itemsize
+      if end > self._data.size:
+        raise ValueError(f'Column {name} is truncated in {filename}')
+      self._columns[name] = self._data[begin:end].view(dtype)
+    missing_columns = _COLUMN_DTYPES.keys() - self._columns.keys()
+    if missing_columns:
+      raise ValueError(
+          f'Columns {sorted(missing_columns)} are missing in {filename}'
+      )
+
+  @property
+  def key(self) -> GraphDatasetKey:
+    """The key of the graph builder configuration used to build the graphs."""
+    return self._key
+
+  @property
+  def num_blocks(self) -> int:
+    """The number of graphs in the data set."""
+    return self._num_blocks
+
+  @property
+  def num_node_tokens(self) -> int:
+    """The number of node tokens in the vocabulary of the data set."""
+    return self._num_node_tokens
+
+  @property
+  def metadata(self) -> Mapping[str, Any]:
+    """The additional metadata stored in the file by the writer."""
+    return self._metadata
+
+  @property
+  def source_block_indices(self) -> np.ndarray:
+    """The indices of the graphs in the input data of the writer."""
+    return self._columns['source_block_indices']
+
+  def _ranges(
+      self, offsets_column: str, block_indices: np.ndarray
+  ) -> tuple[np.ndarray, np.ndarray]:
+    """Returns the lengths and the element indices of the blocks' ranges."""
+    offsets = self._columns[offsets_column]
+    starts = offsets[block_indices]
+    lengths = offsets[block_indices + 1] - starts
+    return lengths, _range_indices(starts, lengths)
+
+  def graphs_tuple_arrays(
+      self,
+      block_indices: Sequence[int],
+      include_global_features: bool = True,
+      index_dtype: np.dtype = np.int32,
+  ) -> dict[str, Optional[np.ndarray]]:
+    """Returns a batch of graphs as a dict of NumPy arrays.
+
+    The arrays are the same as those returned by
+    BasicBlockGraphBuilder.graphs_tuple_arrays() after adding the blocks in the
+    same order to an empty graph builder.
+
+    Args:
+      block_indices: The indices of the graphs in the data set, in the order in
+        which they appear in the batch.
+      include_global_features: When False, the value of 'globals' is None.
+      index_dtype: The dtype of 'senders', 'receivers', 'n_node', and 'n_edge'.
+
+    Returns:
+      A dict that can be used as graph_nets.graphs.GraphsTuple(**arrays). The
+      arrays are copies of the data in the file.
+    """
+    block_indices = self._check_block_indices(block_indices)
+    num_nodes, node_indices = self._ranges('node_offsets', block_indices)
+    num_edges, edge_indices = self._ranges('edge_offsets', block_indices)
+
+    edge_node_offsets = np.repeat(
+        np.cumsum(num_nodes) - num_nodes, num_edges
+    ).astype(index_dtype)
+    columns = self._columns
+    arrays = {
+        'nodes': columns['node_features'][node_indices].astype(np.int32),
+        'edges': columns['edge_features'][edge_indices].astype(np.int32),
+        'globals': None,
+        'senders': (
+            columns['edge_senders'][edge_indices].astype(index_dtype)
+            + edge_node_offsets
+        ),
+        'receivers': (
+            columns['edge_receivers'][edge_indices].astype(index_dtype)
+            + edge_node_offsets
+        ),
+        'n_node': num_nodes.astype(index_dtype),
+        'n_edge': num_edges.astype(index_dtype),
+    }
+    if include_global_features:
+      num_tokens, token_indices = self._ranges(
+          'global_feature_offsets', block_indices
+      )
+      global_features = np.zeros(
+          (block_indices.size, self._num_node_tokens), dtype=np.int32
+      )
+      global_features[
+          np.repeat(np.arange(block_indices.size), num_tokens),
+          columns['global_feature_token_indices'][token_indices],
+      ] = columns['global_feature_token_counts'][token_indices]
+      arrays['globals'] = global_features
+    return arrays
+
+  def instruction_node_mask(self, block_indices: Sequence[int]) -> np.ndarray:
+    """Returns the instruction node mask of a batch of graphs."""
+    block_indices = self._check_block_indices(block_indices)
+    _, node_indices = self._ranges('node_offsets', block_indices)
+    return self._columns['instruction_node_mask'][node_indices].astype(bool)
+
+  def delta_block_index(self, block_indices: Sequence[int]) -> np.ndarray:
+    """Returns the index of the block of each instruction in a batch."""
+    block_indices = self._check_block_indices(block_indices)
+    return np.repeat(
+        np.arange(block_indices.size, dtype=np.int32),
+        self._columns['num_instructions_per_block'][block_indices],
+    )
+
+  def _check_block_indices(self, block_indices: Sequence[int]) -> np.ndarray:
+    block_indices = np.asarray(block_indices, dtype=np.int64)
+    if block_indices.ndim != 1:
+      raise ValueError('block_indices must be a one-dimensional sequence')
+    if block_indices.size and (
+        block_indices.min() < 0 or block_indices.max() >= self._num_blocks
+    ):
+      raise ValueError(
+          f'Block indices must be in the range [0, {self._num_blocks})'
+      )
+    return block_indices
@@ -0,0 +1,187 @@
+# Copyright 2023 Google Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#    http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+import os
+
+from absl.testing import absltest
+from gematria.basic_block.python import tokens
+from gematria.granite.python import graph_builder
+from gematria.io.python import graph_dataset
+from gematria.model.python import oov_token_behavior
+from gematria.testing.python import basic_blocks_with_throughput
+import numpy as np
+
+_OutOfVocabularyTokenBehavior = oov_token_behavior.OutOfVocabularyTokenBehavior
+
+
+class GraphDatasetTest(
+    basic_blocks_with_throughput.TestCase, absltest.TestCase
+):
+
+  def setUp(self):
+    self.num_blocks = 10
+    super().setUp()
+    self.key = graph_dataset.GraphDatasetKey.for_vocabulary(
+        graph_builder_version=graph_builder.GRAPH_BUILDER_VERSION,
+        node_tokens=self.tokens,
+        immediate_token=tokens.IMMEDIATE,
+        fp_immediate_token=tokens.IMMEDIATE,
+        address_token=tokens.ADDRESS,
+        memory_token=tokens.MEMORY,
+        replacement_token=None,
+    )
+
+  def _create_builder(self):
+    return graph_builder.BasicBlockGraphBuilder(
+        node_tokens=self.tokens,
+        immediate_token=tokens.IMMEDIATE,
+        fp_immediate_token=tokens.IMMEDIATE,
+        address_token=tokens.ADDRESS,
+        memory_token=tokens.MEMORY,
+        out_of_vocabulary_behavior=_OutOfVocabularyTokenBehavior.return_error(),
+    )
+
+  def _write_dataset(self, batch_size):
+    filename = os.path.join(self.create_tempdir().full_path, 'graphs.bin')
+    builder = self._create_builder()
+    with graph_dataset.GraphDatasetWriter(
+        filename,
+        self.key,
+        num_node_tokens=builder.num_node_tokens,
+        metadata={'source': 'test'},
+    ) as writer:
+      for batch_start in range(0, len(self.blocks), batch_size):
+        builder.reset()
+        batch = self.blocks[batch_start : batch_start + batch_size]
+        for block in batch:
+          self.assertTrue(builder.add_basic_block(block))
+        writer.add_batch(builder, range(batch_start, batch_start + len(batch)))
+      self.assertEqual(writer.num_blocks, len(self.blocks))
+    return filename
+
+  def test_round_trip(self):
+    filename = self._write_dataset(batch_size=3)
+    dataset = graph_dataset.GraphDataset(filename, expected_key=self.key)
+    self.assertEqual(dataset.key, self.key)
+    self.assertEqual(dataset.num_blocks, len(self.blocks))
+    self.assertEqual(dataset.num_node_tokens, len(self.tokens))
+    self.assertEqual(dataset.metadata, {'source': 'test'})
+    np.testing.assert_array_equal(
+        dataset.source_block_indices, range(len(self.blocks))
+    )
+
+    # The graphs from the data set must be the same as the graphs created by a
+    # graph builder from the same blocks in the same order.
+    block_indices = (7, 2, 2, 9, 0, 5)
+    builder = self._create_builder()
+    for block_index in block_indices:
+      self.assertTrue(builder.add_basic_block(self.blocks[block_index]))
+    expected_arrays = builder.graphs_tuple_arrays()
+    arrays = dataset.graphs_tuple_arrays(block_indices)
+    self.assertCountEqual(arrays.keys(), expected_arrays.keys())
+    for name, expected_array in expected_arrays.items():
+      np.testing.assert_array_equal(arrays[name], expected_array, err_msg=name)
+    np.testing.assert_array_equal(
+        dataset.instruction_node_mask(block_indices),
+        builder.instruction_node_mask,
+    )
+    np.testing.assert_array_equal(
+        dataset.delta_block_index(block_indices), builder.delta_block_index
+    )
+
+  def test_add_released_batch(self):
+    filename = self._write_dataset(batch_size=4)
+    released_filename = os.path.join(
+        self.create_tempdir().full_path, 'released_graphs.bin'
+    )
+    builder = self._create_builder()
+    with graph_dataset.GraphDatasetWriter(
+        released_filename, self.key, num_node_tokens=builder.num_node_tokens
+    ) as writer:
+      for batch_start in range(0, len(self.blocks), 4):
+        batch = self.blocks[batch_start : batch_start + 4]
+        for block in batch:
+          self.assertTrue(builder.add_basic_block(block))
+        writer.add_batch(
+            builder.release_batch(),
+            range(batch_start, batch_start + len(batch)),
+        )
+
+    dataset = graph_dataset.GraphDataset(filename, expected_key=self.key)
+    released_dataset = graph_dataset.GraphDataset(
+        released_filename, expected_key=self.key
+    )
+    self.assertEqual(released_dataset.num_blocks, len(self.blocks))
+    block_indices = range(len(self.blocks))
+    expected_arrays = dataset.graphs_tuple_arrays(block_indices)
+    arrays = released_dataset.graphs_tuple_arrays(block_indices)
+    for name, expected_array in expected_arrays.items():
+      np.testing.assert_array_equal(arrays[name], expected_array, err_msg=name)
+
+  def test_graphs_tuple_arrays_options(self):
+    filename = self._write_dataset(batch_size=len(self.blocks))
+    dataset = graph_dataset.GraphDataset(filename)
+
+    arrays = dataset.graphs_tuple_arrays(
+        (1, 3), include_global_features=False, index_dtype=np.int64
+    )
+    self.assertIsNone(arrays['globals'])
+    for name in ('senders', 'receivers', 'n_node', 'n_edge'):
+      self.assertEqual(arrays[name].dtype, np.int64, name)
+
+    arrays = dataset.graphs_tuple_arrays(())
+    self.assertEmpty(arrays['nodes'])
+    self.assertEqual(arrays['globals'].shape, (0, len(self.tokens)))
+
+  def test_empty_dataset(self):
+    filename = os.path.join(self.create_tempdir().full_path, 'graphs.bin')
+    with graph_dataset.GraphDatasetWriter(
+        filename, self.key, num_node_tokens=len(self.tokens)
+    ):
+      pass
+    dataset = graph_dataset.GraphDataset(filename)
+    self.assertEqual(dataset.num_blocks, 0)
+    self.assertEmpty(dataset.graphs_tuple_arrays(())['n_node'])
+
+  def test_block_index_out_of_range(self):
+    filename = self._write_dataset(batch_size=len(self.blocks))
+    dataset = graph_dataset.GraphDataset(filename)
+    with self.assertRaises(ValueError):
+      dataset.graphs_tuple_arrays((len(self.blocks),))
+    with self.assertRaises(ValueError):
+      dataset.delta_block_index((-1,))
+
+  def test_key_mismatch(self):
+    filename = self._write_dataset(batch_size=len(self.blocks))
+    other_key = graph_dataset.GraphDatasetKey.for_vocabulary(
+        graph_builder_version=graph_builder.GRAPH_BUILDER_VERSION,
+        node_tokens=self.tokens,
+        immediate_token=tokens.IMMEDIATE,
+        fp_immediate_token=tokens.IMMEDIATE,
+        address_token=tokens.ADDRESS,
+        memory_token=tokens.MEMORY,
+        replacement_token=tokens.UNKNOWN,
+    )
+    self.assertNotEqual(self.key, other_key)
+    with self.assertRaises(ValueError):
+      graph_dataset.GraphDataset(filename, expected_key=other_key)
+
+  def test_not_a_graph_dataset(self):
+    filename = self.create_tempfile(content='not a graph data set').full_path
+    with self.assertRaises(ValueError):
+      graph_dataset.GraphDataset(filename)
+
+
+if __name__ == '__main__':
+  absltest.main()
@@ -0,0 +1,241 @@
+# Copyright 2023 Google Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#    http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+"""Splits input data between the workers of a data-parallel training job.
+
+In data-parallel training, each worker replica runs its own input pipeline.
+The functions in this module assign a disjoint part of the input data to each
+worker, using only the index of the worker and the total number of workers, so
+that no coordination between the workers is needed:
+  - read_sharded_protos() splits .tfrecord files between the workers. When there
+    are at least as many files as workers, each worker reads only its files;
+    otherwise, each worker reads all files and keeps every N-th record.
+  - shard_range() splits a range of record indices into contiguous parts.
+  - epoch_permutation() shuffles records deterministically per epoch, so that
+    all workers and all restarts of a worker see the same order.
+  - graph_dataset_batches() serves batches of pre-built graphs from a shard of a
+    graph data set (see graph_dataset.py). The data set is memory-mapped, so
+    the workers on the same host share a single copy of the graphs in the page
+    cache, and no worker needs to build graphs in Python.
+
+Typical use in a worker:
+  shard = sharding.Shard(index=task_id, num_shards=num_workers)
+  dataset = graph_dataset.GraphDataset(filename, expected_key=key)
+  for epoch in itertools.count():
+    for block_indices in sharding.graph_dataset_batches(
+        dataset, shard, epoch=epoch, seed=seed, max_blocks_in_batch=100
+    ):
+      arrays = dataset.graphs_tuple_arrays(block_indices)
+      ...
+"""
+
+from collections.abc import Iterable, Iterator, Sequence
+import dataclasses
+import itertools
+from typing import Optional, Type
+
+from gematria.io.python import graph_dataset
+from gematria.io.python import tfrecord
+import numpy as np
+
+
+@dataclasses.dataclass(frozen=True)
+class Shard:
+  """Identifies the part of the input data used by a single worker.
+
+  Attributes:
+    index: The index of the worker, in the range [0, num_shards).
+    num_shards: The total number of workers.
+  """
+
+  index: int = 0
+  num_shards: int = 1
+
+  def __post_init__(self):
+    if self.num_shards < 1:
+      raise ValueError(f'num_shards must be positive, was {self.num_shards}')
+    if not 0 <= self.index < self.num_shards:
+      raise ValueError(
+          f'The shard index must be in the range [0, {self.num_shards}), was'
+          f' {self.index}'
+      )
+
+
+def shard_filenames(filenames: Sequence[str], shard: Shard) -> Sequence[str]:
+  """Returns the files assigned to `shard` when sharding by files.
+
+  The files are assigned to the shards in a round-robin fashion, in the order in
+  which they appear in `filenames`.
+
+  Args:
+    filenames: The list of all input files.
+    shard: The shard for which the files are returned.
+
+  Returns:
+    The files assigned to the shard. Empty when there are fewer files than
+    shards and the shard index is greater or equal to the number of files.
+  """
+  return filenames[shard.index :: shard.num_shards]
+
+
+def shard_range(
+    num_records: int, shard: Shard, drop_remainder: bool = False
+) -> range:
+  """Returns the contiguous range of record indices assigned to `shard`.
+
+  The ranges of all shards are disjoint and they cover [0, num_records). Their
+  sizes differ by at most one; the first `num_records % num_shards` shards get
+  one extra record.
+
+  Args:
+    num_records: The total number of records.
+    shard: The shard for which the range is returned.
+    drop_remainder: When True, all shards get exactly
+      `num_records // num_shards` records, and the remaining records are not
+      assigned to any shard. This keeps the number of training steps the same
+      on all workers, as needed by synchronous training.
+
+  Returns:
+    The range of record indices of the shard.
+  """
+  base_size, remainder = divmod(num_records, shard.num_shards)
+  if drop_remainder:
+    start = shard.index * base_size
+    return range(start, start + base_size)
+  start = shard.index * base_size + min(shard.index, remainder)
+  size = base_size + (1 if shard.index < remainder else 0)
+  return range(start, start + size)
+
+
+def epoch_permutation(num_records: int, seed: int, epoch: int) -> np.ndarray:
+  """Returns a deterministic permutation of [0, num_records) for an epoch.
+
+  The permutation depends only on `seed` and `epoch`, so all workers that use
+  the same seed compute the same permutation without communicating, and a
+  worker restarted from a checkpoint can continue with the same order.
+
+  Args:
+    num_records: The number of records to permute.
+    seed: The random seed of the training job.
+    epoch: The index of the epoch.
+
+  Returns:
+    A permutation of [0, num_records) as an int64 array.
+  """
+  rng = np.random.default_rng((seed, epoch))
+  return rng.permutation(num_records)
+
+
+def read_sharded_records(
+    filenames: Sequence[str], shard: Shard
+) -> Iterable[bytes]:
+  """Reads the raw records assigned to `shard` from `filenames`.
+
+  The records are assigned to the shards in the same way as in
+  read_sharded_protos().
+
+  Args:
+    filenames: The list of input .tfrecord files.
+    shard: The shard for which the records are read.
+
+  Yields:
+    The records assigned to the shard, in the order in which they appear in the
+    input files.
+  """
+  if isinstance(filenames, str):
+    filenames = (filenames,)
+  if len(filenames) >= shard.num_shards:
+    yield from tfrecord.read_records(shard_filenames(filenames, shard))
+    return
+  yield from itertools.islice(
+      tfrecord.read_records(filenames),
+      shard.index,
+      None,
+      shard.num_shards,
+  )
+
+
+def read_sharded_protos(
+    filenames: Sequence[str],
+    proto_class: Type[tfrecord.Proto],
+    shard: Shard,
+) -> Iterable[tfrecord.Proto]:
+  """Reads the protos assigned to `shard` from `filenames`.
+
+  When there are at least as many files as shards, the files are assigned to the
+  shards using shard_filenames(), and each worker reads only its own files.
+  Otherwise, each worker reads all files and keeps the records whose index in
+  the concatenation of all files is `shard.index` modulo `shard.num_shards`.
+  In both cases, the protos read by different shards are disjoint, and together
+  they contain all protos in `filenames`.
+
+  Args:
+    filenames: The list of input .tfrecord files.
+    proto_class: The class of the protos to parse from the files.
+    shard: The shard for which the protos are read.
+
+  Yields:
+    The protos assigned to the shard, in the order in which they appear in the
+    input files.
+  """
+  for raw_record in read_sharded_records(filenames, shard):
+    yield proto_class.FromString(raw_record)
+
+
+def graph_dataset_batches(
+    dataset: graph_dataset.GraphDataset,
+    shard: Shard,
+    epoch: int,
+    seed: int,
+    max_blocks_in_batch: int,
+    shuffle: bool = True,
+    drop_remainder: bool = True,
+) -> Iterator[np.ndarray]:
+  """Yields batches of block indices from `shard` of a graph data set.
+
+  The blocks of the data set are first shuffled with the permutation for
+  `epoch` that is shared by all shards, and then split into contiguous ranges
+  using shard_range(). Each shard thus sees a different random subset of the
+  data set in each epoch, and the subsets of all shards in the same epoch are
+  disjoint.
+
+  Args:
+    dataset: The graph data set.
+    shard: The shard for which the batches are returned.
+    epoch: The index of the epoch.
+    seed: The random seed used for shuffling. Must be the same on all workers.
+    max_blocks_in_batch: The maximal number of blocks in a batch. Must be
+      positive.
+    shuffle: When False, the blocks are not shuffled and each shard gets the
+      same contiguous range of blocks in each epoch.
+    drop_remainder: When True, all shards get the same number of blocks, and
+      thus the same number of batches; see shard_range().
+
+  Yields:
+    Arrays of block indices, one per batch, that can be passed to the methods of
+    `dataset`, e.g. dataset.graphs_tuple_arrays().
+  """
+  if max_blocks_in_batch < 1:
+    raise ValueError(
+        f'max_blocks_in_batch must be positive, was {max_blocks_in_batch}'
+    )
+  block_order: Optional[np.ndarray] = None
+  if shuffle:
+    block_order = epoch_permutation(dataset.num_blocks, seed, epoch)
+  indices = shard_range(dataset.num_blocks, shard, drop_remainder)
+  for begin in range(indices.start, indices.stop, max_blocks_in_batch):
+    end = min(begin + max_blocks_in_batch, indices.stop)
+    if block_order is None:
+      yield np.arange(begin, end, dtype=np.int64)
+    else:
+      yield block_order[begin:end]
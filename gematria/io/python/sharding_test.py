@@ -0,0 +1,216 @@
+# Copyright 2023 Google Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#    http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+from os import path
+
+from absl.testing import parameterized
+from gematria.io.python import sharding
+from gematria.io.python import tfrecord
+from gematria.proto import canonicalized_instruction_pb2
+import numpy as np
+import tensorflow as tf
+
+_CanonicalizedInstructionProto = (
+    canonicalized_instruction_pb2.CanonicalizedInstructionProto
+)
+
+
+class _FakeGraphDataset:
+  """Provides the part of the GraphDataset API used by the sharding module."""
+
+  def __init__(self, num_blocks):
+    self.num_blocks = num_blocks
+
+
+class ShardTest(tf.test.TestCase):
+
+  def test_valid(self):
+    shard = sharding.Shard(index=2, num_shards=3)
+    self.assertEqual(shard.index, 2)
+    self.assertEqual(shard.num_shards, 3)
+
+  def test_invalid(self):
+    with self.assertRaises(ValueError):
+      sharding.Shard(index=0, num_shards=0)
+    with self.assertRaises(ValueError):
+      sharding.Shard(index=3, num_shards=3)
+    with self.assertRaises(ValueError):
+      sharding.Shard(index=-1, num_shards=3)
+
+
+class ShardRangeTest(parameterized.TestCase, tf.test.TestCase):
+
+  @parameterized.parameters((10, 3), (9, 3), (2, 5), (0, 4), (17, 1))
+  def test_ranges_cover_all_records(self, num_records, num_shards):
+    ranges = [
+        sharding.shard_range(num_records, sharding.Shard(index, num_shards))
+        for index in range(num_shards)
+    ]
+    all_indices = [i for r in ranges for i in r]
+    self.assertSequenceEqual(all_indices, range(num_records))
+    sizes = [len(r) for r in ranges]
+    self.assertLessEqual(max(sizes) - min(sizes), 1)
+
+  def test_ranges(self):
+    self.assertSequenceEqual(
+        [
+            sharding.shard_range(10, sharding.Shard(index, 3))
+            for index in range(3)
+        ],
+        [range(0, 4), range(4, 7), range(7, 10)],
+    )
+
+  def test_drop_remainder(self):
+    self.assertSequenceEqual(
+        [
+            sharding.shard_range(
+                10, sharding.Shard(index, 3), drop_remainder=True
+            )
+            for index in range(3)
+        ],
+        [range(0, 3), range(3, 6), range(6, 9)],
+    )
+
+
+class EpochPermutationTest(tf.test.TestCase):
+
+  def test_is_deterministic(self):
+    first = sharding.epoch_permutation(100, seed=1, epoch=2)
+    second = sharding.epoch_permutation(100, seed=1, epoch=2)
+    np.testing.assert_array_equal(first, second)
+    self.assertCountEqual(first, range(100))
+
+  def test_depends_on_epoch_and_seed(self):
+    permutation = sharding.epoch_permutation(100, seed=1, epoch=2)
+    self.assertFalse(
+        np.array_equal(
+            permutation, sharding.epoch_permutation(100, seed=1, epoch=3)
+        )
+    )
+    self.assertFalse(
+        np.array_equal(
+            permutation, sharding.epoch_permutation(100, seed=2, epoch=2)
+        )
+    )
+
+
+class ReadShardedProtosTest(parameterized.TestCase, tf.test.TestCase):
+
+  def _write_files(self, num_files, num_protos_per_file):
+    output_dir = self.create_tempdir().full_path
+    filenames = []
+    protos = []
+    for file_index in range(num_files):
+      file_protos = [
+          _CanonicalizedInstructionProto(mnemonic=f'I{file_index}_{i}')
+          for i in range(num_protos_per_file)
+      ]
+      filename = path.join(output_dir, f'{file_index}.tfrecord')
+      tfrecord.write_protos(filename, file_protos)
+      filenames.append(filename)
+      protos.extend(file_protos)
+    return filenames, protos
+
+  @parameterized.named_parameters(
+      ('more files than shards', 5, 2),
+      ('same number of files and shards', 3, 3),
+      ('fewer files than shards', 2, 3),
+  )
+  def test_shards_are_disjoint(self, num_files, num_shards):
+    filenames, protos = self._write_files(num_files, 4)
+    sharded_protos = [
+        list(
+            sharding.read_sharded_protos(
+                filenames,
+                _CanonicalizedInstructionProto,
+                sharding.Shard(index, num_shards),
+            )
+        )
+        for index in range(num_shards)
+    ]
+    for shard_protos in sharded_protos:
+      self.assertNotEmpty(shard_protos)
+    self.assertCountEqual(
+        [proto.mnemonic for shard in sharded_protos for proto in shard],
+        [proto.mnemonic for proto in protos],
+    )
+
+  def test_sharding_by_records(self):
+    filenames, _ = self._write_files(1, 5)
+    protos = sharding.read_sharded_protos(
+        filenames, _CanonicalizedInstructionProto, sharding.Shard(1, 2)
+    )
+    self.assertSequenceEqual(
+        [proto.mnemonic for proto in protos], ('I0_1', 'I0_3')
+    )
+
+  def test_read_sharded_records(self):
+    filenames, protos = self._write_files(1, 5)
+    records = sharding.read_sharded_records(filenames, sharding.Shard(0, 2))
+    self.assertSequenceEqual(
+        list(records),
+        [protos[i].SerializeToString() for i in (0, 2, 4)],
+    )
+
+
+class GraphDatasetBatchesTest(tf.test.TestCase):
+
+  def test_without_shuffling(self):
+    dataset = _FakeGraphDataset(10)
+    batches = sharding.graph_dataset_batches(
+        dataset,
+        sharding.Shard(1, 3),
+        epoch=0,
+        seed=0,
+        max_blocks_in_batch=2,
+        shuffle=False,
+    )
+    self.assertSequenceEqual(
+        [batch.tolist() for batch in batches], [[3, 4], [5]]
+    )
+
+  def test_shuffled_shards_are_disjoint(self):
+    dataset = _FakeGraphDataset(100)
+    num_shards = 4
+    for epoch in range(3):
+      epoch_blocks = []
+      for index in range(num_shards):
+        batches = list(
+            sharding.graph_dataset_batches(
+                dataset,
+                sharding.Shard(index, num_shards),
+                epoch=epoch,
+                seed=123,
+                max_blocks_in_batch=10,
+            )
+        )
+        self.assertLen(batches, 3)
+        epoch_blocks.extend(block for batch in batches for block in batch)
+      self.assertCountEqual(epoch_blocks, range(100))
+
+  def test_invalid_batch_size(self):
+    with self.assertRaises(ValueError):
+      next(
+          sharding.graph_dataset_batches(
+              _FakeGraphDataset(10),
+              sharding.Shard(),
+              epoch=0,
+              seed=0,
+              max_blocks_in_batch=0,
+          )
+      )
+
+
+if __name__ == '__main__':
+  tf.test.main()
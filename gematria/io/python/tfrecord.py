@@ -23,6 +23,28 @@ import tensorflow.compat.v1 as tf
 Proto = TypeVar('Proto', bound=message.Message)
 
 
+def read_records(filenames: Sequence[str]) -> Iterable[bytes]:
+  """Reads the raw records from `filenames`.
+
+  Args:
+    filenames: A single file name or a list of file names to read.
+
+  Yields:
+    The contents of the records in the order in which they appear in the files.
+
+  Raises:
+    tf.errors.OpError: On input/output errors.
+  """
+  if isinstance(filenames, str):
+    # NOTE(ondrasej): In Python, `str` is also an `Iterable[str]` (it iterates
+    # over all characters of the string). Since the type checker would not stop
+    # us when passing a single file name instead of a collection, we just fix it
+    # and do what the user expects.
+    filenames = (filenames,)
+  for filename in filenames:
+    yield from tf.io.tf_record_iterator(filename)
+
+
 def read_protos(
     filenames: Sequence[str], proto_class: Type[Proto]
 ) -> Iterable[Proto]:
@@ -42,15 +64,8 @@ def read_protos(
     tf.errors.OpError: On input/output errors.
     DecodeError: When a record in the input files can't be parsed as `Proto`.
   """
-  if isinstance(filenames, str):
-    # NOTE(ondrasej): In Python, `str` is also an `Iterable[str]` (it iterates
-    # over all characters of the string). Since the type checker would not stop
-    # us when passing a single file name instead of a collection, we just fix it
-    # and do what the user expects.
-    filenames = (filenames,)
-  for filename in filenames:
-    for raw_record in tf.io.tf_record_iterator(filename):
-      yield proto_class.FromString(raw_record)
+  for raw_record in read_records(filenames):
+    yield proto_class.FromString(raw_record)
 
 
 def write_protos(filename: str, protos: Iterable[Proto]) -> None:
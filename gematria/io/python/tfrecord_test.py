@@ -123,6 +123,17 @@ class ReadProtosTest(tf.test.TestCase):
     )
     self.assertSequenceEqual(loaded_protos, _TEST_INSTRUCTIONS)
 
+  def test_read_records(self):
+    input_dir = self.create_tempdir()
+    input_filename = path.join(input_dir, 'input.tfrecord')
+    tfrecord.write_protos(input_filename, _TEST_INSTRUCTIONS)
+
+    loaded_records = tuple(tfrecord.read_records(input_filename))
+    self.assertSequenceEqual(
+        loaded_records,
+        [proto.SerializeToString() for proto in _TEST_INSTRUCTIONS],
+    )
+
   def test_read_file_that_does_not_exist(self):
     input_dir = self.create_tempdir()
     input_filename = path.join(input_dir.full_path, 'input.tfrecord')
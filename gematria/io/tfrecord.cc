@@ -0,0 +1,109 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "gematria/io/tfrecord.h"
+
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "absl/log/die_if_null.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+
+namespace gematria {
+namespace {
+
+// The reversed Castagnoli polynomial.
+constexpr uint32_t kCrc32cPolynomial = 0x82f63b78u;
+
+constexpr std::array<uint32_t, 256> MakeCrc32cTable() {
+  std::array<uint32_t, 256> table = {};
+  for (uint32_t i = 0; i < 256; ++i) {
+    uint32_t crc = i;
+    for (int bit = 0; bit < 8; ++bit) {
+      crc = (crc & 1) ? (crc >> 1) ^ kCrc32cPolynomial : crc >> 1;
+    }
+    table[i] = crc;
+  }
+  return table;
+}
+
+constexpr std::array<uint32_t, 256> kCrc32cTable = MakeCrc32cTable();
+
+// Encodes `value` in the little-endian byte order into `buffer`.
+template <typename IntType>
+void EncodeLittleEndian(IntType value, char* buffer) {
+  for (size_t i = 0; i < sizeof(IntType); ++i) {
+    buffer[i] = static_cast<char>((value >> (8 * i)) & 0xff);
+  }
+}
+
+}  // namespace
+
+uint32_t Crc32c(std::string_view data) {
+  uint32_t crc = 0xffffffffu;
+  for (const char c : data) {
+    crc = kCrc32cTable[(crc ^ static_cast<uint8_t>(c)) & 0xff] ^ (crc >> 8);
+  }
+  return crc ^ 0xffffffffu;
+}
+
+absl::StatusOr<std::unique_ptr<TFRecordWriter>> TFRecordWriter::Open(
+    const std::string& file_name) {
+  auto output = std::make_unique<std::ofstream>(
+      file_name, std::ios::binary | std::ios::out | std::ios::trunc);
+  if (!output->is_open()) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Could not open file for writing: ", file_name));
+  }
+  return std::unique_ptr<TFRecordWriter>(new TFRecordWriter(std::move(output)));
+}
+
+TFRecordWriter::TFRecordWriter(std::ostream* output)
+    : output_(*ABSL_DIE_IF_NULL(output)) {}
+
+TFRecordWriter::TFRecordWriter(std::unique_ptr<std::ofstream> output)
+    : owned_output_(std::move(output)), output_(*owned_output_) {}
+
+absl::Status TFRecordWriter::Write(std::string_view record) {
+  char header[sizeof(uint64_t) + sizeof(uint32_t)];
+  EncodeLittleEndian<uint64_t>(record.size(), header);
+  EncodeLittleEndian<uint32_t>(
+      MaskCrc32c(Crc32c(std::string_view(header, sizeof(uint64_t)))),
+      header + sizeof(uint64_t));
+  char footer[sizeof(uint32_t)];
+  EncodeLittleEndian<uint32_t>(MaskCrc32c(Crc32c(record)), footer);
+
+  output_.write(header, sizeof(header));
+  output_.write(record.data(), record.size());
+  output_.write(footer, sizeof(footer));
+  if (!output_) return absl::InternalError("Writing the record failed");
+  ++num_records_;
+  return absl::OkStatus();
+}
+
+absl::Status TFRecordWriter::Flush() {
+  output_.flush();
+  if (!output_) return absl::InternalError("Flushing the output failed");
+  return absl::OkStatus();
+}
+
+}  // namespace gematria
@@ -0,0 +1,83 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Contains a minimal writer for the TFRecord file format used by TensorFlow, so
+// that C++ tools can produce data sets that are readable by the Python code
+// (via tf.data.TFRecordDataset or gematria.io.python.tfrecord) without
+// depending on TensorFlow.
+//
+// Each record in the file is stored as:
+//   uint64 length
+//   uint32 masked CRC-32C of length
+//   byte   data[length]
+//   uint32 masked CRC-32C of data
+// where all integers are in the little-endian byte order.
+
+#ifndef THIRD_PARTY_GEMATRIA_GEMATRIA_IO_TFRECORD_H_
+#define THIRD_PARTY_GEMATRIA_GEMATRIA_IO_TFRECORD_H_
+
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+
+namespace gematria {
+
+// Computes the CRC-32C (Castagnoli) checksum of `data`.
+uint32_t Crc32c(std::string_view data);
+
+// Returns the masked version of `crc`, as used in the TFRecord format.
+inline uint32_t MaskCrc32c(uint32_t crc) {
+  return ((crc >> 15) | (crc << 17)) + 0xa282ead8u;
+}
+
+// Writes records to an output stream in the TFRecord format. The class is not
+// thread-safe; concurrent calls to Write() must be synchronized externally.
+class TFRecordWriter {
+ public:
+  // Opens the file `file_name` for writing. Returns an error when the file
+  // can't be opened.
+  static absl::StatusOr<std::unique_ptr<TFRecordWriter>> Open(
+      const std::string& file_name);
+
+  // Creates a writer that writes to `output`. Does not take ownership of the
+  // stream, and the stream must remain valid for the lifetime of the writer.
+  explicit TFRecordWriter(std::ostream* output);
+
+  // Appends a single record to the output.
+  absl::Status Write(std::string_view record);
+
+  // Flushes the output stream and returns an error when any of the previous
+  // writes failed.
+  absl::Status Flush();
+
+  // Returns the number of records written by this writer.
+  int64_t num_records() const { return num_records_; }
+
+ private:
+  explicit TFRecordWriter(std::unique_ptr<std::ofstream> output);
+
+  std::unique_ptr<std::ofstream> owned_output_;
+  std::ostream& output_;
+  int64_t num_records_ = 0;
+};
+
+}  // namespace gematria
+
+#endif  // THIRD_PARTY_GEMATRIA_GEMATRIA_IO_TFRECORD_H_
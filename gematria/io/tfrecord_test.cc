@@ -0,0 +1,75 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "gematria/io/tfrecord.h"
+
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <string_view>
+
+#include "gematria/testing/matchers.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace gematria {
+namespace {
+
+uint64_t DecodeLittleEndian(std::string_view bytes) {
+  uint64_t value = 0;
+  for (int i = bytes.size() - 1; i >= 0; --i) {
+    value = (value << 8) | static_cast<uint8_t>(bytes[i]);
+  }
+  return value;
+}
+
+TEST(Crc32cTest, KnownValues) {
+  EXPECT_EQ(Crc32c(""), 0u);
+  EXPECT_EQ(Crc32c("a"), 0xc1d04330u);
+  EXPECT_EQ(Crc32c("123456789"), 0xe3069283u);
+  EXPECT_EQ(Crc32c(std::string(32, '\0')), 0x8a9136aau);
+}
+
+TEST(TFRecordWriterTest, WriteRecords) {
+  std::ostringstream output;
+  TFRecordWriter writer(&output);
+  EXPECT_OK(writer.Write("foo"));
+  EXPECT_OK(writer.Write(""));
+  EXPECT_OK(writer.Flush());
+  EXPECT_EQ(writer.num_records(), 2);
+
+  const std::string data = output.str();
+  ASSERT_EQ(data.size(), (8 + 4 + 3 + 4) + (8 + 4 + 0 + 4));
+
+  const std::string_view first_record(data.data(), 19);
+  EXPECT_EQ(DecodeLittleEndian(first_record.substr(0, 8)), 3);
+  EXPECT_EQ(DecodeLittleEndian(first_record.substr(8, 4)),
+            MaskCrc32c(Crc32c(first_record.substr(0, 8))));
+  EXPECT_EQ(first_record.substr(12, 3), "foo");
+  EXPECT_EQ(DecodeLittleEndian(first_record.substr(15, 4)),
+            MaskCrc32c(Crc32c("foo")));
+
+  const std::string_view second_record(data.data() + 19, 16);
+  EXPECT_EQ(DecodeLittleEndian(second_record.substr(0, 8)), 0);
+  EXPECT_EQ(DecodeLittleEndian(second_record.substr(12, 4)),
+            MaskCrc32c(Crc32c("")));
+}
+
+TEST(TFRecordWriterTest, OpenInvalidFile) {
+  EXPECT_THAT(TFRecordWriter::Open("/this/directory/does/not/exist"),
+              StatusIs(absl::StatusCode::kInvalidArgument));
+}
+
+}  // namespace
+}  // namespace gematria
@@ -16,12 +16,16 @@
 
 #include <cstdint>
 #include <memory>
+#include <string>
+#include <string_view>
 #include <utility>
 #include <vector>
 
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
+#include "absl/container/flat_hash_set.h"
 #include "absl/strings/str_cat.h"
+#include "absl/types/span.h"
 #include "gematria/llvm/diagnostics.h"
 #include "llvm/include/llvm/BinaryFormat/ELF.h"
 #include "llvm/include/llvm/IR/InlineAsm.h"
@@ -29,6 +33,7 @@
 #include "llvm/include/llvm/MC/MCDirectives.h"
 #include "llvm/include/llvm/MC/MCInst.h"
 #include "llvm/include/llvm/MC/MCObjectFileInfo.h"
+#include "llvm/include/llvm/MC/MCParser/AsmLexer.h"
 #include "llvm/include/llvm/MC/MCParser/MCAsmParser.h"
 #include "llvm/include/llvm/MC/MCParser/MCTargetAsmParser.h"
 #include "llvm/include/llvm/MC/MCSection.h"
@@ -42,6 +47,7 @@
 #include "llvm/include/llvm/Support/MemoryBuffer.h"
 #include "llvm/include/llvm/Support/SMLoc.h"
 #include "llvm/include/llvm/Support/SourceMgr.h"
+#include "llvm/include/llvm/Support/raw_ostream.h"
 #include "llvm/include/llvm/Target/TargetMachine.h"
 
 namespace gematria {
@@ -67,6 +73,14 @@ class MCInstStreamer : public llvm::MCStreamer {
 
   std::vector<llvm::MCInst> Get() && { return std::move(instructions_); }
 
+  // Returns the instructions collected so far and clears the internal list, so
+  // that the streamer can be used for the next input.
+  std::vector<llvm::MCInst> Take() {
+    std::vector<llvm::MCInst> instructions = std::move(instructions_);
+    instructions_.clear();
+    return instructions;
+  }
+
  private:
   // We only care about instructions, we don't implement this part of the API.
   void emitCommonSymbol(llvm::MCSymbol* symbol, uint64_t size,
@@ -86,8 +100,163 @@ class MCInstStreamer : public llvm::MCStreamer {
   llvm::MCSectionELF* const section_;
 };
 
+// A streamer used by AsmParserSession. In addition to collecting instructions,
+// it keeps labels undefined in the MCContext so that the next input may define
+// them again. Redefinitions within a single input are still reported as errors.
+class SessionMCInstStreamer : public MCInstStreamer {
+ public:
+  using MCInstStreamer::MCInstStreamer;
+
+  void emitLabel(llvm::MCSymbol* symbol, llvm::SMLoc loc) override {
+    if (!labels_in_current_input_.insert(symbol).second) {
+      getContext().reportError(loc, absl::StrCat("symbol '",
+                                                 std::string(symbol->getName()),
+                                                 "' is already defined"));
+    }
+  }
+
+  void StartNextInput() { labels_in_current_input_.clear(); }
+
+ private:
+  absl::flat_hash_set<const llvm::MCSymbol*> labels_in_current_input_;
+};
+
+// The maximal number of inputs parsed with a single parser state. Each input
+// adds a source buffer to the source manager and possibly new symbols to the
+// context, so we re-create the state periodically to keep memory usage bounded.
+constexpr int kMaxInputsPerParserState = 4096;
+
 }  // namespace
 
+struct AsmParserSession::ParserState {
+  ParserState(const llvm::TargetMachine& target_machine,
+              llvm::InlineAsm::AsmDialect dialect,
+              std::unique_ptr<llvm::MemoryBuffer> buffer)
+      : errors_os(errors) {
+    // The MCAsmParser reads the main buffer when it is created, so the first
+    // buffer must be in the source manager before the parser is created.
+    source_manager.AddNewSourceBuffer(std::move(buffer), llvm::SMLoc());
+    num_inputs = 1;
+
+    mc_context = std::make_unique<llvm::MCContext>(
+        target_machine.getTargetTriple(), target_machine.getMCAsmInfo(),
+        target_machine.getMCRegisterInfo(),
+        target_machine.getMCSubtargetInfo(), &source_manager, &options);
+    object_file_info.initMCObjectFileInfo(*mc_context, /*PIC*/ true);
+    mc_context->setObjectFileInfo(&object_file_info);
+    mc_context->setDiagnosticHandler(
+        [this](const llvm::SMDiagnostic& diag, bool, const llvm::SourceMgr&,
+               std::vector<const llvm::MDNode*>&) {
+          diag.print(nullptr, errors_os);
+        });
+
+    streamer = std::make_unique<SessionMCInstStreamer>(mc_context.get());
+    asm_parser.reset(llvm::createMCAsmParser(source_manager, *mc_context,
+                                             *streamer,
+                                             *target_machine.getMCAsmInfo()));
+    asm_parser->setAssemblerDialect(dialect);
+    target_asm_parser.reset(target_machine.getTarget().createMCAsmParser(
+        *target_machine.getMCSubtargetInfo(), *asm_parser,
+        *target_machine.getMCInstrInfo(), options));
+    if (target_asm_parser != nullptr) {
+      asm_parser->setTargetParser(*target_asm_parser);
+    }
+  }
+
+  // Adds `buffer` to the source manager and points the lexer to it.
+  void AddBuffer(std::unique_ptr<llvm::MemoryBuffer> buffer) {
+    const llvm::StringRef contents = buffer->getBuffer();
+    source_manager.AddNewSourceBuffer(std::move(buffer), llvm::SMLoc());
+    static_cast<llvm::AsmLexer&>(asm_parser->getLexer()).setBuffer(contents);
+    ++num_inputs;
+  }
+
+  // The members are destroyed in the reverse order of declaration; objects
+  // that refer to other objects must be declared after them.
+  llvm::SourceMgr source_manager;
+  llvm::MCTargetOptions options;
+  std::unique_ptr<llvm::MCContext> mc_context;
+  llvm::MCObjectFileInfo object_file_info;
+  std::unique_ptr<SessionMCInstStreamer> streamer;
+  std::unique_ptr<llvm::MCAsmParser> asm_parser;
+  std::unique_ptr<llvm::MCTargetAsmParser> target_asm_parser;
+
+  std::string errors;
+  llvm::raw_string_ostream errors_os;
+
+  // The number of inputs added to `source_manager`.
+  int num_inputs = 0;
+};
+
+AsmParserSession::AsmParserSession(const llvm::TargetMachine& target_machine,
+                                   llvm::InlineAsm::AsmDialect dialect)
+    : target_machine_(target_machine), dialect_(dialect) {}
+
+AsmParserSession::~AsmParserSession() = default;
+
+void AsmParserSession::PrepareParser(
+    std::unique_ptr<llvm::MemoryBuffer> buffer) {
+  if (state_ != nullptr && state_->num_inputs < kMaxInputsPerParserState) {
+    state_->AddBuffer(std::move(buffer));
+    return;
+  }
+  state_ = std::make_unique<ParserState>(target_machine_, dialect_,
+                                         std::move(buffer));
+  ++num_parser_initializations_;
+}
+
+absl::StatusOr<std::vector<llvm::MCInst>> AsmParserSession::ParseAsmCode(
+    std::string_view assembly) {
+  // Errors may be caused by state left over from previous inputs, e.g. by a
+  // macro defined in one of them. To return the same result as a fresh parser,
+  // we retry at most once with a new parser state after a failure.
+  while (true) {
+    // We copy the input to the source buffer because the source manager keeps
+    // the buffers until the state is re-created.
+    PrepareParser(llvm::MemoryBuffer::getMemBufferCopy(assembly));
+    const bool is_fresh_state = state_->num_inputs == 1;
+    if (state_->target_asm_parser == nullptr) {
+      state_.reset();
+      return absl::InternalError("cannot create target asm parser");
+    }
+    state_->errors.clear();
+    state_->streamer->StartNextInput();
+    // We do not finalize the streamer; it would check that all local labels
+    // referenced by the code in the context are defined.
+    const bool failed = state_->asm_parser->Run(/*NoInitialTextSection=*/false,
+                                               /*NoFinalize=*/true);
+    if (!failed) return state_->streamer->Take();
+
+    // The context keeps the error state, and the parser may be in the middle
+    // of a macro or a conditional block. The state can't be reused.
+    const std::string errors = state_->errors_os.str();
+    state_.reset();
+    if (is_fresh_state) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("cannot parse asm file:\n", errors));
+    }
+  }
+}
+
+std::vector<absl::StatusOr<std::vector<llvm::MCInst>>>
+AsmParserSession::ParseAsmCodeBatch(
+    absl::Span<const std::string_view> assemblies) {
+  std::vector<absl::StatusOr<std::vector<llvm::MCInst>>> results;
+  results.reserve(assemblies.size());
+  for (const std::string_view assembly : assemblies) {
+    results.push_back(ParseAsmCode(assembly));
+  }
+  return results;
+}
+
+std::vector<absl::StatusOr<std::vector<llvm::MCInst>>> ParseAsmCodeBatch(
+    const llvm::TargetMachine& target_machine,
+    absl::Span<const std::string_view> assemblies,
+    llvm::InlineAsm::AsmDialect dialect) {
+  AsmParserSession session(target_machine, dialect);
+  return session.ParseAsmCodeBatch(assemblies);
+}
+
 absl::StatusOr<std::vector<llvm::MCInst>> ParseAsmCodeFromBuffer(
     const llvm::TargetMachine& target_machine,
     std::unique_ptr<llvm::MemoryBuffer> buffer,
@@ -20,6 +20,7 @@
 #include <vector>
 
 #include "absl/status/statusor.h"
+#include "absl/types/span.h"
 #include "llvm/include/llvm/IR/InlineAsm.h"
 #include "llvm/include/llvm/MC/MCInst.h"
 #include "llvm/include/llvm/Support/MemoryBuffer.h"
@@ -41,6 +42,67 @@ absl::StatusOr<std::vector<llvm::MCInst>> ParseAsmCodeFromBuffer(
     std::unique_ptr<llvm::MemoryBuffer> buffer,
     llvm::InlineAsm::AsmDialect dialect);
 
+// Parses assembly code from many small inputs while reusing the LLVM MC objects
+// (the MCContext, the object file info, the streamer and the parsers) between
+// them. Creating these objects is typically much more expensive than parsing a
+// short snippet, so a session should be used whenever a large number of inputs
+// is parsed with the same target machine and dialect.
+//
+// Each input is parsed independently: labels defined in one input can be
+// defined again in another input, and an input that fails to parse does not
+// affect the following ones. Unlike ParseAsmCodeFromString(), references to
+// local labels that are not defined in the input are not reported as errors.
+// The LLVM objects are re-created after an error and periodically to bound the
+// memory used by the source buffers and symbols of past inputs.
+//
+// The session keeps a reference to the target machine; the target machine must
+// outlive the session. The class is not thread-safe.
+class AsmParserSession {
+ public:
+  AsmParserSession(const llvm::TargetMachine& target_machine,
+                   llvm::InlineAsm::AsmDialect dialect);
+  ~AsmParserSession();
+
+  AsmParserSession(const AsmParserSession&) = delete;
+  AsmParserSession& operator=(const AsmParserSession&) = delete;
+
+  // Parses a single input. The semantics is the same as that of
+  // ParseAsmCodeFromString(), with the exceptions described in the class
+  // comment.
+  absl::StatusOr<std::vector<llvm::MCInst>> ParseAsmCode(
+      std::string_view assembly);
+
+  // Parses all inputs in `assemblies`. Returns a vector that contains the
+  // result for each input, in the same order as the inputs.
+  std::vector<absl::StatusOr<std::vector<llvm::MCInst>>> ParseAsmCodeBatch(
+      absl::Span<const std::string_view> assemblies);
+
+  // The number of times the LLVM objects were created by this session. Exposed
+  // for testing and monitoring.
+  int num_parser_initializations() const { return num_parser_initializations_; }
+
+ private:
+  struct ParserState;
+
+  // Creates a new parser state for `buffer`, or adds `buffer` to the existing
+  // state when it can be reused.
+  void PrepareParser(std::unique_ptr<llvm::MemoryBuffer> buffer);
+
+  const llvm::TargetMachine& target_machine_;
+  const llvm::InlineAsm::AsmDialect dialect_;
+
+  std::unique_ptr<ParserState> state_;
+  int num_parser_initializations_ = 0;
+};
+
+// Parses all inputs in `assemblies` using a single AsmParserSession. Returns a
+// vector that contains the result for each input, in the same order as the
+// inputs.
+std::vector<absl::StatusOr<std::vector<llvm::MCInst>>> ParseAsmCodeBatch(
+    const llvm::TargetMachine& target_machine,
+    absl::Span<const std::string_view> assemblies,
+    llvm::InlineAsm::AsmDialect dialect);
+
 }  // namespace gematria
 
 #endif  // THIRD_PARTY_GEMATRIA_GEMATRIA_LLVM_ASM_PARSER_H_
@@ -18,6 +18,7 @@
 #include <memory>
 #include <tuple>
 #include <type_traits>
+#include <vector>
 
 #include "absl/status/status.h"
 #include "gematria/llvm/llvm_architecture_support.h"
@@ -34,6 +35,7 @@ namespace gematria {
 namespace {
 
 using ::testing::ElementsAre;
+using ::testing::SizeIs;
 
 class AsmParserTest : public testing::Test {
  protected:
@@ -91,5 +93,84 @@ TEST_F(AsmParserTest, AssemblyFailure) {
   EXPECT_THAT(result, StatusIs(absl::StatusCode::kInvalidArgument));
 }
 
+TEST_F(AsmParserTest, SessionReusesParser) {
+  AsmParserSession session(llvm_x86_->target_machine(),
+                           llvm::InlineAsm::AD_Intel);
+  EXPECT_THAT(session.ParseAsmCode("xor eax, eax"),
+              IsOkAndHolds(ElementsAre(HasOpcode(llvm::X86::XOR32rr))));
+  EXPECT_THAT(session.ParseAsmCode("add eax, 1\nxor eax, eax"),
+              IsOkAndHolds(ElementsAre(HasOpcode(llvm::X86::ADD32ri8),
+                                       HasOpcode(llvm::X86::XOR32rr))));
+  EXPECT_THAT(session.ParseAsmCode(""), IsOkAndHolds(SizeIs(0)));
+  EXPECT_EQ(session.num_parser_initializations(), 1);
+}
+
+TEST_F(AsmParserTest, SessionAllowsLabelsInMultipleInputs) {
+  static constexpr std::string_view kAssembly = R"asm(
+    .LBB0_1:
+    add eax, 1
+    jne .LBB0_1
+  )asm";
+  AsmParserSession session(llvm_x86_->target_machine(),
+                           llvm::InlineAsm::AD_Intel);
+  EXPECT_THAT(session.ParseAsmCode(kAssembly), IsOkAndHolds(SizeIs(2)));
+  EXPECT_THAT(session.ParseAsmCode(kAssembly), IsOkAndHolds(SizeIs(2)));
+  EXPECT_EQ(session.num_parser_initializations(), 1);
+}
+
+TEST_F(AsmParserTest, SessionDetectsLabelRedefinitionInOneInput) {
+  static constexpr std::string_view kAssembly = R"asm(
+    foo:
+    add eax, 1
+    foo:
+  )asm";
+  AsmParserSession session(llvm_x86_->target_machine(),
+                           llvm::InlineAsm::AD_Intel);
+  EXPECT_THAT(session.ParseAsmCode(kAssembly),
+              StatusIs(absl::StatusCode::kInvalidArgument));
+}
+
+TEST_F(AsmParserTest, SessionRecoversFromErrors) {
+  AsmParserSession session(llvm_x86_->target_machine(),
+                           llvm::InlineAsm::AD_ATT);
+  EXPECT_THAT(session.ParseAsmCode("xorl %eax, %eax"),
+              IsOkAndHolds(ElementsAre(HasOpcode(llvm::X86::XOR32rr))));
+  EXPECT_THAT(session.ParseAsmCode("this is not valid assembly"),
+              StatusIs(absl::StatusCode::kInvalidArgument));
+  EXPECT_THAT(session.ParseAsmCode("xorl %eax, %eax"),
+              IsOkAndHolds(ElementsAre(HasOpcode(llvm::X86::XOR32rr))));
+}
+
+TEST_F(AsmParserTest, SessionIgnoresStateFromPreviousInputs) {
+  // The macro is defined in the context of the session. Defining it again in
+  // the second input is an error unless the second input is parsed with a
+  // fresh parser.
+  static constexpr std::string_view kAssembly = R"asm(
+    .macro clear reg
+    xorl \reg, \reg
+    .endm
+    clear %eax
+  )asm";
+  AsmParserSession session(llvm_x86_->target_machine(),
+                           llvm::InlineAsm::AD_ATT);
+  EXPECT_THAT(session.ParseAsmCode(kAssembly),
+              IsOkAndHolds(ElementsAre(HasOpcode(llvm::X86::XOR32rr))));
+  EXPECT_THAT(session.ParseAsmCode(kAssembly),
+              IsOkAndHolds(ElementsAre(HasOpcode(llvm::X86::XOR32rr))));
+}
+
+TEST_F(AsmParserTest, ParseAsmCodeBatch) {
+  const std::vector<std::string_view> assemblies = {
+      "xor eax, eax", "this is not valid assembly", "add eax, 1"};
+  const auto results = ParseAsmCodeBatch(llvm_x86_->target_machine(),
+                                         assemblies, llvm::InlineAsm::AD_Intel);
+  EXPECT_THAT(results,
+              ElementsAre(IsOkAndHolds(ElementsAre(
+                              HasOpcode(llvm::X86::XOR32rr))),
+                          StatusIs(absl::StatusCode::kInvalidArgument),
+                          IsOkAndHolds(ElementsAre(
+                              HasOpcode(llvm::X86::ADD32ri8)))));
+}
+
 }  // namespace
 }  // namespace gematria
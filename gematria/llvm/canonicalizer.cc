@@ -14,11 +14,20 @@
 
 #include "gematria/llvm/canonicalizer.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <optional>
 #include <string>
 #include <string_view>
+#include <tuple>
+#include <utility>
+#include <vector>
 
 #include "gematria/basic_block/basic_block.h"
+#include "gematria/utils/instrumentation.h"
 #include "llvm/include/llvm/ADT/ArrayRef.h"
 #include "llvm/include/llvm/ADT/SmallVector.h"
 #include "llvm/include/llvm/MC/MCInst.h"
@@ -33,6 +42,14 @@
 namespace gematria {
 namespace {
 
+// Returns true when `instruction` has at least one `expr` operand.
+bool HasExprOperands(const llvm::MCInst& instruction) {
+  for (const llvm::MCOperand& operand : instruction) {
+    if (operand.isExpr()) return true;
+  }
+  return false;
+}
+
 // Replace `expr` operands in the instructions. The canonicalization of operands
 // and the instruction printer used to get the prefix of the instruction can't
 // handle them without additional information.
@@ -59,28 +76,59 @@ void ReplaceExprOperands(llvm::MCInst& instruction) {
 Canonicalizer::Canonicalizer(const llvm::TargetMachine* target_machine)
     : target_machine_(*target_machine) {
   assert(target_machine != nullptr);
+  const llvm::MCRegisterInfo& register_info =
+      *target_machine_.getMCRegisterInfo();
+  register_names_.reserve(register_info.getNumRegs());
+  for (unsigned reg = 0; reg < register_info.getNumRegs(); ++reg) {
+    register_names_.emplace_back(register_info.getName(reg));
+  }
 }
 
 Canonicalizer::~Canonicalizer() = default;
 
-Instruction Canonicalizer::InstructionFromMCInst(llvm::MCInst mcinst) const {
-  ReplaceExprOperands(mcinst);
-  return PlatformSpecificInstructionFromMCInst(mcinst);
+Instruction Canonicalizer::InstructionFromMCInst(
+    const llvm::MCInst& mcinst) const {
+  ScopedInstrumentationTimer timer(
+      InstrumentationStage::kInstructionFromMCInst);
+  AddToInstrumentationCounter(
+      InstrumentationCounter::kInstructionsCanonicalized);
+  // Most instructions do not have expression operands; copy only those that
+  // need to be modified.
+  if (!HasExprOperands(mcinst)) {
+    return PlatformSpecificInstructionFromMCInst(mcinst);
+  }
+  llvm::MCInst mcinst_without_exprs = mcinst;
+  ReplaceExprOperands(mcinst_without_exprs);
+  return PlatformSpecificInstructionFromMCInst(mcinst_without_exprs);
 }
 
 BasicBlock Canonicalizer::BasicBlockFromMCInst(
     llvm::ArrayRef<llvm::MCInst> mcinsts) const {
   BasicBlock block;
+  block.instructions.reserve(mcinsts.size());
   for (const llvm::MCInst& mcinst : mcinsts) {
     block.instructions.push_back(InstructionFromMCInst(mcinst));
   }
+  AssignMemoryAliasGroups(block.instructions);
   return block;
 }
 
-std::string Canonicalizer::GetRegisterNameOrEmpty(
+std::vector<BasicBlock> Canonicalizer::BasicBlocksFromMCInsts(
+    llvm::ArrayRef<std::vector<llvm::MCInst>> blocks) const {
+  std::vector<BasicBlock> basic_blocks;
+  basic_blocks.reserve(blocks.size());
+  for (const std::vector<llvm::MCInst>& mcinsts : blocks) {
+    basic_blocks.push_back(BasicBlockFromMCInst(mcinsts));
+  }
+  return basic_blocks;
+}
+
+const std::string& Canonicalizer::GetRegisterNameOrEmpty(
     const llvm::MCOperand& operand) const {
   assert(operand.isReg());
-  return target_machine_.getMCRegisterInfo()->getName(operand.getReg());
+  const unsigned reg = operand.getReg();
+  assert(reg < register_names_.size());
+  return register_names_[reg];
 }
 
 namespace {
@@ -101,22 +149,47 @@ llvm::SmallVector<std::string_view, 2> SplitByAny(std::string_view str,
   return tokens;
 }
 
+// Returns the size of a memory access in bytes, based on the size keyword that
+// precedes the memory operand in the Intel syntax, e.g. "qword ptr [rax]".
+// Returns 0 when there is no memory operand or when the keyword does not
+// determine the size, e.g. for "opaque ptr".
+int GetX86MemoryAccessSize(std::string_view assembly_code) {
+  static constexpr std::pair<std::string_view, int> kSizeKeywords[] = {
+      {"byte", 1},   {"word", 2},     {"dword", 4},    {"fword", 6},
+      {"qword", 8},  {"tbyte", 10},   {"xmmword", 16}, {"ymmword", 32},
+      {"zmmword", 64}};
+  static constexpr std::string_view kPtrKeyword = " ptr ";
+  const size_t ptr_pos = assembly_code.find(kPtrKeyword);
+  if (ptr_pos == std::string_view::npos) return 0;
+  const size_t separator_pos = assembly_code.find_last_of(" \t,", ptr_pos - 1);
+  const size_t keyword_pos =
+      separator_pos == std::string_view::npos ? 0 : separator_pos + 1;
+  const std::string_view keyword =
+      assembly_code.substr(keyword_pos, ptr_pos - keyword_pos);
+  for (const auto& [size_keyword, size] : kSizeKeywords) {
+    if (keyword == size_keyword) return size;
+  }
+  return 0;
+}
+
 void AddX86VendorMnemonicAndPrefixes(
     llvm::MCInstPrinter& printer, const llvm::MCSubtargetInfo& subtarget_info,
-    const llvm::MCInst& mcinst, Instruction& instruction) {
+    const llvm::MCInst& mcinst, std::string& mnemonic,
+    std::vector<std::string>& prefixes, int& memory_access_size) {
   constexpr const char* kKnownPrefixes[] = {"REP", "LOCK", "REPNE", "REPE"};
 
   std::string assembly_code;
   llvm::raw_string_ostream stream(assembly_code);
   printer.printInst(&mcinst, 0, "", subtarget_info, stream);
   stream.flush();
+  memory_access_size = GetX86MemoryAccessSize(assembly_code);
 
   auto tokens = SplitByAny(assembly_code, "\t\r\n ");
   assert(!tokens.empty());
 
   // If there is only one token, we treat it as the mnemonic no matter what.
   if (tokens.size() == 1) {
-    instruction.mnemonic = tokens[0];
+    mnemonic = tokens[0];
     return;
   }
 
@@ -128,13 +201,13 @@ void AddX86VendorMnemonicAndPrefixes(
         std::find(std::begin(kKnownPrefixes), std::end(kKnownPrefixes),
                   uppercased_token) != std::end(kKnownPrefixes);
     if (is_known_prefix) {
-      instruction.prefixes.push_back(std::move(uppercased_token));
+      prefixes.push_back(std::move(uppercased_token));
     } else {
-      instruction.mnemonic = std::move(uppercased_token);
+      mnemonic = std::move(uppercased_token);
       break;
     }
   }
-  assert(!instruction.mnemonic.empty());
+  assert(!mnemonic.empty());
 }
 
 int GetX86MemoryOperandPosition(const llvm::MCInstrDesc& descriptor) {
@@ -146,77 +219,376 @@ int GetX86MemoryOperandPosition(const llvm::MCInstrDesc& descriptor) {
          static_cast<int>(llvm::X86II::getOperandBias(descriptor));
 }
 
+// Returns true when `llvm_mnemonic` is a bit test instruction with a memory
+// operand and a register bit offset. These instructions may access memory
+// outside of the addressed operand, e.g. `BT QWORD PTR [RAX], RCX` reads the
+// quadword that contains bit RCX of the bit string starting at RAX.
+bool IsX86BitTestWithRegisterOffset(std::string_view llvm_mnemonic) {
+  return llvm_mnemonic.size() > 4 && llvm_mnemonic.substr(0, 2) == "BT" &&
+         llvm_mnemonic.substr(llvm_mnemonic.size() - 2) == "mr";
+}
+
+// Returns true when `instruction` has at least one memory operand.
+bool HasMemoryOperands(const Instruction& instruction) {
+  const auto is_memory = [](const InstructionOperand& operand) {
+    return operand.type() == OperandType::kMemory;
+  };
+  return std::any_of(instruction.input_operands.begin(),
+                     instruction.input_operands.end(), is_memory) ||
+         std::any_of(instruction.output_operands.begin(),
+                     instruction.output_operands.end(), is_memory);
+}
+
+// Replaces the alias group of all memory operands of `instruction`.
+void SetMemoryAliasGroup(int alias_group_id, Instruction& instruction) {
+  for (std::vector<InstructionOperand>* const operands :
+       {&instruction.input_operands, &instruction.output_operands}) {
+    for (InstructionOperand& operand : *operands) {
+      if (operand.type() == OperandType::kMemory) {
+        operand = InstructionOperand::MemoryLocation(alias_group_id);
+      }
+    }
+  }
+}
+
+// The placeholder used in mnemonic cache keys for immediate values that do not
+// fit into eight bits. Such values never change the printed mnemonic.
+constexpr int64_t kWideImmediatePlaceholder =
+    std::numeric_limits<int64_t>::min();
+
 }  // namespace
 
-X86Canonicalizer::X86Canonicalizer(const llvm::TargetMachine* target_machine)
-    : Canonicalizer(target_machine) {
+X86Canonicalizer::X86Canonicalizer(const llvm::TargetMachine* target_machine,
+                                   MemoryAliasAnalysis memory_alias_analysis)
+    : Canonicalizer(target_machine),
+      memory_alias_analysis_(memory_alias_analysis) {
   static constexpr int kIntelSyntax = 1;
   const llvm::Target& target = target_machine->getTarget();
   mcinst_printer_.reset(target.createMCInstPrinter(
       target_machine_.getTargetTriple(), kIntelSyntax,
       *target_machine_.getMCAsmInfo(), *target_machine_.getMCInstrInfo(),
       *target_machine_.getMCRegisterInfo()));
+
+  const llvm::MCRegisterInfo& register_info =
+      *target_machine_.getMCRegisterInfo();
+  register_operands_.reserve(register_info.getNumRegs());
+  for (unsigned reg = 0; reg < register_info.getNumRegs(); ++reg) {
+    register_operands_.push_back(
+        InstructionOperand::Register(register_info.getName(reg)));
+  }
+  const unsigned num_opcodes =
+      target_machine_.getMCInstrInfo()->getNumOpcodes();
+  if (memory_alias_analysis_ == MemoryAliasAnalysis::kAddressBased) {
+    register_numbers_.reserve(register_info.getNumRegs());
+    for (unsigned reg = 1; reg < register_info.getNumRegs(); ++reg) {
+      register_numbers_.emplace(register_info.getName(reg), reg);
+    }
+    memory_access_sizes_.resize(num_opcodes, 0);
+  }
+  opcode_templates_.resize(num_opcodes);
 }
 
 X86Canonicalizer::~X86Canonicalizer() = default;
 
 Instruction X86Canonicalizer::PlatformSpecificInstructionFromMCInst(
     const llvm::MCInst& mcinst) const {
+  const OpcodeTemplate& opcode_template = GetOpcodeTemplate(mcinst.getOpcode());
+
+  Instruction instruction;
+  instruction.llvm_mnemonic = opcode_template.llvm_mnemonic;
+  const MnemonicAndPrefixes& mnemonic_and_prefixes =
+      GetMnemonicAndPrefixes(mcinst, opcode_template.memory_operand_index);
+  instruction.mnemonic = mnemonic_and_prefixes.mnemonic;
+  instruction.prefixes = mnemonic_and_prefixes.prefixes;
+  if (memory_alias_analysis_ == MemoryAliasAnalysis::kAddressBased &&
+      opcode_template.memory_operand_index >= 0) {
+    memory_access_sizes_[mcinst.getOpcode()] =
+        mnemonic_and_prefixes.memory_access_size;
+  }
+
+  instruction.input_operands = opcode_template.memory_input_operands;
+  instruction.output_operands = opcode_template.memory_output_operands;
+  for (const ExplicitOperand& operand : opcode_template.explicit_operands) {
+    AddOperand(mcinst, /*operand_index=*/operand.operand_index,
+               /*is_output_operand=*/operand.is_output_operand,
+               /*is_address_computation_tuple=*/
+               operand.is_address_computation_tuple,
+               instruction);
+  }
+
+  instruction.implicit_output_operands =
+      opcode_template.implicit_output_operands;
+  instruction.implicit_input_operands = opcode_template.implicit_input_operands;
+
+  return instruction;
+}
+
+const X86Canonicalizer::OpcodeTemplate& X86Canonicalizer::GetOpcodeTemplate(
+    unsigned opcode) const {
   // NOTE(ondrasej): For now, we assume that all memory references are aliased.
   // This is an overly conservative but safe choice. Note that Ithemal chose the
   // other extreme where no two memory accesses are aliased - we may want to
   // support this use case too.
   constexpr int kWholeMemoryAliasGroup = 1;
 
-  const llvm::MCRegisterInfo& register_info =
-      *target_machine_.getMCRegisterInfo();
+  assert(opcode < opcode_templates_.size());
+  std::unique_ptr<const OpcodeTemplate>& cached = opcode_templates_[opcode];
+  if (cached != nullptr) return *cached;
+
   const llvm::MCInstrInfo& instr_info = *target_machine_.getMCInstrInfo();
+  const llvm::MCInstrDesc& descriptor = instr_info.get(opcode);
 
-  Instruction instruction;
-  instruction.llvm_mnemonic =
-      target_machine_.getMCInstrInfo()->getName(mcinst.getOpcode());
-  AddX86VendorMnemonicAndPrefixes(*mcinst_printer_,
-                                  *target_machine_.getMCSubtargetInfo(), mcinst,
-                                  instruction);
+  auto opcode_template = std::make_unique<OpcodeTemplate>();
+  opcode_template->llvm_mnemonic = instr_info.getName(opcode);
+  opcode_template->memory_operand_index =
+      GetX86MemoryOperandPosition(descriptor);
 
-  const llvm::MCInstrDesc& descriptor = instr_info.get(mcinst.getOpcode());
   if (descriptor.mayLoad()) {
-    instruction.input_operands.push_back(
+    opcode_template->memory_input_operands.push_back(
         InstructionOperand::MemoryLocation(kWholeMemoryAliasGroup));
   }
   if (descriptor.mayStore()) {
-    instruction.output_operands.push_back(
+    opcode_template->memory_output_operands.push_back(
         InstructionOperand::MemoryLocation(kWholeMemoryAliasGroup));
   }
 
-  const int memory_operand_index = GetX86MemoryOperandPosition(descriptor);
   for (int operand_index = 0; operand_index < descriptor.getNumOperands();
        ++operand_index) {
-    const bool is_output_operand = operand_index < descriptor.getNumDefs();
     const bool is_address_computation_tuple =
-        operand_index == memory_operand_index;
-    AddOperand(mcinst, /*operand_index=*/operand_index,
-               /*is_output_operand=*/is_output_operand,
-               /*is_address_computation_tuple=*/is_address_computation_tuple,
-               instruction);
+        operand_index == opcode_template->memory_operand_index;
+    opcode_template->explicit_operands.push_back(ExplicitOperand{
+        /*operand_index=*/operand_index,
+        /*is_output_operand=*/operand_index < descriptor.getNumDefs(),
+        /*is_address_computation_tuple=*/is_address_computation_tuple});
     if (is_address_computation_tuple) {
       // A memory reference is represented as a 5-tuple. The whole 5-tuple is
-      // processed in one CanonicalizeOperand() call and we need to skip the
-      // remaining 4 elements here.
+      // processed in one AddOperand() call and we need to skip the remaining 4
+      // elements here.
       operand_index += 4;
     }
   }
 
   for (llvm::MCPhysReg implicit_output_register : descriptor.implicit_defs()) {
-    instruction.implicit_output_operands.push_back(InstructionOperand::Register(
-        register_info.getName(implicit_output_register)));
+    opcode_template->implicit_output_operands.push_back(
+        register_operands_[implicit_output_register]);
   }
   for (llvm::MCPhysReg implicit_input_register : descriptor.implicit_uses()) {
-    instruction.implicit_input_operands.push_back(InstructionOperand::Register(
-        register_info.getName(implicit_input_register)));
+    opcode_template->implicit_input_operands.push_back(
+        register_operands_[implicit_input_register]);
   }
 
-  return instruction;
+  if (memory_alias_analysis_ == MemoryAliasAnalysis::kAddressBased) {
+    opcodes_by_llvm_mnemonic_.emplace(opcode_template->llvm_mnemonic, opcode);
+  }
+  cached = std::move(opcode_template);
+  ++num_opcode_templates_;
+  return *cached;
+}
+
+const X86Canonicalizer::MnemonicAndPrefixes&
+X86Canonicalizer::GetMnemonicAndPrefixes(const llvm::MCInst& mcinst,
+                                         int memory_operand_index) const {
+  MnemonicCacheKey key;
+  std::get<0>(key) = mcinst.getOpcode();
+  std::get<1>(key) = mcinst.getFlags();
+  for (int operand_index = 0; operand_index < mcinst.getNumOperands();
+       ++operand_index) {
+    if (operand_index == memory_operand_index) {
+      // Displacements and scaling factors do not affect the mnemonic.
+      operand_index += 4;
+      continue;
+    }
+    const llvm::MCOperand& operand = mcinst.getOperand(operand_index);
+    if (!operand.isImm()) continue;
+    const int64_t value = operand.getImm();
+    const bool fits_in_eight_bits =
+        value >= std::numeric_limits<int8_t>::min() &&
+        value <= std::numeric_limits<uint8_t>::max();
+    std::get<2>(key).push_back(fits_in_eight_bits ? value
+                                                  : kWideImmediatePlaceholder);
+  }
+
+  const auto [it, inserted] = mnemonic_cache_.try_emplace(std::move(key));
+  if (inserted) {
+    AddX86VendorMnemonicAndPrefixes(*mcinst_printer_,
+                                    *target_machine_.getMCSubtargetInfo(),
+                                    mcinst, it->second.mnemonic,
+                                    it->second.prefixes,
+                                    it->second.memory_access_size);
+  }
+  return it->second;
+}
+
+int X86Canonicalizer::GetMemoryAccessSize(
+    const std::string& llvm_mnemonic) const {
+  const auto it = opcodes_by_llvm_mnemonic_.find(llvm_mnemonic);
+  if (it == opcodes_by_llvm_mnemonic_.end()) return 0;
+  return memory_access_sizes_[it->second];
+}
+
+void X86Canonicalizer::AssignMemoryAliasGroups(
+    llvm::MutableArrayRef<Instruction> instructions) const {
+  if (memory_alias_analysis_ != MemoryAliasAnalysis::kAddressBased) return;
+  const llvm::MCRegisterInfo& register_info =
+      *target_machine_.getMCRegisterInfo();
+
+  // The memory accesses of an instruction in the block. The accessed bytes are
+  // [begin, end) relative to the address computed from the registers.
+  struct MemoryAccess {
+    int instruction_index;
+    int64_t begin;
+    int64_t end;
+  };
+  // The part of the address of a memory access that is not known statically:
+  // the segment register, the base register and its version, the index
+  // register and its version, and the scaling.
+  using AddressKey = std::tuple<unsigned, unsigned, int, unsigned, int, int>;
+
+  // Returns the number of register `name`, 0 for an empty name, and
+  // std::nullopt when the register is not known.
+  const auto find_register =
+      [this](const std::string& name) -> std::optional<unsigned> {
+    if (name.empty()) return 0;
+    const auto it = register_numbers_.find(name);
+    if (it == register_numbers_.end()) return std::nullopt;
+    return it->second;
+  };
+  // Returns true when `reg` can be used in a memory access that is analyzed,
+  // i.e. it is a 64-bit general purpose register other than RIP. The value of
+  // RIP is different for each instruction, address computations with 32-bit
+  // registers wrap around at 4 GiB, and those with vector registers access
+  // multiple locations.
+  const llvm::MCRegisterClass& gr64_class =
+      register_info.getRegClass(llvm::X86::GR64RegClassID);
+  const auto is_supported_address_register = [&gr64_class](unsigned reg) {
+    return reg == 0 || (reg != llvm::X86::RIP && gr64_class.contains(reg));
+  };
+
+  // Returns true when `reg` is RSP or one of its sub-registers.
+  const auto overlaps_stack_pointer = [&register_info](unsigned reg) {
+    for (llvm::MCRegAliasIterator alias(llvm::X86::RSP, &register_info,
+                                        /*IncludeSelf=*/true);
+         alias.isValid(); ++alias) {
+      if (*alias == reg) return true;
+    }
+    return false;
+  };
+
+  // The version of each register is the number of writes to the register or
+  // to a register that overlaps with it seen so far in the block. Two address
+  // computations that use the same registers with the same versions are
+  // based on the same value.
+  std::vector<int> register_versions(register_info.getNumRegs(), 0);
+  std::vector<MemoryAccess> accesses;
+  std::optional<AddressKey> common_key;
+
+  // Accesses are put into different alias groups only when they all use the
+  // same base address and their byte ranges do not overlap. In all other
+  // cases, the function returns early and keeps the whole memory alias group
+  // assigned by InstructionFromMCInst().
+  for (int instruction_index = 0; instruction_index < instructions.size();
+       ++instruction_index) {
+    const Instruction& instruction = instructions[instruction_index];
+    if (HasMemoryOperands(instruction)) {
+      const InstructionOperand* address = nullptr;
+      for (const InstructionOperand& operand : instruction.input_operands) {
+        if (operand.type() != OperandType::kAddress) continue;
+        // Instructions with more than one address are not analyzed.
+        if (address != nullptr) return;
+        address = &operand;
+      }
+      // String instructions, PUSH, POP, and other instructions that access
+      // memory through implicit operands do not have an address tuple.
+      if (address == nullptr) return;
+      for (const InstructionOperand& operand :
+           instruction.implicit_input_operands) {
+        if (operand.type() != OperandType::kRegister) continue;
+        const std::optional<unsigned> reg =
+            find_register(operand.register_name());
+        // E.g. PUSH or CALL with a memory operand also access the stack.
+        if (!reg.has_value() || overlaps_stack_pointer(*reg)) return;
+      }
+      if (IsX86BitTestWithRegisterOffset(instruction.llvm_mnemonic)) return;
+      const int access_size = GetMemoryAccessSize(instruction.llvm_mnemonic);
+      if (access_size <= 0) return;
+
+      const AddressTuple& address_tuple = address->address();
+      const std::optional<unsigned> segment =
+          find_register(address_tuple.segment_register);
+      const std::optional<unsigned> base =
+          find_register(address_tuple.base_register);
+      const std::optional<unsigned> index =
+          find_register(address_tuple.index_register);
+      if (!segment.has_value() || !base.has_value() || !index.has_value() ||
+          !is_supported_address_register(*base) ||
+          !is_supported_address_register(*index)) {
+        return;
+      }
+      const AddressKey key(*segment, *base, register_versions[*base], *index,
+                           register_versions[*index],
+                           *index == 0 ? 0 : address_tuple.scaling);
+      if (!common_key.has_value()) {
+        common_key = key;
+      } else if (key != *common_key) {
+        return;
+      }
+      accesses.push_back(MemoryAccess{
+          /*instruction_index=*/instruction_index,
+          /*begin=*/address_tuple.displacement,
+          /*end=*/address_tuple.displacement + access_size});
+    }
+
+    // The address of the memory access is computed before the outputs of the
+    // instruction are written, so the versions are updated only now.
+    for (const std::vector<InstructionOperand>* const operands :
+         {&instruction.output_operands,
+          &instruction.implicit_output_operands}) {
+      for (const InstructionOperand& operand : *operands) {
+        if (operand.type() != OperandType::kRegister) continue;
+        const std::optional<unsigned> reg =
+            find_register(operand.register_name());
+        if (!reg.has_value()) return;
+        for (llvm::MCRegAliasIterator alias(*reg, &register_info,
+                                            /*IncludeSelf=*/true);
+             alias.isValid(); ++alias) {
+          ++register_versions[*alias];
+        }
+      }
+    }
+  }
+  if (accesses.size() < 2) return;
+
+  // Merge accesses with overlapping byte ranges into components; each
+  // component becomes one alias group.
+  std::vector<int> order(accesses.size());
+  for (int i = 0; i < order.size(); ++i) order[i] = i;
+  std::sort(order.begin(), order.end(), [&accesses](int left, int right) {
+    return accesses[left].begin < accesses[right].begin;
+  });
+  std::vector<int> components(accesses.size());
+  int num_components = 0;
+  int64_t component_end = std::numeric_limits<int64_t>::min();
+  for (const int access_index : order) {
+    const MemoryAccess& access = accesses[access_index];
+    if (num_components == 0 || access.begin >= component_end) {
+      ++num_components;
+      component_end = access.end;
+    } else {
+      component_end = std::max(component_end, access.end);
+    }
+    components[access_index] = num_components - 1;
+  }
+  if (num_components == 1) return;
+
+  // Number the alias groups in the order of their first access in the block.
+  std::vector<int> alias_groups(num_components, 0);
+  int next_alias_group = 1;
+  for (int access_index = 0; access_index < accesses.size(); ++access_index) {
+    int& alias_group = alias_groups[components[access_index]];
+    if (alias_group == 0) alias_group = next_alias_group++;
+    SetMemoryAliasGroup(alias_group,
+                        instructions[accesses[access_index].instruction_index]);
+  }
 }
 
 void X86Canonicalizer::AddOperand(const llvm::MCInst& mcinst, int operand_index,
@@ -238,25 +610,26 @@ void X86Canonicalizer::AddOperand(const llvm::MCInst& mcinst, int operand_index,
       is_output_operand ? instruction.output_operands
                         : instruction.input_operands;
   if (is_address_computation_tuple) {
-    std::string base_register = GetRegisterNameOrEmpty(
+    const std::string& base_register = GetRegisterNameOrEmpty(
         mcinst.getOperand(operand_index + llvm::X86::AddrBaseReg));
     const int64_t displacement =
         mcinst.getOperand(operand_index + llvm::X86::AddrDisp).getImm();
-    std::string index_register = GetRegisterNameOrEmpty(
+    const std::string& index_register = GetRegisterNameOrEmpty(
         mcinst.getOperand(operand_index + llvm::X86::AddrIndexReg));
     const int64_t scaling =
         mcinst.getOperand(operand_index + llvm::X86::AddrScaleAmt).getImm();
-    std::string segment_register = GetRegisterNameOrEmpty(
+    const std::string& segment_register = GetRegisterNameOrEmpty(
         mcinst.getOperand(operand_index + llvm::X86::AddrSegmentReg));
     operand_list.push_back(InstructionOperand::Address(
-        /* base_register= */ std::move(base_register),
+        /* base_register= */ base_register,
         /* displacement= */ displacement,
-        /* index_register= */ std::move(index_register),
+        /* index_register= */ index_register,
         /* scaling= */ static_cast<int>(scaling),
-        /* segment_register= */ std::move(segment_register)));
+        /* segment_register= */ segment_register));
   } else if (operand.isReg()) {
-    operand_list.push_back(
-        InstructionOperand::Register(GetRegisterNameOrEmpty(operand)));
+    const unsigned reg = operand.getReg();
+    assert(reg < register_operands_.size());
+    operand_list.push_back(register_operands_[reg]);
   } else if (operand.isImm()) {
     operand_list.push_back(
         InstructionOperand::ImmediateValue(operand.getImm()));
@@ -19,9 +19,14 @@
 #ifndef THIRD_PARTY_GEMATRIA_GEMATRIA_LLVM_CANONICALIZER_H_
 #define THIRD_PARTY_GEMATRIA_GEMATRIA_LLVM_CANONICALIZER_H_
 
+#include <cstdint>
 #include <memory>
 #include <string>
+#include <tuple>
+#include <vector>
 
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/inlined_vector.h"
 #include "gematria/basic_block/basic_block.h"
 #include "llvm/include/llvm/ADT/ArrayRef.h"
 #include "llvm/include/llvm/MC/MCInst.h"
@@ -30,19 +35,54 @@
 
 namespace gematria {
 
+// The analysis used by a canonicalizer to assign alias groups to the memory
+// operands of the instructions of a basic block.
+enum class MemoryAliasAnalysis {
+  // All memory operands are in a single alias group, i.e. any memory access may
+  // alias with any other memory access.
+  kWholeMemory,
+  // Memory accesses are put into distinct alias groups when their address
+  // computations prove that they do not overlap, i.e. when they use the same
+  // base and index registers with the same values, the same scaling and the
+  // same segment, and the ranges of bytes given by their displacements and
+  // access sizes are disjoint. All other memory accesses are considered to be
+  // aliased.
+  kAddressBased,
+};
+
 // Abstract interface for code that extracts basic block data structures from
 // binary machine code. Each supported platform should provide its own subclass
 // that implements extraction for this specific platform.
+//
+// Canonicalizers may own mutable LLVM objects (e.g. an instruction printer), so
+// a single canonicalizer must not be used from multiple threads at the same
+// time. Use CanonicalizerPool to share canonicalizers between threads.
 class Canonicalizer {
  public:
   explicit Canonicalizer(const llvm::TargetMachine* target_machine);
   virtual ~Canonicalizer();
 
-  // Extracts data from a single machine instruction.
-  virtual Instruction InstructionFromMCInst(llvm::MCInst mcinst) const;
+  // Extracts data from a single machine instruction. The instruction is copied
+  // only when it has expression operands that need to be replaced.
+  virtual Instruction InstructionFromMCInst(const llvm::MCInst& mcinst) const;
   // Extracts data from a sequence of instructions.
   virtual BasicBlock BasicBlockFromMCInst(
       llvm::ArrayRef<llvm::MCInst> mcinsts) const;
+  // Extracts data from many sequences of instructions in one call. Returns a
+  // vector that contains the basic block extracted from blocks[i] at index i.
+  // See BasicBlocksFromMCInstsInParallel() in canonicalizer_pool.h for a
+  // version that uses multiple threads.
+  std::vector<BasicBlock> BasicBlocksFromMCInsts(
+      llvm::ArrayRef<std::vector<llvm::MCInst>> blocks) const;
+
+  // Updates the alias groups of the memory operands of `instructions`, which
+  // must be the instructions of a single basic block in their original order,
+  // canonicalized by this canonicalizer. Called by BasicBlockFromMCInst(); code
+  // that canonicalizes the instructions of a block one by one should call it
+  // once all instructions of the block are canonicalized. The default
+  // implementation keeps the alias groups assigned by InstructionFromMCInst().
+  virtual void AssignMemoryAliasGroups(
+      llvm::MutableArrayRef<Instruction> instructions) const {}
 
   // Returns the target machine on which the canonicalizer is based.
   const llvm::TargetMachine& target_machine() const { return target_machine_; }
@@ -56,26 +96,153 @@ class Canonicalizer {
   // Returns the name of a register in an operand. Returns an empty string when
   // the operand is an "undefined" operand.
   // This method must not be called when `operand.isReg()` is false.
-  std::string GetRegisterNameOrEmpty(const llvm::MCOperand& operand) const;
+  const std::string& GetRegisterNameOrEmpty(
+      const llvm::MCOperand& operand) const;
 
   const llvm::TargetMachine& target_machine_;
+
+ private:
+  // The names of all registers of the target, indexed by the register number.
+  // The number of registers is small, so the names are computed eagerly in the
+  // constructor instead of creating a new string for each operand.
+  std::vector<std::string> register_names_;
 };
 
 // A version of basic block extractor for X86-64.
+//
+// The vendor mnemonic and the prefixes of an instruction are extracted from the
+// output of the LLVM instruction printer. Printing is relatively expensive, so
+// the canonicalizer memoizes the results in a cache keyed by the opcode and the
+// other bits of the MCInst that may influence them.
+//
+// The parts of the instruction that depend only on the opcode, i.e. the roles
+// of the explicit operands, the memory operands, and the implicit operands, are
+// computed once per opcode and stored in an operand template. Canonicalizing an
+// instruction then only fills in the values of the explicit operands.
+//
+// InstructionFromMCInst() puts all memory operands into a single alias group.
+// With MemoryAliasAnalysis::kAddressBased, AssignMemoryAliasGroups() then
+// splits the memory accesses of a basic block into multiple alias groups when
+// it can prove from the address computations that they do not overlap. The
+// access sizes needed for this are taken from the instruction printer, together
+// with the mnemonics.
 class X86Canonicalizer final : public Canonicalizer {
  public:
-  explicit X86Canonicalizer(const llvm::TargetMachine* target_machine);
+  explicit X86Canonicalizer(
+      const llvm::TargetMachine* target_machine,
+      MemoryAliasAnalysis memory_alias_analysis =
+          MemoryAliasAnalysis::kWholeMemory);
   ~X86Canonicalizer() override;
 
+  void AssignMemoryAliasGroups(
+      llvm::MutableArrayRef<Instruction> instructions) const override;
+
+  MemoryAliasAnalysis memory_alias_analysis() const {
+    return memory_alias_analysis_;
+  }
+
+  // Returns the number of entries in the mnemonic cache.
+  size_t num_cached_mnemonics() const { return mnemonic_cache_.size(); }
+  // Returns the number of opcodes for which an operand template was created.
+  size_t num_opcode_templates() const { return num_opcode_templates_; }
+
  private:
+  // An explicit operand of an opcode. The memory 5-tuple is represented by a
+  // single operand whose `operand_index` is the index of its first element.
+  struct ExplicitOperand {
+    int operand_index;
+    bool is_output_operand;
+    bool is_address_computation_tuple;
+  };
+
+  // The parts of a canonicalized instruction that depend only on the opcode.
+  struct OpcodeTemplate {
+    std::string llvm_mnemonic;
+    // The index of the first operand of the memory 5-tuple, or -1 when the
+    // opcode does not use it.
+    int memory_operand_index = -1;
+    std::vector<ExplicitOperand> explicit_operands;
+    // The memory operands added when the opcode may load or store.
+    std::vector<InstructionOperand> memory_input_operands;
+    std::vector<InstructionOperand> memory_output_operands;
+    std::vector<InstructionOperand> implicit_input_operands;
+    std::vector<InstructionOperand> implicit_output_operands;
+  };
+
+  // The vendor mnemonic and prefixes of an instruction, and the size of its
+  // memory access in bytes as shown by the printer, or 0 when it is not known.
+  struct MnemonicAndPrefixes {
+    std::string mnemonic;
+    std::vector<std::string> prefixes;
+    int memory_access_size = 0;
+  };
+
+  // The key used in the mnemonic cache: the opcode, the flags of the MCInst,
+  // and the values of the immediate operands outside of the memory 5-tuple.
+  // The flags encode prefixes that do not have their own opcodes (e.g. LOCK or
+  // REP). The immediate values are needed because the printer takes the
+  // mnemonic of some opcodes from an operand, e.g. the condition code of JCC_1
+  // or the predicate of CMPPS. These are always 8-bit values; wider immediate
+  // values are replaced by a placeholder to keep the cache small.
+  using MnemonicCacheKey =
+      std::tuple<unsigned, unsigned, absl::InlinedVector<int64_t, 2>>;
+
   Instruction PlatformSpecificInstructionFromMCInst(
       const llvm::MCInst& mcinst) const override;
 
+  // Returns the vendor mnemonic, prefixes, and memory access size of `mcinst`.
+  // Uses the instruction printer on cache misses, and the cached value
+  // otherwise.
+  // `memory_operand_index` is the index of the first operand of the memory
+  // 5-tuple of `mcinst`, or -1 when the instruction does not use it.
+  const MnemonicAndPrefixes& GetMnemonicAndPrefixes(
+      const llvm::MCInst& mcinst, int memory_operand_index) const;
+
+  // Returns the operand template for `opcode`. Creates the template on the
+  // first use of the opcode.
+  const OpcodeTemplate& GetOpcodeTemplate(unsigned opcode) const;
+
   void AddOperand(const llvm::MCInst& mcinst, int operand_index,
                   bool is_output_operand, bool is_address_computation_tuple,
                   Instruction& instruction) const;
 
+  // Returns the size of the memory access of instructions with the given LLVM
+  // mnemonic in bytes, or 0 when the size is not known, e.g. because no
+  // instruction with this mnemonic was canonicalized by this canonicalizer.
+  int GetMemoryAccessSize(const std::string& llvm_mnemonic) const;
+
+  const MemoryAliasAnalysis memory_alias_analysis_;
+
   std::unique_ptr<llvm::MCInstPrinter> mcinst_printer_;
+
+  // Register operands for all registers of the target, indexed by the register
+  // number. Copying a prebuilt operand avoids looking up the register name in
+  // the global token table for each operand.
+  std::vector<InstructionOperand> register_operands_;
+
+  // The operand templates, indexed by the opcode. The entries are created on
+  // the first use of each opcode; as with the mnemonic cache, this is safe
+  // because a single canonicalizer is not used from multiple threads.
+  mutable std::vector<std::unique_ptr<const OpcodeTemplate>> opcode_templates_;
+  mutable size_t num_opcode_templates_ = 0;
+
+  // The cache is updated from const methods; this is safe because a single
+  // canonicalizer must not be used from multiple threads at the same time.
+  mutable absl::flat_hash_map<MnemonicCacheKey, MnemonicAndPrefixes>
+      mnemonic_cache_;
+
+  // The memory access sizes of the instructions, indexed by the opcode, and the
+  // opcodes keyed by the LLVM mnemonic, which is all that
+  // AssignMemoryAliasGroups() knows about an instruction. The sizes are updated
+  // by each canonicalized instruction that has a memory operand, both on hits
+  // and misses of the mnemonic cache. Used only by the address-based alias
+  // analysis.
+  mutable std::vector<int> memory_access_sizes_;
+  mutable absl::flat_hash_map<std::string, unsigned> opcodes_by_llvm_mnemonic_;
+
+  // The register numbers, keyed by the register name. Used only by the
+  // address-based alias analysis.
+  absl::flat_hash_map<std::string, unsigned> register_numbers_;
 };
 
 }  // namespace gematria
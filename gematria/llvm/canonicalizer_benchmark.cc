@@ -0,0 +1,141 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Microbenchmarks for X86Canonicalizer. The benchmarks report the number of
+// basic blocks per second as "items_per_second", and the number of
+// instructions per second as "instructions".
+//
+// Run with:
+//   bazel run -c opt //gematria/llvm:canonicalizer_benchmark
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/log/absl_check.h"
+#include "absl/strings/str_cat.h"
+#include "benchmark/benchmark.h"
+#include "gematria/llvm/asm_parser.h"
+#include "gematria/llvm/canonicalizer.h"
+#include "gematria/llvm/llvm_architecture_support.h"
+#include "llvm/include/llvm/IR/InlineAsm.h"
+#include "llvm/include/llvm/MC/MCInst.h"
+
+namespace gematria {
+namespace {
+
+// A short sequence of instructions with register, immediate, address and
+// memory operands. The benchmarks build basic blocks by repeating it.
+constexpr char kAssembly[] = R"asm(
+  mov rax, qword ptr [rbx + 8]
+  add rax, rcx
+  lea rdx, [rax + 4*rcx + 16]
+  add rdx, 42
+  vaddps ymm0, ymm1, ymmword ptr [rsi]
+  lock xadd dword ptr [rdi], eax
+  shl rcx, 3
+  cmp rdx, rax
+)asm";
+constexpr int kNumInstructionsInAssembly = 8;
+
+// Returns a basic block that contains `num_instructions` instructions.
+// `num_instructions` must be a multiple of kNumInstructionsInAssembly.
+std::vector<llvm::MCInst> MakeBasicBlock(
+    const LlvmArchitectureSupport& llvm_architecture, int num_instructions) {
+  ABSL_CHECK_EQ(num_instructions % kNumInstructionsInAssembly, 0);
+  std::string assembly;
+  for (int i = 0; i < num_instructions / kNumInstructionsInAssembly; ++i) {
+    absl::StrAppend(&assembly, kAssembly);
+  }
+  absl::StatusOr<std::vector<llvm::MCInst>> instructions =
+      ParseAsmCodeFromString(llvm_architecture.target_machine(), assembly,
+                             llvm::InlineAsm::AD_Intel);
+  ABSL_CHECK_OK(instructions.status());
+  ABSL_CHECK_EQ(static_cast<int>(instructions->size()), num_instructions);
+  return *std::move(instructions);
+}
+
+void SetCounters(benchmark::State& state, int64_t num_blocks,
+                 int64_t num_instructions) {
+  state.SetItemsProcessed(num_blocks);
+  state.counters["instructions"] =
+      benchmark::Counter(num_instructions, benchmark::Counter::kIsRate);
+}
+
+// Canonicalizes a basic block with `state.range(0)` instructions using a
+// canonicalizer whose mnemonic cache already contains all the instructions.
+// This is the steady state of a long-running import.
+void BM_InstructionFromMCInst(benchmark::State& state) {
+  const int num_instructions = state.range(0);
+  const std::unique_ptr<LlvmArchitectureSupport> llvm_architecture =
+      LlvmArchitectureSupport::X86_64();
+  const X86Canonicalizer canonicalizer(&llvm_architecture->target_machine());
+  const std::vector<llvm::MCInst> block =
+      MakeBasicBlock(*llvm_architecture, num_instructions);
+  for (const llvm::MCInst& mcinst : block) {
+    canonicalizer.InstructionFromMCInst(mcinst);
+  }
+  for (auto _ : state) {
+    for (const llvm::MCInst& mcinst : block) {
+      benchmark::DoNotOptimize(canonicalizer.InstructionFromMCInst(mcinst));
+    }
+  }
+  SetCounters(state, state.iterations(),
+              state.iterations() * num_instructions);
+}
+BENCHMARK(BM_InstructionFromMCInst)->Arg(8)->Arg(64)->Arg(256);
+
+// Canonicalizes a basic block with `state.range(0)` instructions using a new
+// canonicalizer in each iteration, i.e. each distinct instruction misses the
+// mnemonic cache once. This is the cost of the first pass over a data set.
+void BM_InstructionFromMCInst_ColdCache(benchmark::State& state) {
+  const int num_instructions = state.range(0);
+  const std::unique_ptr<LlvmArchitectureSupport> llvm_architecture =
+      LlvmArchitectureSupport::X86_64();
+  const std::vector<llvm::MCInst> block =
+      MakeBasicBlock(*llvm_architecture, num_instructions);
+  for (auto _ : state) {
+    const X86Canonicalizer canonicalizer(&llvm_architecture->target_machine());
+    for (const llvm::MCInst& mcinst : block) {
+      benchmark::DoNotOptimize(canonicalizer.InstructionFromMCInst(mcinst));
+    }
+  }
+  SetCounters(state, state.iterations(),
+              state.iterations() * num_instructions);
+}
+BENCHMARK(BM_InstructionFromMCInst_ColdCache)->Arg(8)->Arg(64)->Arg(256);
+
+// Canonicalizes a basic block with `state.range(0)` instructions with a single
+// call to BasicBlockFromMCInst().
+void BM_BasicBlockFromMCInst(benchmark::State& state) {
+  const int num_instructions = state.range(0);
+  const std::unique_ptr<LlvmArchitectureSupport> llvm_architecture =
+      LlvmArchitectureSupport::X86_64();
+  const X86Canonicalizer canonicalizer(&llvm_architecture->target_machine());
+  const std::vector<llvm::MCInst> block =
+      MakeBasicBlock(*llvm_architecture, num_instructions);
+  canonicalizer.BasicBlockFromMCInst(block);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(canonicalizer.BasicBlockFromMCInst(block));
+  }
+  SetCounters(state, state.iterations(),
+              state.iterations() * num_instructions);
+}
+BENCHMARK(BM_BasicBlockFromMCInst)->Arg(8)->Arg(64)->Arg(256);
+
+}  // namespace
+}  // namespace gematria
+
+BENCHMARK_MAIN();
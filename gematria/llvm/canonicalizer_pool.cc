@@ -0,0 +1,122 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "gematria/llvm/canonicalizer_pool.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "absl/log/absl_check.h"
+#include "absl/log/die_if_null.h"
+#include "absl/synchronization/mutex.h"
+#include "gematria/basic_block/basic_block.h"
+#include "gematria/llvm/canonicalizer.h"
+#include "gematria/llvm/llvm_architecture_support.h"
+#include "gematria/utils/thread_pool.h"
+#include "llvm/include/llvm/ADT/ArrayRef.h"
+#include "llvm/include/llvm/MC/MCInst.h"
+#include "llvm/include/llvm/Target/TargetMachine.h"
+
+namespace gematria {
+
+CanonicalizerPool::Handle& CanonicalizerPool::Handle::operator=(
+    Handle&& other) {
+  if (this != &other) {
+    if (canonicalizer_ != nullptr) pool_->Release(std::move(canonicalizer_));
+    pool_ = other.pool_;
+    canonicalizer_ = std::move(other.canonicalizer_);
+  }
+  return *this;
+}
+
+CanonicalizerPool::Handle::~Handle() {
+  if (canonicalizer_ != nullptr) pool_->Release(std::move(canonicalizer_));
+}
+
+std::unique_ptr<CanonicalizerPool> CanonicalizerPool::X86(
+    const LlvmArchitectureSupport* llvm_architecture) {
+  return std::make_unique<CanonicalizerPool>(
+      llvm_architecture, [](const llvm::TargetMachine* target_machine) {
+        return std::make_unique<X86Canonicalizer>(target_machine);
+      });
+}
+
+CanonicalizerPool::CanonicalizerPool(
+    const LlvmArchitectureSupport* llvm_architecture,
+    CanonicalizerFactory factory)
+    : llvm_architecture_(*ABSL_DIE_IF_NULL(llvm_architecture)),
+      factory_(std::move(factory)) {}
+
+CanonicalizerPool::Handle CanonicalizerPool::Acquire() {
+  {
+    absl::MutexLock lock(&mutex_);
+    if (!available_canonicalizers_.empty()) {
+      std::unique_ptr<Canonicalizer> canonicalizer =
+          std::move(available_canonicalizers_.back());
+      available_canonicalizers_.pop_back();
+      return Handle(this, std::move(canonicalizer));
+    }
+    ++num_created_canonicalizers_;
+  }
+  // Create the canonicalizer outside of the critical section; it does not need
+  // any shared mutable state.
+  return Handle(this, factory_(&llvm_architecture_.target_machine()));
+}
+
+int CanonicalizerPool::num_created_canonicalizers() const {
+  absl::MutexLock lock(&mutex_);
+  return num_created_canonicalizers_;
+}
+
+void CanonicalizerPool::Release(std::unique_ptr<Canonicalizer> canonicalizer) {
+  absl::MutexLock lock(&mutex_);
+  available_canonicalizers_.push_back(std::move(canonicalizer));
+}
+
+std::vector<BasicBlock> BasicBlocksFromMCInstsInParallel(
+    CanonicalizerPool& pool, llvm::ArrayRef<std::vector<llvm::MCInst>> blocks,
+    int num_threads) {
+  ABSL_CHECK_GT(num_threads, 0);
+  num_threads = std::min<int>(num_threads, blocks.size());
+  if (num_threads <= 1) return pool.Acquire()->BasicBlocksFromMCInsts(blocks);
+  ThreadPool thread_pool(num_threads);
+  return BasicBlocksFromMCInstsInParallel(pool, blocks, thread_pool);
+}
+
+std::vector<BasicBlock> BasicBlocksFromMCInstsInParallel(
+    CanonicalizerPool& pool, llvm::ArrayRef<std::vector<llvm::MCInst>> blocks,
+    ThreadPool& thread_pool) {
+  const int num_ranges =
+      std::min<int>(thread_pool.num_threads(), blocks.size());
+  if (num_ranges <= 1) return pool.Acquire()->BasicBlocksFromMCInsts(blocks);
+
+  // The result is preallocated, so that each task can write the blocks of its
+  // range directly to their final positions.
+  std::vector<BasicBlock> basic_blocks(blocks.size());
+  thread_pool.ParallelFor(num_ranges, [&](int64_t range_index) {
+    const size_t begin = blocks.size() * range_index / num_ranges;
+    const size_t end = blocks.size() * (range_index + 1) / num_ranges;
+    const CanonicalizerPool::Handle canonicalizer = pool.Acquire();
+    for (size_t i = begin; i < end; ++i) {
+      basic_blocks[i] = canonicalizer->BasicBlockFromMCInst(blocks[i]);
+    }
+  });
+  return basic_blocks;
+}
+
+}  // namespace gematria
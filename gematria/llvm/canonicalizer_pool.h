@@ -0,0 +1,141 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Contains a thread-safe pool of canonicalizers that share the immutable LLVM
+// data structures of a single LlvmArchitectureSupport object.
+//
+// The LLVM objects used by Gematria fall into two categories:
+//  - immutable target data (llvm::TargetMachine, llvm::MCInstrInfo,
+//    llvm::MCRegisterInfo, llvm::MCSubtargetInfo, llvm::MCAsmInfo) that is
+//    owned by LlvmArchitectureSupport and can be safely shared by any number of
+//    threads,
+//  - mutable state (llvm::MCInstPrinter, llvm::MCContext,
+//    llvm::MCDisassembler) that is cheap to create but must not be used from
+//    multiple threads at the same time.
+// Canonicalizer objects own their instruction printer, so a single
+// canonicalizer must be used by at most one thread at a time. The pool hands
+// out canonicalizers for exclusive use, and reuses them after they are
+// returned, so that each thread needs to create the mutable state at most once.
+
+#ifndef THIRD_PARTY_GEMATRIA_GEMATRIA_LLVM_CANONICALIZER_POOL_H_
+#define THIRD_PARTY_GEMATRIA_GEMATRIA_LLVM_CANONICALIZER_POOL_H_
+
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+#include "gematria/basic_block/basic_block.h"
+#include "gematria/llvm/canonicalizer.h"
+#include "gematria/llvm/llvm_architecture_support.h"
+#include "gematria/utils/thread_pool.h"
+#include "llvm/include/llvm/ADT/ArrayRef.h"
+#include "llvm/include/llvm/MC/MCInst.h"
+#include "llvm/include/llvm/Target/TargetMachine.h"
+
+namespace gematria {
+
+class CanonicalizerPool {
+ public:
+  // Creates a new canonicalizer using the given target machine.
+  using CanonicalizerFactory = std::function<std::unique_ptr<Canonicalizer>(
+      const llvm::TargetMachine* target_machine)>;
+
+  // A handle to a canonicalizer acquired from the pool. The canonicalizer can
+  // be used only by the thread that owns the handle; it is returned to the pool
+  // when the handle is destroyed. The handle must not outlive the pool.
+  class Handle {
+   public:
+    Handle(Handle&& other) = default;
+    Handle& operator=(Handle&& other);
+    ~Handle();
+
+    const Canonicalizer& operator*() const { return *canonicalizer_; }
+    const Canonicalizer* operator->() const { return canonicalizer_.get(); }
+    const Canonicalizer* get() const { return canonicalizer_.get(); }
+
+   private:
+    friend class CanonicalizerPool;
+
+    Handle(CanonicalizerPool* pool,
+           std::unique_ptr<Canonicalizer> canonicalizer)
+        : pool_(pool), canonicalizer_(std::move(canonicalizer)) {}
+
+    CanonicalizerPool* pool_;
+    std::unique_ptr<Canonicalizer> canonicalizer_;
+  };
+
+  // Creates a pool of X86Canonicalizer objects based on `llvm_architecture`.
+  // Does not take ownership of `llvm_architecture`; the object must outlive
+  // the pool.
+  static std::unique_ptr<CanonicalizerPool> X86(
+      const LlvmArchitectureSupport* llvm_architecture);
+
+  // Creates a pool that creates canonicalizers using `factory`. The factory
+  // may be called from any thread that calls Acquire(). Does not take
+  // ownership of `llvm_architecture`.
+  CanonicalizerPool(const LlvmArchitectureSupport* llvm_architecture,
+                    CanonicalizerFactory factory);
+
+  CanonicalizerPool(const CanonicalizerPool&) = delete;
+  CanonicalizerPool& operator=(const CanonicalizerPool&) = delete;
+
+  // Returns a canonicalizer for exclusive use by the caller. Reuses a
+  // canonicalizer returned to the pool when possible; otherwise, creates a new
+  // one. This method is thread-safe.
+  Handle Acquire() ABSL_LOCKS_EXCLUDED(mutex_);
+
+  // Returns the architecture support the pool is based on.
+  const LlvmArchitectureSupport& llvm_architecture() const {
+    return llvm_architecture_;
+  }
+
+  // Returns the number of canonicalizers created by the pool so far.
+  int num_created_canonicalizers() const ABSL_LOCKS_EXCLUDED(mutex_);
+
+ private:
+  // Returns `canonicalizer` to the pool.
+  void Release(std::unique_ptr<Canonicalizer> canonicalizer)
+      ABSL_LOCKS_EXCLUDED(mutex_);
+
+  const LlvmArchitectureSupport& llvm_architecture_;
+  const CanonicalizerFactory factory_;
+
+  mutable absl::Mutex mutex_;
+  std::vector<std::unique_ptr<Canonicalizer>> available_canonicalizers_
+      ABSL_GUARDED_BY(mutex_);
+  int num_created_canonicalizers_ ABSL_GUARDED_BY(mutex_) = 0;
+};
+
+// Extracts basic blocks from many sequences of instructions using up to
+// `num_threads` threads. The blocks are split into contiguous ranges of roughly
+// the same size, and each range is canonicalized by a separate task with a
+// canonicalizer acquired from `pool`. Returns the same result as
+// Canonicalizer::BasicBlocksFromMCInsts(): the block at index i is extracted
+// from blocks[i]. `num_threads` must be positive.
+std::vector<BasicBlock> BasicBlocksFromMCInstsInParallel(
+    CanonicalizerPool& pool, llvm::ArrayRef<std::vector<llvm::MCInst>> blocks,
+    int num_threads);
+// A version of BasicBlocksFromMCInstsInParallel() that runs the tasks on
+// `thread_pool`, using one range per worker thread. This avoids creating new
+// threads for each call when the caller keeps the thread pool.
+std::vector<BasicBlock> BasicBlocksFromMCInstsInParallel(
+    CanonicalizerPool& pool, llvm::ArrayRef<std::vector<llvm::MCInst>> blocks,
+    ThreadPool& thread_pool);
+
+}  // namespace gematria
+
+#endif  // THIRD_PARTY_GEMATRIA_GEMATRIA_LLVM_CANONICALIZER_POOL_H_
@@ -0,0 +1,145 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "gematria/llvm/canonicalizer_pool.h"
+
+#include <memory>
+#include <thread>  // NOLINT(build/c++11)
+#include <utility>
+#include <vector>
+
+#include "gematria/basic_block/basic_block.h"
+#include "gematria/llvm/asm_parser.h"
+#include "gematria/llvm/canonicalizer.h"
+#include "gematria/llvm/llvm_architecture_support.h"
+#include "gematria/utils/thread_pool.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "llvm/include/llvm/IR/InlineAsm.h"
+#include "llvm/include/llvm/MC/MCInst.h"
+
+namespace gematria {
+namespace {
+
+using ::testing::Each;
+using ::testing::ElementsAreArray;
+using ::testing::Eq;
+using ::testing::IsEmpty;
+
+class CanonicalizerPoolTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    llvm_architecture_ = LlvmArchitectureSupport::X86_64();
+    pool_ = CanonicalizerPool::X86(llvm_architecture_.get());
+  }
+
+  std::unique_ptr<LlvmArchitectureSupport> llvm_architecture_;
+  std::unique_ptr<CanonicalizerPool> pool_;
+};
+
+TEST_F(CanonicalizerPoolTest, AcquireCreatesDistinctCanonicalizers) {
+  const CanonicalizerPool::Handle first = pool_->Acquire();
+  const CanonicalizerPool::Handle second = pool_->Acquire();
+  EXPECT_NE(first.get(), second.get());
+  EXPECT_EQ(&first->target_machine(), &llvm_architecture_->target_machine());
+  EXPECT_EQ(&second->target_machine(), &llvm_architecture_->target_machine());
+  EXPECT_EQ(pool_->num_created_canonicalizers(), 2);
+}
+
+TEST_F(CanonicalizerPoolTest, ReusesReleasedCanonicalizers) {
+  const Canonicalizer* canonicalizer = nullptr;
+  {
+    const CanonicalizerPool::Handle handle = pool_->Acquire();
+    canonicalizer = handle.get();
+  }
+  const CanonicalizerPool::Handle handle = pool_->Acquire();
+  EXPECT_EQ(handle.get(), canonicalizer);
+  EXPECT_EQ(pool_->num_created_canonicalizers(), 1);
+}
+
+TEST_F(CanonicalizerPoolTest, MoveHandle) {
+  CanonicalizerPool::Handle first = pool_->Acquire();
+  const Canonicalizer* const canonicalizer = first.get();
+  CanonicalizerPool::Handle second = std::move(first);
+  EXPECT_EQ(second.get(), canonicalizer);
+  EXPECT_EQ(first.get(), nullptr);  // NOLINT(bugprone-use-after-move)
+}
+
+TEST_F(CanonicalizerPoolTest, ConcurrentCanonicalization) {
+  const std::vector<llvm::MCInst> mcinsts =
+      ParseAsmCodeFromString(llvm_architecture_->target_machine(),
+                             "ADD RAX, RBX\nLOCK XOR QWORD PTR [RCX], RAX",
+                             llvm::InlineAsm::AD_Intel)
+          .value();
+  const BasicBlock expected_block =
+      pool_->Acquire()->BasicBlockFromMCInst(mcinsts);
+
+  constexpr int kNumThreads = 8;
+  constexpr int kNumIterations = 100;
+  std::vector<std::vector<BasicBlock>> blocks(kNumThreads);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kNumThreads; ++i) {
+    threads.emplace_back([this, &mcinsts, &blocks, i]() {
+      for (int j = 0; j < kNumIterations; ++j) {
+        const CanonicalizerPool::Handle canonicalizer = pool_->Acquire();
+        blocks[i].push_back(canonicalizer->BasicBlockFromMCInst(mcinsts));
+      }
+    });
+  }
+  for (std::thread& thread : threads) thread.join();
+
+  EXPECT_LE(pool_->num_created_canonicalizers(), kNumThreads);
+  for (const std::vector<BasicBlock>& thread_blocks : blocks) {
+    EXPECT_THAT(thread_blocks, Each(Eq(expected_block)));
+  }
+}
+
+TEST_F(CanonicalizerPoolTest, BasicBlocksFromMCInstsInParallel) {
+  const char* const kAssemblies[] = {
+      "ADD RAX, RBX", "LOCK XOR QWORD PTR [RCX], RAX",
+      "MOV RAX, QWORD PTR FS:[RSI + 123]\nSUB RAX, 1", "NOP", "CMP RAX, RBX"};
+  std::vector<std::vector<llvm::MCInst>> mcinsts;
+  for (int i = 0; i < 5; ++i) {
+    for (const char* const assembly : kAssemblies) {
+      mcinsts.push_back(
+          ParseAsmCodeFromString(llvm_architecture_->target_machine(),
+                                 assembly, llvm::InlineAsm::AD_Intel)
+              .value());
+    }
+  }
+  const std::vector<BasicBlock> expected_blocks =
+      pool_->Acquire()->BasicBlocksFromMCInsts(mcinsts);
+  ASSERT_EQ(expected_blocks.size(), mcinsts.size());
+  for (int i = 0; i < mcinsts.size(); ++i) {
+    EXPECT_EQ(expected_blocks[i],
+              pool_->Acquire()->BasicBlockFromMCInst(mcinsts[i]));
+  }
+
+  for (const int num_threads : {1, 3, 8, 100}) {
+    SCOPED_TRACE(num_threads);
+    EXPECT_THAT(BasicBlocksFromMCInstsInParallel(*pool_, mcinsts, num_threads),
+                ElementsAreArray(expected_blocks));
+  }
+  EXPECT_THAT(BasicBlocksFromMCInstsInParallel(*pool_, {}, 4), IsEmpty());
+
+  // The thread pool can be reused for multiple calls.
+  ThreadPool thread_pool(4);
+  for (int i = 0; i < 2; ++i) {
+    EXPECT_THAT(BasicBlocksFromMCInstsInParallel(*pool_, mcinsts, thread_pool),
+                ElementsAreArray(expected_blocks));
+  }
+}
+
+}  // namespace
+}  // namespace gematria
@@ -29,7 +29,11 @@
 namespace gematria {
 namespace {
 
+using ::testing::AllOf;
+using ::testing::Each;
 using ::testing::ElementsAre;
+using ::testing::Eq;
+using ::testing::Field;
 using ::testing::IsEmpty;
 using ::testing::Not;
 
@@ -53,6 +57,24 @@ class X86BasicBlockExtractorTest : public testing::Test {
   std::unique_ptr<const X86Canonicalizer> extractor_;
 };
 
+// Returns the alias groups of the memory operands of each instruction in
+// `block`; the input operands come before the output operands.
+std::vector<std::vector<int>> MemoryAliasGroups(const BasicBlock& block) {
+  std::vector<std::vector<int>> alias_groups;
+  for (const Instruction& instruction : block.instructions) {
+    std::vector<int>& instruction_groups = alias_groups.emplace_back();
+    for (const std::vector<InstructionOperand>* const operands :
+         {&instruction.input_operands, &instruction.output_operands}) {
+      for (const InstructionOperand& operand : *operands) {
+        if (operand.type() == OperandType::kMemory) {
+          instruction_groups.push_back(operand.alias_group_id());
+        }
+      }
+    }
+  }
+  return alias_groups;
+}
+
 TEST_F(X86BasicBlockExtractorTest, InstructionFromMCInst) {
   const std::vector<llvm::MCInst> mcinsts = ParseAssemblyCode(R"(
       ADD RAX, RBX
@@ -182,5 +204,165 @@ TEST_F(X86BasicBlockExtractorTest, LonePrefix) {
                 /* implicit_output_operands= */ {}));
 }
 
+TEST_F(X86BasicBlockExtractorTest, MnemonicCache) {
+  const std::vector<llvm::MCInst> mcinsts = ParseAssemblyCode(R"(
+      ADD RAX, RBX
+      ADD RCX, RDX
+      LOCK ADD QWORD PTR[RCX], RAX
+      ADD QWORD PTR[RCX + 16], RAX
+      JE loop + 10
+      JNE loop + 20
+    loop:
+  )");
+  ASSERT_EQ(mcinsts.size(), 6);
+
+  const BasicBlock block = extractor_->BasicBlockFromMCInst(mcinsts);
+  EXPECT_THAT(
+      block.instructions,
+      ElementsAre(
+          AllOf(Field(&Instruction::mnemonic, Eq("ADD")),
+                Field(&Instruction::prefixes, IsEmpty())),
+          AllOf(Field(&Instruction::mnemonic, Eq("ADD")),
+                Field(&Instruction::prefixes, IsEmpty())),
+          AllOf(Field(&Instruction::mnemonic, Eq("ADD")),
+                Field(&Instruction::prefixes, ElementsAre("LOCK"))),
+          AllOf(Field(&Instruction::mnemonic, Eq("ADD")),
+                Field(&Instruction::prefixes, IsEmpty())),
+          AllOf(Field(&Instruction::mnemonic, Eq("JE")),
+                Field(&Instruction::llvm_mnemonic, Eq("JCC_1"))),
+          AllOf(Field(&Instruction::mnemonic, Eq("JNE")),
+                Field(&Instruction::llvm_mnemonic, Eq("JCC_1")))));
+  // ADD64rr, ADD64mr with and without LOCK, and JCC_1 with two different
+  // condition codes.
+  EXPECT_EQ(extractor_->num_cached_mnemonics(), 5);
+
+  // Canonicalizing the same code again must not add new entries.
+  EXPECT_EQ(extractor_->BasicBlockFromMCInst(mcinsts), block);
+  EXPECT_EQ(extractor_->num_cached_mnemonics(), 5);
+}
+
+TEST_F(X86BasicBlockExtractorTest, OpcodeTemplates) {
+  const std::vector<llvm::MCInst> mcinsts = ParseAssemblyCode(R"(
+      ADD RAX, RBX
+      ADD RCX, RDX
+      ADD QWORD PTR[RCX + 16], RAX
+  )");
+  ASSERT_EQ(mcinsts.size(), 3);
+  EXPECT_EQ(extractor_->num_opcode_templates(), 0);
+
+  const BasicBlock block = extractor_->BasicBlockFromMCInst(mcinsts);
+  // The instructions with the same opcode share the template, but they still
+  // get their own explicit operands.
+  EXPECT_EQ(extractor_->num_opcode_templates(), 2);
+  ASSERT_EQ(block.instructions.size(), 3);
+  EXPECT_THAT(block.instructions[0].output_operands,
+              ElementsAre(InstructionOperand::Register("RAX")));
+  EXPECT_THAT(block.instructions[1].output_operands,
+              ElementsAre(InstructionOperand::Register("RCX")));
+  EXPECT_THAT(block.instructions[1].input_operands,
+              ElementsAre(InstructionOperand::Register("RCX"),
+                          InstructionOperand::Register("RDX")));
+  EXPECT_THAT(block.instructions[1].implicit_output_operands,
+              ElementsAre(InstructionOperand::Register("EFLAGS")));
+  EXPECT_THAT(block.instructions[2].output_operands,
+              ElementsAre(InstructionOperand::MemoryLocation(1)));
+  EXPECT_THAT(block.instructions[2].input_operands,
+              ElementsAre(InstructionOperand::MemoryLocation(1),
+                          InstructionOperand::Address("RCX", 16, "", 1, ""),
+                          InstructionOperand::Register("RAX")));
+
+  EXPECT_EQ(extractor_->BasicBlockFromMCInst(mcinsts), block);
+  EXPECT_EQ(extractor_->num_opcode_templates(), 2);
+}
+
+TEST_F(X86BasicBlockExtractorTest, BasicBlocksFromMCInsts) {
+  const std::vector<std::vector<llvm::MCInst>> blocks = {
+      ParseAssemblyCode("ADD RAX, RBX\nSUB RCX, RAX"),
+      ParseAssemblyCode(R"(
+        loop:
+          CMP RAX, RBX
+          JE loop + 10
+      )"),
+      {},
+      ParseAssemblyCode("MOV RAX, QWORD PTR FS:[RSI + 123]")};
+
+  const std::vector<BasicBlock> basic_blocks =
+      extractor_->BasicBlocksFromMCInsts(blocks);
+  ASSERT_EQ(basic_blocks.size(), blocks.size());
+  for (int i = 0; i < blocks.size(); ++i) {
+    EXPECT_EQ(basic_blocks[i], extractor_->BasicBlockFromMCInst(blocks[i]));
+  }
+  EXPECT_THAT(basic_blocks[2].instructions, IsEmpty());
+  EXPECT_THAT(extractor_->BasicBlocksFromMCInsts({}), IsEmpty());
+}
+
+TEST_F(X86BasicBlockExtractorTest, AddressBasedMemoryAliasGroups) {
+  const X86Canonicalizer canonicalizer(&llvm_architecture_->target_machine(),
+                                       MemoryAliasAnalysis::kAddressBased);
+  EXPECT_EQ(canonicalizer.memory_alias_analysis(),
+            MemoryAliasAnalysis::kAddressBased);
+  const std::vector<llvm::MCInst> mcinsts = ParseAssemblyCode(R"(
+      MOV QWORD PTR [RSP + 8], RAX
+      MOV QWORD PTR [RSP + 16], RBX
+      MOV RCX, QWORD PTR [RSP + 8]
+      ADD DWORD PTR [RSP + 20], 1
+      MOV RDX, RSP
+  )");
+  ASSERT_THAT(mcinsts, Not(IsEmpty()));
+
+  EXPECT_THAT(MemoryAliasGroups(canonicalizer.BasicBlockFromMCInst(mcinsts)),
+              ElementsAre(ElementsAre(1), ElementsAre(2), ElementsAre(1),
+                          ElementsAre(2, 2), IsEmpty()));
+  // The default canonicalizer keeps all memory accesses in the same group.
+  EXPECT_THAT(MemoryAliasGroups(extractor_->BasicBlockFromMCInst(mcinsts)),
+              ElementsAre(ElementsAre(1), ElementsAre(1), ElementsAre(1),
+                          ElementsAre(1, 1), IsEmpty()));
+}
+
+TEST_F(X86BasicBlockExtractorTest, AddressBasedMemoryAliasGroupsWithIndex) {
+  const X86Canonicalizer canonicalizer(&llvm_architecture_->target_machine(),
+                                       MemoryAliasAnalysis::kAddressBased);
+  const std::vector<llvm::MCInst> mcinsts = ParseAssemblyCode(R"(
+      MOVSS DWORD PTR [RDI + 4 * RCX], XMM0
+      MOVSS DWORD PTR [RDI + 4 * RCX + 4], XMM1
+  )");
+  ASSERT_THAT(mcinsts, Not(IsEmpty()));
+
+  EXPECT_THAT(MemoryAliasGroups(canonicalizer.BasicBlockFromMCInst(mcinsts)),
+              ElementsAre(ElementsAre(1), ElementsAre(2)));
+}
+
+TEST_F(X86BasicBlockExtractorTest, AddressBasedMemoryAliasGroupsMayAlias) {
+  const X86Canonicalizer canonicalizer(&llvm_architecture_->target_machine(),
+                                       MemoryAliasAnalysis::kAddressBased);
+  // Each of these blocks has a pair of memory accesses that can't be proven to
+  // be independent.
+  const std::string kBlocks[] = {
+      // Overlapping byte ranges.
+      "MOV QWORD PTR [RSP], RAX\nMOV ECX, DWORD PTR [RSP + 4]",
+      // Different base registers.
+      "MOV QWORD PTR [RDI], RAX\nMOV RCX, QWORD PTR [RSI + 8]",
+      // The base register is modified between the accesses.
+      "MOV QWORD PTR [RDI], RAX\nADD RDI, 8\nMOV QWORD PTR [RDI + 8], RBX",
+      // A sub-register of the base register is modified.
+      "MOV QWORD PTR [RDI], RAX\nMOV DIL, 1\nMOV QWORD PTR [RDI + 8], RBX",
+      // PUSH accesses the stack through an implicit operand.
+      "MOV QWORD PTR [RSP + 8], RAX\nPUSH RBX\nMOV QWORD PTR [RSP + 16], RCX",
+      // RIP-relative addresses are different in each instruction.
+      "MOV QWORD PTR [RIP + 8], RAX\nMOV QWORD PTR [RIP + 16], RCX",
+      // The bit test may access a different quadword.
+      "BT QWORD PTR [RDI], RCX\nMOV QWORD PTR [RDI + 8], RAX",
+  };
+  for (const std::string& block : kBlocks) {
+    SCOPED_TRACE(block);
+    const std::vector<llvm::MCInst> mcinsts = ParseAssemblyCode(block);
+    ASSERT_THAT(mcinsts, Not(IsEmpty()));
+    for (const std::vector<int>& alias_groups :
+         MemoryAliasGroups(canonicalizer.BasicBlockFromMCInst(mcinsts))) {
+      EXPECT_THAT(alias_groups, Each(1));
+    }
+  }
+}
+
 }  // namespace
 }  // namespace gematria
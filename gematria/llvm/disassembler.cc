@@ -15,12 +15,15 @@
 #include "gematria/llvm/disassembler.h"
 
 #include <cstdint>
+#include <string>
+#include <utility>
 #include <vector>
 
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/str_cat.h"
 #include "absl/types/span.h"
+#include "gematria/utils/instrumentation.h"
 #include "llvm/include/llvm/ADT/ArrayRef.h"
 #include "llvm/include/llvm/MC/MCDisassembler/MCDisassembler.h"
 #include "llvm/include/llvm/MC/MCInstPrinter.h"
@@ -43,19 +46,22 @@ std::string AssemblyFromMCInst(const llvm::MCInstrInfo& instruction_info,
   return assembly_code;
 }
 
-absl::StatusOr<DisassembledInstruction> DisassembleOneInstruction(
+absl::Status DisassembleOneInstruction(
     const llvm::MCDisassembler& disassembler,
     const llvm::MCInstrInfo& instruction_info,
     const llvm::MCRegisterInfo& register_info,
     const llvm::MCSubtargetInfo& subtarget_info, llvm::MCInstPrinter& printer,
-    uint64_t base_address, absl::Span<const uint8_t>& machine_code) {
+    const DisassemblerOptions& options, uint64_t base_address,
+    absl::Span<const uint8_t>& machine_code, DisassembledInstruction& result) {
   if (machine_code.empty())
     return absl::InvalidArgumentError("The input is empty");
 
-  std::string disassembler_output_buffer;
-  llvm::raw_string_ostream output(disassembler_output_buffer);
+  // Clear() keeps the allocated string buffers of the proto, so that they can
+  // be reused for the new instruction.
+  result.instruction.Clear();
+  result.mc_inst = llvm::MCInst();
+  result.size = 0;
 
-  DisassembledInstruction result;
   llvm::ArrayRef<uint8_t> data(machine_code.data(), machine_code.size());
   // Use the current position of the instruction in memory as its address. This
   // is most likely not the "true" address, but in most cases it's the best we
@@ -63,20 +69,28 @@ absl::StatusOr<DisassembledInstruction> DisassembleOneInstruction(
   const uint64_t instruction_address =
       reinterpret_cast<uint64_t>(machine_code.data());
   uint64_t instruction_size = 0;
-  result.instruction.set_address(base_address);
   using DecodeStatus = llvm::MCDisassembler::DecodeStatus;
-  const DecodeStatus status = disassembler.getInstruction(
-      result.mc_inst, instruction_size, data, instruction_address, output);
-  switch (status) {
-    case DecodeStatus::Success:
-      break;
-    case DecodeStatus::Fail:
-      return absl::InvalidArgumentError(
-          absl::StrCat("Disassembling the instruction failed: ",
-                       disassembler_output_buffer));
-    case DecodeStatus::SoftFail:
+  // The disassembler writes comments and diagnostics to the stream. We need
+  // them only to report errors, so we discard them in the first attempt and
+  // decode the instruction again to collect them if the first attempt fails.
+  const DecodeStatus status =
+      disassembler.getInstruction(result.mc_inst, instruction_size, data,
+                                  instruction_address, llvm::nulls());
+  if (status != DecodeStatus::Success) {
+    AddToInstrumentationCounter(InstrumentationCounter::kDisassemblyFailures);
+    std::string disassembler_output_buffer;
+    llvm::raw_string_ostream output(disassembler_output_buffer);
+    llvm::MCInst mc_inst;
+    disassembler.getInstruction(mc_inst, instruction_size, data,
+                                instruction_address, output);
+    output.flush();
+    if (status == DecodeStatus::SoftFail) {
       return absl::InvalidArgumentError(
           absl::StrCat("Incomplete instruction: ", disassembler_output_buffer));
+    }
+    return absl::InvalidArgumentError(
+        absl::StrCat("Disassembling the instruction failed: ",
+                     disassembler_output_buffer));
   }
 
   if (instruction_size > machine_code.size()) {
@@ -85,39 +99,86 @@ absl::StatusOr<DisassembledInstruction> DisassembleOneInstruction(
         ") is bigger than the input buffer (", machine_code.size(), ")."));
   }
 
-  std::string instruction_machine_code(machine_code.begin(),
-                                       machine_code.begin() + instruction_size);
-  result.instruction.set_machine_code(std::move(instruction_machine_code));
-  result.instruction.set_assembly(
-      AssemblyFromMCInst(instruction_info, register_info, subtarget_info,
-                         printer, result.mc_inst));
+  result.size = static_cast<int>(instruction_size);
+  AddToInstrumentationCounter(
+      InstrumentationCounter::kInstructionsDisassembled);
+  AddToInstrumentationCounter(InstrumentationCounter::kBytesDisassembled,
+                              static_cast<int64_t>(instruction_size));
+  if (options.include_address) {
+    result.instruction.set_address(base_address);
+  }
+  if (options.include_machine_code) {
+    result.instruction.mutable_machine_code()->assign(
+        reinterpret_cast<const char*>(machine_code.data()), instruction_size);
+  }
+  if (options.include_assembly) {
+    std::string& assembly = *result.instruction.mutable_assembly();
+    llvm::raw_string_ostream stream(assembly);
+    printer.printInst(&result.mc_inst, 0, "", subtarget_info, stream);
+    stream.flush();
+  }
   machine_code.remove_prefix(instruction_size);
-  return result;
+  return absl::OkStatus();
 }
 
-absl::StatusOr<std::vector<DisassembledInstruction>> DisassembleAllInstructions(
+absl::StatusOr<DisassembledInstruction> DisassembleOneInstruction(
     const llvm::MCDisassembler& disassembler,
     const llvm::MCInstrInfo& instruction_info,
     const llvm::MCRegisterInfo& register_info,
     const llvm::MCSubtargetInfo& subtarget_info, llvm::MCInstPrinter& printer,
-    uint64_t base_address, absl::Span<const uint8_t> machine_code) {
-  std::vector<DisassembledInstruction> result;
+    uint64_t base_address, absl::Span<const uint8_t>& machine_code,
+    const DisassemblerOptions& options /*= DisassemblerOptions()*/) {
+  DisassembledInstruction result;
+  const absl::Status status = DisassembleOneInstruction(
+      disassembler, instruction_info, register_info, subtarget_info, printer,
+      options, base_address, machine_code, result);
+  if (!status.ok()) return status;
+  return result;
+}
 
+absl::Status DisassembleAllInstructions(
+    const llvm::MCDisassembler& disassembler,
+    const llvm::MCInstrInfo& instruction_info,
+    const llvm::MCRegisterInfo& register_info,
+    const llvm::MCSubtargetInfo& subtarget_info, llvm::MCInstPrinter& printer,
+    const DisassemblerOptions& options, uint64_t base_address,
+    absl::Span<const uint8_t> machine_code,
+    std::vector<DisassembledInstruction>& instructions) {
+  ScopedInstrumentationTimer timer(
+      InstrumentationStage::kDisassembleAllInstructions);
+  size_t num_instructions = 0;
   int num_consumed_bytes = 0;
   while (!machine_code.empty()) {
-    absl::StatusOr<DisassembledInstruction> instruction_or_status =
-        DisassembleOneInstruction(
-            disassembler, instruction_info, register_info, subtarget_info,
-            printer, base_address + num_consumed_bytes, machine_code);
-    if (!instruction_or_status.ok()) {
-      return absl::InvalidArgumentError(absl::StrCat(
-          "Parsing of machine code failed at byte ", num_consumed_bytes,
-          " with error: ", instruction_or_status.status().ToString()));
+    if (num_instructions == instructions.size()) instructions.emplace_back();
+    DisassembledInstruction& instruction = instructions[num_instructions];
+    const absl::Status status = DisassembleOneInstruction(
+        disassembler, instruction_info, register_info, subtarget_info, printer,
+        options, base_address + num_consumed_bytes, machine_code, instruction);
+    if (!status.ok()) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Parsing of machine code failed at byte ",
+                       num_consumed_bytes, " with error: ", status.ToString()));
     }
-    result.push_back(std::move(instruction_or_status).value());
-    num_consumed_bytes += result.back().instruction.machine_code().size();
+    ++num_instructions;
+    num_consumed_bytes += instruction.size;
   }
+  instructions.resize(num_instructions);
+
+  return absl::OkStatus();
+}
 
+absl::StatusOr<std::vector<DisassembledInstruction>> DisassembleAllInstructions(
+    const llvm::MCDisassembler& disassembler,
+    const llvm::MCInstrInfo& instruction_info,
+    const llvm::MCRegisterInfo& register_info,
+    const llvm::MCSubtargetInfo& subtarget_info, llvm::MCInstPrinter& printer,
+    uint64_t base_address, absl::Span<const uint8_t> machine_code,
+    const DisassemblerOptions& options /*= DisassemblerOptions()*/) {
+  std::vector<DisassembledInstruction> result;
+  const absl::Status status = DisassembleAllInstructions(
+      disassembler, instruction_info, register_info, subtarget_info, printer,
+      options, base_address, machine_code, result);
+  if (!status.ok()) return status;
   return std::move(result);
 }
 
@@ -18,6 +18,7 @@
 #include <cstdint>
 #include <vector>
 
+#include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "absl/types/span.h"
 #include "gematria/proto/basic_block.pb.h"
@@ -36,6 +37,23 @@ namespace gematria {
 struct DisassembledInstruction {
   MachineInstructionProto instruction;
   llvm::MCInst mc_inst;
+  // The size of the instruction in bytes. Unlike `instruction.machine_code()`,
+  // this is always filled in.
+  int size = 0;
+};
+
+// Controls which fields of MachineInstructionProto are filled in by the
+// disassembler functions below. The fields that are not needed by the caller
+// can be skipped to save time; in particular, the assembly code requires
+// running the instruction printer. `DisassembledInstruction::mc_inst` and
+// `DisassembledInstruction::size` are always filled in.
+struct DisassemblerOptions {
+  // Fill in `MachineInstructionProto::assembly`.
+  bool include_assembly = true;
+  // Fill in `MachineInstructionProto::machine_code`.
+  bool include_machine_code = true;
+  // Fill in `MachineInstructionProto::address`.
+  bool include_address = true;
 };
 
 // Creates the assembly representation of an llvm::MCInst.
@@ -55,7 +73,21 @@ absl::StatusOr<DisassembledInstruction> DisassembleOneInstruction(
     const llvm::MCInstrInfo& instruction_info,
     const llvm::MCRegisterInfo& register_info,
     const llvm::MCSubtargetInfo& subtarget_info, llvm::MCInstPrinter& printer,
-    uint64_t base_address, absl::Span<const uint8_t>& machine_code);
+    uint64_t base_address, absl::Span<const uint8_t>& machine_code,
+    const DisassemblerOptions& options = DisassemblerOptions());
+
+// A version of DisassembleOneInstruction() that stores the instruction in a
+// caller-provided `result`. The previous contents of `result` are overwritten,
+// but its buffers are reused where possible, which reduces the number of
+// allocations when disassembling many instructions. On error, the contents of
+// `result` are unspecified.
+absl::Status DisassembleOneInstruction(
+    const llvm::MCDisassembler& disassembler,
+    const llvm::MCInstrInfo& instruction_info,
+    const llvm::MCRegisterInfo& register_info,
+    const llvm::MCSubtargetInfo& subtarget_info, llvm::MCInstPrinter& printer,
+    const DisassemblerOptions& options, uint64_t base_address,
+    absl::Span<const uint8_t>& machine_code, DisassembledInstruction& result);
 
 // Disassembles all instructions from `machine_code`. Succeeds only when all
 // bytes have been consumed, i.e. it is an error if some number of bytes towards
@@ -68,7 +100,22 @@ absl::StatusOr<std::vector<DisassembledInstruction>> DisassembleAllInstructions(
     const llvm::MCInstrInfo& instruction_info,
     const llvm::MCRegisterInfo& register_info,
     const llvm::MCSubtargetInfo& subtarget_info, llvm::MCInstPrinter& printer,
-    uint64_t base_address, absl::Span<const uint8_t> machine_code);
+    uint64_t base_address, absl::Span<const uint8_t> machine_code,
+    const DisassemblerOptions& options = DisassemblerOptions());
+
+// A version of DisassembleAllInstructions() that stores the instructions in a
+// caller-provided vector. On success, `instructions` contains exactly the
+// instructions from `machine_code`; the elements already present in the vector
+// are overwritten in place and their buffers are reused. On error, the contents
+// of `instructions` are unspecified.
+absl::Status DisassembleAllInstructions(
+    const llvm::MCDisassembler& disassembler,
+    const llvm::MCInstrInfo& instruction_info,
+    const llvm::MCRegisterInfo& register_info,
+    const llvm::MCSubtargetInfo& subtarget_info, llvm::MCInstPrinter& printer,
+    const DisassemblerOptions& options, uint64_t base_address,
+    absl::Span<const uint8_t> machine_code,
+    std::vector<DisassembledInstruction>& instructions);
 
 }  // namespace gematria
 
@@ -17,6 +17,7 @@
 #include <cstdint>
 #include <iterator>
 #include <memory>
+#include <vector>
 
 #include "absl/status/status.h"
 #include "gematria/llvm/llvm_architecture_support.h"
@@ -292,5 +293,55 @@ TEST_F(DisassembleOneInstructionTest, X86_InvalidInstructionSequence) {
       StatusIs(absl::StatusCode::kInvalidArgument));
 }
 
+TEST_F(DisassembleAllInstructionsTest, X86_SkipOptionalFields) {
+  static constexpr uint8_t kInstructionData[] = {0x90, 0x48, 0x89, 0xd8};
+  static constexpr uint64_t kAddress = 305;
+  std::unique_ptr<llvm::MCInstPrinter> mc_inst_printer =
+      llvm_x86_64_->CreateMCInstPrinter(1);
+
+  DisassemblerOptions options;
+  options.include_assembly = false;
+  options.include_machine_code = false;
+  options.include_address = false;
+  EXPECT_THAT(
+      DisassembleAllInstructions(
+          llvm_x86_64_->mc_disassembler(), llvm_x86_64_->mc_instr_info(),
+          llvm_x86_64_->mc_register_info(), llvm_x86_64_->mc_subtarget_info(),
+          *mc_inst_printer, kAddress, kInstructionData, options),
+      IsOkAndHolds(ElementsAre(
+          AllOf(Field(&DisassembledInstruction::instruction,
+                      EqualsProto(MachineInstructionProto())),
+                Field(&DisassembledInstruction::size, 1)),
+          AllOf(Field(&DisassembledInstruction::instruction,
+                      EqualsProto(MachineInstructionProto())),
+                Field(&DisassembledInstruction::mc_inst,
+                      IsMCInst(llvm::X86::MOV64rr, _)),
+                Field(&DisassembledInstruction::size, 3)))));
+}
+
+TEST_F(DisassembleAllInstructionsTest, X86_ReuseOutputBuffer) {
+  static constexpr uint8_t kNopMovRaxRbx[] = {0x90, 0x48, 0x89, 0xd8};
+  static constexpr uint8_t kMovRaxRbx[] = {0x48, 0x89, 0xd8};
+  static constexpr uint64_t kAddress = 306;
+  std::unique_ptr<llvm::MCInstPrinter> mc_inst_printer =
+      llvm_x86_64_->CreateMCInstPrinter(1);
+
+  std::vector<DisassembledInstruction> instructions;
+  EXPECT_OK(DisassembleAllInstructions(
+      llvm_x86_64_->mc_disassembler(), llvm_x86_64_->mc_instr_info(),
+      llvm_x86_64_->mc_register_info(), llvm_x86_64_->mc_subtarget_info(),
+      *mc_inst_printer, DisassemblerOptions(), kAddress, kNopMovRaxRbx,
+      instructions));
+  EXPECT_THAT(instructions, ElementsAre(IsX86Nop(kAddress),
+                                        IsX86MovRaxRbx(kAddress + 1)));
+
+  EXPECT_OK(DisassembleAllInstructions(
+      llvm_x86_64_->mc_disassembler(), llvm_x86_64_->mc_instr_info(),
+      llvm_x86_64_->mc_register_info(), llvm_x86_64_->mc_subtarget_info(),
+      *mc_inst_printer, DisassemblerOptions(), kAddress, kMovRaxRbx,
+      instructions));
+  EXPECT_THAT(instructions, ElementsAre(IsX86MovRaxRbx(kAddress)));
+}
+
 }  // namespace
 }  // namespace gematria
@@ -18,17 +18,24 @@
 #include <optional>
 #include <string>
 #include <string_view>
+#include <tuple>
 #include <utility>
+#include <vector>
 
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
 #include "absl/log/check.h"
 #include "absl/log/die_if_null.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "gematria/basic_block/register_unit_table.h"
 #include "llvm/include/llvm-c/Target.h"
 #include "llvm/include/llvm/ADT/StringRef.h"
 #include "llvm/include/llvm/MC/MCContext.h"
+#include "llvm/include/llvm/MC/MCRegisterInfo.h"
 #include "llvm/include/llvm/MC/TargetRegistry.h"
 #include "llvm/include/llvm/Target/TargetOptions.h"
 
@@ -80,6 +87,49 @@ std::unique_ptr<LlvmArchitectureSupport> LlvmArchitectureSupport::X86_64() {
   return std::move(x86_64_or_status).value();
 }
 
+absl::StatusOr<const LlvmArchitectureSupport*>
+LlvmArchitectureSupport::GetShared(std::string_view llvm_triple,
+                                   std::string_view cpu,
+                                   std::string_view cpu_features) {
+  using Key = std::tuple<std::string, std::string, std::string>;
+  struct Registry {
+    absl::Mutex mutex;
+    absl::flat_hash_map<Key, std::unique_ptr<LlvmArchitectureSupport>>
+        instances ABSL_GUARDED_BY(mutex);
+  };
+  static Registry* const registry = new Registry();
+
+  Key key(llvm_triple, cpu, cpu_features);
+  absl::MutexLock lock(&registry->mutex);
+  const auto it = registry->instances.find(key);
+  if (it != registry->instances.end()) return it->second.get();
+  // The lock is held while the instance is created, so that concurrent calls
+  // with the same arguments do not create it more than once. Errors are not
+  // cached; a failed call is retried on the next invocation.
+  absl::StatusOr<std::unique_ptr<LlvmArchitectureSupport>> architecture =
+      FromTriple(llvm_triple, cpu, cpu_features);
+  if (!architecture.ok()) return architecture.status();
+  return registry->instances.emplace(std::move(key), *std::move(architecture))
+      .first->second.get();
+}
+
+std::shared_ptr<const RegisterUnitTable>
+LlvmArchitectureSupport::CreateRegisterUnitTable() const {
+  const llvm::MCRegisterInfo& register_info = mc_register_info();
+  auto table = std::make_shared<RegisterUnitTable>();
+  std::vector<int> units;
+  // Register 0 is the "no register" value; it has no name and no units.
+  for (unsigned reg = 1; reg < register_info.getNumRegs(); ++reg) {
+    units.clear();
+    for (llvm::MCRegUnitIterator unit(reg, &register_info); unit.isValid();
+         ++unit) {
+      units.push_back(static_cast<int>(*unit));
+    }
+    table->AddRegister(register_info.getName(reg), units);
+  }
+  return table;
+}
+
 LlvmArchitectureSupport::LlvmArchitectureSupport(std::string_view llvm_triple,
                                                  std::string_view cpu,
                                                  std::string_view cpu_features,
@@ -19,6 +19,7 @@
 #include <string_view>
 
 #include "absl/status/statusor.h"
+#include "gematria/basic_block/register_unit_table.h"
 #include "llvm/include/llvm/MC/MCAsmInfo.h"
 #include "llvm/include/llvm/MC/MCContext.h"
 #include "llvm/include/llvm/MC/MCDisassembler/MCDisassembler.h"
@@ -33,6 +34,12 @@ namespace gematria {
 
 // Provides a single handle to all LLVM objects representing a given
 // architecture that can be passed around easily and shared with Python code.
+//
+// The target machine and the target info objects returned by the accessors are
+// immutable and they can be shared by multiple threads. The disassembler
+// returned by mc_disassembler() uses a shared MCContext and it must not be used
+// from multiple threads at the same time; threads that need to disassemble code
+// concurrently should create their own disassembler and MCContext.
 class LlvmArchitectureSupport {
  public:
   // Creates the architecture support from an LLVM triple. Returns an error when
@@ -45,6 +52,17 @@ class LlvmArchitectureSupport {
   // Calls the necessary LLVMInitializeX86*() functions on the first invocation.
   static std::unique_ptr<LlvmArchitectureSupport> X86_64();
 
+  // Returns a process-wide instance of the architecture support for the given
+  // LLVM triple, CPU and CPU features. The instance is created on the first
+  // call with a given combination of the arguments; later calls return the
+  // same object, without creating a new target machine, MCContext, and
+  // disassembler. The instances are never destroyed. Returns an error when the
+  // architecture can't be created. This function is thread-safe, but the
+  // restrictions on the use of mc_disassembler() apply to the shared instance.
+  static absl::StatusOr<const LlvmArchitectureSupport*> GetShared(
+      std::string_view llvm_triple, std::string_view cpu,
+      std::string_view cpu_features);
+
   // Creates a new llvm::MCInstPriner. The value of `syntax_variant` is
   // architecture dependent, and corresponds to the same argument of
   // createMCInstPrinter.
@@ -56,6 +74,11 @@ class LlvmArchitectureSupport {
         mc_instr_info(), mc_register_info()));
   }
 
+  // Creates a table that maps the names of all registers of the target to
+  // their register units in mc_register_info(). The graph builder uses the
+  // table to track dependencies between aliasing registers.
+  std::shared_ptr<const RegisterUnitTable> CreateRegisterUnitTable() const;
+
   const llvm::Target& target() const { return *target_; }
 
   const llvm::TargetMachine& target_machine() const { return *target_machine_; }
@@ -16,6 +16,9 @@
 
 #include <memory>
 
+#include "absl/types/span.h"
+#include "gematria/basic_block/register_unit_table.h"
+#include "gematria/basic_block/token_table.h"
 #include "gematria/testing/matchers.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
@@ -23,6 +26,11 @@
 namespace gematria {
 namespace {
 
+using ::testing::Contains;
+using ::testing::IsEmpty;
+using ::testing::IsSubsetOf;
+using ::testing::Not;
+
 TEST(LlvmArchitectureSupportTest, X86_64) {
   std::unique_ptr<LlvmArchitectureSupport> x86_64 =
       LlvmArchitectureSupport::X86_64();
@@ -48,5 +56,57 @@ TEST(LlvmArchitectureSupportTest, FromTriple_Invalid) {
   EXPECT_THAT(x86_64_or_status, StatusIs(absl::StatusCode::kNotFound));
 }
 
+TEST(LlvmArchitectureSupportTest, GetShared) {
+  absl::StatusOr<const LlvmArchitectureSupport*> x86_64 =
+      LlvmArchitectureSupport::GetShared("x86_64", "", "");
+  ASSERT_OK(x86_64);
+  ASSERT_NE(*x86_64, nullptr);
+  EXPECT_EQ((*x86_64)->target_machine().getTargetTriple().getArchName(),
+            "x86_64");
+
+  // The same arguments return the same instance, different arguments return a
+  // different one.
+  EXPECT_THAT(LlvmArchitectureSupport::GetShared("x86_64", "", ""),
+              IsOkAndHolds(*x86_64));
+  absl::StatusOr<const LlvmArchitectureSupport*> skylake =
+      LlvmArchitectureSupport::GetShared("x86_64", "skylake", "");
+  ASSERT_OK(skylake);
+  EXPECT_NE(*skylake, *x86_64);
+  EXPECT_EQ((*skylake)->target_machine().getTargetCPU(), "skylake");
+}
+
+TEST(LlvmArchitectureSupportTest, GetShared_Invalid) {
+  EXPECT_THAT(LlvmArchitectureSupport::GetShared(
+                  "an_architecture_that_does_not_exist", "", ""),
+              StatusIs(absl::StatusCode::kNotFound));
+}
+
+TEST(LlvmArchitectureSupportTest, CreateRegisterUnitTable) {
+  std::unique_ptr<LlvmArchitectureSupport> x86_64 =
+      LlvmArchitectureSupport::X86_64();
+  std::shared_ptr<const RegisterUnitTable> table =
+      x86_64->CreateRegisterUnitTable();
+  ASSERT_NE(table, nullptr);
+  EXPECT_GT(table->num_units(), 0);
+
+  TokenTable& token_table = TokenTable::Global();
+  const absl::Span<const int> rax = table->units(token_table.Find("RAX"));
+  const absl::Span<const int> eax = table->units(token_table.Find("EAX"));
+  const absl::Span<const int> al = table->units(token_table.Find("AL"));
+  const absl::Span<const int> ah = table->units(token_table.Find("AH"));
+  const absl::Span<const int> rbx = table->units(token_table.Find("RBX"));
+  EXPECT_THAT(rax, Not(IsEmpty()));
+  EXPECT_THAT(eax, IsSubsetOf(rax));
+  EXPECT_THAT(al, IsSubsetOf(eax));
+  EXPECT_THAT(ah, IsSubsetOf(eax));
+  // AL and AH are independent parts of RAX, and RBX does not alias RAX.
+  for (const int unit : ah) {
+    EXPECT_THAT(al, Not(Contains(unit)));
+  }
+  for (const int unit : rbx) {
+    EXPECT_THAT(rax, Not(Contains(unit)));
+  }
+}
+
 }  // namespace
 }  // namespace gematria
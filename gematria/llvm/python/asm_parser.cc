@@ -0,0 +1,164 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "gematria/llvm/asm_parser.h"
+
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/status/statusor.h"
+#include "gematria/basic_block/basic_block.h"
+#include "gematria/llvm/canonicalizer.h"
+#include "gematria/llvm/llvm_architecture_support.h"
+#include "llvm/include/llvm/IR/InlineAsm.h"
+#include "llvm/include/llvm/MC/MCInst.h"
+#include "pybind11/cast.h"
+#include "pybind11/detail/common.h"
+#include "pybind11/pybind11.h"
+#include "pybind11/stl.h"
+#include "pybind11_abseil/import_status_module.h"
+#include "pybind11_abseil/status_casters.h"
+
+namespace gematria {
+namespace {
+
+namespace py = ::pybind11;
+
+// Wraps AsmParserSession together with a canonicalizer, so that the session can
+// return Gematria instructions rather than MCInst objects that are not exported
+// to Python.
+class CanonicalizingAsmParserSession {
+ public:
+  CanonicalizingAsmParserSession(
+      const LlvmArchitectureSupport& llvm_architecture,
+      const Canonicalizer& canonicalizer, llvm::InlineAsm::AsmDialect dialect)
+      : session_(llvm_architecture.target_machine(), dialect),
+        canonicalizer_(canonicalizer) {}
+
+  absl::StatusOr<std::vector<Instruction>> Parse(std::string_view assembly) {
+    absl::StatusOr<std::vector<llvm::MCInst>> mcinsts =
+        session_.ParseAsmCode(assembly);
+    if (!mcinsts.ok()) return std::move(mcinsts).status();
+    // Canonicalize the snippet as a basic block, so that the block-level
+    // passes, e.g. the memory alias analysis, are applied to the instructions.
+    return std::move(
+        canonicalizer_.BasicBlockFromMCInst(*mcinsts).instructions);
+  }
+
+  std::vector<py::tuple> ParseBatch(
+      const std::vector<std::string>& assemblies) {
+    // Parse all snippets first and then canonicalize the successfully parsed
+    // ones in a single batch.
+    std::vector<std::vector<llvm::MCInst>> parsed_blocks;
+    std::vector<std::string> error_messages(assemblies.size());
+    std::vector<bool> parsed(assemblies.size(), false);
+    parsed_blocks.reserve(assemblies.size());
+    for (int i = 0; i < assemblies.size(); ++i) {
+      absl::StatusOr<std::vector<llvm::MCInst>> mcinsts =
+          session_.ParseAsmCode(assemblies[i]);
+      if (mcinsts.ok()) {
+        parsed_blocks.push_back(*std::move(mcinsts));
+        parsed[i] = true;
+      } else {
+        error_messages[i] = std::string(mcinsts.status().message());
+      }
+    }
+    std::vector<BasicBlock> blocks =
+        canonicalizer_.BasicBlocksFromMCInsts(parsed_blocks);
+
+    std::vector<py::tuple> results;
+    results.reserve(assemblies.size());
+    int next_block = 0;
+    for (int i = 0; i < assemblies.size(); ++i) {
+      if (parsed[i]) {
+        results.push_back(py::make_tuple(
+            std::move(blocks[next_block++].instructions), py::none()));
+      } else {
+        results.push_back(py::make_tuple(py::none(), error_messages[i]));
+      }
+    }
+    return results;
+  }
+
+  int num_parser_initializations() const {
+    return session_.num_parser_initializations();
+  }
+
+ private:
+  AsmParserSession session_;
+  const Canonicalizer& canonicalizer_;
+};
+
+PYBIND11_MODULE(asm_parser, m) {
+  m.doc() = "Parsing of assembly code to canonicalized instructions.";
+
+  py::google::ImportStatusModule();
+
+  py::enum_<llvm::InlineAsm::AsmDialect>(m, "AsmDialect")
+      .value("ATT", llvm::InlineAsm::AD_ATT)
+      .value("INTEL", llvm::InlineAsm::AD_Intel);
+
+  py::class_<CanonicalizingAsmParserSession>(
+      m, "AsmParserSession",
+      R"(Parses many snippets of assembly code with one LLVM assembly parser.
+
+      Creating the LLVM objects used for parsing is much more expensive than
+      parsing a short snippet; the session keeps them alive between the calls.
+      Each snippet is parsed independently, and a snippet that fails to parse
+      does not affect the following ones. Labels, directives, and other parts of
+      the assembly language that are not instructions are ignored.)")
+      .def(py::init<const LlvmArchitectureSupport&, const Canonicalizer&,
+                    llvm::InlineAsm::AsmDialect>(),
+           py::arg("llvm_architecture"), py::arg("canonicalizer"),
+           py::arg("dialect") = llvm::InlineAsm::AD_ATT,
+           // The session keeps references to the LLVM architecture and the
+           // canonicalizer.
+           py::keep_alive<1, 2>(), py::keep_alive<1, 3>())
+      .def("parse", &CanonicalizingAsmParserSession::Parse,
+           py::arg("assembly"),
+           R"(Parses a snippet of assembly code.
+
+           Args:
+             assembly: The assembly code to parse.
+
+           Returns:
+             The list of canonicalized instructions in the snippet. The snippet
+             is canonicalized as a single basic block, i.e. the memory alias
+             groups of the instructions are assigned by the alias analysis of
+             the canonicalizer over the whole snippet.
+
+           Raises:
+             StatusNotOk: When the assembly code can't be parsed.)")
+      .def("parse_batch", &CanonicalizingAsmParserSession::ParseBatch,
+           py::arg("assemblies"),
+           R"(Parses a list of snippets of assembly code.
+
+           Args:
+             assemblies: The list of snippets to parse.
+
+           Returns:
+             A list that contains a tuple (instructions, error) for each
+             snippet, in the order of the snippets. For snippets that were
+             parsed successfully, `instructions` is the list of canonicalized
+             instructions and `error` is None; for snippets that could not be
+             parsed, `instructions` is None and `error` is the error message.)")
+      .def_property_readonly(
+          "num_parser_initializations",
+          &CanonicalizingAsmParserSession::num_parser_initializations);
+}
+
+}  // namespace
+}  // namespace gematria
@@ -0,0 +1,71 @@
+# Copyright 2023 Google Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#    http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+from absl.testing import absltest
+from gematria.llvm.python import asm_parser
+from gematria.llvm.python import canonicalizer
+from gematria.llvm.python import llvm_architecture_support
+from pybind11_abseil import status
+
+
+class AsmParserSessionTest(absltest.TestCase):
+
+  def setUp(self):
+    super().setUp()
+    self.llvm = llvm_architecture_support.LlvmArchitectureSupport.x86_64()
+    self.canonicalizer = canonicalizer.Canonicalizer.x86_64(self.llvm)
+
+  def test_parse(self):
+    session = asm_parser.AsmParserSession(
+        self.llvm, self.canonicalizer, asm_parser.AsmDialect.INTEL
+    )
+    instructions = session.parse("xor eax, eax\nadd eax, 1")
+    self.assertSequenceEqual(
+        [instruction.mnemonic for instruction in instructions],
+        ("XOR", "ADD"),
+    )
+
+  def test_parse_error(self):
+    session = asm_parser.AsmParserSession(self.llvm, self.canonicalizer)
+    with self.assertRaises(status.StatusNotOk):
+      session.parse("this is not valid assembly")
+
+  def test_parse_batch(self):
+    session = asm_parser.AsmParserSession(
+        self.llvm, self.canonicalizer, asm_parser.AsmDialect.ATT
+    )
+    results = session.parse_batch(
+        ["xorl %eax, %eax", "this is not valid assembly", "addl $1, %eax"]
+    )
+    self.assertLen(results, 3)
+
+    instructions, error = results[0]
+    self.assertIsNone(error)
+    self.assertEqual(
+        [instruction.mnemonic for instruction in instructions], ["XOR"]
+    )
+
+    instructions, error = results[1]
+    self.assertIsNone(instructions)
+    self.assertIsInstance(error, str)
+
+    instructions, error = results[2]
+    self.assertIsNone(error)
+    self.assertEqual(
+        [instruction.mnemonic for instruction in instructions], ["ADD"]
+    )
+
+
+if __name__ == "__main__":
+  absltest.main()
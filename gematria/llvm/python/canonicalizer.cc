@@ -28,6 +28,13 @@ PYBIND11_MODULE(canonicalizer, m) {
   m.doc() =
       "Provides code for extracting canonical representation of instructions";
 
+  py::enum_<MemoryAliasAnalysis>(m, "MemoryAliasAnalysis",
+                                 R"(The analysis used to assign alias groups.
+
+      See the comments in the C++ version of the enum for more details.)")
+      .value("WHOLE_MEMORY", MemoryAliasAnalysis::kWholeMemory)
+      .value("ADDRESS_BASED", MemoryAliasAnalysis::kAddressBased);
+
   py::class_<Canonicalizer>(  //
       m, "Canonicalizer",
       R"(Provides methods for extracting canonicalized instructions.
@@ -36,14 +43,17 @@ PYBIND11_MODULE(canonicalizer, m) {
       functions and classes imported from C++ that need a canonicalizer.)")
       .def_static(
           "x86_64",
-          [](const LlvmArchitectureSupport& llvm_architecture) {
+          [](const LlvmArchitectureSupport& llvm_architecture,
+             MemoryAliasAnalysis memory_alias_analysis) {
             // We need to explicitly convert to std::unique_ptr<Canonicalizer>
             // to make sure that pybind11 knows how to match the types.
             return std::unique_ptr<Canonicalizer>(
                 std::make_unique<X86Canonicalizer>(
-                    &llvm_architecture.target_machine()));
+                    &llvm_architecture.target_machine(),
+                    memory_alias_analysis));
           },
           py::arg("llvm_architecture"),
+          py::arg("memory_alias_analysis") = MemoryAliasAnalysis::kWholeMemory,
           "Creates a new Canonicalizer for x86-64 from the given LLVM "
           "architecture support");
 }
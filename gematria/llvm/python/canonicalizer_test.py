@@ -24,6 +24,14 @@ class CanonicalizerTest(absltest.TestCase):
     x86_canonicalizer = canonicalizer.Canonicalizer.x86_64(llvm)
     self.assertIsInstance(x86_canonicalizer, canonicalizer.Canonicalizer)
 
+  def test_x86_64_with_memory_alias_analysis(self):
+    llvm = llvm_architecture_support.LlvmArchitectureSupport.x86_64()
+    x86_canonicalizer = canonicalizer.Canonicalizer.x86_64(
+        llvm,
+        memory_alias_analysis=canonicalizer.MemoryAliasAnalysis.ADDRESS_BASED,
+    )
+    self.assertIsInstance(x86_canonicalizer, canonicalizer.Canonicalizer)
+
 
 if __name__ == "__main__":
   absltest.main()
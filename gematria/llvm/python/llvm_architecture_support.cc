@@ -54,7 +54,29 @@ PYBIND11_MODULE(llvm_architecture_support, m) {
             StatusNotOk: When the LLVM triple does not correspond to a LLVM
               target architecture supported by Gematria.)")
       .def_static("x86_64", &LlvmArchitectureSupport::X86_64,
-                  R"(Returns a new LlvmArchitectureSupport for x86-64.)");
+                  R"(Returns a new LlvmArchitectureSupport for x86-64.)")
+      .def_static(
+          "get_shared", &LlvmArchitectureSupport::GetShared,
+          py::arg("llvm_triple"), py::arg("cpu") = std::string(),
+          py::arg("cpu_features") = std::string(),
+          py::return_value_policy::reference,
+          R"(Returns a process-wide LlvmArchitectureSupport for an LLVM triple.
+
+          The object is created on the first call with the given arguments, and
+          the same object is returned by all later calls. This avoids creating
+          the LLVM target objects again in processes that need them more than
+          once.
+
+          Args:
+            llvm_triple: The LLVM triple for which the object should be created.
+            cpu: Optional. The name of the CPU for which the object should be
+              created.
+            cpu_features: Optional. An LLVM CPU feature string further
+              specifying the parameters of the created object.
+
+          Raises:
+            StatusNotOk: When the LLVM triple does not correspond to a LLVM
+              target architecture supported by Gematria.)");
 }
 
 }  // namespace gematria
@@ -39,6 +39,24 @@ class LlvmArchitectureSupportTest(absltest.TestCase):
         llvm, llvm_architecture_support.LlvmArchitectureSupport
     )
 
+  def test_get_shared(self):
+    llvm = llvm_architecture_support.LlvmArchitectureSupport.get_shared(
+        llvm_triple="x86_64"
+    )
+    self.assertIsInstance(
+        llvm, llvm_architecture_support.LlvmArchitectureSupport
+    )
+    self.assertIs(
+        llvm,
+        llvm_architecture_support.LlvmArchitectureSupport.get_shared("x86_64"),
+    )
+
+  def test_get_shared_invalid(self):
+    with self.assertRaises(status.StatusNotOk):
+      llvm_architecture_support.LlvmArchitectureSupport.get_shared(
+          llvm_triple="not_really_an_architecture"
+      )
+
 
 if __name__ == "__main__":
   absltest.main()
@@ -0,0 +1,442 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "gematria/model/basic_block_tokenizer.h"
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/log/absl_check.h"
+#include "absl/log/die_if_null.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "gematria/basic_block/basic_block.h"
+#include "gematria/basic_block/basic_block_protos.h"
+#include "gematria/basic_block/lazy_basic_block.h"
+#include "gematria/basic_block/packed_basic_block.h"
+#include "gematria/basic_block/token_table.h"
+#include "gematria/model/oov_token_behavior.h"
+#include "gematria/model/token_vocabulary.h"
+#include "gematria/proto/basic_block.pb.h"
+#include "gematria/utils/instrumentation.h"
+
+namespace gematria {
+namespace {
+
+constexpr TokenVocabulary::TokenIndex kInvalidTokenIndex =
+    TokenVocabulary::kInvalidTokenIndex;
+
+}  // namespace
+
+BasicBlockTokenizer::BasicBlockTokenizer(
+    const std::vector<std::string>& tokens,
+    OutOfVocabularyTokenBehavior out_of_vocabulary_behavior)
+    : BasicBlockTokenizer(std::make_shared<const TokenVocabulary>(tokens),
+                          std::move(out_of_vocabulary_behavior)) {}
+
+BasicBlockTokenizer::BasicBlockTokenizer(
+    std::shared_ptr<const TokenVocabulary> tokens,
+    OutOfVocabularyTokenBehavior out_of_vocabulary_behavior)
+    : tokens_(std::move(ABSL_DIE_IF_NULL(tokens))),
+      replacement_token_(
+          out_of_vocabulary_behavior.behavior_type() ==
+                  OutOfVocabularyTokenBehavior::BehaviorType::kReturnError
+              ? kInvalidTokenIndex
+              : tokens_->Find(out_of_vocabulary_behavior.replacement_token())),
+      delimiter_token_(tokens_->Find(kDelimiterToken)),
+      immediate_token_(tokens_->Find(kImmediateToken)),
+      address_token_(tokens_->Find(kAddressToken)),
+      memory_token_(tokens_->Find(kMemoryToken)),
+      no_register_token_(tokens_->Find(kNoRegisterToken)),
+      displacement_token_(tokens_->Find(kDisplacementToken)) {
+  ABSL_CHECK(out_of_vocabulary_behavior.behavior_type() ==
+                 OutOfVocabularyTokenBehavior::BehaviorType::kReturnError ||
+             replacement_token_ != kInvalidTokenIndex)
+      << "Token was not found: '"
+      << out_of_vocabulary_behavior.replacement_token() << "'";
+  Reset();
+}
+
+bool BasicBlockTokenizer::AddBasicBlockFromInstructions(
+    const std::vector<Instruction>& instructions) {
+  const size_t prev_num_tokens = token_indices_.size();
+  const size_t prev_num_instructions = instruction_token_offsets_.size();
+  for (const Instruction& instruction : instructions) {
+    if (!AddInstruction(instruction)) {
+      token_indices_.resize(prev_num_tokens);
+      instruction_token_offsets_.resize(prev_num_instructions);
+      return false;
+    }
+    instruction_token_offsets_.push_back(num_tokens());
+  }
+  block_instruction_offsets_.push_back(num_instructions());
+  return true;
+}
+
+bool BasicBlockTokenizer::AddBasicBlock(const PackedBasicBlock& block) {
+  const size_t prev_num_tokens = token_indices_.size();
+  const size_t prev_num_instructions = instruction_token_offsets_.size();
+  for (const PackedInstruction& instruction : block.instructions()) {
+    if (!AddPackedInstruction(block, instruction)) {
+      token_indices_.resize(prev_num_tokens);
+      instruction_token_offsets_.resize(prev_num_instructions);
+      return false;
+    }
+    instruction_token_offsets_.push_back(num_tokens());
+  }
+  block_instruction_offsets_.push_back(num_instructions());
+  return true;
+}
+
+bool BasicBlockTokenizer::AddBasicBlock(const LazyBasicBlock& block) {
+  if (const BasicBlock* const basic_block = block.materialized_block()) {
+    return AddBasicBlock(*basic_block);
+  }
+  if (const PackedBasicBlock* const packed_block = block.packed_block()) {
+    return AddBasicBlock(*packed_block);
+  }
+  if (const std::string* const serialized_proto = block.serialized_proto()) {
+    // LazyBasicBlock checks that the serialized proto is valid.
+    ABSL_CHECK(proto_buffer_.ParseFromString(*serialized_proto));
+    PackedBasicBlockFromProto(proto_buffer_, packed_block_buffer_);
+    return AddBasicBlock(packed_block_buffer_);
+  }
+  return AddBasicBlock(BasicBlock());
+}
+
+std::vector<bool> BasicBlockTokenizer::AddBasicBlocks(
+    absl::Span<const BasicBlock> blocks) {
+  std::vector<const BasicBlock*> block_pointers;
+  block_pointers.reserve(blocks.size());
+  for (const BasicBlock& block : blocks) block_pointers.push_back(&block);
+  return AddBasicBlocks(block_pointers);
+}
+
+std::vector<bool> BasicBlockTokenizer::AddBasicBlocks(
+    absl::Span<const BasicBlock* const> blocks) {
+  // Reserve space based on the number of instructions. Most instructions have
+  // fewer than ten tokens, so this avoids most reallocations in the batch.
+  size_t num_new_instructions = 0;
+  for (const BasicBlock* const block : blocks) {
+    num_new_instructions += ABSL_DIE_IF_NULL(block)->instructions.size();
+  }
+  block_instruction_offsets_.reserve(block_instruction_offsets_.size() +
+                                     blocks.size());
+  instruction_token_offsets_.reserve(instruction_token_offsets_.size() +
+                                     num_new_instructions);
+  token_indices_.reserve(token_indices_.size() + 8 * num_new_instructions);
+
+  std::vector<bool> added(blocks.size());
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    added[i] = AddBasicBlock(*blocks[i]);
+  }
+  return added;
+}
+
+bool BasicBlockTokenizer::CanAddBasicBlockFromInstructions(
+    const std::vector<Instruction>& instructions) const {
+  if (replacement_token_ != kInvalidTokenIndex) return true;
+  // Every instruction uses the delimiter token.
+  if (!instructions.empty() && delimiter_token_ == kInvalidTokenIndex) {
+    return false;
+  }
+  for (const Instruction& instruction : instructions) {
+    if (tokens_->Find(instruction.mnemonic) == kInvalidTokenIndex) {
+      return false;
+    }
+    for (const std::string& prefix : instruction.prefixes) {
+      if (tokens_->Find(prefix) == kInvalidTokenIndex) return false;
+    }
+    for (const std::vector<InstructionOperand>* const operands :
+         {&instruction.output_operands, &instruction.implicit_output_operands,
+          &instruction.input_operands, &instruction.implicit_input_operands}) {
+      for (const InstructionOperand& operand : *operands) {
+        if (!CanAddOperand(operand)) return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool BasicBlockTokenizer::CanAddBasicBlock(
+    const PackedBasicBlock& block) const {
+  if (replacement_token_ != kInvalidTokenIndex) return true;
+  if (block.num_instructions() > 0 && delimiter_token_ == kInvalidTokenIndex) {
+    return false;
+  }
+  for (const PackedInstruction& instruction : block.instructions()) {
+    if (tokens_->Find(instruction.mnemonic) == kInvalidTokenIndex) {
+      return false;
+    }
+    for (const TokenId prefix : block.prefixes(instruction)) {
+      if (tokens_->Find(prefix) == kInvalidTokenIndex) return false;
+    }
+  }
+  // The operands of all instructions are stored in a single array, so they can
+  // be checked without going through the instructions.
+  for (const PackedOperand& operand : block.operands()) {
+    if (!CanAddPackedOperand(block, operand)) return false;
+  }
+  return true;
+}
+
+bool BasicBlockTokenizer::CanAddBasicBlock(const LazyBasicBlock& block) const {
+  if (const BasicBlock* const basic_block = block.materialized_block()) {
+    return CanAddBasicBlock(*basic_block);
+  }
+  if (const PackedBasicBlock* const packed_block = block.packed_block()) {
+    return CanAddBasicBlock(*packed_block);
+  }
+  if (const std::string* const serialized_proto = block.serialized_proto()) {
+    if (replacement_token_ != kInvalidTokenIndex) return true;
+    BasicBlockProto proto;
+    ABSL_CHECK(proto.ParseFromString(*serialized_proto));
+    return CanAddBasicBlock(PackedBasicBlockFromProto(proto));
+  }
+  return true;
+}
+
+std::vector<bool> BasicBlockTokenizer::CanAddBasicBlocks(
+    absl::Span<const BasicBlock> blocks) const {
+  std::vector<bool> can_add(blocks.size());
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    can_add[i] = CanAddBasicBlock(blocks[i]);
+  }
+  return can_add;
+}
+
+std::vector<bool> BasicBlockTokenizer::CanAddBasicBlocks(
+    absl::Span<const BasicBlock* const> blocks) const {
+  std::vector<bool> can_add(blocks.size());
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    can_add[i] = CanAddBasicBlock(*ABSL_DIE_IF_NULL(blocks[i]));
+  }
+  return can_add;
+}
+
+void BasicBlockTokenizer::Reset() {
+  token_indices_.clear();
+  instruction_token_offsets_.assign(1, 0);
+  block_instruction_offsets_.assign(1, 0);
+}
+
+bool BasicBlockTokenizer::AddInstruction(const Instruction& instruction) {
+  // The order of the tokens must be kept in sync with
+  // Instruction::AddTokensToList().
+  for (const std::string& prefix : instruction.prefixes) {
+    if (!AddToken(prefix)) return false;
+  }
+  if (!AddToken(instruction.mnemonic)) return false;
+  if (!AddToken(delimiter_token_, kDelimiterToken)) return false;
+  for (const auto& operand : instruction.output_operands) {
+    if (!AddOperand(operand)) return false;
+  }
+  for (const auto& operand : instruction.implicit_output_operands) {
+    if (!AddOperand(operand)) return false;
+  }
+  if (!AddToken(delimiter_token_, kDelimiterToken)) return false;
+  for (const auto& operand : instruction.input_operands) {
+    if (!AddOperand(operand)) return false;
+  }
+  for (const auto& operand : instruction.implicit_input_operands) {
+    if (!AddOperand(operand)) return false;
+  }
+  return AddToken(delimiter_token_, kDelimiterToken);
+}
+
+bool BasicBlockTokenizer::AddOperand(const InstructionOperand& operand) {
+  // The order of the tokens must be kept in sync with
+  // InstructionOperand::AddTokensToList().
+  switch (operand.type()) {
+    case OperandType::kUnknown:
+      return true;
+    case OperandType::kRegister:
+      return AddTokenById(operand.register_token());
+    case OperandType::kImmediateValue:
+    case OperandType::kFpImmediateValue:
+      return AddToken(immediate_token_, kImmediateToken);
+    case OperandType::kAddress: {
+      const AddressTuple& address = operand.address();
+      if (!AddToken(address_token_, kAddressToken)) return false;
+      if (address.base_register.empty()
+              ? !AddToken(no_register_token_, kNoRegisterToken)
+              : !AddToken(address.base_register)) {
+        return false;
+      }
+      if (address.index_register.empty()
+              ? !AddToken(no_register_token_, kNoRegisterToken)
+              : !AddToken(address.index_register)) {
+        return false;
+      }
+      if (!address.segment_register.empty() &&
+          !AddToken(address.segment_register)) {
+        return false;
+      }
+      if (address.displacement != 0 &&
+          !AddToken(displacement_token_, kDisplacementToken)) {
+        return false;
+      }
+      return true;
+    }
+    case OperandType::kMemory:
+      return AddToken(memory_token_, kMemoryToken);
+  }
+  return true;
+}
+
+bool BasicBlockTokenizer::AddPackedInstruction(
+    const PackedBasicBlock& block, const PackedInstruction& instruction) {
+  // The order of the tokens must be kept in sync with AddInstruction().
+  for (const TokenId prefix : block.prefixes(instruction)) {
+    if (!AddTokenById(prefix)) return false;
+  }
+  if (!AddTokenById(instruction.mnemonic)) return false;
+  if (!AddToken(delimiter_token_, kDelimiterToken)) return false;
+  for (const OperandList list :
+       {OperandList::kOutput, OperandList::kImplicitOutput}) {
+    for (const PackedOperand& operand : block.operands(instruction, list)) {
+      if (!AddPackedOperand(block, operand)) return false;
+    }
+  }
+  if (!AddToken(delimiter_token_, kDelimiterToken)) return false;
+  for (const OperandList list :
+       {OperandList::kInput, OperandList::kImplicitInput}) {
+    for (const PackedOperand& operand : block.operands(instruction, list)) {
+      if (!AddPackedOperand(block, operand)) return false;
+    }
+  }
+  return AddToken(delimiter_token_, kDelimiterToken);
+}
+
+bool BasicBlockTokenizer::AddPackedOperand(const PackedBasicBlock& block,
+                                           const PackedOperand& operand) {
+  // The order of the tokens must be kept in sync with AddOperand().
+  switch (operand.type) {
+    case OperandType::kUnknown:
+      return true;
+    case OperandType::kRegister:
+      return AddTokenById(operand.register_token);
+    case OperandType::kImmediateValue:
+    case OperandType::kFpImmediateValue:
+      return AddToken(immediate_token_, kImmediateToken);
+    case OperandType::kAddress: {
+      const PackedAddress& address = block.address(operand);
+      if (!AddToken(address_token_, kAddressToken)) return false;
+      for (const TokenId register_token :
+           {address.base_register, address.index_register}) {
+        if (register_token == TokenTable::kEmptyTokenId
+                ? !AddToken(no_register_token_, kNoRegisterToken)
+                : !AddTokenById(register_token)) {
+          return false;
+        }
+      }
+      if (address.segment_register != TokenTable::kEmptyTokenId &&
+          !AddTokenById(address.segment_register)) {
+        return false;
+      }
+      if (address.displacement != 0 &&
+          !AddToken(displacement_token_, kDisplacementToken)) {
+        return false;
+      }
+      return true;
+    }
+    case OperandType::kMemory:
+      return AddToken(memory_token_, kMemoryToken);
+  }
+  return true;
+}
+
+bool BasicBlockTokenizer::CanAddOperand(
+    const InstructionOperand& operand) const {
+  // The tokens checked here must be kept in sync with AddOperand().
+  switch (operand.type()) {
+    case OperandType::kUnknown:
+      return true;
+    case OperandType::kRegister:
+      return tokens_->Find(operand.register_token()) != kInvalidTokenIndex;
+    case OperandType::kImmediateValue:
+    case OperandType::kFpImmediateValue:
+      return immediate_token_ != kInvalidTokenIndex;
+    case OperandType::kAddress: {
+      const AddressTuple& address = operand.address();
+      if (address_token_ == kInvalidTokenIndex) return false;
+      for (const std::string* const register_name :
+           {&address.base_register, &address.index_register}) {
+        if (register_name->empty()
+                ? no_register_token_ == kInvalidTokenIndex
+                : tokens_->Find(*register_name) == kInvalidTokenIndex) {
+          return false;
+        }
+      }
+      if (!address.segment_register.empty() &&
+          tokens_->Find(address.segment_register) == kInvalidTokenIndex) {
+        return false;
+      }
+      return address.displacement == 0 ||
+             displacement_token_ != kInvalidTokenIndex;
+    }
+    case OperandType::kMemory:
+      return memory_token_ != kInvalidTokenIndex;
+  }
+  return true;
+}
+
+bool BasicBlockTokenizer::CanAddPackedOperand(
+    const PackedBasicBlock& block, const PackedOperand& operand) const {
+  // The tokens checked here must be kept in sync with AddPackedOperand().
+  switch (operand.type) {
+    case OperandType::kUnknown:
+      return true;
+    case OperandType::kRegister:
+      return tokens_->Find(operand.register_token) != kInvalidTokenIndex;
+    case OperandType::kImmediateValue:
+    case OperandType::kFpImmediateValue:
+      return immediate_token_ != kInvalidTokenIndex;
+    case OperandType::kAddress: {
+      const PackedAddress& address = block.address(operand);
+      if (address_token_ == kInvalidTokenIndex) return false;
+      for (const TokenId register_token :
+           {address.base_register, address.index_register}) {
+        if (register_token == TokenTable::kEmptyTokenId
+                ? no_register_token_ == kInvalidTokenIndex
+                : tokens_->Find(register_token) == kInvalidTokenIndex) {
+          return false;
+        }
+      }
+      if (address.segment_register != TokenTable::kEmptyTokenId &&
+          tokens_->Find(address.segment_register) == kInvalidTokenIndex) {
+        return false;
+      }
+      return address.displacement == 0 ||
+             displacement_token_ != kInvalidTokenIndex;
+    }
+    case OperandType::kMemory:
+      return memory_token_ != kInvalidTokenIndex;
+  }
+  return true;
+}
+
+bool BasicBlockTokenizer::AddOutOfVocabularyToken(absl::string_view token) {
+  AddToInstrumentationCounter(InstrumentationCounter::kOutOfVocabularyTokens);
+  if (replacement_token_ == kInvalidTokenIndex) {
+    last_out_of_vocabulary_token_.assign(token.data(), token.size());
+    return false;
+  }
+  token_indices_.push_back(replacement_token_);
+  return true;
+}
+
+}  // namespace gematria
@@ -0,0 +1,222 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Contains a class that converts basic blocks to sequences of token indices
+// for the sequence and token-based models. The tokens of each instruction are
+// the same as the tokens returned by Instruction::AsTokenList(), but they are
+// looked up in the vocabulary directly, without creating the intermediate
+// lists of strings.
+
+#ifndef THIRD_PARTY_GEMATRIA_GEMATRIA_MODEL_BASIC_BLOCK_TOKENIZER_H_
+#define THIRD_PARTY_GEMATRIA_GEMATRIA_MODEL_BASIC_BLOCK_TOKENIZER_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "gematria/basic_block/basic_block.h"
+#include "gematria/basic_block/lazy_basic_block.h"
+#include "gematria/basic_block/packed_basic_block.h"
+#include "gematria/basic_block/token_table.h"
+#include "gematria/model/oov_token_behavior.h"
+#include "gematria/model/token_vocabulary.h"
+#include "gematria/proto/basic_block.pb.h"
+
+namespace gematria {
+
+// Converts batches of basic blocks to a flat sequence of token indices. The
+// batch is represented by three arrays:
+//  - token_indices() contains the indices of the tokens of all instructions
+//    of all blocks in the batch, in the natural order.
+//  - instruction_token_offsets() contains the offsets of the first token of
+//    each instruction in token_indices(), followed by the total number of
+//    tokens; the tokens of the i-th instruction are at positions
+//    [instruction_token_offsets()[i], instruction_token_offsets()[i + 1]).
+//  - block_instruction_offsets() contains the offsets of the first instruction
+//    of each block, followed by the total number of instructions, in the same
+//    format.
+//
+// The vocabulary is frozen when the tokenizer is created. Tokens that are not
+// in the vocabulary are handled according to the out-of-vocabulary behavior.
+class BasicBlockTokenizer {
+ public:
+  using TokenIndex = TokenVocabulary::TokenIndex;
+
+  // Creates a tokenizer for the given vocabulary. When the out-of-vocabulary
+  // behavior is kReplaceToken, the replacement token must be in `tokens`.
+  BasicBlockTokenizer(const std::vector<std::string>& tokens,
+                      OutOfVocabularyTokenBehavior out_of_vocabulary_behavior);
+  // A version of the constructor that uses an existing vocabulary. The
+  // vocabulary can be shared with other tokenizers and graph builders.
+  BasicBlockTokenizer(std::shared_ptr<const TokenVocabulary> tokens,
+                      OutOfVocabularyTokenBehavior out_of_vocabulary_behavior);
+
+  // Adds the tokens of `block` to the batch. Returns true when the block was
+  // added; returns false when the block contains an out-of-vocabulary token
+  // and the out-of-vocabulary behavior is kReturnError. In that case, the
+  // batch is left unchanged, and the token is available through
+  // last_out_of_vocabulary_token().
+  bool AddBasicBlock(const BasicBlock& block) {
+    return AddBasicBlockFromInstructions(block.instructions);
+  }
+  // A version of AddBasicBlock() that takes the list of instructions of the
+  // basic block.
+  bool AddBasicBlockFromInstructions(
+      const std::vector<Instruction>& instructions);
+  // A version of AddBasicBlock() that takes a packed basic block. Produces the
+  // same tokens as AddBasicBlock(block.ToBasicBlock()), but it uses the token
+  // IDs from the packed basic block directly.
+  bool AddBasicBlock(const PackedBasicBlock& block);
+  // A version of AddBasicBlock() that takes a lazy basic block. Uses the
+  // materialized BasicBlock when there is one, and otherwise tokenizes the
+  // packed basic block or the serialized proto without materializing the
+  // block.
+  bool AddBasicBlock(const LazyBasicBlock& block);
+  // Adds a list of basic blocks to the batch, in the order in which they
+  // appear in `blocks`. Returns a vector that contains true at index i when
+  // the i-th block was added, and false when it was rejected because of an
+  // out-of-vocabulary token.
+  std::vector<bool> AddBasicBlocks(absl::Span<const BasicBlock> blocks);
+  // A version of AddBasicBlocks() that takes pointers to the basic blocks.
+  std::vector<bool> AddBasicBlocks(absl::Span<const BasicBlock* const> blocks);
+
+  // Checks whether AddBasicBlock(block) would add the block to the batch,
+  // without modifying the batch. This is much cheaper than tokenizing the
+  // block, and it can be used to filter out basic blocks with unknown tokens
+  // before they are batched. Always returns true when the out-of-vocabulary
+  // behavior is kReplaceToken.
+  bool CanAddBasicBlock(const BasicBlock& block) const {
+    return CanAddBasicBlockFromInstructions(block.instructions);
+  }
+  // A version of CanAddBasicBlock() that takes the list of instructions of the
+  // basic block.
+  bool CanAddBasicBlockFromInstructions(
+      const std::vector<Instruction>& instructions) const;
+  // Versions of CanAddBasicBlock() for a packed basic block and for a lazy
+  // basic block. Neither of them materializes the BasicBlock.
+  bool CanAddBasicBlock(const PackedBasicBlock& block) const;
+  bool CanAddBasicBlock(const LazyBasicBlock& block) const;
+  // Batch versions of CanAddBasicBlock(). Return a vector that contains true at
+  // index i when the i-th block can be added to the batch.
+  std::vector<bool> CanAddBasicBlocks(
+      absl::Span<const BasicBlock> blocks) const;
+  std::vector<bool> CanAddBasicBlocks(
+      absl::Span<const BasicBlock* const> blocks) const;
+
+  // Removes all basic blocks from the batch. Keeps the allocated memory, so
+  // that the tokenizer can be reused for the next batch without reallocating.
+  void Reset();
+
+  // Returns the vocabulary used by the tokenizer.
+  const TokenVocabulary& vocabulary() const { return *tokens_; }
+  // Returns the index of the replacement token, or
+  // TokenVocabulary::kInvalidTokenIndex when the out-of-vocabulary behavior is
+  // kReturnError.
+  TokenIndex replacement_token() const { return replacement_token_; }
+
+  // Returns the out-of-vocabulary token that caused the last block to be
+  // rejected. Empty when no block was rejected yet.
+  const std::string& last_out_of_vocabulary_token() const {
+    return last_out_of_vocabulary_token_;
+  }
+
+  int num_blocks() const {
+    return static_cast<int>(block_instruction_offsets_.size()) - 1;
+  }
+  int num_instructions() const {
+    return static_cast<int>(instruction_token_offsets_.size()) - 1;
+  }
+  int num_tokens() const { return static_cast<int>(token_indices_.size()); }
+
+  // The arrays of the batch; see the class comment for their format.
+  const std::vector<TokenIndex>& token_indices() const {
+    return token_indices_;
+  }
+  const std::vector<int>& instruction_token_offsets() const {
+    return instruction_token_offsets_;
+  }
+  const std::vector<int>& block_instruction_offsets() const {
+    return block_instruction_offsets_;
+  }
+
+ private:
+  // Adds the tokens of `instruction` to token_indices_. Returns false when the
+  // instruction contains an out-of-vocabulary token that can't be replaced.
+  bool AddInstruction(const Instruction& instruction);
+  bool AddOperand(const InstructionOperand& operand);
+  // Versions of AddInstruction() and AddOperand() for packed basic blocks.
+  // `instruction` and `operand` must be elements of `block`.
+  bool AddPackedInstruction(const PackedBasicBlock& block,
+                            const PackedInstruction& instruction);
+  bool AddPackedOperand(const PackedBasicBlock& block,
+                        const PackedOperand& operand);
+
+  // Checks the tokens of a single operand for CanAddBasicBlock().
+  bool CanAddOperand(const InstructionOperand& operand) const;
+  bool CanAddPackedOperand(const PackedBasicBlock& block,
+                           const PackedOperand& operand) const;
+
+  // Adds a single token to token_indices_. The token is given by its string,
+  // by its ID in the global token table, or by its precomputed index in the
+  // vocabulary; `token` is used only when the index is invalid. All versions
+  // return false when the token is out of vocabulary and can't be replaced.
+  bool AddToken(absl::string_view token) {
+    return AddToken(tokens_->Find(token), token);
+  }
+  bool AddTokenById(TokenId token_id) {
+    const TokenIndex token_index = tokens_->Find(token_id);
+    if (token_index != TokenVocabulary::kInvalidTokenIndex) {
+      token_indices_.push_back(token_index);
+      return true;
+    }
+    return AddOutOfVocabularyToken(TokenTable::Global().Name(token_id));
+  }
+  bool AddToken(TokenIndex token_index, absl::string_view token) {
+    if (token_index != TokenVocabulary::kInvalidTokenIndex) {
+      token_indices_.push_back(token_index);
+      return true;
+    }
+    return AddOutOfVocabularyToken(token);
+  }
+  bool AddOutOfVocabularyToken(absl::string_view token);
+
+  std::shared_ptr<const TokenVocabulary> tokens_;
+  const TokenIndex replacement_token_;
+
+  // The indices of the special tokens used in the token lists. These are
+  // looked up only once, but they may be kInvalidTokenIndex when the token
+  // is not in the vocabulary.
+  const TokenIndex delimiter_token_;
+  const TokenIndex immediate_token_;
+  const TokenIndex address_token_;
+  const TokenIndex memory_token_;
+  const TokenIndex no_register_token_;
+  const TokenIndex displacement_token_;
+
+  std::string last_out_of_vocabulary_token_;
+
+  std::vector<TokenIndex> token_indices_;
+  std::vector<int> instruction_token_offsets_;
+  std::vector<int> block_instruction_offsets_;
+
+  // Scratch buffers for adding lazy basic blocks stored as serialized protos.
+  BasicBlockProto proto_buffer_;
+  PackedBasicBlock packed_block_buffer_;
+};
+
+}  // namespace gematria
+
+#endif  // THIRD_PARTY_GEMATRIA_GEMATRIA_MODEL_BASIC_BLOCK_TOKENIZER_H_
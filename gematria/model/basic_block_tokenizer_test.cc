@@ -0,0 +1,265 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "gematria/model/basic_block_tokenizer.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gematria/basic_block/basic_block.h"
+#include "gematria/basic_block/basic_block_protos.h"
+#include "gematria/basic_block/lazy_basic_block.h"
+#include "gematria/basic_block/packed_basic_block.h"
+#include "gematria/model/oov_token_behavior.h"
+#include "gematria/model/token_vocabulary.h"
+#include "gematria/proto/basic_block.pb.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace gematria {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::ElementsAreArray;
+using ::testing::IsEmpty;
+
+const std::vector<std::string>& Tokens() {
+  static const auto* const tokens = new std::vector<std::string>{
+      "LOCK",      "MOV",         "ADD",       "RAX",         "RBX",
+      "RCX",       "EFLAGS",      "FS",        "_D_",         "_IMMEDIATE_",
+      "_ADDRESS_", "_MEMORY_",    "_UNKNOWN_", "_NO_REGISTER_",
+      "_DISPLACEMENT_"};
+  return *tokens;
+}
+
+// Returns a block that uses all types of operands and tokens.
+BasicBlock TestBlock() {
+  return BasicBlock(
+      {Instruction("MOV", "MOV64rm", {},
+                   {InstructionOperand::Address("RBX", 16, "", 0, "FS"),
+                    InstructionOperand::MemoryLocation(1)},
+                   {}, {InstructionOperand::Register("RAX")}, {}),
+       Instruction("ADD", "ADD64ri8", {"LOCK"},
+                   {InstructionOperand::Register("RCX"),
+                    InstructionOperand::ImmediateValue(1)},
+                   {}, {InstructionOperand::Register("RCX")},
+                   {InstructionOperand::Register("EFLAGS")})});
+}
+
+// Returns the token indices of `block` computed through the token lists of the
+// instructions.
+std::vector<int> TokenIndicesFromTokenLists(const BasicBlock& block,
+                                            const TokenVocabulary& vocabulary) {
+  std::vector<int> indices;
+  for (const Instruction& instruction : block.instructions) {
+    for (const std::string& token : instruction.AsTokenList()) {
+      indices.push_back(vocabulary.Find(token));
+    }
+  }
+  return indices;
+}
+
+// Returns a lazy basic block that stores `block` as a serialized proto.
+LazyBasicBlock LazyBasicBlockFromProto(const BasicBlock& block) {
+  BasicBlockProto proto;
+  for (const Instruction& instruction : block.instructions) {
+    AppendInstructionToProto(instruction,
+                             proto.add_canonicalized_instructions());
+  }
+  return LazyBasicBlock(proto);
+}
+
+TEST(BasicBlockTokenizerTest, EmptyBatch) {
+  const BasicBlockTokenizer tokenizer(
+      Tokens(), OutOfVocabularyTokenBehavior::ReturnError());
+  EXPECT_EQ(tokenizer.num_blocks(), 0);
+  EXPECT_EQ(tokenizer.num_instructions(), 0);
+  EXPECT_EQ(tokenizer.num_tokens(), 0);
+  EXPECT_THAT(tokenizer.token_indices(), IsEmpty());
+  EXPECT_THAT(tokenizer.instruction_token_offsets(), ElementsAre(0));
+  EXPECT_THAT(tokenizer.block_instruction_offsets(), ElementsAre(0));
+  EXPECT_EQ(tokenizer.replacement_token(), TokenVocabulary::kInvalidTokenIndex);
+}
+
+TEST(BasicBlockTokenizerTest, SameTokensAsTokenList) {
+  BasicBlockTokenizer tokenizer(Tokens(),
+                                OutOfVocabularyTokenBehavior::ReturnError());
+  const BasicBlock block = TestBlock();
+  ASSERT_TRUE(tokenizer.AddBasicBlock(block));
+  EXPECT_THAT(tokenizer.token_indices(),
+              ElementsAreArray(
+                  TokenIndicesFromTokenLists(block, tokenizer.vocabulary())));
+  EXPECT_THAT(tokenizer.instruction_token_offsets(), ElementsAre(0, 11, 20));
+  EXPECT_THAT(tokenizer.block_instruction_offsets(), ElementsAre(0, 2));
+}
+
+TEST(BasicBlockTokenizerTest, MultipleBlocks) {
+  BasicBlockTokenizer tokenizer(Tokens(),
+                                OutOfVocabularyTokenBehavior::ReturnError());
+  const BasicBlock block = TestBlock();
+  const BasicBlock small_block({block.instructions[1]});
+  EXPECT_THAT(tokenizer.AddBasicBlocks({block, BasicBlock(), small_block}),
+              ElementsAre(true, true, true));
+  EXPECT_EQ(tokenizer.num_blocks(), 3);
+  EXPECT_EQ(tokenizer.num_instructions(), 3);
+  EXPECT_EQ(tokenizer.num_tokens(), 29);
+  EXPECT_THAT(tokenizer.instruction_token_offsets(),
+              ElementsAre(0, 11, 20, 29));
+  EXPECT_THAT(tokenizer.block_instruction_offsets(), ElementsAre(0, 2, 2, 3));
+
+  tokenizer.Reset();
+  EXPECT_EQ(tokenizer.num_blocks(), 0);
+  EXPECT_EQ(tokenizer.num_tokens(), 0);
+  EXPECT_THAT(tokenizer.instruction_token_offsets(), ElementsAre(0));
+  EXPECT_THAT(tokenizer.block_instruction_offsets(), ElementsAre(0));
+}
+
+TEST(BasicBlockTokenizerTest, OutOfVocabularyReturnError) {
+  BasicBlockTokenizer tokenizer(Tokens(),
+                                OutOfVocabularyTokenBehavior::ReturnError());
+  const BasicBlock block = TestBlock();
+  const BasicBlock unknown_block(
+      {block.instructions[0],
+       Instruction("SUB", "SUB64rr", {}, {InstructionOperand::Register("RDX")},
+                   {}, {InstructionOperand::Register("RAX")}, {})});
+  EXPECT_THAT(tokenizer.AddBasicBlocks({block, unknown_block, block}),
+              ElementsAre(true, false, true));
+  EXPECT_EQ(tokenizer.last_out_of_vocabulary_token(), "SUB");
+  EXPECT_EQ(tokenizer.num_blocks(), 2);
+  EXPECT_THAT(tokenizer.instruction_token_offsets(),
+              ElementsAre(0, 11, 20, 31, 40));
+  EXPECT_THAT(tokenizer.block_instruction_offsets(), ElementsAre(0, 2, 4));
+
+  // Register tokens are looked up by their IDs in the global token table.
+  const BasicBlock unknown_register_block({Instruction(
+      "MOV", "MOV64rr", {}, {InstructionOperand::Register("R15")}, {},
+      {InstructionOperand::Register("RAX")}, {})});
+  EXPECT_FALSE(tokenizer.AddBasicBlock(unknown_register_block));
+  EXPECT_EQ(tokenizer.last_out_of_vocabulary_token(), "R15");
+  EXPECT_EQ(tokenizer.num_tokens(), 40);
+}
+
+TEST(BasicBlockTokenizerTest, OutOfVocabularyReplaceToken) {
+  const auto vocabulary = std::make_shared<const TokenVocabulary>(Tokens());
+  BasicBlockTokenizer tokenizer(
+      vocabulary, OutOfVocabularyTokenBehavior::ReplaceWithToken("_UNKNOWN_"));
+  const int unknown_token = vocabulary->Find("_UNKNOWN_");
+  EXPECT_EQ(tokenizer.replacement_token(), unknown_token);
+
+  const BasicBlock block({Instruction(
+      "SUB", "SUB64rr", {}, {InstructionOperand::Address("R15", 0, "", 0, "")},
+      {}, {InstructionOperand::Register("RAX")}, {})});
+  ASSERT_TRUE(tokenizer.AddBasicBlock(block));
+  EXPECT_THAT(tokenizer.token_indices(),
+              ElementsAre(unknown_token, vocabulary->Find("_D_"),
+                          vocabulary->Find("RAX"), vocabulary->Find("_D_"),
+                          vocabulary->Find("_ADDRESS_"), unknown_token,
+                          vocabulary->Find("_NO_REGISTER_"),
+                          vocabulary->Find("_D_")));
+  EXPECT_THAT(tokenizer.last_out_of_vocabulary_token(), IsEmpty());
+}
+
+TEST(BasicBlockTokenizerTest, CanAddBasicBlock) {
+  BasicBlockTokenizer tokenizer(Tokens(),
+                                OutOfVocabularyTokenBehavior::ReturnError());
+  const BasicBlock block = TestBlock();
+  const std::vector<BasicBlock> blocks = {
+      block,
+      BasicBlock(),
+      // Unknown mnemonic.
+      BasicBlock({Instruction("SUB", "SUB64rr", {}, {}, {}, {}, {})}),
+      // Unknown prefix.
+      BasicBlock({Instruction("ADD", "ADD64rr", {"REP"}, {}, {}, {}, {})}),
+      // Unknown register.
+      BasicBlock({Instruction("MOV", "MOV64rr", {},
+                              {InstructionOperand::Register("R15")}, {},
+                              {InstructionOperand::Register("RAX")}, {})}),
+      // Unknown address register.
+      BasicBlock({Instruction(
+          "MOV", "MOV64rm", {},
+          {InstructionOperand::Address("RBX", 0, "R15", 1, "")}, {},
+          {InstructionOperand::Register("RAX")}, {})})};
+  EXPECT_THAT(tokenizer.CanAddBasicBlocks(blocks),
+              ElementsAre(true, true, false, false, false, false));
+  EXPECT_EQ(tokenizer.num_blocks(), 0);
+  EXPECT_THAT(tokenizer.last_out_of_vocabulary_token(), IsEmpty());
+  EXPECT_THAT(tokenizer.CanAddBasicBlocks(blocks),
+              ElementsAreArray(tokenizer.AddBasicBlocks(blocks)));
+
+  // The special tokens are needed only by the blocks that use them.
+  std::vector<std::string> tokens_without_displacement = Tokens();
+  tokens_without_displacement.pop_back();
+  const BasicBlockTokenizer tokenizer_without_displacement(
+      tokens_without_displacement, OutOfVocabularyTokenBehavior::ReturnError());
+  EXPECT_FALSE(tokenizer_without_displacement.CanAddBasicBlock(block));
+  EXPECT_TRUE(tokenizer_without_displacement.CanAddBasicBlock(
+      BasicBlock({block.instructions[1]})));
+
+  const BasicBlockTokenizer replacing_tokenizer(
+      Tokens(), OutOfVocabularyTokenBehavior::ReplaceWithToken("_UNKNOWN_"));
+  EXPECT_THAT(replacing_tokenizer.CanAddBasicBlocks(blocks),
+              ElementsAre(true, true, true, true, true, true));
+}
+
+TEST(BasicBlockTokenizerTest, PackedAndLazyBasicBlocks) {
+  const BasicBlock block = TestBlock();
+  const std::vector<BasicBlock> blocks = {
+      block, BasicBlock(),
+      // Unknown register.
+      BasicBlock({Instruction("MOV", "MOV64rr", {},
+                              {InstructionOperand::Register("R15")}, {},
+                              {InstructionOperand::Register("RAX")}, {})}),
+      // Unknown address register.
+      BasicBlock({Instruction(
+          "MOV", "MOV64rm", {},
+          {InstructionOperand::Address("RBX", 0, "R15", 1, "")}, {},
+          {InstructionOperand::Register("RAX")}, {})}),
+      BasicBlock({block.instructions[1]})};
+
+  for (const OutOfVocabularyTokenBehavior& behavior :
+       {OutOfVocabularyTokenBehavior::ReturnError(),
+        OutOfVocabularyTokenBehavior::ReplaceWithToken("_UNKNOWN_")}) {
+    BasicBlockTokenizer expected_tokenizer(Tokens(), behavior);
+    const std::vector<bool> expected_added =
+        expected_tokenizer.AddBasicBlocks(blocks);
+
+    BasicBlockTokenizer packed_tokenizer(Tokens(), behavior);
+    BasicBlockTokenizer lazy_tokenizer(Tokens(), behavior);
+    for (int i = 0; i < blocks.size(); ++i) {
+      SCOPED_TRACE(i);
+      const PackedBasicBlock packed_block(blocks[i]);
+      EXPECT_EQ(packed_tokenizer.CanAddBasicBlock(packed_block),
+                expected_added[i]);
+      EXPECT_EQ(packed_tokenizer.AddBasicBlock(packed_block),
+                expected_added[i]);
+
+      const LazyBasicBlock lazy_block = LazyBasicBlockFromProto(blocks[i]);
+      EXPECT_EQ(lazy_tokenizer.CanAddBasicBlock(lazy_block), expected_added[i]);
+      EXPECT_EQ(lazy_tokenizer.AddBasicBlock(lazy_block), expected_added[i]);
+      EXPECT_FALSE(lazy_block.is_materialized());
+    }
+    for (const BasicBlockTokenizer* const tokenizer :
+         {&packed_tokenizer, &lazy_tokenizer}) {
+      EXPECT_EQ(tokenizer->token_indices(), expected_tokenizer.token_indices());
+      EXPECT_EQ(tokenizer->instruction_token_offsets(),
+                expected_tokenizer.instruction_token_offsets());
+      EXPECT_EQ(tokenizer->block_instruction_offsets(),
+                expected_tokenizer.block_instruction_offsets());
+    }
+  }
+}
+
+}  // namespace
+}  // namespace gematria
@@ -0,0 +1,95 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "gematria/model/batch_scheduler.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "absl/types/span.h"
+
+namespace gematria {
+namespace {
+
+// Returns `limit` when it is positive, and the maximal int otherwise.
+int EffectiveLimit(int limit) {
+  return limit > 0 ? limit : std::numeric_limits<int>::max();
+}
+
+}  // namespace
+
+BatchSchedule ScheduleBatchesBySize(
+    absl::Span<const BasicBlockSize> block_sizes,
+    const BatchSchedulerOptions& options) {
+  const int max_blocks = EffectiveLimit(options.max_blocks_in_batch);
+  const int max_instructions =
+      EffectiveLimit(options.max_instructions_in_batch);
+  const int max_nodes = EffectiveLimit(options.max_nodes_in_batch);
+
+  BatchSchedule schedule;
+  std::vector<int> order;
+  order.reserve(block_sizes.size());
+  for (int i = 0; i < static_cast<int>(block_sizes.size()); ++i) {
+    const BasicBlockSize& size = block_sizes[i];
+    if (size.num_instructions > max_instructions ||
+        size.num_nodes > max_nodes) {
+      schedule.skipped_blocks.push_back(i);
+    } else {
+      order.push_back(i);
+    }
+  }
+  // Sorting the indices is stable with respect to the input order, because
+  // the index is the last component of the key.
+  std::sort(order.begin(), order.end(), [&](int left, int right) {
+    const BasicBlockSize& left_size = block_sizes[left];
+    const BasicBlockSize& right_size = block_sizes[right];
+    if (left_size.num_instructions != right_size.num_instructions) {
+      return left_size.num_instructions > right_size.num_instructions;
+    }
+    if (left_size.num_nodes != right_size.num_nodes) {
+      return left_size.num_nodes > right_size.num_nodes;
+    }
+    return left < right;
+  });
+
+  std::vector<int> current_batch;
+  int64_t num_instructions_in_batch = 0;
+  int64_t num_nodes_in_batch = 0;
+  const auto finish_batch = [&]() {
+    if (current_batch.empty()) return;
+    std::sort(current_batch.begin(), current_batch.end());
+    schedule.batches.push_back(std::move(current_batch));
+    current_batch.clear();
+    num_instructions_in_batch = 0;
+    num_nodes_in_batch = 0;
+  };
+  for (const int block : order) {
+    const BasicBlockSize& size = block_sizes[block];
+    if (static_cast<int>(current_batch.size()) == max_blocks ||
+        num_instructions_in_batch + size.num_instructions > max_instructions ||
+        num_nodes_in_batch + size.num_nodes > max_nodes) {
+      finish_batch();
+    }
+    current_batch.push_back(block);
+    num_instructions_in_batch += size.num_instructions;
+    num_nodes_in_batch += size.num_nodes;
+  }
+  finish_batch();
+  return schedule;
+}
+
+}  // namespace gematria
@@ -0,0 +1,78 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Contains a scheduler that splits a collection of basic blocks into batches
+// of blocks of similar sizes. Compared to splitting the blocks into batches in
+// their original order, this reduces the padding needed by the sequence models,
+// and it fills the batches close to their size limits even when the sizes of
+// the blocks are skewed.
+
+#ifndef THIRD_PARTY_GEMATRIA_GEMATRIA_MODEL_BATCH_SCHEDULER_H_
+#define THIRD_PARTY_GEMATRIA_GEMATRIA_MODEL_BATCH_SCHEDULER_H_
+
+#include <vector>
+
+#include "absl/types/span.h"
+
+namespace gematria {
+
+// The size of a basic block used by the scheduler.
+struct BasicBlockSize {
+  // The number of instructions of the basic block.
+  int num_instructions = 0;
+  // The number of nodes in the graph of the basic block, or another measure of
+  // the size of the block that is subject to its own per-batch limit. Use zero
+  // when the number of nodes is not known or not limited.
+  int num_nodes = 0;
+};
+
+// The limits of the batches created by the scheduler. A limit of zero or less
+// means that the corresponding quantity is not limited.
+struct BatchSchedulerOptions {
+  int max_blocks_in_batch = 0;
+  int max_instructions_in_batch = 0;
+  int max_nodes_in_batch = 0;
+};
+
+// The result of the scheduling. All blocks are referenced by their indices in
+// the input of the scheduler.
+struct BatchSchedule {
+  // The indices of the basic blocks in each batch. The indices in each batch
+  // are sorted in the ascending order, i.e. the blocks in a batch are in the
+  // same relative order as in the input.
+  std::vector<std::vector<int>> batches;
+  // The indices of the basic blocks that exceed the instruction or node limit
+  // on their own, and that do not appear in any batch.
+  std::vector<int> skipped_blocks;
+};
+
+// Splits basic blocks of the given sizes into batches respecting the limits in
+// `options`. Each basic block that fits into a batch appears in exactly one
+// batch.
+//
+// The blocks are sorted by their number of instructions and nodes, and then
+// packed into batches in this order; a new batch is started when the next block
+// does not fit into the current one. Each batch thus contains blocks of similar
+// sizes, and the unused capacity of a batch is smaller than the size of the
+// first block of the following batch. The batches are returned from the one
+// with the largest blocks to the one with the smallest blocks; ties are broken
+// by the order of the blocks in the input, so that the schedule is
+// deterministic.
+BatchSchedule ScheduleBatchesBySize(
+    absl::Span<const BasicBlockSize> block_sizes,
+    const BatchSchedulerOptions& options);
+
+}  // namespace gematria
+
+#endif  // THIRD_PARTY_GEMATRIA_GEMATRIA_MODEL_BATCH_SCHEDULER_H_
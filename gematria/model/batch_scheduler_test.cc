@@ -0,0 +1,131 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "gematria/model/batch_scheduler.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace gematria {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+using ::testing::UnorderedElementsAreArray;
+
+std::vector<BasicBlockSize> SizesFromInstructions(
+    const std::vector<int>& num_instructions) {
+  std::vector<BasicBlockSize> sizes;
+  for (const int n : num_instructions) {
+    sizes.push_back(BasicBlockSize{/*num_instructions=*/n, /*num_nodes=*/0});
+  }
+  return sizes;
+}
+
+TEST(ScheduleBatchesBySizeTest, NoBlocks) {
+  const BatchSchedule schedule = ScheduleBatchesBySize({}, {});
+  EXPECT_THAT(schedule.batches, IsEmpty());
+  EXPECT_THAT(schedule.skipped_blocks, IsEmpty());
+}
+
+TEST(ScheduleBatchesBySizeTest, NoLimits) {
+  const BatchSchedule schedule =
+      ScheduleBatchesBySize(SizesFromInstructions({3, 1, 2}), {});
+  EXPECT_THAT(schedule.batches, ElementsAre(ElementsAre(0, 1, 2)));
+  EXPECT_THAT(schedule.skipped_blocks, IsEmpty());
+}
+
+TEST(ScheduleBatchesBySizeTest, GroupsBlocksOfSimilarSize) {
+  // Packing the blocks in the input order would need three batches: [1, 10],
+  // [1, 10, 1] and [10].
+  BatchSchedulerOptions options;
+  options.max_instructions_in_batch = 20;
+  const BatchSchedule schedule = ScheduleBatchesBySize(
+      SizesFromInstructions({1, 10, 1, 10, 1, 10}), options);
+  EXPECT_THAT(schedule.batches,
+              ElementsAre(ElementsAre(1, 3), ElementsAre(0, 2, 4, 5)));
+  EXPECT_THAT(schedule.skipped_blocks, IsEmpty());
+}
+
+TEST(ScheduleBatchesBySizeTest, SkipsBlocksThatAreTooLarge) {
+  // This is the example from the docstring of training.batches().
+  BatchSchedulerOptions options;
+  options.max_blocks_in_batch = 3;
+  options.max_instructions_in_batch = 12;
+  const BatchSchedule schedule = ScheduleBatchesBySize(
+      SizesFromInstructions({1, 3, 5, 1, 15, 12}), options);
+  EXPECT_THAT(schedule.batches,
+              ElementsAre(ElementsAre(5), ElementsAre(0, 1, 2),
+                          ElementsAre(3)));
+  EXPECT_THAT(schedule.skipped_blocks, ElementsAre(4));
+}
+
+TEST(ScheduleBatchesBySizeTest, MaxBlocksInBatch) {
+  BatchSchedulerOptions options;
+  options.max_blocks_in_batch = 2;
+  const BatchSchedule schedule = ScheduleBatchesBySize(
+      SizesFromInstructions({1, 2, 3, 4, 5}), options);
+  EXPECT_THAT(schedule.batches,
+              ElementsAre(ElementsAre(3, 4), ElementsAre(1, 2),
+                          ElementsAre(0)));
+}
+
+TEST(ScheduleBatchesBySizeTest, MaxNodesInBatch) {
+  BatchSchedulerOptions options;
+  options.max_instructions_in_batch = 10;
+  options.max_nodes_in_batch = 20;
+  const std::vector<BasicBlockSize> sizes = {
+      {/*num_instructions=*/2, /*num_nodes=*/15},
+      {/*num_instructions=*/2, /*num_nodes=*/5},
+      {/*num_instructions=*/2, /*num_nodes=*/10},
+      {/*num_instructions=*/2, /*num_nodes=*/30},
+      {/*num_instructions=*/3, /*num_nodes=*/10},
+  };
+  const BatchSchedule schedule = ScheduleBatchesBySize(sizes, options);
+  EXPECT_THAT(schedule.batches,
+              ElementsAre(ElementsAre(4), ElementsAre(0), ElementsAre(1, 2)));
+  EXPECT_THAT(schedule.skipped_blocks, ElementsAre(3));
+}
+
+TEST(ScheduleBatchesBySizeTest, EachBlockIsScheduledOnce) {
+  std::vector<int> num_instructions;
+  for (int i = 0; i < 1000; ++i) num_instructions.push_back(1 + (i * 37) % 50);
+  BatchSchedulerOptions options;
+  options.max_instructions_in_batch = 100;
+  options.max_blocks_in_batch = 16;
+  const BatchSchedule schedule =
+      ScheduleBatchesBySize(SizesFromInstructions(num_instructions), options);
+
+  std::vector<int> scheduled_blocks;
+  std::vector<int> all_blocks;
+  for (int i = 0; i < 1000; ++i) all_blocks.push_back(i);
+  for (const std::vector<int>& batch : schedule.batches) {
+    int batch_instructions = 0;
+    for (const int block : batch) {
+      scheduled_blocks.push_back(block);
+      batch_instructions += num_instructions[block];
+    }
+    EXPECT_LE(batch.size(), 16);
+    EXPECT_LE(batch_instructions, 100);
+    EXPECT_TRUE(std::is_sorted(batch.begin(), batch.end()));
+  }
+  EXPECT_THAT(scheduled_blocks, UnorderedElementsAreArray(all_blocks));
+  EXPECT_THAT(schedule.skipped_blocks, IsEmpty());
+}
+
+}  // namespace
+}  // namespace gematria
@@ -0,0 +1,164 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "gematria/model/basic_block_tokenizer.h"
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "gematria/basic_block/basic_block.h"
+#include "gematria/basic_block/lazy_basic_block.h"
+#include "gematria/model/oov_token_behavior.h"
+#include "gematria/utils/python/instrumentation_bindings.h"
+#include "pybind11/numpy.h"
+#include "pybind11/pybind11.h"
+#include "pybind11/stl.h"
+
+namespace gematria {
+namespace {
+
+namespace py = ::pybind11;
+
+constexpr const char* const kModuleDocstring =
+    R"(Conversion of basic blocks to sequences of token indices.
+
+The array properties of BasicBlockTokenizer return NumPy arrays with a copy of
+the data of the tokenizer; they remain valid when the tokenizer is modified.)";
+
+// Returns a function that can be used as a getter of a read-only Python
+// property that returns a copy of the vector returned by `getter` as a NumPy
+// array. The tokenizer may reallocate its vectors whenever it is modified, so
+// the properties can't share memory with it.
+template <typename T>
+auto NumpyCopyGetter(
+    const std::vector<T>& (BasicBlockTokenizer::*getter)() const) {
+  return [getter](const BasicBlockTokenizer& tokenizer) {
+    const std::vector<T>& data = (tokenizer.*getter)();
+    return py::array_t<T>(data.size(), data.data());
+  };
+}
+
+PYBIND11_MODULE(basic_block_tokenizer, m) {
+  m.doc() = kModuleDocstring;
+  DefineInstrumentationSubmodule(m);
+
+  py::class_<BasicBlockTokenizer>(m, "BasicBlockTokenizer", R"(
+Converts batches of basic blocks to flat sequences of token indices.
+
+The tokens of each instruction are the same as the tokens returned by
+Instruction.as_token_list(), and their indices are positions in `tokens`.)")
+      .def(py::init<std::vector<std::string>, OutOfVocabularyTokenBehavior>(),
+           py::arg("tokens"), py::arg("out_of_vocabulary_behavior"))
+      .def("add_basic_block",
+           py::overload_cast<const BasicBlock&>(
+               &BasicBlockTokenizer::AddBasicBlock),
+           py::arg("block"),
+           R"(Adds the tokens of a basic block to the batch.
+
+Returns False and leaves the batch unchanged when the block contains an
+out-of-vocabulary token and the tokenizer is set up to return an error.)")
+      .def("add_basic_block",
+           py::overload_cast<const LazyBasicBlock&>(
+               &BasicBlockTokenizer::AddBasicBlock),
+           py::arg("block"),
+           R"(A version of add_basic_block() for a LazyBasicBlock.
+
+Tokenizes the block without materializing it as a BasicBlock.)")
+      .def(
+          "add_basic_blocks",
+          [](BasicBlockTokenizer& self,
+             const std::vector<const BasicBlock*>& blocks) {
+            return self.AddBasicBlocks(blocks);
+          },
+          py::arg("blocks"),
+          R"(Adds a list of basic blocks to the batch.
+
+Returns a list of bools, one per input block, that is True when the block was
+added and False when it contains an out-of-vocabulary token and the tokenizer is
+set up to return an error.)")
+      .def(
+          "add_basic_blocks",
+          [](BasicBlockTokenizer& self,
+             const std::vector<const LazyBasicBlock*>& blocks) {
+            std::vector<bool> added(blocks.size());
+            for (size_t i = 0; i < blocks.size(); ++i) {
+              added[i] = self.AddBasicBlock(*blocks[i]);
+            }
+            return added;
+          },
+          py::arg("blocks"))
+      .def("can_add_basic_block",
+           py::overload_cast<const BasicBlock&>(
+               &BasicBlockTokenizer::CanAddBasicBlock, py::const_),
+           py::arg("block"),
+           R"(Checks whether add_basic_block() would add the block to the batch.
+
+Only looks up the tokens of the block in the vocabulary, and does not modify the
+batch. Always returns True when out-of-vocabulary tokens are replaced.)")
+      .def("can_add_basic_block",
+           py::overload_cast<const LazyBasicBlock&>(
+               &BasicBlockTokenizer::CanAddBasicBlock, py::const_),
+           py::arg("block"))
+      .def(
+          "can_add_basic_blocks",
+          [](const BasicBlockTokenizer& self,
+             const std::vector<const BasicBlock*>& blocks) {
+            return self.CanAddBasicBlocks(blocks);
+          },
+          py::arg("blocks"),
+          R"(Checks a list of basic blocks with can_add_basic_block().
+
+Returns a list of bools, one per input block, that is True when the block can be
+added to the batch.)")
+      .def(
+          "can_add_basic_blocks",
+          [](const BasicBlockTokenizer& self,
+             const std::vector<const LazyBasicBlock*>& blocks) {
+            std::vector<bool> can_add(blocks.size());
+            for (size_t i = 0; i < blocks.size(); ++i) {
+              can_add[i] = self.CanAddBasicBlock(*blocks[i]);
+            }
+            return can_add;
+          },
+          py::arg("blocks"))
+      .def("reset", &BasicBlockTokenizer::Reset)
+      .def_property_readonly(
+          "last_out_of_vocabulary_token",
+          &BasicBlockTokenizer::last_out_of_vocabulary_token,
+          R"(The out-of-vocabulary token that caused the last rejection.)")
+      .def_property_readonly("num_blocks", &BasicBlockTokenizer::num_blocks)
+      .def_property_readonly("num_instructions",
+                             &BasicBlockTokenizer::num_instructions)
+      .def_property_readonly("num_tokens", &BasicBlockTokenizer::num_tokens)
+      .def_property_readonly(
+          "token_indices", NumpyCopyGetter(&BasicBlockTokenizer::token_indices))
+      .def_property_readonly(
+          "instruction_token_offsets",
+          NumpyCopyGetter(&BasicBlockTokenizer::instruction_token_offsets),
+          R"(Offsets of the first token of each instruction.
+
+Contains num_instructions + 1 elements; the last one is the number of tokens.)")
+      .def_property_readonly(
+          "block_instruction_offsets",
+          NumpyCopyGetter(&BasicBlockTokenizer::block_instruction_offsets),
+          R"(Offsets of the first instruction of each block.
+
+Contains num_blocks + 1 elements; the last one is the number of
+instructions.)");
+}
+
+}  // namespace
+}  // namespace gematria
@@ -0,0 +1,174 @@
+# Copyright 2023 Google Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#    http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+from absl.testing import absltest
+from gematria.basic_block.python import basic_block_protos
+from gematria.basic_block.python import tokens
+from gematria.model.python import basic_block_tokenizer
+from gematria.model.python import oov_token_behavior
+from gematria.testing.python import basic_blocks_with_throughput
+import numpy as np
+
+_OutOfVocabularyTokenBehavior = oov_token_behavior.OutOfVocabularyTokenBehavior
+
+
+class BasicBlockTokenizerTest(
+    basic_blocks_with_throughput.TestCase, absltest.TestCase
+):
+  """Tests for the BasicBlockTokenizer class wrapper.
+
+  Most of the functionality is tested in the corresponding cc_test(). Here we
+  test that the tokenizer produces the same token indices as the token lists of
+  the instructions, and that the arrays have the expected shape.
+  """
+
+  def setUp(self):
+    self.num_blocks = 10
+    super().setUp()
+
+  def assertTokenizerMatchesTokenLists(self, tokenizer, token_list, blocks):
+    token_index = {token: i for i, token in enumerate(token_list)}
+    expected_tokens = []
+    expected_instruction_offsets = [0]
+    expected_block_offsets = [0]
+    for block in blocks:
+      for instruction in block.instructions:
+        expected_tokens.extend(
+            token_index[token] for token in instruction.as_token_list()
+        )
+        expected_instruction_offsets.append(len(expected_tokens))
+      expected_block_offsets.append(len(expected_instruction_offsets) - 1)
+
+    self.assertEqual(tokenizer.num_blocks, len(blocks))
+    self.assertEqual(tokenizer.num_tokens, len(expected_tokens))
+    self.assertEqual(
+        tokenizer.num_instructions, len(expected_instruction_offsets) - 1
+    )
+    np.testing.assert_array_equal(tokenizer.token_indices, expected_tokens)
+    np.testing.assert_array_equal(
+        tokenizer.instruction_token_offsets, expected_instruction_offsets
+    )
+    np.testing.assert_array_equal(
+        tokenizer.block_instruction_offsets, expected_block_offsets
+    )
+
+  def test_add_basic_block(self):
+    tokenizer = basic_block_tokenizer.BasicBlockTokenizer(
+        tokens=self.tokens,
+        out_of_vocabulary_behavior=_OutOfVocabularyTokenBehavior.return_error(),
+    )
+    for block in self.blocks:
+      self.assertTrue(tokenizer.add_basic_block(block))
+    self.assertTokenizerMatchesTokenLists(tokenizer, self.tokens, self.blocks)
+
+    tokenizer.reset()
+    self.assertEqual(tokenizer.num_blocks, 0)
+    self.assertEqual(tokenizer.num_tokens, 0)
+    self.assertSequenceEqual(tokenizer.instruction_token_offsets, (0,))
+    self.assertSequenceEqual(tokenizer.block_instruction_offsets, (0,))
+
+  def test_add_basic_blocks(self):
+    tokenizer = basic_block_tokenizer.BasicBlockTokenizer(
+        tokens=self.tokens,
+        out_of_vocabulary_behavior=_OutOfVocabularyTokenBehavior.return_error(),
+    )
+    self.assertEqual(
+        tokenizer.add_basic_blocks(self.blocks), [True] * len(self.blocks)
+    )
+    self.assertTokenizerMatchesTokenLists(tokenizer, self.tokens, self.blocks)
+
+  def test_add_lazy_basic_blocks(self):
+    tokenizer = basic_block_tokenizer.BasicBlockTokenizer(
+        tokens=self.tokens,
+        out_of_vocabulary_behavior=_OutOfVocabularyTokenBehavior.return_error(),
+    )
+    lazy_blocks = [
+        basic_block_protos.lazy_basic_block_from_proto(proto.basic_block)
+        for proto in self.block_protos
+    ]
+    self.assertEqual(
+        tokenizer.can_add_basic_blocks(lazy_blocks), [True] * len(lazy_blocks)
+    )
+    self.assertEqual(
+        tokenizer.add_basic_blocks(lazy_blocks), [True] * len(lazy_blocks)
+    )
+    for lazy_block in lazy_blocks:
+      self.assertFalse(lazy_block.is_materialized)
+    self.assertTokenizerMatchesTokenLists(tokenizer, self.tokens, self.blocks)
+
+  def test_can_add_basic_blocks(self):
+    tokenizer = basic_block_tokenizer.BasicBlockTokenizer(
+        tokens=self.tokens,
+        out_of_vocabulary_behavior=_OutOfVocabularyTokenBehavior.return_error(),
+    )
+    self.assertTrue(tokenizer.can_add_basic_block(self.blocks[0]))
+    self.assertEqual(
+        tokenizer.can_add_basic_blocks(self.blocks), [True] * len(self.blocks)
+    )
+    self.assertEqual(tokenizer.num_blocks, 0)
+
+    structural_tokenizer = basic_block_tokenizer.BasicBlockTokenizer(
+        tokens=tokens.STRUCTURAL_TOKENS,
+        out_of_vocabulary_behavior=_OutOfVocabularyTokenBehavior.return_error(),
+    )
+    self.assertEqual(
+        structural_tokenizer.can_add_basic_blocks(self.blocks),
+        [False] * len(self.blocks),
+    )
+
+  def test_arrays_are_copies(self):
+    tokenizer = basic_block_tokenizer.BasicBlockTokenizer(
+        tokens=self.tokens,
+        out_of_vocabulary_behavior=_OutOfVocabularyTokenBehavior.return_error(),
+    )
+    tokenizer.add_basic_block(self.blocks[0])
+    token_indices = tokenizer.token_indices
+    self.assertEqual(token_indices.dtype, np.int32)
+    expected_token_indices = token_indices.copy()
+
+    # The arrays are not affected by later modifications of the tokenizer.
+    tokenizer.add_basic_blocks(self.blocks)
+    tokenizer.reset()
+    np.testing.assert_array_equal(token_indices, expected_token_indices)
+
+  def test_out_of_vocabulary_return_error(self):
+    tokenizer = basic_block_tokenizer.BasicBlockTokenizer(
+        tokens=tokens.STRUCTURAL_TOKENS,
+        out_of_vocabulary_behavior=_OutOfVocabularyTokenBehavior.return_error(),
+    )
+    self.assertFalse(tokenizer.add_basic_block(self.blocks[0]))
+    self.assertNotEmpty(tokenizer.last_out_of_vocabulary_token)
+    self.assertEqual(tokenizer.num_blocks, 0)
+    self.assertEqual(tokenizer.num_tokens, 0)
+
+  def test_out_of_vocabulary_replace_token(self):
+    tokenizer = basic_block_tokenizer.BasicBlockTokenizer(
+        tokens=tokens.STRUCTURAL_TOKENS,
+        out_of_vocabulary_behavior=(
+            _OutOfVocabularyTokenBehavior.replace_with_token(tokens.UNKNOWN)
+        ),
+    )
+    self.assertTrue(tokenizer.add_basic_block(self.blocks[0]))
+    num_tokens = sum(
+        len(instruction.as_token_list())
+        for instruction in self.blocks[0].instructions
+    )
+    self.assertEqual(tokenizer.num_tokens, num_tokens)
+    self.assertIn(
+        tokens.STRUCTURAL_TOKENS.index(tokens.UNKNOWN), tokenizer.token_indices
+    )
+
+
+if __name__ == '__main__':
+  absltest.main()
@@ -0,0 +1,82 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "gematria/model/batch_scheduler.h"
+
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "pybind11/pybind11.h"
+#include "pybind11/stl.h"
+
+namespace gematria {
+namespace {
+
+namespace py = ::pybind11;
+
+PYBIND11_MODULE(batch_scheduler, m) {
+  m.doc() = "Scheduling of basic blocks into batches of similar sizes.";
+
+  m.def(
+      "schedule_batches",
+      [](const std::vector<int>& num_instructions,
+         const std::optional<std::vector<int>>& num_nodes,
+         int max_blocks_in_batch, int max_instructions_in_batch,
+         int max_nodes_in_batch) {
+        if (num_nodes.has_value() &&
+            num_nodes->size() != num_instructions.size()) {
+          throw py::value_error(
+              "num_nodes must have the same length as num_instructions");
+        }
+        std::vector<BasicBlockSize> block_sizes(num_instructions.size());
+        for (int i = 0; i < block_sizes.size(); ++i) {
+          block_sizes[i].num_instructions = num_instructions[i];
+          if (num_nodes.has_value()) {
+            block_sizes[i].num_nodes = (*num_nodes)[i];
+          }
+        }
+        BatchSchedulerOptions options;
+        options.max_blocks_in_batch = max_blocks_in_batch;
+        options.max_instructions_in_batch = max_instructions_in_batch;
+        options.max_nodes_in_batch = max_nodes_in_batch;
+        BatchSchedule schedule = ScheduleBatchesBySize(block_sizes, options);
+        return std::make_pair(std::move(schedule.batches),
+                              std::move(schedule.skipped_blocks));
+      },
+      py::arg("num_instructions"), py::arg("num_nodes") = py::none(),
+      py::arg("max_blocks_in_batch") = 0,
+      py::arg("max_instructions_in_batch") = 0,
+      py::arg("max_nodes_in_batch") = 0,
+      R"(Splits basic blocks into batches of blocks of similar sizes.
+
+Args:
+  num_instructions: The number of instructions of each basic block.
+  num_nodes: The number of graph nodes of each basic block. When not specified,
+    the number of nodes is not limited.
+  max_blocks_in_batch: The maximal number of basic blocks in a batch.
+  max_instructions_in_batch: The maximal number of instructions in a batch.
+  max_nodes_in_batch: The maximal number of graph nodes in a batch.
+
+A limit of zero or less means that the corresponding quantity is not limited.
+
+Returns:
+  A tuple (batches, skipped_blocks). `batches` is a list of batches, each of
+  them a list of indices of basic blocks in the input, in the ascending order.
+  `skipped_blocks` contains the indices of blocks that exceed the limits on
+  their own and do not appear in any batch.)");
+}
+
+}  // namespace
+}  // namespace gematria
@@ -0,0 +1,56 @@
+# Copyright 2023 Google Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#    http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+from absl.testing import absltest
+from gematria.model.python import batch_scheduler
+
+
+class ScheduleBatchesTest(absltest.TestCase):
+  """Tests for the schedule_batches() wrapper.
+
+  Most of the functionality is tested in the corresponding cc_test(). Here we
+  test only the conversion of the arguments and the return values.
+  """
+
+  def test_no_limits(self):
+    batches, skipped_blocks = batch_scheduler.schedule_batches((3, 1, 2))
+    self.assertEqual(batches, [[0, 1, 2]])
+    self.assertEqual(skipped_blocks, [])
+
+  def test_instruction_limit(self):
+    batches, skipped_blocks = batch_scheduler.schedule_batches(
+        (1, 3, 5, 1, 15, 12),
+        max_blocks_in_batch=3,
+        max_instructions_in_batch=12,
+    )
+    self.assertEqual(batches, [[5], [0, 1, 2], [3]])
+    self.assertEqual(skipped_blocks, [4])
+
+  def test_node_limit(self):
+    batches, skipped_blocks = batch_scheduler.schedule_batches(
+        (2, 2, 2, 2, 3),
+        num_nodes=(15, 5, 10, 30, 10),
+        max_instructions_in_batch=10,
+        max_nodes_in_batch=20,
+    )
+    self.assertEqual(batches, [[4], [0], [1, 2]])
+    self.assertEqual(skipped_blocks, [3])
+
+  def test_num_nodes_size_mismatch(self):
+    with self.assertRaises(ValueError):
+      batch_scheduler.schedule_batches((1, 2, 3), num_nodes=(1, 2))
+
+
+if __name__ == '__main__':
+  absltest.main()
@@ -13,12 +13,14 @@
 # limitations under the License.
 """Helper function for running inference with Gematria models."""
 
-from collections.abc import Iterable
+from collections.abc import Iterable, Sequence
+import itertools
 from typing import Optional
 
 from absl import logging
 from gematria.basic_block.python import throughput_protos
 from gematria.model.python import model_base
+from gematria.model.python import prediction_cache as cache_lib
 from gematria.model.python import training
 from gematria.proto import throughput_pb2
 import tensorflow.compat.v1 as tf
@@ -30,12 +32,84 @@ def _get_num_instructions_in_block_with_throughput_proto(
   return len(proto.basic_block.canonicalized_instructions)
 
 
+def _predict_for_batch(
+    model: model_base.ModelBase,
+    sess: tf.Session,
+    protos: Sequence[throughput_pb2.BasicBlockWithThroughputProto],
+    prediction_cache: Optional[cache_lib.PredictionCache],
+) -> None:
+  """Adds predictions of the model to a single batch of protos in place."""
+  block_is_valid = [False] * len(protos)
+  cached_predictions = [None] * len(protos)
+  uncached_indices = []
+  uncached_blocks = []
+  for proto_index, proto in enumerate(protos):
+    if prediction_cache is not None:
+      cached_predictions[proto_index] = prediction_cache.lookup(
+          proto.basic_block
+      )
+      if cached_predictions[proto_index] is not None:
+        continue
+    uncached_indices.append(proto_index)
+    uncached_blocks.append(
+        throughput_protos.block_with_throughput_from_proto(proto).block
+    )
+
+  # Validate all blocks in a single call, so that models can check them in a
+  # single pass in native code.
+  blocks = []
+  for proto_index, block, is_valid in zip(
+      uncached_indices,
+      uncached_blocks,
+      model.validate_basic_blocks(uncached_blocks),
+  ):
+    if is_valid:
+      block_is_valid[proto_index] = True
+      blocks.append(block)
+
+  # Blocks are already divided into batches according to the given criteria,
+  # no need to use max_blocks_in_batch and max_instructions_in_batch again.
+  predictions = iter(model.predict(sess, blocks) if blocks else ())
+
+  # Inject predictions into the input protos.
+  for proto, is_valid, cached in zip(
+      protos, block_is_valid, cached_predictions
+  ):
+    if cached is not None:
+      proto.inverse_throughputs.extend(cached)
+    elif is_valid:
+      prediction = next(predictions)
+      for task_index, task_predictions in zip(
+          range(model.num_tasks), prediction.throughputs
+      ):
+        task_prefix_predictions = (
+            task_predictions.prefix_inverse_throughput_cycles
+        )
+        task_throughput = proto.inverse_throughputs.add(
+            source=model.get_source_name(task_index),
+            inverse_throughput_cycles=(
+                task_predictions.inverse_throughput_cycles
+            ),
+        )
+        for prefix_predictions in task_prefix_predictions:
+          task_throughput.prefix_inverse_throughputs.add(
+              inverse_throughput_cycles=prefix_predictions
+          )
+      if prediction_cache is not None:
+        prediction_cache.insert(
+            proto.basic_block,
+            proto.inverse_throughputs[-model.num_tasks :],
+        )
+
+
 def predict_for_protos(
     model: model_base.ModelBase,
     sess: tf.Session,
     basic_blocks: Iterable[throughput_pb2.BasicBlockWithThroughputProto],
     max_blocks_in_batch: Optional[int] = None,
     max_instructions_in_batch: Optional[int] = None,
+    prediction_cache: Optional[cache_lib.PredictionCache] = None,
+    bucketing_window_size: Optional[int] = None,
 ) -> Iterable[throughput_pb2.BasicBlockWithThroughputProto]:
   """Predicts the inverse throughput using the model.
 
@@ -55,53 +129,73 @@ def predict_for_protos(
     max_instructions_in_batch: The maximal number of instructions across all
       basic blocks processed in a single batch. When not specified, the number
       of instructions in a batch is unlimited.
+    prediction_cache: An optional cache of predictions of the model. When
+      provided, the predictions for basic blocks found in the cache are taken
+      from the cache without running the model, and the new predictions of the
+      model are added to the cache.
+    bucketing_window_size: When specified, the basic blocks are read in windows
+      of this many blocks, and the blocks in each window are split into batches
+      of blocks of similar sizes using training.bucketed_batches(). This
+      reduces the number of batches and the amount of padding when the sizes of
+      the blocks are skewed. The blocks are still returned in the input order.
+      When not specified, the batches are formed from consecutive blocks.
 
   Yields:
-    The basic blocks from basic_blocks. Each basic block has a new
-    inverse_throughputs value added to it with the prediction from the model.
+    The basic blocks from basic_blocks, in the original order. Each basic block
+    has a new inverse_throughputs value added to it with the prediction from the
+    model. Basic blocks that do not fit into a single batch are skipped.
+
+  Raises:
+    ValueError: When bucketing_window_size is not positive.
   """
-  batches = training.batches(
-      basic_blocks,
-      get_num_instructions=(
-          _get_num_instructions_in_block_with_throughput_proto
-      ),
-      max_blocks_in_batch=max_blocks_in_batch,
-      max_instructions_in_batch=max_instructions_in_batch,
-  )
-  for batch_index, protos in enumerate(batches):
-    logging.info(
-        'Processing proto batch %d (%d blocks).', batch_index, len(protos)
+  if bucketing_window_size is None:
+    batches = training.batches(
+        basic_blocks,
+        get_num_instructions=(
+            _get_num_instructions_in_block_with_throughput_proto
+        ),
+        max_blocks_in_batch=max_blocks_in_batch,
+        max_instructions_in_batch=max_instructions_in_batch,
     )
-    blocks = []
-    block_is_valid = [False] * len(protos)
-    for proto_index, proto in enumerate(protos):
-      block = throughput_protos.block_with_throughput_from_proto(proto).block
-      if model.validate_basic_block(block):
-        block_is_valid[proto_index] = True
-        blocks.append(block)
-
-    # Blocks are already divided into batches according to the given criteria,
-    # no need to use max_blocks_in_batch and max_instructions_in_batch again.
-    predictions = iter(model.predict(sess, blocks))
-
-    # Inject predictions into the input protos.
-    for proto, is_valid in zip(protos, block_is_valid):
-      if is_valid:
-        prediction = next(predictions)
-        for task_index, task_predictions in zip(
-            range(model.num_tasks), prediction.throughputs
-        ):
-          task_prefix_predictions = (
-              task_predictions.prefix_inverse_throughput_cycles
-          )
-          task_throughput = proto.inverse_throughputs.add(
-              source=model.get_source_name(task_index),
-              inverse_throughput_cycles=(
-                  task_predictions.inverse_throughput_cycles
-              ),
-          )
-          for prefix_predictions in task_prefix_predictions:
-            task_throughput.prefix_inverse_throughputs.add(
-                inverse_throughput_cycles=prefix_predictions
+    for batch_index, protos in enumerate(batches):
+      logging.info(
+          'Processing proto batch %d (%d blocks).', batch_index, len(protos)
+      )
+      _predict_for_batch(model, sess, protos, prediction_cache)
+      yield from protos
+    return
+
+  if bucketing_window_size <= 0:
+    raise ValueError(
+        f'bucketing_window_size must be positive, was {bucketing_window_size}'
+    )
+  basic_blocks = iter(basic_blocks)
+  batch_index = 0
+  while window := list(itertools.islice(basic_blocks, bucketing_window_size)):
+    # The batches contain indices of the protos in the window, so that we can
+    # restore the original order of the protos after the prediction.
+    batches = training.bucketed_batches(
+        range(len(window)),
+        get_num_instructions=lambda proto_index: (
+            _get_num_instructions_in_block_with_throughput_proto(
+                window[proto_index]
             )
-      yield proto
+        ),
+        max_blocks_in_batch=max_blocks_in_batch,
+        max_instructions_in_batch=max_instructions_in_batch,
+    )
+    proto_is_scheduled = [False] * len(window)
+    for batch in batches:
+      logging.info(
+          'Processing proto batch %d (%d blocks).', batch_index, len(batch)
+      )
+      batch_index += 1
+      for proto_index in batch:
+        proto_is_scheduled[proto_index] = True
+      _predict_for_batch(
+          model,
+          sess,
+          [window[proto_index] for proto_index in batch],
+          prediction_cache,
+      )
+    yield from itertools.compress(window, proto_is_scheduled)
@@ -16,6 +16,7 @@ import copy
 
 from gematria.model.python import inference
 from gematria.model.python import model_base
+from gematria.model.python import prediction_cache
 from gematria.proto import throughput_pb2
 from gematria.testing.python import model_test
 import numpy as np
@@ -127,6 +128,8 @@ class PredictForProtosTest(model_test.TestCase):
       max_instructions_in_batch,
       expected_batch_sizes,
       source_name=None,
+      bucketing_window_size=None,
+      expected_predictions=None,
   ):
     """Checks the prediction of the test model with the given batch size.
 
@@ -143,6 +146,12 @@ class PredictForProtosTest(model_test.TestCase):
         by model.predict(), verified by this method.
       source_name: A string template used with str.format() to create throughput
         source names in the expected data.
+      bucketing_window_size: The bucketing window size passed to
+        inference.predict_for_protos().
+      expected_predictions: The expected predictions of the model for the
+        first task for each basic block. When not specified, the basic blocks
+        are expected to be processed in the input order, and the prediction for
+        each block is its index plus one.
     """
     with self.session() as sess:
       # inference.predict_for_protos() modifies the protos in-place. We need to
@@ -155,6 +164,7 @@ class PredictForProtosTest(model_test.TestCase):
               input_protos,
               max_blocks_in_batch=max_blocks_in_batch,
               max_instructions_in_batch=max_instructions_in_batch,
+              bucketing_window_size=bucketing_window_size,
           )
       )
       self.assertSequenceEqual(model.batch_sizes, expected_batch_sizes)
@@ -165,12 +175,17 @@ class PredictForProtosTest(model_test.TestCase):
         # The prediction of the model is the number of calls to
         # model._add_basic_block_to_batch(). There is one call per basic block,
         # so we can get the expected value from the index of the basic block.
+        expected_prediction = (
+            expected_predictions[index]
+            if expected_predictions is not None
+            else index + 1
+        )
         expected_inverse_throughputs = [*in_proto.inverse_throughputs]
         for task_index in range(model.num_tasks):
           expected_inverse_throughputs.append(
               throughput_pb2.ThroughputWithSourceProto(
                   source=model.get_source_name(task_index),
-                  inverse_throughput_cycles=(index + 1 + task_index,),
+                  inverse_throughput_cycles=(expected_prediction + task_index,),
               )
           )
         self.assertEqual(in_proto.basic_block, out_proto.basic_block)
@@ -221,6 +236,55 @@ class PredictForProtosTest(model_test.TestCase):
         model, batch_size, max_instructions_in_batch, expected_batch_sizes
     )
 
+  def test_predict_with_bucketing(self):
+    model = TestModel(dtype=tf.dtypes.float32)
+    model.initialize()
+
+    max_instructions_in_batch = 10
+    # Lengths of blocks in self.blocks_with_throughput are:
+    # [1, 5, 1, 8, 3, 4, 1, 2, 9, 4].
+    # The blocks are processed in batches [8], [3], [1, 5], [0, 4, 7, 9],
+    # [2, 6], but returned in the original order.
+    expected_batch_sizes = [1, 1, 2, 4, 2]
+    expected_predictions = [5, 3, 9, 2, 6, 4, 10, 7, 1, 8]
+    self._check_predict(
+        model,
+        None,
+        max_instructions_in_batch,
+        expected_batch_sizes,
+        bucketing_window_size=len(self.block_protos),
+        expected_predictions=expected_predictions,
+    )
+
+  def test_predict_with_small_bucketing_window(self):
+    model = TestModel(dtype=tf.dtypes.float32)
+    model.initialize()
+
+    max_instructions_in_batch = 10
+    # The windows are [1, 5, 1, 8], [3, 4, 1, 2], and [9, 4]. The blocks are
+    # processed in batches [3], [0, 1, 2], [4, 5, 6, 7], [8], [9].
+    expected_batch_sizes = [1, 3, 4, 1, 1]
+    expected_predictions = [2, 3, 4, 1, 5, 6, 7, 8, 9, 10]
+    self._check_predict(
+        model,
+        None,
+        max_instructions_in_batch,
+        expected_batch_sizes,
+        bucketing_window_size=4,
+        expected_predictions=expected_predictions,
+    )
+
+  def test_predict_with_invalid_bucketing_window(self):
+    model = TestModel(dtype=tf.dtypes.float32)
+    model.initialize()
+    with self.session() as sess:
+      with self.assertRaises(ValueError):
+        tuple(
+            inference.predict_for_protos(
+                model, sess, self.block_protos, bucketing_window_size=0
+            )
+        )
+
   def test_predict_multi_task(self):
     task_list = ('task_1', 'task_2', 'task_3')
     model = TestModel(dtype=tf.dtypes.float32, task_list=task_list)
@@ -228,6 +292,37 @@ class PredictForProtosTest(model_test.TestCase):
 
     self._check_predict(model, None, None, [len(self.blocks_with_throughput)])
 
+  def test_predict_with_prediction_cache(self):
+    model = TestModel(dtype=tf.dtypes.float32)
+    model.initialize()
+    cache = prediction_cache.PredictionCache(model_key='TestModel')
+
+    with self.session() as sess:
+      first_output_protos = tuple(
+          inference.predict_for_protos(
+              model,
+              sess,
+              copy.deepcopy(self.block_protos),
+              prediction_cache=cache,
+          )
+      )
+      self.assertSequenceEqual(model.batch_sizes, (len(self.block_protos),))
+      self.assertEqual(cache.num_hits, 0)
+
+      second_output_protos = tuple(
+          inference.predict_for_protos(
+              model,
+              sess,
+              copy.deepcopy(self.block_protos),
+              prediction_cache=cache,
+          )
+      )
+    # All predictions in the second run come from the cache, and the model does
+    # not process any new batches.
+    self.assertSequenceEqual(model.batch_sizes, (len(self.block_protos),))
+    self.assertEqual(cache.num_hits, len(self.block_protos))
+    self.assertSequenceEqual(first_output_protos, second_output_protos)
+
   def check_predict_deltas(self, model):
     """Checks the prediction of the model when predicting also deltas."""
     with self.session() as sess:
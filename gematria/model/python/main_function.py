@@ -25,12 +25,14 @@ Typical usage:
 """
 
 from collections.abc import Iterable, Mapping, Sequence
+import dataclasses
 import functools
+import json
 import os
 import random
 import re
 import sys
-from typing import Any, Type
+from typing import Any, Type, Union
 
 from absl import flags
 from absl import logging
@@ -38,11 +40,15 @@ from gematria.basic_block.python import throughput
 from gematria.basic_block.python import throughput_protos
 from gematria.io.python import gfile_copy
 from gematria.io.python import options as io_options
+from gematria.io.python import sharding
 from gematria.io.python import tfrecord
 from gematria.io.python import utils
 from gematria.model.python import inference
 from gematria.model.python import model_base
 from gematria.model.python import options as model_options
+from gematria.model.python import prediction_cache
+from gematria.model.python import streaming_evaluation
+from gematria.model.python import throughput_table
 from gematria.model.python import training
 from gematria.proto import throughput_pb2
 from gematria.utils.python import timer
@@ -61,6 +67,16 @@ _INPUT_FILES = flags.DEFINE_list(
     [],
     'The TFRecord files from which basic block data is loaded.',
 )
+_SHARD_INPUT_FILES = flags.DEFINE_bool(
+    'gematria_shard_input_files',
+    False,
+    (
+        'When training, read only the part of --gematria_input_file assigned to'
+        ' this worker replica, based on --gematria_training_task and'
+        ' --gematria_num_training_worker_replicas. The parts of all replicas'
+        ' are disjoint. See gematria/io/python/sharding.py for details.'
+    ),
+)
 _INPUT_FILE_SCALING = flags.DEFINE_float(
     'gematria_input_file_scaling',
     1.0,
@@ -175,6 +191,16 @@ _GEMATRIA_TRAINING_RANDOMIZE_BATCHES = flags.DEFINE_bool(
         ' the order in which they appear in the input.'
     ),
 )
+_GEMATRIA_TRAINING_NUM_PREFETCHED_BATCHES = flags.DEFINE_integer(
+    'gematria_training_num_prefetched_batches',
+    0,
+    (
+        'The number of training batches scheduled ahead of the current training'
+        ' step on a background thread. When zero, each batch is scheduled right'
+        ' before its training step.'
+    ),
+    lower_bound=0,
+)
 _DROP_INVALID_BLOCKS = flags.DEFINE_bool(
     'gematria_drop_invalid_blocks',
     False,
@@ -185,6 +211,29 @@ _DROP_INVALID_BLOCKS = flags.DEFINE_bool(
         ' mode.'
     ),
 )
+_LAZY_BASIC_BLOCKS = flags.DEFINE_bool(
+    'gematria_lazy_basic_blocks',
+    False,
+    (
+        'Keep the basic blocks loaded from the input files in a compact form,'
+        ' and convert them to Python BasicBlock objects only when they are'
+        ' accessed from Python. This reduces the memory used by large'
+        ' datasets; the graph builder and the tokenizer use the compact form'
+        ' directly.'
+    ),
+)
+_NATIVE_THROUGHPUT_TABLE = flags.DEFINE_bool(
+    'gematria_native_throughput_table',
+    False,
+    (
+        'Load the training and evaluation data into a native throughput table'
+        ' instead of converting each record to Python objects. The source'
+        ' filters, the throughput selection, the input file scaling, and'
+        ' the removal of blocks without throughputs are applied in native'
+        ' code, and the expected outputs of each batch are created in a single'
+        ' native call. Used only when --gematria_action is "train" or "eval".'
+    ),
+)
 _TRAINING_THROUGHPUT_SELECTION = flags.DEFINE_enum_class(
     'gematria_training_throughput_selection',
     io_options.ThroughputSelection.MEAN,
@@ -422,8 +471,48 @@ _GRAPH_DEF_FILE = flags.DEFINE_string(
     None,
     (
         'When running in export graph def node, this is the name of the file to'
-        ' which the GraphDef proto for the model is written. The proto is'
-        ' stored in the text format.'
+        ' which the GraphDef proto for the model is written. The format of'
+        ' the proto is controlled by --gematria_export_graph_def_as_text.'
+    ),
+)
+_GEMATRIA_EXPORT_GRAPH_DEF_AS_TEXT = flags.DEFINE_bool(
+    'gematria_export_graph_def_as_text',
+    True,
+    (
+        'When running in export graph def mode, determines the format of the'
+        ' exported GraphDef proto: when True, the proto is stored in the text'
+        ' format; when False, it is stored in the binary format that can be'
+        ' loaded by the native inference server.'
+    ),
+)
+_GEMATRIA_PREDICTION_CACHE_FILE = flags.DEFINE_string(
+    'gematria_prediction_cache_file',
+    None,
+    (
+        'When running in the predict mode, this is the name of an SQLite'
+        ' database used as a persistent cache of the predictions of the model.'
+        ' The predictions are keyed by the canonicalized instructions of the'
+        ' basic blocks, the model, its vocabulary, and the name of the'
+        ' checkpoint file. When not specified, the predictions are not cached.'
+    ),
+)
+_GEMATRIA_PREDICTION_CACHE_SIZE = flags.DEFINE_integer(
+    'gematria_prediction_cache_size',
+    100000,
+    (
+        'The maximal number of predictions kept in memory by the prediction'
+        ' cache. Used only when --gematria_prediction_cache_file is specified.'
+    ),
+)
+_GEMATRIA_STREAMING_EVALUATION_FILE = flags.DEFINE_string(
+    'gematria_streaming_evaluation_file',
+    '',
+    (
+        'When non-empty, the predictions are compared with the expected inverse'
+        ' throughputs of the basic blocks while they are written to'
+        ' --gematria_output_file, and the error statistics are stored as JSON'
+        ' in this file. The statistics are computed in a single pass with'
+        ' bounded memory. Used only when --gematria_action is "predict".'
     ),
 )
 _GEMATRIA_USE_SEQ2SEQ_LOSS = flags.DEFINE_bool(
@@ -655,6 +744,30 @@ def _resume_previous_experiment_if_needed():
   logging.info('Hacking checkpoint files done.')
 
 
+def _throughput_selection_from_command_line_flags() -> (
+    io_options.ThroughputSelection
+):
+  """Returns the throughput selection used for the input basic blocks."""
+  # When the model is trained with the random throughput selection strategy,
+  # we evaluate it against the mean. For other strategies, we evaluate it
+  # against the chosen strategy.
+  if (
+      _ACTION.value == model_options.Action.TRAIN
+      or _TRAINING_THROUGHPUT_SELECTION.value
+      != io_options.ThroughputSelection.RANDOM
+  ):
+    return _TRAINING_THROUGHPUT_SELECTION.value
+  return io_options.ThroughputSelection.MEAN
+
+
+def _shard_from_command_line_flags() -> sharding.Shard:
+  """Returns the shard of the input files read by this training worker."""
+  return sharding.Shard(
+      index=_GEMATRIA_TRAINING_TASK.value,
+      num_shards=_GEMATRIA_NUM_TRAINING_WORKER_REPLICAS.value,
+  )
+
+
 def _make_basic_block_reader_from_command_line_flags(
     input_files: Sequence[str], source_filter_list: Sequence[str]
 ) -> Iterable[throughput_pb2.BasicBlockWithThroughputProto]:
@@ -695,17 +808,7 @@ def _make_basic_block_reader_from_command_line_flags(
           functools.partial(utils.select_throughputs, source_filters)
       )
 
-    # When the model is trained with the random throughput selection strategy,
-    # we evaluate it against the mean. For other strategies, we evaluate it
-    # against the chosen strategy.
-    if (
-        _ACTION.value == model_options.Action.TRAIN
-        or _TRAINING_THROUGHPUT_SELECTION.value
-        != io_options.ThroughputSelection.RANDOM
-    ):
-      throughput_selection = _TRAINING_THROUGHPUT_SELECTION.value
-    else:
-      throughput_selection = io_options.ThroughputSelection.MEAN
+    throughput_selection = _throughput_selection_from_command_line_flags()
     proto_filters.append(
         functools.partial(
             utils.drop_blocks_with_no_throughputs,
@@ -720,9 +823,16 @@ def _make_basic_block_reader_from_command_line_flags(
           functools.partial(utils.scale_throughputs, _INPUT_FILE_SCALING.value)
       )
 
-  protos = tfrecord.read_protos(
-      input_files, throughput_pb2.BasicBlockWithThroughputProto
-  )
+  if _SHARD_INPUT_FILES.value and _ACTION.value == model_options.Action.TRAIN:
+    protos = sharding.read_sharded_protos(
+        input_files,
+        throughput_pb2.BasicBlockWithThroughputProto,
+        _shard_from_command_line_flags(),
+    )
+  else:
+    protos = tfrecord.read_protos(
+        input_files, throughput_pb2.BasicBlockWithThroughputProto
+    )
   return utils.apply_filters(protos, proto_filters)
 
 
@@ -746,11 +856,80 @@ def _extract_basic_blocks_with_throughput(
   """
   keep_all_blocks = not _DROP_INVALID_BLOCKS.value
   for proto in protos:
-    block = throughput_protos.block_with_throughput_from_proto(proto)
+    block = throughput_protos.block_with_throughput_from_proto(
+        proto, lazy=_LAZY_BASIC_BLOCKS.value
+    )
     if keep_all_blocks or model.validate_basic_block_with_throughput(block):
       yield block
 
 
+def _make_throughput_table_from_command_line_flags(
+    model: model_base.ModelBase,
+    input_files: Sequence[str],
+    source_filter_list: Sequence[str],
+) -> throughput_table.ThroughputTable:
+  """Loads basic blocks from the input files into a throughput table.
+
+  Applies the same transformations as
+  _make_basic_block_reader_from_command_line_flags() followed by
+  _extract_basic_blocks_with_throughput(), but parses and filters the records
+  in native code. The prefix inverse throughputs are kept only when the model
+  uses deltas, and only then they are considered when removing blocks with no
+  inverse throughputs.
+
+  Args:
+    model: The Gematria model for which the basic blocks are loaded.
+    input_files: The list of TFRecord files from which the samples are read.
+    source_filter_list: A list of regular expressions (in text format) used to
+      filter inverse throughput sources. When empty, the first throughputs of
+      each block are used for the tasks of the model.
+
+  Returns:
+    The throughput table with the basic blocks from the input files.
+  """
+  throughput_selection = _throughput_selection_from_command_line_flags()
+  table = throughput_table.ThroughputTable(
+      num_tasks=model.num_tasks,
+      source_filters=source_filter_list,
+      selection=throughput_table.ThroughputSelection.__members__[
+          throughput_selection.name
+      ],
+      scaling=_INPUT_FILE_SCALING.value,
+      keep_prefixes=model.use_deltas,
+  )
+  if _SHARD_INPUT_FILES.value and _ACTION.value == model_options.Action.TRAIN:
+    records = sharding.read_sharded_records(
+        input_files, _shard_from_command_line_flags()
+    )
+  else:
+    records = tfrecord.read_records(input_files)
+  if _DROP_INVALID_BLOCKS.value:
+    for record in records:
+      if table.add_serialized_proto(record) and not model.validate_basic_block(
+          table.block(len(table) - 1)
+      ):
+        table.remove_last_block()
+  else:
+    table.add_serialized_protos(records)
+  logging.info('Loaded %d basic blocks into a throughput table.', len(table))
+  return table
+
+
+def _load_all_blocks(
+    blocks: Union[
+        Iterable[throughput.BasicBlockWithThroughput],
+        throughput_table.ThroughputTable,
+    ],
+) -> Union[
+    Sequence[throughput.BasicBlockWithThroughput],
+    throughput_table.ThroughputTable,
+]:
+  """Reads all basic blocks from `blocks` unless they are in a table."""
+  if isinstance(blocks, throughput_table.ThroughputTable):
+    return blocks
+  return tuple(blocks)
+
+
 def _session_from_checkpoint(checkpoint_file: str) -> tf.Session:
   """Creates a local TF Session and restores it from a given checkpoint file."""
   sess = tf.Session()
@@ -759,6 +938,47 @@ def _session_from_checkpoint(checkpoint_file: str) -> tf.Session:
   return sess
 
 
+def _make_streaming_evaluator(
+    model: model_base.ModelBase,
+) -> streaming_evaluation.StreamingEvaluator:
+  """Creates a streaming evaluator for the predictions of `model`."""
+  source_filters = _THROUGHPUT_SOURCE_FILTERS.value
+  return streaming_evaluation.StreamingEvaluator(
+      num_tasks=model.num_tasks,
+      percentile_ranks=tuple(map(int, _COLLECTED_PERCENTILE_RANKS.value)),
+      expected_source_filters=(
+          source_filters if len(source_filters) == model.num_tasks else None
+      ),
+  )
+
+
+def _write_streaming_evaluation_results(
+    filename: str,
+    model: model_base.ModelBase,
+    evaluator: streaming_evaluation.StreamingEvaluator,
+) -> None:
+  """Stores the results of a streaming evaluation as a JSON file."""
+  results = {
+      'num_skipped_blocks': evaluator.num_skipped_blocks,
+      'tasks': {
+          task_name: dataclasses.asdict(task_result)
+          for task_name, task_result in zip(
+              model.task_list, evaluator.results()
+          )
+      },
+  }
+  for task_name, task_result in results['tasks'].items():
+    logging.info(
+        'Streaming evaluation, task %s: %d blocks, MAE %f, MAPE %f',
+        task_name,
+        task_result['num_blocks'],
+        task_result['mean_absolute_error'],
+        task_result['mean_absolute_percentage_error'],
+    )
+  with tf.io.gfile.GFile(filename, 'w') as results_file:
+    json.dump(results, results_file, indent=2)
+
+
 def _task_names_from_command_line_flags() -> Sequence[str]:
   """Returns a list of task names based on the command line flags."""
   if _TASK_NAMES.value:
@@ -834,12 +1054,25 @@ def run_gematria_model_from_command_line_flags(
                 'At least one .tfrecord file must be specified through'
                 ' --gematria_input_file.'
             )
-          basic_block_protos = _make_basic_block_reader_from_command_line_flags(
-              input_files, _THROUGHPUT_SOURCE_FILTERS.value
-          )
-          blocks_with_throughput = _extract_basic_blocks_with_throughput(
-              model, basic_block_protos
-          )
+          if _NATIVE_THROUGHPUT_TABLE.value and _ACTION.value in (
+              model_options.Action.EVAL,
+              model_options.Action.TRAIN,
+          ):
+            basic_block_protos = None
+            blocks_with_throughput = (
+                _make_throughput_table_from_command_line_flags(
+                    model, input_files, _THROUGHPUT_SOURCE_FILTERS.value
+                )
+            )
+          else:
+            basic_block_protos = (
+                _make_basic_block_reader_from_command_line_flags(
+                    input_files, _THROUGHPUT_SOURCE_FILTERS.value
+                )
+            )
+            blocks_with_throughput = _extract_basic_blocks_with_throughput(
+                model, basic_block_protos
+            )
         else:
           basic_block_protos = None
           blocks_with_throughput = None
@@ -847,7 +1080,7 @@ def run_gematria_model_from_command_line_flags(
       if _ACTION.value == model_options.Action.EVAL:
         session_hooks = None
         model.run_continuous_evaluation(
-            tuple(blocks_with_throughput),
+            _load_all_blocks(blocks_with_throughput),
             _CHECKPOINT_DIR.value,
             _GEMATRIA_SUMMARY_DIR.value,
             tf_master=_MASTER.value,
@@ -857,6 +1090,13 @@ def run_gematria_model_from_command_line_flags(
             max_instructions_in_batch=max_instructions_in_batch,
         )
       elif _ACTION.value == model_options.Action.PREDICT:
+        cache = None
+        if _GEMATRIA_PREDICTION_CACHE_FILE.value:
+          cache = prediction_cache.PredictionCache(
+              prediction_cache.model_cache_key(model, _CHECKPOINT_FILE.value),
+              max_memory_entries=_GEMATRIA_PREDICTION_CACHE_SIZE.value,
+              store_filename=_GEMATRIA_PREDICTION_CACHE_FILE.value,
+          )
         with _session_from_checkpoint(_CHECKPOINT_FILE.value) as sess:
           output_blocks = inference.predict_for_protos(
               model,
@@ -864,8 +1104,24 @@ def run_gematria_model_from_command_line_flags(
               basic_block_protos,
               max_blocks_in_batch=_GEMATRIA_MAX_BLOCKS_IN_BATCH.value,
               max_instructions_in_batch=max_instructions_in_batch,
+              prediction_cache=cache,
           )
+          evaluator = None
+          if _GEMATRIA_STREAMING_EVALUATION_FILE.value:
+            evaluator = _make_streaming_evaluator(model)
+            output_blocks = evaluator.evaluate_protos(output_blocks)
           tfrecord.write_protos(_GEMATRIA_OUTPUT_FILE.value, output_blocks)
+        if evaluator is not None:
+          _write_streaming_evaluation_results(
+              _GEMATRIA_STREAMING_EVALUATION_FILE.value, model, evaluator
+          )
+        if cache is not None:
+          logging.info(
+              'Prediction cache: %d hits, %d misses.',
+              cache.num_hits,
+              cache.num_misses,
+          )
+          cache.close()
       elif _ACTION.value == model_options.Action.EXPORT_GRAPH_DEF:
         graph_def = tf.get_default_graph().as_graph_def()
         graph_def = tf.compat.v1.graph_util.remove_training_nodes(
@@ -885,6 +1141,7 @@ def run_gematria_model_from_command_line_flags(
             graph_def,
             logdir=os.path.dirname(_GRAPH_DEF_FILE.value),
             name=os.path.basename(_GRAPH_DEF_FILE.value),
+            as_text=_GEMATRIA_EXPORT_GRAPH_DEF_AS_TEXT.value,
         )
       elif _ACTION.value == model_options.Action.TRAIN:
         if is_chief:
@@ -899,10 +1156,13 @@ def run_gematria_model_from_command_line_flags(
             )
             model.train(
                 session,
-                tuple(blocks_with_throughput),
+                _load_all_blocks(blocks_with_throughput),
                 max_blocks_in_batch=_GEMATRIA_MAX_BLOCKS_IN_BATCH.value,
                 max_instructions_in_batch=max_instructions_in_batch,
                 num_epochs=_GEMATRIA_TRAINING_NUM_EPOCHS.value,
                 randomize_batches=_GEMATRIA_TRAINING_RANDOMIZE_BATCHES.value,
                 randomize_expected_outputs=randomize_expected_outputs,
+                num_prefetched_batches=(
+                    _GEMATRIA_TRAINING_NUM_PREFETCHED_BATCHES.value
+                ),
             )
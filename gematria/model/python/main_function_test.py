@@ -407,6 +407,7 @@ class GematriaMainFunctionTest(model_test.TestCase):
     training_throughput_selection = io_options.ThroughputSelection.RANDOM
     checkpoint_dir = path.join(self.work_directory.full_path, 'checkpoint')
     use_seq2seq_loss = False  # The default is True.
+    num_prefetched_batches = 2
 
     model = None
 
@@ -432,6 +433,7 @@ class GematriaMainFunctionTest(model_test.TestCase):
     FLAGS.gematria_use_seq2seq_loss = use_seq2seq_loss
     FLAGS.gematria_learning_rate = learning_rate
     FLAGS.gematria_training_throughput_selection = training_throughput_selection
+    FLAGS.gematria_training_num_prefetched_batches = num_prefetched_batches
 
     main_function.run_gematria_model_from_command_line_flags(
         MockModel, dtype=tf.dtypes.float32
@@ -460,6 +462,7 @@ class GematriaMainFunctionTest(model_test.TestCase):
         num_epochs=num_epochs,
         randomize_batches=randomize_batches,
         randomize_expected_outputs=True,
+        num_prefetched_batches=num_prefetched_batches,
     )
 
     # Check that the files created by the monitored session are there.
@@ -546,6 +549,7 @@ class GematriaMainFunctionTest(model_test.TestCase):
         num_epochs=num_epochs,
         randomize_batches=randomize_batches,
         randomize_expected_outputs=False,
+        num_prefetched_batches=0,
     )
 
   @flagsaver.flagsaver
@@ -610,6 +614,7 @@ class GematriaMainFunctionTest(model_test.TestCase):
         num_epochs=num_epochs,
         randomize_batches=randomize_batches,
         randomize_expected_outputs=False,
+        num_prefetched_batches=0,
     )
 
   def test_train_with_resume(self):
@@ -808,6 +813,34 @@ class GematriaMainFunctionTest(model_test.TestCase):
     self.assertNotIn('Variable', graph_def_pbtxt)
     self.assertIn(str(predicted_value), graph_def_pbtxt)
 
+  @flagsaver.flagsaver
+  def test_export_frozen_graph_def_as_binary(self):
+    """Tests exporting a frozen model to a binary GraphDef proto."""
+    predicted_value = 123654
+    graph_def_filename = path.join(
+        self.work_directory.full_path, 'graph_def.pb'
+    )
+
+    checkpoint_filename = path.join(
+        self.work_directory.full_path, 'checkpoint.ckpt'
+    )
+    self._create_checkpoint_file(checkpoint_filename, predicted_value)
+
+    FLAGS.gematria_action = model_options.Action.EXPORT_GRAPH_DEF
+    FLAGS.gematria_graph_def_file = graph_def_filename
+    FLAGS.gematria_checkpoint_file = checkpoint_filename
+    FLAGS.gematria_export_graph_def_as_text = False
+
+    main_function.run_gematria_model_from_command_line_flags(
+        TestModel, dtype=tf.dtypes.float32
+    )
+    graph_def = tf.GraphDef()
+    with open(graph_def_filename, 'rb') as graph_def_file:
+      graph_def.ParseFromString(graph_def_file.read())
+    node_names = {node.name for node in graph_def.node}
+    self.assertIn(model_base.ModelBase.OUTPUT_TENSOR_NAME, node_names)
+    self.assertFalse(any('Variable' in node.op for node in graph_def.node))
+
   @flagsaver.flagsaver
   def test_multi_task_flags(self):
     """Tests validation of multi-task learning flags."""
@@ -39,6 +39,7 @@ from gematria.basic_block.python import basic_block
 from gematria.basic_block.python import throughput
 from gematria.model.python import loss_utils
 from gematria.model.python import options
+from gematria.model.python import throughput_table
 from gematria.model.python import training
 from gematria.utils.python import timer
 import numpy as np
@@ -917,6 +918,23 @@ class ModelBase(metaclass=abc.ABCMeta):
     del block  # Unused.
     return True
 
+  def validate_basic_blocks(
+      self, blocks: Sequence[basic_block.BasicBlock]
+  ) -> list[bool]:
+    """A batch version of validate_basic_block().
+
+    By default, calls validate_basic_block() for each block. Models that can
+    check the blocks more efficiently in a single call can override this method.
+
+    Args:
+      blocks: The basic blocks to check.
+
+    Returns:
+      A list of bools that contains one value per block in `blocks`; the value
+      is True when the corresponding block can be processed by the model.
+    """
+    return [self.validate_basic_block(block) for block in blocks]
+
   def validate_basic_block_with_throughput(
       self, block: throughput.BasicBlockWithThroughput
   ) -> bool:
@@ -1097,13 +1115,61 @@ class ModelBase(metaclass=abc.ABCMeta):
     self._batch_expected_outputs.append(block_expected_outputs)
     self._batch_mask.append(block_mask)
 
+  def _add_expected_outputs_from_table_to_batch(
+      self,
+      table: throughput_table.ThroughputTable,
+      block_indices: Sequence[int],
+      randomize_expected_outputs: bool,
+  ) -> None:
+    """Adds expected outputs for blocks from a throughput table to the batch.
+
+    Computes the expected outputs for all blocks of the batch in a single call
+    to the native code; this replaces _add_expected_outputs_to_batch() for the
+    blocks of the batch.
+
+    Args:
+      table: The throughput table that contains the blocks.
+      block_indices: The indices of the blocks in the batch, in the order in
+        which they were added to the batch.
+      randomize_expected_outputs: When True, the expected output for each basic
+        block and each delta is selected randomly from the values in the table.
+        Otherwise, takes the first value.
+
+    Raises:
+      ValueError: When the table has a different number of tasks than the
+        model.
+    """
+    if table.num_tasks != self.num_tasks:
+      raise ValueError(
+          'The throughput table has a different number of tasks:'
+          f' {table.num_tasks}, should be {self.num_tasks}'
+      )
+    # The seed is drawn from the Python generator only when it is used, so
+    # that the other random decisions of the model do not depend on it.
+    seed = random.getrandbits(64) if randomize_expected_outputs else 0
+    outputs, mask, deltas = table.expected_outputs(
+        block_indices,
+        randomize=randomize_expected_outputs,
+        seed=seed,
+        include_deltas=self._use_deltas,
+        check_num_prefixes=self._use_delta_loss,
+    )
+    self._batch_expected_outputs = outputs
+    self._batch_mask = mask
+    if self._use_deltas:
+      self._batch_expected_outputs_deltas = deltas
+
   def schedule_batch(
       self,
-      basic_blocks: Sequence[BlockOrBlockWithThroughput],
+      basic_blocks: Union[
+          Sequence[BlockOrBlockWithThroughput],
+          throughput_table.ThroughputTable,
+      ],
       max_blocks_in_batch: Optional[int] = None,
       max_instructions_in_batch: Optional[int] = None,
       randomize_batch: bool = False,
       randomize_expected_outputs: bool = False,
+      block_indices: Optional[Sequence[int]] = None,
   ) -> FeedDict:
     """Creates a feed_dict that covers all basic blocks from basic_blocks.
 
@@ -1128,9 +1194,9 @@ class ModelBase(metaclass=abc.ABCMeta):
      sizes of the input basic blocks are perfectly aligned with the limits.
 
     Args:
-      basic_blocks: a list of basic_blocks or basic blocks with throughput. When
-        throughputs are provided, the number of entries must correspond to the
-        number of tasks learned by the model.
+      basic_blocks: a list of basic_blocks or basic blocks with throughput, or a
+        throughput table. When throughputs are provided, the number of entries
+        must correspond to the number of tasks learned by the model.
       max_blocks_in_batch: The maximal number of basic blocks in the batch. When
         specified, at most this many basic blocks are added to the batch.
       max_instructions_in_batch: The maximal number of instructions across all
@@ -1142,6 +1208,9 @@ class ModelBase(metaclass=abc.ABCMeta):
         block and each delta is selected randomly from the list of possible
         values in the input structure. Otherwise, takes the first value from the
         list.
+      block_indices: When specified, only the basic blocks at these indices in
+        `basic_blocks` are considered, in this order. Otherwise, all basic
+        blocks are considered.
 
     Returns:
       The feed_dict object for the batch.
@@ -1149,15 +1218,19 @@ class ModelBase(metaclass=abc.ABCMeta):
     Raises:
       ValueError: When `basic_blocks` is empty.
     """
-    num_input_blocks = len(basic_blocks)
+    if block_indices is None:
+      block_indices = range(len(basic_blocks))
+    num_input_blocks = len(block_indices)
     if num_input_blocks == 0:
       raise ValueError('basic_blocks must contain at least once block.')
 
-    # The input is a sequence that that contains either only basic blocks with
-    # throughputs or only basic blocks without throughputs. We can determine
-    # which case it is by looking at the first block of the sequence.
-    has_throughputs = isinstance(
-        basic_blocks[0], throughput.BasicBlockWithThroughput
+    # The input is either a throughput table, or a sequence that that contains
+    # either only basic blocks with throughputs or only basic blocks without
+    # throughputs. We can determine which case it is by looking at the first
+    # block of the sequence.
+    is_table = isinstance(basic_blocks, throughput_table.ThroughputTable)
+    has_throughputs = is_table or isinstance(
+        basic_blocks[block_indices[0]], throughput.BasicBlockWithThroughput
     )
 
     max_blocks_in_batch = max_blocks_in_batch or num_input_blocks
@@ -1183,25 +1256,30 @@ class ModelBase(metaclass=abc.ABCMeta):
           )
         else:
           num_blocks_in_sample = min(max_blocks_in_batch, num_input_blocks)
-        basic_blocks = random.sample(basic_blocks, num_blocks_in_sample)
+        block_indices = random.sample(block_indices, num_blocks_in_sample)
 
       num_instructions_in_batch = 0
       num_blocks_in_batch = 0
-      for block_or_block_with_throughputs in basic_blocks:
+      batch_block_indices = []
+      for block_index in block_indices:
         if num_blocks_in_batch == max_blocks_in_batch:
           break
 
-        block: basic_block.BasicBlock = (
-            block_or_block_with_throughputs.block
-            if has_throughputs
-            else block_or_block_with_throughputs
-        )
-        if has_throughputs:
-          block_with_throughputs: throughput.BasicBlockWithThroughput = (
-              block_or_block_with_throughputs
+        if is_table:
+          block = basic_blocks.block(block_index)
+        else:
+          block_or_block_with_throughputs = basic_blocks[block_index]
+          block: basic_block.BasicBlock = (
+              block_or_block_with_throughputs.block
+              if has_throughputs
+              else block_or_block_with_throughputs
           )
+          if has_throughputs:
+            block_with_throughputs: throughput.BasicBlockWithThroughput = (
+                block_or_block_with_throughputs
+            )
 
-        num_instructions_in_block = len(block.instructions)
+        num_instructions_in_block = block.num_instructions
 
         if max_instructions_in_batch:
           if num_instructions_in_block > max_instructions_in_batch:
@@ -1226,8 +1304,10 @@ class ModelBase(metaclass=abc.ABCMeta):
             continue
 
         self._add_basic_block_to_batch(block)
-        num_prefixes = len(block.instructions)
-        if has_throughputs:
+        num_prefixes = block.num_instructions
+        if is_table:
+          batch_block_indices.append(block_index)
+        elif has_throughputs:
           self._add_expected_outputs_to_batch(
               throughputs=block_with_throughputs.throughputs,
               randomize_expected_outputs=randomize_expected_outputs,
@@ -1242,6 +1322,11 @@ class ModelBase(metaclass=abc.ABCMeta):
         num_instructions_in_batch += num_instructions_in_block
         num_blocks_in_batch += 1
 
+      if is_table:
+        self._add_expected_outputs_from_table_to_batch(
+            basic_blocks, batch_block_indices, randomize_expected_outputs
+        )
+
       logging.info(
           'ModelBase.schedule_batch: %d blocks, %d instructions',
           num_blocks_in_batch,
@@ -1251,7 +1336,10 @@ class ModelBase(metaclass=abc.ABCMeta):
 
   def run_continuous_evaluation(
       self,
-      basic_blocks: Sequence[throughput.BasicBlockWithThroughput],
+      basic_blocks: Union[
+          Sequence[throughput.BasicBlockWithThroughput],
+          throughput_table.ThroughputTable,
+      ],
       checkpoint_dir: str,
       summary_dir: str,
       tf_master: str = '',
@@ -1269,8 +1357,8 @@ class ModelBase(metaclass=abc.ABCMeta):
 
     Args:
       basic_blocks: A collection of basic blocks that are used for the
-        evaluation. All blocks in the collection are used in each step of the
-        evaluation.
+        evaluation, or a throughput table that contains them. All blocks in the
+        collection are used in each step of the evaluation.
       checkpoint_dir: The checkpoint directory for the model. Trained models are
         loaded from this directory.
       summary_dir: The summary directory for the model. The summaries are
@@ -1368,7 +1456,7 @@ class ModelBase(metaclass=abc.ABCMeta):
           )
           output_index = 0
           for block_index, block in enumerate(batch):
-            block_len = len(block.instructions)
+            block_len = block.num_instructions
             # Extract the per-instruction throughput predictions for the basic
             # block. This has shape (block_len, num_tasks).
             block_output_deltas = output_deltas[
@@ -1416,18 +1504,23 @@ class ModelBase(metaclass=abc.ABCMeta):
   def train(
       self,
       monitored_session: tf.train.MonitoredSession,
-      basic_block_list: Sequence[throughput.BasicBlockWithThroughput],
+      basic_block_list: Union[
+          Sequence[throughput.BasicBlockWithThroughput],
+          throughput_table.ThroughputTable,
+      ],
       num_epochs: int,
       max_blocks_in_batch: Optional[int],
       max_instructions_in_batch: Optional[int],
       randomize_batches: bool = True,
       randomize_expected_outputs: bool = False,
+      num_prefetched_batches: int = 0,
   ) -> Optional[training.TrainingEpochStats]:
     """Runs training of the model on the given training data.
 
     Args:
       monitored_session: The monitored training session to run the training in.
-      basic_block_list: The collection of input basic blocks.
+      basic_block_list: The collection of input basic blocks, or a throughput
+        table that contains them.
       num_epochs: The number of training steps. This value is used only for
         profiling and logging; the method uses monitored_session.should_stop()
         to decide when to stop the training.
@@ -1444,6 +1537,11 @@ class ModelBase(metaclass=abc.ABCMeta):
       randomize_expected_outputs: Set to True to randomly select the expected
         outputs used for training from the available values. When False, it
         takes the first value from the list.
+      num_prefetched_batches: The number of batches scheduled ahead of the
+        current training step. When positive, the batches are scheduled on a
+        background thread while the current step runs in TensorFlow; the
+        sequence of batches is the same as without prefetching. When zero,
+        each batch is scheduled right before its training step.
 
     Returns:
       The loss before the last training step. Returns None when no training was
@@ -1451,14 +1549,15 @@ class ModelBase(metaclass=abc.ABCMeta):
     """
     if randomize_batches:
 
-      def run_one_epoch():
-        return self.train_mini_batch(
-            monitored_session,
-            basic_block_list,
-            max_blocks_in_batch=max_blocks_in_batch,
-            max_instructions_in_batch=max_instructions_in_batch,
-            randomize_expected_outputs=randomize_expected_outputs,
-        )
+      def schedules():
+        while True:
+          yield self.schedule_batch(
+              basic_block_list,
+              max_blocks_in_batch=max_blocks_in_batch,
+              max_instructions_in_batch=max_instructions_in_batch,
+              randomize_batch=True,
+              randomize_expected_outputs=randomize_expected_outputs,
+          )
 
     else:
       # Creates an infinite list of batches that respect the limits and that
@@ -1466,30 +1565,58 @@ class ModelBase(metaclass=abc.ABCMeta):
       # number of basic blocks per batch is not specified, we set it so that in
       # each step we train on basic_block_list, with no repetitions.
       max_blocks_in_batch = max_blocks_in_batch or len(basic_block_list)
+      if isinstance(basic_block_list, throughput_table.ThroughputTable):
+        # The batches of a throughput table contain the indices of the blocks.
+        table = basic_block_list
+        batch_items = range(len(table))
+        get_num_instructions = table.num_instructions
+      else:
+        table = None
+        batch_items = basic_block_list
+        get_num_instructions = (
+            training.get_num_instructions_in_block_with_throughput
+        )
       batches = iter(
           training.batches(
-              itertools.cycle(basic_block_list),
-              get_num_instructions=(
-                  training.get_num_instructions_in_block_with_throughput
-              ),
+              itertools.cycle(batch_items),
+              get_num_instructions=get_num_instructions,
               max_blocks_in_batch=max_blocks_in_batch,
               max_instructions_in_batch=max_instructions_in_batch,
           )
       )
 
-      def run_one_epoch():
-        batch = next(batches)
-        schedule = self.schedule_batch(
-            batch, randomize_expected_outputs=randomize_expected_outputs
-        )
-        return self.train_batch(monitored_session, schedule)
+      def schedules():
+        for batch in batches:
+          if table is not None:
+            yield self.schedule_batch(
+                table,
+                block_indices=batch,
+                randomize_expected_outputs=randomize_expected_outputs,
+            )
+          else:
+            yield self.schedule_batch(
+                batch, randomize_expected_outputs=randomize_expected_outputs
+            )
 
+    # NOTE: With prefetching, the batches are scheduled on a single background
+    # thread. ModelBase.schedule_batch() keeps the state of the batch in the
+    # model object, so batches can't be scheduled in parallel, but a single
+    # thread is enough to overlap scheduling with the training step, which
+    # releases the GIL while running in TensorFlow.
+    schedule_iterator = schedules()
+    if num_prefetched_batches > 0:
+      schedule_iterator = training.prefetch(
+          schedule_iterator, buffer_size=num_prefetched_batches
+      )
     with timer.scoped('ModelBase.train - one batch', num_iterations=num_epochs):
-      stats = None
-      while not monitored_session.should_stop():
-        stats = run_one_epoch()
-        logging.info('Training: %s', stats)
-      return stats
+      try:
+        stats = None
+        while not monitored_session.should_stop():
+          stats = self.train_batch(monitored_session, next(schedule_iterator))
+          logging.info('Training: %s', stats)
+        return stats
+      finally:
+        schedule_iterator.close()
 
   def train_batch(
       self,
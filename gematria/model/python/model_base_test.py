@@ -16,6 +16,7 @@
 from gematria.basic_block.python import throughput
 from gematria.model.python import model_base
 from gematria.model.python import options
+from gematria.model.python import throughput_table
 from gematria.testing.python import model_test
 import numpy as np
 import tensorflow.compat.v1 as tf
@@ -173,6 +174,22 @@ class TestModelWithVarGroups(model_base.ModelBase):
     }
 
 
+class _FakeMonitoredSession:
+  """A stand-in for tf.train.MonitoredSession that stops after `num_steps`."""
+
+  def __init__(self, sess, num_steps):
+    self._sess = sess
+    self._num_steps = num_steps
+    self.num_run_calls = 0
+
+  def should_stop(self):
+    return self.num_run_calls >= self._num_steps
+
+  def run(self, *args, **kwargs):
+    self.num_run_calls += 1
+    return self._sess.run(*args, **kwargs)
+
+
 class ModelBaseTest(model_test.TestCase):
   """The test case for ModelBase."""
 
@@ -389,6 +406,32 @@ class ModelBaseTest(model_test.TestCase):
           np.sum(expected_output_deltas), expected_outputs[0], _TOLERANCE
       )
 
+  def test_expected_outputs_from_throughput_table(self):
+    model = TestModel(dtype=tf.dtypes.float32, use_deltas=True)
+    model.initialize()
+
+    table = throughput_table.ThroughputTable(
+        num_tasks=model.num_tasks,
+        keep_prefixes=True,
+        drop_blocks_without_throughputs=False,
+    )
+    table.add_serialized_protos(
+        proto.SerializeToString() for proto in self.block_protos
+    )
+    self.assertLen(table, len(self.blocks_with_throughput))
+
+    block_indices = [3, 0, 2]
+    table_schedule = model.schedule_batch(table, block_indices=block_indices)
+    list_schedule = model.schedule_batch(
+        [self.blocks_with_throughput[i] for i in block_indices]
+    )
+    for tensor in (
+        model._expected_outputs,
+        model._expected_outputs_deltas,
+        model._output_mask,
+    ):
+      self.assertAllClose(table_schedule[tensor], list_schedule[tensor])
+
   def test_randomized_expected_outputs_delta(self):
     model = TestModel(dtype=tf.dtypes.float32, use_deltas=True)
     model.initialize()
@@ -816,6 +859,47 @@ class ModelBaseTest(model_test.TestCase):
       for weight in weights:
         self.assertNotAlmostEqual(float(weight), 0.5)
 
+  def test_train_with_prefetched_batches(self):
+    num_steps = 7
+
+    def train(num_prefetched_batches, randomize_batches):
+      with tf.Graph().as_default():
+        tf.random.set_random_seed(1)
+        model = TestModelWithVarGroups(
+            dtype=tf.dtypes.float32,
+            use_deltas=False,
+            learning_rate=0.1,
+            task_list=['foo', 'bar'],
+        )
+        model.initialize()
+        with self.session() as sess:
+          sess.run(tf.global_variables_initializer())
+          monitored_session = _FakeMonitoredSession(sess, num_steps)
+          stats = model.train(
+              monitored_session,
+              self.blocks_with_throughput,
+              num_epochs=num_steps,
+              max_blocks_in_batch=3,
+              max_instructions_in_batch=None,
+              randomize_batches=randomize_batches,
+              num_prefetched_batches=num_prefetched_batches,
+          )
+          self.assertEqual(monitored_session.num_run_calls, num_steps)
+          self.assertEqual(stats.epoch, num_steps)
+          return sess.run(model._variable_groups)
+
+    expected_variables = train(
+        num_prefetched_batches=0, randomize_batches=False
+    )
+    for num_prefetched_batches in (1, 3):
+      with self.subTest(num_prefetched_batches=num_prefetched_batches):
+        variables = train(num_prefetched_batches, randomize_batches=False)
+        self.assertAllClose(variables, expected_variables)
+
+    # With randomized batches, the batches are different in each run, but
+    # training still runs the requested number of steps.
+    train(num_prefetched_batches=2, randomize_batches=True)
+
 
 if __name__ == '__main__':
   tf.disable_v2_behavior()
@@ -0,0 +1,505 @@
+# Copyright 2023 Google Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#    http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+"""Benchmarks the Python training and inference pipelines of Gematria models.
+
+Runs ModelBase.schedule_batch() + ModelBase.train_batch() and
+inference.predict_for_protos() for the Granite and the hierarchical LSTM models
+on a fixed data set, and reports the time spent in each stage of the pipeline:
+proto parsing, training.batches, ModelBase.schedule_batch (with the
+model-specific _add_basic_block_to_batch, _make_batch_feed_dict and
+_make_batch_graphs_tuple), and Session.run.
+
+The times of the stages are inclusive, e.g. the time of
+ModelBase.schedule_batch includes the time of _make_batch_feed_dict. The results
+are printed as JSON, so that they can be tracked over time:
+
+{
+  "peak_rss_kib": 1234567,
+  "results": [
+    {
+      "model": "granite",
+      "mode": "train",
+      "num_blocks": 1020,
+      "num_instructions": 3480,
+      "total_seconds": 12.5,
+      "blocks_per_second": 81.6,
+      "instructions_per_second": 278.4,
+      "stages": {
+        "ModelBase.schedule_batch": {
+          "total_seconds": 4.2,
+          "num_calls": 20,
+          "seconds_per_call": 0.21
+        },
+        ...
+      }
+    },
+    ...
+  ]
+}
+
+By default, the benchmark uses the basic blocks from
+gematria/testing/testdata/basic_blocks_with_throughput.pbtxt, repeated to get a
+data set of a realistic size.
+
+Usage:
+  bazel run -c opt //gematria/model/python:pipeline_benchmark -- \
+      --gematria_benchmark_output_json=/tmp/pipeline_benchmark.json
+"""
+
+from collections.abc import Callable, Iterable, Iterator, Mapping, Sequence
+import functools
+import itertools
+import json
+import resource
+import time
+from typing import Any
+
+from absl import app
+from absl import flags
+from absl import logging
+from gematria.basic_block.python import throughput_protos
+from gematria.basic_block.python import tokens
+from gematria.granite.python import token_graph_builder_model
+from gematria.io.python import tfrecord
+from gematria.model.python import inference
+from gematria.model.python import model_base
+from gematria.model.python import oov_token_behavior
+from gematria.model.python import training
+from gematria.proto import throughput_pb2
+from gematria.sequence.python import sequence_model_hlstm
+from gematria.testing.python import basic_blocks_with_throughput
+from gematria.utils.python import timer
+import tensorflow.compat.v1 as tf
+
+_OutOfVocabularyTokenBehavior = oov_token_behavior.OutOfVocabularyTokenBehavior
+
+_GRANITE = 'granite'
+_HLSTM = 'hlstm'
+
+_MODELS = flags.DEFINE_list(
+    'gematria_benchmark_models',
+    [_GRANITE, _HLSTM],
+    f'The models to benchmark. Allowed values are "{_GRANITE}" and "{_HLSTM}".',
+)
+_INPUT_FILES = flags.DEFINE_list(
+    'gematria_benchmark_input_files',
+    [],
+    (
+        'A list of .tfrecord files with BasicBlockWithThroughputProtos used in'
+        ' the benchmark. When empty, the benchmark uses the basic blocks from'
+        ' the test data.'
+    ),
+)
+_DATASET_REPEATS = flags.DEFINE_integer(
+    'gematria_benchmark_dataset_repeats',
+    30,
+    'The number of copies of the input basic blocks in the data set.',
+)
+_MAX_BLOCKS_IN_BATCH = flags.DEFINE_integer(
+    'gematria_benchmark_max_blocks_in_batch',
+    100,
+    'The maximal number of basic blocks in a batch.',
+)
+_NUM_TRAINING_STEPS = flags.DEFINE_integer(
+    'gematria_benchmark_num_training_steps',
+    20,
+    'The number of measured training steps for each model.',
+)
+_NUM_WARMUP_STEPS = flags.DEFINE_integer(
+    'gematria_benchmark_num_warmup_steps',
+    2,
+    (
+        'The number of training steps and inference batches that run before the'
+        ' measurement starts. These steps absorb the one-time costs, e.g.'
+        ' TensorFlow graph optimizations.'
+    ),
+)
+_OUTPUT_JSON = flags.DEFINE_string(
+    'gematria_benchmark_output_json',
+    '',
+    (
+        'The file to which the results are written. When empty, the results'
+        ' are printed to stdout.'
+    ),
+)
+
+# The names of the stages reported by the benchmark.
+_PARSE_PROTOS = 'parse_protos'
+_BLOCK_FROM_PROTO = 'throughput_protos.block_with_throughput_from_proto'
+_BATCHES = 'training.batches'
+_SCHEDULE_BATCH = 'ModelBase.schedule_batch'
+_TRAIN_BATCH = 'ModelBase.train_batch'
+_PREDICT_FOR_PROTOS = 'inference.predict_for_protos'
+_SESSION_RUN = 'Session.run'
+
+# Model-specific methods called from ModelBase.schedule_batch(). They are timed
+# only when the model has them.
+_INSTRUMENTED_MODEL_METHODS = (
+    '_add_basic_block_to_batch',
+    '_make_batch_feed_dict',
+    '_make_batch_graphs_tuple',
+)
+
+
+def _timed(
+    function: Callable[..., Any], accumulator: timer.Accumulator, stage: str
+) -> Callable[..., Any]:
+  """Wraps `function` so that each call is added to `stage` in `accumulator`."""
+
+  @functools.wraps(function)
+  def wrapper(*args, **kwargs):
+    with accumulator.scoped(stage):
+      return function(*args, **kwargs)
+
+  return wrapper
+
+
+def _timed_iterator(
+    iterable: Iterable[Any], accumulator: timer.Accumulator, stage: str
+) -> Iterator[Any]:
+  """Iterates over `iterable`; adds the time of each step to `stage`.
+
+  Only the time needed to produce the next item is measured, the time spent by
+  the consumer of the iterator is not included.
+
+  Args:
+    iterable: The iterable object to iterate over.
+    accumulator: The accumulator that collects the times.
+    stage: The name of the stage to which the time is added.
+
+  Yields:
+    The items from `iterable`.
+  """
+  iterator = iter(iterable)
+  while True:
+    with accumulator.scoped(stage):
+      try:
+        item = next(iterator)
+      except StopIteration:
+        return
+    yield item
+
+
+class _TimedSession:
+  """Wraps a TensorFlow session and measures the time spent in run()."""
+
+  def __init__(self, sess: tf.Session, accumulator: timer.Accumulator):
+    self._sess = sess
+    self._accumulator = accumulator
+
+  def run(self, *args, **kwargs):
+    with self._accumulator.scoped(_SESSION_RUN):
+      return self._sess.run(*args, **kwargs)
+
+
+def _parse_protos(
+    serialized_protos: Iterable[bytes], accumulator: timer.Accumulator
+) -> Iterator[throughput_pb2.BasicBlockWithThroughputProto]:
+  """Parses `serialized_protos`; adds the parsing time to `accumulator`."""
+  for serialized_proto in serialized_protos:
+    with accumulator.scoped(_PARSE_PROTOS):
+      proto = throughput_pb2.BasicBlockWithThroughputProto.FromString(
+          serialized_proto
+      )
+    yield proto
+
+
+def _load_serialized_protos() -> list[bytes]:
+  """Loads the basic blocks used in the benchmark in the serialized form."""
+  if _INPUT_FILES.value:
+    protos = tfrecord.read_protos(
+        _INPUT_FILES.value, throughput_pb2.BasicBlockWithThroughputProto
+    )
+  else:
+    protos = basic_blocks_with_throughput.get_basic_blocks()
+  serialized_protos = [proto.SerializeToString() for proto in protos]
+  return serialized_protos * _DATASET_REPEATS.value
+
+
+def _get_tokens(
+    protos: Iterable[throughput_pb2.BasicBlockWithThroughputProto],
+) -> Sequence[str]:
+  """Returns a sorted list of all tokens used in `protos`."""
+  unique_tokens = set(tokens.STRUCTURAL_TOKENS)
+  for proto in protos:
+    block = throughput_protos.block_with_throughput_from_proto(proto).block
+    for instruction in block.instructions:
+      unique_tokens.update(instruction.as_token_list())
+  return sorted(unique_tokens)
+
+
+def _create_model(
+    model_name: str, model_tokens: Sequence[str]
+) -> model_base.ModelBase:
+  """Creates a model with the default hyperparameters of its main binary."""
+  common_kwargs = {
+      'tokens': model_tokens,
+      'dtype': tf.dtypes.float32,
+      'out_of_vocabulary_behavior': (
+          _OutOfVocabularyTokenBehavior.replace_with_token(tokens.UNKNOWN)
+      ),
+      'use_deltas': True,
+      'use_delta_loss': False,
+  }
+  if model_name == _GRANITE:
+    return token_graph_builder_model.TokenGraphBuilderModel(
+        immediate_token=tokens.IMMEDIATE,
+        fp_immediate_token=tokens.IMMEDIATE,
+        address_token=tokens.ADDRESS,
+        memory_token=tokens.MEMORY,
+        node_embedding_size=128,
+        edge_embedding_size=128,
+        global_embedding_size=128,
+        node_update_layers=(),
+        edge_update_layers=(),
+        global_update_layers=(),
+        readout_layers=(),
+        task_readout_layers=(),
+        graph_module_layer_normalization=True,
+        num_message_passing_iterations=8,
+        **common_kwargs,
+    )
+  if model_name == _HLSTM:
+    return sequence_model_hlstm.HierarchicalLstmModel(
+        token_embedding_size=256,
+        instruction_embedding_size=256,
+        block_embedding_size=256,
+        output_layers=(),
+        task_output_layers=(),
+        bidirectional=False,
+        **common_kwargs,
+    )
+  raise ValueError(f'Unknown model: {model_name}')
+
+
+def _instrument_model(
+    model: model_base.ModelBase, accumulator: timer.Accumulator
+) -> None:
+  """Replaces the methods of `model` with versions that measure their time."""
+  model.schedule_batch = _timed(
+      model.schedule_batch, accumulator, _SCHEDULE_BATCH
+  )
+  for method_name in _INSTRUMENTED_MODEL_METHODS:
+    method = getattr(model, method_name, None)
+    if method is not None:
+      setattr(model, method_name, _timed(method, accumulator, method_name))
+
+
+def _make_result(
+    model_name: str,
+    mode: str,
+    num_blocks: int,
+    num_instructions: int,
+    total_seconds: float,
+    stages: Mapping[str, timer.StageTime],
+) -> dict[str, Any]:
+  """Creates the JSON-serializable result of one benchmark run."""
+  return {
+      'model': model_name,
+      'mode': mode,
+      'num_blocks': num_blocks,
+      'num_instructions': num_instructions,
+      'total_seconds': total_seconds,
+      'blocks_per_second': num_blocks / total_seconds,
+      'instructions_per_second': num_instructions / total_seconds,
+      'stages': {
+          name: {
+              'total_seconds': stage.total_seconds,
+              'num_calls': stage.num_calls,
+              'seconds_per_call': stage.seconds_per_call,
+          }
+          for name, stage in sorted(stages.items())
+      },
+  }
+
+
+def _benchmark_training(
+    model_name: str,
+    model: model_base.ModelBase,
+    sess: tf.Session,
+    serialized_protos: Sequence[bytes],
+    accumulator: timer.Accumulator,
+) -> dict[str, Any]:
+  """Benchmarks the training steps of `model`.
+
+  Args:
+    model_name: The name of the model used in the results.
+    model: The benchmarked model. The model must be instrumented with
+      `accumulator`.
+    sess: The session in which the model is initialized.
+    serialized_protos: The data set used in the benchmark.
+    accumulator: The accumulator that collects the times of the stages.
+
+  Returns:
+    The results of the benchmark in a JSON-serializable form.
+  """
+  accumulator.reset()
+  timed_sess = _TimedSession(sess, accumulator)
+  blocks = []
+  for proto in _parse_protos(serialized_protos, accumulator):
+    with accumulator.scoped(_BLOCK_FROM_PROTO):
+      blocks.append(throughput_protos.block_with_throughput_from_proto(proto))
+  batches = _timed_iterator(
+      training.batches(
+          itertools.cycle(blocks),
+          get_num_instructions=(
+              training.get_num_instructions_in_block_with_throughput
+          ),
+          max_blocks_in_batch=_MAX_BLOCKS_IN_BATCH.value,
+      ),
+      accumulator,
+      _BATCHES,
+  )
+
+  def run_one_step() -> tuple[int, int]:
+    batch = next(batches)
+    schedule = model.schedule_batch(batch)
+    with accumulator.scoped(_TRAIN_BATCH):
+      model.train_batch(timed_sess, schedule)
+    num_instructions = sum(len(block.block.instructions) for block in batch)
+    return len(batch), num_instructions
+
+  # Keep the one-time costs of loading the data, but drop the times of the
+  # warm-up steps.
+  load_stages = dict(accumulator.stages)
+  for _ in range(_NUM_WARMUP_STEPS.value):
+    run_one_step()
+  accumulator.reset()
+
+  num_blocks = 0
+  num_instructions = 0
+  start_time = time.time()
+  for _ in range(_NUM_TRAINING_STEPS.value):
+    num_blocks_in_step, num_instructions_in_step = run_one_step()
+    num_blocks += num_blocks_in_step
+    num_instructions += num_instructions_in_step
+  total_seconds = time.time() - start_time
+  return _make_result(
+      model_name,
+      'train',
+      num_blocks,
+      num_instructions,
+      total_seconds,
+      {**load_stages, **accumulator.stages},
+  )
+
+
+def _benchmark_inference(
+    model_name: str,
+    model: model_base.ModelBase,
+    sess: tf.Session,
+    serialized_protos: Sequence[bytes],
+    accumulator: timer.Accumulator,
+) -> dict[str, Any]:
+  """Benchmarks inference.predict_for_protos() with `model`.
+
+  Args:
+    model_name: The name of the model used in the results.
+    model: The benchmarked model. The model must be instrumented with
+      `accumulator`.
+    sess: The session in which the model is initialized.
+    serialized_protos: The data set used in the benchmark.
+    accumulator: The accumulator that collects the times of the stages.
+
+  Returns:
+    The results of the benchmark in a JSON-serializable form.
+  """
+  accumulator.reset()
+  timed_sess = _TimedSession(sess, accumulator)
+
+  def run_inference(protos: Iterable[bytes]) -> int:
+    num_instructions = 0
+    with accumulator.scoped(_PREDICT_FOR_PROTOS):
+      for proto in inference.predict_for_protos(
+          model,
+          timed_sess,
+          _parse_protos(protos, accumulator),
+          max_blocks_in_batch=_MAX_BLOCKS_IN_BATCH.value,
+      ):
+        num_instructions += len(proto.basic_block.canonicalized_instructions)
+    return num_instructions
+
+  original_batches = training.batches
+  original_block_from_proto = throughput_protos.block_with_throughput_from_proto
+  training.batches = lambda *args, **kwargs: _timed_iterator(
+      original_batches(*args, **kwargs), accumulator, _BATCHES
+  )
+  throughput_protos.block_with_throughput_from_proto = _timed(
+      original_block_from_proto, accumulator, _BLOCK_FROM_PROTO
+  )
+  try:
+    num_warmup_blocks = _NUM_WARMUP_STEPS.value * _MAX_BLOCKS_IN_BATCH.value
+    run_inference(serialized_protos[:num_warmup_blocks])
+    accumulator.reset()
+
+    start_time = time.time()
+    num_instructions = run_inference(serialized_protos)
+    total_seconds = time.time() - start_time
+  finally:
+    training.batches = original_batches
+    throughput_protos.block_with_throughput_from_proto = (
+        original_block_from_proto
+    )
+  return _make_result(
+      model_name,
+      'inference',
+      len(serialized_protos),
+      num_instructions,
+      total_seconds,
+      accumulator.stages,
+  )
+
+
+def main(argv: Sequence[str]) -> None:
+  if len(argv) > 1:
+    raise app.UsageError('Too many command-line arguments.')
+
+  serialized_protos = _load_serialized_protos()
+  model_tokens = _get_tokens(
+      throughput_pb2.BasicBlockWithThroughputProto.FromString(serialized_proto)
+      for serialized_proto in set(serialized_protos)
+  )
+
+  results = []
+  for model_name in _MODELS.value:
+    logging.info('Benchmarking %s', model_name)
+    with tf.Graph().as_default():
+      model = _create_model(model_name, model_tokens)
+      model.initialize()
+      accumulator = timer.Accumulator()
+      _instrument_model(model, accumulator)
+      with tf.Session() as sess:
+        sess.run(tf.global_variables_initializer())
+        for benchmark in (_benchmark_training, _benchmark_inference):
+          result = benchmark(
+              model_name, model, sess, serialized_protos, accumulator
+          )
+          results.append(result)
+          logging.info('Result: %r', result)
+
+  output = {
+      # On Linux, ru_maxrss is in kilobytes.
+      'peak_rss_kib': resource.getrusage(resource.RUSAGE_SELF).ru_maxrss,
+      'results': results,
+  }
+  output_json = json.dumps(output, indent=2)
+  if _OUTPUT_JSON.value:
+    with tf.io.gfile.GFile(_OUTPUT_JSON.value, 'w') as f:
+      f.write(output_json)
+  else:
+    print(output_json)
+
+
+if __name__ == '__main__':
+  app.run(main)
@@ -0,0 +1,224 @@
+# Copyright 2023 Google Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#    http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+"""A cache of the predictions of Gematria models.
+
+Clients that query a model, e.g. compiler passes, often ask for predictions for
+the same basic blocks over and over. The prediction of a model for a basic block
+depends only on the canonicalized instructions of the block and on the model, so
+the predictions can be cached and reused.
+
+The cache keys combine a model key, which identifies the model, its tasks, its
+vocabulary and its version (e.g. its checkpoint), and the canonicalized
+instructions of the basic block. The cache has two levels: an in-memory LRU
+cache of a fixed size, and an optional persistent store in an SQLite database
+that can be shared across runs and copied across machines.
+
+Typical use:
+  cache = prediction_cache.PredictionCache(
+      prediction_cache.model_cache_key(model, checkpoint_file),
+      max_memory_entries=100000,
+      store_filename='/tmp/predictions.db',
+  )
+  with cache:
+    output_protos = inference.predict_for_protos(
+        model, sess, input_protos, prediction_cache=cache
+    )
+"""
+
+import collections
+from collections.abc import Sequence
+import hashlib
+import sqlite3
+from typing import Optional
+
+from gematria.model.python import model_base
+from gematria.proto import basic_block_pb2
+from gematria.proto import throughput_pb2
+
+# The version of the format of the cache entries. Changing the version
+# invalidates all entries in the persistent stores.
+_CACHE_FORMAT_VERSION = 1
+
+
+def model_cache_key(model: model_base.ModelBase, model_version: str) -> str:
+  """Returns a key that identifies the predictions of `model`.
+
+  The key is derived from the name of the model, the names of its tasks, its
+  token vocabulary (for models that have one), and `model_version`.
+
+  Args:
+    model: The model for which the key is computed.
+    model_version: A string that identifies the weights of the model, e.g. the
+      name of the checkpoint file.
+
+  Returns:
+    The key of the model as a hex string.
+  """
+  hasher = hashlib.sha256()
+
+  def add(value: str) -> None:
+    encoded = value.encode('utf-8')
+    hasher.update(len(encoded).to_bytes(8, 'little'))
+    hasher.update(encoded)
+
+  add(f'v{_CACHE_FORMAT_VERSION}')
+  add(model.model_name)
+  add(model_version)
+  for task_index in range(model.num_tasks):
+    add(model.get_source_name(task_index))
+  token_list = getattr(model, 'token_list', None)
+  if token_list is not None:
+    add('\0'.join(token_list))
+  return hasher.hexdigest()
+
+
+def block_cache_key(
+    model_key: str, block: basic_block_pb2.BasicBlockProto
+) -> bytes:
+  """Returns the cache key of `block` for the model identified by `model_key`.
+
+  The key depends only on the canonicalized instructions of the basic block;
+  machine code, assembly and addresses of the instructions are ignored.
+
+  Args:
+    model_key: The key of the model, see model_cache_key().
+    block: The basic block for which the key is computed.
+
+  Returns:
+    The cache key as a SHA-256 digest.
+  """
+  hasher = hashlib.sha256(model_key.encode('utf-8'))
+  for instruction in block.canonicalized_instructions:
+    serialized = instruction.SerializeToString(deterministic=True)
+    hasher.update(len(serialized).to_bytes(8, 'little'))
+    hasher.update(serialized)
+  return hasher.digest()
+
+
+class PredictionCache:
+  """A two-level cache of predictions of a single model.
+
+  The values in the cache are the inverse throughputs predicted by the model
+  for a basic block, one ThroughputWithSourceProto per task of the model. The
+  cache is not thread-safe.
+  """
+
+  def __init__(
+      self,
+      model_key: str,
+      max_memory_entries: int = 100000,
+      store_filename: Optional[str] = None,
+  ):
+    """Initializes the cache.
+
+    Args:
+      model_key: The key of the model; see model_cache_key().
+      max_memory_entries: The maximal number of entries in the in-memory LRU
+        cache.
+      store_filename: The name of the SQLite database used as the persistent
+        store. The database is created when it does not exist. When None, the
+        cache uses only the in-memory level.
+
+    Raises:
+      ValueError: When max_memory_entries is not positive.
+    """
+    if max_memory_entries <= 0:
+      raise ValueError('max_memory_entries must be positive.')
+    self._model_key = model_key
+    self._max_memory_entries = max_memory_entries
+    self._memory: collections.OrderedDict[
+        bytes, Sequence[throughput_pb2.ThroughputWithSourceProto]
+    ] = collections.OrderedDict()
+    self._store: Optional[sqlite3.Connection] = None
+    if store_filename is not None:
+      self._store = sqlite3.connect(store_filename)
+      self._store.execute(
+          'CREATE TABLE IF NOT EXISTS predictions ('
+          'key BLOB PRIMARY KEY, value BLOB NOT NULL)'
+      )
+    self.num_hits = 0
+    self.num_misses = 0
+
+  def __enter__(self) -> 'PredictionCache':
+    return self
+
+  def __exit__(self, exc_type, exc_value, traceback) -> None:
+    self.close()
+
+  def __len__(self) -> int:
+    """Returns the number of entries in the in-memory level of the cache."""
+    return len(self._memory)
+
+  @property
+  def model_key(self) -> str:
+    return self._model_key
+
+  def close(self) -> None:
+    """Commits the pending changes to the persistent store and closes it."""
+    if self._store is not None:
+      self._store.commit()
+      self._store.close()
+      self._store = None
+
+  def lookup(
+      self, block: basic_block_pb2.BasicBlockProto
+  ) -> Optional[Sequence[throughput_pb2.ThroughputWithSourceProto]]:
+    """Returns the cached predictions for `block`, or None on a cache miss."""
+    key = block_cache_key(self._model_key, block)
+    predictions = self._memory.get(key)
+    if predictions is not None:
+      self._memory.move_to_end(key)
+      self.num_hits += 1
+      return predictions
+    if self._store is not None:
+      row = self._store.execute(
+          'SELECT value FROM predictions WHERE key = ?', (key,)
+      ).fetchone()
+      if row is not None:
+        value = throughput_pb2.BasicBlockWithThroughputProto.FromString(row[0])
+        predictions = tuple(value.inverse_throughputs)
+        self._add_to_memory(key, predictions)
+        self.num_hits += 1
+        return predictions
+    self.num_misses += 1
+    return None
+
+  def insert(
+      self,
+      block: basic_block_pb2.BasicBlockProto,
+      predictions: Sequence[throughput_pb2.ThroughputWithSourceProto],
+  ) -> None:
+    """Stores the predictions of the model for `block` in the cache."""
+    key = block_cache_key(self._model_key, block)
+    # Copy the predictions, so that the cached values are not affected by later
+    # changes of the protos of the caller.
+    value = throughput_pb2.BasicBlockWithThroughputProto(
+        inverse_throughputs=predictions
+    )
+    self._add_to_memory(key, tuple(value.inverse_throughputs))
+    if self._store is not None:
+      self._store.execute(
+          'INSERT OR REPLACE INTO predictions (key, value) VALUES (?, ?)',
+          (key, value.SerializeToString()),
+      )
+
+  def _add_to_memory(
+      self,
+      key: bytes,
+      predictions: Sequence[throughput_pb2.ThroughputWithSourceProto],
+  ) -> None:
+    self._memory[key] = predictions
+    self._memory.move_to_end(key)
+    while len(self._memory) > self._max_memory_entries:
+      self._memory.popitem(last=False)
@@ -0,0 +1,168 @@
+# Copyright 2023 Google Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#    http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+import os
+
+from absl.testing import absltest
+from gematria.model.python import prediction_cache
+from gematria.proto import throughput_pb2
+from gematria.testing.python import basic_blocks_with_throughput
+
+
+class FakeModel:
+  """Provides the attributes of a model used by model_cache_key()."""
+
+  def __init__(self, model_name, task_list, token_list=None):
+    self.model_name = model_name
+    self.task_list = task_list
+    self.num_tasks = len(task_list)
+    if token_list is not None:
+      self.token_list = token_list
+
+  def get_source_name(self, task_index):
+    return f'{self.model_name}, task={self.task_list[task_index]}'
+
+
+def _predictions(*values):
+  return tuple(
+      throughput_pb2.ThroughputWithSourceProto(
+          source=f'task_{i}', inverse_throughput_cycles=(value,)
+      )
+      for i, value in enumerate(values)
+  )
+
+
+class ModelCacheKeyTest(absltest.TestCase):
+
+  def test_key_is_deterministic(self):
+    model = FakeModel('model', ('default',), ('ADD', 'RAX'))
+    self.assertEqual(
+        prediction_cache.model_cache_key(model, 'v1'),
+        prediction_cache.model_cache_key(model, 'v1'),
+    )
+
+  def test_key_depends_on_model(self):
+    model = FakeModel('model', ('default',), ('ADD', 'RAX'))
+    key = prediction_cache.model_cache_key(model, 'v1')
+    self.assertNotEqual(key, prediction_cache.model_cache_key(model, 'v2'))
+    self.assertNotEqual(
+        key,
+        prediction_cache.model_cache_key(
+            FakeModel('model', ('default',), ('ADD', 'RBX')), 'v1'
+        ),
+    )
+    self.assertNotEqual(
+        key,
+        prediction_cache.model_cache_key(
+            FakeModel('model', ('task_1', 'task_2'), ('ADD', 'RAX')), 'v1'
+        ),
+    )
+    self.assertNotEqual(
+        key,
+        prediction_cache.model_cache_key(
+            FakeModel('other_model', ('default',), ('ADD', 'RAX')), 'v1'
+        ),
+    )
+
+
+class PredictionCacheTest(
+    basic_blocks_with_throughput.TestCase, absltest.TestCase
+):
+  num_blocks = 4
+
+  def test_lookup_and_insert(self):
+    cache = prediction_cache.PredictionCache('model')
+    block = self.block_protos[0].basic_block
+    self.assertIsNone(cache.lookup(block))
+    cache.insert(block, _predictions(1.0, 2.0))
+    self.assertSequenceEqual(cache.lookup(block), _predictions(1.0, 2.0))
+    self.assertIsNone(cache.lookup(self.block_protos[1].basic_block))
+    self.assertEqual(cache.num_hits, 1)
+    self.assertEqual(cache.num_misses, 2)
+
+  def test_key_ignores_machine_code_and_addresses(self):
+    cache = prediction_cache.PredictionCache('model')
+    block = self.block_protos[0].basic_block
+    cache.insert(block, _predictions(3.0))
+    relocated_block = type(block)()
+    relocated_block.CopyFrom(block)
+    relocated_block.ClearField('machine_instructions')
+    self.assertSequenceEqual(cache.lookup(relocated_block), _predictions(3.0))
+
+  def test_model_key_separates_entries(self):
+    cache = prediction_cache.PredictionCache('model_1')
+    other_cache = prediction_cache.PredictionCache('model_2')
+    block = self.block_protos[0].basic_block
+    cache.insert(block, _predictions(1.0))
+    self.assertNotEqual(
+        prediction_cache.block_cache_key('model_1', block),
+        prediction_cache.block_cache_key('model_2', block),
+    )
+    self.assertIsNone(other_cache.lookup(block))
+
+  def test_lru_eviction(self):
+    cache = prediction_cache.PredictionCache('model', max_memory_entries=2)
+    blocks = [proto.basic_block for proto in self.block_protos[:3]]
+    cache.insert(blocks[0], _predictions(0.0))
+    cache.insert(blocks[1], _predictions(1.0))
+    # Make blocks[0] the most recently used entry, so that blocks[1] is evicted
+    # when blocks[2] is inserted.
+    self.assertIsNotNone(cache.lookup(blocks[0]))
+    cache.insert(blocks[2], _predictions(2.0))
+    self.assertLen(cache, 2)
+    self.assertIsNotNone(cache.lookup(blocks[0]))
+    self.assertIsNone(cache.lookup(blocks[1]))
+    self.assertIsNotNone(cache.lookup(blocks[2]))
+
+  def test_cached_predictions_are_copies(self):
+    cache = prediction_cache.PredictionCache('model')
+    block = self.block_protos[0].basic_block
+    predictions = _predictions(1.0)
+    cache.insert(block, predictions)
+    predictions[0].inverse_throughput_cycles[0] = 5.0
+    self.assertSequenceEqual(cache.lookup(block), _predictions(1.0))
+
+  def test_persistent_store(self):
+    store_filename = os.path.join(
+        self.create_tempdir().full_path, 'predictions.db'
+    )
+    blocks = [proto.basic_block for proto in self.block_protos[:2]]
+    with prediction_cache.PredictionCache(
+        'model', store_filename=store_filename
+    ) as cache:
+      cache.insert(blocks[0], _predictions(1.0, 2.0))
+
+    with prediction_cache.PredictionCache(
+        'model', store_filename=store_filename
+    ) as cache:
+      self.assertLen(cache, 0)
+      self.assertSequenceEqual(
+          cache.lookup(blocks[0]), _predictions(1.0, 2.0)
+      )
+      self.assertIsNone(cache.lookup(blocks[1]))
+      # The entry from the persistent store is now in the in-memory cache.
+      self.assertLen(cache, 1)
+
+    with prediction_cache.PredictionCache(
+        'other_model', store_filename=store_filename
+    ) as cache:
+      self.assertIsNone(cache.lookup(blocks[0]))
+
+  def test_invalid_max_memory_entries(self):
+    with self.assertRaises(ValueError):
+      prediction_cache.PredictionCache('model', max_memory_entries=0)
+
+
+if __name__ == '__main__':
+  absltest.main()
@@ -0,0 +1,616 @@
+# Copyright 2023 Google Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#    http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+"""Bounded-memory evaluation of model predictions on a stream of basic blocks.
+
+The evaluation in model_base.ModelBase needs all expected and predicted values
+in memory to compute the error statistics. This module computes the same kind of
+statistics in a single pass over a stream of basic blocks, using memory that
+does not depend on the size of the dataset:
+  * the mean absolute and squared errors are computed from running moments,
+  * the percentiles of the absolute and relative errors are computed from
+    quantile sketches with a bounded relative error,
+  * the rank correlation between the expected and predicted values is computed
+    from a fixed-size uniform sample of the stream.
+
+All accumulators can be merged, and the evaluation of a large dataset can be
+split across shards that are evaluated independently and merged at the end.
+
+Typical use:
+  evaluator = streaming_evaluation.StreamingEvaluator(
+      num_tasks=model.num_tasks, percentile_ranks=(50, 90, 99)
+  )
+  output_protos = inference.predict_for_protos(model, sess, input_protos)
+  tfrecord.write_protos(
+      output_file, evaluator.evaluate_protos(output_protos)
+  )
+  results = evaluator.results()
+"""
+
+from collections.abc import Iterable, Iterator, Sequence
+import dataclasses
+import math
+import random
+import re
+from typing import Optional
+
+from gematria.proto import throughput_pb2
+
+
+class RunningMoments:
+  """Computes the mean and the variance of a stream of values.
+
+  Uses the Welford's algorithm for adding values, and the parallel algorithm by
+  Chan et al. for merging the moments of two streams.
+  """
+
+  def __init__(self):
+    self.count = 0
+    self.mean = 0.0
+    self._m2 = 0.0
+
+  def add(self, value: float) -> None:
+    self.count += 1
+    delta = value - self.mean
+    self.mean += delta / self.count
+    self._m2 += delta * (value - self.mean)
+
+  def merge(self, other: 'RunningMoments') -> None:
+    """Merges the moments of `other` into this object."""
+    if other.count == 0:
+      return
+    count = self.count + other.count
+    delta = other.mean - self.mean
+    self.mean += delta * other.count / count
+    self._m2 += other._m2 + delta * delta * self.count * other.count / count
+    self.count = count
+
+  @property
+  def variance(self) -> float:
+    """Returns the population variance of the values, or 0 when empty."""
+    if self.count == 0:
+      return 0.0
+    return self._m2 / self.count
+
+
+class QuantileSketch:
+  """A mergeable quantile sketch of non-negative values.
+
+  The sketch keeps a histogram with logarithmically sized buckets, so that any
+  value in a bucket is within `relative_accuracy` of the value that represents
+  the bucket. For a stream of non-negative values, the quantiles returned by the
+  sketch are within `relative_accuracy` of the exact quantiles of the stream.
+  Values that are too small to be indexed are counted in a separate "zero"
+  bucket.
+
+  The number of buckets is proportional to the logarithm of the range of the
+  values, e.g. with the default relative accuracy of 1%, values between 1e-6
+  and 1e6 fit into about 1400 buckets. When there are more than
+  `max_num_buckets` buckets, the lowest buckets are collapsed, i.e. the sketch
+  loses accuracy only for the lowest quantiles.
+  """
+
+  # Values below this threshold are counted as zero.
+  _MIN_INDEXABLE_VALUE = 1e-9
+
+  def __init__(
+      self, relative_accuracy: float = 0.01, max_num_buckets: int = 2048
+  ):
+    """Initializes an empty sketch.
+
+    Args:
+      relative_accuracy: The relative accuracy of the quantiles. Must be
+        between 0 and 1, exclusive.
+      max_num_buckets: The maximal number of buckets of the histogram.
+
+    Raises:
+      ValueError: When the relative accuracy or the number of buckets are out
+        of range.
+    """
+    if not 0 < relative_accuracy < 1:
+      raise ValueError(
+          f'Relative accuracy must be in (0, 1), was {relative_accuracy}'
+      )
+    if max_num_buckets < 1:
+      raise ValueError(
+          f'The number of buckets must be positive, was {max_num_buckets}'
+      )
+    self._relative_accuracy = relative_accuracy
+    self._max_num_buckets = max_num_buckets
+    self._gamma = (1 + relative_accuracy) / (1 - relative_accuracy)
+    self._log_gamma = math.log(self._gamma)
+    self._buckets: dict[int, int] = {}
+    self._zero_count = 0
+    self.count = 0
+
+  def add(self, value: float) -> None:
+    """Adds a value to the sketch.
+
+    Args:
+      value: The value. Must be non-negative.
+
+    Raises:
+      ValueError: When the value is negative.
+    """
+    if value < 0:
+      raise ValueError(f'The sketch supports only non-negative values: {value}')
+    self.count += 1
+    if value < self._MIN_INDEXABLE_VALUE:
+      self._zero_count += 1
+      return
+    index = math.ceil(math.log(value) / self._log_gamma)
+    self._buckets[index] = self._buckets.get(index, 0) + 1
+    self._collapse_buckets()
+
+  def merge(self, other: 'QuantileSketch') -> None:
+    """Merges the values from `other` into this sketch.
+
+    Args:
+      other: The merged sketch. Must use the same relative accuracy.
+
+    Raises:
+      ValueError: When the sketches use a different relative accuracy.
+    """
+    if other._relative_accuracy != self._relative_accuracy:
+      raise ValueError(
+          'Can merge only sketches with the same relative accuracy, got'
+          f' {self._relative_accuracy} and {other._relative_accuracy}'
+      )
+    self.count += other.count
+    self._zero_count += other._zero_count
+    for index, bucket_count in other._buckets.items():
+      self._buckets[index] = self._buckets.get(index, 0) + bucket_count
+    self._collapse_buckets()
+
+  def quantile(self, rank: float) -> float:
+    """Returns an approximation of the quantile at `rank`.
+
+    Args:
+      rank: The rank of the quantile, between 0 and 1, inclusive.
+
+    Returns:
+      The approximate quantile, or NaN when the sketch is empty.
+
+    Raises:
+      ValueError: When the rank is out of range.
+    """
+    if not 0 <= rank <= 1:
+      raise ValueError(f'The rank must be in [0, 1], was {rank}')
+    if self.count == 0:
+      return math.nan
+    # Use the same definition as the "lower" interpolation of numpy.percentile:
+    # the quantile at `rank` is the value at the given position in the sorted
+    # list of values.
+    position = math.floor(rank * (self.count - 1))
+    seen = self._zero_count
+    if position < seen:
+      return 0.0
+    for index in sorted(self._buckets):
+      seen += self._buckets[index]
+      if position < seen:
+        return 2 * self._gamma**index / (self._gamma + 1)
+    raise AssertionError('The bucket counts do not match the total count')
+
+  def _collapse_buckets(self) -> None:
+    if len(self._buckets) <= self._max_num_buckets:
+      return
+    indices = sorted(self._buckets)
+    num_collapsed = len(indices) - self._max_num_buckets
+    target = indices[num_collapsed]
+    for index in indices[:num_collapsed]:
+      self._buckets[target] += self._buckets.pop(index)
+
+
+class ReservoirSample:
+  """A fixed-size uniform sample of a stream of items.
+
+  Uses the reservoir sampling algorithm R. Samples of two streams can be merged
+  into a uniform sample of the concatenation of the streams.
+  """
+
+  def __init__(self, capacity: int, seed: Optional[int] = 0):
+    """Initializes an empty sample.
+
+    Args:
+      capacity: The maximal number of items in the sample.
+      seed: The seed of the random number generator. When None, the generator
+        is seeded from the system randomness source.
+
+    Raises:
+      ValueError: When the capacity is not positive.
+    """
+    if capacity < 1:
+      raise ValueError(f'The capacity must be positive, was {capacity}')
+    self._capacity = capacity
+    self._random = random.Random(seed)
+    self.items = []
+    self.num_seen = 0
+
+  def add(self, item) -> None:
+    self.num_seen += 1
+    if len(self.items) < self._capacity:
+      self.items.append(item)
+      return
+    index = self._random.randrange(self.num_seen)
+    if index < self._capacity:
+      self.items[index] = item
+
+  def merge(self, other: 'ReservoirSample') -> None:
+    """Merges the sample from `other` into this sample.
+
+    Each item of the merged sample is taken from one of the two samples, with
+    the probability proportional to the number of items that were not taken yet
+    from the corresponding stream.
+    """
+    if other.num_seen == 0:
+      return
+    own_items = list(self.items)
+    other_items = list(other.items)
+    self._random.shuffle(own_items)
+    self._random.shuffle(other_items)
+    own_remaining = self.num_seen
+    other_remaining = other.num_seen
+    num_items = min(self._capacity, len(own_items) + len(other_items))
+    merged = []
+    while len(merged) < num_items:
+      take_own = bool(own_items) and (
+          not other_items
+          or self._random.randrange(own_remaining + other_remaining)
+          < own_remaining
+      )
+      if take_own:
+        merged.append(own_items.pop())
+        own_remaining -= 1
+      else:
+        merged.append(other_items.pop())
+        other_remaining -= 1
+    self.items = merged
+    self.num_seen += other.num_seen
+
+
+def _ranks(values: Sequence[float]) -> list[float]:
+  """Returns the ranks of `values`; tied values get their average rank."""
+  order = sorted(range(len(values)), key=values.__getitem__)
+  ranks = [0.0] * len(values)
+  start = 0
+  while start < len(order):
+    end = start + 1
+    while end < len(order) and values[order[end]] == values[order[start]]:
+      end += 1
+    average_rank = (start + end - 1) / 2
+    for i in range(start, end):
+      ranks[order[i]] = average_rank
+    start = end
+  return ranks
+
+
+def spearman_correlation(
+    xs: Sequence[float], ys: Sequence[float]
+) -> Optional[float]:
+  """Computes the Spearman rank correlation coefficient of two sequences.
+
+  Args:
+    xs: The first sequence.
+    ys: The second sequence. Must have the same length as `xs`.
+
+  Returns:
+    The correlation coefficient, or None when it is not defined, i.e. when there
+    are fewer than two values or when one of the sequences is constant.
+
+  Raises:
+    ValueError: When the sequences have a different length.
+  """
+  if len(xs) != len(ys):
+    raise ValueError(
+        f'The sequences have a different length: {len(xs)} and {len(ys)}'
+    )
+  if len(xs) < 2:
+    return None
+  x_ranks = _ranks(xs)
+  y_ranks = _ranks(ys)
+  mean_rank = (len(xs) - 1) / 2
+  covariance = 0.0
+  x_variance = 0.0
+  y_variance = 0.0
+  for x_rank, y_rank in zip(x_ranks, y_ranks):
+    covariance += (x_rank - mean_rank) * (y_rank - mean_rank)
+    x_variance += (x_rank - mean_rank) ** 2
+    y_variance += (y_rank - mean_rank) ** 2
+  if x_variance == 0 or y_variance == 0:
+    return None
+  return covariance / math.sqrt(x_variance * y_variance)
+
+
+@dataclasses.dataclass(frozen=True)
+class TaskEvaluationResult:
+  """The error statistics of the predictions for one task.
+
+  Attributes:
+    num_blocks: The number of basic blocks with both an expected and a predicted
+      value for the task.
+    mean_absolute_error: The mean absolute error of the predictions.
+    mean_squared_error: The mean squared error of the predictions.
+    root_mean_squared_error: The square root of `mean_squared_error`.
+    mean_absolute_percentage_error: The mean relative error of the predictions.
+      Basic blocks with the expected value zero are not included.
+    absolute_error_percentiles: The approximate percentiles of the absolute
+      error, keyed by the percentile rank.
+    absolute_percentage_error_percentiles: The approximate percentiles of the
+      relative error, keyed by the percentile rank.
+    spearman_correlation: The Spearman rank correlation between the expected
+      and predicted values, computed from a uniform sample of the basic blocks.
+      None when it is not defined.
+    num_sampled_blocks: The number of basic blocks used to compute
+      `spearman_correlation`.
+  """
+
+  num_blocks: int
+  mean_absolute_error: float
+  mean_squared_error: float
+  root_mean_squared_error: float
+  mean_absolute_percentage_error: float
+  absolute_error_percentiles: dict[int, float]
+  absolute_percentage_error_percentiles: dict[int, float]
+  spearman_correlation: Optional[float]
+  num_sampled_blocks: int
+
+
+class _TaskAccumulator:
+  """Accumulates the error statistics for a single task."""
+
+  def __init__(
+      self, relative_accuracy: float, reservoir_size: int, seed: Optional[int]
+  ):
+    self.absolute_error = RunningMoments()
+    self.squared_error = RunningMoments()
+    self.absolute_percentage_error = RunningMoments()
+    self.absolute_error_sketch = QuantileSketch(relative_accuracy)
+    self.absolute_percentage_error_sketch = QuantileSketch(relative_accuracy)
+    self.sample = ReservoirSample(reservoir_size, seed)
+
+  def add(self, expected: float, predicted: float) -> None:
+    error = abs(predicted - expected)
+    self.absolute_error.add(error)
+    self.squared_error.add(error * error)
+    self.absolute_error_sketch.add(error)
+    if expected != 0:
+      relative_error = error / abs(expected)
+      self.absolute_percentage_error.add(relative_error)
+      self.absolute_percentage_error_sketch.add(relative_error)
+    self.sample.add((expected, predicted))
+
+  def merge(self, other: '_TaskAccumulator') -> None:
+    self.absolute_error.merge(other.absolute_error)
+    self.squared_error.merge(other.squared_error)
+    self.absolute_percentage_error.merge(other.absolute_percentage_error)
+    self.absolute_error_sketch.merge(other.absolute_error_sketch)
+    self.absolute_percentage_error_sketch.merge(
+        other.absolute_percentage_error_sketch
+    )
+    self.sample.merge(other.sample)
+
+  def result(self, percentile_ranks: Sequence[int]) -> TaskEvaluationResult:
+    expected = [item[0] for item in self.sample.items]
+    predicted = [item[1] for item in self.sample.items]
+    num_blocks = self.absolute_error.count
+    mean_squared_error = self.squared_error.mean if num_blocks else math.nan
+    return TaskEvaluationResult(
+        num_blocks=num_blocks,
+        mean_absolute_error=(
+            self.absolute_error.mean if num_blocks else math.nan
+        ),
+        mean_squared_error=mean_squared_error,
+        root_mean_squared_error=math.sqrt(mean_squared_error),
+        mean_absolute_percentage_error=(
+            self.absolute_percentage_error.mean
+            if self.absolute_percentage_error.count
+            else math.nan
+        ),
+        absolute_error_percentiles={
+            rank: self.absolute_error_sketch.quantile(rank / 100)
+            for rank in percentile_ranks
+        },
+        absolute_percentage_error_percentiles={
+            rank: self.absolute_percentage_error_sketch.quantile(rank / 100)
+            for rank in percentile_ranks
+        },
+        spearman_correlation=spearman_correlation(expected, predicted),
+        num_sampled_blocks=len(expected),
+    )
+
+
+class StreamingEvaluator:
+  """Computes error statistics of predictions in a single pass over the data.
+
+  The evaluator accepts pairs of expected and predicted values for each basic
+  block, either directly through add(), or extracted from the output of
+  inference.predict_for_protos() through add_proto() and evaluate_protos().
+  The memory used by the evaluator is bounded by the number of tasks, the size
+  of the reservoir sample, and the number of buckets of the quantile sketches;
+  it does not depend on the number of basic blocks.
+
+  The evaluator can be pickled, and evaluators of different shards of a dataset
+  can be combined with merge().
+  """
+
+  def __init__(
+      self,
+      num_tasks: int,
+      percentile_ranks: Sequence[int] = (50, 90, 95, 99),
+      relative_accuracy: float = 0.01,
+      reservoir_size: int = 10000,
+      expected_source_filters: Optional[Sequence[str]] = None,
+      seed: Optional[int] = 0,
+  ):
+    """Initializes the evaluator.
+
+    Args:
+      num_tasks: The number of tasks of the evaluated model.
+      percentile_ranks: The ranks of the percentiles of the errors included in
+        the results. Each rank must be between 0 and 100, inclusive.
+      relative_accuracy: The relative accuracy of the percentiles.
+      reservoir_size: The number of basic blocks sampled for computing the rank
+        correlation.
+      expected_source_filters: An optional list of regular expressions, one for
+        each task. When specified, add_proto() uses the first throughput whose
+        source matches the filter of the task as the expected value for the
+        task. Otherwise, add_proto() uses the throughput at the index of the
+        task.
+      seed: The seed of the random number generator used for sampling.
+
+    Raises:
+      ValueError: When the arguments are not consistent.
+    """
+    if num_tasks < 1:
+      raise ValueError(f'The number of tasks must be positive, was {num_tasks}')
+    for rank in percentile_ranks:
+      if not 0 <= rank <= 100:
+        raise ValueError(f'Percentile rank must be in [0, 100], was {rank}')
+    if (
+        expected_source_filters is not None
+        and len(expected_source_filters) != num_tasks
+    ):
+      raise ValueError(
+          'The number of source filters must be the same as the number of'
+          f' tasks. Got {len(expected_source_filters)} filters and'
+          f' {num_tasks} tasks.'
+      )
+    self._num_tasks = num_tasks
+    self._percentile_ranks = tuple(percentile_ranks)
+    self._expected_source_filters = None
+    if expected_source_filters is not None:
+      self._expected_source_filters = tuple(
+          re.compile(source_filter) for source_filter in expected_source_filters
+      )
+    self._tasks = tuple(
+        _TaskAccumulator(relative_accuracy, reservoir_size, seed)
+        for _ in range(num_tasks)
+    )
+    self.num_skipped_blocks = 0
+
+  @property
+  def num_tasks(self) -> int:
+    return self._num_tasks
+
+  def add(
+      self,
+      expected: Sequence[Optional[float]],
+      predicted: Sequence[Optional[float]],
+  ) -> None:
+    """Adds the expected and predicted values for one basic block.
+
+    Args:
+      expected: The expected values, one for each task. Tasks where the value is
+        None are skipped.
+      predicted: The predicted values, one for each task. Tasks where the value
+        is None are skipped.
+
+    Raises:
+      ValueError: When the number of values does not match the number of tasks.
+    """
+    if len(expected) != self._num_tasks or len(predicted) != self._num_tasks:
+      raise ValueError(
+          f'Expected {self._num_tasks} values, got {len(expected)} expected'
+          f' and {len(predicted)} predicted values.'
+      )
+    for task, expected_value, predicted_value in zip(
+        self._tasks, expected, predicted
+    ):
+      if expected_value is None or predicted_value is None:
+        continue
+      task.add(expected_value, predicted_value)
+
+  def add_proto(
+      self, proto: throughput_pb2.BasicBlockWithThroughputProto
+  ) -> bool:
+    """Adds the values from a basic block processed by predict_for_protos().
+
+    The predictions are the last `num_tasks` throughputs of the proto, and the
+    expected values are taken from the throughputs before them. The value of a
+    throughput is the mean of its inverse throughput cycles; throughputs without
+    any cycles are ignored.
+
+    Args:
+      proto: The basic block with the expected and predicted throughputs.
+
+    Returns:
+      True when the basic block was added; False when it did not contain enough
+      throughputs and it was skipped.
+    """
+    num_expected = len(proto.inverse_throughputs) - self._num_tasks
+    if num_expected < 1:
+      self.num_skipped_blocks += 1
+      return False
+    expected_throughputs = proto.inverse_throughputs[:num_expected]
+    predicted = [
+        _mean_cycles(throughput)
+        for throughput in proto.inverse_throughputs[num_expected:]
+    ]
+    expected = []
+    for task_index in range(self._num_tasks):
+      throughput = None
+      if self._expected_source_filters is not None:
+        source_filter = self._expected_source_filters[task_index]
+        for candidate in expected_throughputs:
+          if source_filter.match(candidate.source):
+            throughput = candidate
+            break
+      elif task_index < num_expected:
+        throughput = expected_throughputs[task_index]
+      expected.append(None if throughput is None else _mean_cycles(throughput))
+    if all(value is None for value in expected):
+      self.num_skipped_blocks += 1
+      return False
+    self.add(expected, predicted)
+    return True
+
+  def evaluate_protos(
+      self, protos: Iterable[throughput_pb2.BasicBlockWithThroughputProto]
+  ) -> Iterator[throughput_pb2.BasicBlockWithThroughputProto]:
+    """Adds all basic blocks from `protos` and yields them unchanged.
+
+    The basic blocks are processed one by one, so that the evaluation can be
+    chained with predict_for_protos() and with writing the output to a file
+    without keeping the whole dataset in memory.
+    """
+    for proto in protos:
+      self.add_proto(proto)
+      yield proto
+
+  def merge(self, other: 'StreamingEvaluator') -> None:
+    """Merges the statistics from `other` into this evaluator.
+
+    Raises:
+      ValueError: When the evaluators have a different number of tasks.
+    """
+    if other._num_tasks != self._num_tasks:
+      raise ValueError(
+          'Can merge only evaluators with the same number of tasks, got'
+          f' {self._num_tasks} and {other._num_tasks}'
+      )
+    for task, other_task in zip(self._tasks, other._tasks):
+      task.merge(other_task)
+    self.num_skipped_blocks += other.num_skipped_blocks
+
+  def results(self) -> list[TaskEvaluationResult]:
+    """Returns the error statistics for each task."""
+    return [task.result(self._percentile_ranks) for task in self._tasks]
+
+
+def _mean_cycles(
+    throughput: throughput_pb2.ThroughputWithSourceProto,
+) -> Optional[float]:
+  cycles = throughput.inverse_throughput_cycles
+  if not cycles:
+    return None
+  return sum(cycles) / len(cycles)
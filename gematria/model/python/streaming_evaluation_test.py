@@ -0,0 +1,333 @@
+# Copyright 2023 Google Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#    http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+import math
+import pickle
+import random
+
+from absl.testing import absltest
+from gematria.model.python import streaming_evaluation
+from gematria.proto import throughput_pb2
+
+
+def _throughput(source, *cycles):
+  return throughput_pb2.ThroughputWithSourceProto(
+      source=source, inverse_throughput_cycles=cycles
+  )
+
+
+def _exact_quantile(values, rank):
+  values = sorted(values)
+  return values[math.floor(rank * (len(values) - 1))]
+
+
+class RunningMomentsTest(absltest.TestCase):
+
+  def test_empty(self):
+    moments = streaming_evaluation.RunningMoments()
+    self.assertEqual(moments.count, 0)
+    self.assertEqual(moments.variance, 0)
+
+  def test_add_and_merge(self):
+    values = [1.0, 2.0, 4.0, 8.0, 16.0, 3.0, 5.0]
+    mean = sum(values) / len(values)
+    variance = sum((value - mean) ** 2 for value in values) / len(values)
+
+    moments = streaming_evaluation.RunningMoments()
+    for value in values:
+      moments.add(value)
+    self.assertEqual(moments.count, len(values))
+    self.assertAlmostEqual(moments.mean, mean)
+    self.assertAlmostEqual(moments.variance, variance)
+
+    left = streaming_evaluation.RunningMoments()
+    right = streaming_evaluation.RunningMoments()
+    for value in values[:3]:
+      left.add(value)
+    for value in values[3:]:
+      right.add(value)
+    left.merge(right)
+    self.assertEqual(left.count, len(values))
+    self.assertAlmostEqual(left.mean, mean)
+    self.assertAlmostEqual(left.variance, variance)
+
+
+class QuantileSketchTest(absltest.TestCase):
+
+  def test_empty(self):
+    sketch = streaming_evaluation.QuantileSketch()
+    self.assertTrue(math.isnan(sketch.quantile(0.5)))
+
+  def test_invalid_arguments(self):
+    with self.assertRaises(ValueError):
+      streaming_evaluation.QuantileSketch(relative_accuracy=0)
+    with self.assertRaises(ValueError):
+      streaming_evaluation.QuantileSketch(max_num_buckets=0)
+    sketch = streaming_evaluation.QuantileSketch()
+    with self.assertRaises(ValueError):
+      sketch.add(-1)
+    with self.assertRaises(ValueError):
+      sketch.quantile(1.5)
+
+  def test_relative_accuracy(self):
+    rng = random.Random(1)
+    values = [rng.lognormvariate(0, 2) for _ in range(5000)]
+    values.extend([0.0] * 100)
+    sketch = streaming_evaluation.QuantileSketch(relative_accuracy=0.01)
+    for value in values:
+      sketch.add(value)
+    self.assertEqual(sketch.count, len(values))
+    for rank in (0, 0.01, 0.1, 0.5, 0.9, 0.99, 1):
+      expected = _exact_quantile(values, rank)
+      self.assertLessEqual(
+          abs(sketch.quantile(rank) - expected), 0.01 * expected
+      )
+
+  def test_merge(self):
+    rng = random.Random(2)
+    values = [rng.uniform(0, 100) for _ in range(2000)]
+    left = streaming_evaluation.QuantileSketch()
+    right = streaming_evaluation.QuantileSketch()
+    full = streaming_evaluation.QuantileSketch()
+    for i, value in enumerate(values):
+      (left if i % 3 else right).add(value)
+      full.add(value)
+    left.merge(right)
+    self.assertEqual(left.count, full.count)
+    for rank in (0.1, 0.5, 0.9):
+      self.assertEqual(left.quantile(rank), full.quantile(rank))
+
+    with self.assertRaises(ValueError):
+      left.merge(streaming_evaluation.QuantileSketch(relative_accuracy=0.05))
+
+  def test_collapse_buckets(self):
+    sketch = streaming_evaluation.QuantileSketch(
+        relative_accuracy=0.01, max_num_buckets=10
+    )
+    values = [1.1**i for i in range(100)]
+    for value in values:
+      sketch.add(value)
+    # The highest quantiles are not affected by collapsing the lowest buckets.
+    expected = _exact_quantile(values, 0.99)
+    self.assertLessEqual(
+        abs(sketch.quantile(0.99) - expected), 0.01 * expected
+    )
+
+
+class ReservoirSampleTest(absltest.TestCase):
+
+  def test_small_stream(self):
+    sample = streaming_evaluation.ReservoirSample(10)
+    for i in range(5):
+      sample.add(i)
+    self.assertEqual(sample.num_seen, 5)
+    self.assertSequenceEqual(sample.items, range(5))
+
+  def test_large_stream(self):
+    sample = streaming_evaluation.ReservoirSample(100)
+    for i in range(10000):
+      sample.add(i)
+    self.assertEqual(sample.num_seen, 10000)
+    self.assertLen(sample.items, 100)
+    self.assertLen(set(sample.items), 100)
+    # The sample is uniform, so it should contain items from the whole stream.
+    self.assertGreater(max(sample.items), 5000)
+
+  def test_merge(self):
+    left = streaming_evaluation.ReservoirSample(100, seed=1)
+    right = streaming_evaluation.ReservoirSample(100, seed=2)
+    for i in range(9000):
+      left.add(i)
+    for i in range(9000, 10000):
+      right.add(i)
+    left.merge(right)
+    self.assertEqual(left.num_seen, 10000)
+    self.assertLen(left.items, 100)
+    self.assertLen(set(left.items), 100)
+    # About 10% of the items should come from the smaller stream.
+    num_right = sum(1 for item in left.items if item >= 9000)
+    self.assertBetween(num_right, 1, 30)
+
+
+class SpearmanCorrelationTest(absltest.TestCase):
+
+  def test_correlation(self):
+    self.assertAlmostEqual(
+        streaming_evaluation.spearman_correlation(
+            [1, 2, 3, 4], [10, 20, 30, 1000]
+        ),
+        1.0,
+    )
+    self.assertAlmostEqual(
+        streaming_evaluation.spearman_correlation([1, 2, 3, 4], [4, 3, 2, 1]),
+        -1.0,
+    )
+    # Tied values get their average rank.
+    self.assertAlmostEqual(
+        streaming_evaluation.spearman_correlation([1, 2, 2, 3], [1, 2, 3, 4]),
+        math.sqrt(0.9),
+    )
+
+  def test_undefined(self):
+    self.assertIsNone(streaming_evaluation.spearman_correlation([1], [2]))
+    self.assertIsNone(
+        streaming_evaluation.spearman_correlation([1, 1, 1], [1, 2, 3])
+    )
+    with self.assertRaises(ValueError):
+      streaming_evaluation.spearman_correlation([1, 2], [1])
+
+
+class StreamingEvaluatorTest(absltest.TestCase):
+
+  def test_invalid_arguments(self):
+    with self.assertRaises(ValueError):
+      streaming_evaluation.StreamingEvaluator(num_tasks=0)
+    with self.assertRaises(ValueError):
+      streaming_evaluation.StreamingEvaluator(
+          num_tasks=1, percentile_ranks=(101,)
+      )
+    with self.assertRaises(ValueError):
+      streaming_evaluation.StreamingEvaluator(
+          num_tasks=2, expected_source_filters=('foo',)
+      )
+    evaluator = streaming_evaluation.StreamingEvaluator(num_tasks=2)
+    with self.assertRaises(ValueError):
+      evaluator.add([1.0], [1.0, 2.0])
+
+  def test_add(self):
+    evaluator = streaming_evaluation.StreamingEvaluator(
+        num_tasks=2, percentile_ranks=(0, 100)
+    )
+    evaluator.add([1.0, 2.0], [2.0, 2.0])
+    evaluator.add([4.0, None], [2.0, 3.0])
+    evaluator.add([0.0, 1.0], [1.0, 3.0])
+
+    first, second = evaluator.results()
+    self.assertEqual(first.num_blocks, 3)
+    self.assertAlmostEqual(first.mean_absolute_error, 4 / 3)
+    self.assertAlmostEqual(first.mean_squared_error, 2.0)
+    self.assertAlmostEqual(first.root_mean_squared_error, math.sqrt(2.0))
+    # The block with expected value 0 is not included in the relative error.
+    self.assertAlmostEqual(first.mean_absolute_percentage_error, 0.75)
+    self.assertAlmostEqual(first.absolute_error_percentiles[0], 1.0, places=1)
+    self.assertAlmostEqual(first.absolute_error_percentiles[100], 2, places=1)
+    self.assertAlmostEqual(
+        first.absolute_percentage_error_percentiles[100], 1.0, places=1
+    )
+    self.assertEqual(first.num_sampled_blocks, 3)
+
+    self.assertEqual(second.num_blocks, 2)
+    self.assertAlmostEqual(second.mean_absolute_error, 1.0)
+    self.assertAlmostEqual(second.mean_absolute_percentage_error, 1.0)
+    self.assertAlmostEqual(second.spearman_correlation, -1.0)
+
+  def test_empty_results(self):
+    evaluator = streaming_evaluation.StreamingEvaluator(num_tasks=1)
+    (result,) = evaluator.results()
+    self.assertEqual(result.num_blocks, 0)
+    self.assertTrue(math.isnan(result.mean_absolute_error))
+    self.assertIsNone(result.spearman_correlation)
+
+  def test_evaluate_protos(self):
+    protos = [
+        throughput_pb2.BasicBlockWithThroughputProto(
+            inverse_throughputs=(
+                _throughput('hsw', 1.0, 3.0),
+                _throughput('skl', 4.0),
+                _throughput('model, task=hsw', 3.0),
+                _throughput('model, task=skl', 4.0),
+            )
+        ),
+        throughput_pb2.BasicBlockWithThroughputProto(
+            inverse_throughputs=(
+                _throughput('skl', 10.0),
+                _throughput('model, task=hsw', 3.0),
+                _throughput('model, task=skl', 5.0),
+            )
+        ),
+        # The basic block was not processed by the model.
+        throughput_pb2.BasicBlockWithThroughputProto(
+            inverse_throughputs=(_throughput('hsw', 1.0),)
+        ),
+    ]
+    evaluator = streaming_evaluation.StreamingEvaluator(
+        num_tasks=2, expected_source_filters=('hsw', 'skl')
+    )
+    output_protos = list(evaluator.evaluate_protos(protos))
+    self.assertSequenceEqual(output_protos, protos)
+    self.assertEqual(evaluator.num_skipped_blocks, 1)
+
+    hsw, skl = evaluator.results()
+    self.assertEqual(hsw.num_blocks, 1)
+    self.assertAlmostEqual(hsw.mean_absolute_error, 1.0)
+    self.assertEqual(skl.num_blocks, 2)
+    self.assertAlmostEqual(skl.mean_absolute_error, 2.5)
+    self.assertAlmostEqual(skl.mean_absolute_percentage_error, 0.25)
+
+  def test_add_proto_by_index(self):
+    evaluator = streaming_evaluation.StreamingEvaluator(num_tasks=1)
+    self.assertTrue(
+        evaluator.add_proto(
+            throughput_pb2.BasicBlockWithThroughputProto(
+                inverse_throughputs=(
+                    _throughput('hsw', 2.0),
+                    _throughput('skl', 100.0),
+                    _throughput('model', 3.0),
+                )
+            )
+        )
+    )
+    (result,) = evaluator.results()
+    self.assertAlmostEqual(result.mean_absolute_error, 1.0)
+
+  def test_merge_and_pickle(self):
+    rng = random.Random(3)
+    pairs = [(rng.uniform(1, 10), rng.uniform(1, 10)) for _ in range(1000)]
+    full = streaming_evaluation.StreamingEvaluator(num_tasks=1)
+    shards = [
+        streaming_evaluation.StreamingEvaluator(num_tasks=1, seed=i)
+        for i in range(4)
+    ]
+    for i, (expected, predicted) in enumerate(pairs):
+      full.add([expected], [predicted])
+      shards[i % len(shards)].add([expected], [predicted])
+
+    merged = pickle.loads(pickle.dumps(shards[0]))
+    for shard in shards[1:]:
+      merged.merge(pickle.loads(pickle.dumps(shard)))
+
+    (expected_result,) = full.results()
+    (merged_result,) = merged.results()
+    self.assertEqual(merged_result.num_blocks, expected_result.num_blocks)
+    self.assertAlmostEqual(
+        merged_result.mean_absolute_error, expected_result.mean_absolute_error
+    )
+    self.assertAlmostEqual(
+        merged_result.mean_squared_error, expected_result.mean_squared_error
+    )
+    self.assertEqual(
+        merged_result.absolute_error_percentiles,
+        expected_result.absolute_error_percentiles,
+    )
+    self.assertAlmostEqual(
+        merged_result.spearman_correlation,
+        expected_result.spearman_correlation,
+    )
+
+    with self.assertRaises(ValueError):
+      merged.merge(streaming_evaluation.StreamingEvaluator(num_tasks=2))
+
+
+if __name__ == '__main__':
+  absltest.main()
@@ -0,0 +1,217 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "gematria/model/throughput_table.h"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/status/statusor.h"
+#include "gematria/basic_block/lazy_basic_block.h"
+#include "pybind11/numpy.h"
+#include "pybind11/pybind11.h"
+#include "pybind11/stl.h"
+#include "pybind11_abseil/status_casters.h"
+
+namespace gematria {
+namespace {
+
+namespace py = ::pybind11;
+
+constexpr const char* const kModuleDocstring =
+    R"(A compact table of basic blocks with inverse throughputs.
+
+See the comments in the C++ version of the class for more details. The table
+replaces the conversion of BasicBlockWithThroughputProto records to
+BasicBlockWithThroughput objects, and ModelBase.schedule_batch() accepts it in
+place of a list of basic blocks with throughput.)";
+
+// Returns `data` as a NumPy array of the given shape. The array takes ownership
+// of the data, so that no copy is needed.
+template <typename T>
+py::array MoveToNumpyArray(std::vector<T> data, py::ssize_t num_rows,
+                           py::ssize_t num_columns,
+                           py::dtype dtype = py::dtype::of<T>()) {
+  auto* const heap_data = new std::vector<T>(std::move(data));
+  py::capsule owner(heap_data, [](void* ptr) {
+    delete static_cast<std::vector<T>*>(ptr);
+  });
+  return py::array(dtype, {num_rows, num_columns}, heap_data->data(), owner);
+}
+
+// Returns the contents of a Python bytes object as a string view. The view is
+// valid only as long as the object exists.
+std::string_view BytesAsStringView(py::handle bytes) {
+  char* buffer = nullptr;
+  Py_ssize_t size = 0;
+  if (PyBytes_AsStringAndSize(bytes.ptr(), &buffer, &size) != 0) {
+    throw py::error_already_set();
+  }
+  return std::string_view(buffer, size);
+}
+
+// Raises IndexError when `block_index` is not a valid index in `table`.
+void CheckBlockIndex(const ThroughputTable& table, int block_index) {
+  if (block_index < 0 || block_index >= table.num_blocks()) {
+    throw py::index_error("Block index out of range");
+  }
+}
+
+PYBIND11_MODULE(throughput_table, m) {
+  m.doc() = kModuleDocstring;
+  py::google::ImportStatusModule();
+  // Registers LazyBasicBlock, which is returned by ThroughputTable.block().
+  py::module_::import("gematria.basic_block.python.basic_block");
+
+  py::enum_<ThroughputSelection>(m, "ThroughputSelection", R"(
+The way of selecting the inverse throughput from multiple measurements. The
+values have the same names and meaning as in io.python.options.)")
+      .value("RANDOM", ThroughputSelection::kRandom)
+      .value("FIRST", ThroughputSelection::kFirst)
+      .value("MEAN", ThroughputSelection::kMean)
+      .value("MIN", ThroughputSelection::kMin);
+
+  py::class_<ThroughputTable>(m, "ThroughputTable", R"(
+A table of basic blocks and their inverse throughputs for a fixed set of tasks.
+
+The basic blocks are stored as LazyBasicBlock objects, and the inverse
+throughputs are stored in flat arrays. The inverse throughputs for each task are
+selected with the source filters, and the throughput selection and scaling are
+applied when the records are added to the table.)")
+      .def(py::init([](int num_tasks, std::vector<std::string> source_filters,
+                       ThroughputSelection selection, double scaling,
+                       bool keep_prefixes,
+                       bool drop_blocks_without_throughputs) {
+             ThroughputTableOptions options;
+             options.num_tasks = num_tasks;
+             options.source_filters = std::move(source_filters);
+             options.selection = selection;
+             options.scaling = scaling;
+             options.keep_prefixes = keep_prefixes;
+             options.drop_blocks_without_throughputs =
+                 drop_blocks_without_throughputs;
+             absl::StatusOr<ThroughputTable> table =
+                 ThroughputTable::Create(std::move(options));
+             if (!table.ok()) {
+               throw py::value_error(std::string(table.status().message()));
+             }
+             return *std::move(table);
+           }),
+           py::arg("num_tasks"),
+           py::arg("source_filters") = std::vector<std::string>(),
+           py::arg("selection") = ThroughputSelection::kFirst,
+           py::arg("scaling") = 1.0, py::arg("keep_prefixes") = false,
+           py::arg("drop_blocks_without_throughputs") = true)
+      .def(
+          "add_serialized_proto",
+          [](ThroughputTable& self, py::bytes serialized_proto) {
+            return self.AddSerializedProto(BytesAsStringView(serialized_proto));
+          },
+          py::arg("serialized_proto"),
+          R"(Adds a block from a serialized BasicBlockWithThroughputProto.
+
+Returns True when the block was added, and False when it was skipped because it
+has no inverse throughputs. Raises StatusNotOk when the record can't be parsed,
+or when there are no source filters and it has fewer throughputs than tasks.)")
+      .def(
+          "add_serialized_protos",
+          [](ThroughputTable& self, py::iterable serialized_protos) {
+            int num_added_blocks = 0;
+            for (const py::handle serialized_proto : serialized_protos) {
+              absl::StatusOr<bool> added =
+                  self.AddSerializedProto(BytesAsStringView(serialized_proto));
+              if (!added.ok()) return absl::StatusOr<int>(added.status());
+              num_added_blocks += *added;
+            }
+            return absl::StatusOr<int>(num_added_blocks);
+          },
+          py::arg("serialized_protos"),
+          R"(Adds all blocks from an iterable of serialized protos.
+
+Returns the number of blocks that were added.)")
+      .def("remove_last_block",
+           [](ThroughputTable& self) {
+             if (self.num_blocks() == 0) {
+               throw py::index_error("The table is empty");
+             }
+             self.RemoveLastBlock();
+           })
+      .def("__len__", &ThroughputTable::num_blocks)
+      .def_property_readonly("num_tasks", &ThroughputTable::num_tasks)
+      .def(
+          "block",
+          [](const ThroughputTable& self, int block_index) {
+            CheckBlockIndex(self, block_index);
+            return &self.block(block_index);
+          },
+          py::arg("block_index"), py::return_value_policy::reference_internal,
+          "Returns the block at the given index as a LazyBasicBlock.")
+      .def(
+          "num_instructions",
+          [](const ThroughputTable& self, int block_index) {
+            CheckBlockIndex(self, block_index);
+            return self.num_instructions(block_index);
+          },
+          py::arg("block_index"))
+      .def(
+          "has_throughput",
+          [](const ThroughputTable& self, int block_index, int task_index) {
+            CheckBlockIndex(self, block_index);
+            if (task_index < 0 || task_index >= self.num_tasks()) {
+              throw py::index_error("Task index out of range");
+            }
+            return self.has_throughput(block_index, task_index);
+          },
+          py::arg("block_index"), py::arg("task_index"))
+      .def(
+          "expected_outputs",
+          [](const ThroughputTable& self, std::vector<int> block_indices,
+             bool randomize, uint64_t seed, bool include_deltas,
+             bool check_num_prefixes) -> absl::StatusOr<py::tuple> {
+            absl::StatusOr<ExpectedOutputs> outputs;
+            {
+              py::gil_scoped_release release_gil;
+              outputs =
+                  self.GetExpectedOutputs(block_indices, randomize, seed,
+                                          include_deltas, check_num_prefixes);
+            }
+            if (!outputs.ok()) return outputs.status();
+            const py::ssize_t num_tasks = self.num_tasks();
+            const py::ssize_t num_blocks = block_indices.size();
+            const py::ssize_t num_prefixes =
+                outputs->deltas.size() / num_tasks;
+            return py::make_tuple(
+                MoveToNumpyArray(std::move(outputs->outputs), num_blocks,
+                                 num_tasks),
+                MoveToNumpyArray(std::move(outputs->mask), num_blocks,
+                                 num_tasks, py::dtype::of<bool>()),
+                MoveToNumpyArray(std::move(outputs->deltas), num_prefixes,
+                                 num_tasks));
+          },
+          py::arg("block_indices"), py::arg("randomize") = false,
+          py::arg("seed") = 0, py::arg("include_deltas") = false,
+          py::arg("check_num_prefixes") = false,
+          R"(Returns the expected outputs for the blocks at `block_indices`.
+
+Returns a tuple `(outputs, mask, deltas)` of NumPy arrays. `outputs` and `mask`
+have the shape (len(block_indices), num_tasks); `deltas` has the shape
+(num_instructions, num_tasks), where num_instructions is the total number of
+instructions in the blocks, and it is empty unless `include_deltas` is True.)");
+}
+
+}  // namespace
+}  // namespace gematria
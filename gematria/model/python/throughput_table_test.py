@@ -0,0 +1,129 @@
+# Copyright 2023 Google Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#    http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+"""Tests for the Python bindings of ThroughputTable.
+
+Most of the functionality is tested in the corresponding cc_test(); this test
+only checks that the bindings work as expected.
+"""
+
+from absl.testing import absltest
+from gematria.model.python import throughput_table
+from gematria.proto import basic_block_pb2
+from gematria.proto import canonicalized_instruction_pb2
+from gematria.proto import throughput_pb2
+import numpy as np
+from pybind11_abseil import status
+
+_CanonicalizedInstructionProto = (
+    canonicalized_instruction_pb2.CanonicalizedInstructionProto
+)
+_PrefixThroughputProto = (
+    throughput_pb2.ThroughputWithSourceProto.PrefixThroughputProto
+)
+
+
+def _make_serialized_proto(hsw_cycles, skl_cycles):
+  proto = throughput_pb2.BasicBlockWithThroughputProto(
+      basic_block=basic_block_pb2.BasicBlockProto(
+          canonicalized_instructions=(
+              _CanonicalizedInstructionProto(
+                  mnemonic='MOV', llvm_mnemonic='MOV64rr'
+              ),
+              _CanonicalizedInstructionProto(
+                  mnemonic='ADD', llvm_mnemonic='ADD64rr'
+              ),
+          )
+      ),
+      inverse_throughputs=(
+          throughput_pb2.ThroughputWithSourceProto(
+              source='hsw',
+              inverse_throughput_cycles=hsw_cycles,
+              prefix_inverse_throughputs=(
+                  _PrefixThroughputProto(inverse_throughput_cycles=(1,)),
+                  _PrefixThroughputProto(inverse_throughput_cycles=hsw_cycles),
+              ),
+          ),
+          throughput_pb2.ThroughputWithSourceProto(
+              source='skl', inverse_throughput_cycles=skl_cycles
+          ),
+      ),
+  )
+  return proto.SerializeToString()
+
+
+class ThroughputTableTest(absltest.TestCase):
+
+  def test_invalid_options(self):
+    with self.assertRaises(ValueError):
+      throughput_table.ThroughputTable(num_tasks=0)
+    with self.assertRaises(ValueError):
+      throughput_table.ThroughputTable(num_tasks=2, source_filters=('hsw',))
+
+  def test_add_and_get_expected_outputs(self):
+    table = throughput_table.ThroughputTable(
+        num_tasks=2,
+        source_filters=('skl', 'hsw'),
+        selection=throughput_table.ThroughputSelection.MEAN,
+    )
+    self.assertTrue(
+        table.add_serialized_proto(_make_serialized_proto((2,), ()))
+    )
+    self.assertEqual(
+        table.add_serialized_protos((
+            _make_serialized_proto((), ()),
+            _make_serialized_proto((3,), (4, 6)),
+        )),
+        1,
+    )
+    self.assertLen(table, 2)
+    self.assertEqual(table.num_tasks, 2)
+    self.assertEqual(table.num_instructions(1), 2)
+    self.assertEqual(table.block(1).num_instructions, 2)
+    self.assertEqual(table.block(1).instructions[1].mnemonic, 'ADD')
+    self.assertFalse(table.has_throughput(0, 0))
+    self.assertTrue(table.has_throughput(0, 1))
+
+    outputs, mask, deltas = table.expected_outputs((1, 0))
+    np.testing.assert_array_equal(outputs, ((5, 3), (-1, 2)))
+    np.testing.assert_array_equal(mask, ((True, True), (False, True)))
+    self.assertEqual(mask.dtype, np.bool_)
+    self.assertEqual(deltas.shape, (0, 2))
+
+    table.remove_last_block()
+    self.assertLen(table, 1)
+
+  def test_deltas(self):
+    table = throughput_table.ThroughputTable(
+        num_tasks=1, source_filters=('hsw',), keep_prefixes=True
+    )
+    table.add_serialized_proto(_make_serialized_proto((3,), ()))
+    _, _, deltas = table.expected_outputs(
+        (0,), include_deltas=True, check_num_prefixes=True
+    )
+    np.testing.assert_array_equal(deltas, ((1,), (2,)))
+
+  def test_errors(self):
+    table = throughput_table.ThroughputTable(num_tasks=1)
+    with self.assertRaises(status.StatusNotOk):
+      table.add_serialized_proto(b'\xff\xff\xff')
+    with self.assertRaises(IndexError):
+      table.block(0)
+    with self.assertRaises(IndexError):
+      table.remove_last_block()
+    with self.assertRaises(status.StatusNotOk):
+      table.expected_outputs((0,))
+
+
+if __name__ == '__main__':
+  absltest.main()
@@ -138,6 +138,11 @@ class TokenModel(model_base.ModelBase):
 
     super().__init__(**kwargs)
 
+  @property
+  def token_list(self) -> Sequence[str]:
+    """Returns the list of tokens in the vocabulary of the model."""
+    return self._token_list
+
   @property
   def token_list_tensor(self) -> tf.Tensor:
     """Returns the tensor that contains the list of node tokens.
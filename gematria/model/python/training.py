@@ -13,14 +13,17 @@
 # limitations under the License.
 """Contains helper functions and classes for training models."""
 
-from collections.abc import Callable, Iterable, Sequence
+from collections.abc import Callable, Iterable, Iterator, Sequence
 import dataclasses
 import math
+import queue
+import threading
 from typing import Optional, TypeVar
 
 from absl import logging
 from gematria.basic_block.python import basic_block
 from gematria.basic_block.python import throughput
+from gematria.model.python import batch_scheduler
 import numpy as np
 import tensorflow.compat.v1 as tf
 
@@ -217,14 +220,14 @@ T = TypeVar('T')
 
 def get_num_instructions_in_block(block: basic_block.BasicBlock) -> int:
   """Returns the number of instructions in a basic block."""
-  return len(block.instructions)
+  return block.num_instructions
 
 
 def get_num_instructions_in_block_with_throughput(
     block: throughput.BasicBlockWithThroughput,
 ) -> int:
   """Returns the number of instructions in a basic block with throughput."""
-  return len(block.block.instructions)
+  return block.block.num_instructions
 
 
 def batches(
@@ -299,6 +302,168 @@ def batches(
     yield current_batch
 
 
+def bucketed_batches(
+    blocks: Sequence[T],
+    get_num_instructions: Callable[[T], int],
+    get_num_nodes: Optional[Callable[[T], int]] = None,
+    max_blocks_in_batch: Optional[int] = None,
+    max_instructions_in_batch: Optional[int] = None,
+    max_nodes_in_batch: Optional[int] = None,
+) -> Iterable[Sequence[T]]:
+  """Splits 'blocks' into batches of basic blocks of similar sizes.
+
+  Unlike batches(), this function may reorder the basic blocks: it sorts them by
+  size and packs them into batches in this order, so that each batch contains
+  blocks of similar sizes and the batches are filled close to their limits. This
+  reduces the amount of padding in the sequence models and the number of
+  batches needed to process a collection of blocks with skewed sizes. The blocks
+  in each batch are in the same relative order as in 'blocks'.
+
+  Basic blocks that exceed max_instructions_in_batch or max_nodes_in_batch on
+  their own are skipped.
+
+  For example, suppose that block(n) returns a basic block with n instructions,
+  and blocks = [block(n) for n in (1, 10, 1, 10, 1, 10)]. Then
+    bucketed_batches(blocks, max_instructions_in_batch=20)
+  returns [[blocks[1], blocks[3]], [blocks[0], blocks[2], blocks[4],
+  blocks[5]]], while batches() would need three batches.
+
+  Args:
+    blocks: The basic block collection that is split into batches.
+    get_num_instructions: A callback that returns the number of instructions in
+      each basic block.
+    get_num_nodes: A callback that returns the number of graph nodes in each
+      basic block. Must be specified when max_nodes_in_batch is specified.
+    max_blocks_in_batch: The number of basic blocks to include in a single
+      batch. When not specified, the number of basic blocks per batch is not
+      limited.
+    max_instructions_in_batch: The maximal number of instructions in a single
+      batch. When not specified, the number of instructions per batch is not
+      limited.
+    max_nodes_in_batch: The maximal number of graph nodes in a single batch.
+      When not specified, the number of nodes per batch is not limited.
+
+  Yields:
+    The basic blocks from the input sequence split into batches following the
+    specified limits.
+
+  Raises:
+    ValueError: When max_nodes_in_batch is specified without get_num_nodes.
+  """
+  if max_nodes_in_batch and get_num_nodes is None:
+    raise ValueError('max_nodes_in_batch requires get_num_nodes.')
+  num_instructions = [get_num_instructions(block) for block in blocks]
+  num_nodes = None
+  if get_num_nodes is not None:
+    num_nodes = [get_num_nodes(block) for block in blocks]
+  schedule, skipped_blocks = batch_scheduler.schedule_batches(
+      num_instructions,
+      num_nodes=num_nodes,
+      max_blocks_in_batch=max_blocks_in_batch or 0,
+      max_instructions_in_batch=max_instructions_in_batch or 0,
+      max_nodes_in_batch=max_nodes_in_batch or 0,
+  )
+  for block_index in skipped_blocks:
+    logging.warn(
+        (
+            'Single basic block is larger than the allowed limits per batch'
+            ' (%d instructions, %s nodes). Skipping the basic block'
+        ),
+        num_instructions[block_index],
+        num_nodes[block_index] if num_nodes is not None else 'unknown',
+    )
+  for batch in schedule:
+    yield [blocks[block_index] for block_index in batch]
+
+
+# The interval in seconds in which the prefetching thread checks whether the
+# consumer has stopped while it waits for space in the queue.
+_PREFETCH_POLL_INTERVAL_SECONDS = 0.1
+
+
+@dataclasses.dataclass(frozen=True)
+class _PrefetchError:
+  """Wraps an exception raised by the iterable in the prefetching thread."""
+
+  exception: BaseException
+
+
+# A sentinel value that marks the end of the prefetched sequence.
+_PREFETCH_END = object()
+
+
+def prefetch(items: Iterable[T], buffer_size: int) -> Iterator[T]:
+  """Iterates over `items` on a background thread, `buffer_size` items ahead.
+
+  The items are produced by a single background thread, in the order in which
+  they appear in `items`, and they are returned in the same order. This makes
+  it possible to overlap the computation of the next items, e.g. scheduling the
+  next batches with ModelBase.schedule_batch(), with the processing of the
+  current item by the caller, e.g. running a training step in TensorFlow, while
+  the sequence of items remains deterministic.
+
+  The background thread runs at most `buffer_size` items ahead of the caller.
+  When the caller stops the iteration, e.g. by calling close() on the returned
+  generator or by dropping it, the background thread stops after producing at
+  most one more item. Exceptions raised by `items` are re-raised in the caller
+  when it reaches the item that raised them.
+
+  Note that `items` is iterated on a different thread than the caller; code that
+  produces the items must not use state that is modified by the caller at the
+  same time.
+
+  Args:
+    items: The items to iterate over.
+    buffer_size: The maximal number of items produced ahead of the caller. Must
+      be positive.
+
+  Yields:
+    The items from `items`, in the original order.
+
+  Raises:
+    ValueError: When `buffer_size` is not positive.
+  """
+  if buffer_size <= 0:
+    raise ValueError(f'buffer_size must be positive, was {buffer_size}.')
+  item_queue = queue.Queue(maxsize=buffer_size)
+  stopped = threading.Event()
+
+  def put(item) -> bool:
+    while not stopped.is_set():
+      try:
+        item_queue.put(item, timeout=_PREFETCH_POLL_INTERVAL_SECONDS)
+        return True
+      except queue.Full:
+        pass
+    return False
+
+  def produce_items():
+    try:
+      for item in items:
+        if not put(item):
+          return
+    except Exception as e:  # pylint: disable=broad-exception-caught
+      put(_PrefetchError(e))
+      return
+    put(_PREFETCH_END)
+
+  thread = threading.Thread(
+      target=produce_items, name='gematria-prefetch', daemon=True
+  )
+  thread.start()
+  try:
+    while True:
+      item = item_queue.get()
+      if item is _PREFETCH_END:
+        return
+      if isinstance(item, _PrefetchError):
+        raise item.exception
+      yield item
+  finally:
+    stopped.set()
+    thread.join()
+
+
 def partially_restore_from_checkpoint(
     checkpoint_file: str, load_global_step_from_ckpt: bool, sess: tf.Session
 ) -> None:
@@ -13,6 +13,7 @@
 # limitations under the License.
 
 import os
+import time
 
 from absl.testing import parameterized
 from gematria.model.python import training
@@ -442,6 +443,143 @@ class BatchesTest(
     self.assertSequenceEqual(batches, expected_batches)
 
 
+class BucketedBatchesTest(
+    basic_blocks_with_throughput.TestCase,
+    tf.test.TestCase,
+):
+  """Tests for the bucketed_batches() function."""
+
+  num_blocks = 10
+
+  def test_no_limit(self):
+    batches = tuple(
+        training.bucketed_batches(
+            self.blocks, training.get_num_instructions_in_block
+        )
+    )
+    self.assertSequenceEqual(batches, (self.blocks,))
+
+  def test_max_instruction_limit(self):
+    blocks = self.blocks_with_throughput
+    # Lengths of blocks in self.blocks are: [1, 5, 1, 8, 3, 4, 1, 2, 9, 4].
+    # Block 8 is skipped, and the remaining blocks are packed from the largest
+    # to the smallest one.
+    batches = tuple(
+        training.bucketed_batches(
+            blocks,
+            training.get_num_instructions_in_block_with_throughput,
+            max_instructions_in_batch=8,
+        )
+    )
+    expected_batches = (
+        [blocks[3]],
+        [blocks[1]],
+        [blocks[5], blocks[9]],
+        [blocks[0], blocks[2], blocks[4], blocks[6], blocks[7]],
+    )
+    self.assertSequenceEqual(batches, expected_batches)
+
+  def test_max_blocks_limit(self):
+    batches = tuple(
+        training.bucketed_batches(
+            self.blocks,
+            training.get_num_instructions_in_block,
+            max_blocks_in_batch=3,
+        )
+    )
+    self.assertLen(batches, 4)
+    self.assertCountEqual(
+        [id(block) for batch in batches for block in batch],
+        [id(block) for block in self.blocks],
+    )
+    for batch in batches:
+      self.assertLessEqual(len(batch), 3)
+
+  def test_max_nodes_limit(self):
+    blocks = self.blocks
+    # Use the number of instructions as the number of nodes.
+    batches = tuple(
+        training.bucketed_batches(
+            blocks,
+            training.get_num_instructions_in_block,
+            get_num_nodes=training.get_num_instructions_in_block,
+            max_nodes_in_batch=8,
+        )
+    )
+    self.assertLen(batches, 4)
+
+  def test_max_nodes_limit_without_callback(self):
+    with self.assertRaises(ValueError):
+      tuple(
+          training.bucketed_batches(
+              self.blocks,
+              training.get_num_instructions_in_block,
+              max_nodes_in_batch=8,
+          )
+      )
+
+
+class PrefetchTest(tf.test.TestCase):
+  """Tests for the prefetch() function."""
+
+  def test_preserves_order(self):
+    items = list(range(100))
+    for buffer_size in (1, 3, 200):
+      self.assertSequenceEqual(
+          list(training.prefetch(iter(items), buffer_size)), items
+      )
+
+  def test_empty(self):
+    self.assertEmpty(list(training.prefetch((), buffer_size=2)))
+
+  def test_runs_ahead_by_at_most_buffer_size(self):
+    num_produced_items = 0
+
+    def produce():
+      nonlocal num_produced_items
+      for i in range(10):
+        num_produced_items += 1
+        yield i
+
+    prefetched = training.prefetch(produce(), buffer_size=3)
+    self.assertEqual(next(prefetched), 0)
+    # Give the background thread time to fill the queue. The producer runs at
+    # most `buffer_size` items ahead, plus one item that it waits to insert.
+    time.sleep(0.5)
+    self.assertLessEqual(num_produced_items, 5)
+    prefetched.close()
+
+  def test_propagates_exceptions(self):
+    def produce():
+      yield 1
+      yield 2
+      raise ValueError('Failed')
+
+    prefetched = training.prefetch(produce(), buffer_size=1)
+    self.assertEqual(next(prefetched), 1)
+    self.assertEqual(next(prefetched), 2)
+    with self.assertRaisesRegex(ValueError, 'Failed'):
+      next(prefetched)
+
+  def test_close_stops_producer(self):
+    def produce():
+      i = 0
+      while True:
+        yield i
+        i += 1
+
+    prefetched = training.prefetch(produce(), buffer_size=2)
+    self.assertEqual(next(prefetched), 0)
+    self.assertEqual(next(prefetched), 1)
+    # Joins the background thread; the test would time out if the thread did
+    # not stop.
+    prefetched.close()
+
+  def test_invalid_buffer_size(self):
+    with self.assertRaises(ValueError):
+      next(training.prefetch((1, 2, 3), buffer_size=0))
+
+
 class PartiallyRestoreFromCheckpointTest(tf.test.TestCase):
 
   def test_partially_restore(self):
@@ -0,0 +1,290 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "gematria/model/throughput_table.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <numeric>
+#include <random>
+#include <regex>  // NOLINT: the filters use the same syntax as Python.
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/log/absl_check.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/types/span.h"
+#include "gematria/basic_block/lazy_basic_block.h"
+#include "gematria/proto/throughput.pb.h"
+
+namespace gematria {
+
+absl::StatusOr<ThroughputTable> ThroughputTable::Create(
+    ThroughputTableOptions options) {
+  if (options.num_tasks < 1) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("The number of tasks must be positive, was ",
+                     options.num_tasks));
+  }
+  if (!options.source_filters.empty() &&
+      options.source_filters.size() != options.num_tasks) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "The number of source filters must be the same as the number of tasks."
+        " Got ",
+        options.source_filters.size(), " filters and ", options.num_tasks,
+        " tasks."));
+  }
+  std::vector<std::regex> source_filters;
+  source_filters.reserve(options.source_filters.size());
+  for (const std::string& source_filter : options.source_filters) {
+    try {
+      source_filters.emplace_back(source_filter);
+    } catch (const std::regex_error& error) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          "Invalid source filter '", source_filter, "': ", error.what()));
+    }
+  }
+  ThroughputTable table(std::move(options));
+  table.source_filters_ = std::move(source_filters);
+  return table;
+}
+
+ThroughputTable::ThroughputTable(ThroughputTableOptions options)
+    : options_(std::move(options)) {}
+
+absl::StatusOr<bool> ThroughputTable::AddSerializedProto(
+    std::string_view serialized_proto) {
+  if (!proto_buffer_.ParseFromArray(serialized_proto.data(),
+                                    serialized_proto.size())) {
+    return absl::InvalidArgumentError(
+        "Could not parse the BasicBlockWithThroughputProto");
+  }
+  return AddProto(proto_buffer_);
+}
+
+absl::StatusOr<bool> ThroughputTable::AddProto(
+    const BasicBlockWithThroughputProto& proto) {
+  const int num_tasks = options_.num_tasks;
+  // The throughputs used for each task, in the order of the tasks; nullptr
+  // when there is no throughput for the task.
+  std::vector<const ThroughputWithSourceProto*> task_throughputs(num_tasks,
+                                                                 nullptr);
+  if (source_filters_.empty()) {
+    if (proto.inverse_throughputs_size() < num_tasks) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          "Block contains an insufficient number of throughputs: ",
+          proto.inverse_throughputs_size(), ", should be ", num_tasks));
+    }
+    for (int task = 0; task < num_tasks; ++task) {
+      task_throughputs[task] = &proto.inverse_throughputs(task);
+    }
+  } else {
+    int num_unassigned_tasks = num_tasks;
+    for (const ThroughputWithSourceProto& throughput :
+         proto.inverse_throughputs()) {
+      for (const int task : MatchingFilters(throughput.source())) {
+        if (task_throughputs[task] != nullptr) continue;
+        task_throughputs[task] = &throughput;
+        --num_unassigned_tasks;
+      }
+      if (num_unassigned_tasks == 0) break;
+    }
+  }
+
+  if (options_.drop_blocks_without_throughputs) {
+    const auto has_values =
+        [this](const ThroughputWithSourceProto* throughput) {
+          if (throughput == nullptr) return false;
+          if (!throughput->inverse_throughput_cycles().empty()) return true;
+          if (!options_.keep_prefixes) return false;
+          for (const auto& prefix : throughput->prefix_inverse_throughputs()) {
+            if (!prefix.inverse_throughput_cycles().empty()) return true;
+          }
+          return false;
+        };
+    if (std::none_of(task_throughputs.begin(), task_throughputs.end(),
+                     has_values)) {
+      return false;
+    }
+  }
+
+  blocks_.emplace_back(proto.basic_block());
+  for (const ThroughputWithSourceProto* throughput : task_throughputs) {
+    AppendThroughput(throughput);
+  }
+  return true;
+}
+
+void ThroughputTable::RemoveLastBlock() {
+  ABSL_CHECK(!blocks_.empty());
+  blocks_.pop_back();
+  const size_t num_entries = blocks_.size() * options_.num_tasks;
+  cycle_offsets_.resize(num_entries + 1);
+  cycles_.resize(cycle_offsets_.back());
+  prefix_offsets_.resize(num_entries + 1);
+  prefix_cycle_offsets_.resize(prefix_offsets_.back() + 1);
+  prefix_cycles_.resize(prefix_cycle_offsets_.back());
+}
+
+bool ThroughputTable::has_throughput(int block_index, int task_index) const {
+  const int entry = block_index * options_.num_tasks + task_index;
+  return cycle_offsets_[entry + 1] > cycle_offsets_[entry];
+}
+
+const std::vector<int>& ThroughputTable::MatchingFilters(
+    const std::string& source) {
+  const auto it = matching_filters_cache_.find(source);
+  if (it != matching_filters_cache_.end()) return it->second;
+  std::vector<int> matching_filters;
+  for (int i = 0; i < source_filters_.size(); ++i) {
+    // Python's re.match() anchors the match only at the beginning of the
+    // string; match_continuous does the same for std::regex_search().
+    if (std::regex_search(source, source_filters_[i],
+                          std::regex_constants::match_continuous)) {
+      matching_filters.push_back(i);
+    }
+  }
+  return matching_filters_cache_
+      .emplace(source, std::move(matching_filters))
+      .first->second;
+}
+
+void ThroughputTable::AppendCycles(
+    const google::protobuf::RepeatedField<double>& cycles,
+    std::vector<double>& output) const {
+  if (cycles.empty()) return;
+  const double scaling = options_.scaling;
+  switch (options_.selection) {
+    case ThroughputSelection::kRandom:
+      for (const double value : cycles) output.push_back(value * scaling);
+      return;
+    case ThroughputSelection::kFirst:
+      output.push_back(cycles[0] * scaling);
+      return;
+    case ThroughputSelection::kMean:
+      output.push_back(std::accumulate(cycles.begin(), cycles.end(), 0.0) /
+                       cycles.size() * scaling);
+      return;
+    case ThroughputSelection::kMin:
+      output.push_back(*std::min_element(cycles.begin(), cycles.end()) *
+                       scaling);
+      return;
+  }
+}
+
+void ThroughputTable::AppendThroughput(
+    const ThroughputWithSourceProto* throughput) {
+  if (throughput != nullptr) {
+    AppendCycles(throughput->inverse_throughput_cycles(), cycles_);
+    if (options_.keep_prefixes) {
+      for (const auto& prefix : throughput->prefix_inverse_throughputs()) {
+        AppendCycles(prefix.inverse_throughput_cycles(), prefix_cycles_);
+        prefix_cycle_offsets_.push_back(prefix_cycles_.size());
+      }
+    }
+  }
+  cycle_offsets_.push_back(cycles_.size());
+  prefix_offsets_.push_back(prefix_cycle_offsets_.size() - 1);
+}
+
+absl::StatusOr<ExpectedOutputs> ThroughputTable::GetExpectedOutputs(
+    absl::Span<const int> block_indices, bool randomize, uint64_t seed,
+    bool include_deltas, bool check_num_prefixes) const {
+  if (include_deltas && !options_.keep_prefixes) {
+    return absl::FailedPreconditionError(
+        "Deltas were requested, but the prefix throughputs were not kept");
+  }
+  const int num_tasks = options_.num_tasks;
+  std::mt19937_64 random_generator(seed);
+  // Returns the value picked from values[begin:end]. The range must not be
+  // empty.
+  const auto pick_value = [randomize, &random_generator](
+                              const std::vector<double>& values, int64_t begin,
+                              int64_t end) {
+    if (!randomize || end - begin == 1) return values[begin];
+    std::uniform_int_distribution<int64_t> distribution(begin, end - 1);
+    return values[distribution(random_generator)];
+  };
+
+  ExpectedOutputs result;
+  result.outputs.reserve(block_indices.size() * num_tasks);
+  result.mask.reserve(block_indices.size() * num_tasks);
+  for (const int block_index : block_indices) {
+    if (block_index < 0 || block_index >= num_blocks()) {
+      return absl::OutOfRangeError(
+          absl::StrCat("Block index out of range: ", block_index));
+    }
+    const int first_entry = block_index * num_tasks;
+    for (int task = 0; task < num_tasks; ++task) {
+      const int64_t begin = cycle_offsets_[first_entry + task];
+      const int64_t end = cycle_offsets_[first_entry + task + 1];
+      const bool is_valid = end > begin;
+      result.mask.push_back(is_valid);
+      result.outputs.push_back(is_valid ? pick_value(cycles_, begin, end)
+                                        : kInvalidThroughputValue);
+    }
+    if (!include_deltas) continue;
+
+    const int num_prefixes = num_instructions(block_index);
+    const size_t block_deltas_begin = result.deltas.size();
+    result.deltas.resize(block_deltas_begin + num_prefixes * num_tasks, 0.0);
+    double* const block_deltas = result.deltas.data() + block_deltas_begin;
+    for (int task = 0; task < num_tasks; ++task) {
+      if (!has_throughput(block_index, task)) {
+        for (int prefix = 0; prefix < num_prefixes; ++prefix) {
+          block_deltas[prefix * num_tasks + task] = kInvalidThroughputValue;
+        }
+        continue;
+      }
+      const int64_t prefixes_begin = prefix_offsets_[first_entry + task];
+      const int64_t num_prefixes_in_throughputs =
+          prefix_offsets_[first_entry + task + 1] - prefixes_begin;
+      if (num_prefixes_in_throughputs > num_prefixes ||
+          (check_num_prefixes &&
+           num_prefixes_in_throughputs != num_prefixes)) {
+        return absl::InvalidArgumentError(absl::StrCat(
+            "Invalid number of prefixes for task ", task, " of block ",
+            block_index, ". Expected: ", num_prefixes,
+            ", actual: ", num_prefixes_in_throughputs));
+      }
+      for (int prefix = 0; prefix < num_prefixes_in_throughputs; ++prefix) {
+        const int64_t begin = prefix_cycle_offsets_[prefixes_begin + prefix];
+        const int64_t end = prefix_cycle_offsets_[prefixes_begin + prefix + 1];
+        if (begin == end) {
+          return absl::InvalidArgumentError(
+              absl::StrCat("Prefix ", prefix, " of task ", task, " of block ",
+                           block_index, " has no inverse throughputs"));
+        }
+        block_deltas[prefix * num_tasks + task] =
+            pick_value(prefix_cycles_, begin, end);
+      }
+    }
+    // Turn the prefix throughputs into deltas by subtracting the previous
+    // prefix from all prefixes apart from the first one.
+    for (int prefix = num_prefixes - 1; prefix > 0; --prefix) {
+      for (int task = 0; task < num_tasks; ++task) {
+        block_deltas[prefix * num_tasks + task] -=
+            block_deltas[(prefix - 1) * num_tasks + task];
+      }
+    }
+  }
+  return result;
+}
+
+}  // namespace gematria
@@ -0,0 +1,190 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Contains a compact in-memory table of basic blocks and their inverse
+// throughputs, used as the training and evaluation data of the models.
+//
+// The Python input pipeline reads BasicBlockWithThroughputProto records,
+// selects the inverse throughputs matching the tasks of the model, and converts
+// each record to a BasicBlockWithThroughput object; in each training step, the
+// expected outputs of the model are then assembled from these objects block by
+// block. ThroughputTable does the same in a single pass over the serialized
+// records: it parses each record, applies the source filters and the throughput
+// selection, and stores the basic block as a LazyBasicBlock and the inverse
+// throughputs in flat arrays. The expected outputs for a batch, including the
+// deltas computed from the prefix inverse throughputs, are then created for a
+// list of block indices in one call.
+
+#ifndef THIRD_PARTY_GEMATRIA_GEMATRIA_MODEL_THROUGHPUT_TABLE_H_
+#define THIRD_PARTY_GEMATRIA_GEMATRIA_MODEL_THROUGHPUT_TABLE_H_
+
+#include <cstdint>
+#include <regex>  // NOLINT: the filters use the same syntax as Python.
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/types/span.h"
+#include "gematria/basic_block/lazy_basic_block.h"
+#include "gematria/proto/throughput.pb.h"
+
+namespace gematria {
+
+// The value of the expected output for tasks that have no inverse throughput.
+// This is the same value as INVALID_THROUGHPUT_VALUE in model_base.py.
+inline constexpr double kInvalidThroughputValue = -1;
+
+// The way of selecting the inverse throughput from multiple measurements. The
+// values are the same as in gematria/io/python/options.py.
+enum class ThroughputSelection {
+  // Keeps all values; the expected output is either the first value, or a
+  // randomly selected one.
+  kRandom = 0,
+  // Keeps only the first value.
+  kFirst = 1,
+  // Replaces the values with their mean.
+  kMean = 2,
+  // Replaces the values with their minimum.
+  kMin = 3,
+};
+
+struct ThroughputTableOptions {
+  // The number of tasks, i.e. the number of expected outputs per basic block.
+  int num_tasks = 1;
+  // Regular expressions matched against the sources of the inverse throughputs
+  // of each record, one per task; the first throughput whose source matches
+  // the filter at the beginning is used for the task. When empty, the first
+  // `num_tasks` throughputs of the record are used in their original order.
+  std::vector<std::string> source_filters;
+  ThroughputSelection selection = ThroughputSelection::kFirst;
+  // A factor applied to all inverse throughput values.
+  double scaling = 1.0;
+  // When true, the prefix inverse throughputs are kept, and they are
+  // considered when checking whether a block has any inverse throughputs.
+  bool keep_prefixes = false;
+  // When true, records without any inverse throughput values are skipped.
+  bool drop_blocks_without_throughputs = true;
+};
+
+// The expected outputs of the model for a list of basic blocks. All arrays are
+// in the row-major order.
+struct ExpectedOutputs {
+  // The expected outputs; contains num_blocks x num_tasks entries. The value
+  // is kInvalidThroughputValue for tasks with no inverse throughput.
+  std::vector<double> outputs;
+  // The mask of valid expected outputs; contains num_blocks x num_tasks
+  // entries, where an entry is 1 when the corresponding expected output is
+  // valid.
+  std::vector<uint8_t> mask;
+  // The expected deltas, i.e. the differences between the expected outputs of
+  // consecutive prefixes of the blocks; contains num_instructions x num_tasks
+  // entries, where num_instructions is the total number of instructions of all
+  // blocks. Empty unless requested.
+  std::vector<double> deltas;
+};
+
+// A table of basic blocks with their inverse throughputs for a fixed number of
+// tasks. See the top-level comment for more details.
+class ThroughputTable {
+ public:
+  // Creates an empty table. Returns an error when the options are invalid or
+  // when one of the source filters is not a valid regular expression.
+  static absl::StatusOr<ThroughputTable> Create(
+      ThroughputTableOptions options);
+
+  // Adds the basic block from a serialized BasicBlockWithThroughputProto to
+  // the table. Returns true when the block was added, false when it was skipped
+  // because it has no inverse throughputs, and an error when the record can't
+  // be parsed or when it has fewer throughputs than tasks and there are no
+  // source filters.
+  absl::StatusOr<bool> AddSerializedProto(std::string_view serialized_proto);
+  absl::StatusOr<bool> AddProto(const BasicBlockWithThroughputProto& proto);
+
+  // Removes the last block from the table, e.g. when it was rejected by the
+  // model after it was added. The table must not be empty.
+  void RemoveLastBlock();
+
+  int num_blocks() const { return static_cast<int>(blocks_.size()); }
+  int num_tasks() const { return options_.num_tasks; }
+  const ThroughputTableOptions& options() const { return options_; }
+
+  const LazyBasicBlock& block(int block_index) const {
+    return blocks_[block_index];
+  }
+  int num_instructions(int block_index) const {
+    return blocks_[block_index].num_instructions();
+  }
+  // Returns true when the block has an inverse throughput for the task.
+  bool has_throughput(int block_index, int task_index) const;
+
+  // Creates the expected outputs for the blocks at `block_indices`, in this
+  // order. When `randomize` is true, the expected output of each block, task
+  // and prefix is picked randomly from the stored values using a generator
+  // seeded with `seed`; otherwise, the first value is used. When
+  // `include_deltas` is true, the expected deltas are computed from the prefix
+  // inverse throughputs; this requires `keep_prefixes` in the options, and
+  // when `check_num_prefixes` is true, each valid inverse throughput must have
+  // exactly one prefix per instruction.
+  absl::StatusOr<ExpectedOutputs> GetExpectedOutputs(
+      absl::Span<const int> block_indices, bool randomize, uint64_t seed,
+      bool include_deltas, bool check_num_prefixes) const;
+
+ private:
+  explicit ThroughputTable(ThroughputTableOptions options);
+
+  // Returns the indices of the source filters that match `source`. The result
+  // is cached, because there are typically only a few distinct sources in a
+  // dataset.
+  const std::vector<int>& MatchingFilters(const std::string& source);
+
+  // Appends the values from `cycles` to `output`, after applying the throughput
+  // selection and the scaling.
+  void AppendCycles(const google::protobuf::RepeatedField<double>& cycles,
+                    std::vector<double>& output) const;
+
+  // Appends the inverse throughput `throughput` for the next task of the last
+  // block. `throughput` may be nullptr when there is no throughput for the
+  // task.
+  void AppendThroughput(const ThroughputWithSourceProto* throughput);
+
+  ThroughputTableOptions options_;
+  std::vector<std::regex> source_filters_;
+  absl::flat_hash_map<std::string, std::vector<int>> matching_filters_cache_;
+
+  std::vector<LazyBasicBlock> blocks_;
+
+  // The inverse throughput values of the blocks. The values for task `t` of
+  // block `b` are cycles_[cycle_offsets_[i]:cycle_offsets_[i + 1]], where
+  // i = b * num_tasks + t.
+  std::vector<double> cycles_;
+  std::vector<int64_t> cycle_offsets_ = {0};
+
+  // The prefix inverse throughputs of the blocks. The prefixes for task `t` of
+  // block `b` have indices prefix_offsets_[i]:prefix_offsets_[i + 1], where
+  // i = b * num_tasks + t, and the values for prefix `p` are
+  // prefix_cycles_[prefix_cycle_offsets_[p]:prefix_cycle_offsets_[p + 1]].
+  std::vector<double> prefix_cycles_;
+  std::vector<int64_t> prefix_cycle_offsets_ = {0};
+  std::vector<int64_t> prefix_offsets_ = {0};
+
+  // A buffer reused for parsing the records.
+  BasicBlockWithThroughputProto proto_buffer_;
+};
+
+}  // namespace gematria
+
+#endif  // THIRD_PARTY_GEMATRIA_GEMATRIA_MODEL_THROUGHPUT_TABLE_H_
@@ -0,0 +1,226 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "gematria/model/throughput_table.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "gematria/basic_block/basic_block_protos.h"
+#include "gematria/proto/throughput.pb.h"
+#include "gematria/testing/matchers.h"
+#include "gematria/testing/parse_proto.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace gematria {
+namespace {
+
+using ::testing::AnyOf;
+using ::testing::DoubleEq;
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+
+// A block with two instructions and throughputs from three sources.
+BasicBlockWithThroughputProto MakeTestProto() {
+  return ParseTextProto(R"pb(
+    basic_block {
+      canonicalized_instructions { mnemonic: "MOV" llvm_mnemonic: "MOV64rr" }
+      canonicalized_instructions { mnemonic: "ADD" llvm_mnemonic: "ADD64rr" }
+    }
+    inverse_throughputs {
+      source: "hsw: measured"
+      inverse_throughput_cycles: 1
+      inverse_throughput_cycles: 3
+      prefix_inverse_throughputs { inverse_throughput_cycles: 1 }
+      prefix_inverse_throughputs { inverse_throughput_cycles: 2 }
+    }
+    inverse_throughputs {
+      source: "skl: measured"
+      inverse_throughput_cycles: 4
+      prefix_inverse_throughputs { inverse_throughput_cycles: 3 }
+      prefix_inverse_throughputs { inverse_throughput_cycles: 4 }
+    }
+    inverse_throughputs {
+      source: "hsw: estimated"
+      inverse_throughput_cycles: 10
+    }
+  )pb");
+}
+
+ThroughputTableOptions MakeOptions(int num_tasks,
+                                   std::vector<std::string> source_filters,
+                                   bool keep_prefixes = false) {
+  ThroughputTableOptions options;
+  options.num_tasks = num_tasks;
+  options.source_filters = std::move(source_filters);
+  options.keep_prefixes = keep_prefixes;
+  return options;
+}
+
+ThroughputTable CreateTable(ThroughputTableOptions options) {
+  absl::StatusOr<ThroughputTable> table =
+      ThroughputTable::Create(std::move(options));
+  EXPECT_OK(table);
+  return *std::move(table);
+}
+
+TEST(ThroughputTableTest, InvalidOptions) {
+  EXPECT_THAT(ThroughputTable::Create(MakeOptions(0, {})),
+              StatusIs(absl::StatusCode::kInvalidArgument));
+  EXPECT_THAT(ThroughputTable::Create(MakeOptions(2, {"hsw"})),
+              StatusIs(absl::StatusCode::kInvalidArgument));
+  EXPECT_THAT(ThroughputTable::Create(MakeOptions(1, {"(hsw"})),
+              StatusIs(absl::StatusCode::kInvalidArgument));
+}
+
+TEST(ThroughputTableTest, SourceFilters) {
+  ThroughputTable table = CreateTable(MakeOptions(3, {"skl", "hsw", "icx"}));
+  EXPECT_THAT(table.AddProto(MakeTestProto()), IsOkAndHolds(true));
+  ASSERT_EQ(table.num_blocks(), 1);
+  EXPECT_EQ(table.num_instructions(0), 2);
+  EXPECT_EQ(table.block(0).block(),
+            BasicBlockFromProto(MakeTestProto().basic_block()));
+  EXPECT_TRUE(table.has_throughput(0, 0));
+  EXPECT_TRUE(table.has_throughput(0, 1));
+  EXPECT_FALSE(table.has_throughput(0, 2));
+
+  absl::StatusOr<ExpectedOutputs> outputs =
+      table.GetExpectedOutputs({0}, /*randomize=*/false, /*seed=*/0,
+                               /*include_deltas=*/false,
+                               /*check_num_prefixes=*/false);
+  ASSERT_OK(outputs);
+  EXPECT_THAT(outputs->outputs, ElementsAre(4, 1, kInvalidThroughputValue));
+  EXPECT_THAT(outputs->mask, ElementsAre(1, 1, 0));
+  EXPECT_THAT(outputs->deltas, IsEmpty());
+}
+
+TEST(ThroughputTableTest, FilterMatchesAtTheBeginning) {
+  ThroughputTable table = CreateTable(MakeOptions(1, {"measured"}));
+  EXPECT_THAT(table.AddProto(MakeTestProto()), IsOkAndHolds(false));
+  EXPECT_EQ(table.num_blocks(), 0);
+}
+
+TEST(ThroughputTableTest, NoSourceFilters) {
+  ThroughputTable table = CreateTable(MakeOptions(2, {}));
+  EXPECT_THAT(table.AddProto(MakeTestProto()), IsOkAndHolds(true));
+  absl::StatusOr<ExpectedOutputs> outputs = table.GetExpectedOutputs(
+      {0, 0}, false, 0, false, false);
+  ASSERT_OK(outputs);
+  EXPECT_THAT(outputs->outputs, ElementsAre(1, 4, 1, 4));
+
+  ThroughputTable large_table = CreateTable(MakeOptions(4, {}));
+  EXPECT_THAT(large_table.AddProto(MakeTestProto()),
+              StatusIs(absl::StatusCode::kInvalidArgument));
+}
+
+TEST(ThroughputTableTest, ThroughputSelection) {
+  const auto first_output = [](ThroughputSelection selection) {
+    ThroughputTableOptions options = MakeOptions(1, {"hsw"});
+    options.selection = selection;
+    options.scaling = 2.0;
+    ThroughputTable table = CreateTable(std::move(options));
+    EXPECT_THAT(table.AddProto(MakeTestProto()), IsOkAndHolds(true));
+    return table.GetExpectedOutputs({0}, false, 0, false, false)->outputs[0];
+  };
+  EXPECT_THAT(first_output(ThroughputSelection::kFirst), DoubleEq(2));
+  EXPECT_THAT(first_output(ThroughputSelection::kMean), DoubleEq(4));
+  EXPECT_THAT(first_output(ThroughputSelection::kMin), DoubleEq(2));
+  EXPECT_THAT(first_output(ThroughputSelection::kRandom), DoubleEq(2));
+}
+
+TEST(ThroughputTableTest, RandomizedOutputs) {
+  ThroughputTableOptions options = MakeOptions(1, {"hsw"});
+  options.selection = ThroughputSelection::kRandom;
+  ThroughputTable table = CreateTable(std::move(options));
+  EXPECT_THAT(table.AddProto(MakeTestProto()), IsOkAndHolds(true));
+  bool has_first = false;
+  bool has_second = false;
+  for (int seed = 0; seed < 32; ++seed) {
+    absl::StatusOr<ExpectedOutputs> outputs =
+        table.GetExpectedOutputs({0}, /*randomize=*/true, seed, false, false);
+    ASSERT_OK(outputs);
+    EXPECT_THAT(outputs->outputs, ElementsAre(AnyOf(1, 3)));
+    has_first |= outputs->outputs[0] == 1;
+    has_second |= outputs->outputs[0] == 3;
+  }
+  EXPECT_TRUE(has_first);
+  EXPECT_TRUE(has_second);
+}
+
+TEST(ThroughputTableTest, Deltas) {
+  ThroughputTable table = CreateTable(
+      MakeOptions(3, {"hsw", "skl", "icx"}, /*keep_prefixes=*/true));
+  EXPECT_THAT(table.AddProto(MakeTestProto()), IsOkAndHolds(true));
+  absl::StatusOr<ExpectedOutputs> outputs = table.GetExpectedOutputs(
+      {0}, false, 0, /*include_deltas=*/true, /*check_num_prefixes=*/true);
+  ASSERT_OK(outputs);
+  // Task "icx" has no throughputs, so its prefixes are invalid; the delta of
+  // the second prefix is zero, as in ModelBase.
+  EXPECT_THAT(outputs->deltas,
+              ElementsAre(1, 3, kInvalidThroughputValue, 1, 1, 0));
+
+  ThroughputTable table_without_prefixes =
+      CreateTable(MakeOptions(1, {"hsw"}));
+  EXPECT_THAT(table_without_prefixes.AddProto(MakeTestProto()),
+              IsOkAndHolds(true));
+  EXPECT_THAT(table_without_prefixes.GetExpectedOutputs({0}, false, 0, true,
+                                                        false),
+              StatusIs(absl::StatusCode::kFailedPrecondition));
+}
+
+TEST(ThroughputTableTest, CheckNumPrefixes) {
+  ThroughputTable table =
+      CreateTable(MakeOptions(1, {"hsw: est"}, /*keep_prefixes=*/true));
+  EXPECT_THAT(table.AddProto(MakeTestProto()), IsOkAndHolds(true));
+  EXPECT_THAT(table.GetExpectedOutputs({0}, false, 0, true, true),
+              StatusIs(absl::StatusCode::kInvalidArgument));
+  absl::StatusOr<ExpectedOutputs> outputs =
+      table.GetExpectedOutputs({0}, false, 0, true, false);
+  ASSERT_OK(outputs);
+  EXPECT_THAT(outputs->deltas, ElementsAre(0, 0));
+}
+
+TEST(ThroughputTableTest, SerializedProtosAndRemoveLastBlock) {
+  ThroughputTable table =
+      CreateTable(MakeOptions(2, {"hsw", "skl"}, /*keep_prefixes=*/true));
+  EXPECT_THAT(table.AddSerializedProto("\xff\xff\xff"),
+              StatusIs(absl::StatusCode::kInvalidArgument));
+  EXPECT_THAT(table.AddSerializedProto(MakeTestProto().SerializeAsString()),
+              IsOkAndHolds(true));
+  BasicBlockWithThroughputProto other = MakeTestProto();
+  other.mutable_inverse_throughputs(0)->set_inverse_throughput_cycles(0, 7);
+  EXPECT_THAT(table.AddSerializedProto(other.SerializeAsString()),
+              IsOkAndHolds(true));
+  table.RemoveLastBlock();
+  EXPECT_THAT(table.AddSerializedProto(MakeTestProto().SerializeAsString()),
+              IsOkAndHolds(true));
+  ASSERT_EQ(table.num_blocks(), 2);
+
+  absl::StatusOr<ExpectedOutputs> outputs =
+      table.GetExpectedOutputs({1, 0}, false, 0, true, true);
+  ASSERT_OK(outputs);
+  EXPECT_THAT(outputs->outputs, ElementsAre(1, 4, 1, 4));
+  EXPECT_THAT(outputs->mask, ElementsAre(1, 1, 1, 1));
+  EXPECT_THAT(outputs->deltas, ElementsAre(1, 3, 1, 1, 1, 3, 1, 1));
+
+  EXPECT_THAT(table.GetExpectedOutputs({2}, false, 0, false, false),
+              StatusIs(absl::StatusCode::kOutOfRange));
+}
+
+}  // namespace
+}  // namespace gematria
@@ -0,0 +1,183 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "gematria/model/token_vocabulary.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <ios>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/log/absl_check.h"
+#include "absl/log/absl_log.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "gematria/basic_block/token_table.h"
+#include "gematria/utils/little_endian.h"
+#include "gematria/utils/mapped_file.h"
+
+namespace gematria {
+namespace {
+
+constexpr absl::string_view kSnapshotMagic("GMTKVOCB", 8);
+constexpr uint32_t kSnapshotFormatVersion = 1;
+constexpr size_t kHeaderSize = kSnapshotMagic.size() + 2 * sizeof(uint32_t);
+
+}  // namespace
+
+TokenVocabulary::TokenVocabulary(const std::vector<std::string>& tokens) {
+  token_ids_.reserve(tokens.size());
+  index_by_name_.reserve(tokens.size());
+  for (const std::string& token : tokens) AddToken(token);
+  BuildIndexByTokenId();
+}
+
+void TokenVocabulary::AddToken(absl::string_view token) {
+  TokenTable& token_table = TokenTable::Global();
+  const TokenId token_id = token_table.Intern(token);
+  const auto insertion_result = index_by_name_.emplace(
+      token_table.Name(token_id), static_cast<TokenIndex>(token_ids_.size()));
+  if (!insertion_result.second) {
+    ABSL_LOG(FATAL) << "Duplicate item: '" << insertion_result.first->first
+                    << "'";
+  }
+  token_ids_.push_back(token_id);
+}
+
+void TokenVocabulary::BuildIndexByTokenId() {
+  TokenId max_token_id = TokenTable::kInvalidTokenId;
+  for (const TokenId token_id : token_ids_) {
+    max_token_id = std::max(max_token_id, token_id);
+  }
+  index_by_token_id_.resize(max_token_id + 1, kInvalidTokenIndex);
+  for (TokenIndex i = 0; i < token_ids_.size(); ++i) {
+    index_by_token_id_[token_ids_[i]] = i;
+  }
+}
+
+absl::StatusOr<std::shared_ptr<const TokenVocabulary>>
+TokenVocabulary::ReadSnapshot(const std::string& file_name) {
+  absl::StatusOr<std::unique_ptr<MappedFile>> file =
+      MappedFile::Open(file_name);
+  if (!file.ok()) return file.status();
+  if ((*file)->size() < kHeaderSize) {
+    return absl::InvalidArgumentError(
+        absl::StrCat(file_name, " is not a vocabulary snapshot"));
+  }
+  // The tokens are copied to the global token table, so the file is unmapped
+  // as soon as the vocabulary is created.
+  absl::StatusOr<std::shared_ptr<const TokenVocabulary>> vocabulary =
+      FromSnapshotData((*file)->contents());
+  if (!vocabulary.ok()) {
+    return absl::InvalidArgumentError(
+        absl::StrCat(file_name, ": ", vocabulary.status().message()));
+  }
+  return vocabulary;
+}
+
+absl::StatusOr<std::shared_ptr<const TokenVocabulary>>
+TokenVocabulary::FromSnapshotData(absl::string_view snapshot) {
+  if (snapshot.size() < kHeaderSize ||
+      snapshot.substr(0, kSnapshotMagic.size()) != kSnapshotMagic) {
+    return absl::InvalidArgumentError("Not a vocabulary snapshot");
+  }
+  const char* const data = snapshot.data();
+  const uint32_t format_version =
+      DecodeLittleEndian<uint32_t>(data + kSnapshotMagic.size());
+  if (format_version != kSnapshotFormatVersion) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Unsupported format version ", format_version));
+  }
+  const uint64_t num_tokens =
+      DecodeLittleEndian<uint32_t>(data + kSnapshotMagic.size() + 4);
+  // The number of tokens is bounded by the size of the file, which also
+  // guarantees that the size of the offset table does not overflow.
+  if (num_tokens > (snapshot.size() - kHeaderSize) / sizeof(uint64_t)) {
+    return absl::InvalidArgumentError("Invalid number of tokens");
+  }
+  const char* const offsets = data + kHeaderSize;
+  const char* const token_data = offsets + num_tokens * sizeof(uint64_t);
+  const uint64_t token_data_size = data + snapshot.size() - token_data;
+
+  std::shared_ptr<TokenVocabulary> vocabulary(new TokenVocabulary());
+  vocabulary->token_ids_.reserve(num_tokens);
+  vocabulary->index_by_name_.reserve(num_tokens);
+  uint64_t token_begin = 0;
+  for (uint64_t i = 0; i < num_tokens; ++i) {
+    const uint64_t token_end =
+        DecodeLittleEndian<uint64_t>(offsets + i * sizeof(uint64_t));
+    if (token_end < token_begin || token_end > token_data_size) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Invalid end offset of token ", i));
+    }
+    const absl::string_view token(token_data + token_begin,
+                                  token_end - token_begin);
+    if (vocabulary->Find(token) != kInvalidTokenIndex) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Duplicate token '", token, "'"));
+    }
+    vocabulary->AddToken(token);
+    token_begin = token_end;
+  }
+  if (token_begin != token_data_size) {
+    return absl::InvalidArgumentError("Unexpected data after the last token");
+  }
+  vocabulary->BuildIndexByTokenId();
+  return vocabulary;
+}
+
+absl::Status TokenVocabulary::WriteSnapshot(
+    const std::string& file_name) const {
+  if (token_ids_.size() > std::numeric_limits<uint32_t>::max()) {
+    return absl::InvalidArgumentError("The vocabulary is too large");
+  }
+  const TokenTable& token_table = TokenTable::Global();
+  std::string snapshot(kSnapshotMagic);
+  AppendLittleEndian(kSnapshotFormatVersion, snapshot);
+  AppendLittleEndian(static_cast<uint32_t>(token_ids_.size()), snapshot);
+  uint64_t token_end = 0;
+  for (const TokenId token_id : token_ids_) {
+    token_end += token_table.Name(token_id).size();
+    AppendLittleEndian(token_end, snapshot);
+  }
+  for (const TokenId token_id : token_ids_) {
+    snapshot.append(token_table.Name(token_id));
+  }
+
+  std::ofstream output(file_name, std::ios::binary | std::ios::trunc);
+  if (!output) {
+    return absl::InternalError(absl::StrCat("Could not create ", file_name));
+  }
+  output.write(snapshot.data(), snapshot.size());
+  output.close();
+  if (!output) {
+    return absl::InternalError(absl::StrCat("Could not write ", file_name));
+  }
+  return absl::OkStatus();
+}
+
+const std::string& TokenVocabulary::token(TokenIndex index) const {
+  ABSL_CHECK_GE(index, 0);
+  ABSL_CHECK_LT(index, size());
+  return TokenTable::Global().Name(token_ids_[index]);
+}
+
+}  // namespace gematria
@@ -0,0 +1,142 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Contains a frozen vocabulary of tokens used by the token-based models. The
+// vocabulary maps tokens to their indices in the embedding tables of the model.
+//
+// A vocabulary can be stored in a snapshot file, so that processes that use the
+// same vocabulary many times, e.g. short-lived inference jobs, can load it in a
+// single read instead of recreating it from a list of strings. The snapshot
+// file has the following layout:
+//   char   magic[8]
+//   uint32 format_version
+//   uint32 num_tokens
+//   uint64 token_end_offsets[num_tokens]
+//   char   token_data[]
+// where all integers are in the little-endian byte order, token_data is the
+// concatenation of all tokens in the order of their indices, and token `i` is
+// token_data[token_end_offsets[i - 1]:token_end_offsets[i]], with
+// token_end_offsets[-1] = 0.
+
+#ifndef THIRD_PARTY_GEMATRIA_GEMATRIA_MODEL_TOKEN_VOCABULARY_H_
+#define THIRD_PARTY_GEMATRIA_GEMATRIA_MODEL_TOKEN_VOCABULARY_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "gematria/basic_block/token_table.h"
+
+namespace gematria {
+
+// An immutable mapping between tokens and their indices, i.e. their positions
+// in the list of tokens used to create the vocabulary.
+//
+// All tokens of the vocabulary are interned in the global token table, and the
+// vocabulary keeps a dense array indexed by their token IDs. Lookups by token
+// ID are thus a bounds check and an array access; lookups by string need a
+// single hash table probe. The vocabulary is never modified after it is
+// created, so a single instance can be shared by multiple threads, e.g. by
+// wrapping it in a std::shared_ptr<const TokenVocabulary>.
+class TokenVocabulary {
+ public:
+  using TokenIndex = int;
+
+  // The value returned by the lookup methods for tokens that are not in the
+  // vocabulary.
+  static constexpr TokenIndex kInvalidTokenIndex = -1;
+
+  // Creates a vocabulary from a list of tokens. The index of each token is its
+  // position in `tokens`. Dies when `tokens` contains duplicates.
+  explicit TokenVocabulary(const std::vector<std::string>& tokens);
+
+  // Loads a vocabulary from a snapshot file created by WriteSnapshot(). The
+  // file is mapped to memory, and the tokens are interned directly from the
+  // mapped data. Returns an error when the file can't be read or when it is not
+  // a valid snapshot.
+  static absl::StatusOr<std::shared_ptr<const TokenVocabulary>> ReadSnapshot(
+      const std::string& file_name);
+
+  // Writes the vocabulary to a snapshot file `file_name`. See the top-level
+  // comment for the layout of the file.
+  absl::Status WriteSnapshot(const std::string& file_name) const;
+
+  // Returns the index of `token`, or kInvalidTokenIndex when `token` is not in
+  // the vocabulary.
+  TokenIndex Find(absl::string_view token) const {
+    const auto it = index_by_name_.find(token);
+    return it == index_by_name_.end() ? kInvalidTokenIndex : it->second;
+  }
+  // Returns the index of the token with ID `token_id` in the global token
+  // table, or kInvalidTokenIndex when the token is not in the vocabulary.
+  TokenIndex Find(TokenId token_id) const {
+    if (token_id < 0 ||
+        token_id >= static_cast<TokenId>(index_by_token_id_.size())) {
+      return kInvalidTokenIndex;
+    }
+    return index_by_token_id_[token_id];
+  }
+
+  // Returns the token at `index`.
+  const std::string& token(TokenIndex index) const;
+  // Returns the IDs of the tokens in the global token table, in the order of
+  // their indices.
+  const std::vector<TokenId>& token_ids() const { return token_ids_; }
+
+  // Returns the number of tokens in the vocabulary.
+  int size() const { return static_cast<int>(token_ids_.size()); }
+
+  // Two vocabularies are equal when they contain the same tokens with the
+  // same indices.
+  bool operator==(const TokenVocabulary& other) const {
+    return token_ids_ == other.token_ids_;
+  }
+  bool operator!=(const TokenVocabulary& other) const {
+    return !(*this == other);
+  }
+
+ private:
+  TokenVocabulary() = default;
+
+  // Creates a vocabulary from the contents of a snapshot file.
+  static absl::StatusOr<std::shared_ptr<const TokenVocabulary>>
+  FromSnapshotData(absl::string_view snapshot);
+
+  // Adds `token` to the end of the vocabulary. Dies when the token is already
+  // in the vocabulary.
+  void AddToken(absl::string_view token);
+  // Creates index_by_token_id_ from token_ids_; called after all tokens were
+  // added.
+  void BuildIndexByTokenId();
+
+  // The IDs of the tokens in the global token table, indexed by their indices
+  // in the vocabulary.
+  std::vector<TokenId> token_ids_;
+  // The indices of the tokens, indexed by their IDs in the global token table.
+  // Contains kInvalidTokenIndex for IDs of tokens that are not in the
+  // vocabulary. Tokens interned after the vocabulary was created have IDs
+  // beyond the end of the vector.
+  std::vector<TokenIndex> index_by_token_id_;
+  // The indices of the tokens, indexed by the tokens. The keys point to the
+  // strings owned by the global token table.
+  absl::flat_hash_map<absl::string_view, TokenIndex> index_by_name_;
+};
+
+}  // namespace gematria
+
+#endif  // THIRD_PARTY_GEMATRIA_GEMATRIA_MODEL_TOKEN_VOCABULARY_H_
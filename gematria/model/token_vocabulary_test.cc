@@ -0,0 +1,149 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "gematria/model/token_vocabulary.h"
+
+#include <fstream>
+#include <ios>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "gematria/basic_block/token_table.h"
+#include "gematria/testing/matchers.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace gematria {
+namespace {
+
+using ::testing::SizeIs;
+
+std::string TempFileName(const std::string& name) {
+  return absl::StrCat(::testing::TempDir(), "/", name);
+}
+
+void WriteFile(const std::string& file_name, const std::string& contents) {
+  std::ofstream output(file_name, std::ios::binary | std::ios::trunc);
+  output.write(contents.data(), contents.size());
+  ASSERT_TRUE(output);
+}
+
+TEST(TokenVocabularyTest, FindByName) {
+  const TokenVocabulary vocabulary({"MOV", "RAX", "_ADDRESS_"});
+  EXPECT_EQ(vocabulary.size(), 3);
+  EXPECT_EQ(vocabulary.Find("MOV"), 0);
+  EXPECT_EQ(vocabulary.Find("RAX"), 1);
+  EXPECT_EQ(vocabulary.Find("_ADDRESS_"), 2);
+  EXPECT_EQ(vocabulary.Find("RBX"), TokenVocabulary::kInvalidTokenIndex);
+  EXPECT_EQ(vocabulary.Find(""), TokenVocabulary::kInvalidTokenIndex);
+
+  EXPECT_EQ(vocabulary.token(0), "MOV");
+  EXPECT_EQ(vocabulary.token(2), "_ADDRESS_");
+}
+
+TEST(TokenVocabularyTest, FindByTokenId) {
+  TokenTable& token_table = TokenTable::Global();
+  const TokenVocabulary vocabulary({"ADD", "RCX"});
+  EXPECT_THAT(vocabulary.token_ids(), SizeIs(2));
+  EXPECT_EQ(vocabulary.Find(token_table.Find("ADD")), 0);
+  EXPECT_EQ(vocabulary.Find(token_table.Find("RCX")), 1);
+  EXPECT_EQ(vocabulary.Find(TokenTable::kEmptyTokenId),
+            TokenVocabulary::kInvalidTokenIndex);
+  EXPECT_EQ(vocabulary.Find(TokenTable::kInvalidTokenId),
+            TokenVocabulary::kInvalidTokenIndex);
+
+  // Tokens interned after the vocabulary was created are not in it.
+  const TokenId new_token_id =
+      token_table.Intern("TokenVocabularyTest_FindByTokenId");
+  EXPECT_EQ(vocabulary.Find(new_token_id),
+            TokenVocabulary::kInvalidTokenIndex);
+}
+
+TEST(TokenVocabularyTest, Equality) {
+  const TokenVocabulary vocabulary({"MOV", "RAX"});
+  EXPECT_EQ(vocabulary, TokenVocabulary({"MOV", "RAX"}));
+  EXPECT_NE(vocabulary, TokenVocabulary({"RAX", "MOV"}));
+  EXPECT_NE(vocabulary, TokenVocabulary({"MOV"}));
+}
+
+TEST(TokenVocabularyTest, Snapshot) {
+  const std::string file_name = TempFileName("snapshot");
+  // Includes an empty token and a token with a NUL character.
+  const TokenVocabulary vocabulary(
+      {"MOV", "", "_ADDRESS_", std::string("A\0B", 3), "TokenVocabularyTest"});
+  ASSERT_OK(vocabulary.WriteSnapshot(file_name));
+
+  absl::StatusOr<std::shared_ptr<const TokenVocabulary>> snapshot =
+      TokenVocabulary::ReadSnapshot(file_name);
+  ASSERT_OK(snapshot);
+  EXPECT_EQ(**snapshot, vocabulary);
+  EXPECT_EQ((*snapshot)->Find("_ADDRESS_"), 2);
+  EXPECT_EQ((*snapshot)->Find(std::string("A\0B", 3)), 3);
+  EXPECT_EQ((*snapshot)->token(4), "TokenVocabularyTest");
+}
+
+TEST(TokenVocabularyTest, EmptySnapshot) {
+  const std::string file_name = TempFileName("empty_snapshot");
+  const TokenVocabulary vocabulary((std::vector<std::string>()));
+  ASSERT_OK(vocabulary.WriteSnapshot(file_name));
+  absl::StatusOr<std::shared_ptr<const TokenVocabulary>> snapshot =
+      TokenVocabulary::ReadSnapshot(file_name);
+  ASSERT_OK(snapshot);
+  EXPECT_EQ((*snapshot)->size(), 0);
+}
+
+TEST(TokenVocabularyTest, InvalidSnapshot) {
+  EXPECT_THAT(TokenVocabulary::ReadSnapshot(TempFileName("does_not_exist")),
+              StatusIs(absl::StatusCode::kNotFound));
+
+  const std::string file_name = TempFileName("invalid_snapshot");
+  ASSERT_OK(TokenVocabulary({"MOV", "RAX"}).WriteSnapshot(file_name));
+  std::string contents;
+  {
+    std::ifstream input(file_name, std::ios::binary);
+    contents.assign(std::istreambuf_iterator<char>(input),
+                    std::istreambuf_iterator<char>());
+  }
+
+  // Wrong magic.
+  std::string invalid = contents;
+  invalid[0] = 'X';
+  WriteFile(file_name, invalid);
+  EXPECT_THAT(TokenVocabulary::ReadSnapshot(file_name),
+              StatusIs(absl::StatusCode::kInvalidArgument));
+
+  // Truncated token data.
+  WriteFile(file_name, contents.substr(0, contents.size() - 1));
+  EXPECT_THAT(TokenVocabulary::ReadSnapshot(file_name),
+              StatusIs(absl::StatusCode::kInvalidArgument));
+
+  // Duplicate tokens: "MOV" and "RAX" are replaced with "MOV" and "MOV".
+  invalid = contents;
+  invalid.replace(invalid.size() - 3, 3, "MOV");
+  WriteFile(file_name, invalid);
+  EXPECT_THAT(TokenVocabulary::ReadSnapshot(file_name),
+              StatusIs(absl::StatusCode::kInvalidArgument));
+}
+
+TEST(TokenVocabularyDeathTest, DuplicateToken) {
+  EXPECT_DEATH(TokenVocabulary({"MOV", "RAX", "MOV"}), "Duplicate item");
+}
+
+}  // namespace
+}  // namespace gematria
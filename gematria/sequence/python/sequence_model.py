@@ -14,10 +14,11 @@
 """Base class for Gematria models that read basic blocks as sequences of tokens."""
 
 import abc
-from collections.abc import MutableSequence
+from collections.abc import Sequence
 from typing import Optional
 
 from gematria.basic_block.python import basic_block
+from gematria.model.python import basic_block_tokenizer
 from gematria.model.python import model_base
 from gematria.model.python import oov_token_behavior
 from gematria.model.python import token_model
@@ -74,17 +75,49 @@ class SequenceModelBase(token_model.TokenModel, model_base.ModelBase):
   # The model used for processing the data.
   _model: Optional[tf.keras.Model] = None
 
-  # Temporary lists used when transforming basic blocks from BasicBlockProto to
-  # the three tensors described above.
-  _batch_tokens: MutableSequence[int]
-  _batch_num_tokens_per_instruction: MutableSequence[int]
-  _batch_num_instructions_per_block: MutableSequence[int]
+  # The tokenizer that converts basic blocks in the batch to the three tensors
+  # described above. It uses the vocabulary and the out-of-vocabulary behavior
+  # of the model.
+  _tokenizer: basic_block_tokenizer.BasicBlockTokenizer
 
   # Inputs (tf.placeholder tensors) specific to sequence models.
   _token_sequence_placeholder: tf.Tensor
   _num_tokens_per_instruction_placeholder: tf.Tensor
   _num_instructions_per_block_placeholder: tf.Tensor
 
+  def __init__(self, **kwargs):
+    """Initializes the sequence model.
+
+    Args:
+      **kwargs: All arguments are passed to the next constructor in the chain.
+    """
+    super().__init__(**kwargs)
+    self._tokenizer = basic_block_tokenizer.BasicBlockTokenizer(
+        tokens=self._token_list,
+        out_of_vocabulary_behavior=self._oov_behavior,
+    )
+
+  # @Override
+  def validate_basic_block(self, block: basic_block.BasicBlock) -> bool:
+    """See base class."""
+    # The check in the tokenizer is much faster than the token list check in the
+    # base class; the latter is used only to log the unknown token.
+    if self._tokenizer.can_add_basic_block(block):
+      return True
+    return self.validate_basic_blockTokens(block)
+
+  # @Override
+  def validate_basic_blocks(
+      self, blocks: Sequence[basic_block.BasicBlock]
+  ) -> list[bool]:
+    """See base class."""
+    valid = self._tokenizer.can_add_basic_blocks(blocks)
+    for block, is_valid in zip(blocks, valid):
+      if not is_valid:
+        # Logs the unknown token.
+        self.validate_basic_blockTokens(block)
+    return valid
+
   @abc.abstractmethod
   def _create_model(self) -> tf.keras.Model:
     """Creates the Keras model for this class.
@@ -134,14 +167,15 @@ class SequenceModelBase(token_model.TokenModel, model_base.ModelBase):
   def _start_batch(self) -> None:
     """See base class."""
     super()._start_batch()
-    self._batch_tokens = []
-    self._batch_num_tokens_per_instruction = []
-    self._batch_num_instructions_per_block = []
+    self._tokenizer.reset()
 
   # @Override
   def _make_batch_feed_dict(self) -> model_base.FeedDict:
     """See base class."""
-    batch_tokens = np.array(self._batch_tokens, dtype=np.int32)
+    tokenizer = self._tokenizer
+    # The arrays of the tokenizer are copies, so the OOV injection can modify
+    # the token indices in place.
+    batch_tokens = np.asarray(tokenizer.token_indices, dtype=np.int32)
     if self._oov_injection_probability > 0:
       oov_injection_mask = (
           np.random.uniform(0.0, 1.0, size=batch_tokens.shape)
@@ -151,19 +185,18 @@ class SequenceModelBase(token_model.TokenModel, model_base.ModelBase):
 
     return {
         self._token_sequence_placeholder: batch_tokens,
-        self._num_tokens_per_instruction_placeholder: np.array(
-            self._batch_num_tokens_per_instruction, dtype=np.int32
-        ),
-        self._num_instructions_per_block_placeholder: np.array(
-            self._batch_num_instructions_per_block, dtype=np.int32
-        ),
+        self._num_tokens_per_instruction_placeholder: np.diff(
+            tokenizer.instruction_token_offsets
+        ).astype(np.int32),
+        self._num_instructions_per_block_placeholder: np.diff(
+            tokenizer.block_instruction_offsets
+        ).astype(np.int32),
     }
 
   # @Override
   def _add_basic_block_to_batch(self, block: basic_block.BasicBlock) -> None:
     """See base class."""
-    self._batch_num_instructions_per_block.append(len(block.instructions))
-    for instruction in block.instructions:
-      tokens = instruction.as_token_list()
-      self._batch_num_tokens_per_instruction.append(len(tokens))
-      self._batch_tokens.extend(self._token_index(token) for token in tokens)
+    if not self._tokenizer.add_basic_block(block):
+      raise token_model.TokenNotFoundError(
+          self._tokenizer.last_out_of_vocabulary_token
+      )
@@ -256,6 +256,12 @@ class SequenceModelTest(parameterized.TestCase, model_test.TestCase):
     )
     self.assertFalse(model.validate_basic_block(invalid_block))
 
+    blocks = [block.block for block in self.blocks_with_throughput]
+    self.assertEqual(
+        model.validate_basic_blocks(blocks + [invalid_block]),
+        [True] * len(blocks) + [False],
+    )
+
 
 if __name__ == '__main__':
   tf.disable_v2_behavior()
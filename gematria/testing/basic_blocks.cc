@@ -0,0 +1,128 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "gematria/testing/basic_blocks.h"
+
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <string>
+
+#include "absl/log/absl_check.h"
+#include "gematria/proto/basic_block.pb.h"
+#include "gematria/proto/canonicalized_instruction.pb.h"
+#include "gematria/proto/throughput.pb.h"
+#include "google/protobuf/text_format.h"
+#include "tools/cpp/runfiles/runfiles.h"
+
+namespace gematria {
+namespace {
+
+using ::bazel::tools::cpp::runfiles::Runfiles;
+
+constexpr char kTestDataPath[] =
+    "com_google_gematria/gematria/testing/testdata/"
+    "basic_blocks_with_throughput.pbtxt";
+
+// The general-purpose registers used by the synthetic basic blocks.
+constexpr const char* kRegisters[] = {"RAX", "RBX", "RCX", "RDX",
+                                      "RSI", "RDI", "R8",  "R9"};
+constexpr int kNumRegisters = std::size(kRegisters);
+
+void AddRegister(CanonicalizedOperandProto* operand, int register_index) {
+  operand->set_register_name(kRegisters[register_index % kNumRegisters]);
+}
+
+void AddAddress(CanonicalizedOperandProto* operand, int base_register,
+                int index_register, int displacement) {
+  CanonicalizedOperandProto::AddressTuple& address =
+      *operand->mutable_address();
+  address.set_base_register(kRegisters[base_register % kNumRegisters]);
+  if (index_register >= 0) {
+    address.set_index_register(kRegisters[index_register % kNumRegisters]);
+  }
+  address.set_displacement(displacement);
+  address.set_scaling(1);
+}
+
+}  // namespace
+
+BasicBlockWithThroughputListProto LoadBasicBlocksWithThroughputFromTestData(
+    const char* argv0) {
+  std::string error;
+  const std::unique_ptr<Runfiles> runfiles(Runfiles::Create(argv0, &error));
+  ABSL_CHECK(runfiles != nullptr) << "Could not find runfiles: " << error;
+  const std::string path = runfiles->Rlocation(kTestDataPath);
+
+  std::ifstream input(path);
+  ABSL_CHECK(input.good()) << "Could not open " << path;
+  std::stringstream contents;
+  contents << input.rdbuf();
+
+  BasicBlockWithThroughputListProto protos;
+  ABSL_CHECK(google::protobuf::TextFormat::ParseFromString(contents.str(),
+                                                           &protos))
+      << "Could not parse " << path;
+  return protos;
+}
+
+BasicBlockProto SyntheticBasicBlockProto(int num_instructions) {
+  BasicBlockProto proto;
+  for (int i = 0; i < num_instructions; ++i) {
+    CanonicalizedInstructionProto& instruction =
+        *proto.add_canonicalized_instructions();
+    switch (i % 4) {
+      case 0:
+        // MOV r64, qword ptr [base + displacement]
+        instruction.set_mnemonic("MOV");
+        instruction.set_llvm_mnemonic("MOV64rm");
+        AddRegister(instruction.add_output_operands(), i);
+        instruction.add_input_operands()->mutable_memory()->set_alias_group_id(
+            1);
+        AddAddress(instruction.add_input_operands(), i + 1, -1, 8 * i);
+        break;
+      case 1:
+        // ADD r64, r64
+        instruction.set_mnemonic("ADD");
+        instruction.set_llvm_mnemonic("ADD64rr");
+        AddRegister(instruction.add_output_operands(), i);
+        AddRegister(instruction.add_input_operands(), i);
+        AddRegister(instruction.add_input_operands(), i - 1);
+        instruction.add_implicit_output_operands()->set_register_name(
+            "EFLAGS");
+        break;
+      case 2:
+        // LEA r64, [base + index + displacement]
+        instruction.set_mnemonic("LEA");
+        instruction.set_llvm_mnemonic("LEA64r");
+        AddRegister(instruction.add_output_operands(), i);
+        AddAddress(instruction.add_input_operands(), i - 1, i - 2, 16);
+        break;
+      case 3:
+        // ADD r64, imm32
+        instruction.set_mnemonic("ADD");
+        instruction.set_llvm_mnemonic("ADD64ri32");
+        AddRegister(instruction.add_output_operands(), i);
+        AddRegister(instruction.add_input_operands(), i);
+        instruction.add_input_operands()->set_immediate_value(i);
+        instruction.add_implicit_output_operands()->set_register_name(
+            "EFLAGS");
+        break;
+    }
+  }
+  return proto;
+}
+
+}  // namespace gematria
@@ -0,0 +1,42 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Contains helpers for loading and generating basic blocks for benchmarks.
+
+#ifndef THIRD_PARTY_GEMATRIA_GEMATRIA_TESTING_BASIC_BLOCKS_H_
+#define THIRD_PARTY_GEMATRIA_GEMATRIA_TESTING_BASIC_BLOCKS_H_
+
+#include "gematria/proto/basic_block.pb.h"
+#include "gematria/proto/throughput.pb.h"
+
+namespace gematria {
+
+// Loads the basic blocks from
+// gematria/testing/testdata/basic_blocks_with_throughput.pbtxt. `argv0` is the
+// path of the binary; it is used to find the runfiles when the binary is not
+// run as a test. The binary must have the file in its `data` dependencies.
+// Dies when the file can't be found or parsed.
+BasicBlockWithThroughputListProto LoadBasicBlocksWithThroughputFromTestData(
+    const char* argv0);
+
+// Creates a synthetic basic block with `num_instructions` instructions. The
+// block uses a small set of x86-64 instructions (MOV, ADD, LEA) with register,
+// immediate, address and memory operands, and its instructions depend on each
+// other through registers and memory. The block is deterministic, i.e. the
+// same value of `num_instructions` always produces the same block.
+BasicBlockProto SyntheticBasicBlockProto(int num_instructions);
+
+}  // namespace gematria
+
+#endif  // THIRD_PARTY_GEMATRIA_GEMATRIA_TESTING_BASIC_BLOCKS_H_
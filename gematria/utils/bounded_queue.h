@@ -0,0 +1,239 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// A bounded multi-producer multi-consumer queue that connects the stages of a
+// pipeline, e.g. the reader of the input and the workers that process it.
+//
+// The queue is a ring buffer of slots with sequence numbers, as described by
+// Dmitry Vyukov in "Bounded MPMC queue"; TryPush() and TryPop() are lock-free
+// and each of them does a single compare-and-swap in the common case. The
+// blocking Push() and Pop() provide backpressure: a producer that is faster
+// than the consumers waits until there is space in the queue. The threads
+// waiting in Push() and Pop() sleep on a mutex, and the mutex is touched by the
+// other side only when there is a waiting thread.
+
+#ifndef THIRD_PARTY_GEMATRIA_GEMATRIA_UTILS_BOUNDED_QUEUE_H_
+#define THIRD_PARTY_GEMATRIA_GEMATRIA_UTILS_BOUNDED_QUEUE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <utility>
+
+#include "absl/log/absl_check.h"
+#include "absl/synchronization/mutex.h"
+
+namespace gematria {
+
+// A queue of at most `capacity` values of type `T`. All methods are
+// thread-safe. `T` must be movable.
+//
+// Typical use:
+//   BoundedQueue<Batch> queue(/*capacity=*/16);
+//   // Producer:
+//   while (std::optional<Batch> batch = ReadBatch()) queue.Push(*batch);
+//   queue.Close();
+//   // Consumers:
+//   while (std::optional<Batch> batch = queue.Pop()) Process(*batch);
+template <typename T>
+class BoundedQueue {
+ public:
+  explicit BoundedQueue(size_t capacity)
+      : capacity_(capacity), slots_(std::make_unique<Slot[]>(capacity)) {
+    ABSL_CHECK_GT(capacity, 0);
+    for (size_t i = 0; i < capacity; ++i) {
+      slots_[i].sequence.store(2 * i, std::memory_order_relaxed);
+    }
+  }
+
+  BoundedQueue(const BoundedQueue&) = delete;
+  BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+  // Returns the maximal number of values in the queue.
+  size_t capacity() const { return capacity_; }
+
+  // Returns the number of values in the queue. The value is approximate when
+  // other threads modify the queue at the same time.
+  size_t size() const {
+    const uint64_t end = push_position_.load(std::memory_order_acquire);
+    const uint64_t begin = pop_position_.load(std::memory_order_acquire);
+    return end > begin ? static_cast<size_t>(end - begin) : 0;
+  }
+  bool empty() const { return size() == 0; }
+
+  // Adds `value` to the queue when there is space in it. Returns true when the
+  // value was added; otherwise, returns false and leaves `value` unchanged.
+  // Does not check whether the queue is closed.
+  bool TryPush(T&& value) {
+    if (!TryPushWithoutNotification(value)) return false;
+    NotifyWaiters(num_waiting_consumers_);
+    return true;
+  }
+
+  // Removes the oldest value from the queue. Returns std::nullopt when the
+  // queue is empty.
+  std::optional<T> TryPop() {
+    std::optional<T> value = TryPopWithoutNotification();
+    if (value.has_value()) NotifyWaiters(num_waiting_producers_);
+    return value;
+  }
+
+  // Adds `value` to the queue, waiting until there is space in it. Returns
+  // false and drops the value when the queue is closed before the value could
+  // be added.
+  bool Push(T value) {
+    while (true) {
+      if (closed_.load(std::memory_order_acquire)) return false;
+      if (TryPush(std::move(value))) return true;
+      absl::MutexLock lock(&mutex_);
+      // The increment must be visible before the waiting thread checks the
+      // queue in the condition; see NotifyWaiters().
+      num_waiting_producers_.fetch_add(1, std::memory_order_seq_cst);
+      mutex_.Await(absl::Condition(this, &BoundedQueue::CanPushOrClosed));
+      num_waiting_producers_.fetch_sub(1, std::memory_order_relaxed);
+    }
+  }
+
+  // Removes the oldest value from the queue, waiting until there is one.
+  // Returns std::nullopt when the queue is closed and empty.
+  std::optional<T> Pop() {
+    while (true) {
+      std::optional<T> value = TryPop();
+      if (value.has_value()) return value;
+      if (closed_.load(std::memory_order_acquire)) {
+        // Values pushed before the queue was closed are still returned.
+        return TryPop();
+      }
+      absl::MutexLock lock(&mutex_);
+      num_waiting_consumers_.fetch_add(1, std::memory_order_seq_cst);
+      mutex_.Await(absl::Condition(this, &BoundedQueue::CanPopOrClosed));
+      num_waiting_consumers_.fetch_sub(1, std::memory_order_relaxed);
+    }
+  }
+
+  // Closes the queue. Wakes up all threads waiting in Push() and Pop(); Push()
+  // fails from now on, and Pop() fails once the values that are already in the
+  // queue are removed. A producer closes the queue after pushing its last
+  // value; a consumer may close it to stop the producers early.
+  void Close() {
+    absl::MutexLock lock(&mutex_);
+    closed_.store(true, std::memory_order_release);
+  }
+
+  bool closed() const { return closed_.load(std::memory_order_acquire); }
+
+ private:
+  struct Slot {
+    // The state of the slot: 2 * position when the slot is empty and the value
+    // at `position` can be pushed to it, and 2 * position + 1 when it contains
+    // the value at `position`. Unlike the original algorithm, which uses
+    // `position` and `position + 1`, this distinguishes the two states also
+    // when the capacity is one.
+    std::atomic<uint64_t> sequence;
+    std::optional<T> value;
+  };
+
+  bool TryPushWithoutNotification(T& value) {
+    uint64_t position = push_position_.load(std::memory_order_relaxed);
+    while (true) {
+      Slot& slot = slots_[position % capacity_];
+      const uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+      const int64_t diff =
+          static_cast<int64_t>(sequence) - static_cast<int64_t>(2 * position);
+      if (diff == 0) {
+        if (push_position_.compare_exchange_weak(position, position + 1,
+                                                 std::memory_order_relaxed)) {
+          slot.value.emplace(std::move(value));
+          slot.sequence.store(2 * position + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;  // The queue is full.
+      } else {
+        position = push_position_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  std::optional<T> TryPopWithoutNotification() {
+    uint64_t position = pop_position_.load(std::memory_order_relaxed);
+    while (true) {
+      Slot& slot = slots_[position % capacity_];
+      const uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+      const int64_t diff = static_cast<int64_t>(sequence) -
+                           static_cast<int64_t>(2 * position + 1);
+      if (diff == 0) {
+        if (pop_position_.compare_exchange_weak(position, position + 1,
+                                                std::memory_order_relaxed)) {
+          std::optional<T> value = std::move(slot.value);
+          slot.value.reset();
+          slot.sequence.store(2 * (position + capacity_),
+                              std::memory_order_release);
+          return value;
+        }
+      } else if (diff < 0) {
+        return std::nullopt;  // The queue is empty.
+      } else {
+        position = pop_position_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Wakes up the threads waiting on the other side of the queue, if there are
+  // any. The fence orders the update of the slot before the load of the number
+  // of waiting threads; together with the sequentially consistent increment in
+  // Push() and Pop(), either this thread sees the waiting thread, or the
+  // waiting thread sees the update when it evaluates its condition. Releasing
+  // the mutex re-evaluates the conditions of the waiting threads.
+  void NotifyWaiters(const std::atomic<int>& num_waiting) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (num_waiting.load(std::memory_order_relaxed) > 0) {
+      absl::MutexLock lock(&mutex_);
+    }
+  }
+
+  bool CanPushOrClosed() const {
+    const uint64_t position = push_position_.load(std::memory_order_seq_cst);
+    const uint64_t sequence =
+        slots_[position % capacity_].sequence.load(std::memory_order_seq_cst);
+    return sequence >= 2 * position ||
+           closed_.load(std::memory_order_relaxed);
+  }
+  bool CanPopOrClosed() const {
+    const uint64_t position = pop_position_.load(std::memory_order_seq_cst);
+    const uint64_t sequence =
+        slots_[position % capacity_].sequence.load(std::memory_order_seq_cst);
+    return sequence >= 2 * position + 1 ||
+           closed_.load(std::memory_order_relaxed);
+  }
+
+  const size_t capacity_;
+  const std::unique_ptr<Slot[]> slots_;
+
+  alignas(64) std::atomic<uint64_t> push_position_ = 0;
+  alignas(64) std::atomic<uint64_t> pop_position_ = 0;
+
+  alignas(64) std::atomic<int> num_waiting_producers_ = 0;
+  std::atomic<int> num_waiting_consumers_ = 0;
+  std::atomic<bool> closed_ = false;
+  // Used only by the waiting threads; the state of the queue is not guarded by
+  // the mutex.
+  absl::Mutex mutex_;
+};
+
+}  // namespace gematria
+
+#endif  // THIRD_PARTY_GEMATRIA_GEMATRIA_UTILS_BOUNDED_QUEUE_H_
@@ -0,0 +1,146 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "gematria/utils/bounded_queue.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <thread>  // NOLINT(build/c++11)
+#include <utility>
+#include <vector>
+
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace gematria {
+namespace {
+
+using ::testing::Optional;
+using ::testing::Pointee;
+
+TEST(BoundedQueueTest, TryPushAndTryPop) {
+  BoundedQueue<std::unique_ptr<int>> queue(/*capacity=*/2);
+  EXPECT_EQ(queue.capacity(), 2);
+  EXPECT_TRUE(queue.empty());
+  EXPECT_EQ(queue.TryPop(), std::nullopt);
+
+  EXPECT_TRUE(queue.TryPush(std::make_unique<int>(1)));
+  EXPECT_TRUE(queue.TryPush(std::make_unique<int>(2)));
+  EXPECT_EQ(queue.size(), 2);
+  // The value is not moved when the queue is full.
+  auto value = std::make_unique<int>(3);
+  EXPECT_FALSE(queue.TryPush(std::move(value)));
+  EXPECT_THAT(value, Pointee(3));
+
+  EXPECT_THAT(queue.TryPop(), Optional(Pointee(1)));
+  EXPECT_TRUE(queue.TryPush(std::move(value)));
+  EXPECT_THAT(queue.TryPop(), Optional(Pointee(2)));
+  EXPECT_THAT(queue.TryPop(), Optional(Pointee(3)));
+  EXPECT_EQ(queue.TryPop(), std::nullopt);
+  EXPECT_TRUE(queue.empty());
+}
+
+TEST(BoundedQueueTest, PushWaitsForSpace) {
+  BoundedQueue<int> queue(/*capacity=*/1);
+  EXPECT_TRUE(queue.Push(1));
+  std::atomic<bool> pushed = false;
+  std::thread producer([&]() {
+    EXPECT_TRUE(queue.Push(2));
+    pushed = true;
+  });
+  absl::SleepFor(absl::Milliseconds(50));
+  EXPECT_FALSE(pushed.load());
+  EXPECT_THAT(queue.Pop(), Optional(1));
+  producer.join();
+  EXPECT_TRUE(pushed.load());
+  EXPECT_THAT(queue.Pop(), Optional(2));
+}
+
+TEST(BoundedQueueTest, PopWaitsForValue) {
+  BoundedQueue<int> queue(/*capacity=*/4);
+  std::optional<int> value;
+  std::thread consumer([&]() { value = queue.Pop(); });
+  absl::SleepFor(absl::Milliseconds(10));
+  EXPECT_TRUE(queue.Push(7));
+  consumer.join();
+  EXPECT_THAT(value, Optional(7));
+}
+
+TEST(BoundedQueueTest, Close) {
+  BoundedQueue<int> queue(/*capacity=*/4);
+  EXPECT_TRUE(queue.Push(1));
+  EXPECT_TRUE(queue.Push(2));
+  queue.Close();
+  EXPECT_TRUE(queue.closed());
+  EXPECT_FALSE(queue.Push(3));
+  // The values pushed before closing the queue are still returned.
+  EXPECT_THAT(queue.Pop(), Optional(1));
+  EXPECT_THAT(queue.Pop(), Optional(2));
+  EXPECT_EQ(queue.Pop(), std::nullopt);
+}
+
+TEST(BoundedQueueTest, CloseWakesUpWaitingThreads) {
+  BoundedQueue<int> empty_queue(/*capacity=*/1);
+  std::thread consumer(
+      [&]() { EXPECT_EQ(empty_queue.Pop(), std::nullopt); });
+  BoundedQueue<int> full_queue(/*capacity=*/1);
+  EXPECT_TRUE(full_queue.Push(1));
+  std::thread producer([&]() { EXPECT_FALSE(full_queue.Push(2)); });
+  absl::SleepFor(absl::Milliseconds(10));
+  empty_queue.Close();
+  full_queue.Close();
+  consumer.join();
+  producer.join();
+}
+
+TEST(BoundedQueueTest, MultipleProducersAndConsumers) {
+  constexpr int kNumProducers = 4;
+  constexpr int kNumConsumers = 4;
+  constexpr int kNumValuesPerProducer = 10000;
+  BoundedQueue<int> queue(/*capacity=*/8);
+  std::atomic<int64_t> sum = 0;
+  std::atomic<int> num_values = 0;
+
+  std::vector<std::thread> consumers;
+  for (int i = 0; i < kNumConsumers; ++i) {
+    consumers.emplace_back([&]() {
+      while (std::optional<int> value = queue.Pop()) {
+        sum.fetch_add(*value);
+        num_values.fetch_add(1);
+      }
+    });
+  }
+  std::vector<std::thread> producers;
+  for (int i = 0; i < kNumProducers; ++i) {
+    producers.emplace_back([&queue, i]() {
+      for (int j = 0; j < kNumValuesPerProducer; ++j) {
+        EXPECT_TRUE(queue.Push(i * kNumValuesPerProducer + j));
+      }
+    });
+  }
+  for (std::thread& producer : producers) producer.join();
+  queue.Close();
+  for (std::thread& consumer : consumers) consumer.join();
+
+  constexpr int64_t kNumValues = kNumProducers * kNumValuesPerProducer;
+  EXPECT_EQ(num_values.load(), kNumValues);
+  EXPECT_EQ(sum.load(), kNumValues * (kNumValues - 1) / 2);
+}
+
+}  // namespace
+}  // namespace gematria
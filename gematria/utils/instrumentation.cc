@@ -0,0 +1,294 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "gematria/utils/instrumentation.h"
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_set.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+
+namespace gematria {
+namespace instrumentation_internal {
+
+std::atomic<bool> tracing_enabled = false;
+
+namespace {
+
+// The maximal number of trace events kept in memory. With about 40 bytes per
+// event, the trace takes at most ~40 MiB.
+constexpr size_t kMaxTraceEvents = 1 << 20;
+
+// The values of all counters and stage timers, in a form that can be added and
+// subtracted.
+struct Totals {
+  std::array<int64_t, kNumInstrumentationCounters> counters = {};
+  std::array<int64_t, kNumInstrumentationStages> num_calls = {};
+  std::array<int64_t, kNumInstrumentationStages> nanoseconds = {};
+
+  void Add(const ThreadData& data) {
+    for (int i = 0; i < kNumInstrumentationCounters; ++i) {
+      counters[i] += data.counters[i].load(std::memory_order_relaxed);
+    }
+    for (int i = 0; i < kNumInstrumentationStages; ++i) {
+      num_calls[i] += data.num_calls[i].load(std::memory_order_relaxed);
+      nanoseconds[i] += data.nanoseconds[i].load(std::memory_order_relaxed);
+    }
+  }
+  void Subtract(const Totals& other) {
+    for (int i = 0; i < kNumInstrumentationCounters; ++i) {
+      counters[i] -= other.counters[i];
+    }
+    for (int i = 0; i < kNumInstrumentationStages; ++i) {
+      num_calls[i] -= other.num_calls[i];
+      nanoseconds[i] -= other.nanoseconds[i];
+    }
+  }
+};
+
+struct TraceEvent {
+  InstrumentationStage stage;
+  int thread_id;
+  int64_t start_nanoseconds;
+  int64_t end_nanoseconds;
+};
+
+class Registry {
+ public:
+  static Registry& Get() {
+    // The registry is never destroyed, so that it can be used by threads that
+    // exit after the static objects of the process were destroyed.
+    static Registry* const registry = new Registry();
+    return *registry;
+  }
+
+  int Register(ThreadData* data) {
+    absl::MutexLock lock(&mutex_);
+    threads_.insert(data);
+    return next_thread_id_++;
+  }
+
+  void Unregister(ThreadData* data) {
+    absl::MutexLock lock(&mutex_);
+    threads_.erase(data);
+    exited_threads_.Add(*data);
+  }
+
+  // Returns the totals since the start of the process.
+  Totals GetTotals() {
+    absl::MutexLock lock(&mutex_);
+    return GetTotalsLocked();
+  }
+
+  // Returns the totals since the last reset.
+  Totals GetTotalsSinceReset() {
+    absl::MutexLock lock(&mutex_);
+    Totals totals = GetTotalsLocked();
+    totals.Subtract(baseline_);
+    return totals;
+  }
+
+  void Reset() {
+    absl::MutexLock lock(&mutex_);
+    baseline_ = GetTotalsLocked();
+  }
+
+  void RecordTraceEvent(const TraceEvent& event) {
+    absl::MutexLock lock(&trace_mutex_);
+    if (trace_events_.size() >= kMaxTraceEvents) {
+      ++num_dropped_trace_events_;
+      return;
+    }
+    trace_events_.push_back(event);
+  }
+
+  std::vector<TraceEvent> GetTraceEvents(int64_t& num_dropped_events) {
+    absl::MutexLock lock(&trace_mutex_);
+    num_dropped_events = num_dropped_trace_events_;
+    return trace_events_;
+  }
+
+  void ClearTrace() {
+    absl::MutexLock lock(&trace_mutex_);
+    trace_events_.clear();
+    num_dropped_trace_events_ = 0;
+  }
+
+ private:
+  Totals GetTotalsLocked() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+    Totals totals = exited_threads_;
+    for (const ThreadData* const data : threads_) totals.Add(*data);
+    return totals;
+  }
+
+  absl::Mutex mutex_;
+  absl::flat_hash_set<ThreadData*> threads_ ABSL_GUARDED_BY(mutex_);
+  // The values accumulated by threads that already exited.
+  Totals exited_threads_ ABSL_GUARDED_BY(mutex_);
+  // The totals at the time of the last reset.
+  Totals baseline_ ABSL_GUARDED_BY(mutex_);
+  int next_thread_id_ ABSL_GUARDED_BY(mutex_) = 1;
+
+  absl::Mutex trace_mutex_;
+  std::vector<TraceEvent> trace_events_ ABSL_GUARDED_BY(trace_mutex_);
+  int64_t num_dropped_trace_events_ ABSL_GUARDED_BY(trace_mutex_) = 0;
+};
+
+// Formats a time in nanoseconds as microseconds, the time unit of the Chrome
+// trace event format.
+std::string Microseconds(int64_t nanoseconds) {
+  return absl::StrCat(nanoseconds / 1000, ".",
+                      absl::Dec(nanoseconds % 1000, absl::kZeroPad3));
+}
+
+}  // namespace
+
+ThreadRegistration::ThreadRegistration() {
+  data.thread_id = Registry::Get().Register(&data);
+#ifdef __linux__
+  // Use the ID of the thread in the OS when available, so that the events can
+  // be matched with other traces of the process, and with the events recorded
+  // by other copies of the instrumentation library in the same process.
+  data.thread_id = static_cast<int>(syscall(SYS_gettid));
+#endif  // __linux__
+}
+
+ThreadRegistration::~ThreadRegistration() {
+  Registry::Get().Unregister(&data);
+}
+
+void RecordTraceEvent(InstrumentationStage stage, int thread_id,
+                      int64_t start_nanoseconds, int64_t end_nanoseconds) {
+  Registry::Get().RecordTraceEvent(
+      TraceEvent{stage, thread_id, start_nanoseconds, end_nanoseconds});
+}
+
+}  // namespace instrumentation_internal
+
+absl::string_view InstrumentationCounterName(InstrumentationCounter counter) {
+  switch (counter) {
+    case InstrumentationCounter::kBytesDisassembled:
+      return "bytes_disassembled";
+    case InstrumentationCounter::kInstructionsDisassembled:
+      return "instructions_disassembled";
+    case InstrumentationCounter::kDisassemblyFailures:
+      return "disassembly_failures";
+    case InstrumentationCounter::kInstructionsCanonicalized:
+      return "instructions_canonicalized";
+    case InstrumentationCounter::kOutOfVocabularyTokens:
+      return "out_of_vocabulary_tokens";
+    case InstrumentationCounter::kGraphNodesAdded:
+      return "graph_nodes_added";
+    case InstrumentationCounter::kGraphEdgesAdded:
+      return "graph_edges_added";
+    case InstrumentationCounter::kNumCounters:
+      break;
+  }
+  return "unknown";
+}
+
+absl::string_view InstrumentationStageName(InstrumentationStage stage) {
+  switch (stage) {
+    case InstrumentationStage::kDisassembleAllInstructions:
+      return "DisassembleAllInstructions";
+    case InstrumentationStage::kInstructionFromMCInst:
+      return "Canonicalizer::InstructionFromMCInst";
+    case InstrumentationStage::kAddBasicBlock:
+      return "BasicBlockGraphBuilder::AddBasicBlock";
+    case InstrumentationStage::kNumStages:
+      break;
+  }
+  return "unknown";
+}
+
+InstrumentationSnapshot GetInstrumentationSnapshot() {
+  const instrumentation_internal::Totals totals =
+      instrumentation_internal::Registry::Get().GetTotalsSinceReset();
+  InstrumentationSnapshot snapshot;
+  for (int i = 0; i < kNumInstrumentationCounters; ++i) {
+    snapshot.counters.emplace(
+        InstrumentationCounterName(static_cast<InstrumentationCounter>(i)),
+        totals.counters[i]);
+  }
+  for (int i = 0; i < kNumInstrumentationStages; ++i) {
+    snapshot.stages.emplace(
+        InstrumentationStageName(static_cast<InstrumentationStage>(i)),
+        InstrumentationStageStats{totals.num_calls[i], totals.nanoseconds[i]});
+  }
+  return snapshot;
+}
+
+void ResetInstrumentation() {
+  instrumentation_internal::Registry::Get().Reset();
+}
+
+void SetInstrumentationTracingEnabled(bool enabled) {
+  instrumentation_internal::tracing_enabled.store(enabled,
+                                                  std::memory_order_relaxed);
+}
+
+bool IsInstrumentationTracingEnabled() {
+  return instrumentation_internal::tracing_enabled.load(
+      std::memory_order_relaxed);
+}
+
+std::string InstrumentationTraceToChromeJson() {
+  using instrumentation_internal::Microseconds;
+  int64_t num_dropped_events = 0;
+  const std::vector<instrumentation_internal::TraceEvent> events =
+      instrumentation_internal::Registry::Get().GetTraceEvents(
+          num_dropped_events);
+  const int pid = static_cast<int>(getpid());
+
+  // None of the names contain characters that would need escaping in JSON.
+  std::string json = "{\"traceEvents\":[";
+  for (const instrumentation_internal::TraceEvent& event : events) {
+    const int64_t duration = event.end_nanoseconds - event.start_nanoseconds;
+    absl::StrAppend(&json, "{\"name\":\"",
+                    InstrumentationStageName(event.stage),
+                    "\",\"cat\":\"gematria\",\"ph\":\"X\",\"ts\":",
+                    Microseconds(event.start_nanoseconds),
+                    ",\"dur\":", Microseconds(duration), ",\"pid\":", pid,
+                    ",\"tid\":", event.thread_id, "},");
+  }
+  const InstrumentationSnapshot snapshot = GetInstrumentationSnapshot();
+  absl::StrAppend(
+      &json, "{\"name\":\"gematria_counters\",\"ph\":\"C\",\"ts\":",
+      Microseconds(instrumentation_internal::NowNanoseconds()),
+      ",\"pid\":", pid, ",\"args\":{");
+  absl::string_view separator = "";
+  for (const auto& [name, value] : snapshot.counters) {
+    absl::StrAppend(&json, separator, "\"", name, "\":", value);
+    separator = ",";
+  }
+  absl::StrAppend(&json, "}}],\"otherData\":{\"num_dropped_events\":",
+                  num_dropped_events, "}}");
+  return json;
+}
+
+void ClearInstrumentationTrace() {
+  instrumentation_internal::Registry::Get().ClearTrace();
+}
+
+}  // namespace gematria
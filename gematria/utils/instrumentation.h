@@ -0,0 +1,241 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Contains lightweight instrumentation of the hot paths of the C++ pipeline:
+// event counters (e.g. the number of disassembled instructions or emitted
+// graph nodes) and timers of the main processing stages. The data can be
+// exported as a snapshot, and the stage timers can optionally record trace
+// events in the Chrome trace event format, which can be loaded into Perfetto
+// or chrome://tracing.
+//
+// The counters are kept per thread, so that updating them does not need any
+// synchronization with other threads. Building with
+// -DGEMATRIA_DISABLE_INSTRUMENTATION removes all instrumentation code from the
+// instrumented functions; the export functions remain available, but they
+// return only zeros.
+
+#ifndef THIRD_PARTY_GEMATRIA_GEMATRIA_UTILS_INSTRUMENTATION_H_
+#define THIRD_PARTY_GEMATRIA_GEMATRIA_UTILS_INSTRUMENTATION_H_
+
+#include <array>
+#include <atomic>
+#include <chrono>  // NOLINT(build/c++11)
+#include <cstdint>
+#include <map>
+#include <string>
+
+#include "absl/strings/string_view.h"
+
+namespace gematria {
+
+#ifdef GEMATRIA_DISABLE_INSTRUMENTATION
+inline constexpr bool kInstrumentationEnabled = false;
+#else
+inline constexpr bool kInstrumentationEnabled = true;
+#endif
+
+// The events counted by the instrumentation.
+enum class InstrumentationCounter {
+  // The number of bytes of machine code consumed by successfully disassembled
+  // instructions.
+  kBytesDisassembled,
+  // The number of successfully disassembled instructions.
+  kInstructionsDisassembled,
+  // The number of instructions that could not be disassembled.
+  kDisassemblyFailures,
+  // The number of instructions converted by Canonicalizer.
+  kInstructionsCanonicalized,
+  // The number of out-of-vocabulary tokens encountered by the graph builder
+  // and the tokenizer, including tokens that were replaced.
+  kOutOfVocabularyTokens,
+  // The numbers of nodes and edges of the basic block graphs that were added
+  // to a graph builder.
+  kGraphNodesAdded,
+  kGraphEdgesAdded,
+
+  // The number of counters. Must be the last value of the enum.
+  kNumCounters,
+};
+
+// The stages of the pipeline measured by the instrumentation timers.
+enum class InstrumentationStage {
+  kDisassembleAllInstructions,
+  kInstructionFromMCInst,
+  kAddBasicBlock,
+
+  // The number of stages. Must be the last value of the enum.
+  kNumStages,
+};
+
+inline constexpr int kNumInstrumentationCounters =
+    static_cast<int>(InstrumentationCounter::kNumCounters);
+inline constexpr int kNumInstrumentationStages =
+    static_cast<int>(InstrumentationStage::kNumStages);
+
+// Returns the name of the counter or stage used in the snapshots and in the
+// trace events, e.g. "instructions_disassembled".
+absl::string_view InstrumentationCounterName(InstrumentationCounter counter);
+absl::string_view InstrumentationStageName(InstrumentationStage stage);
+
+// The accumulated statistics of one stage.
+struct InstrumentationStageStats {
+  // The number of times the stage was entered.
+  int64_t num_calls = 0;
+  // The total time spent in the stage, in nanoseconds.
+  int64_t total_nanoseconds = 0;
+};
+
+// A snapshot of all counters and stage timers, summed over all threads.
+// Counters and stages are indexed by their names.
+struct InstrumentationSnapshot {
+  std::map<std::string, int64_t> counters;
+  std::map<std::string, InstrumentationStageStats> stages;
+};
+
+// Returns the values accumulated since the start of the process or since the
+// last call to ResetInstrumentation(). Can be called from any thread; values
+// updated concurrently by other threads may or may not be included.
+InstrumentationSnapshot GetInstrumentationSnapshot();
+
+// Resets all counters and stage timers to zero. Does not affect the recorded
+// trace events.
+void ResetInstrumentation();
+
+// Enables or disables recording of trace events. When enabled, each stage
+// timer records a "complete" trace event. The number of recorded events is
+// limited; events beyond the limit are dropped.
+void SetInstrumentationTracingEnabled(bool enabled);
+bool IsInstrumentationTracingEnabled();
+
+// Returns the recorded trace events in the Chrome trace event JSON format.
+// The current values of the counters are added as a counter event at the end
+// of the trace.
+std::string InstrumentationTraceToChromeJson();
+
+// Removes all recorded trace events.
+void ClearInstrumentationTrace();
+
+namespace instrumentation_internal {
+
+// The instrumentation data of a single thread. The data is updated only by
+// the thread that owns it, and it is read by the export functions; the
+// atomics are used only with relaxed memory ordering, so that the updates are
+// plain loads and stores on common architectures.
+struct ThreadData {
+  std::array<std::atomic<int64_t>, kNumInstrumentationCounters> counters = {};
+  std::array<std::atomic<int64_t>, kNumInstrumentationStages> num_calls = {};
+  std::array<std::atomic<int64_t>, kNumInstrumentationStages> nanoseconds = {};
+  // The ID of the thread used in the trace events.
+  int thread_id = 0;
+};
+
+// Registers the data of the current thread with the global registry, and
+// unregisters it when the thread exits; the values of the counters of exited
+// threads are kept in the snapshots.
+class ThreadRegistration {
+ public:
+  ThreadRegistration();
+  ~ThreadRegistration();
+
+  ThreadRegistration(const ThreadRegistration&) = delete;
+  ThreadRegistration& operator=(const ThreadRegistration&) = delete;
+
+  ThreadData data;
+};
+
+inline ThreadData& CurrentThreadData() {
+  thread_local ThreadRegistration registration;
+  return registration.data;
+}
+
+inline void Add(std::atomic<int64_t>& value, int64_t delta) {
+  value.store(value.load(std::memory_order_relaxed) + delta,
+              std::memory_order_relaxed);
+}
+
+extern std::atomic<bool> tracing_enabled;
+
+// Records a trace event; `start` and `end` are in nanoseconds since the epoch
+// of the steady clock.
+void RecordTraceEvent(InstrumentationStage stage, int thread_id,
+                      int64_t start_nanoseconds, int64_t end_nanoseconds);
+
+inline int64_t NowNanoseconds() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+}  // namespace instrumentation_internal
+
+// Adds `delta` to `counter` in the data of the current thread.
+inline void AddToInstrumentationCounter(InstrumentationCounter counter,
+                                        int64_t delta = 1) {
+  if constexpr (kInstrumentationEnabled) {
+    instrumentation_internal::Add(
+        instrumentation_internal::CurrentThreadData()
+            .counters[static_cast<int>(counter)],
+        delta);
+  }
+}
+
+// Measures the time between the construction and destruction of the object,
+// and adds it to the statistics of `stage`. Typical usage:
+//
+//   void ExpensiveStage() {
+//     ScopedInstrumentationTimer timer(InstrumentationStage::kAddBasicBlock);
+//     ...
+//   }
+class ScopedInstrumentationTimer {
+ public:
+  explicit ScopedInstrumentationTimer(
+      [[maybe_unused]] InstrumentationStage stage)
+#ifndef GEMATRIA_DISABLE_INSTRUMENTATION
+      : stage_(stage),
+        start_nanoseconds_(instrumentation_internal::NowNanoseconds())
+#endif
+  {
+  }
+
+  ~ScopedInstrumentationTimer() {
+#ifndef GEMATRIA_DISABLE_INSTRUMENTATION
+    const int64_t end_nanoseconds = instrumentation_internal::NowNanoseconds();
+    instrumentation_internal::ThreadData& data =
+        instrumentation_internal::CurrentThreadData();
+    const int stage_index = static_cast<int>(stage_);
+    instrumentation_internal::Add(data.num_calls[stage_index], 1);
+    instrumentation_internal::Add(data.nanoseconds[stage_index],
+                                  end_nanoseconds - start_nanoseconds_);
+    if (instrumentation_internal::tracing_enabled.load(
+            std::memory_order_relaxed)) {
+      instrumentation_internal::RecordTraceEvent(
+          stage_, data.thread_id, start_nanoseconds_, end_nanoseconds);
+    }
+#endif
+  }
+
+  ScopedInstrumentationTimer(const ScopedInstrumentationTimer&) = delete;
+  ScopedInstrumentationTimer& operator=(const ScopedInstrumentationTimer&) =
+      delete;
+
+ private:
+#ifndef GEMATRIA_DISABLE_INSTRUMENTATION
+  const InstrumentationStage stage_;
+  const int64_t start_nanoseconds_;
+#endif
+};
+
+}  // namespace gematria
+
+#endif  // THIRD_PARTY_GEMATRIA_GEMATRIA_UTILS_INSTRUMENTATION_H_
@@ -0,0 +1,130 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "gematria/utils/instrumentation.h"
+
+#include <string>
+#include <thread>  // NOLINT(build/c++11)
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace gematria {
+namespace {
+
+using ::testing::Contains;
+using ::testing::Field;
+using ::testing::HasSubstr;
+using ::testing::Key;
+using ::testing::Not;
+using ::testing::Pair;
+
+class InstrumentationTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    if (!kInstrumentationEnabled) {
+      GTEST_SKIP() << "Instrumentation is disabled in this build.";
+    }
+    ResetInstrumentation();
+    ClearInstrumentationTrace();
+  }
+  void TearDown() override { SetInstrumentationTracingEnabled(false); }
+};
+
+TEST_F(InstrumentationTest, AllCountersAndStagesHaveNames) {
+  const InstrumentationSnapshot snapshot = GetInstrumentationSnapshot();
+  EXPECT_EQ(snapshot.counters.size(), kNumInstrumentationCounters);
+  EXPECT_EQ(snapshot.stages.size(), kNumInstrumentationStages);
+  EXPECT_THAT(snapshot.counters, Not(Contains(Key("unknown"))));
+  EXPECT_THAT(snapshot.stages, Not(Contains(Key("unknown"))));
+}
+
+TEST_F(InstrumentationTest, Counters) {
+  AddToInstrumentationCounter(InstrumentationCounter::kGraphNodesAdded, 5);
+  AddToInstrumentationCounter(InstrumentationCounter::kGraphNodesAdded, 2);
+  AddToInstrumentationCounter(InstrumentationCounter::kGraphEdgesAdded);
+  const InstrumentationSnapshot snapshot = GetInstrumentationSnapshot();
+  EXPECT_THAT(snapshot.counters, Contains(Pair("graph_nodes_added", 7)));
+  EXPECT_THAT(snapshot.counters, Contains(Pair("graph_edges_added", 1)));
+  EXPECT_THAT(snapshot.counters, Contains(Pair("bytes_disassembled", 0)));
+
+  ResetInstrumentation();
+  EXPECT_THAT(GetInstrumentationSnapshot().counters,
+              Contains(Pair("graph_nodes_added", 0)));
+}
+
+TEST_F(InstrumentationTest, CountersFromOtherThreads) {
+  constexpr int kNumThreads = 4;
+  constexpr int kNumIncrements = 1000;
+  std::thread threads[kNumThreads];
+  for (std::thread& thread : threads) {
+    thread = std::thread([]() {
+      for (int i = 0; i < kNumIncrements; ++i) {
+        AddToInstrumentationCounter(
+            InstrumentationCounter::kInstructionsDisassembled);
+      }
+    });
+  }
+  for (std::thread& thread : threads) thread.join();
+  // The threads have exited, but their values must still be in the snapshot.
+  EXPECT_THAT(GetInstrumentationSnapshot().counters,
+              Contains(Pair("instructions_disassembled",
+                            kNumThreads * kNumIncrements)));
+}
+
+TEST_F(InstrumentationTest, ScopedTimer) {
+  for (int i = 0; i < 3; ++i) {
+    ScopedInstrumentationTimer timer(InstrumentationStage::kAddBasicBlock);
+  }
+  const InstrumentationSnapshot snapshot = GetInstrumentationSnapshot();
+  EXPECT_THAT(snapshot.stages,
+              Contains(Pair("BasicBlockGraphBuilder::AddBasicBlock",
+                            Field(&InstrumentationStageStats::num_calls, 3))));
+  EXPECT_THAT(snapshot.stages,
+              Contains(Pair("DisassembleAllInstructions",
+                            Field(&InstrumentationStageStats::num_calls, 0))));
+}
+
+TEST_F(InstrumentationTest, ChromeTrace) {
+  {
+    ScopedInstrumentationTimer timer(
+        InstrumentationStage::kInstructionFromMCInst);
+  }
+  EXPECT_THAT(InstrumentationTraceToChromeJson(),
+              Not(HasSubstr("\"ph\":\"X\"")));
+
+  SetInstrumentationTracingEnabled(true);
+  EXPECT_TRUE(IsInstrumentationTracingEnabled());
+  {
+    ScopedInstrumentationTimer timer(
+        InstrumentationStage::kInstructionFromMCInst);
+  }
+  SetInstrumentationTracingEnabled(false);
+  AddToInstrumentationCounter(InstrumentationCounter::kOutOfVocabularyTokens,
+                              3);
+
+  const std::string trace = InstrumentationTraceToChromeJson();
+  EXPECT_THAT(trace, HasSubstr("{\"traceEvents\":[{\"name\":\"Canonicalizer::"
+                               "InstructionFromMCInst\",\"cat\":\"gematria\","
+                               "\"ph\":\"X\",\"ts\":"));
+  EXPECT_THAT(trace, HasSubstr("\"out_of_vocabulary_tokens\":3"));
+  EXPECT_THAT(trace, HasSubstr("\"num_dropped_events\":0"));
+
+  ClearInstrumentationTrace();
+  EXPECT_THAT(InstrumentationTraceToChromeJson(),
+              Not(HasSubstr("\"ph\":\"X\"")));
+}
+
+}  // namespace
+}  // namespace gematria
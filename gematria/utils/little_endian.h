@@ -0,0 +1,51 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Encoding and decoding of integers in the little-endian byte order, used by
+// the binary file formats of Gematria. The functions work byte by byte, so they
+// do not depend on the byte order or on the alignment requirements of the host.
+
+#ifndef THIRD_PARTY_GEMATRIA_GEMATRIA_UTILS_LITTLE_ENDIAN_H_
+#define THIRD_PARTY_GEMATRIA_GEMATRIA_UTILS_LITTLE_ENDIAN_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+
+namespace gematria {
+
+// Appends `value` in the little-endian byte order to `buffer`.
+template <typename IntType>
+void AppendLittleEndian(IntType value, std::string& buffer) {
+  static_assert(std::is_unsigned_v<IntType>);
+  for (size_t i = 0; i < sizeof(IntType); ++i) {
+    buffer.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+  }
+}
+
+// Decodes a little-endian integer of type `IntType` stored at `data`.
+template <typename IntType>
+IntType DecodeLittleEndian(const char* data) {
+  static_assert(std::is_unsigned_v<IntType>);
+  IntType value = 0;
+  for (int i = sizeof(IntType) - 1; i >= 0; --i) {
+    value = (value << 8) | static_cast<uint8_t>(data[i]);
+  }
+  return value;
+}
+
+}  // namespace gematria
+
+#endif  // THIRD_PARTY_GEMATRIA_GEMATRIA_UTILS_LITTLE_ENDIAN_H_
@@ -0,0 +1,51 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "gematria/utils/little_endian.h"
+
+#include <cstdint>
+#include <string>
+
+#include "gtest/gtest.h"
+
+namespace gematria {
+namespace {
+
+TEST(LittleEndianTest, Append) {
+  std::string buffer = "x";
+  AppendLittleEndian(uint32_t{0x04030201}, buffer);
+  AppendLittleEndian(uint16_t{0xfffe}, buffer);
+  EXPECT_EQ(buffer, std::string("x\x01\x02\x03\x04\xfe\xff", 7));
+}
+
+TEST(LittleEndianTest, Decode) {
+  const std::string data("\x01\x02\x03\x04\x05\x06\x07\x88", 8);
+  EXPECT_EQ(DecodeLittleEndian<uint64_t>(data.data()), 0x8807060504030201);
+  EXPECT_EQ(DecodeLittleEndian<uint32_t>(data.data() + 4), 0x88070605);
+  EXPECT_EQ(DecodeLittleEndian<uint8_t>(data.data() + 7), 0x88);
+}
+
+TEST(LittleEndianTest, RoundTrip) {
+  const uint64_t values[] = {0, 1, 0xff, 0x100, 0xdeadbeefcafef00d,
+                             UINT64_MAX};
+  for (const uint64_t value : values) {
+    std::string buffer;
+    AppendLittleEndian(value, buffer);
+    ASSERT_EQ(buffer.size(), sizeof(value));
+    EXPECT_EQ(DecodeLittleEndian<uint64_t>(buffer.data()), value);
+  }
+}
+
+}  // namespace
+}  // namespace gematria
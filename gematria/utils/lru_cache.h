@@ -0,0 +1,94 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef THIRD_PARTY_GEMATRIA_GEMATRIA_UTILS_LRU_CACHE_H_
+#define THIRD_PARTY_GEMATRIA_GEMATRIA_UTILS_LRU_CACHE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <utility>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/log/absl_check.h"
+
+namespace gematria {
+
+// A key-value cache with a fixed capacity that evicts the least recently used
+// entry when it is full. Lookups and insertions take amortized constant time.
+// The class is not thread-safe.
+template <typename Key, typename Value>
+class LruCache {
+ public:
+  explicit LruCache(size_t capacity) : capacity_(capacity) {
+    ABSL_CHECK_GT(capacity_, 0);
+  }
+
+  LruCache(const LruCache&) = delete;
+  LruCache& operator=(const LruCache&) = delete;
+
+  // Returns a pointer to the value stored for `key`, or nullptr when the key
+  // is not in the cache. Marks the entry as the most recently used one. The
+  // pointer remains valid until the entry is evicted or replaced.
+  const Value* Lookup(const Key& key) {
+    const auto it = index_.find(key);
+    if (it == index_.end()) {
+      ++num_misses_;
+      return nullptr;
+    }
+    ++num_hits_;
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return &it->second->second;
+  }
+
+  // Stores `value` for `key`, replacing the previous value if there was one.
+  // Evicts the least recently used entry when the cache is full.
+  void Insert(const Key& key, Value value) {
+    const auto it = index_.find(key);
+    if (it != index_.end()) {
+      it->second->second = std::move(value);
+      entries_.splice(entries_.begin(), entries_, it->second);
+      return;
+    }
+    if (entries_.size() >= capacity_) {
+      index_.erase(entries_.back().first);
+      entries_.pop_back();
+    }
+    entries_.emplace_front(key, std::move(value));
+    index_.emplace(key, entries_.begin());
+  }
+
+  size_t size() const { return entries_.size(); }
+  size_t capacity() const { return capacity_; }
+
+  // The number of calls to Lookup() that found and did not find the key.
+  int64_t num_hits() const { return num_hits_; }
+  int64_t num_misses() const { return num_misses_; }
+
+ private:
+  using Entry = std::pair<Key, Value>;
+
+  const size_t capacity_;
+  // The entries of the cache, ordered from the most recently used to the least
+  // recently used.
+  std::list<Entry> entries_;
+  absl::flat_hash_map<Key, typename std::list<Entry>::iterator> index_;
+
+  int64_t num_hits_ = 0;
+  int64_t num_misses_ = 0;
+};
+
+}  // namespace gematria
+
+#endif  // THIRD_PARTY_GEMATRIA_GEMATRIA_UTILS_LRU_CACHE_H_
@@ -0,0 +1,70 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "gematria/utils/lru_cache.h"
+
+#include <string>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace gematria {
+namespace {
+
+using ::testing::IsNull;
+using ::testing::Pointee;
+
+TEST(LruCacheTest, LookupAndInsert) {
+  LruCache<std::string, int> cache(4);
+  EXPECT_THAT(cache.Lookup("a"), IsNull());
+  cache.Insert("a", 1);
+  cache.Insert("b", 2);
+  EXPECT_THAT(cache.Lookup("a"), Pointee(1));
+  EXPECT_THAT(cache.Lookup("b"), Pointee(2));
+  EXPECT_THAT(cache.Lookup("c"), IsNull());
+  EXPECT_EQ(cache.size(), 2);
+  EXPECT_EQ(cache.num_hits(), 2);
+  EXPECT_EQ(cache.num_misses(), 2);
+}
+
+TEST(LruCacheTest, InsertReplacesValue) {
+  LruCache<std::string, int> cache(4);
+  cache.Insert("a", 1);
+  cache.Insert("a", 2);
+  EXPECT_THAT(cache.Lookup("a"), Pointee(2));
+  EXPECT_EQ(cache.size(), 1);
+}
+
+TEST(LruCacheTest, EvictsLeastRecentlyUsed) {
+  LruCache<std::string, int> cache(2);
+  cache.Insert("a", 1);
+  cache.Insert("b", 2);
+  // Makes "a" the most recently used entry.
+  EXPECT_THAT(cache.Lookup("a"), Pointee(1));
+  cache.Insert("c", 3);
+  EXPECT_EQ(cache.size(), 2);
+  EXPECT_THAT(cache.Lookup("a"), Pointee(1));
+  EXPECT_THAT(cache.Lookup("b"), IsNull());
+  EXPECT_THAT(cache.Lookup("c"), Pointee(3));
+
+  // Replacing a value also makes the entry the most recently used one.
+  cache.Insert("a", 4);
+  cache.Insert("d", 5);
+  EXPECT_THAT(cache.Lookup("a"), Pointee(4));
+  EXPECT_THAT(cache.Lookup("c"), IsNull());
+  EXPECT_THAT(cache.Lookup("d"), Pointee(5));
+}
+
+}  // namespace
+}  // namespace gematria
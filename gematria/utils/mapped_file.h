@@ -0,0 +1,59 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef THIRD_PARTY_GEMATRIA_GEMATRIA_UTILS_MAPPED_FILE_H_
+#define THIRD_PARTY_GEMATRIA_GEMATRIA_UTILS_MAPPED_FILE_H_
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "absl/status/statusor.h"
+
+namespace gematria {
+
+// A read-only view of the contents of a file mapped to memory. The file is
+// unmapped when the object is destroyed. The contents are shared with the page
+// cache; they are read lazily, when they are first accessed.
+class MappedFile {
+ public:
+  // Maps the file `file_name` to memory. Returns an error when the file can't
+  // be opened or mapped.
+  static absl::StatusOr<std::unique_ptr<MappedFile>> Open(
+      const std::string& file_name);
+
+  ~MappedFile();
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  // Returns the contents of the file. The view is valid for the lifetime of
+  // this object.
+  std::string_view contents() const { return std::string_view(data_, size_); }
+  const char* data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  MappedFile(const char* data, size_t size) : data_(data), size_(size) {}
+
+  // The mapped data, or nullptr when the file is empty; empty files can't be
+  // mapped.
+  const char* const data_;
+  const size_t size_;
+};
+
+}  // namespace gematria
+
+#endif  // THIRD_PARTY_GEMATRIA_GEMATRIA_UTILS_MAPPED_FILE_H_
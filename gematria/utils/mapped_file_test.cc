@@ -0,0 +1,65 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "gematria/utils/mapped_file.h"
+
+#include <fstream>
+#include <ios>
+#include <string>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "gematria/testing/matchers.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace gematria {
+namespace {
+
+std::string WriteTempFile(const std::string& name,
+                          const std::string& contents) {
+  const std::string file_name = absl::StrCat(::testing::TempDir(), "/", name);
+  std::ofstream output(file_name, std::ios::binary | std::ios::trunc);
+  output.write(contents.data(), contents.size());
+  output.close();
+  EXPECT_TRUE(output) << file_name;
+  return file_name;
+}
+
+TEST(MappedFileTest, Open) {
+  const std::string contents("some\0data", 9);
+  const std::string file_name = WriteTempFile("mapped_file", contents);
+  const auto file = MappedFile::Open(file_name);
+  ASSERT_OK(file);
+  EXPECT_EQ((*file)->size(), contents.size());
+  EXPECT_EQ((*file)->contents(), contents);
+  EXPECT_EQ((*file)->contents().data(), (*file)->data());
+}
+
+TEST(MappedFileTest, EmptyFile) {
+  const std::string file_name = WriteTempFile("empty_mapped_file", "");
+  const auto file = MappedFile::Open(file_name);
+  ASSERT_OK(file);
+  EXPECT_EQ((*file)->size(), 0);
+  EXPECT_TRUE((*file)->contents().empty());
+}
+
+TEST(MappedFileTest, MissingFile) {
+  EXPECT_THAT(
+      MappedFile::Open(absl::StrCat(::testing::TempDir(), "/does_not_exist")),
+      StatusIs(absl::StatusCode::kNotFound));
+}
+
+}  // namespace
+}  // namespace gematria
@@ -0,0 +1,192 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// A batcher that coalesces independent requests submitted from multiple threads
+// into micro-batches processed by a single worker thread.
+//
+// The batcher is intended for serving workloads where each request is small
+// (e.g. a single basic block), but the cost of processing a batch is dominated
+// by a fixed per-batch overhead (e.g. a call to the TensorFlow runtime). The
+// worker thread collects requests until either the batch reaches
+// `max_batch_size` requests, or the oldest request in the batch waited for
+// `max_batch_wait`, whichever comes first; this puts an upper bound on the
+// latency added by the batching.
+
+#ifndef THIRD_PARTY_GEMATRIA_GEMATRIA_UTILS_MICRO_BATCHER_H_
+#define THIRD_PARTY_GEMATRIA_GEMATRIA_UTILS_MICRO_BATCHER_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>  // NOLINT(build/c++11)
+#include <thread>  // NOLINT(build/c++11)
+#include <utility>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/log/absl_check.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+
+namespace gematria {
+
+struct MicroBatcherOptions {
+  // The maximal number of requests in a single batch. Must be positive.
+  int max_batch_size = 32;
+  // The maximal time a request waits for other requests to join its batch.
+  // When zero, the worker thread processes the requests that are available at
+  // the time it picks up a new batch without waiting.
+  absl::Duration max_batch_wait = absl::Milliseconds(1);
+};
+
+// Collects requests of type `Request` into batches, and computes responses of
+// type `Response` for them by calling a user-provided batch function. The
+// batch function is always called from the same worker thread, one batch at a
+// time, so it does not need to be thread-safe. All other methods of the class
+// are thread-safe.
+//
+// Typical use:
+//   MicroBatcher<Input, Output> batcher(
+//       [&](std::vector<Input> inputs) { return model.Run(inputs); },
+//       options);
+//   std::future<Output> output = batcher.Submit(input);
+//   ...
+//   UseOutput(output.get());
+template <typename Request, typename Response>
+class MicroBatcher {
+ public:
+  // The function that processes a batch. It must return exactly one response
+  // for each request in the batch, in the order of the requests.
+  using BatchFunction =
+      std::function<std::vector<Response>(std::vector<Request> requests)>;
+
+  MicroBatcher(BatchFunction batch_function, MicroBatcherOptions options)
+      : batch_function_(std::move(batch_function)), options_(options) {
+    ABSL_CHECK(batch_function_ != nullptr);
+    ABSL_CHECK_GT(options_.max_batch_size, 0);
+    ABSL_CHECK_GE(options_.max_batch_wait, absl::ZeroDuration());
+    worker_ = std::thread(&MicroBatcher::WorkerLoop, this);
+  }
+
+  MicroBatcher(const MicroBatcher&) = delete;
+  MicroBatcher& operator=(const MicroBatcher&) = delete;
+
+  // Processes all requests that were already submitted, and stops the worker
+  // thread.
+  ~MicroBatcher() {
+    {
+      absl::MutexLock lock(&mutex_);
+      shutting_down_ = true;
+    }
+    worker_.join();
+  }
+
+  // Adds `request` to the queue. The returned future becomes ready when the
+  // batch containing the request is processed. Must not be called while the
+  // batcher is being destroyed.
+  std::future<Response> Submit(Request request) {
+    PendingRequest pending;
+    pending.request = std::move(request);
+    pending.enqueue_time = absl::Now();
+    std::future<Response> response = pending.response.get_future();
+    absl::MutexLock lock(&mutex_);
+    ABSL_CHECK(!shutting_down_);
+    queue_.push_back(std::move(pending));
+    return response;
+  }
+
+  // The number of batches processed so far.
+  int64_t num_batches() const {
+    absl::MutexLock lock(&mutex_);
+    return num_batches_;
+  }
+
+  // The number of requests processed so far.
+  int64_t num_requests() const {
+    absl::MutexLock lock(&mutex_);
+    return num_requests_;
+  }
+
+ private:
+  struct PendingRequest {
+    Request request;
+    std::promise<Response> response;
+    absl::Time enqueue_time;
+  };
+
+  void WorkerLoop() {
+    while (true) {
+      std::vector<PendingRequest> batch;
+      {
+        absl::MutexLock lock(&mutex_);
+        mutex_.Await(absl::Condition(this, &MicroBatcher::HasWork));
+        if (queue_.empty()) return;  // Shutting down with an empty queue.
+        const absl::Time deadline =
+            queue_.front().enqueue_time + options_.max_batch_wait;
+        // Returns early when the batch is full or the batcher is shutting
+        // down; otherwise, waits until the deadline of the oldest request.
+        mutex_.AwaitWithDeadline(
+            absl::Condition(this, &MicroBatcher::HasFullBatchOrShutdown),
+            deadline);
+        const size_t batch_size = std::min<size_t>(
+            queue_.size(), static_cast<size_t>(options_.max_batch_size));
+        batch.reserve(batch_size);
+        for (size_t i = 0; i < batch_size; ++i) {
+          batch.push_back(std::move(queue_.front()));
+          queue_.pop_front();
+        }
+        ++num_batches_;
+        num_requests_ += batch_size;
+      }
+
+      std::vector<Request> requests;
+      requests.reserve(batch.size());
+      for (PendingRequest& pending : batch) {
+        requests.push_back(std::move(pending.request));
+      }
+      std::vector<Response> responses = batch_function_(std::move(requests));
+      ABSL_CHECK_EQ(responses.size(), batch.size());
+      for (size_t i = 0; i < batch.size(); ++i) {
+        batch[i].response.set_value(std::move(responses[i]));
+      }
+    }
+  }
+
+  bool HasWork() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+    return !queue_.empty() || shutting_down_;
+  }
+  bool HasFullBatchOrShutdown() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+    return queue_.size() >= static_cast<size_t>(options_.max_batch_size) ||
+           shutting_down_;
+  }
+
+  const BatchFunction batch_function_;
+  const MicroBatcherOptions options_;
+
+  mutable absl::Mutex mutex_;
+  std::deque<PendingRequest> queue_ ABSL_GUARDED_BY(mutex_);
+  bool shutting_down_ ABSL_GUARDED_BY(mutex_) = false;
+  int64_t num_batches_ ABSL_GUARDED_BY(mutex_) = 0;
+  int64_t num_requests_ ABSL_GUARDED_BY(mutex_) = 0;
+
+  // Must be the last member, so that the thread is started after all other
+  // members are initialized.
+  std::thread worker_;
+};
+
+}  // namespace gematria
+
+#endif  // THIRD_PARTY_GEMATRIA_GEMATRIA_UTILS_MICRO_BATCHER_H_
@@ -0,0 +1,144 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "gematria/utils/micro_batcher.h"
+
+#include <future>  // NOLINT(build/c++11)
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+#include "absl/synchronization/notification.h"
+#include "absl/time/time.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace gematria {
+namespace {
+
+using ::testing::Each;
+using ::testing::ElementsAre;
+using ::testing::Le;
+
+MicroBatcherOptions MakeOptions(int max_batch_size,
+                                absl::Duration max_batch_wait) {
+  MicroBatcherOptions options;
+  options.max_batch_size = max_batch_size;
+  options.max_batch_wait = max_batch_wait;
+  return options;
+}
+
+TEST(MicroBatcherTest, SingleRequest) {
+  MicroBatcher<int, int> batcher(
+      [](std::vector<int> requests) {
+        for (int& request : requests) request *= 2;
+        return requests;
+      },
+      MakeOptions(8, absl::ZeroDuration()));
+  EXPECT_EQ(batcher.Submit(21).get(), 42);
+  EXPECT_EQ(batcher.num_batches(), 1);
+  EXPECT_EQ(batcher.num_requests(), 1);
+}
+
+TEST(MicroBatcherTest, CoalescesRequests) {
+  // The batch function blocks on the first batch until all requests are
+  // submitted, so that the remaining requests are collected into a batch of
+  // the maximal size.
+  absl::Notification all_submitted;
+  absl::Mutex mutex;
+  std::vector<int> batch_sizes;
+  MicroBatcher<int, int> batcher(
+      [&](std::vector<int> requests) {
+        all_submitted.WaitForNotification();
+        {
+          absl::MutexLock lock(&mutex);
+          batch_sizes.push_back(requests.size());
+        }
+        for (int& request : requests) request += 1;
+        return requests;
+      },
+      MakeOptions(4, absl::Seconds(10)));
+
+  // With the long deadline, the batcher processes a batch only when it has
+  // four requests.
+  std::vector<std::future<int>> responses;
+  for (int i = 0; i < 8; ++i) {
+    responses.push_back(batcher.Submit(i));
+  }
+  all_submitted.Notify();
+  for (int i = 0; i < 8; ++i) {
+    EXPECT_EQ(responses[i].get(), i + 1);
+  }
+  absl::MutexLock lock(&mutex);
+  EXPECT_THAT(batch_sizes, ElementsAre(4, 4));
+}
+
+TEST(MicroBatcherTest, FlushesPartialBatchAfterDeadline) {
+  MicroBatcher<int, int> batcher(
+      [](std::vector<int> requests) { return requests; },
+      MakeOptions(1000, absl::Milliseconds(5)));
+  std::future<int> first = batcher.Submit(1);
+  std::future<int> second = batcher.Submit(2);
+  EXPECT_EQ(first.get(), 1);
+  EXPECT_EQ(second.get(), 2);
+}
+
+TEST(MicroBatcherTest, DestructorProcessesPendingRequests) {
+  std::vector<std::future<int>> responses;
+  {
+    MicroBatcher<int, int> batcher(
+        [](std::vector<int> requests) { return requests; },
+        MakeOptions(2, absl::Seconds(10)));
+    for (int i = 0; i < 5; ++i) {
+      responses.push_back(batcher.Submit(i));
+    }
+  }
+  for (int i = 0; i < 5; ++i) {
+    EXPECT_EQ(responses[i].get(), i);
+  }
+}
+
+TEST(MicroBatcherTest, ConcurrentSubmitters) {
+  constexpr int kNumThreads = 8;
+  constexpr int kNumRequestsPerThread = 100;
+  constexpr int kMaxBatchSize = 16;
+  absl::Mutex mutex;
+  std::vector<int> batch_sizes;
+  MicroBatcher<int, int> batcher(
+      [&](std::vector<int> requests) {
+        absl::MutexLock lock(&mutex);
+        batch_sizes.push_back(requests.size());
+        for (int& request : requests) request = -request;
+        return requests;
+      },
+      MakeOptions(kMaxBatchSize, absl::Microseconds(100)));
+
+  std::vector<std::thread> threads;
+  for (int thread = 0; thread < kNumThreads; ++thread) {
+    threads.emplace_back([&batcher, thread]() {
+      for (int i = 0; i < kNumRequestsPerThread; ++i) {
+        const int request = thread * kNumRequestsPerThread + i;
+        EXPECT_EQ(batcher.Submit(request).get(), -request);
+      }
+    });
+  }
+  for (std::thread& thread : threads) thread.join();
+
+  EXPECT_EQ(batcher.num_requests(), kNumThreads * kNumRequestsPerThread);
+  absl::MutexLock lock(&mutex);
+  EXPECT_THAT(batch_sizes, Each(Le(kMaxBatchSize)));
+}
+
+}  // namespace
+}  // namespace gematria
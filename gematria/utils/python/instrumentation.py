@@ -0,0 +1,152 @@
+# Copyright 2023 Google Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#    http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Access to the instrumentation of the C++ code from Python.
+
+The C++ counters and stage timers are exported by each instrumented extension
+module as its `instrumentation` submodule, e.g.
+`gematria.granite.python.graph_builder.instrumentation`. Each extension module
+has its own copy of the data; the functions in this module merge the data from
+all instrumented extension modules that are currently loaded, so that the
+caller does not need to know which extensions were used.
+
+Example usage:
+  instrumentation.reset()
+  model.schedule_batch(blocks)
+  snapshot = instrumentation.snapshot()
+  print(snapshot.counters['graph_nodes_added'])
+"""
+
+from collections.abc import Iterable, Mapping
+import dataclasses
+import json
+import sys
+import types
+from typing import Any, Optional
+
+from gematria.utils.python import timer
+
+_NANOSECONDS_PER_SECOND = 1e9
+
+
+@dataclasses.dataclass
+class Snapshot:
+  """The values of the C++ counters and stage timers.
+
+  Attributes:
+    counters: The values of the counters, by the counter name.
+    stages: The accumulated running times of the instrumented stages, by the
+      stage name.
+  """
+
+  counters: dict[str, int] = dataclasses.field(default_factory=dict)
+  stages: dict[str, timer.StageTime] = dataclasses.field(default_factory=dict)
+
+
+def instrumented_modules() -> list[types.ModuleType]:
+  """Returns the instrumentation submodules of all loaded extension modules."""
+  modules = []
+  for module in list(sys.modules.values()):
+    if not getattr(module, '__name__', '').startswith('gematria.'):
+      continue
+    submodule = getattr(module, 'instrumentation', None)
+    if isinstance(submodule, types.ModuleType) and hasattr(
+        submodule, 'chrome_trace_json'
+    ):
+      modules.append(submodule)
+  return modules
+
+
+def _modules_or_default(
+    modules: Optional[Iterable[Any]],
+) -> Iterable[Any]:
+  return instrumented_modules() if modules is None else modules
+
+
+def snapshot(modules: Optional[Iterable[Any]] = None) -> Snapshot:
+  """Returns the sum of the counters and timers from `modules`.
+
+  Args:
+    modules: The instrumentation submodules to read the data from. When None,
+      uses all instrumented extension modules that are loaded.
+
+  Returns:
+    The merged snapshot.
+  """
+  result = Snapshot()
+  for module in _modules_or_default(modules):
+    module_snapshot: Mapping[str, Mapping[str, Any]] = module.snapshot()
+    for name, value in module_snapshot['counters'].items():
+      result.counters[name] = result.counters.get(name, 0) + value
+    for name, (num_calls, nanoseconds) in module_snapshot['stages'].items():
+      stage = result.stages.setdefault(name, timer.StageTime())
+      stage.num_calls += num_calls
+      stage.total_seconds += nanoseconds / _NANOSECONDS_PER_SECOND
+  return result
+
+
+def reset(modules: Optional[Iterable[Any]] = None) -> None:
+  """Resets the counters and timers in `modules`, or in all loaded modules."""
+  for module in _modules_or_default(modules):
+    module.reset()
+
+
+def set_tracing_enabled(
+    enabled: bool, modules: Optional[Iterable[Any]] = None
+) -> None:
+  """Enables or disables recording of trace events in the C++ code."""
+  for module in _modules_or_default(modules):
+    module.set_tracing_enabled(enabled)
+
+
+def clear_trace(modules: Optional[Iterable[Any]] = None) -> None:
+  """Removes the recorded trace events."""
+  for module in _modules_or_default(modules):
+    module.clear_trace()
+
+
+def chrome_trace(modules: Optional[Iterable[Any]] = None) -> dict[str, Any]:
+  """Returns the recorded trace events in the Chrome trace event format.
+
+  The result can be serialized with json.dump() and loaded into Perfetto or
+  chrome://tracing. The counter events of the individual modules are replaced
+  by a single counter event with the merged values.
+
+  Args:
+    modules: The instrumentation submodules to read the data from. When None,
+      uses all instrumented extension modules that are loaded.
+
+  Returns:
+    The trace as a JSON-compatible dict.
+  """
+  modules = list(_modules_or_default(modules))
+  events = []
+  counter_event = None
+  num_dropped_events = 0
+  for module in modules:
+    trace = json.loads(module.chrome_trace_json())
+    num_dropped_events += trace['otherData']['num_dropped_events']
+    for event in trace['traceEvents']:
+      if event['ph'] == 'C':
+        if counter_event is None or event['ts'] > counter_event['ts']:
+          counter_event = event
+      else:
+        events.append(event)
+  if counter_event is not None:
+    counter_event['args'] = snapshot(modules).counters
+    events.append(counter_event)
+  return {
+      'traceEvents': events,
+      'otherData': {'num_dropped_events': num_dropped_events},
+  }
@@ -0,0 +1,71 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Contains Python bindings of the C++ instrumentation layer. Each extension
+// module links its own copy of the instrumentation data, so the bindings are
+// added to each instrumented extension module as its `instrumentation`
+// submodule; gematria.utils.python.instrumentation merges the data from all
+// loaded submodules.
+
+#ifndef THIRD_PARTY_GEMATRIA_GEMATRIA_UTILS_PYTHON_INSTRUMENTATION_BINDINGS_H_
+#define THIRD_PARTY_GEMATRIA_GEMATRIA_UTILS_PYTHON_INSTRUMENTATION_BINDINGS_H_
+
+#include "gematria/utils/instrumentation.h"
+#include "pybind11/pybind11.h"
+
+namespace gematria {
+
+// Adds the `instrumentation` submodule to `module`. The functions of the
+// submodule return only built-in Python types, so that the submodule can be
+// added to any number of extension modules.
+inline void DefineInstrumentationSubmodule(pybind11::module_& module) {
+  namespace py = ::pybind11;
+  py::module_ instrumentation = module.def_submodule(
+      "instrumentation",
+      "Counters and stage timers of the C++ code in this extension module.");
+  instrumentation.attr("ENABLED") = kInstrumentationEnabled;
+  instrumentation.def(
+      "snapshot",
+      []() {
+        const InstrumentationSnapshot snapshot = GetInstrumentationSnapshot();
+        py::dict counters;
+        for (const auto& [name, value] : snapshot.counters) {
+          counters[py::str(name)] = value;
+        }
+        py::dict stages;
+        for (const auto& [name, stats] : snapshot.stages) {
+          stages[py::str(name)] =
+              py::make_tuple(stats.num_calls, stats.total_nanoseconds);
+        }
+        py::dict result;
+        result["counters"] = counters;
+        result["stages"] = stages;
+        return result;
+      },
+      R"(Returns the current values of the counters and stage timers.
+
+The result is a dict with two keys: 'counters' maps counter names to their
+values, and 'stages' maps stage names to (num_calls, total_nanoseconds).)");
+  instrumentation.def("reset", &ResetInstrumentation);
+  instrumentation.def("set_tracing_enabled",
+                      &SetInstrumentationTracingEnabled, py::arg("enabled"));
+  instrumentation.def("is_tracing_enabled", &IsInstrumentationTracingEnabled);
+  instrumentation.def("chrome_trace_json", &InstrumentationTraceToChromeJson,
+                      "Returns the trace events in the Chrome JSON format.");
+  instrumentation.def("clear_trace", &ClearInstrumentationTrace);
+}
+
+}  // namespace gematria
+
+#endif  // THIRD_PARTY_GEMATRIA_GEMATRIA_UTILS_PYTHON_INSTRUMENTATION_BINDINGS_H_
@@ -0,0 +1,152 @@
+# Copyright 2023 Google Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#    http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+import json
+
+from absl.testing import absltest
+from gematria.utils.python import instrumentation
+
+
+class FakeInstrumentationModule:
+  """A stand-in for the instrumentation submodule of an extension module."""
+
+  def __init__(self, counters, stages, events):
+    self.counters = counters
+    self.stages = stages
+    self.events = events
+    self.tracing_enabled = False
+
+  def snapshot(self):
+    return {'counters': dict(self.counters), 'stages': dict(self.stages)}
+
+  def reset(self):
+    self.counters = {name: 0 for name in self.counters}
+    self.stages = {name: (0, 0) for name in self.stages}
+
+  def set_tracing_enabled(self, enabled):
+    self.tracing_enabled = enabled
+
+  def clear_trace(self):
+    self.events = []
+
+  def chrome_trace_json(self):
+    counter_event = {
+        'name': 'gematria_counters',
+        'ph': 'C',
+        'ts': 100.0,
+        'pid': 1,
+        'args': dict(self.counters),
+    }
+    return json.dumps({
+        'traceEvents': [*self.events, counter_event],
+        'otherData': {'num_dropped_events': 1},
+    })
+
+
+def _make_modules():
+  graph_builder = FakeInstrumentationModule(
+      counters={'graph_nodes_added': 10, 'instructions_disassembled': 0},
+      stages={'BasicBlockGraphBuilder::AddBasicBlock': (2, 3_000_000_000)},
+      events=[{
+          'name': 'BasicBlockGraphBuilder::AddBasicBlock',
+          'ph': 'X',
+          'ts': 1.0,
+          'dur': 2.0,
+      }],
+  )
+  bhive_importer = FakeInstrumentationModule(
+      counters={'graph_nodes_added': 0, 'instructions_disassembled': 5},
+      stages={
+          'BasicBlockGraphBuilder::AddBasicBlock': (0, 0),
+          'DisassembleAllInstructions': (1, 500_000_000),
+      },
+      events=[{
+          'name': 'DisassembleAllInstructions',
+          'ph': 'X',
+          'ts': 5.0,
+          'dur': 1.0,
+      }],
+  )
+  return [graph_builder, bhive_importer]
+
+
+class InstrumentationTest(absltest.TestCase):
+
+  def test_snapshot(self):
+    snapshot = instrumentation.snapshot(_make_modules())
+    self.assertEqual(
+        snapshot.counters,
+        {'graph_nodes_added': 10, 'instructions_disassembled': 5},
+    )
+    add_basic_block = snapshot.stages['BasicBlockGraphBuilder::AddBasicBlock']
+    self.assertEqual(add_basic_block.num_calls, 2)
+    self.assertAlmostEqual(add_basic_block.total_seconds, 3.0)
+    self.assertAlmostEqual(add_basic_block.seconds_per_call, 1.5)
+    disassemble = snapshot.stages['DisassembleAllInstructions']
+    self.assertEqual(disassemble.num_calls, 1)
+    self.assertAlmostEqual(disassemble.total_seconds, 0.5)
+
+  def test_reset(self):
+    modules = _make_modules()
+    instrumentation.reset(modules)
+    snapshot = instrumentation.snapshot(modules)
+    self.assertEqual(
+        snapshot.counters,
+        {'graph_nodes_added': 0, 'instructions_disassembled': 0},
+    )
+
+  def test_set_tracing_enabled(self):
+    modules = _make_modules()
+    instrumentation.set_tracing_enabled(True, modules)
+    self.assertTrue(all(module.tracing_enabled for module in modules))
+    instrumentation.set_tracing_enabled(False, modules)
+    self.assertFalse(any(module.tracing_enabled for module in modules))
+
+  def test_chrome_trace(self):
+    trace = instrumentation.chrome_trace(_make_modules())
+    events = trace['traceEvents']
+    self.assertSequenceEqual(
+        [event['name'] for event in events],
+        (
+            'BasicBlockGraphBuilder::AddBasicBlock',
+            'DisassembleAllInstructions',
+            'gematria_counters',
+        ),
+    )
+    self.assertEqual(
+        events[-1]['args'],
+        {'graph_nodes_added': 10, 'instructions_disassembled': 5},
+    )
+    self.assertEqual(trace['otherData'], {'num_dropped_events': 2})
+    # The result must be serializable as JSON.
+    self.assertNotEmpty(json.dumps(trace))
+
+  def test_clear_trace(self):
+    modules = _make_modules()
+    instrumentation.clear_trace(modules)
+    trace = instrumentation.chrome_trace(modules)
+    self.assertSequenceEqual(
+        [event['name'] for event in trace['traceEvents']],
+        ('gematria_counters',),
+    )
+
+  def test_instrumented_modules(self):
+    # No extension modules are loaded in this test; the function must still
+    # work and return only modules with the instrumentation API.
+    for module in instrumentation.instrumented_modules():
+      self.assertTrue(hasattr(module, 'snapshot'))
+
+
+if __name__ == '__main__':
+  absltest.main()
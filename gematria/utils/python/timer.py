@@ -14,8 +14,10 @@
 
 """Contains functions for performance debugging in Gematria code."""
 
-from collections.abc import Callable, Iterator
+import collections
+from collections.abc import Callable, Iterator, Mapping
 import contextlib
+import dataclasses
 import time
 from typing import Optional
 
@@ -59,3 +61,71 @@ def scoped(
     )
   else:
     log_function('%s: %fs', name, duration)
+
+
+@dataclasses.dataclass
+class StageTime:
+  """The accumulated running time of one named stage.
+
+  Attributes:
+    total_seconds: The total running time of the stage in seconds.
+    num_calls: The number of times the stage was entered.
+  """
+
+  total_seconds: float = 0.0
+  num_calls: int = 0
+
+  @property
+  def seconds_per_call(self) -> float:
+    """Returns the average running time of one call to the stage."""
+    return self.total_seconds / self.num_calls if self.num_calls else 0.0
+
+
+class Accumulator:
+  """Accumulates the running times of named stages across many calls.
+
+  Unlike scoped(), the accumulator does not print anything to the log; it only
+  collects the running times so that they can be reported at the end, e.g. as
+  a per-stage breakdown of a training step.
+
+  Example usage:
+    accumulator = timer.Accumulator()
+    for batch in batches:
+      with accumulator.scoped('Schedule batch'):
+        schedule = model.schedule_batch(batch)
+    print(accumulator.stages['Schedule batch'].total_seconds)
+  """
+
+  def __init__(self):
+    self._stages = collections.defaultdict(StageTime)
+
+  @property
+  def stages(self) -> Mapping[str, StageTime]:
+    """Returns the running times of all stages entered so far, by name."""
+    return self._stages
+
+  @contextlib.contextmanager
+  def scoped(self, name: str) -> Iterator[None]:
+    """Measures the running time of the code in the context.
+
+    The time is added to the stage `name` also when the code in the context
+    raises an exception.
+
+    Args:
+      name: The name of the measured stage.
+
+    Yields:
+      None. Yielding is used only as a way to transfer control to the measured
+      code.
+    """
+    start_time = time.time()
+    try:
+      yield
+    finally:
+      stage = self._stages[name]
+      stage.total_seconds += time.time() - start_time
+      stage.num_calls += 1
+
+  def reset(self) -> None:
+    """Removes all stages from the accumulator."""
+    self._stages.clear()
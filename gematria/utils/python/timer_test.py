@@ -62,5 +62,44 @@ class TimerTest(absltest.TestCase):
     self.assertEqual(log_args, ('%s: %fs, %fs per iteration', timer_name, 6, 2))
 
 
+class AccumulatorTest(absltest.TestCase):
+
+  @mock.patch('time.time', side_effect=[10, 15, 20, 21, 30, 32])
+  def test_accumulates_stages(self, mock_time):
+    del mock_time  # Unused
+    accumulator = timer.Accumulator()
+    with accumulator.scoped('parse'):
+      pass
+    with accumulator.scoped('run'):
+      pass
+    with accumulator.scoped('parse'):
+      pass
+
+    self.assertCountEqual(accumulator.stages.keys(), ('parse', 'run'))
+    self.assertEqual(accumulator.stages['parse'].total_seconds, 7)
+    self.assertEqual(accumulator.stages['parse'].num_calls, 2)
+    self.assertEqual(accumulator.stages['parse'].seconds_per_call, 3.5)
+    self.assertEqual(accumulator.stages['run'].total_seconds, 1)
+    self.assertEqual(accumulator.stages['run'].num_calls, 1)
+
+  @mock.patch('time.time', side_effect=[10, 14])
+  def test_accumulates_on_exception(self, mock_time):
+    del mock_time  # Unused
+    accumulator = timer.Accumulator()
+    with self.assertRaises(ValueError):
+      with accumulator.scoped('fail'):
+        raise ValueError('Failed')
+
+    self.assertEqual(accumulator.stages['fail'].total_seconds, 4)
+    self.assertEqual(accumulator.stages['fail'].num_calls, 1)
+
+  def test_reset(self):
+    accumulator = timer.Accumulator()
+    with accumulator.scoped('stage'):
+      pass
+    accumulator.reset()
+    self.assertEmpty(accumulator.stages)
+
+
 if __name__ == '__main__':
   absltest.main()
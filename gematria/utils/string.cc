@@ -14,52 +14,210 @@
 
 #include "gematria/utils/string.h"
 
+#include <array>
 #include <cstdint>
 #include <string_view>
+#include <vector>
 
 #include "absl/status/status.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_format.h"
+#include "absl/types/span.h"
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 namespace gematria {
 namespace {
 
-constexpr int kInvalidHexDigit = 256;
+// The value of each character as a hex digit, or kInvalidHexDigit when the
+// character is not a hex digit.
+constexpr uint8_t kInvalidHexDigit = 0xff;
+constexpr std::array<uint8_t, 256> kHexDigitValues = [] {
+  std::array<uint8_t, 256> values = {};
+  for (int c = 0; c < 256; ++c) {
+    if (c >= '0' && c <= '9') {
+      values[c] = c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      values[c] = c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+      values[c] = c - 'A' + 10;
+    } else {
+      values[c] = kInvalidHexDigit;
+    }
+  }
+  return values;
+}();
+
+absl::Status InvalidLengthError() {
+  return absl::InvalidArgumentError(
+      "The input string has invalid format. Expected an even number of hex "
+      "digits with no whitespace.");
+}
 
-int ParseHexDigit(char digit) {
-  if (digit >= '0' && digit <= '9') {
-    return digit - '0';
+// Decodes `hex_string` to `output` one byte at a time. Expects that `output`
+// has the right size.
+absl::Status ParseHexStringScalar(std::string_view hex_string,
+                                  uint8_t* output) {
+  while (!hex_string.empty()) {
+    const uint8_t high = kHexDigitValues[static_cast<uint8_t>(hex_string[0])];
+    const uint8_t low = kHexDigitValues[static_cast<uint8_t>(hex_string[1])];
+    if ((high | low) > 0xf) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          "Invalid hex string format starting with: '", hex_string, "'"));
+    }
+    *output++ = (high << 4) | low;
+    hex_string.remove_prefix(2);
   }
-  if (digit >= 'a' && digit <= 'f') {
-    return digit - 'a' + 10;
+  return absl::OkStatus();
+}
+
+#if defined(__SSE2__)
+
+// The SIMD decoders compute the value of each hex digit and check that all
+// characters are hex digits:
+//  * digits are characters in ['0', '9'],
+//  * letters are characters c such that (c | 0x20) is in ['a', 'f']; setting
+//    the bit 0x20 maps upper-case letters to lower-case letters, and no other
+//    character to this range.
+// Then they merge each pair of hex digit values, which are adjacent bytes, to
+// a single byte: in a 16-bit lane, the first digit is the low byte and the
+// second digit is the high byte, so the byte value is
+// (lane << 4 | lane >> 8) & 0xff.
+
+// Decodes 16 hex digits from `input` into the low bytes of the 16-bit lanes
+// of `decoded`. Returns false when some of the characters are not hex digits.
+inline bool DecodeHexDigits(const char* input, __m128i& decoded) {
+  const __m128i chars =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(input));
+  const __m128i lower = _mm_or_si128(chars, _mm_set1_epi8(0x20));
+  const __m128i is_digit =
+      _mm_and_si128(_mm_cmpgt_epi8(chars, _mm_set1_epi8('0' - 1)),
+                    _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), chars));
+  const __m128i is_letter =
+      _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                    _mm_cmpgt_epi8(_mm_set1_epi8('f' + 1), lower));
+  if (_mm_movemask_epi8(_mm_or_si128(is_digit, is_letter)) != 0xffff) {
+    return false;
   }
-  if (digit >= 'A' && digit <= 'F') {
-    return digit - 'A' + 10;
+  const __m128i values = _mm_or_si128(
+      _mm_and_si128(is_digit, _mm_sub_epi8(chars, _mm_set1_epi8('0'))),
+      _mm_and_si128(is_letter, _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10))));
+  decoded = _mm_and_si128(
+      _mm_or_si128(_mm_slli_epi16(values, 4), _mm_srli_epi16(values, 8)),
+      _mm_set1_epi16(0xff));
+  return true;
+}
+
+// Decodes 32 hex digits from `input` to 16 bytes in `output`. Returns false
+// when some of the characters are not hex digits.
+inline bool DecodeHexBlock16(const char* input, uint8_t* output) {
+  __m128i first, second;
+  if (!DecodeHexDigits(input, first) ||
+      !DecodeHexDigits(input + sizeof(__m128i), second)) {
+    return false;
   }
-  return kInvalidHexDigit;
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(output),
+                   _mm_packus_epi16(first, second));
+  return true;
 }
 
+// Decodes 16 hex digits from `input` to 8 bytes in `output`. Returns false
+// when some of the characters are not hex digits.
+inline bool DecodeHexBlock8(const char* input, uint8_t* output) {
+  __m128i decoded;
+  if (!DecodeHexDigits(input, decoded)) return false;
+  _mm_storel_epi64(reinterpret_cast<__m128i*>(output),
+                   _mm_packus_epi16(decoded, decoded));
+  return true;
+}
+
+#endif  // defined(__SSE2__)
+
+#if defined(__AVX2__)
+
+// An AVX2 version of DecodeHexBlock16() that decodes 64 hex digits from
+// `input` to 32 bytes in `output`.
+inline bool DecodeHexBlock32(const char* input, uint8_t* output) {
+  __m256i packed[2];
+  for (int i = 0; i < 2; ++i) {
+    const __m256i chars = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i*>(input + i * sizeof(__m256i)));
+    const __m256i lower = _mm256_or_si256(chars, _mm256_set1_epi8(0x20));
+    const __m256i is_digit =
+        _mm256_and_si256(_mm256_cmpgt_epi8(chars, _mm256_set1_epi8('0' - 1)),
+                         _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), chars));
+    const __m256i is_letter =
+        _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)),
+                         _mm256_cmpgt_epi8(_mm256_set1_epi8('f' + 1), lower));
+    if (_mm256_movemask_epi8(_mm256_or_si256(is_digit, is_letter)) != -1) {
+      return false;
+    }
+    const __m256i values = _mm256_or_si256(
+        _mm256_and_si256(is_digit,
+                         _mm256_sub_epi8(chars, _mm256_set1_epi8('0'))),
+        _mm256_and_si256(is_letter,
+                         _mm256_sub_epi8(lower, _mm256_set1_epi8('a' - 10))));
+    packed[i] = _mm256_and_si256(
+        _mm256_or_si256(_mm256_slli_epi16(values, 4),
+                        _mm256_srli_epi16(values, 8)),
+        _mm256_set1_epi16(0xff));
+  }
+  // _mm256_packus_epi16 interleaves the 128-bit lanes of its inputs; the
+  // permutation restores the order of the bytes.
+  const __m256i bytes = _mm256_permute4x64_epi64(
+      _mm256_packus_epi16(packed[0], packed[1]), 0b11'01'10'00);
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(output), bytes);
+  return true;
+}
+
+#endif  // defined(__AVX2__)
+
 }  // namespace
 
-absl::StatusOr<std::vector<uint8_t>> ParseHexString(
-    std::string_view hex_string) {
-  if (hex_string.size() % 2 != 0) {
+absl::Status ParseHexStringInto(std::string_view hex_string,
+                                absl::Span<uint8_t> output) {
+  if (hex_string.size() % 2 != 0) return InvalidLengthError();
+  if (output.size() != hex_string.size() / 2) {
     return absl::InvalidArgumentError(
-        "The input string has invalid format. Expected an even number of hex "
-        "digits with no whitespace.");
+        absl::StrFormat("The output buffer has %d bytes, expected %d",
+                        output.size(), hex_string.size() / 2));
   }
-  std::vector<uint8_t> res;
-  while (!hex_string.empty()) {
-    const int hex_value =
-        (ParseHexDigit(hex_string[0]) << 4) + ParseHexDigit(hex_string[1]);
-    if (hex_value >= 256) {
-      return absl::InvalidArgumentError(absl::StrCat(
-          "Invalid hex string format starting with: '", hex_string, "'"));
-    }
-    res.push_back(hex_value);
-    hex_string.remove_prefix(2);
+  uint8_t* out = output.data();
+  // When a block contains a character that is not a hex digit, we leave it to
+  // the scalar decoder to produce the error message.
+#if defined(__AVX2__)
+  while (hex_string.size() >= 64 && DecodeHexBlock32(hex_string.data(), out)) {
+    hex_string.remove_prefix(64);
+    out += 32;
+  }
+#endif  // defined(__AVX2__)
+#if defined(__SSE2__)
+  while (hex_string.size() >= 32 && DecodeHexBlock16(hex_string.data(), out)) {
+    hex_string.remove_prefix(32);
+    out += 16;
   }
+  if (hex_string.size() >= 16 && DecodeHexBlock8(hex_string.data(), out)) {
+    hex_string.remove_prefix(16);
+    out += 8;
+  }
+#endif  // defined(__SSE2__)
+  return ParseHexStringScalar(hex_string, out);
+}
 
+absl::Status ParseHexStringInto(std::string_view hex_string,
+                                std::vector<uint8_t>& output) {
+  if (hex_string.size() % 2 != 0) return InvalidLengthError();
+  output.resize(hex_string.size() / 2);
+  return ParseHexStringInto(hex_string, absl::MakeSpan(output));
+}
+
+absl::StatusOr<std::vector<uint8_t>> ParseHexString(
+    std::string_view hex_string) {
+  std::vector<uint8_t> res;
+  const absl::Status status = ParseHexStringInto(hex_string, res);
+  if (!status.ok()) return status;
   return res;
 }
 
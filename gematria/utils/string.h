@@ -16,10 +16,14 @@
 #define THIRD_PARTY_GEMATRIA_GEMATRIA_UTILS_STRING_H_
 
 #include <cstdint>
+#include <string>
+#include <string_view>
 #include <vector>
 
+#include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/escaping.h"
+#include "absl/types/span.h"
 
 namespace gematria {
 
@@ -32,6 +36,18 @@ namespace gematria {
 absl::StatusOr<std::vector<uint8_t>> ParseHexString(
     std::string_view hex_string);
 
+// Versions of ParseHexString() that store the bytes in a caller-provided
+// buffer instead of allocating a new vector. The span version requires that
+// `output` has exactly `hex_string.size() / 2` elements; the vector version
+// resizes `output` and reuses its capacity. On error, the contents of `output`
+// are unspecified.
+// When compiled with SSE2 or AVX2 enabled, the functions decode up to 32 bytes
+// at a time using SIMD instructions.
+absl::Status ParseHexStringInto(std::string_view hex_string,
+                                absl::Span<uint8_t> output);
+absl::Status ParseHexStringInto(std::string_view hex_string,
+                                std::vector<uint8_t>& output);
+
 // Formats `bytes` as a hex string that can be parsed with ParseHexString().
 inline std::string FormatAsHexString(absl::Span<const uint8_t> bytes) {
   std::string_view bytes_as_string(reinterpret_cast<const char*>(bytes.data()),
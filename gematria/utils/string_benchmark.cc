@@ -0,0 +1,72 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Microbenchmarks for hex string decoding. The benchmarks report the number of
+// decoded bytes per second as "bytes_per_second".
+//
+// Run with:
+//   bazel run -c opt //gematria/utils:string_benchmark
+// To compare the SSE2 and AVX2 versions of the decoder, add --copt=-mavx2.
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "absl/log/absl_check.h"
+#include "benchmark/benchmark.h"
+#include "gematria/utils/string.h"
+
+namespace gematria {
+namespace {
+
+// Returns a hex string that decodes to `num_bytes` bytes.
+std::string MakeHexString(int num_bytes) {
+  static constexpr char kDigits[] = "0123456789abcdefABCDEF";
+  std::string hex_string;
+  hex_string.reserve(2 * num_bytes);
+  for (int i = 0; i < 2 * num_bytes; ++i) {
+    hex_string.push_back(kDigits[(i * 7) % 22]);
+  }
+  return hex_string;
+}
+
+// Decodes a hex string of `state.range(0)` bytes to a newly allocated vector.
+void BM_ParseHexString(benchmark::State& state) {
+  const std::string hex_string = MakeHexString(state.range(0));
+  ABSL_CHECK_OK(ParseHexString(hex_string).status());
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(ParseHexString(hex_string));
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ParseHexString)->Arg(8)->Arg(32)->Arg(128)->Arg(1024);
+
+// Decodes a hex string of `state.range(0)` bytes to a vector that is reused
+// between the iterations.
+void BM_ParseHexStringInto(benchmark::State& state) {
+  const std::string hex_string = MakeHexString(state.range(0));
+  std::vector<uint8_t> buffer;
+  ABSL_CHECK_OK(ParseHexStringInto(hex_string, buffer));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(ParseHexStringInto(hex_string, buffer));
+    benchmark::DoNotOptimize(buffer.data());
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ParseHexStringInto)->Arg(8)->Arg(32)->Arg(128)->Arg(1024);
+
+}  // namespace
+}  // namespace gematria
+
+BENCHMARK_MAIN();
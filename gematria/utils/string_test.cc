@@ -14,10 +14,14 @@
 
 #include "gematria/utils/string.h"
 
+#include <cstdint>
+#include <string>
 #include <string_view>
 #include <vector>
 
 #include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/types/span.h"
 #include "gematria/testing/matchers.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
@@ -57,6 +61,81 @@ TEST(ParseHexStringTest, SomeInvalidHexStrings) {
   }
 }
 
+// Returns a hex string of `num_bytes` bytes with mixed-case digits, and stores
+// the bytes in `bytes`.
+std::string MakeHexString(int num_bytes, std::vector<uint8_t>& bytes) {
+  static constexpr char kDigits[] = "0123456789abcdefABCDEF";
+  bytes.clear();
+  std::string hex_string;
+  for (int i = 0; i < num_bytes; ++i) {
+    const int high = (i * 7) % 22;
+    const int low = (i * 13 + 5) % 22;
+    hex_string.push_back(kDigits[high]);
+    hex_string.push_back(kDigits[low]);
+    bytes.push_back(((high < 16 ? high : high - 6) << 4) |
+                    (low < 16 ? low : low - 6));
+  }
+  return hex_string;
+}
+
+TEST(ParseHexStringTest, LongHexStrings) {
+  // The lengths cover the SIMD block sizes with and without a tail.
+  for (const int num_bytes : {15, 16, 17, 31, 32, 33, 48, 64, 100, 257}) {
+    SCOPED_TRACE(absl::StrCat("num_bytes = ", num_bytes));
+    std::vector<uint8_t> expected_bytes;
+    const std::string hex_string = MakeHexString(num_bytes, expected_bytes);
+    EXPECT_THAT(ParseHexString(hex_string),
+                IsOkAndHolds(ElementsAreArray(expected_bytes)));
+  }
+}
+
+TEST(ParseHexStringTest, InvalidCharacterAtAnyPosition) {
+  // Characters that are close to hex digits in the ASCII table, or that become
+  // hex digits when bits are flipped.
+  static constexpr char kInvalidCharacters[] = {'/', ':', '@', 'G', '`', 'g',
+                                                '\x10', '\x19', '\xc1', ' '};
+  std::vector<uint8_t> bytes;
+  const std::string valid_hex_string = MakeHexString(80, bytes);
+  for (size_t position = 0; position < valid_hex_string.size(); ++position) {
+    for (const char invalid_character : kInvalidCharacters) {
+      std::string hex_string = valid_hex_string;
+      hex_string[position] = invalid_character;
+      SCOPED_TRACE(absl::StrCat("hex_string = ", hex_string));
+      const std::string_view expected_suffix =
+          std::string_view(hex_string).substr(position - position % 2);
+      EXPECT_THAT(ParseHexString(hex_string),
+                  StatusIs(absl::StatusCode::kInvalidArgument,
+                           absl::StrCat("Invalid hex string format starting "
+                                        "with: '",
+                                        expected_suffix, "'")));
+    }
+  }
+}
+
+TEST(ParseHexStringIntoTest, Span) {
+  std::vector<uint8_t> expected_bytes;
+  const std::string hex_string = MakeHexString(40, expected_bytes);
+  std::vector<uint8_t> buffer(40);
+  EXPECT_OK(ParseHexStringInto(hex_string, absl::MakeSpan(buffer)));
+  EXPECT_THAT(buffer, ElementsAreArray(expected_bytes));
+}
+
+TEST(ParseHexStringIntoTest, SpanWithWrongSize) {
+  std::vector<uint8_t> buffer(3);
+  EXPECT_THAT(ParseHexStringInto("abcd", absl::MakeSpan(buffer)),
+              StatusIs(absl::StatusCode::kInvalidArgument));
+}
+
+TEST(ParseHexStringIntoTest, VectorIsResized) {
+  std::vector<uint8_t> buffer(100, 0xff);
+  EXPECT_OK(ParseHexStringInto("abcd", buffer));
+  EXPECT_THAT(buffer, ElementsAreArray({0xab, 0xcd}));
+  EXPECT_OK(ParseHexStringInto("", buffer));
+  EXPECT_THAT(buffer, ElementsAreArray(std::vector<uint8_t>()));
+  EXPECT_THAT(ParseHexStringInto("abc", buffer),
+              StatusIs(absl::StatusCode::kInvalidArgument));
+}
+
 TEST(FormatAsHexStringTest, EmptySpan) {
   EXPECT_EQ(FormatAsHexString(absl::Span<uint8_t>()), "");
 }
@@ -0,0 +1,313 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "gematria/utils/thread_pool.h"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <thread>  // NOLINT(build/c++11)
+#include <utility>
+#include <vector>
+
+#include "absl/log/absl_check.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/synchronization/notification.h"
+
+namespace gematria {
+namespace {
+
+// The pool and the index of the worker running on the current thread.
+thread_local const ThreadPool* current_pool = nullptr;
+thread_local int current_worker_index = -1;
+
+// The initial capacity of the task deque of each worker.
+constexpr int64_t kInitialDequeCapacity = 256;
+
+ThreadPoolOptions OptionsWithNumThreads(int num_threads) {
+  ThreadPoolOptions options;
+  options.num_threads = num_threads;
+  return options;
+}
+
+}  // namespace
+
+// A lock-free single-producer, multi-consumer deque of tasks, as described in
+// "Correct and Efficient Work-Stealing for Weak Memory Models" by Le et al.
+// (PPoPP 2013). Push() and Pop() may be called only by the worker that owns the
+// deque; Steal() may be called by any thread. The buffer grows when it is full;
+// the old buffers may still be read by concurrent calls to Steal(), so they are
+// kept until the deque is destroyed. The deque does not own the tasks.
+class ThreadPool::TaskDeque {
+ public:
+  TaskDeque() {
+    buffers_.push_back(std::make_unique<Buffer>(kInitialDequeCapacity));
+    buffer_.store(buffers_.back().get(), std::memory_order_relaxed);
+  }
+
+  TaskDeque(const TaskDeque&) = delete;
+  TaskDeque& operator=(const TaskDeque&) = delete;
+
+  void Push(Task* task) {
+    const int64_t bottom = bottom_.load(std::memory_order_relaxed);
+    const int64_t top = top_.load(std::memory_order_acquire);
+    Buffer* buffer = buffer_.load(std::memory_order_relaxed);
+    if (bottom - top > buffer->capacity - 1) {
+      buffer = Grow(buffer, top, bottom);
+    }
+    buffer->at(bottom).store(task, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom_.store(bottom + 1, std::memory_order_relaxed);
+  }
+
+  // Removes the most recently pushed task. Returns nullptr when the deque is
+  // empty.
+  Task* Pop() {
+    const int64_t bottom = bottom_.load(std::memory_order_relaxed) - 1;
+    Buffer* const buffer = buffer_.load(std::memory_order_relaxed);
+    bottom_.store(bottom, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t top = top_.load(std::memory_order_relaxed);
+    if (top > bottom) {
+      // The deque was empty.
+      bottom_.store(bottom + 1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    Task* task = buffer->at(bottom).load(std::memory_order_relaxed);
+    if (top == bottom) {
+      // This is the last task in the deque; compete with the thieves for it.
+      if (!top_.compare_exchange_strong(top, top + 1,
+                                        std::memory_order_seq_cst,
+                                        std::memory_order_relaxed)) {
+        task = nullptr;
+      }
+      bottom_.store(bottom + 1, std::memory_order_relaxed);
+    }
+    return task;
+  }
+
+  // Removes the oldest task. Returns nullptr when the deque is empty, or when
+  // another thread took the task first.
+  Task* Steal() {
+    int64_t top = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const int64_t bottom = bottom_.load(std::memory_order_acquire);
+    if (top >= bottom) return nullptr;
+    Buffer* const buffer = buffer_.load(std::memory_order_acquire);
+    Task* const task = buffer->at(top).load(std::memory_order_relaxed);
+    if (!top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+                                      std::memory_order_relaxed)) {
+      return nullptr;
+    }
+    return task;
+  }
+
+ private:
+  // A circular buffer of tasks. The capacity is a power of two.
+  struct Buffer {
+    explicit Buffer(int64_t capacity)
+        : capacity(capacity),
+          slots(std::make_unique<std::atomic<Task*>[]>(capacity)) {}
+
+    std::atomic<Task*>& at(int64_t index) {
+      return slots[index & (capacity - 1)];
+    }
+
+    const int64_t capacity;
+    const std::unique_ptr<std::atomic<Task*>[]> slots;
+  };
+
+  // Replaces `buffer` with a buffer of twice the size that contains the tasks
+  // in the range [top, bottom).
+  Buffer* Grow(Buffer* buffer, int64_t top, int64_t bottom) {
+    buffers_.push_back(std::make_unique<Buffer>(2 * buffer->capacity));
+    Buffer* const new_buffer = buffers_.back().get();
+    for (int64_t i = top; i < bottom; ++i) {
+      new_buffer->at(i).store(buffer->at(i).load(std::memory_order_relaxed),
+                              std::memory_order_relaxed);
+    }
+    buffer_.store(new_buffer, std::memory_order_release);
+    return new_buffer;
+  }
+
+  // The indices of the oldest task and of the slot after the newest task. Only
+  // the owner modifies `bottom_`; `top_` is advanced by successful steals and
+  // by the owner when it pops the last task.
+  alignas(64) std::atomic<int64_t> top_ = 0;
+  alignas(64) std::atomic<int64_t> bottom_ = 0;
+  std::atomic<Buffer*> buffer_ = nullptr;
+  // All buffers used by the deque; accessed only by the owner.
+  std::vector<std::unique_ptr<Buffer>> buffers_;
+};
+
+struct alignas(64) ThreadPool::Worker {
+  TaskDeque deque;
+  std::thread thread;
+};
+
+ThreadPool::ThreadPool(int num_threads)
+    : ThreadPool(OptionsWithNumThreads(num_threads)) {}
+
+ThreadPool::ThreadPool(ThreadPoolOptions options)
+    : on_worker_start_(std::move(options.on_worker_start)),
+      on_worker_stop_(std::move(options.on_worker_stop)) {
+  ABSL_CHECK_GT(options.num_threads, 0);
+  // A worker may steal from the deque of any other worker as soon as its
+  // thread starts, so `workers_` must be complete and never resized while the
+  // threads run. The destructor relies on the same invariant: the threads are
+  // joined before any deque is destroyed.
+  workers_.reserve(options.num_threads);
+  for (int i = 0; i < options.num_threads; ++i) {
+    workers_.push_back(std::make_unique<Worker>());
+  }
+  for (int i = 0; i < options.num_threads; ++i) {
+    workers_[i]->thread = std::thread(&ThreadPool::WorkerLoop, this, i);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  ABSL_CHECK_LT(CurrentWorkerIndex(), 0)
+      << "A thread pool can't be destroyed from its own task";
+  {
+    absl::MutexLock lock(&mutex_);
+    stopping_ = true;
+  }
+  for (const std::unique_ptr<Worker>& worker : workers_) {
+    worker->thread.join();
+  }
+}
+
+void ThreadPool::Schedule(Task task) {
+  ABSL_CHECK(task != nullptr);
+  auto* const heap_task = new Task(std::move(task));
+  const int worker_index = CurrentWorkerIndex();
+  if (worker_index >= 0) {
+    workers_[worker_index]->deque.Push(heap_task);
+    num_pending_tasks_.fetch_add(1, std::memory_order_seq_cst);
+    WakeUpWorkers();
+    return;
+  }
+  // Releasing the mutex wakes up the sleeping workers.
+  absl::MutexLock lock(&mutex_);
+  ABSL_CHECK(!stopping_);
+  shared_queue_.push_back(heap_task);
+  shared_queue_size_.fetch_add(1, std::memory_order_relaxed);
+  num_pending_tasks_.fetch_add(1, std::memory_order_seq_cst);
+}
+
+void ThreadPool::ParallelFor(int64_t num_items,
+                             const std::function<void(int64_t)>& fn) {
+  if (num_items <= 0) return;
+  std::atomic<int64_t> num_remaining_items = num_items;
+  absl::Notification done;
+  for (int64_t i = 0; i < num_items; ++i) {
+    Schedule([i, &fn, &num_remaining_items, &done]() {
+      fn(i);
+      if (num_remaining_items.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        done.Notify();
+      }
+    });
+  }
+  const int worker_index = CurrentWorkerIndex();
+  if (worker_index < 0) {
+    done.WaitForNotification();
+    return;
+  }
+  // Help with the tasks instead of blocking the worker.
+  while (!done.HasBeenNotified()) {
+    Task* const task = FindTask(worker_index);
+    if (task != nullptr) {
+      RunTask(task);
+    } else {
+      std::this_thread::yield();
+    }
+  }
+  // Notify() may still be running; wait until it releases the notification.
+  done.WaitForNotification();
+}
+
+int ThreadPool::CurrentWorkerIndex() const {
+  return current_pool == this ? current_worker_index : -1;
+}
+
+void ThreadPool::WorkerLoop(int worker_index) {
+  current_pool = this;
+  current_worker_index = worker_index;
+  if (on_worker_start_) on_worker_start_(worker_index);
+  while (true) {
+    Task* const task = FindTask(worker_index);
+    if (task != nullptr) {
+      RunTask(task);
+      continue;
+    }
+    absl::MutexLock lock(&mutex_);
+    if (stopping_ &&
+        num_pending_tasks_.load(std::memory_order_seq_cst) == 0) {
+      break;
+    }
+    // The increment must be visible before the worker checks the number of
+    // pending tasks in the condition; see WakeUpWorkers().
+    num_sleeping_workers_.fetch_add(1, std::memory_order_seq_cst);
+    mutex_.Await(
+        absl::Condition(this, &ThreadPool::HasPendingTasksOrStopping));
+    num_sleeping_workers_.fetch_sub(1, std::memory_order_relaxed);
+  }
+  if (on_worker_stop_) on_worker_stop_(worker_index);
+  current_pool = nullptr;
+  current_worker_index = -1;
+}
+
+ThreadPool::Task* ThreadPool::FindTask(int worker_index) {
+  Task* task = workers_[worker_index]->deque.Pop();
+  if (task == nullptr &&
+      shared_queue_size_.load(std::memory_order_relaxed) > 0) {
+    absl::MutexLock lock(&mutex_);
+    if (!shared_queue_.empty()) {
+      task = shared_queue_.front();
+      shared_queue_.pop_front();
+      shared_queue_size_.fetch_sub(1, std::memory_order_relaxed);
+    }
+  }
+  const int num_workers = num_threads();
+  for (int i = 1; task == nullptr && i < num_workers; ++i) {
+    task = workers_[(worker_index + i) % num_workers]->deque.Steal();
+  }
+  if (task != nullptr) {
+    num_pending_tasks_.fetch_sub(1, std::memory_order_relaxed);
+  }
+  return task;
+}
+
+void ThreadPool::RunTask(Task* task) {
+  (*task)();
+  delete task;
+}
+
+void ThreadPool::WakeUpWorkers() {
+  // The number of pending tasks was increased with a sequentially consistent
+  // operation, so either this load sees the increment of the number of
+  // sleeping workers, or the worker sees the new task when it evaluates the
+  // condition. In the former case, releasing the mutex re-evaluates the
+  // conditions of the sleeping workers.
+  if (num_sleeping_workers_.load(std::memory_order_seq_cst) > 0) {
+    absl::MutexLock lock(&mutex_);
+  }
+}
+
+bool ThreadPool::HasPendingTasksOrStopping() const {
+  return num_pending_tasks_.load(std::memory_order_seq_cst) > 0 || stopping_;
+}
+
+}  // namespace gematria
@@ -0,0 +1,199 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// A work-stealing thread pool shared by the parallel stages of the data
+// pipelines, e.g. the import of basic blocks and the construction of graphs.
+//
+// Each worker thread has its own lock-free deque of tasks. Tasks scheduled from
+// a worker thread are pushed to the deque of that worker and popped in the LIFO
+// order, which keeps the data of recently scheduled tasks in the cache of the
+// worker; idle workers steal the oldest tasks from the deques of other workers.
+// Tasks scheduled from other threads are added to a shared queue. Workers that
+// do not find any task go to sleep, and they are woken up only when new tasks
+// are scheduled, so an idle pool does not consume CPU time.
+//
+// State that is expensive to create and that can't be shared between threads,
+// e.g. a BHiveImporter with its disassembler and instruction printer, or a
+// graph builder, can be kept per worker with WorkerLocal.
+
+#ifndef THIRD_PARTY_GEMATRIA_GEMATRIA_UTILS_THREAD_POOL_H_
+#define THIRD_PARTY_GEMATRIA_GEMATRIA_UTILS_THREAD_POOL_H_
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <thread>  // NOLINT(build/c++11)
+#include <utility>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/log/absl_check.h"
+#include "absl/synchronization/mutex.h"
+
+namespace gematria {
+
+struct ThreadPoolOptions {
+  // The number of worker threads. Must be positive.
+  int num_threads = 1;
+  // When set, called on each worker thread with the index of the worker before
+  // the worker runs any task.
+  std::function<void(int worker_index)> on_worker_start;
+  // When set, called on each worker thread with the index of the worker after
+  // the worker ran its last task, when the pool is being destroyed.
+  std::function<void(int worker_index)> on_worker_stop;
+};
+
+// A fixed-size pool of worker threads that run tasks scheduled with
+// Schedule() or ParallelFor(). All methods are thread-safe, and they can be
+// called also from the tasks running in the pool.
+//
+// Typical use:
+//   ThreadPool pool(num_threads);
+//   WorkerLocal<BasicBlockGraphBuilder> builders(pool, [&](int) {
+//     return std::make_unique<BasicBlockGraphBuilder>(...);
+//   });
+//   pool.ParallelFor(num_shards, [&](int64_t shard) {
+//     BasicBlockGraphBuilder& builder = builders.Get();
+//     ...
+//   });
+class ThreadPool {
+ public:
+  using Task = std::function<void()>;
+
+  explicit ThreadPool(int num_threads);
+  explicit ThreadPool(ThreadPoolOptions options);
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // Runs all tasks that were already scheduled, including the tasks they
+  // schedule, and then stops the worker threads. Must not be called from a
+  // task running in the pool.
+  ~ThreadPool();
+
+  // Returns the number of worker threads.
+  int num_threads() const { return static_cast<int>(workers_.size()); }
+
+  // Schedules `task` to run on one of the worker threads. Returns immediately;
+  // the task may start before the method returns.
+  void Schedule(Task task);
+
+  // Calls `fn(i)` for each i in the range [0, num_items) on the worker
+  // threads, and returns when all the calls have completed. Each item is a
+  // separate task, so the items should be coarse enough to amortize the cost of
+  // scheduling. When called from a task running in the pool, the calling
+  // worker runs other tasks while it waits, so that nested calls do not
+  // deadlock.
+  void ParallelFor(int64_t num_items, const std::function<void(int64_t)>& fn);
+
+  // Returns the index of the worker that runs the calling thread, or -1 when
+  // the calling thread is not a worker thread of this pool. The indices are in
+  // the range [0, num_threads()).
+  int CurrentWorkerIndex() const;
+
+ private:
+  class TaskDeque;
+  struct Worker;
+
+  // The body of the worker thread with the given index.
+  void WorkerLoop(int worker_index);
+
+  // Removes a task from the deque of the worker at `worker_index`, from the
+  // shared queue, or from the deque of another worker, in this order. Returns
+  // nullptr when no task was found.
+  Task* FindTask(int worker_index);
+  // Runs and deletes `task`.
+  static void RunTask(Task* task);
+
+  // Wakes up the sleeping workers, if there are any.
+  void WakeUpWorkers();
+
+  bool HasPendingTasksOrStopping() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  std::function<void(int worker_index)> on_worker_start_;
+  std::function<void(int worker_index)> on_worker_stop_;
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+
+  // The number of tasks that were scheduled but not yet taken by a worker.
+  std::atomic<int64_t> num_pending_tasks_ = 0;
+  // The number of workers that sleep in WorkerLoop() or that are about to.
+  std::atomic<int> num_sleeping_workers_ = 0;
+  // The number of tasks in `shared_queue_`; allows the workers to check the
+  // queue without taking the mutex.
+  std::atomic<int64_t> shared_queue_size_ = 0;
+
+  // Protects the shared queue, and is used by the sleeping workers to wait for
+  // new tasks.
+  mutable absl::Mutex mutex_;
+  std::deque<Task*> shared_queue_ ABSL_GUARDED_BY(mutex_);
+  bool stopping_ ABSL_GUARDED_BY(mutex_) = false;
+};
+
+// Keeps a separate instance of `T` for each worker thread of a ThreadPool. The
+// instances are created on first use by the worker thread that uses them, by
+// calling the factory with the index of the worker, and they are destroyed with
+// the WorkerLocal object. The WorkerLocal object must not outlive the pool, and
+// it must not be destroyed while tasks that use it are running.
+template <typename T>
+class WorkerLocal {
+ public:
+  using Factory = std::function<std::unique_ptr<T>(int worker_index)>;
+
+  WorkerLocal(const ThreadPool& pool, Factory factory)
+      : pool_(pool),
+        factory_(std::move(factory)),
+        instances_(pool.num_threads()) {
+    ABSL_CHECK(factory_ != nullptr);
+  }
+
+  WorkerLocal(const WorkerLocal&) = delete;
+  WorkerLocal& operator=(const WorkerLocal&) = delete;
+
+  // Returns the instance of the calling worker thread. Must be called from a
+  // worker thread of the pool.
+  T& Get() {
+    const int worker_index = pool_.CurrentWorkerIndex();
+    ABSL_CHECK_GE(worker_index, 0)
+        << "WorkerLocal::Get() called outside of the thread pool";
+    // Each element is accessed only by its own worker, so no synchronization
+    // is needed.
+    std::unique_ptr<T>& instance = instances_[worker_index];
+    if (instance == nullptr) {
+      instance = factory_(worker_index);
+      ABSL_CHECK(instance != nullptr);
+    }
+    return *instance;
+  }
+
+  // Calls `fn` for each instance that was created so far, in the order of the
+  // worker indices. Must not be called while tasks that use the instances are
+  // running.
+  void ForEach(const std::function<void(int worker_index, T&)>& fn) {
+    for (int i = 0; i < static_cast<int>(instances_.size()); ++i) {
+      if (instances_[i] != nullptr) fn(i, *instances_[i]);
+    }
+  }
+
+ private:
+  const ThreadPool& pool_;
+  const Factory factory_;
+  std::vector<std::unique_ptr<T>> instances_;
+};
+
+}  // namespace gematria
+
+#endif  // THIRD_PARTY_GEMATRIA_GEMATRIA_UTILS_THREAD_POOL_H_
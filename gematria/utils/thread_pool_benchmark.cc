@@ -0,0 +1,107 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Scaling benchmarks for ThreadPool and BoundedQueue, with 1 to 64 threads.
+// The benchmarks report the number of processed items per second of wall time
+// as "items_per_second"; with perfect scaling, the value grows linearly with
+// the number of threads up to the number of cores of the machine.
+//
+// Run with:
+//   bazel run -c opt //gematria/utils:thread_pool_benchmark
+
+#include <cstdint>
+#include <optional>
+
+#include "benchmark/benchmark.h"
+#include "gematria/utils/bounded_queue.h"
+#include "gematria/utils/thread_pool.h"
+
+namespace gematria {
+namespace {
+
+// The number of items processed in each iteration of the ThreadPool
+// benchmarks.
+constexpr int64_t kNumItems = 1024;
+
+// A CPU-bound computation of roughly `num_steps` dependent operations.
+uint64_t Spin(int num_steps, uint64_t seed) {
+  uint64_t value = seed;
+  for (int i = 0; i < num_steps; ++i) {
+    value = value * 6364136223846793005ULL + 1442695040888963407ULL;
+  }
+  return value;
+}
+
+// Runs kNumItems CPU-bound items with ParallelFor() on a pool with
+// `state.range(0)` threads. `state.range(1)` is the number of steps of each
+// item; small items measure the overhead of scheduling and stealing.
+void BM_ParallelFor(benchmark::State& state) {
+  ThreadPool pool(state.range(0));
+  const int num_steps = state.range(1);
+  for (auto _ : state) {
+    pool.ParallelFor(kNumItems, [num_steps](int64_t i) {
+      benchmark::DoNotOptimize(Spin(num_steps, i));
+    });
+  }
+  state.SetItemsProcessed(state.iterations() * kNumItems);
+}
+BENCHMARK(BM_ParallelFor)
+    ->ArgNames({"threads", "steps"})
+    ->ArgsProduct({benchmark::CreateRange(1, 64, /*multi=*/2), {100, 10000}})
+    ->UseRealTime();
+
+// Like BM_ParallelFor, but each item schedules its work from a worker thread
+// as two halves, so that most of the tasks are taken from the deques of the
+// workers rather than from the shared queue.
+void BM_NestedParallelFor(benchmark::State& state) {
+  ThreadPool pool(state.range(0));
+  const int num_steps = state.range(1);
+  for (auto _ : state) {
+    pool.ParallelFor(kNumItems / 2, [&pool, num_steps](int64_t i) {
+      pool.ParallelFor(2, [i, num_steps](int64_t j) {
+        benchmark::DoNotOptimize(Spin(num_steps, 2 * i + j));
+      });
+    });
+  }
+  state.SetItemsProcessed(state.iterations() * kNumItems);
+}
+BENCHMARK(BM_NestedParallelFor)
+    ->ArgNames({"threads", "steps"})
+    ->ArgsProduct({benchmark::CreateRange(1, 64, /*multi=*/2), {100, 10000}})
+    ->UseRealTime();
+
+// Each benchmark thread pushes a value to a shared queue and pops a value from
+// it in each iteration. Measures the throughput of the lock-free paths of the
+// queue under contention.
+void BM_BoundedQueue(benchmark::State& state) {
+  static BoundedQueue<int64_t>* const queue =
+      new BoundedQueue<int64_t>(/*capacity=*/1024);
+  int64_t value = state.thread_index();
+  for (auto _ : state) {
+    while (!queue->TryPush(int64_t{value})) {
+    }
+    std::optional<int64_t> popped;
+    while (!(popped = queue->TryPop()).has_value()) {
+    }
+    value = *popped;
+  }
+  benchmark::DoNotOptimize(value);
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_BoundedQueue)->ThreadRange(1, 64)->UseRealTime();
+
+}  // namespace
+}  // namespace gematria
+
+BENCHMARK_MAIN();
@@ -0,0 +1,202 @@
+// Copyright 2023 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "gematria/utils/thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <thread>  // NOLINT(build/c++11)
+#include <utility>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace gematria {
+namespace {
+
+using ::testing::AllOf;
+using ::testing::Each;
+using ::testing::ElementsAre;
+using ::testing::Ge;
+using ::testing::Lt;
+
+TEST(ThreadPoolTest, ScheduleRunsAllTasks) {
+  constexpr int kNumTasks = 10000;
+  std::atomic<int> num_runs = 0;
+  {
+    ThreadPool pool(4);
+    EXPECT_EQ(pool.num_threads(), 4);
+    for (int i = 0; i < kNumTasks; ++i) {
+      pool.Schedule([&num_runs]() { num_runs.fetch_add(1); });
+    }
+    // The destructor runs all scheduled tasks.
+  }
+  EXPECT_EQ(num_runs.load(), kNumTasks);
+}
+
+TEST(ThreadPoolTest, TasksScheduledFromTasks) {
+  std::atomic<int> num_runs = 0;
+  // Creates a binary tree of tasks of the given depth. Declared before the
+  // pool, so that it outlives the tasks.
+  std::function<void(int)> spawn;
+  {
+    ThreadPool pool(3);
+    spawn = [&](int depth) {
+      num_runs.fetch_add(1);
+      if (depth == 0) return;
+      pool.Schedule([&spawn, depth]() { spawn(depth - 1); });
+      pool.Schedule([&spawn, depth]() { spawn(depth - 1); });
+    };
+    pool.Schedule([&spawn]() { spawn(10); });
+  }
+  EXPECT_EQ(num_runs.load(), (1 << 11) - 1);
+}
+
+TEST(ThreadPoolTest, ParallelFor) {
+  constexpr int kNumItems = 1000;
+  ThreadPool pool(4);
+  std::vector<std::atomic<int>> runs(kNumItems);
+  pool.ParallelFor(kNumItems, [&runs](int64_t i) { runs[i].fetch_add(1); });
+  for (const std::atomic<int>& num_runs : runs) {
+    EXPECT_EQ(num_runs.load(), 1);
+  }
+  // An empty range returns immediately.
+  pool.ParallelFor(0, [](int64_t) { FAIL(); });
+}
+
+TEST(ThreadPoolTest, NestedParallelFor) {
+  ThreadPool pool(2);
+  std::atomic<int> num_runs = 0;
+  // The outer items block their workers; this would deadlock if the workers
+  // did not run the inner items while waiting.
+  pool.ParallelFor(8, [&](int64_t) {
+    pool.ParallelFor(100, [&](int64_t) { num_runs.fetch_add(1); });
+  });
+  EXPECT_EQ(num_runs.load(), 800);
+}
+
+TEST(ThreadPoolTest, CurrentWorkerIndex) {
+  constexpr int kNumThreads = 3;
+  ThreadPool pool(kNumThreads);
+  ThreadPool other_pool(1);
+  EXPECT_EQ(pool.CurrentWorkerIndex(), -1);
+  std::vector<int> indices(100);
+  std::vector<int> other_indices(100);
+  pool.ParallelFor(100, [&](int64_t i) {
+    indices[i] = pool.CurrentWorkerIndex();
+    other_indices[i] = other_pool.CurrentWorkerIndex();
+  });
+  EXPECT_THAT(indices, Each(AllOf(Ge(0), Lt(kNumThreads))));
+  EXPECT_THAT(other_indices, Each(-1));
+}
+
+TEST(ThreadPoolTest, IdleWorkersStealTasks) {
+  constexpr int kNumThreads = 4;
+  ThreadPool pool(kNumThreads);
+  std::atomic<int> num_started = 0;
+  std::atomic<bool> all_started = false;
+  absl::Mutex mutex;
+  std::vector<int> worker_indices;
+  // All tasks are pushed to the deque of the worker that runs the first task.
+  // They can all run at the same time only when the other workers steal them.
+  pool.ParallelFor(1, [&](int64_t) {
+    pool.ParallelFor(kNumThreads, [&](int64_t) {
+      {
+        absl::MutexLock lock(&mutex);
+        worker_indices.push_back(pool.CurrentWorkerIndex());
+      }
+      num_started.fetch_add(1);
+      const absl::Time deadline = absl::Now() + absl::Seconds(30);
+      while (num_started.load() < kNumThreads && absl::Now() < deadline) {
+        std::this_thread::yield();
+      }
+      if (num_started.load() == kNumThreads) all_started = true;
+    });
+  });
+  EXPECT_TRUE(all_started.load());
+  absl::MutexLock lock(&mutex);
+  std::sort(worker_indices.begin(), worker_indices.end());
+  EXPECT_THAT(worker_indices, ElementsAre(0, 1, 2, 3));
+}
+
+TEST(ThreadPoolTest, WorkerHooks) {
+  constexpr int kNumThreads = 4;
+  absl::Mutex mutex;
+  std::vector<int> started;
+  std::vector<int> stopped;
+  {
+    ThreadPoolOptions options;
+    options.num_threads = kNumThreads;
+    options.on_worker_start = [&](int worker_index) {
+      absl::MutexLock lock(&mutex);
+      started.push_back(worker_index);
+    };
+    options.on_worker_stop = [&](int worker_index) {
+      absl::MutexLock lock(&mutex);
+      stopped.push_back(worker_index);
+    };
+    ThreadPool pool(std::move(options));
+    pool.ParallelFor(100, [](int64_t) {});
+  }
+  std::sort(started.begin(), started.end());
+  std::sort(stopped.begin(), stopped.end());
+  EXPECT_THAT(started, ElementsAre(0, 1, 2, 3));
+  EXPECT_THAT(stopped, ElementsAre(0, 1, 2, 3));
+}
+
+TEST(ThreadPoolTest, WorkerLocal) {
+  struct State {
+    int worker_index = -1;
+    int64_t sum = 0;
+  };
+  constexpr int kNumThreads = 4;
+  ThreadPool pool(kNumThreads);
+  std::atomic<int> num_created = 0;
+  WorkerLocal<State> states(pool, [&num_created](int worker_index) {
+    num_created.fetch_add(1);
+    auto state = std::make_unique<State>();
+    state->worker_index = worker_index;
+    return state;
+  });
+  std::atomic<int> num_mismatched = 0;
+  pool.ParallelFor(1000, [&](int64_t i) {
+    State& state = states.Get();
+    if (state.worker_index != pool.CurrentWorkerIndex()) {
+      num_mismatched.fetch_add(1);
+    }
+    state.sum += i;
+  });
+  EXPECT_EQ(num_mismatched.load(), 0);
+  EXPECT_LE(num_created.load(), kNumThreads);
+
+  int64_t sum = 0;
+  int num_instances = 0;
+  states.ForEach([&](int worker_index, State& state) {
+    EXPECT_EQ(state.worker_index, worker_index);
+    sum += state.sum;
+    ++num_instances;
+  });
+  EXPECT_EQ(num_instances, num_created.load());
+  EXPECT_EQ(sum, 999 * 1000 / 2);
+}
+
+}  // namespace
+}  // namespace gematria
@@ -13,7 +13,7 @@
 # limitations under the License.
 """Contains portable rules for building and testing Python code."""
 
-load("@pybind11_bazel//:build_defs.bzl", "pybind_extension")
+load("@pybind11_bazel//:build_defs.bzl", "pybind_extension", "pybind_library")
 load("@rules_python//python:defs.bzl", "py_binary", "py_library", "py_test")
 
 def gematria_py_binary(name = None, **kwargs):
@@ -27,3 +27,6 @@ def gematria_py_test(name = None, **kwargs):
 
 def gematria_pybind_extension(name = None, **kwargs):
     pybind_extension(name = name, **kwargs)
+
+def gematria_pybind_library(name = None, **kwargs):
+    pybind_library(name = name, **kwargs)